@@ -28,16 +28,21 @@ elif platform.system() == 'Linux':
 
 include_dirs = ['ttcr', 'boost_1_72_0', 'eigen-3.3.7', np.get_include()]
 
+# shm_open (ShotProcesses.h) lives in librt with older glibc
+libraries = ['rt'] if platform.system() == 'Linux' else []
+
 extensions = [
     Extension('ttcrpy.rgrid',
               sources=['ttcrpy/rgrid.pyx', 'ttcrpy/verbose.cpp'],  # additional source file(s)
               include_dirs=include_dirs,
+              libraries=libraries,
               language='c++',             # generate C++ code
               extra_compile_args=extra_compile_args,
               ),
     Extension('ttcrpy.tmesh',
               sources=['ttcrpy/tmesh.pyx', 'ttcrpy/verbose.cpp'],  # additional source file(s)
               include_dirs=include_dirs,
+              libraries=libraries,
               language='c++',             # generate C++ code
               extra_compile_args=extra_compile_args,
               ),
@@ -0,0 +1,201 @@
+//
+//  local_origin.cpp
+//  ttcr
+//
+//  Created by agent on 2026-10-19.
+//  Copyright (c) 2026 agent. All rights reserved.
+//
+
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// Grids in single precision built relative to an origin (Grid3D::setOrigin),
+// compared with the same grids in double precision at the coordinates of the
+// model (UTM-like).  Run by test_rgrid3d.py; prints the differences and
+// returns 1 if they are too large.
+
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+#include "Cell.h"
+#include "Grid3Drcsp.h"
+#include "Grid3Drnfs.h"
+#include "RayPaths.h"
+
+using namespace ttcr;
+
+namespace {
+
+    const uint32_t nc = 20;
+    const double d = 10.0;
+    const double xo = 600000.0;
+    const double yo = 5000000.0;
+    const double zo = 100.0;
+
+    // slowness increasing with depth and along x, in local coordinates
+    double slowness(const double x, const double z) {
+        return 1.0/(1500.0 + 2.0*z + 0.5*x);
+    }
+
+    template<typename T>
+    std::vector<sxyz<T>> points(const std::vector<sxyz<double>>& p) {
+        std::vector<sxyz<T>> q(p.size());
+        for ( size_t n=0; n<p.size(); ++n ) {
+            q[n] = sxyz<T>(static_cast<T>(p[n].x),
+                           static_cast<T>(p[n].y),
+                           static_cast<T>(p[n].z));
+        }
+        return q;
+    }
+
+    double length(const std::vector<sxyz<double>>& ray) {
+        double l = 0.0;
+        for ( size_t i=1; i<ray.size(); ++i ) l += ray[i].getDistance(ray[i-1]);
+        return l;
+    }
+
+    struct results {
+        std::vector<double> tt;
+        std::vector<std::vector<sxyz<double>>> rays;
+        std::vector<double> ttPts;        // getTraveltimes
+        double xmin;
+    };
+
+    template<typename T>
+    void run(const Grid3D<T,uint32_t>& g,
+             const std::vector<sxyz<double>>& Tx,
+             const std::vector<sxyz<double>>& Rx,
+             results& res, double& rayDiff) {
+        std::vector<sxyz<T>> tx = points<T>(Tx);
+        std::vector<sxyz<T>> rx = points<T>(Rx);
+        std::vector<T> t0(tx.size(), 0);
+        std::vector<T> tt;
+        std::vector<std::vector<sxyz<T>>> r_data;
+        g.raytrace(tx, t0, rx, tt, r_data);
+
+        res.tt.assign(tt.begin(), tt.end());
+        res.rays.resize( r_data.size() );
+        for ( size_t n=0; n<r_data.size(); ++n ) {
+            for ( size_t i=0; i<r_data[n].size(); ++i ) {
+                res.rays[n].push_back( sxyz<double>(r_data[n][i].x, r_data[n][i].y,
+                                                    r_data[n][i].z) );
+            }
+        }
+
+        // the raypaths in flat storage are shifted as r_data
+        RayPaths<float,uint32_t> rays;
+        std::vector<T> tt2;
+        g.raytrace(tx, t0, rx, tt2, rays);
+        rayDiff = 0.0;
+        for ( size_t n=0; n<rays.size(); ++n ) {
+            for ( size_t i=0; i<rays.getNumberOfPoints(n); ++i ) {
+                const float* p = rays.getPoint(n, i);
+                const sxyz<T>& q = r_data[n][i];
+                rayDiff = std::max(rayDiff, std::abs(p[0]-double(q.x)));
+                rayDiff = std::max(rayDiff, std::abs(p[1]-double(q.y)));
+                rayDiff = std::max(rayDiff, std::abs(p[2]-double(q.z)));
+            }
+        }
+
+        std::vector<T> ttp;
+        g.getTraveltimes(rx, ttp);
+        res.ttPts.assign(ttp.begin(), ttp.end());
+        res.xmin = g.getXmin();
+    }
+
+    bool compare(const char* name, const results& ref, const results& r,
+                 const double rayDiff) {
+        // shortest paths may differ by nodes of equal traveltime: the ends
+        // and lengths of the rays are compared
+        double dt = 0.0, dtp = 0.0, dr = 0.0, dl = 0.0;
+        for ( size_t n=0; n<ref.tt.size(); ++n ) {
+            dt = std::max(dt, std::abs(r.tt[n]-ref.tt[n])/ref.tt[n]);
+            dtp = std::max(dtp, std::abs(r.ttPts[n]-ref.ttPts[n])/ref.ttPts[n]);
+            dr = std::max(dr, r.rays[n].front().getDistance(ref.rays[n].front()));
+            dr = std::max(dr, r.rays[n].back().getDistance(ref.rays[n].back()));
+            const double l = length(ref.rays[n]);
+            dl = std::max(dl, std::abs(length(r.rays[n])-l)/l);
+        }
+        std::cout << name << ": traveltimes " << dt << ", getTraveltimes " << dtp
+        << ", ends of rays " << dr << ", lengths " << dl
+        << ", flat rays " << rayDiff
+        << ", xmin " << r.xmin-ref.xmin << '\n';
+        // coordinates at 5e6 m in float are known within 0.25 m, which
+        // bounds the precision of points and lengths of the rays; with the
+        // grid in float at these coordinates, traveltimes of fast sweeping
+        // differ by about 1e-3
+        return dt < 1.e-5 && dtp < 1.e-5 && dr < 1.0 && dl < 1.e-2 && rayDiff < 1.0 &&
+        r.xmin == ref.xmin;
+    }
+}
+
+int main() {
+    // sources and receivers at integer coordinates, exact in float
+    std::vector<sxyz<double>> Tx(1, sxyz<double>(xo+23.0, yo+41.0, zo+12.0));
+    std::vector<sxyz<double>> Rx;
+    for ( int i=1; i<10; ++i ) {
+        Rx.push_back( sxyz<double>(xo+20.0*i+5.0, yo+190.0-17.0*i, zo+8.0+19.0*i) );
+    }
+
+    bool ok = true;
+    {
+        // shortest path, slowness in cells
+        typedef Cell<double,Node3Dcsp<double,uint32_t>,sxyz<double>> cd;
+        typedef Cell<float,Node3Dcsp<float,uint32_t>,sxyz<float>> cf;
+        Grid3Drcsp<double,uint32_t,cd> gd(nc, nc, nc, d, d, d, xo, yo, zo,
+                                          3, 3, 3, false, 1);
+        Grid3Drcsp<float,uint32_t,cf> gf(nc, nc, nc, d, d, d, 0, 0, 0,
+                                         3, 3, 3, false, 1);
+        gf.setOrigin(sxyz<double>(xo, yo, zo));
+        std::vector<double> sd;
+        for ( uint32_t k=0; k<nc; ++k )
+            for ( uint32_t j=0; j<nc; ++j )
+                for ( uint32_t i=0; i<nc; ++i )
+                    sd.push_back( slowness((i+0.5)*d, (k+0.5)*d) );
+        gd.setSlowness(sd);
+        gf.setSlowness(std::vector<float>(sd.begin(), sd.end()));
+
+        results rd, rf;
+        double dummy, rayDiff;
+        run(gd, Tx, Rx, rd, dummy);
+        run(gf, Tx, Rx, rf, rayDiff);
+        ok = compare("Grid3Drcsp", rd, rf, rayDiff) && ok;
+    }
+    {
+        // fast sweeping, slowness at nodes
+        Grid3Drnfs<double,uint32_t> gd(nc, nc, nc, d, xo, yo, zo,
+                                       1.e-15, 20, false, true, false, 1);
+        Grid3Drnfs<float,uint32_t> gf(nc, nc, nc, d, 0, 0, 0,
+                                      1.e-7, 20, false, true, false, 1);
+        gf.setOrigin(sxyz<double>(xo, yo, zo));
+        std::vector<double> sd;
+        for ( uint32_t k=0; k<=nc; ++k )
+            for ( uint32_t j=0; j<=nc; ++j )
+                for ( uint32_t i=0; i<=nc; ++i )
+                    sd.push_back( slowness(i*d, k*d) );
+        gd.setSlowness(sd);
+        gf.setSlowness(std::vector<float>(sd.begin(), sd.end()));
+
+        results rd, rf;
+        double dummy, rayDiff;
+        run(gd, Tx, Rx, rd, dummy);
+        run(gf, Tx, Rx, rf, rayDiff);
+        ok = compare("Grid3Drnfs", rd, rf, rayDiff) && ok;
+    }
+    return ok ? 0 : 1;
+}
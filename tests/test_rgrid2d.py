@@ -19,6 +19,59 @@ import ttcrpy.rgrid as rg
 #     def test_Grid2Dfs(self):
         
 
+class TestGrid2dAniso(unittest.TestCase):
+
+    def setUp(self):
+        self.x = np.arange(0., 20.1, 1.0)
+        self.z = np.arange(0., 20.1, 1.0)
+        shape = (self.x.size-1, self.z.size-1)
+        rng = np.random.default_rng(3)
+        self.slowness = rng.uniform(0.8, 1.2, shape)
+        self.xi = rng.uniform(0.8, 1.2, shape)
+        self.theta = rng.uniform(-0.5, 0.5, shape)
+        self.src = np.array([[3.3, 5.0]])
+        self.rcv = np.c_[0.19*np.arange(50)+10.0, 19.0-0.3*np.arange(50)]
+
+    def check_tables(self, g, g0, msg):
+        tt = g.raytrace(self.src, self.rcv)
+        tt0 = g0.raytrace(self.src, self.rcv)
+        self.assertLess(np.max(np.abs(tt-tt0)), 1.e-10, msg)
+
+    def test_edge_tables(self):
+        for aniso in ('elliptical', 'tilted_elliptical', 'vti_psv'):
+            g = rg.Grid2d(self.x, self.z, method='SPM', aniso=aniso,
+                          nsnx=5, nsnz=5)
+            g0 = rg.Grid2d(self.x, self.z, method='SPM', aniso=aniso,
+                           nsnx=5, nsnz=5)
+            g0.set_edge_tables(0)
+            self.assertTrue(g.has_edge_tables())
+            self.assertFalse(g0.has_edge_tables())
+            for grid in (g, g0):
+                if aniso == 'vti_psv':
+                    grid.set_Vp0(2.0/self.slowness)
+                    grid.set_Vs0(1.0/self.slowness)
+                    grid.set_epsilon(0.2*self.xi-0.1)
+                    grid.set_delta(0.1*self.xi-0.05)
+                else:
+                    grid.set_slowness(self.slowness)
+                    grid.set_xi(self.xi)
+                    if aniso == 'tilted_elliptical':
+                        grid.set_tilt_angle(self.theta)
+            self.check_tables(g, g0, aniso+': tables and computeDt differ')
+            # tables are stale after the parameters change
+            for grid in (g, g0):
+                if aniso == 'vti_psv':
+                    grid.set_epsilon(0.1*self.xi)
+                elif aniso == 'tilted_elliptical':
+                    grid.set_tilt_angle(-self.theta)
+                else:
+                    grid.set_xi(self.xi[::-1, :])
+            self.check_tables(g, g0, aniso+': stale tables used')
+        # tables are dropped if larger than the budget
+        g.set_edge_tables(1024)
+        self.assertFalse(g.has_edge_tables())
+        self.check_tables(g, g0, 'traveltimes computed on the fly differ')
+
 class Data_kernel(unittest.TestCase):
 
     def test_2d(self):
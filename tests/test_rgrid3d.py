@@ -1,5 +1,9 @@
 # -*- coding: utf-8 -*-
 
+import os
+import shutil
+import subprocess
+import tempfile
 import unittest
 import numpy as np
 import vtk
@@ -51,6 +55,15 @@ class TestGrid3dc(unittest.TestCase):
         self.assertLess(np.sum(np.abs(tt-tt_ref))/tt.size, 0.01,
                         'FSM accuracy failed (slowness in cells)')
 
+    def test_Grid3Dfm(self):
+        g = rg.Grid3d(self.x, self.y, self.z, method='FMM', tt_from_rp=False)
+        tt = g.raytrace(self.src, self.rcv, self.slowness)
+        tt = g.get_grid_traveltimes()
+        tt = tt.flatten()
+        tt_ref = get_tt('fsm_d_p_lc_src_all_tt.vtr')
+        self.assertLess(np.sum(np.abs(tt-tt_ref))/tt.size, 0.1,
+                        'FMM accuracy failed (slowness in cells)')
+
     def test_Grid3Dsp(self):
         g = rg.Grid3d(self.x, self.y, self.z, method='SPM', tt_from_rp=False,
                       nsnx=5, nsny=5, nsnz=5)
@@ -73,6 +86,20 @@ class TestGrid3dc(unittest.TestCase):
         self.assertLess(np.sum(np.abs(tt-tt_ref))/tt.size, 0.1,
                         'SPM accuracy failed (slowness in cells)')
 
+    def test_matrix_free_products(self):
+        g = rg.Grid3d(self.x, self.y, self.z, method='SPM', tt_from_rp=False,
+                      nsnx=2, nsny=2, nsnz=2)
+        tt, L = g.raytrace(self.src, self.rcv, self.slowness, compute_L=True)
+        np.random.seed(42)
+        r = np.random.rand(self.rcv.shape[0])
+        x = np.random.rand(self.slowness.size)
+        tt2, LTr = g.raytrace(self.src, self.rcv, residuals=r)
+        tt3, Lx = g.raytrace(self.src, self.rcv, model=x)
+        self.assertAlmostEqual(np.sum(np.abs(LTr-L.T@r)), 0.0,
+                               msg='L^T r failed')
+        self.assertAlmostEqual(np.sum(np.abs(Lx-L@x)), 0.0,
+                               msg='L x failed')
+
 
 class TestGrid3dn(unittest.TestCase):
 
@@ -104,6 +131,16 @@ class TestGrid3dn(unittest.TestCase):
         self.assertLess(np.sum(np.abs(tt-tt_ref))/tt.size, 0.01,
                         'FSM accuracy failed (slowness at nodes)')
 
+    def test_Grid3Dfm(self):
+        g = rg.Grid3d(self.x, self.y, self.z, method='FMM', tt_from_rp=False,
+                      cell_slowness=0)
+        tt = g.raytrace(self.src, self.rcv, self.slowness)
+        tt = g.get_grid_traveltimes()
+        tt = tt.flatten()
+        tt_ref = get_tt('fsm_d_p_gc_src_all_tt.vtr')
+        self.assertLess(np.sum(np.abs(tt-tt_ref))/tt.size, 0.1,
+                        'FMM accuracy failed (slowness at nodes)')
+
     def test_Grid3Dsp(self):
         g = rg.Grid3d(self.x, self.y, self.z, method='SPM', tt_from_rp=False,
                       nsnx=5, nsny=5, nsnz=5, cell_slowness=0)
@@ -127,6 +164,212 @@ class TestGrid3dn(unittest.TestCase):
         self.assertLess(np.sum(np.abs(tt-tt_ref))/tt.size, 0.1,
                         'SPM accuracy failed (slowness at nodes)')
 
+    def test_tertiary_nodes_cache(self):
+        kw = dict(method='DSPM', tt_from_rp=False, n_secondary=2,
+                  n_tertiary=2, radius_tertiary=2, cell_slowness=0)
+        g = rg.Grid3d(self.x, self.y, self.z, **kw)
+        gc = rg.Grid3d(self.x, self.y, self.z, **kw)
+        gc.set_tertiary_nodes_cache(1)
+        src2 = self.src.copy()
+        src2[0, 1:] += 1.0
+        for slowness in (self.slowness, 1.05*self.slowness):
+            for src in (self.src, src2, self.src):
+                tt_ref = g.raytrace(src, self.rcv, slowness)
+                tt = gc.raytrace(src, self.rcv, slowness)
+                self.assertAlmostEqual(np.sum(np.abs(tt-tt_ref)), 0.0,
+                                       msg='tertiary nodes cache failed')
+
+    def test_factored(self):
+        slowness = np.ones(self.slowness.shape)
+        tt_ref = np.sqrt(np.sum((self.rcv-self.src[0, 1:])**2, axis=1))
+        for method in ('FSM', 'FMM'):
+            g = rg.Grid3d(self.x, self.y, self.z, method=method,
+                          tt_from_rp=False, cell_slowness=0, weno=0)
+            tt = g.raytrace(self.src, self.rcv, slowness)
+            g = rg.Grid3d(self.x, self.y, self.z, method=method,
+                          tt_from_rp=False, cell_slowness=0, weno=0,
+                          factored=1)
+            tt2 = g.raytrace(self.src, self.rcv, slowness)
+            self.assertLess(np.max(np.abs(tt2-tt_ref)),
+                            np.max(np.abs(tt-tt_ref)),
+                            '{0:s} factored accuracy failed'.format(method))
+
+    def test_misfit_gradient(self):
+        g = rg.Grid3d(self.x, self.y, self.z, method='FSM', tt_from_rp=False,
+                      cell_slowness=0, weno=0)
+        tt_obs = 1.1 * g.raytrace(self.src, self.rcv, self.slowness)
+        tt, grad = g.raytrace(self.src, self.rcv, self.slowness, tt_obs=tt_obs)
+        np.random.seed(42)
+        ds = 1.e-6 * np.random.rand(self.slowness.size)
+        ttp = g.raytrace(self.src, self.rcv, self.slowness+ds)
+        ttm = g.raytrace(self.src, self.rcv, self.slowness-ds)
+        dJ = 0.25 * (np.sum((ttp-tt_obs)**2) - np.sum((ttm-tt_obs)**2))
+        self.assertAlmostEqual(np.dot(grad, ds)/dJ, 1.0, places=3,
+                               msg='adjoint-state gradient failed')
+
+    def test_get_tt_at(self):
+        g = rg.Grid3d(self.x, self.y, self.z, method='SPM', tt_from_rp=False,
+                      nsnx=5, nsny=5, nsnz=5, cell_slowness=0)
+        tt = g.raytrace(self.src, self.rcv, self.slowness)
+        tt2 = g.get_tt_at(self.rcv)
+        self.assertAlmostEqual(np.sum(np.abs(tt-tt2)), 0.0)
+
+    def test_raytrace_phases(self):
+        g = rg.Grid3d(self.x, self.y, self.z, method='FSM', tt_from_rp=False,
+                      cell_slowness=0, n_threads=2)
+        X, Y = np.meshgrid(self.x, self.y)
+        itf = np.c_[X.flatten(), Y.flatten(),
+                    self.z[self.z.size//2]*np.ones((X.size,))]
+        tt = g.raytrace_phases(self.src, self.rcv, [itf], [[], [0]],
+                               self.slowness, reciprocal=False)
+        tt0 = g.raytrace(self.src, self.rcv)
+        self.assertAlmostEqual(np.sum(np.abs(tt[0, 0, :]-tt0)), 0.0)
+        t_itf = g.raytrace(self.src, itf)
+        tt1 = g.raytrace(np.c_[t_itf, itf], self.rcv, aggregate_src=True)
+        self.assertAlmostEqual(np.sum(np.abs(tt[1, 0, :]-tt1)), 0.0,
+                               msg='reflected phase failed')
+
+    def test_raytrace_ensemble(self):
+        g = rg.Grid3d(self.x, self.y, self.z, method='SPM', tt_from_rp=False,
+                      nsnx=3, nsny=3, nsnz=3, cell_slowness=0, n_threads=2)
+        models = np.vstack((self.slowness, 0.9*self.slowness,
+                            1.2*self.slowness))
+        g.set_slowness(self.slowness)
+        tt = g.raytrace_ensemble(self.src, self.rcv, models)
+        self.assertEqual(tt.shape, (3, 1, self.rcv.shape[0]))
+        for k in range(models.shape[0]):
+            tt0 = g.raytrace(self.src, self.rcv, models[k])
+            self.assertAlmostEqual(np.sum(np.abs(tt[k, 0, :]-tt0)), 0.0,
+                                   msg='ensemble raytracing failed')
+
+    def test_warm_start(self):
+        g = rg.Grid3d(self.x, self.y, self.z, method='FSM', tt_from_rp=False,
+                      cell_slowness=0, weno=0)
+        slowness = 1.05 * self.slowness
+        tt_ref = g.raytrace(self.src, self.rcv, slowness)
+        niter_ref = g.get_niter()
+        g.set_warm_start(True)
+        g.raytrace(self.src, self.rcv, self.slowness)
+        tt = g.raytrace(self.src, self.rcv, slowness)
+        self.assertAlmostEqual(np.sum(np.abs(tt-tt_ref)), 0.0,
+                               msg='warm start failed')
+        self.assertLessEqual(g.get_niter(), niter_ref)
+        tt = g.raytrace(self.src, self.rcv, slowness)
+        self.assertEqual(g.get_niter(), 1)
+
+    def test_traveltime_cache(self):
+        g = rg.Grid3d(self.x, self.y, self.z, method='FSM', tt_from_rp=False,
+                      cell_slowness=0)
+        g.set_slowness(self.slowness)
+        tt_ref = g.raytrace(self.src, self.rcv)
+        g.set_traveltime_cache(2**26)
+        g.raytrace(self.src, self.rcv)
+        tt = g.raytrace(self.src, self.rcv)
+        self.assertAlmostEqual(np.sum(np.abs(tt-tt_ref)), 0.0,
+                               msg='traveltime cache failed')
+        stats = g.get_traveltime_cache_stats()
+        self.assertEqual(stats['hits'], 1)
+        g.set_slowness(1.05 * self.slowness)
+        self.assertEqual(g.get_traveltime_cache_stats()['size'], 0)
+
+    def test_traveltime_cache_niter(self):
+        g = rg.Grid3d(self.x, self.y, self.z, method='FSM', tt_from_rp=False,
+                      cell_slowness=0, eps=1.e-6, maxit=100)
+        g.set_slowness(self.slowness)
+        g.set_traveltime_cache(2**26)
+        g.raytrace(self.src, self.rcv)
+        niter_ref = g.get_niter()
+        g.raytrace(np.c_[0.0, self.rcv[-1:, :]], self.rcv[:-1, :])
+        self.assertNotEqual(g.get_niter(), niter_ref)
+        # the number of sweeps is restored along with the traveltimes
+        g.raytrace(self.src, self.rcv)
+        self.assertEqual(g.get_traveltime_cache_stats()['hits'], 1)
+        self.assertEqual(g.get_niter(), niter_ref)
+
+    def test_n_procs(self):
+        g = rg.Grid3d(self.x, self.y, self.z, method='FSM', tt_from_rp=False,
+                      cell_slowness=0)
+        # each of 3 sources recorded by all receivers
+        src = np.repeat(np.c_[np.zeros((3,)), self.rcv[100:103, :]],
+                        self.rcv.shape[0], axis=0)
+        rcv = np.tile(self.rcv, (3, 1))
+        tt_ref = g.raytrace(src, rcv, self.slowness)
+        tt = g.raytrace(src, rcv, self.slowness, n_procs=2)
+        self.assertAlmostEqual(np.sum(np.abs(tt-tt_ref)), 0.0,
+                               msg='shots in processes failed')
+
+    def test_flat_rays(self):
+        g = rg.Grid3d(self.x, self.y, self.z, method='FSM', cell_slowness=0)
+        X, Y, Z = np.meshgrid(np.arange(2.5, 19.0, 4.0),
+                              np.arange(2.5, 19.0, 4.0),
+                              np.arange(2.5, 19.0, 4.0), indexing='ij')
+        rcv = np.c_[X.flatten(), Y.flatten(), Z.flatten()]
+        src = np.repeat(np.array([[0.0, 5.0, 6.0, 7.0], [0.0, 15.0, 12.0, 11.0]]),
+                        rcv.shape[0], axis=0)
+        rcv = np.tile(rcv, (2, 1))
+        tt_ref, rays = g.raytrace(src, rcv, self.slowness, return_rays=True)
+        tt, (offsets, coords) = g.raytrace(src, rcv, self.slowness,
+                                           return_rays='flat')
+        self.assertAlmostEqual(np.sum(np.abs(tt-tt_ref)), 0.0)
+        self.assertEqual(offsets.size, rcv.shape[0]+1)
+        self.assertEqual(offsets[-1], coords.shape[0])
+        for i in range(rcv.shape[0]):
+            np.testing.assert_allclose(coords[offsets[i]:offsets[i+1], :],
+                                       rays[i], rtol=1.e-6, atol=1.e-4)
+        with tempfile.TemporaryDirectory() as d:
+            fname = os.path.join(d, 'rays.bin')
+            rg.save_rays(fname, offsets, coords)
+            offsets2, coords2 = rg.load_rays(fname)
+            np.testing.assert_array_equal(offsets2, offsets)
+            np.testing.assert_array_equal(coords2, coords)
+
+            fname = os.path.join(d, 'rays.vtp')
+            rg.save_rays(fname, offsets, coords)
+            reader = vtk.vtkXMLPolyDataReader()
+            reader.SetFileName(fname)
+            reader.Update()
+            data = reader.GetOutput()
+            self.assertEqual(data.GetNumberOfLines(), rcv.shape[0])
+            np.testing.assert_array_equal(
+                vtk_to_numpy(data.GetPoints().GetData()), coords)
+
+    def test_tiled(self):
+        g = rg.Grid3d(self.x, self.y, self.z, method='FSM', tt_from_rp=False,
+                      cell_slowness=0)
+        src = np.repeat(np.c_[np.zeros((2,)), self.rcv[[100, 340], :]],
+                        self.rcv.shape[0], axis=0)
+        rcv = np.tile(self.rcv, (2, 1))
+        tt_ref = g.raytrace(src, rcv, self.slowness)
+        # bricks of 4^3 nodes, windows covering the whole model
+        nbricks = int(np.ceil(self.x.size/4)*np.ceil(self.y.size/4)*np.ceil(self.z.size/4))
+        with tempfile.TemporaryDirectory() as d:
+            fname = os.path.join(d, 'gradient.brk')
+            rg.write_brick_file(fname, self.x, self.y, self.z, self.slowness,
+                                cell_slowness=0, brick_size=4)
+            for cache, misses in ((nbricks, nbricks), (8, 2*nbricks)):
+                gt = rg.TiledGrid3d(fname, margin=20.0, brick_cache=cache,
+                                    tt_from_rp=False)
+                tt = gt.raytrace(src, rcv)
+                self.assertAlmostEqual(np.sum(np.abs(tt-tt_ref)), 0.0,
+                                       msg='tiled model failed')
+                # bricks evicted with the small cache are read again
+                self.assertEqual(gt.get_brick_cache_stats()['misses'], misses)
+
+            # window strictly inside the model: receivers at most 2 nodes
+            # away from the source, with a margin of 3 nodes
+            src = np.array([[0.0, 10.0, 10.0, 10.0]])
+            X, Y, Z = np.meshgrid(np.arange(8.0, 13.0), np.arange(8.0, 13.0),
+                                  np.arange(8.0, 13.0), indexing='ij')
+            rcv = np.c_[X.flatten(), Y.flatten(), Z.flatten()]
+            tt_ref = g.raytrace(src, rcv, self.slowness)
+            gt = rg.TiledGrid3d(fname, margin=3.0, brick_cache=nbricks,
+                                tt_from_rp=False)
+            tt = gt.raytrace(src, rcv)
+            np.testing.assert_allclose(tt, tt_ref, rtol=1.e-6,
+                                       err_msg='tiled model failed')
+            # nodes 5 to 15 along each axis, in bricks 1 to 3
+            self.assertEqual(gt.get_brick_cache_stats()['misses'], 27)
+
 
 class Data_kernel(unittest.TestCase):
 
@@ -173,6 +416,58 @@ class Data_kernel(unittest.TestCase):
 
         self.assertAlmostEqual(np.sum(np.abs(tt-tt2)), 0.0 )
 
+    def test_3d_threads(self):
+
+        np.random.seed(42)
+        grx = np.cumsum(np.random.rand(9)+0.5)
+        gry = np.cumsum(np.random.rand(8)+0.5)
+        grz = np.cumsum(np.random.rand(10)+0.5)
+        lo = np.array([grx[0], gry[0], grz[0]])
+        hi = np.array([grx[-1], gry[-1], grz[-1]])
+        Tx = lo + (hi-lo)*np.random.rand(500, 3)
+        Rx = lo + (hi-lo)*np.random.rand(500, 3)
+
+        L1 = rg.Grid3d.data_kernel_straight_rays(Tx, Rx, grx, gry, grz)
+        L4 = rg.Grid3d.data_kernel_straight_rays(Tx, Rx, grx, gry, grz,
+                                                 n_threads=4)
+        d = np.sqrt(np.sum((Tx-Rx)**2, axis=1))
+        self.assertAlmostEqual(np.max(np.abs(L1.sum(axis=1).A1-d)), 0.0)
+        self.assertAlmostEqual(np.sum(np.abs((L1-L4).toarray())), 0.0)
+
+    def test_outside_grid(self):
+
+        grx = np.arange(12.)
+        gry = np.arange(13.)
+        grz = np.arange(14.)
+        Tx = np.array([[0.5, 0.5, 0.5], [0.5, 0.5, 0.5]])
+        Rx = np.array([[10.5, 11.5, 12.5], [10.5, 11.5, 14.5]])
+
+        with self.assertRaises(RuntimeError):
+            rg.Grid3d.data_kernel_straight_rays(Tx, Rx, grx, gry, grz)
+
+
+class TestSinglePrecision(unittest.TestCase):
+
+    def test_local_origin(self):
+        # ttcrpy is built in double only: grids in float relative to an
+        # origin are compared with grids in double at UTM-like coordinates
+        # by a program compiled from local_origin.cpp
+        cxx = shutil.which(os.environ.get('CXX', 'c++'))
+        if cxx is None:
+            self.skipTest('no C++ compiler found')
+        root = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+        includes = ['-I' + os.path.join(root, d)
+                    for d in ('ttcr', 'boost_1_72_0', 'eigen-3.3.7')]
+        with tempfile.TemporaryDirectory() as d:
+            exe = os.path.join(d, 'local_origin')
+            subprocess.run([cxx, '-std=c++11', '-O2'] + includes +
+                           [os.path.join(root, 'tests', 'local_origin.cpp'),
+                            os.path.join(root, 'ttcrpy', 'verbose.cpp'),
+                            '-pthread', '-o', exe], check=True)
+            p = subprocess.run([exe], stdout=subprocess.PIPE,
+                               universal_newlines=True)
+        self.assertEqual(p.returncode, 0, p.stdout)
+
 if __name__ == '__main__':
 
     unittest.main()
@@ -0,0 +1,232 @@
+# -*- coding: utf-8 -*-
+
+import os
+import pickle
+import tempfile
+import unittest
+import numpy as np
+
+import ttcrpy.tmesh as tm
+
+
+def box_mesh(n, size=10.0):
+    """Regular tetrahedral mesh of a cube, 6 tetrahedra per voxel."""
+    h = size / n
+    x = np.arange(n+1) * h
+    X, Y, Z = np.meshgrid(x, x, x, indexing='ij')
+    nodes = np.c_[X.ravel(order='F'), Y.ravel(order='F'), Z.ravel(order='F')]
+
+    def ind(i, j, k):
+        return (k*(n+1) + j)*(n+1) + i
+
+    tetra = []
+    for k in range(n):
+        for j in range(n):
+            for i in range(n):
+                v = [ind(i+(c & 1), j+((c >> 1) & 1), k+((c >> 2) & 1))
+                     for c in range(8)]
+                tetra += [[v[0], v[1], v[3], v[7]], [v[0], v[1], v[5], v[7]],
+                          [v[0], v[2], v[3], v[7]], [v[0], v[2], v[6], v[7]],
+                          [v[0], v[4], v[5], v[7]], [v[0], v[4], v[6], v[7]]]
+    return nodes, np.array(tetra, dtype=np.int64)
+
+
+def linear_gradient_tt(src, rcv, v0, g):
+    """Traveltimes for a velocity v0 + g*z."""
+    vs = v0 + g*src[2]
+    vr = v0 + g*rcv[:, 2]
+    r2 = np.sum((rcv-src)**2, axis=1)
+    return np.arccosh(1.0 + g*g*r2/(2.0*vs*vr)) / g
+
+
+class TestMesh3d(unittest.TestCase):
+
+    def setUp(self):
+        self.nodes, self.tetra = box_mesh(12)
+        self.slowness = 1.0 / (1.0 + 0.05*self.nodes[:, 2])
+        self.src = np.array([[1.0, 1.0, 1.0]])
+        self.rcv = np.c_[8.7-0.3*np.arange(10), 7.9+np.zeros(10),
+                         8.5-0.5*np.arange(10)]
+
+    def test_fim(self):
+        # active lists long enough to be shared among threads
+        nodes, tetra = box_mesh(24)
+        slowness = 1.0 / (1.0 + 0.05*nodes[:, 2])
+        tt_ref = linear_gradient_tt(self.src[0], self.rcv, 1.0, 0.05)
+        g1 = tm.Mesh3d(nodes, tetra, cell_slowness=0, method='FIM',
+                       tt_from_rp=0, eps=1e-12)
+        tt1 = g1.raytrace(self.src, self.rcv, slowness)
+        self.assertLess(np.max(np.abs(tt1-tt_ref)/tt_ref), 0.03,
+                        'FIM accuracy failed')
+        # a single source shares the active list among the threads
+        g4 = tm.Mesh3d(nodes, tetra, cell_slowness=0, method='FIM',
+                       tt_from_rp=0, eps=1e-12, n_threads=4)
+        for _ in range(3):
+            tt4 = g4.raytrace(self.src, self.rcv, slowness)
+            self.assertAlmostEqual(np.sum(np.abs(tt4-tt1)), 0.0,
+                                   msg='FIM with threads failed')
+
+    def test_reorder(self):
+        # source and receivers inside cells, not on faces shared by cells
+        # that are visited in an order depending on the numbering; with a
+        # single secondary node per edge, secondary nodes do not depend on
+        # the orientation of faces either
+        src = np.array([[1.1, 0.7, 1.3]])
+        rcv = self.rcv + np.array([0.03, 0.02, 0.01])
+        g = tm.Mesh3d(self.nodes, self.tetra, cell_slowness=0, method='SPM',
+                      n_secondary=1, tt_from_rp=0)
+        tt = g.raytrace(src, rcv, self.slowness)
+        tt_grid = g.get_grid_traveltimes()
+        # same mesh, with nodes and cells listed in another order
+        rs = np.random.RandomState(0)
+        pn = rs.permutation(self.nodes.shape[0])
+        pc = rs.permutation(self.tetra.shape[0])
+        nodes = self.nodes[pn, :]
+        tetra = np.argsort(pn)[self.tetra[pc, :]]
+        slowness = self.slowness[pn]
+        for reorder in (None, 'morton', 'rcm'):
+            g2 = tm.Mesh3d(nodes, tetra, cell_slowness=0, method='SPM',
+                           n_secondary=1, tt_from_rp=0, reorder=reorder)
+            tt2 = g2.raytrace(src, rcv, slowness)
+            self.assertAlmostEqual(np.sum(np.abs(tt2-tt)), 0.0,
+                                   msg='permuted mesh failed')
+            tt2_grid = g2.get_grid_traveltimes()
+            self.assertAlmostEqual(np.sum(np.abs(tt2_grid-tt_grid[pn])), 0.0,
+                                   msg='grid traveltimes of permuted mesh failed')
+
+    def test_n_procs(self):
+        # each of 3 sources recorded by all receivers
+        src = np.repeat(self.rcv[:3, :]-5.0, self.rcv.shape[0], axis=0)
+        rcv = np.tile(self.rcv, (3, 1))
+        g = tm.Mesh3d(self.nodes, self.tetra, cell_slowness=0, method='SPM',
+                      n_secondary=2, tt_from_rp=0)
+        tt_ref = g.raytrace(src, rcv, self.slowness)
+        tt = g.raytrace(src, rcv, self.slowness, n_procs=2)
+        self.assertAlmostEqual(np.sum(np.abs(tt-tt_ref)), 0.0,
+                               msg='shots in processes failed')
+
+    def test_snapshot(self):
+        g = tm.Mesh3d(self.nodes, self.tetra, cell_slowness=0, method='SPM',
+                      n_secondary=3)
+        tt = g.raytrace(self.src, self.rcv, self.slowness)
+        snapshot = g.save_snapshot()
+        g2 = tm.Mesh3d(self.nodes, self.tetra, cell_slowness=0, method='SPM',
+                       n_secondary=3, snapshot=snapshot)
+        tt2 = g2.raytrace(self.src, self.rcv, self.slowness)
+        self.assertAlmostEqual(np.sum(np.abs(tt2-tt)), 0.0,
+                               msg='snapshot round trip failed')
+        # snapshots are only restored in grids built alike
+        with self.assertRaises(RuntimeError):
+            tm.Mesh3d(self.nodes, self.tetra, cell_slowness=0, method='SPM',
+                      n_secondary=2, snapshot=snapshot)
+        with self.assertRaises(RuntimeError):
+            tm.Mesh3d(self.nodes, self.tetra, cell_slowness=0, method='DSPM',
+                      n_secondary=3, snapshot=snapshot)
+        with self.assertRaises(RuntimeError):
+            tm.Mesh3d(self.nodes, self.tetra, cell_slowness=0, method='SPM',
+                      n_secondary=3, snapshot=snapshot[:len(snapshot)//2])
+
+    def test_edge_tables(self):
+        # lengths from the tables are those computed on the fly
+        slo_cells = 1.0 / (1.0 + 0.05*np.mean(self.nodes[self.tetra, 2], axis=1))
+        for cell_slowness, slowness in ((0, self.slowness), (1, slo_cells)):
+            g = tm.Mesh3d(self.nodes, self.tetra, cell_slowness=cell_slowness,
+                          method='SPM', n_secondary=2, tt_from_rp=0)
+            self.assertTrue(g.has_edge_tables())
+            tt = g.raytrace(self.src, self.rcv, slowness)
+            tt_grid = g.get_grid_traveltimes()
+            g.set_edge_tables(0)
+            self.assertFalse(g.has_edge_tables())
+            np.testing.assert_array_equal(g.raytrace(self.src, self.rcv, slowness), tt)
+            np.testing.assert_array_equal(g.get_grid_traveltimes(), tt_grid)
+            # tables not built when over budget
+            g.set_edge_tables(1024)
+            self.assertFalse(g.has_edge_tables())
+            g.set_edge_tables(1 << 28)
+            self.assertTrue(g.has_edge_tables())
+            np.testing.assert_array_equal(g.raytrace(self.src, self.rcv, slowness), tt)
+
+    def test_reflectors(self):
+        # faces of the tetrahedra in the plane z = 5 make the reflector
+        nodes, tetra = box_mesh(4)
+        faces = set()
+        for t in tetra:
+            for f in ((0, 1, 2), (0, 1, 3), (0, 2, 3), (1, 2, 3)):
+                v = tuple(sorted(t[list(f)]))
+                if np.all(nodes[list(v), 2] == 5.0):
+                    faces.add(v)
+        tri = np.array(sorted(faces))
+        edges = {tuple(sorted(e)) for t in tri
+                 for e in ((t[0], t[1]), (t[1], t[2]), (t[0], t[2]))}
+        vertices = np.unique(tri)
+        with tempfile.TemporaryDirectory() as d:
+            fname = os.path.join(d, 'reflector.msh')
+            with open(fname, 'w') as f:
+                f.write('$MeshFormat\n2.2 0 8\n$EndMeshFormat\n')
+                f.write('$PhysicalNames\n2\n2 1 "top"\n3 2 "rock"\n')
+                f.write('$EndPhysicalNames\n')
+                f.write('$Nodes\n{0:d}\n'.format(nodes.shape[0]))
+                for n in range(nodes.shape[0]):
+                    f.write('{0:d} {1:.17g} {2:.17g} {3:.17g}\n'.format(n+1, *nodes[n]))
+                f.write('$EndNodes\n$Elements\n')
+                f.write('{0:d}\n'.format(tri.shape[0]+tetra.shape[0]))
+                for n in range(tri.shape[0]):
+                    f.write('{0:d} 2 2 1 1 {1:d} {2:d} {3:d}\n'.format(n+1, *(tri[n]+1)))
+                for n in range(tetra.shape[0]):
+                    f.write('{0:d} 4 2 2 2 {1:d} {2:d} {3:d} {4:d}\n'.format(
+                        tri.shape[0]+n+1, *(tetra[n]+1)))
+                f.write('$EndElements\n')
+            pts = tm.reflector_points(fname, n_secondary=3, n_threads=2)['top']
+        # vertices, 3 points per edge and 3 per face
+        nv = vertices.size
+        self.assertEqual(pts.shape[0], nv + 3*len(edges) + 3*tri.shape[0])
+        self.assertEqual({tuple(p) for p in pts[:nv]},
+                         {tuple(p) for p in nodes[vertices]})
+        for cell_slowness in (0, 1):
+            g = tm.Mesh3d(nodes, tetra, cell_slowness=cell_slowness,
+                          method='SPM', n_secondary=3)
+            sec = g.get_secondary_nodes()
+            dist = np.sqrt(np.sum((pts[nv:, np.newaxis, :] -
+                                   sec[np.newaxis, :, :])**2, axis=2))
+            self.assertLess(np.max(np.min(dist, axis=1)), 1.e-12,
+                            'reflector points are not secondary nodes')
+
+
+class TestMesh2ds(unittest.TestCase):
+
+    def setUp(self):
+        # undulated surface, 2 triangles per square
+        n = 12
+        x = np.arange(n+1, dtype=np.float64)
+        X, Y = np.meshgrid(x, x, indexing='ij')
+        self.nodes = np.c_[X.ravel(), Y.ravel(), 0.5*np.sin(0.5*X.ravel())]
+        tri = []
+        for i in range(n):
+            for j in range(n):
+                v = [i*(n+1)+j, i*(n+1)+j+1, (i+1)*(n+1)+j, (i+1)*(n+1)+j+1]
+                tri += [[v[0], v[1], v[3]], [v[0], v[2], v[3]]]
+        self.tri = np.array(tri, dtype=np.int64)
+        # each of 3 sources recorded by all receivers
+        isrc = np.repeat([14, 90, 150], 10)
+        ircv = np.tile(np.arange(20, 170, 15), 3)
+        self.src = self.nodes[isrc, :]
+        self.rcv = self.nodes[ircv, :]
+        self.slowness = np.ones((self.tri.shape[0],))
+
+    def test_pickle(self):
+        g = tm.Mesh2ds(self.nodes, self.tri, n_threads=2, n_secondary=3)
+        tt = g.raytrace(self.src, self.rcv, self.slowness)
+        g2 = pickle.loads(pickle.dumps(g))
+        self.assertEqual(g2.n_threads, 2)
+        tt2 = g2.raytrace(self.src, self.rcv, self.slowness)
+        self.assertAlmostEqual(np.sum(np.abs(tt2-tt)), 0.0,
+                               msg='pickled mesh failed')
+        g1 = tm.Mesh2ds(self.nodes, self.tri, n_threads=1, n_secondary=3)
+        tt1 = g1.raytrace(self.src, self.rcv, self.slowness)
+        self.assertAlmostEqual(np.sum(np.abs(tt2-tt1)), 0.0,
+                               msg='Mesh2ds with threads failed')
+
+
+if __name__ == '__main__':
+
+    unittest.main()
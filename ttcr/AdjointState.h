@@ -0,0 +1,159 @@
+//
+//  AdjointState.h
+//  ttcr
+//
+//  Created by agent on 2026-10-18.
+//  Copyright (c) 2026 agent. All rights reserved.
+//
+
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+
+ Adjoint-state computation of the gradient of the traveltime misfit
+
+ @article{leung06,
+ author = {Leung, Shingyu and Qian, Jianliang},
+ title = {An adjoint state method for three-dimensional transmission traveltime tomography using first-arrivals},
+ journal = {Communications in Mathematical Sciences},
+ year = {2006},
+ volume = {4},
+ number = {1},
+ pages = {249--266}
+ }
+
+ The local solvers are linearized about the computed traveltimes,
+ T_n = sum_k w_k T_k + l_n*s, where the T_k are upwind traveltimes.  The
+ adjoint variables are obtained by transposing these relations, visiting
+ the nodes by decreasing traveltime, so that neither rays nor the data
+ kernel matrix are needed.
+
+ */
+
+#ifndef ttcr_AdjointState_h
+#define ttcr_AdjointState_h
+
+#include <cmath>
+#include <limits>
+
+#include "ttcr_t.h"
+
+namespace ttcr {
+
+    // barycentric coordinates of pt in tetrahedron x
+    template<typename T1>
+    void barycentric(const sxyz<T1>& pt, const sxyz<T1> x[4], T1 w[4]) {
+        T1 V = dot(x[1]-x[0], cross(x[2]-x[0], x[3]-x[0]));
+        w[0] = dot(x[1]-pt, cross(x[2]-pt, x[3]-pt))/V;
+        w[1] = dot(pt-x[0], cross(x[2]-x[0], x[3]-x[0]))/V;
+        w[2] = dot(x[1]-x[0], cross(pt-x[0], x[3]-x[0]))/V;
+        w[3] = 1. - w[0] - w[1] - w[2];
+    }
+
+    // Linearization of the traveltime at vertex D of a tetrahedron with
+    // vertices D, x[0], x[1] and x[2], for slowness s.  The ray reaching D
+    // comes from point P of an edge, a face or the interior of the face
+    // opposite to D, with P located by following -grad T (T interpolated
+    // linearly in the corresponding simplex).  Among these candidates, the
+    // value of
+    //   sum_k w_k t_k + s*l,  l = |DP|,
+    // closest to tD (normally the smallest) is returned along with the
+    // barycentric coordinates w_k of P and l.  Only vertices with t_k < tD
+    // are considered, and max() is returned if there is none.
+    template<typename T1>
+    T1 upwindLinearization(const sxyz<T1>& xD, const T1 tD, const T1 s,
+                           const sxyz<T1> x[3], const T1 t[3],
+                           T1 w[3], T1& l) {
+
+        T1 tmin = std::numeric_limits<T1>::max();
+        T1 err = std::numeric_limits<T1>::max();
+        const sxyz<T1> e[3] = { x[0]-xD, x[1]-xD, x[2]-xD };
+
+        // edges
+        for ( size_t k=0; k<3; ++k ) {
+            if ( t[k] >= tD ) continue;
+            T1 d = norm(e[k]);
+            if ( std::abs(t[k] + s*d - tD) < err ) {
+                tmin = t[k] + s*d;
+                err = std::abs(tmin - tD);
+                l = d;
+                w[0] = w[1] = w[2] = 0.0;
+                w[k] = 1.0;
+            }
+        }
+
+        // faces: -grad T = la*e[a] + lb*e[b]
+        for ( size_t a=0; a<3; ++a ) {
+            const size_t b = (a+1)%3;
+            if ( t[a] >= tD || t[b] >= tD ) continue;
+            T1 g11 = dot(e[a], e[a]);
+            T1 g12 = dot(e[a], e[b]);
+            T1 g22 = dot(e[b], e[b]);
+            T1 det = g11*g22 - g12*g12;
+            if ( det <= 0.0 ) continue;
+            T1 la = -(g22*(t[a]-tD) - g12*(t[b]-tD))/det;
+            T1 lb = -(g11*(t[b]-tD) - g12*(t[a]-tD))/det;
+            if ( la <= 0.0 || lb <= 0.0 ) continue;
+            T1 wa = la/(la+lb);
+            T1 wb = lb/(la+lb);
+            T1 d = norm(wa*e[a] + wb*e[b]);
+            T1 tt = wa*t[a] + wb*t[b] + s*d;
+            if ( std::abs(tt - tD) < err ) {
+                tmin = tt;
+                err = std::abs(tt - tD);
+                l = d;
+                w[0] = w[1] = w[2] = 0.0;
+                w[a] = wa;
+                w[b] = wb;
+            }
+        }
+
+        // interior of opposite face
+        if ( t[0] < tD && t[1] < tD && t[2] < tD ) {
+            T1 det = dot(e[0], cross(e[1], e[2]));
+            if ( det == 0.0 ) return tmin;
+            sxyz<T1> m[3] = { cross(e[1], e[2])/det, cross(e[2], e[0])/det,
+                cross(e[0], e[1])/det };
+            sxyz<T1> g = (t[0]-tD)*m[0] + (t[1]-tD)*m[1] + (t[2]-tD)*m[2];
+            T1 lambda[3];
+            T1 sum = 0.0;
+            for ( size_t k=0; k<3; ++k ) {
+                lambda[k] = -dot(m[k], g);
+                if ( lambda[k] <= 0.0 ) return tmin;
+                sum += lambda[k];
+            }
+            sxyz<T1> DP;
+            T1 tt = 0.0;
+            for ( size_t k=0; k<3; ++k ) {
+                DP += (lambda[k]/sum)*e[k];
+                tt += (lambda[k]/sum)*t[k];
+            }
+            T1 d = norm(DP);
+            tt += s*d;
+            if ( std::abs(tt - tD) < err ) {
+                tmin = tt;
+                err = std::abs(tt - tD);
+                l = d;
+                for ( size_t k=0; k<3; ++k ) w[k] = lambda[k]/sum;
+            }
+        }
+        return tmin;
+    }
+
+}
+
+#endif
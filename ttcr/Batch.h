@@ -0,0 +1,372 @@
+//
+//  Batch.h
+//  ttcr
+//
+//  Created by agent on 2026-10-18.
+//  Copyright (c) 2026 agent. All rights reserved.
+//
+
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+
+ Execution of a batch of shots over the threads of a grid
+
+ The shots are handed out one at a time to the threads (the calling thread
+ being thread 0), so that shots of uneven cost are balanced.  Each shot is
+ computed into a buffer taken from a pool of at most `window' buffers,
+ which are reused from one shot to the next.  The results are passed to
+ the sink in the order of the shots, and the buffer is then returned to
+ the pool; a thread waits for a buffer when the sink lags behind, which
+ bounds the memory held by pending results.
+
+ The first exception thrown by a shot or by the sink stops the batch and is
+ rethrown to the caller once all threads are done.
+
+ raytraceBatch computes, for each shot of a survey, the traveltimes and
+ optionally the raypaths and the matrices of partial derivatives (M) or of
+ ray lengths (L), using the per-source methods of Grid3D or Grid2D.
+
+ */
+
+#ifndef ttcr_Batch_h
+#define ttcr_Batch_h
+
+#include <condition_variable>
+#include <exception>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "Grid2D.h"
+#include "Grid3D.h"
+
+namespace ttcr {
+
+    struct noBuffer {};
+
+    template<typename BUF = noBuffer>
+    class Batch {
+    public:
+        Batch(const size_t nt, const size_t w=0) :
+        nThreads(nt==0 ? 1 : nt), window(w < nThreads ? 2*nThreads : w) {}
+
+        size_t getNthreads() const { return nThreads; }
+
+        // compute(n, buffer, threadNo) for all n < nTasks, then sink(n, buffer)
+        // in increasing order of n
+        template<typename COMPUTE, typename SINK>
+        void run(const size_t nTasks, COMPUTE compute, SINK sink) const;
+
+        // compute(n, threadNo) for all n < nTasks, in any order
+        template<typename COMPUTE>
+        void run(const size_t nTasks, COMPUTE compute) const {
+            // nothing is held for the sink, no need to bound the pending shots
+            Batch<BUF> b(nThreads, nTasks);
+            b.run(nTasks,
+                [&compute](const size_t n, BUF&, const size_t threadNo) { compute(n, threadNo); },
+                [](const size_t, BUF&) {});
+        }
+
+    private:
+        size_t nThreads;
+        size_t window;
+    };
+
+    template<typename BUF>
+    template<typename COMPUTE, typename SINK>
+    void Batch<BUF>::run(const size_t nTasks, COMPUTE compute, SINK sink) const {
+
+        const size_t nt = nThreads < nTasks ? nThreads : (nTasks == 0 ? 1 : nTasks);
+        const size_t nb = window < nTasks ? window : (nTasks == 0 ? 1 : nTasks);
+
+        std::vector<BUF> buffers(nb);
+        std::vector<size_t> freeBuffers;
+        for ( size_t i=nb; i>0; --i ) freeBuffers.push_back( i-1 );
+        std::map<size_t, size_t> done;   // shot -> buffer, waiting for the sink
+
+        std::mutex mtx;
+        std::condition_variable cv;
+        size_t next = 0;      // next shot to compute
+        size_t nextSink = 0;  // next shot to pass to the sink
+        std::exception_ptr error;
+
+        auto worker = [&](const size_t threadNo) {
+            std::unique_lock<std::mutex> lock(mtx);
+            for ( ;; ) {
+                cv.wait(lock, [&]{ return next == nTasks || error || !freeBuffers.empty(); });
+                if ( next == nTasks || error ) break;
+
+                const size_t n = next++;
+                const size_t b = freeBuffers.back();
+                freeBuffers.pop_back();
+                lock.unlock();
+                try {
+                    compute(n, buffers[b], threadNo);
+                } catch (...) {
+                    lock.lock();
+                    if ( !error ) error = std::current_exception();
+                    cv.notify_all();
+                    break;
+                }
+                lock.lock();
+                done[n] = b;
+
+                // the thread completing the oldest pending shot flushes the
+                // results that are ready, in order
+                while ( !error && !done.empty() && done.begin()->first == nextSink ) {
+                    const size_t bs = done.begin()->second;
+                    done.erase( done.begin() );
+                    lock.unlock();
+                    try {
+                        sink(nextSink, buffers[bs]);
+                    } catch (...) {
+                        lock.lock();
+                        if ( !error ) error = std::current_exception();
+                        break;
+                    }
+                    lock.lock();
+                    nextSink++;
+                    freeBuffers.push_back( bs );
+                }
+                cv.notify_all();
+            }
+        };
+
+        std::vector<std::thread> threads;
+        for ( size_t i=1; i<nt; ++i ) {
+            threads.push_back( std::thread(worker, i) );
+        }
+        worker(0);
+        for ( size_t i=0; i<threads.size(); ++i ) {
+            threads[i].join();
+        }
+        if ( error ) std::rethrow_exception(error);
+    }
+
+
+    // outputs of raytraceBatch, traveltimes are always computed
+    enum batchOutput {
+        BATCH_TT   = 0,
+        BATCH_RAYS = 1,
+        BATCH_M    = 2,
+        BATCH_L    = 4
+    };
+
+    template<typename T1, typename S>
+    struct survey {
+        std::vector<const std::vector<S>*> Tx;
+        std::vector<const std::vector<T1>*> t0;
+        std::vector<const std::vector<S>*> Rx;   // one set per shot, or common to all
+
+        survey() {}
+        survey(const std::vector<std::vector<S>>& tx,
+               const std::vector<std::vector<T1>>& t,
+               const std::vector<std::vector<S>>& rx) {
+            for ( size_t n=0; n<tx.size(); ++n ) Tx.push_back( &(tx[n]) );
+            for ( size_t n=0; n<t.size(); ++n ) t0.push_back( &(t[n]) );
+            for ( size_t n=0; n<rx.size(); ++n ) Rx.push_back( &(rx[n]) );
+        }
+
+        size_t size() const { return Tx.size(); }
+        const std::vector<S>& getRx(const size_t n) const {
+            return Rx.size() == 1 ? *(Rx[0]) : *(Rx[n]);
+        }
+    };
+
+    template<typename T1, typename S, typename L>
+    struct shotData {
+        std::vector<T1> tt;
+        std::vector<std::vector<S>> r_data;
+        T1 v0;
+        std::vector<std::vector<sijv<T1>>> m_data;
+        std::vector<std::vector<L>> l_data;
+    };
+
+    // sink storing the traveltimes and raypaths of the shots
+    template<typename T1, typename S, typename L>
+    struct gatherShot {
+        std::vector<std::vector<T1>>& tt;
+        std::vector<std::vector<std::vector<S>>>* r_data;
+
+        gatherShot(std::vector<std::vector<T1>>& t,
+                   std::vector<std::vector<std::vector<S>>>* r) : tt(t), r_data(r) {}
+
+        void operator()(const size_t n, shotData<T1,S,L>& d) {
+            tt[n].swap( d.tt );
+            if ( r_data != nullptr ) (*r_data)[n].swap( d.r_data );
+        }
+    };
+
+    template<typename T1, typename T2>
+    void raytraceShot(const Grid3D<T1,T2>& g,
+                      const std::vector<sxyz<T1>>& Tx,
+                      const std::vector<T1>& t0,
+                      const std::vector<sxyz<T1>>& Rx,
+                      const int outputs,
+                      shotData<T1,sxyz<T1>,siv<T1>>& d,
+                      const size_t threadNo) {
+        const bool rays = (outputs & BATCH_RAYS) != 0;
+        if ( (outputs & BATCH_M) && (outputs & BATCH_L) ) {
+            throw std::invalid_argument("Error: M and L cannot be computed together.");
+        } else if ( outputs & BATCH_M ) {
+            if ( rays )
+                g.raytrace(Tx, t0, Rx, d.tt, d.r_data, d.m_data, threadNo);
+            else
+                g.raytrace(Tx, t0, Rx, d.tt, d.m_data, threadNo);
+        } else if ( outputs & BATCH_L ) {
+            if ( rays )
+                g.raytrace(Tx, t0, Rx, d.tt, d.r_data, d.l_data, threadNo);
+            else
+                g.raytrace(Tx, t0, Rx, d.tt, d.l_data, threadNo);
+        } else if ( rays ) {
+            g.raytrace(Tx, t0, Rx, d.tt, d.r_data, threadNo);
+        } else {
+            g.raytrace(Tx, t0, Rx, d.tt, threadNo);
+        }
+    }
+
+    template<typename T1, typename T2, typename S>
+    void raytraceShot(const Grid2D<T1,T2,S>& g,
+                      const std::vector<S>& Tx,
+                      const std::vector<T1>& t0,
+                      const std::vector<S>& Rx,
+                      const int outputs,
+                      shotData<T1,S,siv2<T1>>& d,
+                      const size_t threadNo) {
+        const bool rays = (outputs & BATCH_RAYS) != 0;
+        if ( (outputs & BATCH_M) && (outputs & BATCH_L) ) {
+            throw std::invalid_argument("Error: M and L cannot be computed together.");
+        } else if ( outputs & BATCH_M ) {
+            // M is obtained along with the raypaths and the slowness at the source
+            g.raytrace(Tx, t0, Rx, d.tt, d.r_data, d.v0, d.m_data, threadNo);
+        } else if ( outputs & BATCH_L ) {
+            if ( rays )
+                g.raytrace(Tx, t0, Rx, d.tt, d.r_data, d.l_data, threadNo);
+            else
+                g.raytrace(Tx, t0, Rx, d.tt, d.l_data, threadNo);
+        } else if ( rays ) {
+            g.raytrace(Tx, t0, Rx, d.tt, d.r_data, threadNo);
+        } else {
+            g.raytrace(Tx, t0, Rx, d.tt, threadNo);
+        }
+    }
+
+    template<typename T1, typename S, typename L, typename GRID, typename SINK>
+    void raytraceBatch_(const GRID& g,
+                        const survey<T1,S>& sv,
+                        const int outputs,
+                        SINK& sink,
+                        size_t nThreads,
+                        const size_t window) {
+        if ( sv.t0.size() != sv.size() ||
+            (sv.Rx.size() != 1 && sv.Rx.size() != sv.size()) ) {
+            throw std::length_error("Error: inconsistent number of shots in survey.");
+        }
+        if ( nThreads == 0 || nThreads > g.getNthreads() ) {
+            nThreads = g.getNthreads();
+        }
+        Batch<shotData<T1,S,L>> batch(nThreads, window);
+        batch.run(sv.size(),
+                  [&g,&sv,outputs](const size_t n, shotData<T1,S,L>& d, const size_t threadNo) {
+                      raytraceShot(g, *(sv.Tx[n]), *(sv.t0[n]), sv.getRx(n), outputs, d, threadNo);
+                  },
+                  [&sink](const size_t n, shotData<T1,S,L>& d) { sink(n, d); });
+    }
+
+    // sink(n, shotData&) is called in the order of the shots; the data can
+    // be moved out of the buffer by the sink
+    template<typename T1, typename T2, typename SINK>
+    void raytraceBatch(const Grid3D<T1,T2>& g,
+                       const survey<T1,sxyz<T1>>& sv,
+                       const int outputs,
+                       SINK sink,
+                       const size_t nThreads=0,
+                       const size_t window=0) {
+        raytraceBatch_<T1,sxyz<T1>,siv<T1>>(g, sv, outputs, sink, nThreads, window);
+    }
+
+    template<typename T1, typename T2, typename S, typename SINK>
+    void raytraceBatch(const Grid2D<T1,T2,S>& g,
+                       const survey<T1,S>& sv,
+                       const int outputs,
+                       SINK sink,
+                       const size_t nThreads=0,
+                       const size_t window=0) {
+        raytraceBatch_<T1,S,siv2<T1>>(g, sv, outputs, sink, nThreads, window);
+    }
+
+    // traveltimes, and raypaths if r_data is not null, returned in tt[n] and
+    // (*r_data)[n]
+    template<typename T1, typename T2>
+    void raytraceBatch(const Grid3D<T1,T2>& g,
+                       const std::vector<std::vector<sxyz<T1>>>& Tx,
+                       const std::vector<std::vector<T1>>& t0,
+                       const std::vector<std::vector<sxyz<T1>>>& Rx,
+                       std::vector<std::vector<T1>>& tt,
+                       std::vector<std::vector<std::vector<sxyz<T1>>>>* r_data,
+                       const size_t nThreads=0) {
+        tt.resize( Tx.size() );
+        if ( r_data != nullptr ) r_data->resize( Tx.size() );
+        raytraceBatch(g, survey<T1,sxyz<T1>>(Tx, t0, Rx),
+                      r_data == nullptr ? BATCH_TT : BATCH_RAYS,
+                      gatherShot<T1,sxyz<T1>,siv<T1>>(tt, r_data), nThreads);
+    }
+
+    template<typename T1, typename T2, typename S>
+    void raytraceBatch(const Grid2D<T1,T2,S>& g,
+                       const std::vector<std::vector<S>>& Tx,
+                       const std::vector<std::vector<T1>>& t0,
+                       const std::vector<std::vector<S>>& Rx,
+                       std::vector<std::vector<T1>>& tt,
+                       std::vector<std::vector<std::vector<S>>>* r_data,
+                       const size_t nThreads=0) {
+        tt.resize( Tx.size() );
+        if ( r_data != nullptr ) r_data->resize( Tx.size() );
+        raytraceBatch(g, survey<T1,S>(Tx, t0, Rx),
+                      r_data == nullptr ? BATCH_TT : BATCH_RAYS,
+                      gatherShot<T1,S,siv2<T1>>(tt, r_data), nThreads);
+    }
+
+
+    template<typename T1, typename T2>
+    void raytraceBatch(const Grid3D<T1,T2>& g,
+                       const std::vector<std::vector<sxyz<T1>>>& Tx,
+                       const std::vector<std::vector<T1>>& t0,
+                       const std::vector<std::vector<sxyz<T1>>>& Rx,
+                       std::vector<std::vector<T1>>& tt,
+                       const size_t nThreads=0) {
+        std::vector<std::vector<std::vector<sxyz<T1>>>>* r_data = nullptr;
+        raytraceBatch(g, Tx, t0, Rx, tt, r_data, nThreads);
+    }
+
+    template<typename T1, typename T2, typename S>
+    void raytraceBatch(const Grid2D<T1,T2,S>& g,
+                       const std::vector<std::vector<S>>& Tx,
+                       const std::vector<std::vector<T1>>& t0,
+                       const std::vector<std::vector<S>>& Rx,
+                       std::vector<std::vector<T1>>& tt,
+                       const size_t nThreads=0) {
+        std::vector<std::vector<std::vector<S>>>* r_data = nullptr;
+        raytraceBatch(g, Tx, t0, Rx, tt, r_data, nThreads);
+    }
+
+}
+
+#endif
@@ -0,0 +1,265 @@
+//
+//  Bricks.h
+//  ttcr
+//
+//  Created by agent on 2026-10-18.
+//  Copyright (c) 2026 agent. All rights reserved.
+//
+
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef ttcr_Bricks_h
+#define ttcr_Bricks_h
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace ttcr {
+
+    // Slowness models of rectilinear grids stored on disk as cubic bricks,
+    // for models too large to be held in memory.
+    //
+    // A brick file starts with a header of 80 bytes:
+    //   char     magic[8]       "ttcrbrk1"
+    //   uint32_t nv[3]          number of values along x, y and z
+    //   uint32_t bs             number of values along each edge of a brick
+    //   uint32_t cells          1 if values are defined for cells, 0 for nodes
+    //   uint32_t reserved
+    //   double   d[3]           size of cells along x, y and z
+    //   double   min[3]         origin of grid
+    // followed by the bricks, each holding bs^3 doubles with x varying
+    // fastest.  Bricks are ordered with x varying fastest, and values of
+    // bricks beyond the edges of the model are padded.  All values are in
+    // the byte order of the machine.
+
+    const char brickMagic[8] = { 't', 't', 'c', 'r', 'b', 'r', 'k', '1' };
+
+    struct brickHeader {
+        char magic[8];
+        uint32_t nv[3];
+        uint32_t bs;
+        uint32_t cells;
+        uint32_t reserved;
+        double d[3];
+        double min[3];
+
+        brickHeader() : magic(), nv(), bs(0), cells(0), reserved(0), d(), min() {
+            std::memcpy(magic, brickMagic, 8);
+        }
+        size_t nBricks(const size_t i) const { return (nv[i]+bs-1)/bs; }
+        size_t brickSize() const { return size_t(bs)*bs*bs; }
+        size_t nCells(const size_t i) const { return cells ? nv[i] : nv[i]-1; }
+    };
+
+
+    // Writes a brick file one xy plane at a time (z increasing), so that the
+    // whole model never has to be held in memory.  Only bs planes are
+    // buffered.
+    class BrickWriter {
+    public:
+        BrickWriter(const std::string& filename, const brickHeader& h) :
+        hdr(h), fout(filename.c_str(), std::ios::out | std::ios::binary),
+        buffer(), nPlanes(0), nWritten(0) {
+            if ( !fout ) {
+                throw std::runtime_error("Error: cannot open " + filename);
+            }
+            if ( hdr.bs == 0 || hdr.nv[0] == 0 || hdr.nv[1] == 0 || hdr.nv[2] == 0 ) {
+                throw std::invalid_argument("Error: brick and model sizes should be positive");
+            }
+            fout.write(reinterpret_cast<const char*>(&hdr), sizeof(brickHeader));
+            buffer.resize( hdr.nBricks(0)*hdr.nBricks(1)*hdr.brickSize(), 0.0 );
+        }
+        ~BrickWriter() {
+            try { close(); } catch (...) {}
+        }
+
+        // values of plane nWritten, with x varying fastest
+        template<typename T>
+        void addPlane(const std::vector<T>& plane) {
+            const size_t nx = hdr.nv[0];
+            const size_t ny = hdr.nv[1];
+            if ( plane.size() != nx*ny ) {
+                throw std::length_error("Error: plane should hold " +
+                                        std::to_string(nx*ny) + " values");
+            }
+            if ( nWritten >= hdr.nv[2] ) {
+                throw std::out_of_range("Error: all planes already written");
+            }
+            const size_t bs = hdr.bs;
+            const size_t nbx = hdr.nBricks(0);
+            const size_t k = nPlanes;
+            for ( size_t j=0; j<ny; ++j ) {
+                const size_t jb = j/bs;
+                for ( size_t i=0; i<nx; ++i ) {
+                    const size_t ib = i/bs;
+                    buffer[(jb*nbx + ib)*hdr.brickSize() + (k*bs + j%bs)*bs + i%bs] = plane[j*nx+i];
+                }
+            }
+            nPlanes++;
+            nWritten++;
+            if ( nPlanes == bs || nWritten == hdr.nv[2] ) flush();
+        }
+
+        void close() {
+            if ( !fout.is_open() ) return;
+            if ( nWritten != hdr.nv[2] ) {
+                fout.close();
+                throw std::runtime_error("Error: brick file closed after " +
+                                         std::to_string(nWritten) + " of " +
+                                         std::to_string(hdr.nv[2]) + " planes");
+            }
+            fout.close();
+        }
+
+    private:
+        brickHeader hdr;
+        std::ofstream fout;
+        std::vector<double> buffer;  // one layer of bricks
+        size_t nPlanes;              // planes in current layer
+        size_t nWritten;
+
+        void flush() {
+            fout.write(reinterpret_cast<const char*>(buffer.data()),
+                       buffer.size()*sizeof(double));
+            if ( !fout ) {
+                throw std::runtime_error("Error: cannot write brick file");
+            }
+            std::fill(buffer.begin(), buffer.end(), 0.0);
+            nPlanes = 0;
+        }
+    };
+
+
+    // Read access to a brick file, with a cache of the most recently used
+    // bricks.  Bricks are returned as shared pointers, so a brick evicted from
+    // the cache stays valid for the threads still using it.
+    template<typename T1>
+    class BrickStore {
+    public:
+        typedef std::shared_ptr<const std::vector<T1>> brick;
+
+        BrickStore(const std::string& filename, const size_t cacheSize) :
+        fname(filename), fin(filename.c_str(), std::ios::in | std::ios::binary),
+        capacity(cacheSize==0 ? 1 : cacheSize), nHits(0), nMisses(0) {
+            if ( !fin ) {
+                throw std::runtime_error("Error: cannot open " + filename);
+            }
+            fin.read(reinterpret_cast<char*>(&hdr), sizeof(brickHeader));
+            if ( !fin || std::memcmp(hdr.magic, brickMagic, 8) != 0 ) {
+                throw std::runtime_error("Error: " + filename + " is not a brick file");
+            }
+            // at least one cell along each dimension
+            const uint32_t nmin = hdr.cells ? 1 : 2;
+            if ( hdr.bs == 0 || hdr.nv[0] < nmin || hdr.nv[1] < nmin || hdr.nv[2] < nmin ) {
+                throw std::runtime_error("Error: invalid header in " + filename);
+            }
+            fin.seekg(0, std::ios::end);
+            const size_t expected = sizeof(brickHeader) +
+            hdr.nBricks(0)*hdr.nBricks(1)*hdr.nBricks(2)*hdr.brickSize()*sizeof(double);
+            if ( static_cast<size_t>(fin.tellg()) < expected ) {
+                throw std::runtime_error("Error: " + filename + " is truncated");
+            }
+        }
+
+        const brickHeader& header() const { return hdr; }
+        size_t getCacheSize() const { return capacity; }
+        size_t getHits() const { return nHits; }
+        size_t getMisses() const { return nMisses; }
+
+        brick get(const size_t ib, const size_t jb, const size_t kb) const {
+            const size_t key = (kb*hdr.nBricks(1) + jb)*hdr.nBricks(0) + ib;
+            std::lock_guard<std::mutex> lock(mtx);
+            auto it = cache.find(key);
+            if ( it != cache.end() ) {
+                nHits++;
+                lru.splice(lru.begin(), lru, it->second.second);
+                return it->second.first;
+            }
+            nMisses++;
+            std::vector<double> tmp(hdr.brickSize());
+            fin.clear();
+            fin.seekg(sizeof(brickHeader) + key*tmp.size()*sizeof(double));
+            fin.read(reinterpret_cast<char*>(tmp.data()), tmp.size()*sizeof(double));
+            if ( !fin ) {
+                throw std::runtime_error("Error: cannot read brick from " + fname);
+            }
+            brick b = std::make_shared<const std::vector<T1>>(tmp.begin(), tmp.end());
+            if ( cache.size() >= capacity ) {
+                cache.erase( lru.back() );
+                lru.pop_back();
+            }
+            lru.push_front( key );
+            cache[key] = std::make_pair(b, lru.begin());
+            return b;
+        }
+
+        // values of the box [i0,i1) x [j0,j1) x [k0,k1), x varying fastest
+        void getBox(const size_t i0, const size_t i1,
+                    const size_t j0, const size_t j1,
+                    const size_t k0, const size_t k1,
+                    std::vector<T1>& values) const {
+            if ( i1 > hdr.nv[0] || j1 > hdr.nv[1] || k1 > hdr.nv[2] ||
+                i0 >= i1 || j0 >= j1 || k0 >= k1 ) {
+                throw std::out_of_range("Error: box outside of brick model");
+            }
+            const size_t bs = hdr.bs;
+            const size_t nx = i1-i0;
+            const size_t ny = j1-j0;
+            values.resize( nx*ny*(k1-k0) );
+            for ( size_t kb=k0/bs; kb<=(k1-1)/bs; ++kb ) {
+                for ( size_t jb=j0/bs; jb<=(j1-1)/bs; ++jb ) {
+                    for ( size_t ib=i0/bs; ib<=(i1-1)/bs; ++ib ) {
+                        brick b = get(ib, jb, kb);
+                        const size_t ka = std::max(k0, kb*bs), kz = std::min(k1, (kb+1)*bs);
+                        const size_t ja = std::max(j0, jb*bs), jz = std::min(j1, (jb+1)*bs);
+                        const size_t ia = std::max(i0, ib*bs), iz = std::min(i1, (ib+1)*bs);
+                        for ( size_t k=ka; k<kz; ++k ) {
+                            for ( size_t j=ja; j<jz; ++j ) {
+                                const T1* src = b->data() + ((k-kb*bs)*bs + j-jb*bs)*bs + ia-ib*bs;
+                                std::copy(src, src+(iz-ia),
+                                          values.begin() + ((k-k0)*ny + j-j0)*nx + ia-i0);
+                            }
+                        }
+                    }
+                }
+            }
+        }
+
+    private:
+        std::string fname;
+        brickHeader hdr;
+        mutable std::ifstream fin;
+        size_t capacity;             // max number of bricks held in memory
+        mutable std::mutex mtx;
+        mutable std::list<size_t> lru;  // most recently used first
+        mutable std::unordered_map<size_t, std::pair<brick, std::list<size_t>::iterator>> cache;
+        mutable size_t nHits;
+        mutable size_t nMisses;
+    };
+
+}
+
+#endif
@@ -0,0 +1,208 @@
+//
+//  EdgeLengths.h
+//  ttcr
+//
+//  Created by agent on 2026-10-18.
+//  Copyright (c) 2026 agent. All rights reserved.
+//
+
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef ttcr_EdgeLengths_h
+#define ttcr_EdgeLengths_h
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdlib>
+#include <utility>
+#include <vector>
+
+namespace ttcr {
+
+    // Lengths of the edges relaxed by the shortest path method.  These only
+    // depend on the geometry of the grid and are computed once, so that the
+    // traveltime along an edge is obtained with a multiplication.
+
+    // Rectilinear grids: all primary and secondary nodes lie on a lattice of
+    // spacing dx/(nsx+1), dy/(nsy+1), dz/(nsz+1), and two nodes of the same
+    // cell are at most nsx+1, nsy+1 and nsz+1 lattice steps apart, so that
+    // the lengths form a small table indexed by the lattice offsets.
+    template<typename T1, typename T2>
+    class LatticeEdgeLengths {
+    public:
+        static const size_t defaultMaxBytes = 268435456;
+
+        LatticeEdgeLengths() : nj(0), nk(0) {}
+
+        // returns false if the tables would take more than maxBytes
+        template<typename NODE>
+        bool build(const std::vector<NODE>& nodes,
+                   const T1 xmin, const T1 ymin, const T1 zmin,
+                   const T1 dx, const T1 dy, const T1 dz,
+                   const T2 nsx, const T2 nsy, const T2 nsz,
+                   const size_t maxBytes=defaultMaxBytes) {
+            clear();
+            T1 dxs = dx/(nsx+1);
+            T1 dys = dy/(nsy+1);
+            T1 dzs = dz/(nsz+1);
+            T2 ni = nsx+2;
+            nj = nsy+2;
+            nk = nsz+2;
+            if ( ni*nj*nk*sizeof(T1) + nodes.size()*sizeof(ijk[0]) > maxBytes ) {
+                return false;
+            }
+            lengths.resize(ni*nj*nk);
+            for ( T2 i=0; i<ni; ++i ) {
+                for ( T2 j=0; j<nj; ++j ) {
+                    for ( T2 k=0; k<nk; ++k ) {
+                        lengths[(i*nj+j)*nk+k] = std::sqrt( (i*dxs)*(i*dxs) +
+                                                            (j*dys)*(j*dys) +
+                                                            (k*dzs)*(k*dzs) );
+                    }
+                }
+            }
+            ijk.resize(nodes.size());
+            for ( size_t n=0; n<nodes.size(); ++n ) {
+                ijk[n][0] = static_cast<long>(std::round((nodes[n].getX()-xmin)/dxs));
+                ijk[n][1] = static_cast<long>(std::round((nodes[n].getY()-ymin)/dys));
+                ijk[n][2] = static_cast<long>(std::round((nodes[n].getZ()-zmin)/dzs));
+            }
+            return true;
+        }
+
+        void clear() {
+            std::vector<T1>().swap(lengths);
+            std::vector<std::array<long,3>>().swap(ijk);
+        }
+
+        bool empty() const { return ijk.empty(); }
+
+        // true if node n is a node of the grid (and not a source node added
+        // for a raytracing call)
+        bool contains(const size_t n) const { return n < ijk.size(); }
+
+        // length of the edge between nodes n1 and n2, which must share a cell
+        T1 operator()(const size_t n1, const size_t n2) const {
+            return lengths[(std::labs(ijk[n1][0]-ijk[n2][0])*nj +
+                            std::labs(ijk[n1][1]-ijk[n2][1]))*nk +
+                           std::labs(ijk[n1][2]-ijk[n2][2])];
+        }
+
+    private:
+        size_t nj;
+        size_t nk;
+        std::vector<T1> lengths;
+        std::vector<std::array<long,3>> ijk;   // lattice coordinates of the nodes
+    };
+
+
+    // Unstructured meshes: the m nodes of a cell (neighbors[cell]) are joined
+    // by m(m-1)/2 edges, whose lengths are stored once per cell as a packed
+    // upper triangle.  Each node also keeps its position in the node list of
+    // each of its owners, so that the edges of a node are found from its
+    // owner index without searching.
+    template<typename T1, typename T2>
+    class CellEdgeLengths {
+    public:
+        static const size_t defaultMaxBytes = 268435456;
+
+        // returns false if the tables would take more than maxBytes
+        template<typename NODE>
+        bool build(const std::vector<NODE>& nodes,
+                   const std::vector<std::vector<T2>>& neighbors,
+                   const size_t maxBytes=defaultMaxBytes) {
+            clear();
+            size_t nLengths = 0;
+            for ( size_t c=0; c<neighbors.size(); ++c ) {
+                nLengths += neighbors[c].size()*(neighbors[c].size()-1)/2;
+            }
+            size_t nOwners = 0;
+            for ( size_t n=0; n<nodes.size(); ++n ) {
+                nOwners += nodes[n].getOwners().size();
+            }
+            if ( nLengths*sizeof(T1) + nOwners*sizeof(T2) +
+                (neighbors.size()+nodes.size()+2)*sizeof(size_t) > maxBytes ) {
+                return false;
+            }
+            ownerStart.resize(nodes.size()+1);
+            local.resize(nOwners);
+            ownerStart[0] = 0;
+            for ( size_t n=0; n<nodes.size(); ++n ) {
+                const std::vector<T2>& owners = nodes[n].getOwners();
+                for ( size_t no=0; no<owners.size(); ++no ) {
+                    const std::vector<T2>& neib = neighbors[ owners[no] ];
+                    size_t a = std::find(neib.begin(), neib.end(), n) - neib.begin();
+                    if ( a == neib.size() ) {
+                        // node not listed in its owner, tables cannot be used
+                        clear();
+                        return false;
+                    }
+                    local[ownerStart[n]+no] = static_cast<T2>(a);
+                }
+                ownerStart[n+1] = ownerStart[n] + owners.size();
+            }
+            cellStart.resize(neighbors.size()+1);
+            lengths.resize(nLengths);
+            cellStart[0] = 0;
+            for ( size_t c=0; c<neighbors.size(); ++c ) {
+                const std::vector<T2>& neib = neighbors[c];
+                T1 *l = lengths.data()+cellStart[c];
+                for ( size_t i=0; i<neib.size(); ++i ) {
+                    for ( size_t j=i+1; j<neib.size(); ++j ) {
+                        *l++ = nodes[neib[i]].getDistance( nodes[neib[j]] );
+                    }
+                }
+                cellStart[c+1] = cellStart[c] + neib.size()*(neib.size()-1)/2;
+            }
+            return true;
+        }
+
+        void clear() {
+            std::vector<size_t>().swap(cellStart);
+            std::vector<size_t>().swap(ownerStart);
+            std::vector<T2>().swap(local);
+            std::vector<T1>().swap(lengths);
+        }
+
+        bool empty() const { return ownerStart.empty(); }
+
+        bool contains(const size_t n) const { return n+1 < ownerStart.size(); }
+
+        // position of node n in the node list of its owner no
+        size_t localIndex(const size_t n, const size_t no) const {
+            return local[ownerStart[n]+no];
+        }
+
+        // length of the edge between nodes i and k of cell cellNo, which has
+        // m nodes (i != k)
+        T1 operator()(const size_t cellNo, const size_t m,
+                      size_t i, size_t k) const {
+            if ( i > k ) std::swap(i, k);
+            return lengths[cellStart[cellNo] + i*(2*m-i-1)/2 + k-i-1];
+        }
+
+    private:
+        std::vector<size_t> cellStart;
+        std::vector<size_t> ownerStart;
+        std::vector<T2> local;
+        std::vector<T1> lengths;
+    };
+
+}
+
+#endif
@@ -0,0 +1,141 @@
+//
+//  EdgeTimes.h
+//  ttcr
+//
+//  Created by agent on 2026-10-18.
+//  Copyright (c) 2026 agent. All rights reserved.
+//
+
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef ttcr_EdgeTimes_h
+#define ttcr_EdgeTimes_h
+
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <mutex>
+#include <vector>
+
+namespace ttcr {
+
+    // Traveltimes along the edges relaxed by the shortest path method, for
+    // rectilinear 2D grids of anisotropic cells.  Nodes lie on a lattice of
+    // spacing dx/(nsx+1), dz/(nsz+1), and the traveltime along an edge only
+    // depends on the cell and on the lattice offset (di,dk) between the two
+    // nodes.  Anisotropic cells give the same traveltime for (di,dk) and
+    // (-di,-dk), so that offsets are stored as |di|, |dk| and the sign of
+    // di*dk.  The tables hold times: they are flagged as stale each time the
+    // cell parameters change, and computed again when next used, so that
+    // setting parameters several times between raytracing calls (e.g. in an
+    // inversion loop) costs a single update.  Tables are not built if they
+    // would take more than maxBytes, and times are then computed on the fly.
+    template<typename T1, typename T2>
+    class LatticeEdgeTimes2D {
+    public:
+        static const size_t defaultMaxBytes = 268435456;
+
+        LatticeEdgeTimes2D() : nk(0), nOffsets(0), dxs(0), dzs(0), stale(true) {}
+
+        // returns false if the tables would take more than maxBytes
+        template<typename NODE>
+        bool build(const std::vector<NODE>& nodes,
+                   const T1 xmin, const T1 zmin,
+                   const T1 dx, const T1 dz,
+                   const T2 nsx, const T2 nsz, const size_t nCells,
+                   const size_t maxBytes=defaultMaxBytes) {
+            clear();
+            dxs = dx/(nsx+1);
+            dzs = dz/(nsz+1);
+            nk = nsz+2;
+            nOffsets = 2*(nsx+2)*nk;
+            if ( nOffsets*nCells*sizeof(T1) + nodes.size()*sizeof(ik[0]) > maxBytes ) {
+                return false;
+            }
+            times.resize(nOffsets*nCells);
+            stale.store(true, std::memory_order_release);
+            ik.resize(nodes.size());
+            for ( size_t n=0; n<nodes.size(); ++n ) {
+                ik[n][0] = static_cast<long>(std::round((nodes[n].getX()-xmin)/dxs));
+                ik[n][1] = static_cast<long>(std::round((nodes[n].getZ()-zmin)/dzs));
+            }
+            return true;
+        }
+
+        void clear() {
+            std::vector<T1>().swap(times);
+            std::vector<std::array<long,2>>().swap(ik);
+        }
+
+        bool empty() const { return ik.empty(); }
+
+        // to be called when the cell parameters change
+        void invalidate() { stale.store(true, std::memory_order_release); }
+
+        // compute the traveltimes for all offsets in all cells if the cell
+        // parameters changed since the last call; can be called concurrently
+        template<typename NODE, typename CELL>
+        void update(const CELL& cells) const {
+            if ( ik.empty() || !stale.load(std::memory_order_acquire) ) return;
+            std::lock_guard<std::mutex> lock(mtx);
+            if ( !stale.load(std::memory_order_relaxed) ) return;
+            NODE src(1);
+            NODE rcv(1);
+            src.setX( 0.0 );
+            src.setZ( 0.0 );
+            size_t ni = nOffsets/(2*nk);
+            for ( size_t c=0, n=0; c<times.size()/nOffsets; ++c ) {
+                for ( size_t i=0; i<ni; ++i ) {
+                    for ( size_t k=0; k<nk; ++k ) {
+                        rcv.setX( i*dxs );
+                        rcv.setZ( k*dzs );
+                        times[n++] = cells.computeDt(src, rcv, c);
+                        rcv.setZ( -(k*dzs) );
+                        times[n++] = cells.computeDt(src, rcv, c);
+                    }
+                }
+            }
+            stale.store(false, std::memory_order_release);
+        }
+
+        // true if node n is a node of the grid (and not a source node added
+        // for a raytracing call)
+        bool contains(const size_t n) const { return n < ik.size(); }
+
+        // traveltime between nodes n1 and n2 of cell cellNo
+        T1 operator()(const size_t n1, const size_t n2, const size_t cellNo) const {
+            long di = ik[n1][0]-ik[n2][0];
+            long dk = ik[n1][1]-ik[n2][1];
+            size_t s = (di<0) != (dk<0) ? 1 : 0;
+            return times[cellNo*nOffsets + (std::labs(di)*nk + std::labs(dk))*2 + s];
+        }
+
+    private:
+        size_t nk;
+        size_t nOffsets;        // number of offsets per cell
+        T1 dxs;
+        T1 dzs;
+        mutable std::vector<T1> times;
+        std::vector<std::array<long,2>> ik;   // lattice coordinates of the nodes
+        mutable std::atomic<bool> stale;
+        mutable std::mutex mtx;
+    };
+
+}
+
+#endif
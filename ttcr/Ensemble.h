@@ -0,0 +1,174 @@
+//
+//  Ensemble.h
+//  ttcr
+//
+//  Created by agent on 2026-10-18.
+//  Copyright (c) 2026 agent. All rights reserved.
+//
+
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+
+ Raytracing of a survey through an ensemble of slowness models
+
+ The models share the geometry of a single grid (nodes, neighbours, edge
+ lengths) and its per-thread traveltime arrays.  The slowness of each model
+ is expanded once to all nodes of the grid (getSlownessState), so that
+ switching models is a plain copy and secondary nodes are not interpolated
+ again at each call.
+
+ Slowness being stored in the nodes, one model is active at a time: the
+ shots of a model are dispatched over the threads, and the next model is
+ loaded when they are done.  The traveltimes are written directly in a
+ caller-supplied buffer ordered by model, shot and receiver, and the
+ slowness of the grid is restored afterwards.
+
+ */
+
+#ifndef ttcr_Ensemble_h
+#define ttcr_Ensemble_h
+
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+
+#include "Batch.h"
+#include "Grid3D.h"
+
+namespace ttcr {
+
+    template<typename T1, typename T2>
+    class Ensemble {
+    public:
+        Ensemble(Grid3D<T1,T2>& g) : grid(g), states() {}
+
+        // adds a model, with slowness s given as for setSlowness
+        void addModel(const std::vector<T1>& s) {
+            std::vector<T1> current;
+            grid.getSlownessState(current);
+            states.push_back( std::vector<T1>() );
+            try {
+                grid.setSlowness(s);
+                grid.getSlownessState(states.back());
+            } catch (...) {
+                states.pop_back();
+                grid.setSlownessState(current);
+                throw;
+            }
+            grid.setSlownessState(current);
+        }
+
+        size_t size() const { return states.size(); }
+        void clear() { states.clear(); }
+
+        // number of traveltimes per model
+        size_t getNumberOfData(const survey<T1,sxyz<T1>>& sv) const {
+            size_t n = 0;
+            for ( size_t ns=0; ns<sv.size(); ++ns ) {
+                n += sv.getRx(ns).size();
+            }
+            return n;
+        }
+
+        // traveltimes of shot n at receiver i for model k are written in
+        // tt[k*nData + offset[n] + i], where nData is the number of
+        // traveltimes per model and offset[n] the number of receivers of
+        // the shots before n
+        void raytrace(const survey<T1,sxyz<T1>>& sv, T1* tt,
+                      const size_t nThreads=1);
+
+        // receivers common to all shots, tt ordered as nModels x nTx x nRx
+        void raytrace(const std::vector<std::vector<sxyz<T1>>>& Tx,
+                      const std::vector<std::vector<T1>>& t0,
+                      const std::vector<sxyz<T1>>& Rx,
+                      T1* tt, const size_t nThreads=1) {
+            survey<T1,sxyz<T1>> sv;
+            for ( size_t n=0; n<Tx.size(); ++n ) sv.Tx.push_back( &(Tx[n]) );
+            for ( size_t n=0; n<t0.size(); ++n ) sv.t0.push_back( &(t0[n]) );
+            sv.Rx.push_back( &Rx );
+            raytrace(sv, tt, nThreads);
+        }
+
+        void raytrace(const std::vector<std::vector<sxyz<T1>>>& Tx,
+                      const std::vector<std::vector<T1>>& t0,
+                      const std::vector<std::vector<sxyz<T1>>>& Rx,
+                      std::vector<std::vector<std::vector<T1>>>& tt,
+                      const size_t nThreads=1);
+
+    private:
+        Grid3D<T1,T2>& grid;
+        std::vector<std::vector<T1>> states;
+    };
+
+    template<typename T1, typename T2>
+    void Ensemble<T1,T2>::raytrace(const survey<T1,sxyz<T1>>& sv, T1* tt,
+                                   const size_t nThreads) {
+        const size_t nTx = sv.size();
+        if ( sv.t0.size() != nTx || (sv.Rx.size() != 1 && sv.Rx.size() != nTx) ) {
+            throw std::length_error("Error: Tx, t0 and Rx should have the same size.");
+        }
+        std::vector<size_t> offset(nTx+1, 0);
+        for ( size_t n=0; n<nTx; ++n ) {
+            offset[n+1] = offset[n] + sv.getRx(n).size();
+        }
+        const size_t nData = offset[nTx];
+
+        std::vector<T1> current;
+        grid.getSlownessState(current);
+        Batch<> batch(nThreads);
+        try {
+            for ( size_t k=0; k<states.size(); ++k ) {
+                grid.setSlownessState(states[k]);
+                T1* out = tt + k*nData;
+                const Grid3D<T1,T2>& g = grid;
+                batch.run(nTx, [&g,&sv,&offset,out](const size_t n, const size_t threadNo) {
+                    std::vector<T1> t;
+                    g.raytrace(*(sv.Tx[n]), *(sv.t0[n]), sv.getRx(n), t, threadNo);
+                    std::copy(t.begin(), t.end(), out+offset[n]);
+                });
+            }
+        } catch (...) {
+            grid.setSlownessState(current);
+            throw;
+        }
+        grid.setSlownessState(current);
+    }
+
+    template<typename T1, typename T2>
+    void Ensemble<T1,T2>::raytrace(const std::vector<std::vector<sxyz<T1>>>& Tx,
+                                   const std::vector<std::vector<T1>>& t0,
+                                   const std::vector<std::vector<sxyz<T1>>>& Rx,
+                                   std::vector<std::vector<std::vector<T1>>>& tt,
+                                   const size_t nThreads) {
+        survey<T1,sxyz<T1>> sv(Tx, t0, Rx);
+        std::vector<T1> buffer( states.size()*getNumberOfData(sv) );
+        raytrace(sv, buffer.data(), nThreads);
+        tt.resize( states.size() );
+        typename std::vector<T1>::const_iterator it = buffer.begin();
+        for ( size_t k=0; k<states.size(); ++k ) {
+            tt[k].resize( Tx.size() );
+            for ( size_t n=0; n<Tx.size(); ++n ) {
+                tt[k][n].assign(it, it+sv.getRx(n).size());
+                it += sv.getRx(n).size();
+            }
+        }
+    }
+
+}
+
+#endif
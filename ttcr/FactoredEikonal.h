@@ -0,0 +1,201 @@
+//
+//  FactoredEikonal.h
+//  ttcr
+//
+//  Created by agent on 2026-10-18.
+//  Copyright (c) 2026 agent. All rights reserved.
+//
+
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+
+ Factored eikonal equation of
+
+ @article{fomel09,
+ author = {Fomel, Sergey and Luo, Songting and Zhao, Hongkai},
+ title = {Fast sweeping method for the factored eikonal equation},
+ journal = {Journal of Computational Physics},
+ year = {2009},
+ volume = {228},
+ number = {17},
+ pages = {6440--6455},
+ doi = {10.1016/j.jcp.2009.05.029}
+ }
+
+ The traveltime is written T = t0 + T0*tau, where T0 = s0*|x-xs| is the
+ traveltime in a medium of constant slowness s0 (slowness at the source).
+ tau is smooth at the source and is well approximated by the first order
+ upwind stencils, which removes the error due to the curvature of the
+ wavefront close to the source.
+
+ */
+
+#ifndef ttcr_FactoredEikonal_h
+#define ttcr_FactoredEikonal_h
+
+#include <cmath>
+#include <limits>
+
+#include "ttcr_t.h"
+
+namespace ttcr {
+
+    template<typename T1>
+    struct FactoredSource {
+        bool active;
+        sxyz<T1> pt;    // source coordinates
+        T1 s0;          // slowness at the source
+        T1 t0;          // source time
+
+        FactoredSource() : active(false), pt(), s0(0.0), t0(0.0) {}
+
+        void set(const sxyz<T1>& p, const T1 s, const T1 t) {
+            active = true;
+            pt = p;
+            s0 = s;
+            t0 = t;
+        }
+
+        T1 T0(const sxyz<T1>& x) const {
+            return s0 * x.getDistance(pt);
+        }
+
+        // gradient of T0
+        sxyz<T1> p(const sxyz<T1>& x) const {
+            T1 d = x.getDistance(pt);
+            if ( d == 0.0 ) return sxyz<T1>(0.0, 0.0, 0.0);
+            return sxyz<T1>(s0*(x.x-pt.x)/d, s0*(x.y-pt.y)/d, s0*(x.z-pt.z)/d);
+        }
+
+        // factor tau of traveltime t at x
+        T1 tau(const sxyz<T1>& x, const T1 t) const {
+            T1 t0x = T0(x);
+            return t0x > 0.0 ? (t-t0)/t0x : 1.0;
+        }
+    };
+
+    // First order upwind update at node x of a rectilinear grid.  Along axis
+    // d, tn[d] is the traveltime of the upwind neighbour, located at
+    // x + sgn[d]*h[d] (sgn[d] = -1 or 1), or is max() if there is none.  The
+    // update is the smallest traveltime among the solutions obtained with
+    // the subsets of axes that respect causality; max() is returned if
+    // there is none.
+    template<typename T1>
+    T1 factoredUpdate(const FactoredSource<T1>& src, const sxyz<T1>& x,
+                      const T1 s, const T1 h[3], const T1 tn[3],
+                      const int sgn[3]) {
+
+        const T1 t0x = src.T0(x);
+        if ( t0x == 0.0 ) return std::numeric_limits<T1>::max();
+        const sxyz<T1> p = src.p(x);
+        const T1 pd[3] = { p.x, p.y, p.z };
+
+        // along axis d, the derivative of T is a[d]*tau - b[d]
+        T1 a[3], b[3], sigma[3];
+        bool avail[3];
+        for ( size_t d=0; d<3; ++d ) {
+            avail[d] = tn[d] < std::numeric_limits<T1>::max();
+            if ( !avail[d] ) continue;
+            sxyz<T1> xn = x;
+            if ( d==0 ) xn.x += sgn[d]*h[d];
+            else if ( d==1 ) xn.y += sgn[d]*h[d];
+            else xn.z += sgn[d]*h[d];
+            sigma[d] = -sgn[d];
+            a[d] = pd[d] + sigma[d]*t0x/h[d];
+            b[d] = sigma[d]*t0x*src.tau(xn, tn[d])/h[d];
+        }
+
+        T1 t = std::numeric_limits<T1>::max();
+        for ( int set=1; set<8; ++set ) {
+            T1 A = 0.0, B = 0.0, C = -s*s;
+            bool ok = true;
+            for ( size_t d=0; d<3; ++d ) {
+                if ( (set & (1<<d)) == 0 ) continue;
+                if ( !avail[d] ) { ok = false; break; }
+                A += a[d]*a[d];
+                B += a[d]*b[d];
+                C += b[d]*b[d];
+            }
+            if ( !ok || A == 0.0 ) continue;
+            T1 disc = B*B - A*C;
+            if ( disc < 0.0 ) continue;
+            T1 tau = (B + std::sqrt(disc))/A;
+            for ( size_t d=0; d<3; ++d ) {
+                if ( (set & (1<<d)) != 0 && sigma[d]*(a[d]*tau-b[d]) < 0.0 ) {
+                    ok = false;
+                    break;
+                }
+            }
+            if ( !ok ) continue;
+            T1 tt = src.t0 + t0x*tau;
+            if ( tt < t ) t = tt;
+        }
+        return t;
+    }
+
+    // Update at vertex D of a tetrahedron ABCD, with tau interpolated
+    // linearly in the tetrahedron.  max() is returned if the
+    // characteristic does not cross face ABC.
+    template<typename T1>
+    T1 factoredUpdate(const FactoredSource<T1>& src, const sxyz<T1>& xD,
+                      const T1 s,
+                      const sxyz<T1>& xA, const T1 tA,
+                      const sxyz<T1>& xB, const T1 tB,
+                      const sxyz<T1>& xC, const T1 tC) {
+
+        const T1 t0D = src.T0(xD);
+        if ( t0D == 0.0 ) return std::numeric_limits<T1>::max();
+
+        sxyz<T1> e1 = xA - xD;
+        sxyz<T1> e2 = xB - xD;
+        sxyz<T1> e3 = xC - xD;
+        sxyz<T1> m1 = cross(e2, e3);
+        sxyz<T1> m2 = cross(e3, e1);
+        sxyz<T1> m3 = cross(e1, e2);
+        T1 det = dot(e1, m1);
+        if ( det == 0.0 ) return std::numeric_limits<T1>::max();
+        m1 /= det;
+        m2 /= det;
+        m3 /= det;
+
+        // grad tau = m1*(tauA-tauD) + m2*(tauB-tauD) + m3*(tauC-tauD)
+        // and grad T = tauD*p + T0*grad tau = alpha*tauD + beta
+        const T1 tauA = src.tau(xA, tA);
+        const T1 tauB = src.tau(xB, tB);
+        const T1 tauC = src.tau(xC, tC);
+        sxyz<T1> alpha = src.p(xD) - t0D*(m1 + m2 + m3);
+        sxyz<T1> beta = t0D*(tauA*m1 + tauB*m2 + tauC*m3);
+
+        T1 A = dot(alpha, alpha);
+        T1 B = dot(alpha, beta);
+        T1 C = dot(beta, beta) - s*s;
+        T1 disc = B*B - A*C;
+        if ( A == 0.0 || disc < 0.0 ) return std::numeric_limits<T1>::max();
+        T1 tau = (-B + std::sqrt(disc))/A;
+
+        // -grad T must lie in the cone spanned by DA, DB & DC
+        sxyz<T1> g = tau*alpha + beta;
+        if ( dot(m1, g) > 0.0 || dot(m2, g) > 0.0 || dot(m3, g) > 0.0 ) {
+            return std::numeric_limits<T1>::max();
+        }
+        return src.t0 + t0D*tau;
+    }
+
+}
+
+#endif
@@ -0,0 +1,267 @@
+//
+//  FieldCache.h
+//  ttcr
+//
+//  Created by agent on 2026-10-18.
+//  Copyright (c) 2026 agent. All rights reserved.
+//
+
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+
+ Cache of traveltime fields
+
+ Relocation or survey design compute traveltimes from the same sources
+ many times with the same slowness.  The fields computed at the nodes are
+ kept, keyed by the source points, t0 and the version of the slowness
+ (incremented each time the slowness of the grid, or a setting changing
+ the traveltimes, is set), so that only the interpolation at the
+ receivers has to be done again.  The numbers of sweeps of the solve are
+ stored after the field, and restored along with it.
+
+ The cache holds at most a given number of bytes in memory.  The least
+ recently used fields are dropped, or moved to a memory-mapped file if
+ one is given.  The file is divided in slots holding one field each; it is
+ also managed as a LRU cache, and removed when the cache is destroyed.
+ Fields found in the file are moved back to memory.
+
+ */
+
+#ifndef ttcr_FieldCache_h
+#define ttcr_FieldCache_h
+
+#include <cerrno>
+#include <cstring>
+#include <list>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include "ttcr_t.h"
+
+namespace ttcr {
+
+    template<typename T1>
+    struct fieldKey {
+        std::vector<T1> src;  // coordinates and t0 of the source points
+        size_t version;       // version of the slowness
+
+        template<typename S>
+        fieldKey(const std::vector<S>& Tx, const std::vector<T1>& t0,
+                 const size_t v) : src(), version(v) {
+            src.reserve( 4*Tx.size() );
+            for ( size_t n=0; n<Tx.size(); ++n ) {
+                append(Tx[n]);
+                src.push_back( n<t0.size() ? t0[n] : 0.0 );
+            }
+        }
+
+        bool operator<(const fieldKey<T1>& k) const {
+            return version < k.version || (version == k.version && src < k.src);
+        }
+
+    private:
+        void append(const sxz<T1>& p) {
+            src.push_back( p.x );
+            src.push_back( p.z );
+        }
+        void append(const sxyz<T1>& p) {
+            src.push_back( p.x );
+            src.push_back( p.y );
+            src.push_back( p.z );
+        }
+    };
+
+    template<typename T1>
+    class FieldCache {
+    public:
+        FieldCache(const size_t maxBytes, const std::string& spillFile="",
+                   const size_t spillBytes=0) :
+        capacity(maxBytes), nBytes(0), lru(), index(),
+        fname(spillFile), spillCapacity(spillBytes), fd(-1), mapped(nullptr),
+        slotSize(0), nSlots(0), freeSlots(), spillLru(), spillIndex(),
+        nHits(0), nSpillHits(0), nMisses(0) {
+#ifdef _WIN32
+            if ( !fname.empty() ) {
+                throw std::runtime_error("Error: spilling traveltime fields to a file not supported on this system");
+            }
+#endif
+        }
+
+        ~FieldCache() {
+#ifndef _WIN32
+            if ( mapped != nullptr ) munmap(mapped, nSlots*slotSize*sizeof(T1));
+            if ( fd != -1 ) {
+                close(fd);
+                unlink(fname.c_str());
+            }
+#endif
+        }
+
+        // copies the field of key k in tt, returns false if not found
+        bool get(const fieldKey<T1>& k, std::vector<T1>& tt) {
+            std::lock_guard<std::mutex> lock(mtx);
+            typename std::map<fieldKey<T1>, typename entryList::iterator>::iterator it = index.find(k);
+            if ( it != index.end() ) {
+                nHits++;
+                lru.splice(lru.begin(), lru, it->second);
+                tt = it->second->second;
+                return true;
+            }
+            typename std::map<fieldKey<T1>, typename slotList::iterator>::iterator is = spillIndex.find(k);
+            if ( is != spillIndex.end() ) {
+                nSpillHits++;
+                const T1* p = mapped + is->second->second*slotSize;
+                tt.assign(p, p+slotSize);
+                freeSlots.push_back( is->second->second );
+                spillLru.erase( is->second );
+                spillIndex.erase( is );
+                insert(k, tt);
+                return true;
+            }
+            nMisses++;
+            return false;
+        }
+
+        void put(const fieldKey<T1>& k, const std::vector<T1>& tt) {
+            std::lock_guard<std::mutex> lock(mtx);
+            typename std::map<fieldKey<T1>, typename slotList::iterator>::iterator is = spillIndex.find(k);
+            if ( is != spillIndex.end() ) {
+                freeSlots.push_back( is->second->second );
+                spillLru.erase( is->second );
+                spillIndex.erase( is );
+            }
+            insert(k, tt);
+        }
+
+        void clear() {
+            std::lock_guard<std::mutex> lock(mtx);
+            lru.clear();
+            index.clear();
+            nBytes = 0;
+            for ( typename slotList::const_iterator it=spillLru.begin(); it!=spillLru.end(); ++it )
+                freeSlots.push_back( it->second );
+            spillLru.clear();
+            spillIndex.clear();
+        }
+
+        size_t size() const { return index.size(); }
+        size_t getNumberSpilled() const { return spillIndex.size(); }
+        size_t getBytes() const { return nBytes; }
+        size_t getHits() const { return nHits; }
+        size_t getSpillHits() const { return nSpillHits; }
+        size_t getMisses() const { return nMisses; }
+
+    private:
+        typedef std::list<std::pair<fieldKey<T1>, std::vector<T1>>> entryList;
+        typedef std::list<std::pair<fieldKey<T1>, size_t>> slotList;
+
+        std::mutex mtx;
+        size_t capacity;              // max number of bytes held in memory
+        size_t nBytes;
+        entryList lru;                // most recently used first
+        std::map<fieldKey<T1>, typename entryList::iterator> index;
+
+        std::string fname;
+        size_t spillCapacity;         // max number of bytes in file
+        int fd;
+        T1* mapped;
+        size_t slotSize;              // number of values of a field
+        size_t nSlots;
+        std::vector<size_t> freeSlots;
+        slotList spillLru;            // most recently spilled first
+        std::map<fieldKey<T1>, typename slotList::iterator> spillIndex;
+
+        size_t nHits;
+        size_t nSpillHits;
+        size_t nMisses;
+
+        void insert(const fieldKey<T1>& k, const std::vector<T1>& tt) {
+            typename std::map<fieldKey<T1>, typename entryList::iterator>::iterator it = index.find(k);
+            if ( it != index.end() ) {
+                nBytes -= it->second->second.size()*sizeof(T1);
+                lru.erase( it->second );
+                index.erase( it );
+            }
+            lru.push_front( std::make_pair(k, tt) );
+            index[k] = lru.begin();
+            nBytes += tt.size()*sizeof(T1);
+            while ( nBytes > capacity && !lru.empty() ) {
+                spill( lru.back().first, lru.back().second );
+                nBytes -= lru.back().second.size()*sizeof(T1);
+                index.erase( lru.back().first );
+                lru.pop_back();
+            }
+        }
+
+        void spill(const fieldKey<T1>& k, const std::vector<T1>& tt) {
+            if ( fname.empty() ) return;
+            if ( mapped == nullptr ) mapFile(tt.size());
+            if ( nSlots == 0 || tt.size() != slotSize ) return;
+            if ( freeSlots.empty() ) {
+                freeSlots.push_back( spillLru.back().second );
+                spillIndex.erase( spillLru.back().first );
+                spillLru.pop_back();
+            }
+            const size_t slot = freeSlots.back();
+            freeSlots.pop_back();
+            std::memcpy(mapped + slot*slotSize, tt.data(), slotSize*sizeof(T1));
+            spillLru.push_front( std::make_pair(k, slot) );
+            spillIndex[k] = spillLru.begin();
+        }
+
+        // maps the file, sized for fields of n values
+        void mapFile(const size_t n) {
+#ifndef _WIN32
+            if ( fd != -1 ) return;
+            slotSize = n;
+            nSlots = n == 0 ? 0 : spillCapacity/(n*sizeof(T1));
+            fd = ::open(fname.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+            if ( fd == -1 ) {
+                throw std::runtime_error("Error: cannot open " + fname + ": " + std::strerror(errno));
+            }
+            if ( nSlots == 0 ) return;
+            const size_t len = nSlots*slotSize*sizeof(T1);
+            if ( ftruncate(fd, len) != 0 ) {
+                nSlots = 0;
+                throw std::runtime_error("Error: cannot size " + fname + ": " + std::strerror(errno));
+            }
+            void* p = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if ( p == MAP_FAILED ) {
+                nSlots = 0;
+                throw std::runtime_error("Error: cannot map " + fname + ": " + std::strerror(errno));
+            }
+            mapped = static_cast<T1*>(p);
+            freeSlots.reserve( nSlots );
+            for ( size_t i=nSlots; i>0; --i ) freeSlots.push_back( i-1 );
+#endif
+        }
+    };
+
+}
+
+#endif
@@ -32,6 +32,7 @@
 #include <thread>
 #include <vector>
 
+#include "RayPaths.h"
 #include "ttcr_t.h"
 
 namespace ttcr {
@@ -71,6 +72,19 @@ namespace ttcr {
             throw std::runtime_error("Method should be implemented in subclass");
         }
         
+        // raypaths appended to flat container
+        void raytrace(const std::vector<S>& Tx,
+                      const std::vector<T1>& t0,
+                      const std::vector<S>& Rx,
+                      std::vector<T1>& traveltimes,
+                      RayPaths<float,T2>& rays,
+                      const size_t threadNo=0) const {
+            std::vector<std::vector<S>> r_data;
+            raytrace(Tx, t0, Rx, traveltimes, r_data, threadNo);
+            rays.append(r_data);
+            rays.endGroup();
+        }
+        
         virtual void raytrace(const std::vector<S>& Tx,
                               const std::vector<T1>& t0,
                               const std::vector<const std::vector<S>*>& Rx,
@@ -99,6 +113,54 @@ namespace ttcr {
             throw std::runtime_error("Method should be implemented in subclass");
         }
         
+        // Matrix-free products with the data kernel matrix L (ray lengths in
+        // cells): raytraceLTr adds L^T r to LTr, where r holds the (possibly
+        // weighted) residuals at Rx, and raytraceLx computes L x at Rx.  The
+        // ray lengths are only held for the current source.
+        virtual void raytraceLTr(const std::vector<S>& Tx,
+                                 const std::vector<T1>& t0,
+                                 const std::vector<S>& Rx,
+                                 const std::vector<T1>& r,
+                                 std::vector<T1>& traveltimes,
+                                 std::vector<T1>& LTr,
+                                 const size_t threadNo=0) const {
+            if ( r.size() != Rx.size() ) {
+                throw std::length_error("Error: r and Rx should have the same size.");
+            }
+            std::vector<std::vector<siv2<T1>>> l_data;
+            this->raytrace(Tx, t0, Rx, traveltimes, l_data, threadNo);
+
+            if ( LTr.size() != this->getNumberOfCells() ) {
+                LTr.assign( this->getNumberOfCells(), 0.0 );
+            }
+            for ( size_t n=0; n<Rx.size(); ++n ) {
+                for ( size_t nc=0; nc<l_data[n].size(); ++nc ) {
+                    LTr[ l_data[n][nc].i ] += l_data[n][nc].v * r[n];
+                }
+            }
+        }
+
+        virtual void raytraceLx(const std::vector<S>& Tx,
+                                const std::vector<T1>& t0,
+                                const std::vector<S>& Rx,
+                                const std::vector<T1>& x,
+                                std::vector<T1>& traveltimes,
+                                std::vector<T1>& Lx,
+                                const size_t threadNo=0) const {
+            if ( x.size() != this->getNumberOfCells() ) {
+                throw std::length_error("Error: x should have one value per cell.");
+            }
+            std::vector<std::vector<siv2<T1>>> l_data;
+            this->raytrace(Tx, t0, Rx, traveltimes, l_data, threadNo);
+
+            Lx.assign( Rx.size(), 0.0 );
+            for ( size_t n=0; n<Rx.size(); ++n ) {
+                for ( size_t nc=0; nc<l_data[n].size(); ++nc ) {
+                    Lx[n] += l_data[n][nc].v * x[ l_data[n][nc].i ];
+                }
+            }
+        }
+
         virtual void raytrace(const std::vector<S>& Tx,
                               const std::vector<T1>& t0,
                               const std::vector<S>& Rx,
@@ -145,6 +207,22 @@ namespace ttcr {
                       std::vector<std::vector<std::vector<S>>>& r_data,
                       std::vector<std::vector<std::vector<siv2<T1>>>>& l_data) const;
 
+        // each thread accumulates L^T r in its own buffer, the buffers are
+        // summed at the end
+        void raytraceLTr(const std::vector<std::vector<S>>& Tx,
+                         const std::vector<std::vector<T1>>& t0,
+                         const std::vector<std::vector<S>>& Rx,
+                         const std::vector<std::vector<T1>>& r,
+                         std::vector<std::vector<T1>>& traveltimes,
+                         std::vector<T1>& LTr) const;
+
+        void raytraceLx(const std::vector<std::vector<S>>& Tx,
+                        const std::vector<std::vector<T1>>& t0,
+                        const std::vector<std::vector<S>>& Rx,
+                        const std::vector<T1>& x,
+                        std::vector<std::vector<T1>>& traveltimes,
+                        std::vector<std::vector<T1>>& Lx) const;
+
         virtual void setSlowness(const std::vector<T1>& s) {}
         virtual void setXi(const std::vector<T1>& x) {
                 throw std::runtime_error("Method should be implemented in subclass");
@@ -176,9 +254,34 @@ namespace ttcr {
         virtual void getSlowness(std::vector<T1>&) const {
             throw std::runtime_error("Method should be implemented in subclass");
         }
+        
+        // traveltimes at arbitrary points, from the field computed by the
+        // last call to raytrace with the same threadNo
+        void getTraveltimes(const std::vector<S>& pts,
+                            std::vector<T1>& traveltimes,
+                            const size_t threadNo=0) const {
+            traveltimes.resize( pts.size() );
+            getTraveltimes(pts, traveltimes.data(), threadNo);
+        }
+        void getTraveltimes(const std::vector<S>& pts,
+                            T1* traveltimes,
+                            const size_t threadNo=0) const {
+            this->checkPts(pts);
+            for ( size_t n=0; n<pts.size(); ++n ) {
+                traveltimes[n] = this->getTraveltimeAt(pts[n], threadNo);
+            }
+        }
 
         virtual void saveTT(const std::string &, const int, const size_t nt=0,
                             const int format=1) const {}
+        // numbering of the primary nodes in the model file, when the mesh was
+        // renumbered (see Renumbering.h): saveTT writes nodes in that order
+        virtual void setNodeNumbering(const std::vector<T2>&) {}
+        // shortest path, anisotropic cells: tables of edge traveltimes are
+        // kept within maxBytes (0 disables them), and traveltimes are
+        // otherwise computed on the fly; hasEdgeTables tells if tables are used
+        virtual void setEdgeTables(const size_t maxBytes) {}
+        virtual bool hasEdgeTables() const { return false; }
         
         virtual void saveTTgrad(const std::string &, const size_t nt=0,
                                 const bool vtkFormat=0) const {}
@@ -228,6 +331,13 @@ namespace ttcr {
         
         std::vector<std::vector<T2>> neighbors;  // nodes common to a cell
         
+        virtual void checkPts(const std::vector<S>&) const {}
+        
+        // traveltime at pt, obtained as for the receivers in raytrace
+        virtual T1 getTraveltimeAt(const S& pt, const size_t threadNo) const {
+            throw std::runtime_error("Method should be implemented in subclass");
+        }
+        
         template<typename N>
         void buildGridNeighbors(std::vector<N>& nodes) {
             for ( T2 n=0; n<nodes.size(); ++n ) {
@@ -379,6 +489,80 @@ namespace ttcr {
         }
     }
 
+
+    template<typename T1, typename T2, typename S>
+    void Grid2D<T1,T2,S>::raytraceLTr(const std::vector<std::vector<S>>& Tx,
+                                      const std::vector<std::vector<T1>>& t0,
+                                      const std::vector<std::vector<S>>& Rx,
+                                      const std::vector<std::vector<T1>>& r,
+                                      std::vector<std::vector<T1>>& traveltimes,
+                                      std::vector<T1>& LTr) const {
+        
+        traveltimes.resize( Tx.size() );
+        LTr.assign( this->getNumberOfCells(), 0.0 );
+        if ( Tx.size() == 1 ) {
+            this->raytraceLTr(Tx[0], t0[0], Rx[0], r[0], traveltimes[0], LTr, 0);
+        } else {
+            std::vector<size_t> blk_size = get_blk_size(Tx.size());
+            std::vector<std::vector<T1>> buffer(blk_size.size());
+            
+            std::vector<std::thread> threads(blk_size.size());
+            size_t blk_start = 0;
+            for ( size_t i=0; i<blk_size.size(); ++i ) {
+                
+                size_t blk_end = blk_start + blk_size[i];
+                threads[i]=std::thread( [this,&Tx,&t0,&Rx,&r,&traveltimes,&buffer,blk_start,blk_end,i]{
+                    
+                    for ( size_t n=blk_start; n<blk_end; ++n ) {
+                        this->raytraceLTr(Tx[n], t0[n], Rx[n], r[n], traveltimes[n], buffer[i], i);
+                    }
+                });
+                
+                blk_start = blk_end;
+            }
+            
+            std::for_each(threads.begin(),threads.end(), std::mem_fn(&std::thread::join));
+            
+            for ( size_t i=0; i<buffer.size(); ++i ) {
+                for ( size_t n=0; n<LTr.size(); ++n ) LTr[n] += buffer[i][n];
+            }
+        }
+    }
+
+    template<typename T1, typename T2, typename S>
+    void Grid2D<T1,T2,S>::raytraceLx(const std::vector<std::vector<S>>& Tx,
+                                     const std::vector<std::vector<T1>>& t0,
+                                     const std::vector<std::vector<S>>& Rx,
+                                     const std::vector<T1>& x,
+                                     std::vector<std::vector<T1>>& traveltimes,
+                                     std::vector<std::vector<T1>>& Lx) const {
+        
+        traveltimes.resize( Tx.size() );
+        Lx.resize( Tx.size() );
+        if ( Tx.size() == 1 ) {
+            this->raytraceLx(Tx[0], t0[0], Rx[0], x, traveltimes[0], Lx[0], 0);
+        } else {
+            std::vector<size_t> blk_size = get_blk_size(Tx.size());
+            
+            std::vector<std::thread> threads(blk_size.size());
+            size_t blk_start = 0;
+            for ( size_t i=0; i<blk_size.size(); ++i ) {
+                
+                size_t blk_end = blk_start + blk_size[i];
+                threads[i]=std::thread( [this,&Tx,&t0,&Rx,&x,&traveltimes,&Lx,blk_start,blk_end,i]{
+                    
+                    for ( size_t n=blk_start; n<blk_end; ++n ) {
+                        this->raytraceLx(Tx[n], t0[n], Rx[n], x, traveltimes[n], Lx[n], i);
+                    }
+                });
+                
+                blk_start = blk_end;
+            }
+            
+            std::for_each(threads.begin(),threads.end(), std::mem_fn(&std::thread::join));
+        }
+    }
+
 }
 
 #endif
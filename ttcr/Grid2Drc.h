@@ -52,6 +52,7 @@ namespace ttcr {
         void setSlowness(const std::vector<T1>& s) {
             try {
                 cells.setSlowness( s );
+                updateCells();
             } catch (std::exception& e) {
                 throw;
             }
@@ -59,6 +60,7 @@ namespace ttcr {
         void setXi(const std::vector<T1>& x) {
             try {
                 cells.setXi( x );
+                updateCells();
             } catch (std::exception& e) {
                 throw;
             }
@@ -66,6 +68,7 @@ namespace ttcr {
         void setTiltAngle(const std::vector<T1>& t) {
             try {
                 cells.setTiltAngle( t );
+                updateCells();
             } catch (std::exception& e) {
                 throw;
             }
@@ -73,6 +76,7 @@ namespace ttcr {
         void setVp0(const std::vector<T1>& s) {
             try {
                 cells.setVp0(s);
+                updateCells();
             } catch (std::exception& e) {
                 throw;
             }
@@ -80,6 +84,7 @@ namespace ttcr {
         void setVs0(const std::vector<T1>& s) {
             try {
                 cells.setVs0(s);
+                updateCells();
             } catch (std::exception& e) {
                 throw;
             }
@@ -87,6 +92,7 @@ namespace ttcr {
         void setDelta(const std::vector<T1>& s) {
             try {
                 cells.setDelta(s);
+                updateCells();
             } catch (std::exception& e) {
                 throw;
             }
@@ -94,6 +100,7 @@ namespace ttcr {
         void setEpsilon(const std::vector<T1>& s) {
             try {
                 cells.setEpsilon(s);
+                updateCells();
             } catch (std::exception& e) {
                 throw;
             }
@@ -101,6 +108,7 @@ namespace ttcr {
         void setGamma(const std::vector<T1>& s) {
             try {
                 cells.setGamma(s);
+                updateCells();
             } catch (std::exception& e) {
                 throw;
             }
@@ -177,6 +185,9 @@ namespace ttcr {
         mutable std::vector<NODE> nodes;
         
         CELL cells;   // column-wise (z axis) slowness vector of the cells
+        
+        // called after the cell parameters have been modified
+        virtual void updateCells() {}
                
         void checkPts(const std::vector<S>&) const;
         
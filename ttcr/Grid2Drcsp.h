@@ -46,6 +46,10 @@
 #ifndef __GRID2DRCSP_H__
 #define __GRID2DRCSP_H__
 
+#include <type_traits>
+
+#include "Cell.h"
+#include "EdgeTimes.h"
 #include "Grid2Drc.h"
 #include "Node2Dcsp.h"
 
@@ -105,6 +109,9 @@ namespace ttcr {
         const T2 getNsnx() const { return nsnx; }
         const T2 getNsnz() const { return nsnz; }
         
+        void setEdgeTables(const size_t maxBytes) { buildEdgeTimes(maxBytes); }
+        bool hasEdgeTables() const { return !edgeTimes.empty(); }
+        
         void getTT(std::vector<T1>& tt, const size_t threadNo=0) const final {
             size_t nPrimary = (this->ncx+1) * (this->ncz+1);
             tt.resize(nPrimary);
@@ -120,8 +127,23 @@ namespace ttcr {
         T2 nsnz;    // number of secondary nodes in z
         T2 nsgx;    // number of subgrid cells in x
         T2 nsgz;    // number of subgrid cells in z
+        LatticeEdgeTimes2D<T1,T2> edgeTimes;
         
         void buildGridNodes();
+        void buildEdgeTimes(const size_t maxBytes);
+        
+        void updateCells() {
+            edgeTimes.invalidate();
+        }
+        
+        T1 computeDt(const Node2Dcsp<T1,T2>& source,
+                     const Node2Dcsp<T1,T2>& node,
+                     const T2 cellNo) const {
+            if ( edgeTimes.contains(source.getGridIndex()) ) {
+                return edgeTimes(source.getGridIndex(), node.getGridIndex(), cellNo);
+            }
+            return this->cells.computeDt(source, node, cellNo);
+        }
         
         void propagate(std::priority_queue<Node2Dcsp<T1,T2>*,
                        std::vector<Node2Dcsp<T1,T2>*>,
@@ -161,6 +183,10 @@ namespace ttcr {
         T1 getTraveltime(const S& Rx, const std::vector<Node2Dcsp<T1,T2>>& nodes,
                          const size_t threadNo) const;
         
+        T1 getTraveltimeAt(const S& pt, const size_t threadNo) const {
+            return getTraveltime(pt, this->nodes, threadNo);
+        }
+        
         T1 getTraveltime(const S& Rx, const std::vector<Node2Dcsp<T1,T2>>& nodes,
                          T2& nodeParentRx, T2& cellParentRx,
                          const size_t threadNo) const;
@@ -189,6 +215,21 @@ namespace ttcr {
     {
         buildGridNodes();
         this->template buildGridNeighbors<Node2Dcsp<T1,T2>>(this->nodes);
+        buildEdgeTimes(LatticeEdgeTimes2D<T1,T2>::defaultMaxBytes);
+    }
+    
+    template<typename T1, typename T2, typename S, typename CELL>
+    void Grid2Drcsp<T1,T2,S,CELL>::buildEdgeTimes(const size_t maxBytes) {
+        // tables are not needed for isotropic cells
+        if ( std::is_same<CELL, Cell<T1,Node2Dcsp<T1,T2>,S>>::value ) {
+            return;
+        }
+        if ( !edgeTimes.build(this->nodes, this->xmin, this->zmin, this->dx, this->dz,
+                              nsnx, nsnz, this->ncx*this->ncz, maxBytes) &&
+            maxBytes > 0 && verbose ) {
+            std::cout << "Tables of edge traveltimes would exceed " << maxBytes
+            << " bytes, traveltimes are computed on the fly.\n";
+        }
     }
     
     template<typename T1, typename T2, typename S, typename CELL>
@@ -319,6 +360,8 @@ namespace ttcr {
                                              std::vector<bool>& frozen,
                                              const size_t threadNo) const {
         
+        edgeTimes.template update<Node2Dcsp<T1,T2>>(this->cells);
+        
         for (size_t n=0; n<Tx.size(); ++n) {
             bool found = false;
             for ( size_t nn=0; nn<this->nodes.size(); ++nn ) {
@@ -358,6 +401,8 @@ namespace ttcr {
                                             std::vector<bool>& frozen,
                                             const size_t threadNo) const {
         
+        edgeTimes.template update<Node2Dcsp<T1,T2>>(this->cells);
+        
         for (size_t n=0; n<Tx.size(); ++n) {
             bool found = false;
             for ( size_t nn=0; nn<this->nodes.size(); ++nn ) {
@@ -376,7 +421,7 @@ namespace ttcr {
                             for ( size_t k=0; k< this->neighbors[cellNo].size(); ++k ) {
                                 T2 neibNo = this->neighbors[cellNo][k];
                                 if ( neibNo == nn ) continue;
-                                T1 dt = this->cells.computeDt(this->nodes[nn], this->nodes[neibNo], cellNo);
+                                T1 dt = computeDt(this->nodes[nn], this->nodes[neibNo], cellNo);
                                 
                                 if ( t0[n]+dt < this->nodes[neibNo].getTT(threadNo) ) {
                                     this->nodes[neibNo].setTT( t0[n]+dt, threadNo );
@@ -967,7 +1012,7 @@ namespace ttcr {
                     }
                     
                     // compute dt
-                    T1 dt = this->cells.computeDt(*source, this->nodes[neibNo], cellNo);
+                    T1 dt = computeDt(*source, this->nodes[neibNo], cellNo);
                     
                     if ( source->getTT(threadNo)+dt < this->nodes[neibNo].getTT(threadNo) ) {
                         this->nodes[neibNo].setTT( source->getTT(threadNo)+dt, threadNo );
@@ -1007,7 +1052,7 @@ namespace ttcr {
                     }
                     
                     // compute dt
-                    T1 dt = this->cells.computeDt(*source, this->nodes[neibNo], cellNo);
+                    T1 dt = computeDt(*source, this->nodes[neibNo], cellNo);
                     
                     if ( source->getTT(threadNo)+dt < this->nodes[neibNo].getTT(threadNo) ) {
                         this->nodes[neibNo].setTT( source->getTT(threadNo)+dt, threadNo );
@@ -30,6 +30,7 @@
 #include <cstring>
 #include <iostream>
 #include <fstream>
+#include <functional>
 #include <queue>
 #include <sstream>
 #include <stdexcept>
@@ -143,6 +144,10 @@ namespace ttcr {
         
         T1 getTraveltime(const S& Rx, const size_t threadNo) const;
         
+        T1 getTraveltimeAt(const S& pt, const size_t threadNo) const {
+            return getTraveltime(pt, threadNo);
+        }
+        
         T1 getTraveltime(const S& Rx, T2& nodeParentRx, T2& cellParentRx,
                          const size_t threadNo) const;
         
@@ -202,6 +207,14 @@ namespace ttcr {
                      const std::vector<T1>& t0, std::vector<bool>& frozen,
                      const int npts, const size_t threadNo) const;
         
+        T1 update_node_fmm(const size_t, const size_t,
+                           const std::vector<bool>& frozen,
+                           const bool secondOrder,
+                           const size_t threadNo) const;
+        void propagateFMM(std::vector<bool>& frozen,
+                          const bool secondOrder,
+                          const size_t threadNo) const;
+        
         T1 getSlowness(const S& Rx) const;
         
         void dump_secondary(std::ofstream& os) const {
@@ -1747,8 +1760,9 @@ namespace ttcr {
     template<typename T1, typename T2, typename S, typename NODE>
     void Grid2Drn<T1,T2,S,NODE>::update_node(const size_t i, const size_t j,
                                              const size_t threadNo) const {
+        typedef typename solver_type<T1>::type TS;
         
-        T1 a, b, t;
+        TS a, b, t;
         if (i==0)
             a = nodes[ (i+1)*(ncz+1)+j ].getTT(threadNo);
         else if (i==ncx)
@@ -1769,7 +1783,7 @@ namespace ttcr {
             b = b<t ? b : t;
         }
         
-        T1 fh = nodes[i*(ncz+1)+j].getNodeSlowness() * dx;
+        TS fh = nodes[i*(ncz+1)+j].getNodeSlowness() * dx;
         
         if ( std::abs(a-b) >= fh )
             t = (a<b ? a : b) + fh;
@@ -1784,9 +1798,10 @@ namespace ttcr {
     template<typename T1, typename T2, typename S, typename NODE>
     void Grid2Drn<T1,T2,S,NODE>::update_node45(const size_t i, const size_t j,
                                                const size_t threadNo) const {
+        typedef typename solver_type<T1>::type TS;
         // stencil rotated pi/4
         
-        T1 a, b, t;
+        TS a, b, t;
         if (i==0) {
             if (j!=ncz)
                 a = nodes[ (i+1)*(ncz+1)+j+1 ].getTT(threadNo);
@@ -1831,7 +1846,7 @@ namespace ttcr {
             b = b<t ? b : t;
         }
         
-        T1 fh = 1.414213562373095 * nodes[i*(ncz+1)+j].getNodeSlowness() *
+        TS fh = 1.414213562373095 * nodes[i*(ncz+1)+j].getNodeSlowness() *
         dx;
         if ( std::abs(a-b) >= fh )
             t = (a<b ? a : b) + fh;
@@ -1846,8 +1861,9 @@ namespace ttcr {
     template<typename T1, typename T2, typename S, typename NODE>
     void Grid2Drn<T1,T2,S,NODE>::update_node_xz(const size_t i, const size_t j,
                                                 const size_t threadNo) const {
+        typedef typename solver_type<T1>::type TS;
         
-        T1 a, b, t;
+        TS a, b, t;
         if (i==0)
             a = nodes[ (i+1)*(ncz+1)+j ].getTT(threadNo);
         else if (i==ncx)
@@ -1873,9 +1889,9 @@ namespace ttcr {
         } else if ( a>b && ((a-b)/dz)>nodes[i*(ncz+1)+j].getNodeSlowness() ) {
             t = b + nodes[i*(ncz+1)+j].getNodeSlowness()*dz;
         } else {
-            T1 dx2 = dx*dx;
-            T1 dz2 = dz*dz;
-            T1 s2 = nodes[i*(ncz+1)+j].getNodeSlowness()*nodes[i*(ncz+1)+j].getNodeSlowness();
+            TS dx2 = dx*dx;
+            TS dz2 = dz*dz;
+            TS s2 = nodes[i*(ncz+1)+j].getNodeSlowness()*nodes[i*(ncz+1)+j].getNodeSlowness();
             t = (b*dx2 + a*dz2)/(dx2 + dz2) + sqrt((2.0*a*b*dx2*dz2 - a*a*dx2*dz2 -
                                                     b*b*dx2*dz2 + dx2*dx2*dz2*s2 +
                                                     dx2*dz2*dz2*s2)/((dx2 + dz2)*(dx2 + dz2)));
@@ -1888,6 +1904,7 @@ namespace ttcr {
     template<typename T1, typename T2, typename S, typename NODE>
     void Grid2Drn<T1,T2,S,NODE>::update_node_weno3(const size_t i, const size_t j,
                                                    const size_t threadNo) const {
+        typedef typename solver_type<T1>::type TS;
         
         // not valid if dx != dz
         
@@ -1904,18 +1921,18 @@ namespace ttcr {
         //        }
         
         
-        T1 a, b, t;
+        TS a, b, t;
         if (i==0) {
             a = nodes[ (i+1)*(ncz+1)+j ].getTT(threadNo);  // fist order
         } else if (i==1) {
-            T1 num = nodes[ (i+2)*(ncz+1)+j ].getTT(threadNo) -2.*nodes[ (i+1)*(ncz+1)+j ].getTT(threadNo) + nodes[ i*(ncz+1)+j ].getTT(threadNo);
+            TS num = nodes[ (i+2)*(ncz+1)+j ].getTT(threadNo) -2.*nodes[ (i+1)*(ncz+1)+j ].getTT(threadNo) + nodes[ i*(ncz+1)+j ].getTT(threadNo);
             num *= num;
-            T1 den = nodes[ (i+1)*(ncz+1)+j ].getTT(threadNo) -2.*nodes[ i*(ncz+1)+j ].getTT(threadNo) + nodes[ (i-1)*(ncz+1)+j ].getTT(threadNo);
+            TS den = nodes[ (i+1)*(ncz+1)+j ].getTT(threadNo) -2.*nodes[ i*(ncz+1)+j ].getTT(threadNo) + nodes[ (i-1)*(ncz+1)+j ].getTT(threadNo);
             den *= den;
-            T1 r = (std::numeric_limits<T1>::epsilon()+num)/(std::numeric_limits<T1>::epsilon()+den);
-            T1 w = 1./(1.+2.*r*r);
+            TS r = (std::numeric_limits<T1>::epsilon()+num)/(std::numeric_limits<T1>::epsilon()+den);
+            TS w = 1./(1.+2.*r*r);
             
-            T1 ap = (1.-w)*(nodes[ (i+1)*(ncz+1)+j ].getTT(threadNo)-nodes[ (i-1)*(ncz+1)+j ].getTT(threadNo))/(2.*dx) +
+            TS ap = (1.-w)*(nodes[ (i+1)*(ncz+1)+j ].getTT(threadNo)-nodes[ (i-1)*(ncz+1)+j ].getTT(threadNo))/(2.*dx) +
             w*(-nodes[ (i+2)*(ncz+1)+j ].getTT(threadNo) +4.*nodes[ (i+1)*(ncz+1)+j ].getTT(threadNo) -3.*nodes[ i*(ncz+1)+j ].getTT(threadNo))/(2.*dx);
             
             a = nodes[ i*(ncz+1)+j ].getTT(threadNo) + dx*ap;
@@ -1926,14 +1943,14 @@ namespace ttcr {
         } else if (i==ncx) {
             a = nodes[ (i-1)*(ncz+1)+j ].getTT(threadNo);
         } else if (i==ncx-1) {
-            T1 num = nodes[ i*(ncz+1)+j ].getTT(threadNo) -2.*nodes[ (i-1)*(ncz+1)+j ].getTT(threadNo) + nodes[ (i-2)*(ncz+1)+j ].getTT(threadNo);
+            TS num = nodes[ i*(ncz+1)+j ].getTT(threadNo) -2.*nodes[ (i-1)*(ncz+1)+j ].getTT(threadNo) + nodes[ (i-2)*(ncz+1)+j ].getTT(threadNo);
             num *= num;
-            T1 den = nodes[ (i+1)*(ncz+1)+j ].getTT(threadNo) -2.*nodes[ i*(ncz+1)+j ].getTT(threadNo) + nodes[ (i-1)*(ncz+1)+j ].getTT(threadNo);
+            TS den = nodes[ (i+1)*(ncz+1)+j ].getTT(threadNo) -2.*nodes[ i*(ncz+1)+j ].getTT(threadNo) + nodes[ (i-1)*(ncz+1)+j ].getTT(threadNo);
             den *= den;
-            T1 r = (std::numeric_limits<T1>::epsilon()+num)/(std::numeric_limits<T1>::epsilon()+den);
-            T1 w = 1./(1.+2.*r*r);
+            TS r = (std::numeric_limits<T1>::epsilon()+num)/(std::numeric_limits<T1>::epsilon()+den);
+            TS w = 1./(1.+2.*r*r);
             
-            T1 am = (1.-w)*(nodes[ (i+1)*(ncz+1)+j ].getTT(threadNo)-nodes[ (i-1)*(ncz+1)+j ].getTT(threadNo))/(2.*dx) +
+            TS am = (1.-w)*(nodes[ (i+1)*(ncz+1)+j ].getTT(threadNo)-nodes[ (i-1)*(ncz+1)+j ].getTT(threadNo))/(2.*dx) +
             w*(3.*nodes[ i*(ncz+1)+j ].getTT(threadNo) -4.*nodes[ (i-1)*(ncz+1)+j ].getTT(threadNo) + nodes[ (i-2)*(ncz+1)+j ].getTT(threadNo))/(2.*dx);
             
             a = nodes[ i*(ncz+1)+j ].getTT(threadNo) - dx*am;
@@ -1942,14 +1959,14 @@ namespace ttcr {
             a = a<t ? a : t;
             
         } else {
-            T1 num = nodes[ (i+2)*(ncz+1)+j ].getTT(threadNo) -2.*nodes[ (i+1)*(ncz+1)+j ].getTT(threadNo) + nodes[ i*(ncz+1)+j ].getTT(threadNo);
+            TS num = nodes[ (i+2)*(ncz+1)+j ].getTT(threadNo) -2.*nodes[ (i+1)*(ncz+1)+j ].getTT(threadNo) + nodes[ i*(ncz+1)+j ].getTT(threadNo);
             num *= num;
-            T1 den = nodes[ (i+1)*(ncz+1)+j ].getTT(threadNo) -2.*nodes[ i*(ncz+1)+j ].getTT(threadNo) + nodes[ (i-1)*(ncz+1)+j ].getTT(threadNo);
+            TS den = nodes[ (i+1)*(ncz+1)+j ].getTT(threadNo) -2.*nodes[ i*(ncz+1)+j ].getTT(threadNo) + nodes[ (i-1)*(ncz+1)+j ].getTT(threadNo);
             den *= den;
-            T1 r = (std::numeric_limits<T1>::epsilon()+num)/(std::numeric_limits<T1>::epsilon()+den);
-            T1 w = 1./(1.+2.*r*r);
+            TS r = (std::numeric_limits<T1>::epsilon()+num)/(std::numeric_limits<T1>::epsilon()+den);
+            TS w = 1./(1.+2.*r*r);
             
-            T1 ap = (1.-w)*(nodes[ (i+1)*(ncz+1)+j ].getTT(threadNo)-nodes[ (i-1)*(ncz+1)+j ].getTT(threadNo))/(2.*dx) +
+            TS ap = (1.-w)*(nodes[ (i+1)*(ncz+1)+j ].getTT(threadNo)-nodes[ (i-1)*(ncz+1)+j ].getTT(threadNo))/(2.*dx) +
             w*(-nodes[ (i+2)*(ncz+1)+j ].getTT(threadNo) +4.*nodes[ (i+1)*(ncz+1)+j ].getTT(threadNo) -3.*nodes[ i*(ncz+1)+j ].getTT(threadNo))/(2.*dx);
             
             num = nodes[ i*(ncz+1)+j ].getTT(threadNo) -2.*nodes[ (i-1)*(ncz+1)+j ].getTT(threadNo) + nodes[ (i-2)*(ncz+1)+j ].getTT(threadNo);
@@ -1957,7 +1974,7 @@ namespace ttcr {
             r = (std::numeric_limits<T1>::epsilon()+num)/(std::numeric_limits<T1>::epsilon()+den);
             w = 1./(1.+2.*r*r);
             
-            T1 am = (1.-w)*(nodes[ (i+1)*(ncz+1)+j ].getTT(threadNo)-nodes[ (i-1)*(ncz+1)+j ].getTT(threadNo))/(2.*dx) +
+            TS am = (1.-w)*(nodes[ (i+1)*(ncz+1)+j ].getTT(threadNo)-nodes[ (i-1)*(ncz+1)+j ].getTT(threadNo))/(2.*dx) +
             w*(3.*nodes[ i*(ncz+1)+j ].getTT(threadNo) -4.*nodes[ (i-1)*(ncz+1)+j ].getTT(threadNo) + nodes[ (i-2)*(ncz+1)+j ].getTT(threadNo))/(2.*dx);
             
             a = nodes[ i*(ncz+1)+j ].getTT(threadNo) - dx*am < nodes[ i*(ncz+1)+j ].getTT(threadNo) + dx*ap ?
@@ -1968,14 +1985,14 @@ namespace ttcr {
         if (j==0) {
             b = nodes[ i*(ncz+1)+j+1 ].getTT(threadNo);
         } else if (j==1) {
-            T1 num = nodes[ i*(ncz+1)+j+2 ].getTT(threadNo) -2.*nodes[ i*(ncz+1)+j+1 ].getTT(threadNo) + nodes[ i*(ncz+1)+j ].getTT(threadNo);
+            TS num = nodes[ i*(ncz+1)+j+2 ].getTT(threadNo) -2.*nodes[ i*(ncz+1)+j+1 ].getTT(threadNo) + nodes[ i*(ncz+1)+j ].getTT(threadNo);
             num *= num;
-            T1 den = nodes[ i*(ncz+1)+j+1 ].getTT(threadNo) -2.*nodes[ i*(ncz+1)+j ].getTT(threadNo) + nodes[ i*(ncz+1)+j-1 ].getTT(threadNo);
+            TS den = nodes[ i*(ncz+1)+j+1 ].getTT(threadNo) -2.*nodes[ i*(ncz+1)+j ].getTT(threadNo) + nodes[ i*(ncz+1)+j-1 ].getTT(threadNo);
             den *= den;
-            T1 r = (std::numeric_limits<T1>::epsilon()+num)/(std::numeric_limits<T1>::epsilon()+den);
-            T1 w = 1./(1.+2.*r*r);
+            TS r = (std::numeric_limits<T1>::epsilon()+num)/(std::numeric_limits<T1>::epsilon()+den);
+            TS w = 1./(1.+2.*r*r);
             
-            T1 bp = (1.-w)*(nodes[ i*(ncz+1)+j+1 ].getTT(threadNo)-nodes[ i*(ncz+1)+j-1 ].getTT(threadNo))/(2.*dx) +
+            TS bp = (1.-w)*(nodes[ i*(ncz+1)+j+1 ].getTT(threadNo)-nodes[ i*(ncz+1)+j-1 ].getTT(threadNo))/(2.*dx) +
             w*(-nodes[ i*(ncz+1)+j+2 ].getTT(threadNo) +4.*nodes[ i*(ncz+1)+j+1 ].getTT(threadNo) -3.*nodes[ i*(ncz+1)+j ].getTT(threadNo))/(2.*dx);
             
             b = nodes[ i*(ncz+1)+j ].getTT(threadNo) + dx*bp;
@@ -1986,14 +2003,14 @@ namespace ttcr {
         } else if (j==ncz) {
             b = nodes[ i*(ncz+1)+j-1 ].getTT(threadNo);
         } else if (j==ncz-1) {
-            T1 num = nodes[ i*(ncz+1)+j ].getTT(threadNo) -2.*nodes[ i*(ncz+1)+j-1 ].getTT(threadNo) + nodes[ i*(ncz+1)+j-2 ].getTT(threadNo);
+            TS num = nodes[ i*(ncz+1)+j ].getTT(threadNo) -2.*nodes[ i*(ncz+1)+j-1 ].getTT(threadNo) + nodes[ i*(ncz+1)+j-2 ].getTT(threadNo);
             num *= num;
-            T1 den = nodes[ i*(ncz+1)+j+1 ].getTT(threadNo) -2.*nodes[ i*(ncz+1)+j ].getTT(threadNo) + nodes[ i*(ncz+1)+j-1 ].getTT(threadNo);
+            TS den = nodes[ i*(ncz+1)+j+1 ].getTT(threadNo) -2.*nodes[ i*(ncz+1)+j ].getTT(threadNo) + nodes[ i*(ncz+1)+j-1 ].getTT(threadNo);
             den *= den;
-            T1 r = (std::numeric_limits<T1>::epsilon()+num)/(std::numeric_limits<T1>::epsilon()+den);
-            T1 w = 1./(1.+2.*r*r);
+            TS r = (std::numeric_limits<T1>::epsilon()+num)/(std::numeric_limits<T1>::epsilon()+den);
+            TS w = 1./(1.+2.*r*r);
             
-            T1 bm = (1.-w)*(nodes[ i*(ncz+1)+j+1 ].getTT(threadNo)-nodes[ i*(ncz+1)+j-1 ].getTT(threadNo))/(2.*dx) +
+            TS bm = (1.-w)*(nodes[ i*(ncz+1)+j+1 ].getTT(threadNo)-nodes[ i*(ncz+1)+j-1 ].getTT(threadNo))/(2.*dx) +
             w*(3.*nodes[ i*(ncz+1)+j ].getTT(threadNo) -4.*nodes[ i*(ncz+1)+j-1 ].getTT(threadNo) + nodes[ i*(ncz+1)+j-2 ].getTT(threadNo))/(2.*dx);
             
             b = nodes[ i*(ncz+1)+j ].getTT(threadNo) - dx*bm;
@@ -2002,14 +2019,14 @@ namespace ttcr {
             b = b<t ? b : t;
             
         } else {
-            T1 num = nodes[ i*(ncz+1)+j+2 ].getTT(threadNo) -2.*nodes[ i*(ncz+1)+j+1 ].getTT(threadNo) + nodes[ i*(ncz+1)+j ].getTT(threadNo);
+            TS num = nodes[ i*(ncz+1)+j+2 ].getTT(threadNo) -2.*nodes[ i*(ncz+1)+j+1 ].getTT(threadNo) + nodes[ i*(ncz+1)+j ].getTT(threadNo);
             num *= num;
-            T1 den = nodes[ i*(ncz+1)+j+1 ].getTT(threadNo) -2.*nodes[ i*(ncz+1)+j ].getTT(threadNo) + nodes[ i*(ncz+1)+j-1 ].getTT(threadNo);
+            TS den = nodes[ i*(ncz+1)+j+1 ].getTT(threadNo) -2.*nodes[ i*(ncz+1)+j ].getTT(threadNo) + nodes[ i*(ncz+1)+j-1 ].getTT(threadNo);
             den *= den;
-            T1 r = (std::numeric_limits<T1>::epsilon()+num)/(std::numeric_limits<T1>::epsilon()+den);
-            T1 w = 1./(1.+2.*r*r);
+            TS r = (std::numeric_limits<T1>::epsilon()+num)/(std::numeric_limits<T1>::epsilon()+den);
+            TS w = 1./(1.+2.*r*r);
             
-            T1 bp = (1.-w)*(nodes[ i*(ncz+1)+j+1 ].getTT(threadNo)-nodes[ i*(ncz+1)+j-1 ].getTT(threadNo))/(2.*dx) +
+            TS bp = (1.-w)*(nodes[ i*(ncz+1)+j+1 ].getTT(threadNo)-nodes[ i*(ncz+1)+j-1 ].getTT(threadNo))/(2.*dx) +
             w*(-nodes[ i*(ncz+1)+j+2 ].getTT(threadNo) +4.*nodes[ i*(ncz+1)+j+1 ].getTT(threadNo) -3.*nodes[ i*(ncz+1)+j ].getTT(threadNo))/(2.*dx);
             
             num = nodes[ i*(ncz+1)+j ].getTT(threadNo) -2.*nodes[ i*(ncz+1)+j-1 ].getTT(threadNo) + nodes[ i*(ncz+1)+j-2 ].getTT(threadNo);
@@ -2017,7 +2034,7 @@ namespace ttcr {
             r = (std::numeric_limits<T1>::epsilon()+num)/(std::numeric_limits<T1>::epsilon()+den);
             w = 1./(1.+2.*r*r);
             
-            T1 bm = (1.-w)*(nodes[ i*(ncz+1)+j+1 ].getTT(threadNo)-nodes[ i*(ncz+1)+j-1 ].getTT(threadNo))/(2.*dx) +
+            TS bm = (1.-w)*(nodes[ i*(ncz+1)+j+1 ].getTT(threadNo)-nodes[ i*(ncz+1)+j-1 ].getTT(threadNo))/(2.*dx) +
             w*(3.*nodes[ i*(ncz+1)+j ].getTT(threadNo) -4.*nodes[ i*(ncz+1)+j-1 ].getTT(threadNo) + nodes[ i*(ncz+1)+j-2 ].getTT(threadNo))/(2.*dx);
             
             b = nodes[ i*(ncz+1)+j ].getTT(threadNo) - dx*bm < nodes[ i*(ncz+1)+j ].getTT(threadNo) + dx*bp ?
@@ -2025,7 +2042,7 @@ namespace ttcr {
             
         }
         
-        T1 fh = nodes[i*(ncz+1)+j].getNodeSlowness() * dx;
+        TS fh = nodes[i*(ncz+1)+j].getNodeSlowness() * dx;
         
         if ( std::abs(a-b) >= fh )
             t = (a<b ? a : b) + fh;
@@ -2044,19 +2061,20 @@ namespace ttcr {
     template<typename T1, typename T2, typename S, typename NODE>
     void Grid2Drn<T1,T2,S,NODE>::update_node_weno3_xz(const size_t i, const size_t j,
                                                       const size_t threadNo) const {
+        typedef typename solver_type<T1>::type TS;
         
-        T1 a, b, t;
+        TS a, b, t;
         if (i==0) {
             a = nodes[ (i+1)*(ncz+1)+j ].getTT(threadNo);  // fist order
         } else if (i==1) {
-            T1 num = nodes[ (i+2)*(ncz+1)+j ].getTT(threadNo) -2.*nodes[ (i+1)*(ncz+1)+j ].getTT(threadNo) + nodes[ i*(ncz+1)+j ].getTT(threadNo);
+            TS num = nodes[ (i+2)*(ncz+1)+j ].getTT(threadNo) -2.*nodes[ (i+1)*(ncz+1)+j ].getTT(threadNo) + nodes[ i*(ncz+1)+j ].getTT(threadNo);
             num *= num;
-            T1 den = nodes[ (i+1)*(ncz+1)+j ].getTT(threadNo) -2.*nodes[ i*(ncz+1)+j ].getTT(threadNo) + nodes[ (i-1)*(ncz+1)+j ].getTT(threadNo);
+            TS den = nodes[ (i+1)*(ncz+1)+j ].getTT(threadNo) -2.*nodes[ i*(ncz+1)+j ].getTT(threadNo) + nodes[ (i-1)*(ncz+1)+j ].getTT(threadNo);
             den *= den;
-            T1 r = (std::numeric_limits<T1>::epsilon()+num)/(std::numeric_limits<T1>::epsilon()+den);
-            T1 w = 1./(1.+2.*r*r);
+            TS r = (std::numeric_limits<T1>::epsilon()+num)/(std::numeric_limits<T1>::epsilon()+den);
+            TS w = 1./(1.+2.*r*r);
             
-            T1 ap = (1.-w)*(nodes[ (i+1)*(ncz+1)+j ].getTT(threadNo)-nodes[ (i-1)*(ncz+1)+j ].getTT(threadNo))/(2.*dx) +
+            TS ap = (1.-w)*(nodes[ (i+1)*(ncz+1)+j ].getTT(threadNo)-nodes[ (i-1)*(ncz+1)+j ].getTT(threadNo))/(2.*dx) +
             w*(-nodes[ (i+2)*(ncz+1)+j ].getTT(threadNo) +4.*nodes[ (i+1)*(ncz+1)+j ].getTT(threadNo) -3.*nodes[ i*(ncz+1)+j ].getTT(threadNo))/(2.*dx);
             
             a = nodes[ i*(ncz+1)+j ].getTT(threadNo) + dx*ap;
@@ -2067,14 +2085,14 @@ namespace ttcr {
         } else if (i==ncx) {
             a = nodes[ (i-1)*(ncz+1)+j ].getTT(threadNo);
         } else if (i==ncx-1) {
-            T1 num = nodes[ i*(ncz+1)+j ].getTT(threadNo) -2.*nodes[ (i-1)*(ncz+1)+j ].getTT(threadNo) + nodes[ (i-2)*(ncz+1)+j ].getTT(threadNo);
+            TS num = nodes[ i*(ncz+1)+j ].getTT(threadNo) -2.*nodes[ (i-1)*(ncz+1)+j ].getTT(threadNo) + nodes[ (i-2)*(ncz+1)+j ].getTT(threadNo);
             num *= num;
-            T1 den = nodes[ (i+1)*(ncz+1)+j ].getTT(threadNo) -2.*nodes[ i*(ncz+1)+j ].getTT(threadNo) + nodes[ (i-1)*(ncz+1)+j ].getTT(threadNo);
+            TS den = nodes[ (i+1)*(ncz+1)+j ].getTT(threadNo) -2.*nodes[ i*(ncz+1)+j ].getTT(threadNo) + nodes[ (i-1)*(ncz+1)+j ].getTT(threadNo);
             den *= den;
-            T1 r = (std::numeric_limits<T1>::epsilon()+num)/(std::numeric_limits<T1>::epsilon()+den);
-            T1 w = 1./(1.+2.*r*r);
+            TS r = (std::numeric_limits<T1>::epsilon()+num)/(std::numeric_limits<T1>::epsilon()+den);
+            TS w = 1./(1.+2.*r*r);
             
-            T1 am = (1.-w)*(nodes[ (i+1)*(ncz+1)+j ].getTT(threadNo)-nodes[ (i-1)*(ncz+1)+j ].getTT(threadNo))/(2.*dx) +
+            TS am = (1.-w)*(nodes[ (i+1)*(ncz+1)+j ].getTT(threadNo)-nodes[ (i-1)*(ncz+1)+j ].getTT(threadNo))/(2.*dx) +
             w*(3.*nodes[ i*(ncz+1)+j ].getTT(threadNo) -4.*nodes[ (i-1)*(ncz+1)+j ].getTT(threadNo) + nodes[ (i-2)*(ncz+1)+j ].getTT(threadNo))/(2.*dx);
             
             a = nodes[ i*(ncz+1)+j ].getTT(threadNo) - dx*am;
@@ -2083,14 +2101,14 @@ namespace ttcr {
             a = a<t ? a : t;
             
         } else {
-            T1 num = nodes[ (i+2)*(ncz+1)+j ].getTT(threadNo) -2.*nodes[ (i+1)*(ncz+1)+j ].getTT(threadNo) + nodes[ i*(ncz+1)+j ].getTT(threadNo);
+            TS num = nodes[ (i+2)*(ncz+1)+j ].getTT(threadNo) -2.*nodes[ (i+1)*(ncz+1)+j ].getTT(threadNo) + nodes[ i*(ncz+1)+j ].getTT(threadNo);
             num *= num;
-            T1 den = nodes[ (i+1)*(ncz+1)+j ].getTT(threadNo) -2.*nodes[ i*(ncz+1)+j ].getTT(threadNo) + nodes[ (i-1)*(ncz+1)+j ].getTT(threadNo);
+            TS den = nodes[ (i+1)*(ncz+1)+j ].getTT(threadNo) -2.*nodes[ i*(ncz+1)+j ].getTT(threadNo) + nodes[ (i-1)*(ncz+1)+j ].getTT(threadNo);
             den *= den;
-            T1 r = (std::numeric_limits<T1>::epsilon()+num)/(std::numeric_limits<T1>::epsilon()+den);
-            T1 w = 1./(1.+2.*r*r);
+            TS r = (std::numeric_limits<T1>::epsilon()+num)/(std::numeric_limits<T1>::epsilon()+den);
+            TS w = 1./(1.+2.*r*r);
             
-            T1 ap = (1.-w)*(nodes[ (i+1)*(ncz+1)+j ].getTT(threadNo)-nodes[ (i-1)*(ncz+1)+j ].getTT(threadNo))/(2.*dx) +
+            TS ap = (1.-w)*(nodes[ (i+1)*(ncz+1)+j ].getTT(threadNo)-nodes[ (i-1)*(ncz+1)+j ].getTT(threadNo))/(2.*dx) +
             w*(-nodes[ (i+2)*(ncz+1)+j ].getTT(threadNo) +4.*nodes[ (i+1)*(ncz+1)+j ].getTT(threadNo) -3.*nodes[ i*(ncz+1)+j ].getTT(threadNo))/(2.*dx);
             
             num = nodes[ i*(ncz+1)+j ].getTT(threadNo) -2.*nodes[ (i-1)*(ncz+1)+j ].getTT(threadNo) + nodes[ (i-2)*(ncz+1)+j ].getTT(threadNo);
@@ -2098,7 +2116,7 @@ namespace ttcr {
             r = (std::numeric_limits<T1>::epsilon()+num)/(std::numeric_limits<T1>::epsilon()+den);
             w = 1./(1.+2.*r*r);
             
-            T1 am = (1.-w)*(nodes[ (i+1)*(ncz+1)+j ].getTT(threadNo)-nodes[ (i-1)*(ncz+1)+j ].getTT(threadNo))/(2.*dx) +
+            TS am = (1.-w)*(nodes[ (i+1)*(ncz+1)+j ].getTT(threadNo)-nodes[ (i-1)*(ncz+1)+j ].getTT(threadNo))/(2.*dx) +
             w*(3.*nodes[ i*(ncz+1)+j ].getTT(threadNo) -4.*nodes[ (i-1)*(ncz+1)+j ].getTT(threadNo) + nodes[ (i-2)*(ncz+1)+j ].getTT(threadNo))/(2.*dx);
             
             a = nodes[ i*(ncz+1)+j ].getTT(threadNo) - dx*am < nodes[ i*(ncz+1)+j ].getTT(threadNo) + dx*ap ?
@@ -2109,14 +2127,14 @@ namespace ttcr {
         if (j==0) {
             b = nodes[ i*(ncz+1)+j+1 ].getTT(threadNo);
         } else if (j==1) {
-            T1 num = nodes[ i*(ncz+1)+j+2 ].getTT(threadNo) -2.*nodes[ i*(ncz+1)+j+1 ].getTT(threadNo) + nodes[ i*(ncz+1)+j ].getTT(threadNo);
+            TS num = nodes[ i*(ncz+1)+j+2 ].getTT(threadNo) -2.*nodes[ i*(ncz+1)+j+1 ].getTT(threadNo) + nodes[ i*(ncz+1)+j ].getTT(threadNo);
             num *= num;
-            T1 den = nodes[ i*(ncz+1)+j+1 ].getTT(threadNo) -2.*nodes[ i*(ncz+1)+j ].getTT(threadNo) + nodes[ i*(ncz+1)+j-1 ].getTT(threadNo);
+            TS den = nodes[ i*(ncz+1)+j+1 ].getTT(threadNo) -2.*nodes[ i*(ncz+1)+j ].getTT(threadNo) + nodes[ i*(ncz+1)+j-1 ].getTT(threadNo);
             den *= den;
-            T1 r = (std::numeric_limits<T1>::epsilon()+num)/(std::numeric_limits<T1>::epsilon()+den);
-            T1 w = 1./(1.+2.*r*r);
+            TS r = (std::numeric_limits<T1>::epsilon()+num)/(std::numeric_limits<T1>::epsilon()+den);
+            TS w = 1./(1.+2.*r*r);
             
-            T1 bp = (1.-w)*(nodes[ i*(ncz+1)+j+1 ].getTT(threadNo)-nodes[ i*(ncz+1)+j-1 ].getTT(threadNo))/(2.*dz) +
+            TS bp = (1.-w)*(nodes[ i*(ncz+1)+j+1 ].getTT(threadNo)-nodes[ i*(ncz+1)+j-1 ].getTT(threadNo))/(2.*dz) +
             w*(-nodes[ i*(ncz+1)+j+2 ].getTT(threadNo) +4.*nodes[ i*(ncz+1)+j+1 ].getTT(threadNo) -3.*nodes[ i*(ncz+1)+j ].getTT(threadNo))/(2.*dz);
             
             b = nodes[ i*(ncz+1)+j ].getTT(threadNo) + dz*bp;
@@ -2127,14 +2145,14 @@ namespace ttcr {
         } else if (j==ncz) {
             b = nodes[ i*(ncz+1)+j-1 ].getTT(threadNo);
         } else if (j==ncz-1) {
-            T1 num = nodes[ i*(ncz+1)+j ].getTT(threadNo) -2.*nodes[ i*(ncz+1)+j-1 ].getTT(threadNo) + nodes[ i*(ncz+1)+j-2 ].getTT(threadNo);
+            TS num = nodes[ i*(ncz+1)+j ].getTT(threadNo) -2.*nodes[ i*(ncz+1)+j-1 ].getTT(threadNo) + nodes[ i*(ncz+1)+j-2 ].getTT(threadNo);
             num *= num;
-            T1 den = nodes[ i*(ncz+1)+j+1 ].getTT(threadNo) -2.*nodes[ i*(ncz+1)+j ].getTT(threadNo) + nodes[ i*(ncz+1)+j-1 ].getTT(threadNo);
+            TS den = nodes[ i*(ncz+1)+j+1 ].getTT(threadNo) -2.*nodes[ i*(ncz+1)+j ].getTT(threadNo) + nodes[ i*(ncz+1)+j-1 ].getTT(threadNo);
             den *= den;
-            T1 r = (std::numeric_limits<T1>::epsilon()+num)/(std::numeric_limits<T1>::epsilon()+den);
-            T1 w = 1./(1.+2.*r*r);
+            TS r = (std::numeric_limits<T1>::epsilon()+num)/(std::numeric_limits<T1>::epsilon()+den);
+            TS w = 1./(1.+2.*r*r);
             
-            T1 bm = (1.-w)*(nodes[ i*(ncz+1)+j+1 ].getTT(threadNo)-nodes[ i*(ncz+1)+j-1 ].getTT(threadNo))/(2.*dz) +
+            TS bm = (1.-w)*(nodes[ i*(ncz+1)+j+1 ].getTT(threadNo)-nodes[ i*(ncz+1)+j-1 ].getTT(threadNo))/(2.*dz) +
             w*(3.*nodes[ i*(ncz+1)+j ].getTT(threadNo) -4.*nodes[ i*(ncz+1)+j-1 ].getTT(threadNo) + nodes[ i*(ncz+1)+j-2 ].getTT(threadNo))/(2.*dz);
             
             b = nodes[ i*(ncz+1)+j ].getTT(threadNo) - dz*bm;
@@ -2143,14 +2161,14 @@ namespace ttcr {
             b = b<t ? b : t;
             
         } else {
-            T1 num = nodes[ i*(ncz+1)+j+2 ].getTT(threadNo) -2.*nodes[ i*(ncz+1)+j+1 ].getTT(threadNo) + nodes[ i*(ncz+1)+j ].getTT(threadNo);
+            TS num = nodes[ i*(ncz+1)+j+2 ].getTT(threadNo) -2.*nodes[ i*(ncz+1)+j+1 ].getTT(threadNo) + nodes[ i*(ncz+1)+j ].getTT(threadNo);
             num *= num;
-            T1 den = nodes[ i*(ncz+1)+j+1 ].getTT(threadNo) -2.*nodes[ i*(ncz+1)+j ].getTT(threadNo) + nodes[ i*(ncz+1)+j-1 ].getTT(threadNo);
+            TS den = nodes[ i*(ncz+1)+j+1 ].getTT(threadNo) -2.*nodes[ i*(ncz+1)+j ].getTT(threadNo) + nodes[ i*(ncz+1)+j-1 ].getTT(threadNo);
             den *= den;
-            T1 r = (std::numeric_limits<T1>::epsilon()+num)/(std::numeric_limits<T1>::epsilon()+den);
-            T1 w = 1./(1.+2.*r*r);
+            TS r = (std::numeric_limits<T1>::epsilon()+num)/(std::numeric_limits<T1>::epsilon()+den);
+            TS w = 1./(1.+2.*r*r);
             
-            T1 bp = (1.-w)*(nodes[ i*(ncz+1)+j+1 ].getTT(threadNo)-nodes[ i*(ncz+1)+j-1 ].getTT(threadNo))/(2.*dz) +
+            TS bp = (1.-w)*(nodes[ i*(ncz+1)+j+1 ].getTT(threadNo)-nodes[ i*(ncz+1)+j-1 ].getTT(threadNo))/(2.*dz) +
             w*(-nodes[ i*(ncz+1)+j+2 ].getTT(threadNo) +4.*nodes[ i*(ncz+1)+j+1 ].getTT(threadNo) -3.*nodes[ i*(ncz+1)+j ].getTT(threadNo))/(2.*dz);
             
             num = nodes[ i*(ncz+1)+j ].getTT(threadNo) -2.*nodes[ i*(ncz+1)+j-1 ].getTT(threadNo) + nodes[ i*(ncz+1)+j-2 ].getTT(threadNo);
@@ -2158,7 +2176,7 @@ namespace ttcr {
             r = (std::numeric_limits<T1>::epsilon()+num)/(std::numeric_limits<T1>::epsilon()+den);
             w = 1./(1.+2.*r*r);
             
-            T1 bm = (1.-w)*(nodes[ i*(ncz+1)+j+1 ].getTT(threadNo)-nodes[ i*(ncz+1)+j-1 ].getTT(threadNo))/(2.*dz) +
+            TS bm = (1.-w)*(nodes[ i*(ncz+1)+j+1 ].getTT(threadNo)-nodes[ i*(ncz+1)+j-1 ].getTT(threadNo))/(2.*dz) +
             w*(3.*nodes[ i*(ncz+1)+j ].getTT(threadNo) -4.*nodes[ i*(ncz+1)+j-1 ].getTT(threadNo) + nodes[ i*(ncz+1)+j-2 ].getTT(threadNo))/(2.*dz);
             
             b = nodes[ i*(ncz+1)+j ].getTT(threadNo) - dz*bm < nodes[ i*(ncz+1)+j ].getTT(threadNo) + dz*bp ?
@@ -2171,9 +2189,9 @@ namespace ttcr {
         } else if ( a>b && ((a-b)/dz)>nodes[i*(ncz+1)+j].getNodeSlowness() ) {
             t = b + nodes[i*(ncz+1)+j].getNodeSlowness()*dz;
         } else {
-            T1 dx2 = dx*dx;
-            T1 dz2 = dz*dz;
-            T1 s2 = nodes[i*(ncz+1)+j].getNodeSlowness()*nodes[i*(ncz+1)+j].getNodeSlowness();
+            TS dx2 = dx*dx;
+            TS dz2 = dz*dz;
+            TS s2 = nodes[i*(ncz+1)+j].getNodeSlowness()*nodes[i*(ncz+1)+j].getNodeSlowness();
             t = (b*dx2 + a*dz2)/(dx2 + dz2) + sqrt((2.0*a*b*dx2*dz2 - a*a*dx2*dz2 -
                                                     b*b*dx2*dz2 + dx2*dx2*dz2*s2 +
                                                     dx2*dz2*dz2*s2)/((dx2 + dz2)*(dx2 + dz2)));
@@ -2245,6 +2263,118 @@ namespace ttcr {
         }
     }
     
+    template<typename T1, typename T2, typename S, typename NODE>
+    T1 Grid2Drn<T1,T2,S,NODE>::update_node_fmm(const size_t i, const size_t j,
+                                               const std::vector<bool>& frozen,
+                                               const bool secondOrder,
+                                               const size_t threadNo) const {
+        typedef typename solver_type<T1>::type TS;
+        
+        // Upwind solution of the eikonal equation at node (i,j), using frozen
+        // neighbours only.  Along each axis, the term of the discrete
+        // equation is a*(t-b)^2, with a = 1/h^2 and b = t1 for the first
+        // order stencil, and a = 9/(4h^2) and b = (4t1-t2)/3 for the second
+        // order stencil, t1 and t2 being the upwind values at h and 2h.
+        const long long ij[2] = { static_cast<long long>(i), static_cast<long long>(j) };
+        const long long nn[2] = { static_cast<long long>(ncx+1), static_cast<long long>(ncz+1) };
+        const long long stride[2] = { nn[1], 1 };
+        const TS h[2] = { dx, dz };
+        const long long n = ij[0]*nn[1]+ij[1];
+        
+        TS a[2], b[2];
+        size_t nd = 0;
+        for ( size_t d=0; d<2; ++d ) {
+            TS t1 = std::numeric_limits<T1>::max();
+            TS t2 = std::numeric_limits<T1>::max();
+            for ( long long s=-1; s<=1; s+=2 ) {
+                if ( ij[d]+s < 0 || ij[d]+s >= nn[d] ) continue;
+                long long n1 = n + s*stride[d];
+                if ( !frozen[n1] || nodes[n1].getTT(threadNo) >= t1 ) continue;
+                t1 = nodes[n1].getTT(threadNo);
+                t2 = std::numeric_limits<T1>::max();
+                if ( secondOrder && ij[d]+2*s >= 0 && ij[d]+2*s < nn[d] ) {
+                    long long n2 = n1 + s*stride[d];
+                    if ( frozen[n2] && nodes[n2].getTT(threadNo) <= t1 ) {
+                        t2 = nodes[n2].getTT(threadNo);
+                    }
+                }
+            }
+            if ( t1 == std::numeric_limits<T1>::max() ) continue;
+            if ( t2 < std::numeric_limits<T1>::max() ) {
+                a[nd] = 9./(4.*h[d]*h[d]);
+                b[nd] = (4.*t1 - t2)/3.;
+            } else {
+                a[nd] = 1./(h[d]*h[d]);
+                b[nd] = t1;
+            }
+            ++nd;
+        }
+        if ( nd == 0 ) return std::numeric_limits<T1>::max();
+        if ( nd == 2 && b[1] < b[0] ) {
+            std::swap(a[0], a[1]);
+            std::swap(b[0], b[1]);
+        }
+        
+        // add terms as long as the solution is larger than their b
+        TS s2 = nodes[n].getNodeSlowness() * nodes[n].getNodeSlowness();
+        TS A = 0.0, B = 0.0, C = 0.0;
+        TS t = std::numeric_limits<T1>::max();
+        for ( size_t m=0; m<nd; ++m ) {
+            A += a[m];
+            B += a[m]*b[m];
+            C += a[m]*b[m]*b[m];
+            TS disc = B*B - A*(C-s2);
+            if ( disc < 0.0 ) break;
+            t = (B + std::sqrt(disc))/A;
+            if ( m+1 == nd || t <= b[m+1] ) break;
+        }
+        return t;
+    }
+    
+    template<typename T1, typename T2, typename S, typename NODE>
+    void Grid2Drn<T1,T2,S,NODE>::propagateFMM(std::vector<bool>& frozen,
+                                              const bool secondOrder,
+                                              const size_t threadNo) const {
+        
+        // Fast marching from the frozen nodes.  The narrow band holds
+        // (traveltime, node) pairs; a node whose traveltime decreases is
+        // pushed again, and outdated entries are skipped when popped.
+        std::priority_queue<std::pair<T1,T2>, std::vector<std::pair<T1,T2>>,
+        std::greater<std::pair<T1,T2>>> narrow_band;
+        
+        auto update = [&](const size_t i, const size_t j) {
+            const size_t n = i*(ncz+1)+j;
+            if ( frozen[n] ) return;
+            T1 t = update_node_fmm(i, j, frozen, secondOrder, threadNo);
+            if ( t < nodes[n].getTT(threadNo) ) {
+                nodes[n].setTT(t, threadNo);
+                narrow_band.push( std::make_pair(t, static_cast<T2>(n)) );
+            }
+        };
+        auto updateNeighbours = [&](const size_t i, const size_t j) {
+            if ( i>0 ) update(i-1, j);
+            if ( i<ncx ) update(i+1, j);
+            if ( j>0 ) update(i, j-1);
+            if ( j<ncz ) update(i, j+1);
+        };
+        
+        // initial narrow band: neighbours of the frozen nodes
+        for ( size_t i=0, n=0; i<=ncx; ++i ) {
+            for ( size_t j=0; j<=ncz; ++j, ++n ) {
+                if ( frozen[n] ) updateNeighbours(i, j);
+            }
+        }
+        
+        while ( !narrow_band.empty() ) {
+            std::pair<T1,T2> top = narrow_band.top();
+            narrow_band.pop();
+            const size_t n = top.second;
+            if ( frozen[n] || top.first > nodes[n].getTT(threadNo) ) continue;
+            frozen[n] = true;
+            updateNeighbours(n/(ncz+1), n%(ncz+1));
+        }
+    }
+    
     template<typename T1, typename T2, typename S, typename NODE>
     T1 Grid2Drn<T1,T2,S,NODE>::getSlowness(const S& pt) const {
         
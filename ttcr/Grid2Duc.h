@@ -155,6 +155,15 @@ namespace ttcr {
         
         void saveTT(const std::string &, const int, const size_t nt=0,
                     const int format=1) const;
+        void setNodeNumbering(const std::vector<T2>& i2e) {
+            if ( i2e.size() != nPrimary ) {
+                throw std::length_error("Error: node numbering and mesh of incompatible size.");
+            }
+            nodeOrder.resize( i2e.size() );
+            for ( size_t n=0; n<i2e.size(); ++n ) {
+                nodeOrder[ i2e[n] ] = static_cast<T2>(n);
+            }
+        }
         
 #ifdef VTK
         void saveModelVTU(const std::string &, const bool saveSlowness=true,
@@ -200,6 +209,7 @@ namespace ttcr {
         const size_t nThreads;
         T2 nPrimary;
         mutable std::vector<NODE> nodes;
+        std::vector<T2> nodeOrder;  // nodes in the order of the model file
         std::vector<T1> slowness;
         std::vector<triangleElemAngle<T1,T2>> triangles;
         std::map<T2, virtualNode<T1,NODE>> virtualNodes;
@@ -227,6 +237,10 @@ namespace ttcr {
                          const std::vector<NODE>& nodes,
                          const size_t threadNo) const;
         
+        T1 getTraveltimeAt(const S& pt, const size_t threadNo) const {
+            return getTraveltime(pt, this->nodes, threadNo);
+        }
+        
         T1 getTraveltime(const S& Rx,
                          const std::vector<NODE>& nodes,
                          T2& nodeParentRx,
@@ -444,9 +458,10 @@ namespace ttcr {
                 nMax = static_cast<T2>(nodes.size());
             }
             for ( T2 n=0; n<nMax; ++n ) {
-                fout << nodes[n].getX() << '\t'
-                << nodes[n].getZ() << '\t'
-                << nodes[n].getTT(nt) << '\n';
+                const T2 i = n<nodeOrder.size() ? nodeOrder[n] : n;
+                fout << nodes[i].getX() << '\t'
+                << nodes[i].getZ() << '\t'
+                << nodes[i].getTT(nt) << '\n';
             }
             fout.close();
         } else if ( format == 2) {
@@ -504,7 +519,8 @@ namespace ttcr {
                 nMax = static_cast<T2>(nodes.size());
             }
             for ( T2 n=0; n<nMax; ++n ) {
-                T1 tmp[] = { nodes[n].getX(), nodes[n].getZ(), nodes[n].getTT(nt) };
+                const T2 i = n<nodeOrder.size() ? nodeOrder[n] : n;
+                T1 tmp[] = { nodes[i].getX(), nodes[i].getZ(), nodes[i].getTT(nt) };
                 fout.write( (char*)tmp, 3*sizeof(T1) );
             }
             fout.close();
@@ -777,11 +793,12 @@ namespace ttcr {
     template<typename T1, typename T2, typename NODE, typename S>
     void Grid2Duc<T1,T2,NODE,S>::localSolver(NODE *vertexC,
                                              const size_t threadNo) const {
+        typedef typename solver_type<T1>::type TS;
         
         static const double pi2 = pi / 2.;
         T2 i0, i1, i2;
         NODE *vertexA, *vertexB;
-        T1 a, b, c, alpha, beta;
+        TS a, b, c, alpha, beta;
         
         for ( size_t no=0; no<vertexC->getOwners().size(); ++no ) {
             
@@ -822,28 +839,28 @@ namespace ttcr {
             
             if ( std::abs(vertexB->getTT(threadNo)-vertexA->getTT(threadNo)) <= c*slowness[triangleNo]) {
                 
-                T1 theta = asin( std::abs(vertexB->getTT(threadNo)-vertexA->getTT(threadNo))/
+                TS theta = asin( std::abs(vertexB->getTT(threadNo)-vertexA->getTT(threadNo))/
                                 (c*slowness[triangleNo]) );
                 
                 if ( ((0.>alpha-pi2?0.:alpha-pi2)<=theta && theta<=(pi2-beta) ) ||
                     ((alpha-pi2)<=theta && theta<=(0.<pi2-beta?0.:pi2-beta)) ) {
-                    T1 h = a*sin(alpha-theta);
-                    T1 H = b*sin(beta+theta);
+                    TS h = a*sin(alpha-theta);
+                    TS H = b*sin(beta+theta);
                     
-                    T1 t = 0.5*(h*slowness[triangleNo]+vertexB->getTT(threadNo)) +
+                    TS t = 0.5*(h*slowness[triangleNo]+vertexB->getTT(threadNo)) +
                     0.5*(H*slowness[triangleNo]+vertexA->getTT(threadNo));
                     
                     if ( t<vertexC->getTT(threadNo) )
                         vertexC->setTT(t, threadNo);
                 } else {
-                    T1 t = vertexA->getTT(threadNo) + b*slowness[triangleNo];
+                    TS t = vertexA->getTT(threadNo) + b*slowness[triangleNo];
                     t = t<vertexB->getTT(threadNo) + a*slowness[triangleNo] ? t :
                     vertexB->getTT(threadNo) + a*slowness[triangleNo];
                     if ( t<vertexC->getTT(threadNo) )
                         vertexC->setTT(t, threadNo);
                 }
             } else {
-                T1 t = vertexA->getTT(threadNo) + b*slowness[triangleNo];
+                TS t = vertexA->getTT(threadNo) + b*slowness[triangleNo];
                 t = t<vertexB->getTT(threadNo) + a*slowness[triangleNo] ? t :
                 vertexB->getTT(threadNo) + a*slowness[triangleNo];
                 if ( t<vertexC->getTT(threadNo) )
@@ -86,6 +86,22 @@ namespace ttcr {
                      std::vector<std::vector<siv<T1>>>&,
                      const size_t=0) const;
 
+        void raytraceLTr(const std::vector<S>& Tx,
+                         const std::vector<T1>& t0,
+                         const std::vector<S>& Rx,
+                         const std::vector<T1>& r,
+                         std::vector<T1>& traveltimes,
+                         std::vector<T1>& LTr,
+                         const size_t threadNo=0) const;
+
+        void raytraceLx(const std::vector<S>& Tx,
+                        const std::vector<T1>& t0,
+                        const std::vector<S>& Rx,
+                        const std::vector<T1>& x,
+                        std::vector<T1>& traveltimes,
+                        std::vector<T1>& Lx,
+                        const size_t threadNo=0) const;
+
     private:
         void buildGridNodes(const std::vector<S>&,
                             const int,
@@ -719,6 +735,54 @@ namespace ttcr {
         }
     }
 
+    template<typename T1, typename T2, typename NODE, typename S>
+    void Grid2Ducsp<T1,T2,NODE,S>::raytraceLTr(const std::vector<S>& Tx,
+                                               const std::vector<T1>& t0,
+                                               const std::vector<S>& Rx,
+                                               const std::vector<T1>& r,
+                                               std::vector<T1>& traveltimes,
+                                               std::vector<T1>& LTr,
+                                               const size_t threadNo) const {
+        if ( r.size() != Rx.size() ) {
+            throw std::length_error("Error: r and Rx should have the same size.");
+        }
+        std::vector<std::vector<S>> r_data;
+        std::vector<std::vector<siv<T1>>> l_data;
+        raytrace(Tx, t0, Rx, traveltimes, r_data, l_data, threadNo);
+
+        if ( LTr.size() != this->getNumberOfCells() ) {
+            LTr.assign( this->getNumberOfCells(), 0.0 );
+        }
+        for ( size_t n=0; n<Rx.size(); ++n ) {
+            for ( size_t nc=0; nc<l_data[n].size(); ++nc ) {
+                LTr[ l_data[n][nc].i ] += l_data[n][nc].v * r[n];
+            }
+        }
+    }
+
+    template<typename T1, typename T2, typename NODE, typename S>
+    void Grid2Ducsp<T1,T2,NODE,S>::raytraceLx(const std::vector<S>& Tx,
+                                              const std::vector<T1>& t0,
+                                              const std::vector<S>& Rx,
+                                              const std::vector<T1>& x,
+                                              std::vector<T1>& traveltimes,
+                                              std::vector<T1>& Lx,
+                                              const size_t threadNo) const {
+        if ( x.size() != this->getNumberOfCells() ) {
+            throw std::length_error("Error: x should have one value per cell.");
+        }
+        std::vector<std::vector<S>> r_data;
+        std::vector<std::vector<siv<T1>>> l_data;
+        raytrace(Tx, t0, Rx, traveltimes, r_data, l_data, threadNo);
+
+        Lx.assign( Rx.size(), 0.0 );
+        for ( size_t n=0; n<Rx.size(); ++n ) {
+            for ( size_t nc=0; nc<l_data[n].size(); ++nc ) {
+                Lx[n] += l_data[n][nc].v * x[ l_data[n][nc].i ];
+            }
+        }
+    }
+
 }
 
 #endif
@@ -31,8 +31,14 @@
 #include <exception>
 #include <functional>
 #include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
 #include <thread>
 
+#include "FieldCache.h"
+#include "RayPaths.h"
+#include "Snapshot.h"
 #include "ttcr_t.h"
 
 namespace ttcr {
@@ -42,65 +48,142 @@ namespace ttcr {
     public:
         Grid3D(const bool ttrp, const size_t ncells, const size_t nt=1) :
             nThreads(nt), tt_from_rp(ttrp),
-            neighbors(std::vector<std::vector<T2>>(ncells)) {}
+            neighbors(std::vector<std::vector<T2>>(ncells)),
+            slownessVersion(0), ttCache(), origin(), localCoords(false) {}
 
         virtual ~Grid3D() {}
         
-        virtual void raytrace(const std::vector<sxyz<T1>>& Tx,
-                              const std::vector<T1>& t0,
-                              const std::vector<sxyz<T1>>& Rx,
-                              std::vector<T1>& traveltimes,
-                              const size_t threadNo=0) const;
+        // Tx, Rx and raypaths are in the coordinates of the model; for grids
+        // built relative to an origin (see setOrigin), Tx and Rx are shifted
+        // to the coordinates of the grid before calling the *Local methods
+        // implemented by subclasses, and raypaths are shifted back
+        void raytrace(const std::vector<sxyz<T1>>& Tx,
+                      const std::vector<T1>& t0,
+                      const std::vector<sxyz<T1>>& Rx,
+                      std::vector<T1>& traveltimes,
+                      const size_t threadNo=0) const {
+            std::vector<sxyz<T1>> lTx, lRx;
+            raytraceLocal(toLocal(Tx, lTx), t0, toLocal(Rx, lRx), traveltimes, threadNo);
+        }
+        
+        void raytrace(const std::vector<sxyz<T1>>& Tx,
+                      const std::vector<T1>& t0,
+                      const std::vector<const std::vector<sxyz<T1>>*>& Rx,
+                      std::vector<std::vector<T1>*>& traveltimes,
+                      const size_t threadNo=0) const {
+            std::vector<sxyz<T1>> lTx;
+            std::vector<std::vector<sxyz<T1>>> lRx;
+            std::vector<const std::vector<sxyz<T1>>*> pRx;
+            raytraceLocal(toLocal(Tx, lTx), t0, toLocal(Rx, lRx, pRx), traveltimes, threadNo);
+        }
         
-        virtual void raytrace(const std::vector<sxyz<T1>>& Tx,
-                              const std::vector<T1>& t0,
-                              const std::vector<const std::vector<sxyz<T1>>*>& Rx,
-                              std::vector<std::vector<T1>*>& traveltimes,
-                              const size_t threadNo=0) const;
+        void raytrace(const std::vector<sxyz<T1>>& Tx,
+                      const std::vector<T1>& t0,
+                      const std::vector<sxyz<T1>>& Rx,
+                      std::vector<T1>& traveltimes,
+                      std::vector<std::vector<sxyz<T1>>>& r_data,
+                      const size_t threadNo=0) const {
+            std::vector<sxyz<T1>> lTx, lRx;
+            raytraceLocal(toLocal(Tx, lTx), t0, toLocal(Rx, lRx), traveltimes, r_data, threadNo);
+            toGlobal(r_data);
+        }
         
-        virtual void raytrace(const std::vector<sxyz<T1>>& Tx,
-                              const std::vector<T1>& t0,
-                              const std::vector<sxyz<T1>>& Rx,
-                              std::vector<T1>& traveltimes,
-                              std::vector<std::vector<sxyz<T1>>>& r_data,
-                              const size_t threadNo=0) const;
+        void raytrace(const std::vector<sxyz<T1>>& Tx,
+                      const std::vector<T1>& t0,
+                      const std::vector<const std::vector<sxyz<T1>>*>& Rx,
+                      std::vector<std::vector<T1>*>& traveltimes,
+                      std::vector<std::vector<std::vector<sxyz<T1>>>*>& r_data,
+                      const size_t threadNo=0) const {
+            std::vector<sxyz<T1>> lTx;
+            std::vector<std::vector<sxyz<T1>>> lRx;
+            std::vector<const std::vector<sxyz<T1>>*> pRx;
+            raytraceLocal(toLocal(Tx, lTx), t0, toLocal(Rx, lRx, pRx), traveltimes, r_data, threadNo);
+            for ( size_t n=0; n<r_data.size(); ++n ) toGlobal(*r_data[n]);
+        }
         
-        virtual void raytrace(const std::vector<sxyz<T1>>& Tx,
-                              const std::vector<T1>& t0,
-                              const std::vector<const std::vector<sxyz<T1>>*>& Rx,
-                              std::vector<std::vector<T1>*>& traveltimes,
-                              std::vector<std::vector<std::vector<sxyz<T1>>>*>& r_data,
-                              const size_t threadNo=0) const;
+        // raypaths appended to flat container, as a group
+        void raytrace(const std::vector<sxyz<T1>>& Tx,
+                      const std::vector<T1>& t0,
+                      const std::vector<sxyz<T1>>& Rx,
+                      std::vector<T1>& traveltimes,
+                      RayPaths<float,T2>& rays,
+                      const size_t threadNo=0) const {
+            std::vector<sxyz<T1>> lTx, lRx;
+            const size_t n0 = rays.size();
+            raytraceLocal(toLocal(Tx, lTx), t0, toLocal(Rx, lRx), traveltimes, rays, threadNo);
+            if ( localCoords ) rays.translate(n0, origin.x, origin.y, origin.z);
+        }
         
-        virtual void raytrace(const std::vector<sxyz<T1>>& Tx,
-                              const std::vector<T1>& t0,
-                              const std::vector<sxyz<T1>>& Rx,
-                              std::vector<T1>& traveltimes,
-                              std::vector<std::vector<sxyz<T1>>>& r_data,
-                              std::vector<std::vector<sijv<T1>>>& m_data,
-                              const size_t threadNo=0) const;
-
-        virtual void raytrace(const std::vector<sxyz<T1>>& Tx,
-                              const std::vector<T1>& t0,
-                              const std::vector<sxyz<T1>>& Rx,
-                              std::vector<T1>& traveltimes,
-                              std::vector<std::vector<sijv<T1>>>& m_data,
-                              const size_t threadNo=0) const;
-
-        virtual void raytrace(const std::vector<sxyz<T1>>& Tx,
-                              const std::vector<T1>& t0,
-                              const std::vector<sxyz<T1>>& Rx,
-                              std::vector<T1>& traveltimes,
-                              std::vector<std::vector<siv<T1>>>& l_data,
-                              const size_t threadNo=0) const;
-
-        virtual void raytrace(const std::vector<sxyz<T1>>& Tx,
-                              const std::vector<T1>& t0,
-                              const std::vector<sxyz<T1>>& Rx,
-                              std::vector<T1>& traveltimes,
-                              std::vector<std::vector<sxyz<T1>>>& r_data,
-                              std::vector<std::vector<siv<T1>>>& l_data,
-                              const size_t threadNo=0) const;
+        void raytrace(const std::vector<sxyz<T1>>& Tx,
+                      const std::vector<T1>& t0,
+                      const std::vector<sxyz<T1>>& Rx,
+                      std::vector<T1>& traveltimes,
+                      std::vector<std::vector<sxyz<T1>>>& r_data,
+                      std::vector<std::vector<sijv<T1>>>& m_data,
+                      const size_t threadNo=0) const {
+            std::vector<sxyz<T1>> lTx, lRx;
+            raytraceLocal(toLocal(Tx, lTx), t0, toLocal(Rx, lRx), traveltimes, r_data, m_data, threadNo);
+            toGlobal(r_data);
+        }
+
+        void raytrace(const std::vector<sxyz<T1>>& Tx,
+                      const std::vector<T1>& t0,
+                      const std::vector<sxyz<T1>>& Rx,
+                      std::vector<T1>& traveltimes,
+                      std::vector<std::vector<sijv<T1>>>& m_data,
+                      const size_t threadNo=0) const {
+            std::vector<sxyz<T1>> lTx, lRx;
+            raytraceLocal(toLocal(Tx, lTx), t0, toLocal(Rx, lRx), traveltimes, m_data, threadNo);
+        }
+
+        void raytrace(const std::vector<sxyz<T1>>& Tx,
+                      const std::vector<T1>& t0,
+                      const std::vector<sxyz<T1>>& Rx,
+                      std::vector<T1>& traveltimes,
+                      std::vector<std::vector<siv<T1>>>& l_data,
+                      const size_t threadNo=0) const {
+            std::vector<sxyz<T1>> lTx, lRx;
+            raytraceLocal(toLocal(Tx, lTx), t0, toLocal(Rx, lRx), traveltimes, l_data, threadNo);
+        }
+
+        void raytrace(const std::vector<sxyz<T1>>& Tx,
+                      const std::vector<T1>& t0,
+                      const std::vector<sxyz<T1>>& Rx,
+                      std::vector<T1>& traveltimes,
+                      std::vector<std::vector<sxyz<T1>>>& r_data,
+                      std::vector<std::vector<siv<T1>>>& l_data,
+                      const size_t threadNo=0) const {
+            std::vector<sxyz<T1>> lTx, lRx;
+            raytraceLocal(toLocal(Tx, lTx), t0, toLocal(Rx, lRx), traveltimes, r_data, l_data, threadNo);
+            toGlobal(r_data);
+        }
+
+        // Matrix-free products with the data kernel matrix L (ray lengths in
+        // cells), computed while the raypaths are traced back, without
+        // storing l_data.  raytraceLTr adds L^T r to LTr, where r holds the
+        // (possibly weighted) residuals at Rx, and raytraceLx computes L x
+        // at Rx for the model vector x.
+        void raytraceLTr(const std::vector<sxyz<T1>>& Tx,
+                         const std::vector<T1>& t0,
+                         const std::vector<sxyz<T1>>& Rx,
+                         const std::vector<T1>& r,
+                         std::vector<T1>& traveltimes,
+                         std::vector<T1>& LTr,
+                         const size_t threadNo=0) const {
+            std::vector<sxyz<T1>> lTx, lRx;
+            raytraceLTrLocal(toLocal(Tx, lTx), t0, toLocal(Rx, lRx), r, traveltimes, LTr, threadNo);
+        }
+
+        void raytraceLx(const std::vector<sxyz<T1>>& Tx,
+                        const std::vector<T1>& t0,
+                        const std::vector<sxyz<T1>>& Rx,
+                        const std::vector<T1>& x,
+                        std::vector<T1>& traveltimes,
+                        std::vector<T1>& Lx,
+                        const size_t threadNo=0) const {
+            std::vector<sxyz<T1>> lTx, lRx;
+            raytraceLxLocal(toLocal(Tx, lTx), t0, toLocal(Rx, lRx), x, traveltimes, Lx, threadNo);
+        }
 
         // methods for threaded raytracing
         void raytrace(const std::vector<std::vector<sxyz<T1>>>& Tx,
@@ -140,14 +223,57 @@ namespace ttcr {
                        std::vector<std::vector<std::vector<sxyz<T1>>>>& r_data,
                        std::vector<std::vector<std::vector<siv<T1>>>>& l_data) const;
 
+        // each thread accumulates L^T r in its own buffer, the buffers are
+        // summed at the end
+        void raytraceLTr(const std::vector<std::vector<sxyz<T1>>>& Tx,
+                         const std::vector<std::vector<T1>>& t0,
+                         const std::vector<std::vector<sxyz<T1>>>& Rx,
+                         const std::vector<std::vector<T1>>& r,
+                         std::vector<std::vector<T1>>& traveltimes,
+                         std::vector<T1>& LTr) const;
+
+        void raytraceLx(const std::vector<std::vector<sxyz<T1>>>& Tx,
+                        const std::vector<std::vector<T1>>& t0,
+                        const std::vector<std::vector<sxyz<T1>>>& Rx,
+                        const std::vector<T1>& x,
+                        std::vector<std::vector<T1>>& traveltimes,
+                        std::vector<std::vector<T1>>& Lx) const;
+
         virtual void setSlowness(const std::vector<T1>& s) {}
         virtual void getSlowness(std::vector<T1>&) const {
             throw std::runtime_error("Method should be implemented in subclass");
         }
+        // slowness at all nodes of the grid, including values interpolated at
+        // secondary nodes, to switch between models without interpolating
+        // again (see Ensemble.h)
+        virtual void getSlownessState(std::vector<T1>& s) const { getSlowness(s); }
+        virtual void setSlownessState(const std::vector<T1>& s) { setSlowness(s); }
         virtual void setChi(const std::vector<T1>& x) {}
         virtual void setPsi(const std::vector<T1>& x) {}
         
         virtual void setSourceRadius(const double) {}
+        // temporary nodes (DSPM) built for the last nTx sources are kept, to
+        // be reused if raytracing again from the same sources
+        virtual void setTempNodesCache(const size_t) {}
+        virtual void setFactored(const bool) {}
+        // numbering of the primary nodes in the model file, when the mesh was
+        // renumbered (see Renumbering.h): saveTT writes nodes in that order
+        virtual void setNodeNumbering(const std::vector<T2>&) {}
+        // shortest path: tables of edge lengths are kept within maxBytes (0
+        // disables them), and lengths are otherwise computed on the fly;
+        // hasEdgeTables tells if tables are used
+        virtual void setEdgeTables(const size_t maxBytes) {}
+        virtual bool hasEdgeTables() const { return false; }
+        
+        // fast sweeping: start from the field of the previous solve for the
+        // same source (setWarmStart, fields kept within maxBytes), or from
+        // traveltimes tt at the nodes for the next solve in thread threadNo
+        // (setTraveltimeSeed), s being the slowness at the nodes used to
+        // compute tt, or empty if unknown
+        virtual void setWarmStart(const bool, const size_t maxBytes=268435456) {}
+        virtual void setTraveltimeSeed(const std::vector<T1>& tt,
+                                       const std::vector<T1>& s,
+                                       const size_t threadNo=0) const {}
         
         virtual size_t getNumberOfNodes() const { return 1; }
         virtual size_t getNumberOfCells() const { return 1; }
@@ -155,6 +281,46 @@ namespace ttcr {
             throw std::runtime_error("Method should be implemented in subclass");
         }
         
+        // gradient of the misfit 0.5*sum(r^2) with respect to slowness (at
+        // nodes or cells, as given to setSlowness), computed with the
+        // adjoint-state method from the traveltime field of the last call to
+        // raytrace with the same threadNo.  r holds the residuals at Rx.
+        void getMisfitGradient(const std::vector<sxyz<T1>>& Rx,
+                               const std::vector<T1>& r,
+                               std::vector<T1>& grad,
+                               const size_t threadNo=0) const {
+            std::vector<sxyz<T1>> lRx;
+            getMisfitGradientLocal(toLocal(Rx, lRx), r, grad, threadNo);
+        }
+
+        // threaded version: raytrace from all Tx, and sum the gradients of
+        // the misfit between the traveltimes and tobs
+        void getMisfitGradient(const std::vector<std::vector<sxyz<T1>>>& Tx,
+                               const std::vector<std::vector<T1>>& t0,
+                               const std::vector<std::vector<sxyz<T1>>>& Rx,
+                               const std::vector<std::vector<T1>>& tobs,
+                               std::vector<std::vector<T1>>& traveltimes,
+                               std::vector<T1>& grad) const;
+
+        // traveltimes at arbitrary points, from the field computed by the
+        // last call to raytrace with the same threadNo
+        void getTraveltimes(const std::vector<sxyz<T1>>& pts,
+                            std::vector<T1>& traveltimes,
+                            const size_t threadNo=0) const {
+            traveltimes.resize( pts.size() );
+            getTraveltimes(pts, traveltimes.data(), threadNo);
+        }
+        void getTraveltimes(const std::vector<sxyz<T1>>& pts,
+                            T1* traveltimes,
+                            const size_t threadNo=0) const {
+            std::vector<sxyz<T1>> lpts;
+            const std::vector<sxyz<T1>>& p = toLocal(pts, lpts);
+            this->checkPts(p);
+            for ( size_t n=0; n<p.size(); ++n ) {
+                traveltimes[n] = this->getTraveltimeAt(p[n], threadNo);
+            }
+        }
+        
         virtual void saveTT(const std::string &, const int, const size_t nt=0,
                             const int format=1) const {}
         virtual void loadTT(const std::string &, const int, const size_t nt=0,
@@ -167,12 +333,66 @@ namespace ttcr {
         virtual const T1 getZmin() const { return 1; }
         virtual const T1 getZmax() const { return 1; }
         
-        virtual const int get_niter() const { return 0; }
+        virtual int get_niter() const { return 0; }
         virtual const int get_niterw() const { return 0; }
+        // number of sweeps of the last solve in thread threadNo
+        virtual int getNiter(const size_t threadNo) const { return get_niter(); }
+        
+        // Keep the traveltimes computed at the nodes for each source, so that
+        // raytracing again from the same source with the same slowness only
+        // interpolates the traveltimes at the receivers.  At most maxBytes
+        // are kept in memory; the least recently used fields are dropped, or
+        // moved to spillFile (up to spillBytes) if given (see FieldCache.h).
+        // Fields are discarded when slowness, or a setting changing the
+        // traveltimes, is set.  The cache is disabled with maxBytes equal to
+        // 0, and is not used by grids whose state is not held by the
+        // traveltimes at the nodes (DSPM).
+        void setTraveltimeCache(const size_t maxBytes,
+                                const std::string& spillFile="",
+                                const size_t spillBytes=0) {
+            if ( maxBytes == 0 ) {
+                ttCache.reset();
+            } else {
+                ttCache.reset( new FieldCache<T1>(maxBytes, spillFile, spillBytes) );
+            }
+        }
+        const FieldCache<T1>* getTraveltimeCache() const { return ttCache.get(); }
         
         const size_t getNthreads() const { return nThreads; }
         
+        // For grids built with coordinates relative to an origin (e.g. in
+        // single precision, to keep the precision of distances in models
+        // with coordinates of large magnitude), the origin is subtracted in
+        // double from Tx and Rx, and added to raypaths, extents and to the
+        // node coordinates written by saveTT and saveModelVT*.
+        void setOrigin(const sxyz<double>& o) {
+            origin = o;
+            localCoords = o.x != 0.0 || o.y != 0.0 || o.z != 0.0;
+        }
+        const sxyz<double>& getOrigin() const { return origin; }
+        
         virtual void dump_secondary(std::ofstream&) const {}
+        virtual void getSecondaryNodes(std::vector<sxyz<T1>>& pts) const { pts.clear(); }
+
+        // binary snapshot of the built grid, to restore it without having to
+        // build nodes and neighbors again (see Snapshot.h)
+        virtual void saveSnapshot(std::ostream&) const {
+            throw std::runtime_error("Method should be implemented in subclass");
+        }
+        virtual void loadSnapshot(std::istream&) {
+            throw std::runtime_error("Method should be implemented in subclass");
+        }
+        void getSnapshot(std::string& buffer) const {
+            std::ostringstream os(std::ios::binary);
+            saveSnapshot(os);
+            buffer = os.str();
+        }
+        void setSnapshot(const char* buffer, const size_t size) {
+            SnapshotBuffer sb(buffer, size);
+            std::istream is(&sb);
+            loadSnapshot(is);
+            slownessChanged();
+        }
 
         virtual T1 computeSlowness(const sxyz<T1>&) const {
             throw std::runtime_error("Method should be implemented in subclass");
@@ -187,9 +407,246 @@ namespace ttcr {
                                   const bool saveSlowness=true) const {}
 #endif
     protected:
+        virtual void raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                                   const std::vector<T1>& t0,
+                                   const std::vector<sxyz<T1>>& Rx,
+                                   std::vector<T1>& traveltimes,
+                                   const size_t threadNo=0) const;
+        
+        virtual void raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                                   const std::vector<T1>& t0,
+                                   const std::vector<const std::vector<sxyz<T1>>*>& Rx,
+                                   std::vector<std::vector<T1>*>& traveltimes,
+                                   const size_t threadNo=0) const;
+        
+        virtual void raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                                   const std::vector<T1>& t0,
+                                   const std::vector<sxyz<T1>>& Rx,
+                                   std::vector<T1>& traveltimes,
+                                   std::vector<std::vector<sxyz<T1>>>& r_data,
+                                   const size_t threadNo=0) const;
+        
+        virtual void raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                                   const std::vector<T1>& t0,
+                                   const std::vector<const std::vector<sxyz<T1>>*>& Rx,
+                                   std::vector<std::vector<T1>*>& traveltimes,
+                                   std::vector<std::vector<std::vector<sxyz<T1>>>*>& r_data,
+                                   const size_t threadNo=0) const;
+        
+        virtual void raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                                   const std::vector<T1>& t0,
+                                   const std::vector<sxyz<T1>>& Rx,
+                                   std::vector<T1>& traveltimes,
+                                   RayPaths<float,T2>& rays,
+                                   const size_t threadNo=0) const;
+        
+        virtual void raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                                   const std::vector<T1>& t0,
+                                   const std::vector<sxyz<T1>>& Rx,
+                                   std::vector<T1>& traveltimes,
+                                   std::vector<std::vector<sxyz<T1>>>& r_data,
+                                   std::vector<std::vector<sijv<T1>>>& m_data,
+                                   const size_t threadNo=0) const;
+
+        virtual void raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                                   const std::vector<T1>& t0,
+                                   const std::vector<sxyz<T1>>& Rx,
+                                   std::vector<T1>& traveltimes,
+                                   std::vector<std::vector<sijv<T1>>>& m_data,
+                                   const size_t threadNo=0) const;
+
+        virtual void raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                                   const std::vector<T1>& t0,
+                                   const std::vector<sxyz<T1>>& Rx,
+                                   std::vector<T1>& traveltimes,
+                                   std::vector<std::vector<siv<T1>>>& l_data,
+                                   const size_t threadNo=0) const;
+
+        virtual void raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                                   const std::vector<T1>& t0,
+                                   const std::vector<sxyz<T1>>& Rx,
+                                   std::vector<T1>& traveltimes,
+                                   std::vector<std::vector<sxyz<T1>>>& r_data,
+                                   std::vector<std::vector<siv<T1>>>& l_data,
+                                   const size_t threadNo=0) const;
+
+        virtual void raytraceLTrLocal(const std::vector<sxyz<T1>>& Tx,
+                                      const std::vector<T1>& t0,
+                                      const std::vector<sxyz<T1>>& Rx,
+                                      const std::vector<T1>& r,
+                                      std::vector<T1>& traveltimes,
+                                      std::vector<T1>& LTr,
+                                      const size_t threadNo=0) const;
+
+        virtual void raytraceLxLocal(const std::vector<sxyz<T1>>& Tx,
+                                     const std::vector<T1>& t0,
+                                     const std::vector<sxyz<T1>>& Rx,
+                                     const std::vector<T1>& x,
+                                     std::vector<T1>& traveltimes,
+                                     std::vector<T1>& Lx,
+                                     const size_t threadNo=0) const;
+
+
+        virtual void getMisfitGradientLocal(const std::vector<sxyz<T1>>&,
+                                            const std::vector<T1>&,
+                                            std::vector<T1>&,
+                                            const size_t=0) const {
+            throw std::runtime_error("Method should be implemented in subclass");
+        }
+
+        // for grids whose raypaths are not traced back with getRaypath: the
+        // raypaths of the r_data overload are appended to rays
+        void appendRaypaths(const std::vector<sxyz<T1>>& Tx,
+                            const std::vector<T1>& t0,
+                            const std::vector<sxyz<T1>>& Rx,
+                            std::vector<T1>& traveltimes,
+                            RayPaths<float,T2>& rays,
+                            const size_t threadNo) const {
+            std::vector<std::vector<sxyz<T1>>> r_data;
+            this->raytraceLocal(Tx, t0, Rx, traveltimes, r_data, threadNo);
+            rays.append(r_data);
+            rays.endGroup();
+        }
+
         size_t nThreads;         // number of threads
         bool tt_from_rp;
         std::vector<std::vector<T2>> neighbors;  // nodes common to a cell
+        
+        // incremented each time slowness, or a setting changing the
+        // traveltimes (factored equation, source radius), is set
+        size_t slownessVersion;
+        std::unique_ptr<FieldCache<T1>> ttCache;
+        sxyz<double> origin;
+        bool localCoords;        // origin is not 0
+        
+        // to be called by the methods setting slowness
+        void slownessChanged() {
+            slownessVersion++;
+            if ( ttCache ) ttCache->clear();
+        }
+        
+        // traveltimes of all nodes computed by the last call to raytrace with
+        // threadNo, along with the data needed to use them afterwards.
+        // getTTState returns false if the state cannot be saved.
+        virtual bool getTTState(std::vector<T1>&, const size_t) const {
+            return false;
+        }
+        virtual void setTTState(const std::vector<sxyz<T1>>& Tx,
+                                const std::vector<T1>& t0,
+                                const std::vector<T1>&, const size_t) const {}
+        // called after setTTState, in place of a solve: n and nw are the
+        // numbers of sweeps (nw for WENO3) of the solve that computed the
+        // traveltimes
+        virtual void restoreSolve(const std::vector<sxyz<T1>>& Tx,
+                                  const std::vector<T1>& t0,
+                                  const int n, const int nw,
+                                  const size_t threadNo) const {}
+        
+        // computes the traveltimes at the nodes, or takes them from the cache
+        void computeTT(const std::vector<sxyz<T1>>& Tx,
+                       const std::vector<T1>& t0,
+                       const std::vector<sxyz<T1>>& Rx,
+                       const size_t threadNo) const {
+            if ( !ttCache ) {
+                this->raytraceLocal(Tx, t0, Rx, threadNo);
+                return;
+            }
+            fieldKey<T1> key(Tx, t0, slownessVersion);
+            std::vector<T1> state;
+            if ( ttCache->get(key, state) ) {
+                this->checkPts(Tx);
+                this->checkPts(Rx);
+                restoreTTState(Tx, t0, state, threadNo);
+                return;
+            }
+            this->raytraceLocal(Tx, t0, Rx, threadNo);
+            if ( saveTTState(state, threadNo) ) ttCache->put(key, state);
+        }
+        void computeTT(const std::vector<sxyz<T1>>& Tx,
+                       const std::vector<T1>& t0,
+                       const std::vector<const std::vector<sxyz<T1>>*>& Rx,
+                       const size_t threadNo) const {
+            if ( !ttCache ) {
+                this->raytraceLocal(Tx, t0, Rx, threadNo);
+                return;
+            }
+            fieldKey<T1> key(Tx, t0, slownessVersion);
+            std::vector<T1> state;
+            if ( ttCache->get(key, state) ) {
+                this->checkPts(Tx);
+                for ( size_t n=0; n<Rx.size(); ++n )
+                    this->checkPts(*Rx[n]);
+                restoreTTState(Tx, t0, state, threadNo);
+                return;
+            }
+            this->raytraceLocal(Tx, t0, Rx, threadNo);
+            if ( saveTTState(state, threadNo) ) ttCache->put(key, state);
+        }
+        
+        // cached state: the state of the grid followed by the numbers of
+        // sweeps of the solve
+        bool saveTTState(std::vector<T1>& state, const size_t threadNo) const {
+            if ( !getTTState(state, threadNo) ) return false;
+            state.push_back( static_cast<T1>(getNiter(threadNo)) );
+            state.push_back( static_cast<T1>(get_niterw()) );
+            return true;
+        }
+        void restoreTTState(const std::vector<sxyz<T1>>& Tx,
+                            const std::vector<T1>& t0,
+                            std::vector<T1>& state,
+                            const size_t threadNo) const {
+            const int nw = static_cast<int>(state.back());
+            state.pop_back();
+            const int n = static_cast<int>(state.back());
+            state.pop_back();
+            setTTState(Tx, t0, state, threadNo);
+            restoreSolve(Tx, t0, n, nw, threadNo);
+        }
+
+        // pts in the coordinates of the grid: pts itself if the origin is
+        // 0, or pts shifted into buffer
+        const std::vector<sxyz<T1>>& toLocal(const std::vector<sxyz<T1>>& pts,
+                                             std::vector<sxyz<T1>>& buffer) const {
+            if ( !localCoords ) return pts;
+            buffer.resize( pts.size() );
+            for ( size_t n=0; n<pts.size(); ++n ) {
+                buffer[n].x = static_cast<T1>(pts[n].x-origin.x);
+                buffer[n].y = static_cast<T1>(pts[n].y-origin.y);
+                buffer[n].z = static_cast<T1>(pts[n].z-origin.z);
+            }
+            return buffer;
+        }
+        const std::vector<const std::vector<sxyz<T1>>*>&
+        toLocal(const std::vector<const std::vector<sxyz<T1>>*>& pts,
+                std::vector<std::vector<sxyz<T1>>>& buffer,
+                std::vector<const std::vector<sxyz<T1>>*>& ptrs) const {
+            if ( !localCoords ) return pts;
+            buffer.resize( pts.size() );
+            ptrs.resize( pts.size() );
+            for ( size_t n=0; n<pts.size(); ++n ) {
+                ptrs[n] = &toLocal(*pts[n], buffer[n]);
+            }
+            return ptrs;
+        }
+        void toGlobal(std::vector<std::vector<sxyz<T1>>>& r_data) const {
+            if ( !localCoords ) return;
+            for ( size_t n=0; n<r_data.size(); ++n ) {
+                for ( size_t i=0; i<r_data[n].size(); ++i ) {
+                    sxyz<T1>& p = r_data[n][i];
+                    p.x = static_cast<T1>(p.x+origin.x);
+                    p.y = static_cast<T1>(p.y+origin.y);
+                    p.z = static_cast<T1>(p.z+origin.z);
+                }
+            }
+        }
+
+        virtual void checkPts(const std::vector<sxyz<T1>>&) const {}
+        
+        // traveltime at pt, obtained as for the receivers in raytrace
+        virtual T1 getTraveltimeAt(const sxyz<T1>& pt,
+                                   const size_t threadNo) const {
+            return this->getTraveltime(pt, threadNo);
+        }
 
         template<typename N>
         void buildGridNeighbors(const std::vector<N>& nodes) {
@@ -201,17 +658,18 @@ namespace ttcr {
             }
         }
 
-        virtual void raytrace(const std::vector<sxyz<T1>>& Tx,
-                              const std::vector<T1>& t0,
-                              const std::vector<sxyz<T1>>& Rx,
-                              const size_t threadNo=0) const {
+        // solves from Tx, without computing traveltimes at Rx
+        virtual void raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                                   const std::vector<T1>& t0,
+                                   const std::vector<sxyz<T1>>& Rx,
+                                   const size_t threadNo=0) const {
             throw std::runtime_error("Method should be implemented in subclass");
         }
 
-        virtual void raytrace(const std::vector<sxyz<T1>>& Tx,
-                      const std::vector<T1>& t0,
-                      const std::vector<const std::vector<sxyz<T1>>*>& Rx,
-                      const size_t threadNo=0) const {
+        virtual void raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                                   const std::vector<T1>& t0,
+                                   const std::vector<const std::vector<sxyz<T1>>*>& Rx,
+                                   const size_t threadNo=0) const {
             throw std::runtime_error("Method should be implemented in subclass");
         }
 
@@ -296,12 +754,12 @@ namespace ttcr {
 
 
     template<typename T1, typename T2>
-    void Grid3D<T1,T2>::raytrace(const std::vector<sxyz<T1>>& Tx,
-                                 const std::vector<T1>& t0,
-                                 const std::vector<sxyz<T1>>& Rx,
-                                 std::vector<T1>& traveltimes,
-                                 const size_t threadNo) const {
-        this->raytrace(Tx, t0, Rx, threadNo);
+    void Grid3D<T1,T2>::raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                                      const std::vector<T1>& t0,
+                                      const std::vector<sxyz<T1>>& Rx,
+                                      std::vector<T1>& traveltimes,
+                                      const size_t threadNo) const {
+        this->computeTT(Tx, t0, Rx, threadNo);
 
         if ( traveltimes.size() != Rx.size() ) {
             traveltimes.resize( Rx.size() );
@@ -319,12 +777,12 @@ namespace ttcr {
     }
 
     template<typename T1, typename T2>
-    void Grid3D<T1,T2>::raytrace(const std::vector<sxyz<T1>>& Tx,
-                                 const std::vector<T1>& t0,
-                                 const std::vector<const std::vector<sxyz<T1>>*>& Rx,
-                                 std::vector<std::vector<T1>*>& traveltimes,
-                                 const size_t threadNo) const {
-        this->raytrace(Tx, t0, Rx, threadNo);
+    void Grid3D<T1,T2>::raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                                      const std::vector<T1>& t0,
+                                      const std::vector<const std::vector<sxyz<T1>>*>& Rx,
+                                      std::vector<std::vector<T1>*>& traveltimes,
+                                      const size_t threadNo) const {
+        this->computeTT(Tx, t0, Rx, threadNo);
 
         if ( traveltimes.size() != Rx.size() ) {
             traveltimes.resize( Rx.size() );
@@ -346,14 +804,14 @@ namespace ttcr {
     }
 
     template<typename T1, typename T2>
-    void Grid3D<T1,T2>::raytrace(const std::vector<sxyz<T1>>& Tx,
-                                 const std::vector<T1>& t0,
-                                 const std::vector<sxyz<T1>>& Rx,
-                                 std::vector<T1>& traveltimes,
-                                 std::vector<std::vector<sxyz<T1>>>& r_data,
-                                 const size_t threadNo) const {
+    void Grid3D<T1,T2>::raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                                      const std::vector<T1>& t0,
+                                      const std::vector<sxyz<T1>>& Rx,
+                                      std::vector<T1>& traveltimes,
+                                      std::vector<std::vector<sxyz<T1>>>& r_data,
+                                      const size_t threadNo) const {
 
-        this->raytrace(Tx, t0, Rx, threadNo);
+        this->computeTT(Tx, t0, Rx, threadNo);
 
         if ( r_data.size() != Rx.size() ) {
             r_data.resize( Rx.size() );
@@ -370,16 +828,39 @@ namespace ttcr {
     }
 
     template<typename T1, typename T2>
-    void Grid3D<T1,T2>::raytrace(const std::vector<sxyz<T1>>& Tx,
-                                 const std::vector<T1>& t0,
-                                 const std::vector<const std::vector<sxyz<T1>>*>& Rx,
-                                 std::vector<std::vector<T1>*>& traveltimes,
-                                 std::vector<std::vector<std::vector<sxyz<T1>>>*>& r_data,
-                                 const size_t threadNo) const {
+    void Grid3D<T1,T2>::raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                                      const std::vector<T1>& t0,
+                                      const std::vector<sxyz<T1>>& Rx,
+                                      std::vector<T1>& traveltimes,
+                                      RayPaths<float,T2>& rays,
+                                      const size_t threadNo) const {
+
+        this->computeTT(Tx, t0, Rx, threadNo);
+
+        if ( traveltimes.size() != Rx.size() ) {
+            traveltimes.resize( Rx.size() );
+        }
+        // each raypath is appended as soon as it is traced back
+        std::vector<sxyz<T1>> r;
+        for (size_t n=0; n<Rx.size(); ++n) {
+            r.resize( 0 );
+            this->getRaypath(Tx, t0, Rx[n], r, traveltimes[n], threadNo);
+            rays.append(r);
+        }
+        rays.endGroup();
+    }
+
+    template<typename T1, typename T2>
+    void Grid3D<T1,T2>::raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                                      const std::vector<T1>& t0,
+                                      const std::vector<const std::vector<sxyz<T1>>*>& Rx,
+                                      std::vector<std::vector<T1>*>& traveltimes,
+                                      std::vector<std::vector<std::vector<sxyz<T1>>>*>& r_data,
+                                      const size_t threadNo) const {
         if ( verbose > 2 ) {
             std::cout << "\nIn Grid3D::raytrace(..., r_data, threadNo)\n" << std::endl;
         }
-        this->raytrace(Tx, t0, Rx, threadNo);
+        this->computeTT(Tx, t0, Rx, threadNo);
 
         if ( r_data.size() != Rx.size() ) {
             r_data.resize( Rx.size() );
@@ -403,14 +884,14 @@ namespace ttcr {
     }
 
     template<typename T1, typename T2>
-    void Grid3D<T1,T2>::raytrace(const std::vector<sxyz<T1>>& Tx,
-                                 const std::vector<T1>& t0,
-                                 const std::vector<sxyz<T1>>& Rx,
-                                 std::vector<T1>& traveltimes,
-                                 std::vector<std::vector<sxyz<T1>>>& r_data,
-                                 std::vector<std::vector<sijv<T1>>>& m_data,
-                                 const size_t threadNo) const {
-        this->raytrace(Tx, t0, Rx, threadNo);
+    void Grid3D<T1,T2>::raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                                      const std::vector<T1>& t0,
+                                      const std::vector<sxyz<T1>>& Rx,
+                                      std::vector<T1>& traveltimes,
+                                      std::vector<std::vector<sxyz<T1>>>& r_data,
+                                      std::vector<std::vector<sijv<T1>>>& m_data,
+                                      const size_t threadNo) const {
+        this->computeTT(Tx, t0, Rx, threadNo);
 
         if ( r_data.size() != Rx.size() ) {
             r_data.resize( Rx.size() );
@@ -431,17 +912,17 @@ namespace ttcr {
     }
 
     template<typename T1, typename T2>
-    void Grid3D<T1,T2>::raytrace(const std::vector<sxyz<T1>>& Tx,
-                                 const std::vector<T1>& t0,
-                                 const std::vector<sxyz<T1>>& Rx,
-                                 std::vector<T1>& traveltimes,
-                                 std::vector<std::vector<sxyz<T1>>>& r_data,
-                                 std::vector<std::vector<siv<T1>>>& l_data,
-                                 const size_t threadNo) const {
+    void Grid3D<T1,T2>::raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                                      const std::vector<T1>& t0,
+                                      const std::vector<sxyz<T1>>& Rx,
+                                      std::vector<T1>& traveltimes,
+                                      std::vector<std::vector<sxyz<T1>>>& r_data,
+                                      std::vector<std::vector<siv<T1>>>& l_data,
+                                      const size_t threadNo) const {
         if ( verbose > 2 ) {
             std::cout << "\nIn Grid3D::raytrace(..., r_data, l_data, threadNo)\n" << std::endl;
         }
-        this->raytrace(Tx, t0, Rx, threadNo);
+        this->computeTT(Tx, t0, Rx, threadNo);
 
         if ( r_data.size() != Rx.size() ) {
             r_data.resize( Rx.size() );
@@ -455,6 +936,9 @@ namespace ttcr {
         for ( size_t ni=0; ni<l_data.size(); ++ni ) {
             l_data[ni].resize( 0 );
         }
+        if ( traveltimes.size() != Rx.size() ) {
+            traveltimes.resize( Rx.size() );
+        }
 
         for (size_t n=0; n<Rx.size(); ++n) {
             this->getRaypath(Tx, t0, Rx[n], r_data[n], l_data[n], traveltimes[n], threadNo);
@@ -462,13 +946,13 @@ namespace ttcr {
     }
 
     template<typename T1, typename T2>
-    void Grid3D<T1,T2>::raytrace(const std::vector<sxyz<T1>>& Tx,
-                                 const std::vector<T1>& t0,
-                                 const std::vector<sxyz<T1>>& Rx,
-                                 std::vector<T1>& traveltimes,
-                                 std::vector<std::vector<sijv<T1>>>& m_data,
-                                 const size_t threadNo) const {
-        this->raytrace(Tx, t0, Rx, threadNo);
+    void Grid3D<T1,T2>::raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                                      const std::vector<T1>& t0,
+                                      const std::vector<sxyz<T1>>& Rx,
+                                      std::vector<T1>& traveltimes,
+                                      std::vector<std::vector<sijv<T1>>>& m_data,
+                                      const size_t threadNo) const {
+        this->computeTT(Tx, t0, Rx, threadNo);
 
         if ( m_data.size() != Rx.size() ) {
             m_data.resize( Rx.size() );
@@ -483,14 +967,14 @@ namespace ttcr {
     }
 
     template<typename T1, typename T2>
-    void Grid3D<T1,T2>::raytrace(const std::vector<sxyz<T1>>& Tx,
-                                 const std::vector<T1>& t0,
-                                 const std::vector<sxyz<T1>>& Rx,
-                                 std::vector<T1>& traveltimes,
-                                 std::vector<std::vector<siv<T1>>>& l_data,
-                                 const size_t threadNo) const {
+    void Grid3D<T1,T2>::raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                                      const std::vector<T1>& t0,
+                                      const std::vector<sxyz<T1>>& Rx,
+                                      std::vector<T1>& traveltimes,
+                                      std::vector<std::vector<siv<T1>>>& l_data,
+                                      const size_t threadNo) const {
 
-        this->raytrace(Tx, t0, Rx, threadNo);
+        this->computeTT(Tx, t0, Rx, threadNo);
 
         if ( l_data.size() != Rx.size() ) {
             l_data.resize( Rx.size() );
@@ -507,6 +991,134 @@ namespace ttcr {
         }
     }
 
+    template<typename T1, typename T2>
+    void Grid3D<T1,T2>::raytraceLTrLocal(const std::vector<sxyz<T1>>& Tx,
+                                         const std::vector<T1>& t0,
+                                         const std::vector<sxyz<T1>>& Rx,
+                                         const std::vector<T1>& r,
+                                         std::vector<T1>& traveltimes,
+                                         std::vector<T1>& LTr,
+                                         const size_t threadNo) const {
+        if ( r.size() != Rx.size() ) {
+            throw std::length_error("Error: r and Rx should have the same size.");
+        }
+        this->computeTT(Tx, t0, Rx, threadNo);
+
+        if ( traveltimes.size() != Rx.size() ) {
+            traveltimes.resize( Rx.size() );
+        }
+        if ( LTr.size() != this->getNumberOfCells() ) {
+            LTr.assign( this->getNumberOfCells(), 0.0 );
+        }
+
+        std::vector<siv<T1>> l;
+        for (size_t n=0; n<Rx.size(); ++n) {
+            l.resize( 0 );
+            this->getRaypath(Tx, t0, Rx[n], l, traveltimes[n], threadNo);
+            for ( size_t nc=0; nc<l.size(); ++nc ) {
+                LTr[ l[nc].i ] += l[nc].v * r[n];
+            }
+        }
+    }
+
+    template<typename T1, typename T2>
+    void Grid3D<T1,T2>::raytraceLxLocal(const std::vector<sxyz<T1>>& Tx,
+                                        const std::vector<T1>& t0,
+                                        const std::vector<sxyz<T1>>& Rx,
+                                        const std::vector<T1>& x,
+                                        std::vector<T1>& traveltimes,
+                                        std::vector<T1>& Lx,
+                                        const size_t threadNo) const {
+        if ( x.size() != this->getNumberOfCells() ) {
+            throw std::length_error("Error: x should have one value per cell.");
+        }
+        this->computeTT(Tx, t0, Rx, threadNo);
+
+        if ( traveltimes.size() != Rx.size() ) {
+            traveltimes.resize( Rx.size() );
+        }
+        Lx.assign( Rx.size(), 0.0 );
+
+        std::vector<siv<T1>> l;
+        for (size_t n=0; n<Rx.size(); ++n) {
+            l.resize( 0 );
+            this->getRaypath(Tx, t0, Rx[n], l, traveltimes[n], threadNo);
+            for ( size_t nc=0; nc<l.size(); ++nc ) {
+                Lx[n] += l[nc].v * x[ l[nc].i ];
+            }
+        }
+    }
+
+    template<typename T1, typename T2>
+    void Grid3D<T1,T2>::getMisfitGradient(const std::vector<std::vector<sxyz<T1>>>& Tx,
+                                          const std::vector<std::vector<T1>>& t0,
+                                          const std::vector<std::vector<sxyz<T1>>>& Rx,
+                                          const std::vector<std::vector<T1>>& tobs,
+                                          std::vector<std::vector<T1>>& traveltimes,
+                                          std::vector<T1>& grad) const {
+
+        // each thread sums the gradients of its sources
+        auto work = [this,&Tx,&t0,&Rx,&tobs,&traveltimes](const size_t blk_start,
+                                                          const size_t blk_end,
+                                                          const size_t threadNo,
+                                                          std::vector<T1>& g) {
+            std::vector<T1> r;
+            std::vector<T1> gn;
+            for ( size_t n=blk_start; n<blk_end; ++n ) {
+                this->raytrace(Tx[n], t0[n], Rx[n], traveltimes[n], threadNo);
+                r.resize( Rx[n].size() );
+                for ( size_t nr=0; nr<r.size(); ++nr ) {
+                    r[nr] = traveltimes[n][nr] - tobs[n][nr];
+                }
+                this->getMisfitGradient(Rx[n], r, gn, threadNo);
+                if ( g.empty() ) {
+                    g.swap(gn);
+                } else {
+                    for ( size_t i=0; i<g.size(); ++i ) g[i] += gn[i];
+                }
+            }
+        };
+
+        for ( size_t n=0; n<Tx.size(); ++n ) {
+            if ( tobs[n].size() != Rx[n].size() ) {
+                throw std::length_error("Error: tobs and Rx should have the same size.");
+            }
+        }
+        traveltimes.resize( Tx.size() );
+        grad.clear();
+        if ( Tx.empty() ) {
+            // no source, the gradient is null
+            getSlowness(grad);
+            std::fill(grad.begin(), grad.end(), T1(0));
+            return;
+        }
+        if ( Tx.size() == 1 ) {
+            work(0, 1, 0, grad);
+        } else {
+            std::vector<size_t> blk_size = get_blk_size(Tx.size());
+            std::vector<std::vector<T1>> g(blk_size.size());
+
+            std::vector<std::thread> threads(blk_size.size());
+            size_t blk_start = 0;
+            for ( size_t i=0; i<blk_size.size(); ++i ) {
+
+                size_t blk_end = blk_start + blk_size[i];
+                threads[i]=std::thread( [&work,&g,blk_start,blk_end,i]{
+                    work(blk_start, blk_end, i, g[i]);
+                });
+
+                blk_start = blk_end;
+            }
+
+            std::for_each(threads.begin(),threads.end(), std::mem_fn(&std::thread::join));
+
+            grad.swap(g[0]);
+            for ( size_t i=1; i<g.size(); ++i ) {
+                for ( size_t n=0; n<grad.size(); ++n ) grad[n] += g[i][n];
+            }
+        }
+    }
+
     template<typename T1, typename T2>
     void Grid3D<T1,T2>::raytrace(const std::vector<std::vector<sxyz<T1>>>& Tx,
                                  const std::vector<std::vector<T1>>& t0,
@@ -696,6 +1308,80 @@ namespace ttcr {
         }
     }
 
+
+    template<typename T1, typename T2>
+    void Grid3D<T1,T2>::raytraceLTr(const std::vector<std::vector<sxyz<T1>>>& Tx,
+                                    const std::vector<std::vector<T1>>& t0,
+                                    const std::vector<std::vector<sxyz<T1>>>& Rx,
+                                    const std::vector<std::vector<T1>>& r,
+                                    std::vector<std::vector<T1>>& traveltimes,
+                                    std::vector<T1>& LTr) const {
+
+        traveltimes.resize( Tx.size() );
+        LTr.assign( this->getNumberOfCells(), 0.0 );
+        if ( Tx.size() == 1 ) {
+            this->raytraceLTr(Tx[0], t0[0], Rx[0], r[0], traveltimes[0], LTr, 0);
+        } else {
+            std::vector<size_t> blk_size = get_blk_size(Tx.size());
+            std::vector<std::vector<T1>> buffer(blk_size.size());
+
+            std::vector<std::thread> threads(blk_size.size());
+            size_t blk_start = 0;
+            for ( size_t i=0; i<blk_size.size(); ++i ) {
+
+                size_t blk_end = blk_start + blk_size[i];
+                threads[i]=std::thread( [this,&Tx,&t0,&Rx,&r,&traveltimes,&buffer,blk_start,blk_end,i]{
+
+                    for ( size_t n=blk_start; n<blk_end; ++n ) {
+                        this->raytraceLTr(Tx[n], t0[n], Rx[n], r[n], traveltimes[n], buffer[i], i);
+                    }
+                });
+
+                blk_start = blk_end;
+            }
+
+            std::for_each(threads.begin(),threads.end(), std::mem_fn(&std::thread::join));
+
+            for ( size_t i=0; i<buffer.size(); ++i ) {
+                for ( size_t n=0; n<LTr.size(); ++n ) LTr[n] += buffer[i][n];
+            }
+        }
+    }
+
+    template<typename T1, typename T2>
+    void Grid3D<T1,T2>::raytraceLx(const std::vector<std::vector<sxyz<T1>>>& Tx,
+                                   const std::vector<std::vector<T1>>& t0,
+                                   const std::vector<std::vector<sxyz<T1>>>& Rx,
+                                   const std::vector<T1>& x,
+                                   std::vector<std::vector<T1>>& traveltimes,
+                                   std::vector<std::vector<T1>>& Lx) const {
+
+        traveltimes.resize( Tx.size() );
+        Lx.resize( Tx.size() );
+        if ( Tx.size() == 1 ) {
+            this->raytraceLx(Tx[0], t0[0], Rx[0], x, traveltimes[0], Lx[0], 0);
+        } else {
+            std::vector<size_t> blk_size = get_blk_size(Tx.size());
+
+            std::vector<std::thread> threads(blk_size.size());
+            size_t blk_start = 0;
+            for ( size_t i=0; i<blk_size.size(); ++i ) {
+
+                size_t blk_end = blk_start + blk_size[i];
+                threads[i]=std::thread( [this,&Tx,&t0,&Rx,&x,&traveltimes,&Lx,blk_start,blk_end,i]{
+
+                    for ( size_t n=blk_start; n<blk_end; ++n ) {
+                        this->raytraceLx(Tx[n], t0[n], Rx[n], x, traveltimes[n], Lx[n], i);
+                    }
+                });
+
+                blk_start = blk_end;
+            }
+
+            std::for_each(threads.begin(),threads.end(), std::mem_fn(&std::thread::join));
+        }
+    }
+
 }
 
 
@@ -57,6 +57,7 @@
 #include <boost/math/special_functions/sign.hpp>
 
 #include "Grid3D.h"
+#include "StraightRays.h"
 
 namespace ttcr {
     
@@ -92,12 +93,15 @@ namespace ttcr {
             } catch (std::exception& e) {
                 throw;
             }
+            this->slownessChanged();
         }
         void setChi(const std::vector<T1>& x) {
             cells.setChi( x );
+            this->slownessChanged();
         }
         void setPsi(const std::vector<T1>& x) {
             cells.setPsi( x );
+            this->slownessChanged();
         }
 
         size_t getNumberOfNodes() const { return nodes.size(); }
@@ -154,9 +158,9 @@ namespace ttcr {
             return size;
         }
         
-        const T1 getXmin() const { return xmin; }
-        const T1 getYmin() const { return ymin; }
-        const T1 getZmin() const { return zmin; }
+        const T1 getXmin() const { return static_cast<T1>(xmin+this->origin.x); }
+        const T1 getYmin() const { return static_cast<T1>(ymin+this->origin.y); }
+        const T1 getZmin() const { return static_cast<T1>(zmin+this->origin.z); }
         const T1 getDx() const { return dx; }
         const T1 getDy() const { return dy; }
         const T1 getDz() const { return dz; }
@@ -175,6 +179,34 @@ namespace ttcr {
             return cells.getSlowness(getCellNo(pt));
         }
 
+        // data kernel matrix of straight rays between pairs Tx[n]-Rx[n], in
+        // CSR format, with columns following the numbering of the cells
+        void getStraightRayKernel(const std::vector<sxyz<T1>>& Tx,
+                                  const std::vector<sxyz<T1>>& Rx,
+                                  std::vector<T2>& indptr,
+                                  std::vector<T2>& indices,
+                                  std::vector<T1>& data) const {
+            checkPts(Tx);
+            checkPts(Rx);
+            std::vector<T1> grx(ncx+1), gry(ncy+1), grz(ncz+1);
+            for ( T2 n=0; n<=ncx; ++n ) grx[n] = xmin + n*dx;
+            for ( T2 n=0; n<=ncy; ++n ) gry[n] = ymin + n*dy;
+            for ( T2 n=0; n<=ncz; ++n ) grz[n] = zmin + n*dz;
+            grx[ncx] = xmax;
+            gry[ncy] = ymax;
+            grz[ncz] = zmax;
+            // cells are numbered with x varying fastest: axes are swapped
+            std::vector<sxyz<T1>> zyxTx(Tx.size()), zyxRx(Rx.size());
+            for ( size_t n=0; n<Tx.size(); ++n ) {
+                zyxTx[n] = sxyz<T1>(Tx[n].z, Tx[n].y, Tx[n].x);
+            }
+            for ( size_t n=0; n<Rx.size(); ++n ) {
+                zyxRx[n] = sxyz<T1>(Rx[n].z, Rx[n].y, Rx[n].x);
+            }
+            ttcr::getStraightRayKernel(zyxTx, zyxRx, grz, gry, grx,
+                                       indptr, indices, data, this->nThreads);
+        }
+
     protected:
         T1 dx;                   // cell size in x
         T1 dy;			         // cell size in y
@@ -193,6 +225,22 @@ namespace ttcr {
         
         CELL cells;   // column-wise (z axis) slowness vector of the cells, NOT used by Grid3Dcinterp        
         
+        bool getTTState(std::vector<T1>& state, const size_t threadNo) const {
+            state.resize( nodes.size() );
+            for ( size_t n=0; n<nodes.size(); ++n ) {
+                state[n] = nodes[n].getTT(threadNo);
+            }
+            return true;
+        }
+        void setTTState(const std::vector<sxyz<T1>>& Tx,
+                        const std::vector<T1>& t0,
+                        const std::vector<T1>& state,
+                        const size_t threadNo) const {
+            for ( size_t n=0; n<nodes.size(); ++n ) {
+                nodes[n].setTT(state[n], threadNo);
+            }
+        }
+        
         T2 getCellNo(const sxyz<T1>& pt) const {
             T1 x = xmax-pt.x < small2 ? xmax-.5*dx : pt.x;
             T1 y = ymax-pt.y < small2 ? ymax-.5*dy : pt.y;
@@ -1158,9 +1206,9 @@ namespace ttcr {
             fout.precision(12);
             for ( T2 n=0; n<nodes.size(); ++n ) {
                 if ( nodes[n].isPrimary() || all==1 ) {
-                    fout << nodes[n].getX() << '\t'
-                    << nodes[n].getY() << '\t'
-                    << nodes[n].getZ() << '\t'
+                    fout << nodes[n].getX()+this->origin.x << '\t'
+                    << nodes[n].getY()+this->origin.y << '\t'
+                    << nodes[n].getZ()+this->origin.z << '\t'
                     << nodes[n].getTT(nt) << '\n';
                 }
             }
@@ -1173,13 +1221,13 @@ namespace ttcr {
             
             vtkSmartPointer<vtkDoubleArray> xCoords = vtkSmartPointer<vtkDoubleArray>::New();
             for (size_t n=0; n<nn[0]; ++n)
-                xCoords->InsertNextValue( xmin + n*dx );
+                xCoords->InsertNextValue( xmin + this->origin.x + n*dx );
             vtkSmartPointer<vtkDoubleArray> yCoords = vtkSmartPointer<vtkDoubleArray>::New();
             for (size_t n=0; n<nn[1]; ++n)
-                yCoords->InsertNextValue( ymin + n*dy );
+                yCoords->InsertNextValue( ymin + this->origin.y + n*dy );
             vtkSmartPointer<vtkDoubleArray> zCoords = vtkSmartPointer<vtkDoubleArray>::New();
             for (size_t n=0; n<nn[2]; ++n)
-                zCoords->InsertNextValue( zmin + n*dz );
+                zCoords->InsertNextValue( zmin + this->origin.z + n*dz );
             
             vtkSmartPointer<vtkRectilinearGrid> rgrid = vtkSmartPointer<vtkRectilinearGrid>::New();
             rgrid->SetDimensions( nn );
@@ -1196,7 +1244,9 @@ namespace ttcr {
             
             for ( size_t n=0; n<nodes.size(); ++n ) {
                 if ( nodes[n].isPrimary() ) {
-                    vtkIdType id = rgrid->FindPoint(nodes[n].getX(), nodes[n].getY(), nodes[n].getZ());
+                    vtkIdType id = rgrid->FindPoint(nodes[n].getX()+this->origin.x,
+                                                    nodes[n].getY()+this->origin.y,
+                                                    nodes[n].getZ()+this->origin.z);
                     newScalars->SetTuple1(id, nodes[n].getTT(nt) );
                 }
             }
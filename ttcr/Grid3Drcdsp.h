@@ -16,9 +16,14 @@
 #include "vtkXMLPolyDataWriter.h"
 #endif
 
+#include <algorithm>
+#include <array>
+#include <map>
+
 #include "Grid3Drc.h"
 #include "Node3Dc.h"
 #include "Node3Dcd.h"
+#include "TempNodesCache.h"
 
 namespace ttcr {
     
@@ -34,7 +39,8 @@ namespace ttcr {
         nSecondary(ns), nTertiary(nd), nPermanent(0),
         dynRadius(drad),
         tempNodes(std::vector<std::vector<Node3Dcd<T1,T2>>>(nt)),
-        tempNeighbors(std::vector<std::vector<std::vector<T2>>>(nt))
+        tempNeighbors(std::vector<std::vector<std::vector<T2>>>(nt)),
+        tempCache(std::vector<TempNodesCache<T1,T2,Node3Dcd<T1,T2>>>(nt))
         {
             buildGridNodes();
             this->template buildGridNeighbors<Node3Dc<T1,T2>>(this->nodes);
@@ -47,6 +53,15 @@ namespace ttcr {
         ~Grid3Drcdsp() {
         }
 
+        void setTempNodesCache(const size_t nTx) {
+            for ( size_t n=0; n<tempCache.size(); ++n )
+                tempCache[n].setCapacity( nTx );
+        }
+        
+    protected:
+        // the field depends on temporary nodes, which are not cached
+        bool getTTState(std::vector<T1>&, const size_t) const { return false; }
+        
     private:
         T2 nSecondary;                 // number of permanent secondary
         T2 nTertiary;                   // number of temporary secondary
@@ -58,9 +73,13 @@ namespace ttcr {
         // nodes vary from one Tx to the other)
         mutable std::vector<std::vector<Node3Dcd<T1,T2>>> tempNodes;
         mutable std::vector<std::vector<std::vector<T2>>> tempNeighbors;
+        
+        // temporary nodes are reused as long as Tx does not move
+        mutable std::vector<TempNodesCache<T1,T2,Node3Dcd<T1,T2>>> tempCache;
 
         void buildGridNodes();
         void addTemporaryNodes(const std::vector<sxyz<T1>>&, const size_t) const;
+        void buildTemporaryNodes(const std::vector<sxyz<T1>>&, const size_t) const;
 
         void initQueue(const std::vector<sxyz<T1>>& Tx,
                        const std::vector<T1>& t0,
@@ -79,15 +98,15 @@ namespace ttcr {
                        std::vector<bool>& frozen,
                        const size_t threadNo) const;
         
-        void raytrace(const std::vector<sxyz<T1>>&,
-                      const std::vector<T1>&,
-                      const std::vector<sxyz<T1>>&,
-                      const size_t=0) const;
+        void raytraceLocal(const std::vector<sxyz<T1>>&,
+                           const std::vector<T1>&,
+                           const std::vector<sxyz<T1>>&,
+                           const size_t=0) const;
         
-        void raytrace(const std::vector<sxyz<T1>>&,
-                      const std::vector<T1>&,
-                      const std::vector<const std::vector<sxyz<T1>>*>&,
-                      const size_t=0) const;
+        void raytraceLocal(const std::vector<sxyz<T1>>&,
+                           const std::vector<T1>&,
+                           const std::vector<const std::vector<sxyz<T1>>*>&,
+                           const size_t=0) const;
     };
 
     template<typename T1, typename T2, typename CELL>
@@ -460,14 +479,38 @@ namespace ttcr {
     void Grid3Drcdsp<T1,T2,CELL>::addTemporaryNodes(const std::vector<sxyz<T1>>& Tx,
                                                     const size_t threadNo) const {
 
-        // clear previously assigned nodes
-        tempNodes[threadNo].clear();
-        for ( size_t nt=0; nt<tempNeighbors[threadNo].size(); ++nt ) {
-            tempNeighbors[threadNo][nt].clear();
+        // clear neighbors of previously assigned nodes
+        for ( size_t n=0; n<tempNodes[threadNo].size(); ++n ) {
+            for ( size_t n2=0; n2<tempNodes[threadNo][n].getOwners().size(); ++n2 ) {
+                tempNeighbors[threadNo][ tempNodes[threadNo][n].getOwners()[n2] ].clear();
+            }
         }
 
+        if ( tempCache[threadNo].fetch(Tx, tempNodes[threadNo]) ) {
+            // same layout as for a previous call
+            for ( size_t n=0; n<tempNodes[threadNo].size(); ++n ) {
+                tempNodes[threadNo][n].reinit( 0 );
+            }
+        } else {
+            buildTemporaryNodes(Tx, threadNo);
+            tempCache[threadNo].set(Tx, 0);
+        }
+
+        for ( T2 n=0; n<tempNodes[threadNo].size(); ++n ) {
+            for ( size_t n2=0; n2<tempNodes[threadNo][n].getOwners().size(); ++n2) {
+                tempNeighbors[threadNo][ tempNodes[threadNo][n].getOwners()[n2] ].push_back(n);
+            }
+        }
+        if ( verbose )
+            std::cout << "  *** thread no " << threadNo << ": " << tempNodes[threadNo].size() << " dynamic nodes were added ***" << std::endl;
+    }
+
+    template<typename T1, typename T2, typename CELL>
+    void Grid3Drcdsp<T1,T2,CELL>::buildTemporaryNodes(const std::vector<sxyz<T1>>& Tx,
+                                                      const size_t threadNo) const {
+
         // find cells surrounding Tx
-        std::set<T2> txCells;
+        std::vector<T2> txCells;
         for (size_t n=0; n<Tx.size(); ++n) {
             long long i, j, k;
             this->getIJK(Tx[n], i, j, k);
@@ -496,16 +539,18 @@ namespace ttcr {
                 for ( p.y=ystart+this->dy/2.; p.y<ystop; p.y+=this->dy ) {
                     for ( p.z=zstart+this->dz/2.; p.z<zstop; p.z+=this->dz ) {
                         if ( Tx[n].getDistance(p) < dynRadius ) {
-                            txCells.insert( this->getCellNo(p) );
+                            txCells.push_back( this->getCellNo(p) );
                         }
                     }
                 }
             }
         }
+        std::sort(txCells.begin(), txCells.end());
+        txCells.erase( std::unique(txCells.begin(), txCells.end()), txCells.end() );
         if ( verbose )
             std::cout << "\n  *** thread no " << threadNo << ": found " << txCells.size() << " cells within radius ***" << std::endl;
 
-        std::set<T2> adjacentCells(txCells.begin(), txCells.end());
+        std::vector<T2> adjacentCells;
 
         T2 nTemp = nTertiary * (nSecondary+1);
         
@@ -529,44 +574,44 @@ namespace ttcr {
             this->getCellIJK(*cell, ind);
 
             if ( ind.i > 0 )
-                adjacentCells.insert( (ind.k * this->ncy + ind.j) * this->ncx + ind.i-1);
+                adjacentCells.push_back( (ind.k * this->ncy + ind.j) * this->ncx + ind.i-1);
             if ( ind.i < this->ncx-1 )
-                adjacentCells.insert( (ind.k * this->ncy + ind.j) * this->ncx + ind.i+1);
+                adjacentCells.push_back( (ind.k * this->ncy + ind.j) * this->ncx + ind.i+1);
             if ( ind.j > 0 )
-                adjacentCells.insert( (ind.k * this->ncy + ind.j-1) * this->ncx + ind.i);
+                adjacentCells.push_back( (ind.k * this->ncy + ind.j-1) * this->ncx + ind.i);
             if ( ind.j < this->ncy-1 )
-                adjacentCells.insert( (ind.k * this->ncy + ind.j+1) * this->ncx + ind.i);
+                adjacentCells.push_back( (ind.k * this->ncy + ind.j+1) * this->ncx + ind.i);
             if ( ind.k > 0 )
-                adjacentCells.insert( ((ind.k-1) * this->ncy + ind.j) * this->ncx + ind.i);
+                adjacentCells.push_back( ((ind.k-1) * this->ncy + ind.j) * this->ncx + ind.i);
             if ( ind.k < this->ncz-1 )
-                adjacentCells.insert( ((ind.k+1) * this->ncy + ind.j) * this->ncx + ind.i);
+                adjacentCells.push_back( ((ind.k+1) * this->ncy + ind.j) * this->ncx + ind.i);
 
             if ( ind.i > 0 && ind.j > 0 )
-                adjacentCells.insert( (ind.k * this->ncy + ind.j-1) * this->ncx + ind.i-1);
+                adjacentCells.push_back( (ind.k * this->ncy + ind.j-1) * this->ncx + ind.i-1);
             if ( ind.i < this->ncx-1 && ind.j > 0 )
-                adjacentCells.insert( (ind.k * this->ncy + ind.j-1) * this->ncx + ind.i+1);
+                adjacentCells.push_back( (ind.k * this->ncy + ind.j-1) * this->ncx + ind.i+1);
             if ( ind.i > 0 && ind.j < this->ncy-1 )
-                adjacentCells.insert( (ind.k * this->ncy + ind.j+1) * this->ncx + ind.i-1);
+                adjacentCells.push_back( (ind.k * this->ncy + ind.j+1) * this->ncx + ind.i-1);
             if ( ind.i < this->ncx-1 && ind.j < this->ncy-1 )
-                adjacentCells.insert( (ind.k * this->ncy + ind.j+1) * this->ncx + ind.i+1);
+                adjacentCells.push_back( (ind.k * this->ncy + ind.j+1) * this->ncx + ind.i+1);
 
             if ( ind.i > 0 && ind.k > 0 )
-                adjacentCells.insert( ((ind.k-1) * this->ncy + ind.j) * this->ncx + ind.i-1);
+                adjacentCells.push_back( ((ind.k-1) * this->ncy + ind.j) * this->ncx + ind.i-1);
             if ( ind.i < this->ncx-1 && ind.k > 0 )
-                adjacentCells.insert( ((ind.k-1) * this->ncy + ind.j) * this->ncx + ind.i+1);
+                adjacentCells.push_back( ((ind.k-1) * this->ncy + ind.j) * this->ncx + ind.i+1);
             if ( ind.i > 0 && ind.k < this->ncz-1 )
-                adjacentCells.insert( ((ind.k+1) * this->ncy + ind.j) * this->ncx + ind.i-1);
+                adjacentCells.push_back( ((ind.k+1) * this->ncy + ind.j) * this->ncx + ind.i-1);
             if ( ind.i < this->ncx-1 && ind.k < this->ncz-1 )
-                adjacentCells.insert( ((ind.k+1) * this->ncy + ind.j) * this->ncx + ind.i+1);
+                adjacentCells.push_back( ((ind.k+1) * this->ncy + ind.j) * this->ncx + ind.i+1);
 
             if ( ind.j > 0 && ind.k > 0 )
-                adjacentCells.insert( ((ind.k-1) * this->ncy + ind.j-1) * this->ncx + ind.i);
+                adjacentCells.push_back( ((ind.k-1) * this->ncy + ind.j-1) * this->ncx + ind.i);
             if ( ind.j < this->ncy-1 && ind.k > 0 )
-                adjacentCells.insert( ((ind.k-1) * this->ncy + ind.j+1) * this->ncx + ind.i);
+                adjacentCells.push_back( ((ind.k-1) * this->ncy + ind.j+1) * this->ncx + ind.i);
             if ( ind.j > 0 && ind.k < this->ncz-1 )
-                adjacentCells.insert( ((ind.k+1) * this->ncy + ind.j-1) * this->ncx + ind.i);
+                adjacentCells.push_back( ((ind.k+1) * this->ncy + ind.j-1) * this->ncx + ind.i);
             if ( ind.j < this->ncy-1 && ind.k < this->ncz-1 )
-                adjacentCells.insert( ((ind.k+1) * this->ncy + ind.j+1) * this->ncx + ind.i);
+                adjacentCells.push_back( ((ind.k+1) * this->ncy + ind.j+1) * this->ncx + ind.i);
 
             T1 x0 = this->xmin + ind.i*this->dx;
             T1 y0 = this->ymin + ind.j*this->dy;
@@ -882,9 +927,13 @@ namespace ttcr {
             }
         }
         
-        for ( auto cell=txCells.begin(); cell!=txCells.end(); ++cell ) {
-            adjacentCells.erase(*cell);
-        }
+        // keep cells adjacent to, but not within, cells around Tx
+        std::sort(adjacentCells.begin(), adjacentCells.end());
+        adjacentCells.erase( std::unique(adjacentCells.begin(), adjacentCells.end()), adjacentCells.end() );
+        adjacentCells.erase( std::remove_if(adjacentCells.begin(), adjacentCells.end(),
+                                            [&txCells](const T2 c) {
+                                                return std::binary_search(txCells.begin(), txCells.end(), c); }),
+                            adjacentCells.end() );
         for ( auto adj=adjacentCells.begin(); adj!=adjacentCells.end(); ++adj ) {
             this->getCellIJK(*adj, ind);
             
@@ -1005,14 +1054,6 @@ namespace ttcr {
                 }
             }
         }
-        
-        for ( T2 n=0; n<tempNodes[threadNo].size(); ++n ) {
-            for ( size_t n2=0; n2<tempNodes[threadNo][n].getOwners().size(); ++n2) {
-                tempNeighbors[threadNo][ tempNodes[threadNo][n].getOwners()[n2] ].push_back(n);
-            }
-        }
-        if ( verbose )
-            std::cout << "  *** thread no " << threadNo << ": " << tempNodes[threadNo].size() << " dynamic nodes were added ***" << std::endl;
 
 //#ifdef VTK
 //        vtkSmartPointer<vtkPolyData> polydata = vtkSmartPointer<vtkPolyData>::New();
@@ -1034,10 +1075,10 @@ namespace ttcr {
     }
     
     template<typename T1, typename T2, typename CELL>
-    void Grid3Drcdsp<T1,T2,CELL>::raytrace(const std::vector<sxyz<T1>>& Tx,
-                                           const std::vector<T1>& t0,
-                                           const std::vector<sxyz<T1>>& Rx,
-                                           const size_t threadNo) const {
+    void Grid3Drcdsp<T1,T2,CELL>::raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                                                const std::vector<T1>& t0,
+                                                const std::vector<sxyz<T1>>& Rx,
+                                                const size_t threadNo) const {
         this->checkPts(Tx);
         this->checkPts(Rx);
         
@@ -1061,10 +1102,10 @@ namespace ttcr {
     }
     
     template<typename T1, typename T2, typename CELL>
-    void Grid3Drcdsp<T1,T2,CELL>::raytrace(const std::vector<sxyz<T1>>& Tx,
-                                           const std::vector<T1>& t0,
-                                           const std::vector<const std::vector<sxyz<T1>>*>& Rx,
-                                           const size_t threadNo) const {
+    void Grid3Drcdsp<T1,T2,CELL>::raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                                                const std::vector<T1>& t0,
+                                                const std::vector<const std::vector<sxyz<T1>>*>& Rx,
+                                                const size_t threadNo) const {
         this->checkPts(Tx);
         for ( size_t n=0; n<Rx.size(); ++n )
             this->checkPts(*Rx[n]);
@@ -0,0 +1,141 @@
+//
+//  Grid3Drcfm.h
+//  ttcr
+//
+//  Created by agent on 2026-10-18.
+//  Copyright (c) 2026 agent. All rights reserved.
+//
+
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+
+ Fast marching method of
+
+ @article{sethian96,
+ author = {Sethian, J. A.},
+ title = {A fast marching level set method for monotonically advancing fronts},
+ journal = {Proceedings of the National Academy of Sciences},
+ year = {1996},
+ volume = {93},
+ number = {4},
+ pages = {1591--1595},
+ doi = {10.1073/pnas.93.4.1591}
+ }
+
+ with the second order upwind stencil of
+
+ @book{sethian99,
+ author = {Sethian, J. A.},
+ title = {Level Set Methods and Fast Marching Methods},
+ publisher = {Cambridge University Press},
+ year = {1999},
+ edition = {2nd}
+ }
+
+ */
+
+#ifndef ttcr_Grid3Drcfm_h
+#define ttcr_Grid3Drcfm_h
+
+#include "Grid3Drcfs.h"
+
+namespace ttcr {
+
+    // Slowness in cells (interpolated at nodes), traveltimes computed with
+    // the fast marching method.  Nodes, raypaths and matrices are those of
+    // Grid3Drcfs.
+    template<typename T1, typename T2>
+    class Grid3Drcfm : public Grid3Drcfs<T1,T2> {
+    public:
+        Grid3Drcfm(const T2 nx, const T2 ny, const T2 nz, const T1 ddx,
+                   const T1 minx, const T1 miny, const T1 minz,
+                   const bool so, const bool ttrp=true, const bool intVel=false,
+                   const size_t nt=1) :
+        Grid3Drcfs<T1,T2>(nx, ny, nz, ddx, minx, miny, minz, 0.0, 0, false,
+                          ttrp, intVel, nt),
+        secondOrder(so)
+        {
+        }
+
+        ~Grid3Drcfm() {
+        }
+
+    protected:
+        bool secondOrder;
+
+    private:
+        Grid3Drcfm() {}
+        Grid3Drcfm(const Grid3Drcfm<T1,T2>& g) {}
+        Grid3Drcfm<T1,T2>& operator=(const Grid3Drcfm<T1,T2>& g) {}
+
+        void raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                           const std::vector<T1>& t0,
+                           const std::vector<sxyz<T1>>& Rx,
+                           const size_t threadNo=0) const;
+        void raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                           const std::vector<T1>& t0,
+                           const std::vector<const std::vector<sxyz<T1>>*>& Rx,
+                           const size_t threadNo=0) const;
+
+    };
+
+    template<typename T1, typename T2>
+    void Grid3Drcfm<T1,T2>::raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                                          const std::vector<T1>& t0,
+                                          const std::vector<sxyz<T1>>& Rx,
+                                          const size_t threadNo) const {
+
+        this->checkPts(Tx);
+        this->checkPts(Rx);
+
+        for ( size_t n=0; n<this->nodes.size(); ++n ) {
+            this->nodes[n].reinit( threadNo );
+        }
+
+        // Set Tx pts and their nearest nodes only: straight-ray traveltimes
+        // at farther nodes are too inaccurate in heterogeneous media, and the
+        // second order stencil falls back to first order until two upwind
+        // nodes are frozen
+        std::vector<bool> frozen( this->nodes.size(), false );
+        this->initFSM(Tx, t0, frozen, 1, threadNo);
+
+        this->propagateFMM(frozen, secondOrder, threadNo);
+    }
+
+    template<typename T1, typename T2>
+    void Grid3Drcfm<T1,T2>::raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                                          const std::vector<T1>& t0,
+                                          const std::vector<const std::vector<sxyz<T1>>*>& Rx,
+                                          const size_t threadNo) const {
+
+        this->checkPts(Tx);
+        for ( size_t n=0; n<Rx.size(); ++n )
+            this->checkPts(*Rx[n]);
+
+        for ( size_t n=0; n<this->nodes.size(); ++n ) {
+            this->nodes[n].reinit( threadNo );
+        }
+
+        std::vector<bool> frozen( this->nodes.size(), false );
+        this->initFSM(Tx, t0, frozen, 1, threadNo);
+
+        this->propagateFMM(frozen, secondOrder, threadNo);
+    }
+}
+
+#endif
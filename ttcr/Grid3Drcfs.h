@@ -36,19 +36,26 @@ namespace ttcr {
         
         void setSlowness(const std::vector<T1>& s);
         
-        const int get_niter() const { return niter_final; }
+        int get_niter() const { return niter_final; }
         const int get_niterw() const { return niterw_final; }
+        int getNiter(const size_t threadNo) const {
+            return this->warm.getNiter(threadNo);
+        }
         
-        void raytrace(const std::vector<sxyz<T1>>& Tx,
-                      const std::vector<T1>& t0,
-                      const std::vector<sxyz<T1>>& Rx,
-                      std::vector<T1>& traveltimes,
-                      const size_t threadNo=0) const {
-            // this is here just to be able to compile cgrid3d.pyx cython code
-            // should be removed when cgrid3d be replace by rgrid
-            Grid3D<T1,T2>::raytrace(Tx, t0, Rx, traveltimes, threadNo);
+        void setWarmStart(const bool w, const size_t maxBytes=268435456) { this->warm.setCached(w, maxBytes); }
+        void setTraveltimeSeed(const std::vector<T1>& tt,
+                               const std::vector<T1>& s,
+                               const size_t threadNo=0) const {
+            this->warm.setSeed(tt, s, threadNo);
         }
-
+        
+    protected:
+        void getMisfitGradientLocal(const std::vector<sxyz<T1>>& Rx,
+                                    const std::vector<T1>& r,
+                                    std::vector<T1>& grad,
+                                    const size_t threadNo=0) const;
+        
+    public:
         void raytrace2(const std::vector<sxyz<T1>>& Tx,
                        const std::vector<T1>& t0,
                        const std::vector<sxyz<T1>>& Rx,
@@ -58,28 +65,7 @@ namespace ttcr {
             // this function created for cython, which does not take two methods with equal number of arguments
             // (already using one with l_data)
             // should be removed when cgrid3d be replace by rgrid
-            Grid3D<T1,T2>::raytrace(Tx, t0, Rx, traveltimes, r_data, threadNo);
-        }
-        void raytrace(const std::vector<sxyz<T1>>& Tx,
-                      const std::vector<T1>& t0,
-                      const std::vector<sxyz<T1>>& Rx,
-                      std::vector<T1>& traveltimes,
-                      std::vector<std::vector<sxyz<T1>>>& r_data,
-                      std::vector<std::vector<siv<T1>>>& l_data,
-                      const size_t threadNo=0) const {
-            // this is here just to be able to compile cgrid3d.pyx cython code
-            // should be removed when cgrid3d be replace by rgrid
-            Grid3D<T1,T2>::raytrace(Tx, t0, Rx, traveltimes, r_data, l_data, threadNo);
-        }
-        void raytrace(const std::vector<sxyz<T1>>& Tx,
-                      const std::vector<T1>& t0,
-                      const std::vector<sxyz<T1>>& Rx,
-                      std::vector<T1>& traveltimes,
-                      std::vector<std::vector<siv<T1>>>& l_data,
-                      const size_t threadNo=0) const {
-            // this is here just to be able to compile cgrid3d.pyx cython code
-            // should be removed when cgrid3d be replace by rgrid
-            Grid3D<T1,T2>::raytrace(Tx, t0, Rx, traveltimes, l_data, threadNo);
+            this->raytrace(Tx, t0, Rx, traveltimes, r_data, threadNo);
         }
 
     protected:
@@ -91,20 +77,29 @@ namespace ttcr {
         
         void buildGridNodes();
         
+        void restoreSolve(const std::vector<sxyz<T1>>& Tx,
+                          const std::vector<T1>& t0,
+                          const int n, const int nw,
+                          const size_t threadNo) const {
+            Grid3Drn<T1,T2,Node3Dn<T1,T2>>::restoreSolve(Tx, t0, n, nw, threadNo);
+            niter_final = n-nw;
+            niterw_final = nw;
+        }
+        
     private:
         Grid3Drcfs() {}
         Grid3Drcfs(const Grid3Drcfs<T1,T2>& g) {}
         Grid3Drcfs<T1,T2>& operator=(const Grid3Drcfs<T1,T2>& g) {}
         
-        void raytrace(const std::vector<sxyz<T1>>& Tx,
-                      const std::vector<T1>& t0,
-                      const std::vector<sxyz<T1>>& Rx,
-                      const size_t threadNo=0) const;
+        void raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                           const std::vector<T1>& t0,
+                           const std::vector<sxyz<T1>>& Rx,
+                           const size_t threadNo=0) const;
         
-        void raytrace(const std::vector<sxyz<T1>>& Tx,
-                      const std::vector<T1>& t0,
-                      const std::vector<const std::vector<sxyz<T1>>*>& Rx,
-                      const size_t threadNo=0) const;
+        void raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                           const std::vector<T1>& t0,
+                           const std::vector<const std::vector<sxyz<T1>>*>& Rx,
+                           const size_t threadNo=0) const;
         
     };
     
@@ -193,9 +188,45 @@ namespace ttcr {
                 }
             }
         }
+        this->slownessChanged();
     }
     
     
+    template<typename T1, typename T2>
+    void Grid3Drcfs<T1,T2>::getMisfitGradientLocal(const std::vector<sxyz<T1>>& Rx,
+                                                   const std::vector<T1>& r,
+                                                   std::vector<T1>& grad,
+                                                   const size_t threadNo) const {
+        
+        // gradient at nodes, then spread to the cells: the slowness at a
+        // node is the mean of the slowness of its cells (see setSlowness)
+        std::vector<T1> gn;
+        Grid3Drn<T1,T2,Node3Dn<T1,T2>>::getMisfitGradientLocal(Rx, r, gn, threadNo);
+        
+        const long long nx = this->ncx;
+        const long long ny = this->ncy;
+        const long long nz = this->ncz;
+        grad.assign(nx*ny*nz, 0.0);
+        for ( long long k=0, n=0; k<=nz; ++k ) {
+            for ( long long j=0; j<=ny; ++j ) {
+                for ( long long i=0; i<=nx; ++i, ++n ) {
+                    if ( gn[n] == 0.0 ) continue;
+                    long long i0 = std::max(i-1, 0LL), i1 = std::min(i, nx-1);
+                    long long j0 = std::max(j-1, 0LL), j1 = std::min(j, ny-1);
+                    long long k0 = std::max(k-1, 0LL), k1 = std::min(k, nz-1);
+                    T1 g = gn[n] / ((i1-i0+1)*(j1-j0+1)*(k1-k0+1));
+                    for ( long long kk=k0; kk<=k1; ++kk ) {
+                        for ( long long jj=j0; jj<=j1; ++jj ) {
+                            for ( long long ii=i0; ii<=i1; ++ii ) {
+                                grad[(kk*ny+jj)*nx+ii] += g;
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+    
     template<typename T1, typename T2>
     void Grid3Drcfs<T1,T2>::buildGridNodes() {
         
@@ -317,12 +348,12 @@ namespace ttcr {
     
     
     template<typename T1, typename T2>
-    void Grid3Drcfs<T1,T2>::raytrace(const std::vector<sxyz<T1>>& Tx,
-                                     const std::vector<T1>& t0,
-                                     const std::vector<sxyz<T1>>& Rx,
-                                     const size_t threadNo) const {
+    void Grid3Drcfs<T1,T2>::raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                                          const std::vector<T1>& t0,
+                                          const std::vector<sxyz<T1>>& Rx,
+                                          const size_t threadNo) const {
         if ( verbose > 2 ) {
-            std::cout << "\nIn Grid3Drcfs::raytrace(Tx, t0, Rx, threadNo)\n" << std::endl;
+            std::cout << "\nIn Grid3Drcfs::raytraceLocal(Tx, t0, Rx, threadNo)\n" << std::endl;
         }
         this->checkPts(Tx);
         this->checkPts(Rx);
@@ -336,10 +367,11 @@ namespace ttcr {
         int npts = 1;
         if ( weno3 == true) npts = 2;
         this->initFSM(Tx, t0, frozen, npts, threadNo);
-        
-        std::vector<T1> times( this->nodes.size() );
-        for ( size_t n=0; n<this->nodes.size(); ++n )
-            times[n] = this->nodes[n].getTT( threadNo );
+        // all nodes are active at first, unless starting from the field of
+        // a previous solve
+        std::vector<bool> active( this->nodes.size(), true );
+        bool relax = false;
+        this->initWarmStart(Tx, t0, frozen, active, relax, threadNo);
         
         T1 change = std::numeric_limits<T1>::max();
         if ( weno3 == true ) {
@@ -349,53 +381,34 @@ namespace ttcr {
                 throw std::logic_error("Error: WENO stencil needs dx equal to dz");
             }
             while ( change >= epsilon && niter<nitermax ) {
-                this->sweep(frozen, threadNo);
-                change = 0.0;
-                for ( size_t n=0; n<this->nodes.size(); ++n ) {
-                    T1 dt = std::abs( times[n] - this->nodes[n].getTT(threadNo) );
-                    
-                    change += dt;
-                    times[n] = this->nodes[n].getTT(threadNo);
-                }
+                change = this->sweep(frozen, active, threadNo, relax);
                 niter++;
             }
             change = std::numeric_limits<T1>::max();
             while ( change >= epsilon && niterw<nitermax ) {
-                this->sweep_weno3(frozen, threadNo);
-                change = 0.0;
-                for ( size_t n=0; n<this->nodes.size(); ++n ) {
-                    T1 dt = std::abs( times[n] - this->nodes[n].getTT(threadNo) );
-                    
-                    change += dt;
-                    times[n] = this->nodes[n].getTT(threadNo);
-                }
+                change = this->sweep_weno3(frozen, threadNo);
                 niterw++;
             }
             niter_final = niter;
             niterw_final = niterw;
+            this->warm.setNiter(niter+niterw, threadNo);
         } else {
             int niter = 0;
             while ( change >= epsilon && niter<nitermax ) {
-                this->sweep(frozen, threadNo);
-                
-                change = 0.0;
-                for ( size_t n=0; n<this->nodes.size(); ++n ) {
-                    T1 dt = std::abs( times[n] - this->nodes[n].getTT(threadNo) );
-                    
-                    change += dt;
-                    times[n] = this->nodes[n].getTT(threadNo);
-                }
+                change = this->sweep(frozen, active, threadNo, relax);
                 niter++;
             }
             niter_final = niter;
+            this->warm.setNiter(niter, threadNo);
         }
+        this->saveWarmStart(Tx, t0, threadNo);
     }
     
     template<typename T1, typename T2>
-    void Grid3Drcfs<T1,T2>::raytrace(const std::vector<sxyz<T1>>& Tx,
-                                     const std::vector<T1>& t0,
-                                     const std::vector<const std::vector<sxyz<T1>>*>& Rx,
-                                     const size_t threadNo) const {
+    void Grid3Drcfs<T1,T2>::raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                                          const std::vector<T1>& t0,
+                                          const std::vector<const std::vector<sxyz<T1>>*>& Rx,
+                                          const size_t threadNo) const {
         
         this->checkPts(Tx);
         for ( size_t n=0; n<Rx.size(); ++n )
@@ -410,10 +423,11 @@ namespace ttcr {
         int npts = 1;
         if ( weno3 == true ) npts = 2;
         this->initFSM(Tx, t0, frozen, npts, threadNo);
-        
-        std::vector<T1> times( this->nodes.size() );
-        for ( size_t n=0; n<this->nodes.size(); ++n )
-            times[n] = this->nodes[n].getTT( threadNo );
+        // all nodes are active at first, unless starting from the field of
+        // a previous solve
+        std::vector<bool> active( this->nodes.size(), true );
+        bool relax = false;
+        this->initWarmStart(Tx, t0, frozen, active, relax, threadNo);
         
         T1 change = std::numeric_limits<T1>::max();
         if ( weno3 == true ) {
@@ -423,46 +437,27 @@ namespace ttcr {
                 throw std::logic_error("Error: WENO stencil needs dx equal to dz");
             }
             while ( change >= epsilon && niter<nitermax ) {
-                this->sweep(frozen, threadNo);
-                change = 0.0;
-                for ( size_t n=0; n<this->nodes.size(); ++n ) {
-                    T1 dt = std::abs( times[n] - this->nodes[n].getTT(threadNo) );
-                    
-                    change += dt;
-                    times[n] = this->nodes[n].getTT(threadNo);
-                }
+                change = this->sweep(frozen, active, threadNo, relax);
                 niter++;
             }
             change = std::numeric_limits<T1>::max();
             while ( change >= epsilon && niterw<nitermax ) {
-                this->sweep_weno3(frozen, threadNo);
-                change = 0.0;
-                for ( size_t n=0; n<this->nodes.size(); ++n ) {
-                    T1 dt = std::abs( times[n] - this->nodes[n].getTT(threadNo) );
-                    
-                    change += dt;
-                    times[n] = this->nodes[n].getTT(threadNo);
-                }
+                change = this->sweep_weno3(frozen, threadNo);
                 niterw++;
             }
             niter_final = niter;
             niterw_final = niterw;
+            this->warm.setNiter(niter+niterw, threadNo);
         } else {
             int niter = 0;
             while ( change >= epsilon && niter<nitermax ) {
-                this->sweep(frozen, threadNo);
-                
-                change = 0.0;
-                for ( size_t n=0; n<this->nodes.size(); ++n ) {
-                    T1 dt = std::abs( times[n] - this->nodes[n].getTT(threadNo) );
-                    
-                    change += dt;
-                    times[n] = this->nodes[n].getTT(threadNo);
-                }
+                change = this->sweep(frozen, active, threadNo, relax);
                 niter++;
             }
             niter_final = niter;
+            this->warm.setNiter(niter, threadNo);
         }
+        this->saveWarmStart(Tx, t0, threadNo);
         
     }
 }
@@ -39,8 +39,11 @@
 #include <iostream>
 #include <map>
 #include <queue>
+#include <type_traits>
 #include <vector>
 
+#include "Cell.h"
+#include "EdgeLengths.h"
 #include "Grid3Drc.h"
 #include "Node3Dcsp.h"
 
@@ -63,10 +66,12 @@ namespace ttcr {
                    const T2 nnx, const T2 nny, const T2 nnz,
                    const bool ttrp, const size_t nt) :
         Grid3Drc<T1,T2,Node3Dcsp<T1,T2>,CELL>(nx, ny, nz, ddx, ddy, ddz, minx, miny, minz, ttrp, nt),
-        nsnx(nnx), nsny(nny), nsnz(nnz)
+        nsnx(nnx), nsny(nny), nsnz(nnz),
+        edgeTablesMaxBytes(LatticeEdgeLengths<T1,T2>::defaultMaxBytes)
         {
             buildGridNodes();
             this->template buildGridNeighbors<Node3Dcsp<T1,T2>>(this->nodes);
+            buildEdgeLengths();
         }
         
         ~Grid3Drcsp() {
@@ -74,47 +79,78 @@ namespace ttcr {
         }
         
         
-        void raytrace(const std::vector<sxyz<T1>>& Tx,
-                     const std::vector<T1>& t0,
-                     const std::vector<sxyz<T1>>& Rx,
-                     std::vector<T1>& traveltimes,
-                     const size_t threadNo=0) const;
-        
-        void raytrace(const std::vector<sxyz<T1>>& Tx,
-                     const std::vector<T1>& t0,
-                     const std::vector<const std::vector<sxyz<T1>>*>& Rx,
-                     std::vector<std::vector<T1>*>& traveltimes,
-                     const size_t threadNo=0) const;
-        
-        void raytrace(const std::vector<sxyz<T1>>& Tx,
-                     const std::vector<T1>& t0,
-                     const std::vector<sxyz<T1>>& Rx,
-                     std::vector<T1>& traveltimes,
-                     std::vector<std::vector<sxyz<T1>>>& r_data,
-                     const size_t threadNo=0) const;
-        
-        void raytrace(const std::vector<sxyz<T1>>& Tx,
-                     const std::vector<T1>& t0,
-                     const std::vector<const std::vector<sxyz<T1>>*>& Rx,
-                     std::vector<std::vector<T1>*>& traveltimes,
-                     std::vector<std::vector<std::vector<sxyz<T1>>>*>& r_data,
-                     const size_t threadNo=0) const;
-        
-        void raytrace(const std::vector<sxyz<T1>>& Tx,
-                     const std::vector<T1>& t0,
-                     const std::vector<sxyz<T1>>& Rx,
-                     std::vector<T1>& traveltimes,
-                     std::vector<std::vector<sxyz<T1>>>& r_data,
-                     std::vector<std::vector<siv<T1>>>& l_data,
-                     const size_t threadNo=0) const;
+    protected:
+        void raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                          const std::vector<T1>& t0,
+                          const std::vector<sxyz<T1>>& Rx,
+                          std::vector<T1>& traveltimes,
+                          const size_t threadNo=0) const;
+        
+        void raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                          const std::vector<T1>& t0,
+                          const std::vector<const std::vector<sxyz<T1>>*>& Rx,
+                          std::vector<std::vector<T1>*>& traveltimes,
+                          const size_t threadNo=0) const;
+        
+        void raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                          const std::vector<T1>& t0,
+                          const std::vector<sxyz<T1>>& Rx,
+                          std::vector<T1>& traveltimes,
+                          std::vector<std::vector<sxyz<T1>>>& r_data,
+                          const size_t threadNo=0) const;
+        
+        // raypaths are traced back through the parents of the nodes, which
+        // include temporary source nodes
+        void raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                           const std::vector<T1>& t0,
+                           const std::vector<sxyz<T1>>& Rx,
+                           std::vector<T1>& traveltimes,
+                           RayPaths<float,T2>& rays,
+                           const size_t threadNo=0) const {
+            this->appendRaypaths(Tx, t0, Rx, traveltimes, rays, threadNo);
+        }
+        
+        void raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                          const std::vector<T1>& t0,
+                          const std::vector<const std::vector<sxyz<T1>>*>& Rx,
+                          std::vector<std::vector<T1>*>& traveltimes,
+                          std::vector<std::vector<std::vector<sxyz<T1>>>*>& r_data,
+                          const size_t threadNo=0) const;
+        
+        void raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                          const std::vector<T1>& t0,
+                          const std::vector<sxyz<T1>>& Rx,
+                          std::vector<T1>& traveltimes,
+                          std::vector<std::vector<sxyz<T1>>>& r_data,
+                          std::vector<std::vector<siv<T1>>>& l_data,
+                          const size_t threadNo=0) const;
 
-        void raytrace(const std::vector<sxyz<T1>>& Tx,
-                     const std::vector<T1>& t0,
-                     const std::vector<sxyz<T1>>& Rx,
-                     std::vector<T1>& traveltimes,
-                     std::vector<std::vector<siv<T1>>>& l_data,
-                     const size_t threadNo=0) const;
+        void raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                          const std::vector<T1>& t0,
+                          const std::vector<sxyz<T1>>& Rx,
+                          std::vector<T1>& traveltimes,
+                          std::vector<std::vector<siv<T1>>>& l_data,
+                          const size_t threadNo=0) const;
+        
+        // the raypaths are obtained while the shortest path tree is traced
+        // back, l_data is thus only held for the current source
+        void raytraceLTrLocal(const std::vector<sxyz<T1>>& Tx,
+                              const std::vector<T1>& t0,
+                              const std::vector<sxyz<T1>>& Rx,
+                              const std::vector<T1>& r,
+                              std::vector<T1>& traveltimes,
+                              std::vector<T1>& LTr,
+                              const size_t threadNo=0) const;
 
+        void raytraceLxLocal(const std::vector<sxyz<T1>>& Tx,
+                             const std::vector<T1>& t0,
+                             const std::vector<sxyz<T1>>& Rx,
+                             const std::vector<T1>& x,
+                             std::vector<T1>& traveltimes,
+                             std::vector<T1>& Lx,
+                             const size_t threadNo=0) const;
+        
+    public:
         void raytrace2(const std::vector<sxyz<T1>>& Tx,
                       const std::vector<T1>& t0,
                       const std::vector<sxyz<T1>>& Rx,
@@ -125,13 +161,47 @@ namespace ttcr {
         const T2 getNsny() const { return nsny; }
         const T2 getNsnz() const { return nsnz; }
         
+        void setEdgeTables(const size_t maxBytes) {
+            edgeTablesMaxBytes = maxBytes;
+            buildEdgeLengths();
+        }
+        bool hasEdgeTables() const { return !edgeLengths.empty(); }
+        
     private:
         T2 nsnx;                 // number of secondary nodes in x
         T2 nsny;                 // number of secondary nodes in y
         T2 nsnz;                 // number of secondary nodes in z
+        size_t edgeTablesMaxBytes;
+        LatticeEdgeLengths<T1,T2> edgeLengths;
+        
+        void buildEdgeLengths() {
+            if ( !edgeLengths.build(this->nodes, this->xmin, this->ymin, this->zmin,
+                                    this->dx, this->dy, this->dz, nsnx, nsny, nsnz,
+                                    edgeTablesMaxBytes) &&
+                edgeTablesMaxBytes > 0 && verbose ) {
+                std::cout << "Tables of edge lengths would exceed " << edgeTablesMaxBytes
+                << " bytes, lengths are computed on the fly.\n";
+            }
+        }
+        
+        T1 getTraveltimeAt(const sxyz<T1>& pt, const size_t threadNo) const {
+            return this->getTraveltime(pt, this->nodes, threadNo);
+        }
         
         void buildGridNodes();
         
+        T1 computeDt(const Node3Dcsp<T1,T2>& source,
+                     const Node3Dcsp<T1,T2>& node,
+                     const T2 cellNo) const {
+            // lengths can be used directly only if slowness is isotropic
+            if ( std::is_same<CELL, Cell<T1,Node3Dcsp<T1,T2>,sxyz<T1>>>::value &&
+                edgeLengths.contains(source.getGridIndex()) ) {
+                return this->cells.getSlowness(cellNo) *
+                edgeLengths(source.getGridIndex(), node.getGridIndex());
+            }
+            return this->cells.computeDt(source, node, cellNo);
+        }
+        
         void initQueue(const std::vector<sxyz<T1>>& Tx,
                        const std::vector<T1>& t0,
                        std::priority_queue<Node3Dcsp<T1,T2>*,
@@ -584,7 +654,7 @@ namespace ttcr {
             if ( found==false ) {
                 // If Tx[n] is not on a node, we create a new node and initialize the queue:
                 txNodes.push_back( Node3Dcsp<T1,T2>(Tx[n].x, Tx[n].y, Tx[n].z,
-                                                    static_cast<T2>(this->nodes.size()+txNodes.size()-1),
+                                                    static_cast<T2>(this->nodes.size()+txNodes.size()),
                                                     this->nThreads));
                 txNodes.back().setTT(t0[n], threadNo);
                 txNodes.back().pushOwner( this->getCellNo(Tx[n]) );
@@ -624,7 +694,7 @@ namespace ttcr {
                     T1 ttsource= source->getTT( threadNo );
                     if (ttsource < this->nodes[neibNo].getTT(threadNo)){
                         // Compute dt
-                        T1 dt = this->cells.computeDt(*source, this->nodes[neibNo], cellNo);
+                        T1 dt = computeDt(*source, this->nodes[neibNo], cellNo);
                         
                         if ( ttsource +dt < this->nodes[neibNo].getTT( threadNo ) ) {
                             this->nodes[neibNo].setTT( ttsource +dt, threadNo );
@@ -668,7 +738,7 @@ namespace ttcr {
                     T1 ttsource= source->getTT( threadNo );
 //                    if (ttsource < this->nodes[neibNo].getTT(threadNo)){
                         // Compute dt
-                        T1 dt = this->cells.computeDt(*source, this->nodes[neibNo], cellNo);
+                        T1 dt = computeDt(*source, this->nodes[neibNo], cellNo);
                         
                         if ( ttsource+dt < this->nodes[neibNo].getTT( threadNo ) ) {
                             this->nodes[neibNo].setTT( ttsource+dt, threadNo );
@@ -708,7 +778,7 @@ namespace ttcr {
                 }
                 
                 // compute dt
-                T1 dt = this->cells.computeDt(node, this->nodes[neibNo], cellNo);
+                T1 dt = computeDt(node, this->nodes[neibNo], cellNo);
                 
                 if ( node.getTT( threadNo )+dt < this->nodes[neibNo].getTT( threadNo ) ) {
                     this->nodes[neibNo].setTT( node.getTT( threadNo )+dt, threadNo );
@@ -853,11 +923,11 @@ namespace ttcr {
     }
     
     template<typename T1, typename T2, typename CELL>
-    void Grid3Drcsp<T1,T2,CELL>::raytrace(const std::vector<sxyz<T1>>& Tx,
-                                          const std::vector<T1>& t0,
-                                          const std::vector<sxyz<T1>>& Rx,
-                                          std::vector<T1>& traveltimes,
-                                          const size_t threadNo) const {
+    void Grid3Drcsp<T1,T2,CELL>::raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                                               const std::vector<T1>& t0,
+                                               const std::vector<sxyz<T1>>& Rx,
+                                               std::vector<T1>& traveltimes,
+                                               const size_t threadNo) const {
         
         // Primary function
         
@@ -898,11 +968,11 @@ namespace ttcr {
     }
     
     template<typename T1, typename T2, typename CELL>
-    void Grid3Drcsp<T1,T2,CELL>::raytrace(const std::vector<sxyz<T1>>& Tx,
-                                          const std::vector<T1>& t0,
-                                          const std::vector<const std::vector<sxyz<T1>>*>& Rx,
-                                          std::vector<std::vector<T1>*>& traveltimes,
-                                          const size_t threadNo) const {
+    void Grid3Drcsp<T1,T2,CELL>::raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                                               const std::vector<T1>& t0,
+                                               const std::vector<const std::vector<sxyz<T1>>*>& Rx,
+                                               std::vector<std::vector<T1>*>& traveltimes,
+                                               const size_t threadNo) const {
         
         this->checkPts(Tx);
         for ( size_t n=0; n<Rx.size(); ++n )
@@ -944,12 +1014,12 @@ namespace ttcr {
     }
     
     template<typename T1, typename T2, typename CELL>
-    void Grid3Drcsp<T1,T2,CELL>::raytrace(const std::vector<sxyz<T1>>& Tx,
-                                          const std::vector<T1>& t0,
-                                          const std::vector<sxyz<T1>>& Rx,
-                                          std::vector<T1>& traveltimes,
-                                          std::vector<std::vector<sxyz<T1>>>& r_data,
-                                          const size_t threadNo) const {
+    void Grid3Drcsp<T1,T2,CELL>::raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                                               const std::vector<T1>& t0,
+                                               const std::vector<sxyz<T1>>& Rx,
+                                               std::vector<T1>& traveltimes,
+                                               std::vector<std::vector<sxyz<T1>>>& r_data,
+                                               const size_t threadNo) const {
         
         // Primary function
         
@@ -989,6 +1059,19 @@ namespace ttcr {
         for (size_t n=0; n<Rx.size(); ++n) {
             traveltimes[n] = this->getTraveltime(Rx[n], this->nodes, nodeParentRx, cellParentRx,
                                                  threadNo);
+
+            bool flag=false;
+            for ( size_t ns=0; ns<Tx.size(); ++ns ) {
+                if ( Rx[n] == Tx[ns] ) {
+
+                    r_data[n].resize( 1 );
+                    r_data[n][0] = Rx[n];
+
+                    flag = true;
+                    break;
+                }
+            }
+            if ( flag ) continue;
             
             // Rx are in nodes (not txNodes)
             std::vector<Node3Dcsp<T1,T2>> *node_p;
@@ -1044,12 +1127,12 @@ namespace ttcr {
     }
     
     template<typename T1, typename T2, typename CELL>
-    void Grid3Drcsp<T1,T2,CELL>::raytrace(const std::vector<sxyz<T1>>& Tx,
-                                          const std::vector<T1>& t0,
-                                          const std::vector<const std::vector<sxyz<T1>>*>& Rx,
-                                          std::vector<std::vector<T1>*>& traveltimes,
-                                          std::vector<std::vector<std::vector<sxyz<T1>>>*>& r_data,
-                                          const size_t threadNo) const {
+    void Grid3Drcsp<T1,T2,CELL>::raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                                               const std::vector<T1>& t0,
+                                               const std::vector<const std::vector<sxyz<T1>>*>& Rx,
+                                               std::vector<std::vector<T1>*>& traveltimes,
+                                               std::vector<std::vector<std::vector<sxyz<T1>>>*>& r_data,
+                                               const size_t threadNo) const {
         
         this->checkPts(Tx);
         for ( size_t n=0; n<Rx.size(); ++n )
@@ -1156,13 +1239,13 @@ namespace ttcr {
     }
     
     template<typename T1, typename T2, typename CELL>
-    void Grid3Drcsp<T1,T2,CELL>::raytrace(const std::vector<sxyz<T1>>& Tx,
-                                          const std::vector<T1>& t0,
-                                          const std::vector<sxyz<T1>>& Rx,
-                                          std::vector<T1>& traveltimes,
-                                          std::vector<std::vector<sxyz<T1>>>& r_data,
-                                          std::vector<std::vector<siv<T1>>>& l_data,
-                                          const size_t threadNo) const {
+    void Grid3Drcsp<T1,T2,CELL>::raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                                               const std::vector<T1>& t0,
+                                               const std::vector<sxyz<T1>>& Rx,
+                                               std::vector<T1>& traveltimes,
+                                               std::vector<std::vector<sxyz<T1>>>& r_data,
+                                               std::vector<std::vector<siv<T1>>>& l_data,
+                                               const size_t threadNo) const {
         
         // Primary function
         
@@ -1209,6 +1292,19 @@ namespace ttcr {
         for (size_t n=0; n<Rx.size(); ++n) {
             traveltimes[n] = this->getTraveltime(Rx[n], this->nodes, nodeParentRx, cellParentRx,
                                                  threadNo);
+
+            bool flag=false;
+            for ( size_t ns=0; ns<Tx.size(); ++ns ) {
+                if ( Rx[n] == Tx[ns] ) {
+
+                    r_data[n].resize( 1 );
+                    r_data[n][0] = Rx[n];
+
+                    flag = true;
+                    break;
+                }
+            }
+            if ( flag ) continue;
             
             // Rx are in nodes (not txNodes)
             std::vector<Node3Dcsp<T1,T2>> *node_p;
@@ -1296,12 +1392,12 @@ namespace ttcr {
     }
     
     template<typename T1, typename T2, typename CELL>
-    void Grid3Drcsp<T1,T2,CELL>::raytrace(const std::vector<sxyz<T1>>& Tx,
-                                          const std::vector<T1>& t0,
-                                          const std::vector<sxyz<T1>>& Rx,
-                                          std::vector<T1>& traveltimes,
-                                          std::vector<std::vector<siv<T1>>>& l_data,
-                                          const size_t threadNo) const {
+    void Grid3Drcsp<T1,T2,CELL>::raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                                               const std::vector<T1>& t0,
+                                               const std::vector<sxyz<T1>>& Rx,
+                                               std::vector<T1>& traveltimes,
+                                               std::vector<std::vector<siv<T1>>>& l_data,
+                                               const size_t threadNo) const {
 
         // Primary function
 
@@ -1343,6 +1439,16 @@ namespace ttcr {
             traveltimes[n] = this->getTraveltime(Rx[n], this->nodes, nodeParentRx, cellParentRx,
                                                  threadNo);
 
+            // Rx on a Tx: nothing to backtrack, the ray has no length
+            bool flag=false;
+            for ( size_t ns=0; ns<Tx.size(); ++ns ) {
+                if ( Rx[n] == Tx[ns] ) {
+                    flag = true;
+                    break;
+                }
+            }
+            if ( flag ) continue;
+
             // Rx are in nodes (not txNodes)
             std::vector<Node3Dcsp<T1,T2>> *node_p;
             node_p = &(this->nodes);
@@ -1457,6 +1563,53 @@ namespace ttcr {
             traveltimes[n] = this->getTraveltime(Rx[n], this->nodes, threadNo);
         }
     }    
+
+    template<typename T1, typename T2, typename CELL>
+    void Grid3Drcsp<T1,T2,CELL>::raytraceLTrLocal(const std::vector<sxyz<T1>>& Tx,
+                                                  const std::vector<T1>& t0,
+                                                  const std::vector<sxyz<T1>>& Rx,
+                                                  const std::vector<T1>& r,
+                                                  std::vector<T1>& traveltimes,
+                                                  std::vector<T1>& LTr,
+                                                  const size_t threadNo) const {
+        if ( r.size() != Rx.size() ) {
+            throw std::length_error("Error: r and Rx should have the same size.");
+        }
+        std::vector<std::vector<siv<T1>>> l_data;
+        raytraceLocal(Tx, t0, Rx, traveltimes, l_data, threadNo);
+
+        if ( LTr.size() != this->getNumberOfCells() ) {
+            LTr.assign( this->getNumberOfCells(), 0.0 );
+        }
+        for ( size_t n=0; n<Rx.size(); ++n ) {
+            for ( size_t nc=0; nc<l_data[n].size(); ++nc ) {
+                LTr[ l_data[n][nc].i ] += l_data[n][nc].v * r[n];
+            }
+        }
+    }
+
+    template<typename T1, typename T2, typename CELL>
+    void Grid3Drcsp<T1,T2,CELL>::raytraceLxLocal(const std::vector<sxyz<T1>>& Tx,
+                                                 const std::vector<T1>& t0,
+                                                 const std::vector<sxyz<T1>>& Rx,
+                                                 const std::vector<T1>& x,
+                                                 std::vector<T1>& traveltimes,
+                                                 std::vector<T1>& Lx,
+                                                 const size_t threadNo) const {
+        if ( x.size() != this->getNumberOfCells() ) {
+            throw std::length_error("Error: x should have one value per cell.");
+        }
+        std::vector<std::vector<siv<T1>>> l_data;
+        raytraceLocal(Tx, t0, Rx, traveltimes, l_data, threadNo);
+
+        Lx.assign( Rx.size(), 0.0 );
+        for ( size_t n=0; n<Rx.size(); ++n ) {
+            for ( size_t nc=0; nc<l_data[n].size(); ++nc ) {
+                Lx[n] += l_data[n][nc].v * x[ l_data[n][nc].i ];
+            }
+        }
+    }
+
 }
 
 #endif
@@ -31,6 +31,7 @@
 #include <cstring>
 #include <iostream>
 #include <fstream>
+#include <functional>
 #include <queue>
 #include <sstream>
 #include <stdexcept>
@@ -47,8 +48,10 @@
 #include "vtkXMLRectilinearGridWriter.h"
 #endif
 
+#include "FactoredEikonal.h"
 #include "Grid3D.h"
 #include "Interpolator.h"
+#include "WarmStart.h"
 
 namespace ttcr {
     
@@ -71,7 +74,8 @@ namespace ttcr {
         xmin(minx), ymin(miny), zmin(minz),
         xmax(minx+nx*ddx), ymax(miny+ny*ddy), zmax(minz+nz*ddz),
         ncx(nx), ncy(ny), ncz(nz), interpVel(intVel),
-        nodes(std::vector<NODE>((nx+1)*(ny+1)*(nz+1), NODE(nt)))
+        nodes(std::vector<NODE>((nx+1)*(ny+1)*(nz+1), NODE(nt))),
+        factored(false), factoredSrc(nt), fsmInit(nt), warm(nt)
         { }
         
         virtual ~Grid3Drn() {}
@@ -83,6 +87,7 @@ namespace ttcr {
             for ( size_t n=0; n<nodes.size(); ++n ) {
                 nodes[n].setNodeSlowness( s[n] );
             }
+            this->slownessChanged();
         }
         void getSlowness(std::vector<T1>& slowness) const {
             if (slowness.size() != (ncx+1) * (ncy+1) * (ncz+1)) {
@@ -138,9 +143,9 @@ namespace ttcr {
         void loadTT(const std::string &, const int, const size_t nt=0,
                     const int format=1) const;
         
-        const T1 getXmin() const { return xmin; }
-        const T1 getYmin() const { return ymin; }
-        const T1 getZmin() const { return zmin; }
+        const T1 getXmin() const { return static_cast<T1>(xmin+this->origin.x); }
+        const T1 getYmin() const { return static_cast<T1>(ymin+this->origin.y); }
+        const T1 getZmin() const { return static_cast<T1>(zmin+this->origin.z); }
         const T1 getDx() const { return dx; }
         const T1 getDy() const { return dy; }
         const T1 getDz() const { return dz; }
@@ -157,6 +162,21 @@ namespace ttcr {
 
         T1 computeSlowness(const sxyz<T1>&) const;
 
+        // solve the factored eikonal equation (single point source)
+        void setFactored(const bool f) {
+            if ( f != factored ) {
+                factored = f;
+                this->slownessChanged();
+            }
+        }
+        
+    protected:
+        void getMisfitGradientLocal(const std::vector<sxyz<T1>>& Rx,
+                                    const std::vector<T1>& r,
+                                    std::vector<T1>& grad,
+                                    const size_t threadNo=0) const;
+        
+    public:
 #ifdef VTK
         void saveModelVTR(const std::string &,
                           const bool saveSlowness=true) const;
@@ -180,8 +200,66 @@ namespace ttcr {
         
         mutable std::vector<NODE> nodes;
         
+        bool factored;
+        // source of the factored equation, for each thread
+        mutable std::vector<FactoredSource<T1>> factoredSrc;
+        
+        // sources and nodes set by initFSM, for each thread (the traveltime
+        // of these nodes is computed directly, see getMisfitGradient)
+        struct FSMinit {
+            std::vector<sxyz<T1>> Tx;
+            std::vector<T1> t0;
+            std::vector<bool> frozen;
+        };
+        mutable std::vector<FSMinit> fsmInit;
+        
+        // initial fields of the FSM and number of sweeps, for each thread
+        mutable WarmStart<T1> warm;
+        
         void interpSecondary();
         
+        // traveltimes of the nodes, followed by the flags of the nodes set by
+        // initFSM, if any
+        bool getTTState(std::vector<T1>& state, const size_t threadNo) const {
+            const std::vector<bool>& frozen = fsmInit[threadNo].frozen;
+            state.resize( frozen.empty() ? nodes.size() : 2*nodes.size() );
+            for ( size_t n=0; n<nodes.size(); ++n ) {
+                state[n] = nodes[n].getTT(threadNo);
+            }
+            for ( size_t n=0; n<frozen.size(); ++n ) {
+                state[nodes.size()+n] = frozen[n] ? 1.0 : 0.0;
+            }
+            return true;
+        }
+        void setTTState(const std::vector<sxyz<T1>>& Tx,
+                        const std::vector<T1>& t0,
+                        const std::vector<T1>& state,
+                        const size_t threadNo) const {
+            for ( size_t n=0; n<nodes.size(); ++n ) {
+                nodes[n].setTT(state[n], threadNo);
+            }
+            FSMinit& init = fsmInit[threadNo];
+            init.frozen.clear();
+            if ( state.size() == 2*nodes.size() ) {
+                init.Tx = Tx;
+                init.t0 = t0;
+                init.frozen.resize( nodes.size() );
+                for ( size_t n=0; n<nodes.size(); ++n ) {
+                    init.frozen[n] = state[nodes.size()+n] != 0.0;
+                }
+            }
+        }
+        // the seed supplied for the thread was meant for a solve, and is
+        // dropped; the traveltimes are kept for a warm start from Tx
+        void restoreSolve(const std::vector<sxyz<T1>>& Tx,
+                          const std::vector<T1>& t0,
+                          const int n, const int nw,
+                          const size_t threadNo) const {
+            warm.setNiter(n, threadNo);
+            warm.dropSeed(threadNo);
+            saveWarmStart(Tx, t0, threadNo);
+        }
+        
         T2 getCellNo(const sxyz<T1>& pt) const {
             T1 x = xmax-pt.x < small2 ? xmax-.5*dx : pt.x;
             T1 y = ymax-pt.y < small2 ? ymax-.5*dy : pt.y;
@@ -307,13 +385,22 @@ namespace ttcr {
                             std::vector<sxyz<T1>> &r_data,
                             const size_t threadNo=0) const;
         
-        void sweep(const std::vector<bool>& frozen,
-                   const size_t threadNo) const;
-        void sweep_weno3(const std::vector<bool>& frozen,
-                         const size_t threadNo) const;
-        
-        void update_node(const size_t, const size_t, const size_t, const size_t=0) const;
-        void update_node_weno3(const size_t, const size_t, const size_t, const size_t=0) const;
+        T1 sweep(const std::vector<bool>& frozen,
+                 std::vector<bool>& active,
+                 const size_t threadNo, const bool relax=false) const;
+        T1 sweep_weno3(const std::vector<bool>& frozen,
+                       const size_t threadNo) const;
+        
+        T1 update_active(const size_t, const size_t, const size_t,
+                         const std::vector<bool>& frozen,
+                         std::vector<bool>& active,
+                         const size_t threadNo, const bool relax) const;
+        T1 update_node(const size_t, const size_t, const size_t, const size_t=0,
+                       const bool relax=false) const;
+        T1 update_node_weno3(const size_t, const size_t, const size_t, const size_t=0) const;
+        T1 update_node_factored(const size_t, const size_t, const size_t,
+                                const std::vector<bool>* frozen,
+                                const size_t threadNo) const;
         
         void initFSM(const std::vector<sxyz<T1>>& Tx,
                      const std::vector<T1>& t0,
@@ -321,6 +408,26 @@ namespace ttcr {
                      const int npts,
                      const size_t threadNo) const;
         
+        bool initWarmStart(const std::vector<sxyz<T1>>& Tx,
+                           const std::vector<T1>& t0,
+                           const std::vector<bool>& frozen,
+                           std::vector<bool>& active,
+                           bool& relax,
+                           const size_t threadNo) const;
+        void saveWarmStart(const std::vector<sxyz<T1>>& Tx,
+                           const std::vector<T1>& t0,
+                           const size_t threadNo) const {
+            if ( warm.isCached() ) warm.put(Tx, t0, warm.makeField(nodes, threadNo));
+        }
+        
+        T1 update_node_fmm(const size_t, const size_t, const size_t,
+                           const std::vector<bool>& frozen,
+                           const bool secondOrder,
+                           const size_t threadNo) const;
+        void propagateFMM(std::vector<bool>& frozen,
+                          const bool secondOrder,
+                          const size_t threadNo) const;
+        
     private:
         Grid3Drn() {}
         Grid3Drn(const Grid3Drn<T1,T2,NODE>& g) {}
@@ -358,8 +465,8 @@ namespace ttcr {
     template<typename T1, typename T2, typename NODE>
     T1 Grid3Drn<T1,T2,NODE>::getTraveltime(const sxyz<T1> &pt, const size_t nt) const {
         
-        static const size_t nnx = ncx+1;
-        static const size_t nny = ncy+1;
+        const size_t nnx = ncx+1;
+        const size_t nny = ncy+1;
         
         // trilinear interpolation if not on node
         
@@ -601,8 +708,8 @@ namespace ttcr {
         
         // compute average gradient for voxel (i,j,k)
         
-        static const size_t nnx = ncx+1;
-        static const size_t nny = ncy+1;
+        const size_t nnx = ncx+1;
+        const size_t nny = ncy+1;
         
         g.x = 0.25*(nodes[(    k*nny+j  )*nnx+i+1].getTT(nt) - nodes[(    k*nny+j  )*nnx+i  ].getTT(nt) +
                     nodes[(    k*nny+j+1)*nnx+i+1].getTT(nt) - nodes[(    k*nny+j+1)*nnx+i  ].getTT(nt) +
@@ -1141,8 +1248,8 @@ namespace ttcr {
         tt = 0.0;
         T1 s1, s2;
 
-        static const size_t nnx = ncx+1;
-        static const size_t nny = ncy+1;
+        const size_t nnx = ncx+1;
+        const size_t nny = ncy+1;
 
         for ( size_t ns=0; ns<Tx.size(); ++ns ) {
             if ( Rx == Tx[ns] ) {
@@ -1779,8 +1886,8 @@ namespace ttcr {
         tt = 0.0;
         T1 s1, s2;
 
-        static const size_t nnx = ncx+1;
-        static const size_t nny = ncy+1;
+        const size_t nnx = ncx+1;
+        const size_t nny = ncy+1;
 
         r_data.push_back( Rx );
         
@@ -2546,9 +2653,9 @@ namespace ttcr {
     template<typename T1, typename T2, typename NODE>
     T1 Grid3Drn<T1,T2,NODE>::computeSlowness(const sxyz<T1>& pt) const {
         
-        static const size_t nnx = ncx+1;
-        static const size_t nny = ncy+1;
-        static const size_t nnz = ncz+1;
+        const size_t nnx = ncx+1;
+        const size_t nny = ncy+1;
+        const size_t nnz = ncz+1;
 
         // are we on an node, an edge or a face?
         ptrdiff_t onX = -1;
@@ -2779,9 +2886,9 @@ namespace ttcr {
             fout.precision(12);
             for ( T2 n=0; n<nodes.size(); ++n ) {
                 if ( nodes[n].isPrimary() || all==1 ) {
-                    fout << nodes[n].getX() << '\t'
-                    << nodes[n].getY() << '\t'
-                    << nodes[n].getZ() << '\t'
+                    fout << nodes[n].getX()+this->origin.x << '\t'
+                    << nodes[n].getY()+this->origin.y << '\t'
+                    << nodes[n].getZ()+this->origin.z << '\t'
                     << nodes[n].getTT(nt) << '\n';
                 }
             }
@@ -2794,13 +2901,13 @@ namespace ttcr {
             
             vtkSmartPointer<vtkDoubleArray> xCoords = vtkSmartPointer<vtkDoubleArray>::New();
             for (size_t n=0; n<nn[0]; ++n)
-                xCoords->InsertNextValue( xmin + n*dx );
+                xCoords->InsertNextValue( xmin + this->origin.x + n*dx );
             vtkSmartPointer<vtkDoubleArray> yCoords = vtkSmartPointer<vtkDoubleArray>::New();
             for (size_t n=0; n<nn[1]; ++n)
-                yCoords->InsertNextValue( ymin + n*dy );
+                yCoords->InsertNextValue( ymin + this->origin.y + n*dy );
             vtkSmartPointer<vtkDoubleArray> zCoords = vtkSmartPointer<vtkDoubleArray>::New();
             for (size_t n=0; n<nn[2]; ++n)
-                zCoords->InsertNextValue( zmin + n*dz );
+                zCoords->InsertNextValue( zmin + this->origin.z + n*dz );
             
             vtkSmartPointer<vtkRectilinearGrid> rgrid = vtkSmartPointer<vtkRectilinearGrid>::New();
             rgrid->SetDimensions( nn );
@@ -2817,7 +2924,9 @@ namespace ttcr {
             
             for ( size_t n=0; n<nodes.size(); ++n ) {
                 if ( nodes[n].isPrimary() ) {
-                    vtkIdType id = rgrid->FindPoint(nodes[n].getX(), nodes[n].getY(), nodes[n].getZ());
+                    vtkIdType id = rgrid->FindPoint(nodes[n].getX()+this->origin.x,
+                                                    nodes[n].getY()+this->origin.y,
+                                                    nodes[n].getZ()+this->origin.z);
                     newScalars->SetTuple1(id, nodes[n].getTT(nt) );
                 }
             }
@@ -2901,16 +3010,20 @@ namespace ttcr {
 
     
     template<typename T1, typename T2, typename NODE>
-    void Grid3Drn<T1,T2,NODE>::sweep(const std::vector<bool>& frozen,
-                                     const size_t threadNo) const {
+    T1 Grid3Drn<T1,T2,NODE>::sweep(const std::vector<bool>& frozen,
+                                   std::vector<bool>& active,
+                                   const size_t threadNo,
+                                   const bool relax) const {
+        
+        // nodes are updated only if active, i.e. if one of their neighbours
+        // changed since their last update; returns the sum of the changes
+        T1 change = 0.0;
         
         // sweep first direction
         for ( size_t k=0; k<=ncz; ++k ) {
             for ( size_t j=0; j<=ncy; ++j ) {
                 for ( size_t i=0; i<=ncx; ++i ) {
-                    if ( !frozen[ (k*(ncy+1)+j)*(ncx+1)+i ] ) {
-                        update_node(i, j, k, threadNo);
-                    }
+                    change += update_active(i, j, k, frozen, active, threadNo, relax);
                 }
             }
         }
@@ -2918,9 +3031,7 @@ namespace ttcr {
         for ( size_t k=0; k<=ncz; ++k ) {
             for ( size_t j=0; j<=ncy; ++j ) {
                 for ( long int i=ncx; i>=0; --i ) {
-                    if ( !frozen[ (k*(ncy+1)+j)*(ncx+1)+i ] ) {
-                        update_node(i, j, k, threadNo);
-                    }
+                    change += update_active(i, j, k, frozen, active, threadNo, relax);
                 }
             }
         }
@@ -2928,9 +3039,7 @@ namespace ttcr {
         for ( size_t k=0; k<=ncz; ++k ) {
             for ( long int j=ncy; j>=0; --j ) {
                 for ( size_t i=0; i<=ncx; ++i ) {
-                    if ( !frozen[ (k*(ncy+1)+j)*(ncx+1)+i ] ) {
-                        update_node(i, j, k, threadNo);
-                    }
+                    change += update_active(i, j, k, frozen, active, threadNo, relax);
                 }
             }
         }
@@ -2938,9 +3047,7 @@ namespace ttcr {
         for ( size_t k=0; k<=ncz; ++k ) {
             for ( long int j=ncy; j>=0; --j ) {
                 for ( long int i=ncx; i>=0; --i ) {
-                    if ( !frozen[ (k*(ncy+1)+j)*(ncx+1)+i ] ) {
-                        update_node(i, j, k, threadNo);
-                    }
+                    change += update_active(i, j, k, frozen, active, threadNo, relax);
                 }
             }
         }
@@ -2948,9 +3055,7 @@ namespace ttcr {
         for ( long int k=ncz; k>=0; --k ) {
             for ( size_t j=0; j<=ncy; ++j ) {
                 for ( size_t i=0; i<=ncx; ++i ) {
-                    if ( !frozen[ (k*(ncy+1)+j)*(ncx+1)+i ] ) {
-                        update_node(i, j, k, threadNo);
-                    }
+                    change += update_active(i, j, k, frozen, active, threadNo, relax);
                 }
             }
         }
@@ -2958,9 +3063,7 @@ namespace ttcr {
         for ( long int k=ncz; k>=0; --k ) {
             for ( size_t j=0; j<=ncy; ++j ) {
                 for ( long int i=ncx; i>=0; --i ) {
-                    if ( !frozen[ (k*(ncy+1)+j)*(ncx+1)+i ] ) {
-                        update_node(i, j, k, threadNo);
-                    }
+                    change += update_active(i, j, k, frozen, active, threadNo, relax);
                 }
             }
         }
@@ -2968,9 +3071,7 @@ namespace ttcr {
         for ( long int k=ncz; k>=0; --k ) {
             for ( long int j=ncy; j>=0; --j ) {
                 for ( size_t i=0; i<=ncx; ++i ) {
-                    if ( !frozen[ (k*(ncy+1)+j)*(ncx+1)+i ] ) {
-                        update_node(i, j, k, threadNo);
-                    }
+                    change += update_active(i, j, k, frozen, active, threadNo, relax);
                 }
             }
         }
@@ -2978,18 +3079,42 @@ namespace ttcr {
         for ( long int k=ncz; k>=0; --k ) {
             for ( long int j=ncy; j>=0; --j ) {
                 for ( long int i=ncx; i>=0; --i ) {
-                    if ( !frozen[ (k*(ncy+1)+j)*(ncx+1)+i ] ) {
-                        update_node(i, j, k, threadNo);
-                    }
+                    change += update_active(i, j, k, frozen, active, threadNo, relax);
                 }
             }
         }
+        return change;
     }
     
     template<typename T1, typename T2, typename NODE>
-    void Grid3Drn<T1,T2,NODE>::update_node(const size_t i, const size_t j, const size_t k,
-                                           const size_t threadNo) const {
-        T1 a1, a2, a3, t;
+    T1 Grid3Drn<T1,T2,NODE>::update_active(const size_t i, const size_t j, const size_t k,
+                                           const std::vector<bool>& frozen,
+                                           std::vector<bool>& active,
+                                           const size_t threadNo,
+                                           const bool relax) const {
+        const size_t n = (k*(ncy+1)+j)*(ncx+1)+i;
+        if ( frozen[n] || !active[n] ) return 0.0;
+        
+        active[n] = false;
+        T1 dt = update_node(i, j, k, threadNo, relax);
+        if ( dt > 0.0 ) {
+            // neighbours have to be updated again
+            if ( i>0 ) active[n-1] = true;
+            if ( i<ncx ) active[n+1] = true;
+            if ( j>0 ) active[n-(ncx+1)] = true;
+            if ( j<ncy ) active[n+(ncx+1)] = true;
+            if ( k>0 ) active[n-(ncy+1)*(ncx+1)] = true;
+            if ( k<ncz ) active[n+(ncy+1)*(ncx+1)] = true;
+        }
+        return dt;
+    }
+    
+    template<typename T1, typename T2, typename NODE>
+    T1 Grid3Drn<T1,T2,NODE>::update_node(const size_t i, const size_t j, const size_t k,
+                                         const size_t threadNo,
+                                         const bool relax) const {
+        typedef typename solver_type<T1>::type TS;
+        TS a1, a2, a3, t;
         
         if (k==0)
             a1 = nodes[ ((k+1)*(ncy+1)+j)*(ncx+1)+i ].getTT(threadNo);
@@ -3025,7 +3150,7 @@ namespace ttcr {
         if ( a1>a3 ) std::swap(a1, a3);
         if ( a2>a3 ) std::swap(a2, a3);
         
-        T1 fh = nodes[(k*(ncy+1)+j)*(ncx+1)+i].getNodeSlowness() * dx;
+        TS fh = nodes[(k*(ncy+1)+j)*(ncx+1)+i].getNodeSlowness() * dx;
         
         t = a1 + fh;
         if ( t > a2 ) {
@@ -3040,21 +3165,72 @@ namespace ttcr {
                 
             }
         }
+        if ( factoredSrc[threadNo].active ) {
+            TS tf = update_node_factored(i, j, k, nullptr, threadNo);
+            if ( tf < std::numeric_limits<T1>::max() ) t = tf;
+        }
         
-        if ( t<nodes[(k*(ncy+1)+j)*(ncx+1)+i].getTT(threadNo) )
-            nodes[(k*(ncy+1)+j)*(ncx+1)+i].setTT(t,threadNo);
         
+        // when relaxing (initial field from a previous solve), the update is
+        // also accepted if larger than the current value, by more than
+        // round-off to avoid flip-flopping between sweeps.  The comparison
+        // is done in storage precision, as for the value that is kept
+        t = static_cast<T1>(t);
+        T1 tc = nodes[(k*(ncy+1)+j)*(ncx+1)+i].getTT(threadNo);
+        if ( t<tc || (relax && t<std::numeric_limits<T1>::max() &&
+                      t-tc > 100*std::numeric_limits<T1>::epsilon()*tc) ) {
+            nodes[(k*(ncy+1)+j)*(ncx+1)+i].setTT(t,threadNo);
+            return std::abs(tc-t);
+        }
+        return 0.0;
     }
     
     template<typename T1, typename T2, typename NODE>
-    void Grid3Drn<T1,T2,NODE>::sweep_weno3(const std::vector<bool>& frozen,
-                                           const size_t threadNo) const {
+    T1 Grid3Drn<T1,T2,NODE>::update_node_factored(const size_t i, const size_t j,
+                                                  const size_t k,
+                                                  const std::vector<bool>* frozen,
+                                                  const size_t threadNo) const {
+        
+        // along each axis, the upwind neighbour is the one with the smallest
+        // traveltime (among frozen nodes if frozen is not null)
+        const long long ijk[3] = { static_cast<long long>(i),
+            static_cast<long long>(j), static_cast<long long>(k) };
+        const long long nn[3] = { static_cast<long long>(ncx+1),
+            static_cast<long long>(ncy+1), static_cast<long long>(ncz+1) };
+        const long long stride[3] = { 1, nn[0], nn[0]*nn[1] };
+        const T1 h[3] = { dx, dy, dz };
+        const long long n = (ijk[2]*nn[1]+ijk[1])*nn[0]+ijk[0];
+        
+        T1 tn[3];
+        int sgn[3];
+        for ( size_t d=0; d<3; ++d ) {
+            tn[d] = std::numeric_limits<T1>::max();
+            sgn[d] = 1;
+            for ( int s=-1; s<=1; s+=2 ) {
+                if ( ijk[d]+s < 0 || ijk[d]+s >= nn[d] ) continue;
+                long long n1 = n + s*stride[d];
+                if ( frozen != nullptr && !(*frozen)[n1] ) continue;
+                if ( nodes[n1].getTT(threadNo) < tn[d] ) {
+                    tn[d] = nodes[n1].getTT(threadNo);
+                    sgn[d] = s;
+                }
+            }
+        }
+        sxyz<T1> x(nodes[n].getX(), nodes[n].getY(), nodes[n].getZ());
+        return factoredUpdate(factoredSrc[threadNo], x, nodes[n].getNodeSlowness(),
+                              h, tn, sgn);
+    }
+    
+    template<typename T1, typename T2, typename NODE>
+    T1 Grid3Drn<T1,T2,NODE>::sweep_weno3(const std::vector<bool>& frozen,
+                                         const size_t threadNo) const {
+        T1 change = 0.0;
         // sweep first direction
         for ( size_t k=0; k<=ncz; ++k ) {
             for ( size_t j=0; j<=ncy; ++j ) {
                 for ( size_t i=0; i<=ncx; ++i ) {
                     if ( !frozen[ (k*(ncy+1)+j)*(ncx+1)+i ] ) {
-                        update_node_weno3(i, j, k, threadNo);
+                        change += update_node_weno3(i, j, k, threadNo);
                     }
                 }
             }
@@ -3064,7 +3240,7 @@ namespace ttcr {
             for ( size_t j=0; j<=ncy; ++j ) {
                 for ( long int i=ncx; i>=0; --i ) {
                     if ( !frozen[ (k*(ncy+1)+j)*(ncx+1)+i ] ) {
-                        update_node_weno3(i, j, k, threadNo);
+                        change += update_node_weno3(i, j, k, threadNo);
                     }
                 }
             }
@@ -3074,7 +3250,7 @@ namespace ttcr {
             for ( long int j=ncy; j>=0; --j ) {
                 for ( size_t i=0; i<=ncx; ++i ) {
                     if ( !frozen[ (k*(ncy+1)+j)*(ncx+1)+i ] ) {
-                        update_node_weno3(i, j, k, threadNo);
+                        change += update_node_weno3(i, j, k, threadNo);
                     }
                 }
             }
@@ -3084,7 +3260,7 @@ namespace ttcr {
             for ( long int j=ncy; j>=0; --j ) {
                 for ( long int i=ncx; i>=0; --i ) {
                     if ( !frozen[ (k*(ncy+1)+j)*(ncx+1)+i ] ) {
-                        update_node_weno3(i, j, k, threadNo);
+                        change += update_node_weno3(i, j, k, threadNo);
                     }
                 }
             }
@@ -3094,7 +3270,7 @@ namespace ttcr {
             for ( size_t j=0; j<=ncy; ++j ) {
                 for ( size_t i=0; i<=ncx; ++i ) {
                     if ( !frozen[ (k*(ncy+1)+j)*(ncx+1)+i ] ) {
-                        update_node_weno3(i, j, k, threadNo);
+                        change += update_node_weno3(i, j, k, threadNo);
                     }
                 }
             }
@@ -3104,7 +3280,7 @@ namespace ttcr {
             for ( size_t j=0; j<=ncy; ++j ) {
                 for ( long int i=ncx; i>=0; --i ) {
                     if ( !frozen[ (k*(ncy+1)+j)*(ncx+1)+i ] ) {
-                        update_node_weno3(i, j, k, threadNo);
+                        change += update_node_weno3(i, j, k, threadNo);
                     }
                 }
             }
@@ -3114,7 +3290,7 @@ namespace ttcr {
             for ( long int j=ncy; j>=0; --j ) {
                 for ( size_t i=0; i<=ncx; ++i ) {
                     if ( !frozen[ (k*(ncy+1)+j)*(ncx+1)+i ] ) {
-                        update_node_weno3(i, j, k, threadNo);
+                        change += update_node_weno3(i, j, k, threadNo);
                     }
                 }
             }
@@ -3124,35 +3300,37 @@ namespace ttcr {
             for ( long int j=ncy; j>=0; --j ) {
                 for ( long int i=ncx; i>=0; --i ) {
                     if ( !frozen[ (k*(ncy+1)+j)*(ncx+1)+i ] ) {
-                        update_node_weno3(i, j, k, threadNo);
+                        change += update_node_weno3(i, j, k, threadNo);
                     }
                 }
             }
         }
+        return change;
     }
     
     template<typename T1, typename T2, typename NODE>
-    void Grid3Drn<T1,T2,NODE>::update_node_weno3(const size_t i,
-                                                 const size_t j,
-                                                 const size_t k,
-                                                 const size_t threadNo) const {
-        T1 a1, a2, a3, t;
+    T1 Grid3Drn<T1,T2,NODE>::update_node_weno3(const size_t i,
+                                               const size_t j,
+                                               const size_t k,
+                                               const size_t threadNo) const {
+        typedef typename solver_type<T1>::type TS;
+        TS a1, a2, a3, t;
         
         if (k==0) {
             a1 = nodes[ ((k+1)*(ncy+1)+j)*(ncx+1)+i ].getTT(threadNo);  // first order
         } else if (k==1) {
-            T1 num = nodes[ ((k+2)*(ncy+1)+j)*(ncx+1)+i ].getTT(threadNo) -
+            TS num = nodes[ ((k+2)*(ncy+1)+j)*(ncx+1)+i ].getTT(threadNo) -
             2.*nodes[ ((k+1)*(ncy+1)+j)*(ncx+1)+i ].getTT(threadNo) +
             nodes[ (k*(ncy+1)+j)*(ncx+1)+i ].getTT(threadNo);
             num *= num;
-            T1 den = nodes[ ((k+1)*(ncy+1)+j)*(ncx+1)+i ].getTT(threadNo) -
+            TS den = nodes[ ((k+1)*(ncy+1)+j)*(ncx+1)+i ].getTT(threadNo) -
             2.*nodes[ (k*(ncy+1)+j)*(ncx+1)+i ].getTT(threadNo) +
             nodes[ ((k-1)*(ncy+1)+j)*(ncx+1)+i ].getTT(threadNo);
             den *= den;
-            T1 r = (std::numeric_limits<T1>::epsilon()+num)/(std::numeric_limits<T1>::epsilon()+den);
-            T1 w = 1./(1.+2.*r*r);
+            TS r = (std::numeric_limits<T1>::epsilon()+num)/(std::numeric_limits<T1>::epsilon()+den);
+            TS w = 1./(1.+2.*r*r);
             
-            T1 ap = (1.-w)*(nodes[ ((k+1)*(ncy+1)+j)*(ncx+1)+i ].getTT(threadNo)-
+            TS ap = (1.-w)*(nodes[ ((k+1)*(ncy+1)+j)*(ncx+1)+i ].getTT(threadNo)-
                             nodes[ ((k-1)*(ncy+1)+j)*(ncx+1)+i ].getTT(threadNo))/(2.*dx) +
             w*(-nodes[ ((k+2)*(ncy+1)+j)*(ncx+1)+i ].getTT(threadNo) +
                4.*nodes[ ((k+1)*(ncy+1)+j)*(ncx+1)+i ].getTT(threadNo) -
@@ -3166,18 +3344,18 @@ namespace ttcr {
         } else if (k==ncz) {
             a1 = nodes[ ((k-1)*(ncy+1)+j)*(ncx+1)+i ].getTT(threadNo);
         } else if (k==ncz-1) {
-            T1 num = nodes[ (k*(ncy+1)+j)*(ncx+1)+i ].getTT(threadNo) -
+            TS num = nodes[ (k*(ncy+1)+j)*(ncx+1)+i ].getTT(threadNo) -
             2.*nodes[ ((k-1)*(ncy+1)+j)*(ncx+1)+i ].getTT(threadNo) +
             nodes[ ((k-2)*(ncy+1)+j)*(ncx+1)+i ].getTT(threadNo);
             num *= num;
-            T1 den = nodes[ ((k+1)*(ncy+1)+j)*(ncx+1)+i ].getTT(threadNo) -
+            TS den = nodes[ ((k+1)*(ncy+1)+j)*(ncx+1)+i ].getTT(threadNo) -
             2.*nodes[ (k*(ncy+1)+j)*(ncx+1)+i ].getTT(threadNo) +
             nodes[ ((k-1)*(ncy+1)+j)*(ncx+1)+i ].getTT(threadNo);
             den *= den;
-            T1 r = (std::numeric_limits<T1>::epsilon()+num)/(std::numeric_limits<T1>::epsilon()+den);
-            T1 w = 1./(1.+2.*r*r);
+            TS r = (std::numeric_limits<T1>::epsilon()+num)/(std::numeric_limits<T1>::epsilon()+den);
+            TS w = 1./(1.+2.*r*r);
             
-            T1 am = (1.-w)*(nodes[ ((k+1)*(ncy+1)+j)*(ncx+1)+i ].getTT(threadNo)-
+            TS am = (1.-w)*(nodes[ ((k+1)*(ncy+1)+j)*(ncx+1)+i ].getTT(threadNo)-
                             nodes[ ((k-1)*(ncy+1)+j)*(ncx+1)+i ].getTT(threadNo))/(2.*dx) +
             w*(3.*nodes[ (k*(ncy+1)+j)*(ncx+1)+i ].getTT(threadNo) -
                4.*nodes[ ((k-1)*(ncy+1)+j)*(ncx+1)+i ].getTT(threadNo) +
@@ -3189,18 +3367,18 @@ namespace ttcr {
             a1 = a1<t ? a1 : t;
             
         } else {
-            T1 num = nodes[ ((k+2)*(ncy+1)+j)*(ncx+1)+i ].getTT(threadNo) -
+            TS num = nodes[ ((k+2)*(ncy+1)+j)*(ncx+1)+i ].getTT(threadNo) -
             2.*nodes[ ((k+1)*(ncy+1)+j)*(ncx+1)+i ].getTT(threadNo) +
             nodes[ (k*(ncy+1)+j)*(ncx+1)+i ].getTT(threadNo);
             num *= num;
-            T1 den = nodes[ ((k+1)*(ncy+1)+j)*(ncx+1)+i ].getTT(threadNo) -
+            TS den = nodes[ ((k+1)*(ncy+1)+j)*(ncx+1)+i ].getTT(threadNo) -
             2.*nodes[ (k*(ncy+1)+j)*(ncx+1)+i ].getTT(threadNo) +
             nodes[ ((k-1)*(ncy+1)+j)*(ncx+1)+i ].getTT(threadNo);
             den *= den;
-            T1 r = (std::numeric_limits<T1>::epsilon()+num)/(std::numeric_limits<T1>::epsilon()+den);
-            T1 w = 1./(1.+2.*r*r);
+            TS r = (std::numeric_limits<T1>::epsilon()+num)/(std::numeric_limits<T1>::epsilon()+den);
+            TS w = 1./(1.+2.*r*r);
             
-            T1 ap = (1.-w)*(nodes[ ((k+1)*(ncy+1)+j)*(ncx+1)+i ].getTT(threadNo)-
+            TS ap = (1.-w)*(nodes[ ((k+1)*(ncy+1)+j)*(ncx+1)+i ].getTT(threadNo)-
                             nodes[ ((k-1)*(ncy+1)+j)*(ncx+1)+i ].getTT(threadNo))/(2.*dx) +
             w*(-nodes[ ((k+2)*(ncy+1)+j)*(ncx+1)+i ].getTT(threadNo) +
                4.*nodes[ ((k+1)*(ncy+1)+j)*(ncx+1)+i ].getTT(threadNo) -
@@ -3215,7 +3393,7 @@ namespace ttcr {
             r = (std::numeric_limits<T1>::epsilon()+num)/(std::numeric_limits<T1>::epsilon()+den);
             w = 1./(1.+2.*r*r);
             
-            T1 am = (1.-w)*(nodes[ ((k+1)*(ncy+1)+j)*(ncx+1)+i ].getTT(threadNo)-
+            TS am = (1.-w)*(nodes[ ((k+1)*(ncy+1)+j)*(ncx+1)+i ].getTT(threadNo)-
                             nodes[ ((k-1)*(ncy+1)+j)*(ncx+1)+i ].getTT(threadNo))/(2.*dx) +
             w*(3.*nodes[ (k*(ncy+1)+j)*(ncx+1)+i ].getTT(threadNo) -
                4.*nodes[ ((k-1)*(ncy+1)+j)*(ncx+1)+i ].getTT(threadNo) +
@@ -3229,18 +3407,18 @@ namespace ttcr {
         if (j==0) {
             a2 = nodes[ (k*(ncy+1)+j+1)*(ncx+1)+i ].getTT(threadNo);
         } else if (j==1) {
-            T1 num = nodes[ (k*(ncy+1)+j+2)*(ncx+1)+i ].getTT(threadNo) -
+            TS num = nodes[ (k*(ncy+1)+j+2)*(ncx+1)+i ].getTT(threadNo) -
             2.*nodes[ (k*(ncy+1)+j+1)*(ncx+1)+i ].getTT(threadNo) +
             nodes[ (k*(ncy+1)+j)*(ncx+1)+i ].getTT(threadNo);
             num *= num;
-            T1 den = nodes[ (k*(ncy+1)+j+1)*(ncx+1)+i ].getTT(threadNo) -
+            TS den = nodes[ (k*(ncy+1)+j+1)*(ncx+1)+i ].getTT(threadNo) -
             2.*nodes[ (k*(ncy+1)+j)*(ncx+1)+i ].getTT(threadNo) +
             nodes[ (k*(ncy+1)+j-1)*(ncx+1)+i ].getTT(threadNo);
             den *= den;
-            T1 r = (std::numeric_limits<T1>::epsilon()+num)/(std::numeric_limits<T1>::epsilon()+den);
-            T1 w = 1./(1.+2.*r*r);
+            TS r = (std::numeric_limits<T1>::epsilon()+num)/(std::numeric_limits<T1>::epsilon()+den);
+            TS w = 1./(1.+2.*r*r);
             
-            T1 ap = (1.-w)*(nodes[ (k*(ncy+1)+j+1)*(ncx+1)+i ].getTT(threadNo)-
+            TS ap = (1.-w)*(nodes[ (k*(ncy+1)+j+1)*(ncx+1)+i ].getTT(threadNo)-
                             nodes[ (k*(ncy+1)+j-1)*(ncx+1)+i ].getTT(threadNo))/(2.*dx) +
             w*(-nodes[ (k*(ncy+1)+j+2)*(ncx+1)+i ].getTT(threadNo) +
                4.*nodes[ (k*(ncy+1)+j+1)*(ncx+1)+i ].getTT(threadNo) -
@@ -3254,18 +3432,18 @@ namespace ttcr {
         } else if (j==ncy) {
             a2 = nodes[ (k*(ncy+1)+j-1)*(ncx+1)+i ].getTT(threadNo);
         } else if (j==ncy-1) {
-            T1 num = nodes[ (k*(ncy+1)+j)*(ncx+1)+i ].getTT(threadNo) -
+            TS num = nodes[ (k*(ncy+1)+j)*(ncx+1)+i ].getTT(threadNo) -
             2.*nodes[ (k*(ncy+1)+j-1)*(ncx+1)+i ].getTT(threadNo) +
             nodes[ (k*(ncy+1)+j-2)*(ncx+1)+i ].getTT(threadNo);
             num *= num;
-            T1 den = nodes[ (k*(ncy+1)+j+1)*(ncx+1)+i ].getTT(threadNo) -
+            TS den = nodes[ (k*(ncy+1)+j+1)*(ncx+1)+i ].getTT(threadNo) -
             2.*nodes[ (k*(ncy+1)+j)*(ncx+1)+i ].getTT(threadNo) +
             nodes[ (k*(ncy+1)+j-1)*(ncx+1)+i ].getTT(threadNo);
             den *= den;
-            T1 r = (std::numeric_limits<T1>::epsilon()+num)/(std::numeric_limits<T1>::epsilon()+den);
-            T1 w = 1./(1.+2.*r*r);
+            TS r = (std::numeric_limits<T1>::epsilon()+num)/(std::numeric_limits<T1>::epsilon()+den);
+            TS w = 1./(1.+2.*r*r);
             
-            T1 am = (1.-w)*(nodes[ (k*(ncy+1)+j+1)*(ncx+1)+i ].getTT(threadNo)-
+            TS am = (1.-w)*(nodes[ (k*(ncy+1)+j+1)*(ncx+1)+i ].getTT(threadNo)-
                             nodes[ (k*(ncy+1)+j-1)*(ncx+1)+i ].getTT(threadNo))/(2.*dx) +
             w*(3.*nodes[ (k*(ncy+1)+j)*(ncx+1)+i ].getTT(threadNo) -
                4.*nodes[ (k*(ncy+1)+j-1)*(ncx+1)+i ].getTT(threadNo) +
@@ -3277,18 +3455,18 @@ namespace ttcr {
             a2 = a2<t ? a2 : t;
             
         } else {
-            T1 num = nodes[ (k*(ncy+1)+j+2)*(ncx+1)+i ].getTT(threadNo) -
+            TS num = nodes[ (k*(ncy+1)+j+2)*(ncx+1)+i ].getTT(threadNo) -
             2.*nodes[ (k*(ncy+1)+j+1)*(ncx+1)+i ].getTT(threadNo) +
             nodes[ (k*(ncy+1)+j)*(ncx+1)+i ].getTT(threadNo);
             num *= num;
-            T1 den = nodes[ (k*(ncy+1)+j+1)*(ncx+1)+i ].getTT(threadNo) -
+            TS den = nodes[ (k*(ncy+1)+j+1)*(ncx+1)+i ].getTT(threadNo) -
             2.*nodes[ (k*(ncy+1)+j)*(ncx+1)+i ].getTT(threadNo) +
             nodes[ (k*(ncy+1)+j-1)*(ncx+1)+i ].getTT(threadNo);
             den *= den;
-            T1 r = (std::numeric_limits<T1>::epsilon()+num)/(std::numeric_limits<T1>::epsilon()+den);
-            T1 w = 1./(1.+2.*r*r);
+            TS r = (std::numeric_limits<T1>::epsilon()+num)/(std::numeric_limits<T1>::epsilon()+den);
+            TS w = 1./(1.+2.*r*r);
             
-            T1 ap = (1.-w)*(nodes[ (k*(ncy+1)+j+1)*(ncx+1)+i ].getTT(threadNo)-
+            TS ap = (1.-w)*(nodes[ (k*(ncy+1)+j+1)*(ncx+1)+i ].getTT(threadNo)-
                             nodes[ (k*(ncy+1)+j-1)*(ncx+1)+i ].getTT(threadNo))/(2.*dx) +
             w*(-nodes[ (k*(ncy+1)+j+2)*(ncx+1)+i ].getTT(threadNo) +
                4.*nodes[ (k*(ncy+1)+j+1)*(ncx+1)+i ].getTT(threadNo) -
@@ -3303,7 +3481,7 @@ namespace ttcr {
             r = (std::numeric_limits<T1>::epsilon()+num)/(std::numeric_limits<T1>::epsilon()+den);
             w = 1./(1.+2.*r*r);
             
-            T1 am = (1.-w)*(nodes[ (k*(ncy+1)+j+1)*(ncx+1)+i ].getTT(threadNo)-
+            TS am = (1.-w)*(nodes[ (k*(ncy+1)+j+1)*(ncx+1)+i ].getTT(threadNo)-
                             nodes[ (k*(ncy+1)+j-1)*(ncx+1)+i ].getTT(threadNo))/(2.*dx) +
             w*(3.*nodes[ (k*(ncy+1)+j)*(ncx+1)+i ].getTT(threadNo) -
                4.*nodes[ (k*(ncy+1)+j-1)*(ncx+1)+i ].getTT(threadNo) +
@@ -3317,18 +3495,18 @@ namespace ttcr {
         if (i==0) {
             a3 = nodes[ (k*(ncy+1)+j)*(ncx+1)+i+1 ].getTT(threadNo);
         } else if (i==1) {
-            T1 num = nodes[ (k*(ncy+1)+j)*(ncx+1)+i+2 ].getTT(threadNo) -
+            TS num = nodes[ (k*(ncy+1)+j)*(ncx+1)+i+2 ].getTT(threadNo) -
             2.*nodes[ (k*(ncy+1)+j)*(ncx+1)+i+1 ].getTT(threadNo) +
             nodes[ (k*(ncy+1)+j)*(ncx+1)+i ].getTT(threadNo);
             num *= num;
-            T1 den = nodes[ (k*(ncy+1)+j)*(ncx+1)+i+1 ].getTT(threadNo) -
+            TS den = nodes[ (k*(ncy+1)+j)*(ncx+1)+i+1 ].getTT(threadNo) -
             2.*nodes[ (k*(ncy+1)+j)*(ncx+1)+i ].getTT(threadNo) +
             nodes[ (k*(ncy+1)+j)*(ncx+1)+i-1 ].getTT(threadNo);
             den *= den;
-            T1 r = (std::numeric_limits<T1>::epsilon()+num)/(std::numeric_limits<T1>::epsilon()+den);
-            T1 w = 1./(1.+2.*r*r);
+            TS r = (std::numeric_limits<T1>::epsilon()+num)/(std::numeric_limits<T1>::epsilon()+den);
+            TS w = 1./(1.+2.*r*r);
             
-            T1 ap = (1.-w)*(nodes[ (k*(ncy+1)+j)*(ncx+1)+i+1 ].getTT(threadNo)-
+            TS ap = (1.-w)*(nodes[ (k*(ncy+1)+j)*(ncx+1)+i+1 ].getTT(threadNo)-
                             nodes[ (k*(ncy+1)+j)*(ncx+1)+i-1 ].getTT(threadNo))/(2.*dx) +
             w*(-nodes[ (k*(ncy+1)+j)*(ncx+1)+i+2 ].getTT(threadNo) +
                4.*nodes[ (k*(ncy+1)+j)*(ncx+1)+i+1 ].getTT(threadNo) -
@@ -3342,18 +3520,18 @@ namespace ttcr {
         } else if (i==ncx) {
             a3 = nodes[ (k*(ncy+1)+j)*(ncx+1)+i-1 ].getTT(threadNo);
         } else if (i==ncx-1) {
-            T1 num = nodes[ (k*(ncy+1)+j)*(ncx+1)+i ].getTT(threadNo) -
+            TS num = nodes[ (k*(ncy+1)+j)*(ncx+1)+i ].getTT(threadNo) -
             2.*nodes[ (k*(ncy+1)+j)*(ncx+1)+i-1 ].getTT(threadNo) +
             nodes[ (k*(ncy+1)+j)*(ncx+1)+i-2 ].getTT(threadNo);
             num *= num;
-            T1 den = nodes[ (k*(ncy+1)+j)*(ncx+1)+i+1 ].getTT(threadNo) -
+            TS den = nodes[ (k*(ncy+1)+j)*(ncx+1)+i+1 ].getTT(threadNo) -
             2.*nodes[ (k*(ncy+1)+j)*(ncx+1)+i ].getTT(threadNo) +
             nodes[ (k*(ncy+1)+j)*(ncx+1)+i-1 ].getTT(threadNo);
             den *= den;
-            T1 r = (std::numeric_limits<T1>::epsilon()+num)/(std::numeric_limits<T1>::epsilon()+den);
-            T1 w = 1./(1.+2.*r*r);
+            TS r = (std::numeric_limits<T1>::epsilon()+num)/(std::numeric_limits<T1>::epsilon()+den);
+            TS w = 1./(1.+2.*r*r);
             
-            T1 am = (1.-w)*(nodes[ (k*(ncy+1)+j)*(ncx+1)+i+1 ].getTT(threadNo)-
+            TS am = (1.-w)*(nodes[ (k*(ncy+1)+j)*(ncx+1)+i+1 ].getTT(threadNo)-
                             nodes[ (k*(ncy+1)+j)*(ncx+1)+i-1 ].getTT(threadNo))/(2.*dx) +
             w*(3.*nodes[ (k*(ncy+1)+j)*(ncx+1)+i ].getTT(threadNo) -
                4.*nodes[ (k*(ncy+1)+j)*(ncx+1)+i-1 ].getTT(threadNo) +
@@ -3365,18 +3543,18 @@ namespace ttcr {
             a3 = a3<t ? a3 : t;
             
         } else {
-            T1 num = nodes[ (k*(ncy+1)+j)*(ncx+1)+i+2 ].getTT(threadNo) -
+            TS num = nodes[ (k*(ncy+1)+j)*(ncx+1)+i+2 ].getTT(threadNo) -
             2.*nodes[ (k*(ncy+1)+j)*(ncx+1)+i+1 ].getTT(threadNo) +
             nodes[ (k*(ncy+1)+j)*(ncx+1)+i ].getTT(threadNo);
             num *= num;
-            T1 den = nodes[ (k*(ncy+1)+j)*(ncx+1)+i+1 ].getTT(threadNo) -
+            TS den = nodes[ (k*(ncy+1)+j)*(ncx+1)+i+1 ].getTT(threadNo) -
             2.*nodes[ (k*(ncy+1)+j)*(ncx+1)+i ].getTT(threadNo) +
             nodes[ (k*(ncy+1)+j)*(ncx+1)+i-1 ].getTT(threadNo);
             den *= den;
-            T1 r = (std::numeric_limits<T1>::epsilon()+num)/(std::numeric_limits<T1>::epsilon()+den);
-            T1 w = 1./(1.+2.*r*r);
+            TS r = (std::numeric_limits<T1>::epsilon()+num)/(std::numeric_limits<T1>::epsilon()+den);
+            TS w = 1./(1.+2.*r*r);
             
-            T1 ap = (1.-w)*(nodes[ (k*(ncy+1)+j)*(ncx+1)+i+1 ].getTT(threadNo)-
+            TS ap = (1.-w)*(nodes[ (k*(ncy+1)+j)*(ncx+1)+i+1 ].getTT(threadNo)-
                             nodes[ (k*(ncy+1)+j)*(ncx+1)+i-1 ].getTT(threadNo))/(2.*dx) +
             w*(-nodes[ (k*(ncy+1)+j)*(ncx+1)+i+2 ].getTT(threadNo) +
                4.*nodes[ (k*(ncy+1)+j)*(ncx+1)+i+1 ].getTT(threadNo) -
@@ -3391,7 +3569,7 @@ namespace ttcr {
             r = (std::numeric_limits<T1>::epsilon()+num)/(std::numeric_limits<T1>::epsilon()+den);
             w = 1./(1.+2.*r*r);
             
-            T1 am = (1.-w)*(nodes[ (k*(ncy+1)+j)*(ncx+1)+i+1 ].getTT(threadNo)-
+            TS am = (1.-w)*(nodes[ (k*(ncy+1)+j)*(ncx+1)+i+1 ].getTT(threadNo)-
                             nodes[ (k*(ncy+1)+j)*(ncx+1)+i-1 ].getTT(threadNo))/(2.*dx) +
             w*(3.*nodes[ (k*(ncy+1)+j)*(ncx+1)+i ].getTT(threadNo) -
                4.*nodes[ (k*(ncy+1)+j)*(ncx+1)+i-1 ].getTT(threadNo) +
@@ -3406,7 +3584,7 @@ namespace ttcr {
         if ( a1>a3 ) std::swap(a1, a3);
         if ( a2>a3 ) std::swap(a2, a3);
         
-        T1 fh = nodes[(k*(ncy+1)+j)*(ncx+1)+i].getNodeSlowness() * dx;
+        TS fh = nodes[(k*(ncy+1)+j)*(ncx+1)+i].getNodeSlowness() * dx;
         
         t = a1 + fh;
         if ( t > a2 ) {
@@ -3422,9 +3600,13 @@ namespace ttcr {
             }
         }
         
-        if ( t<nodes[(k*(ncy+1)+j)*(ncx+1)+i].getTT(threadNo) )
+        t = static_cast<T1>(t);
+        T1 tc = nodes[(k*(ncy+1)+j)*(ncx+1)+i].getTT(threadNo);
+        if ( t<tc ) {
             nodes[(k*(ncy+1)+j)*(ncx+1)+i].setTT(t,threadNo);
-        
+            return tc-t;
+        }
+        return 0.0;
     }
     
     template<typename T1, typename T2, typename NODE>
@@ -3497,6 +3679,185 @@ namespace ttcr {
                 }
             }
         }
+        
+        if ( factored && Tx.size() == 1 ) {
+            factoredSrc[threadNo].set(Tx[0], computeSlowness(Tx[0]), t0[0]);
+        } else {
+            factoredSrc[threadNo].active = false;
+        }
+        fsmInit[threadNo].Tx = Tx;
+        fsmInit[threadNo].t0 = t0;
+        fsmInit[threadNo].frozen = frozen;
+    }
+
+    template<typename T1, typename T2, typename NODE>
+    bool Grid3Drn<T1,T2,NODE>::initWarmStart(const std::vector<sxyz<T1>>& Tx,
+                                             const std::vector<T1>& t0,
+                                             const std::vector<bool>& frozen,
+                                             std::vector<bool>& active,
+                                             bool& relax,
+                                             const size_t threadNo) const {
+        
+        // Start from the field of a previous solve, if any.  Returns true if
+        // nodes were initialized, in which case only the nodes flagged by
+        // WarmStart::seedNodes and their neighbours are active, and relax is
+        // set if relaxed updates are needed.
+        typename WarmStart<T1>::field f = warm.get(Tx, t0, threadNo);
+        if ( !f ) return false;
+        
+        std::vector<bool> changed;
+        relax = warm.seedNodes(*f, nodes, frozen, changed, threadNo);
+        active.assign( nodes.size(), false );
+        for ( size_t k=0, n=0; k<=ncz; ++k ) {
+            for ( size_t j=0; j<=ncy; ++j ) {
+                for ( size_t i=0; i<=ncx; ++i, ++n ) {
+                    if ( !changed[n] ) continue;
+                    active[n] = true;
+                    if ( i>0 ) active[n-1] = true;
+                    if ( i<ncx ) active[n+1] = true;
+                    if ( j>0 ) active[n-(ncx+1)] = true;
+                    if ( j<ncy ) active[n+(ncx+1)] = true;
+                    if ( k>0 ) active[n-(ncy+1)*(ncx+1)] = true;
+                    if ( k<ncz ) active[n+(ncy+1)*(ncx+1)] = true;
+                }
+            }
+        }
+        return true;
+    }
+    
+    template<typename T1, typename T2, typename NODE>
+    T1 Grid3Drn<T1,T2,NODE>::update_node_fmm(const size_t i, const size_t j,
+                                             const size_t k,
+                                             const std::vector<bool>& frozen,
+                                             const bool secondOrder,
+                                             const size_t threadNo) const {
+        typedef typename solver_type<T1>::type TS;
+        
+        // Upwind solution of the eikonal equation at node (i,j,k), using
+        // frozen neighbours only.  Along each axis, the term of the discrete
+        // equation is a*(t-b)^2, with a = 1/h^2 and b = t1 for the first
+        // order stencil, and a = 9/(4h^2) and b = (4t1-t2)/3 for the second
+        // order stencil, t1 and t2 being the upwind values at h and 2h.
+        const long long ijk[3] = { static_cast<long long>(i),
+            static_cast<long long>(j), static_cast<long long>(k) };
+        const long long nn[3] = { static_cast<long long>(ncx+1),
+            static_cast<long long>(ncy+1), static_cast<long long>(ncz+1) };
+        const long long stride[3] = { 1, nn[0], nn[0]*nn[1] };
+        const TS h[3] = { dx, dy, dz };
+        const long long n = (ijk[2]*nn[1]+ijk[1])*nn[0]+ijk[0];
+        
+        if ( factoredSrc[threadNo].active && !secondOrder ) {
+            TS tf = update_node_factored(i, j, k, &frozen, threadNo);
+            if ( tf < std::numeric_limits<T1>::max() ) return tf;
+        }
+        
+        TS a[3], b[3];
+        size_t nd = 0;
+        for ( size_t d=0; d<3; ++d ) {
+            TS t1 = std::numeric_limits<T1>::max();
+            TS t2 = std::numeric_limits<T1>::max();
+            for ( long long s=-1; s<=1; s+=2 ) {
+                if ( ijk[d]+s < 0 || ijk[d]+s >= nn[d] ) continue;
+                long long n1 = n + s*stride[d];
+                if ( !frozen[n1] || nodes[n1].getTT(threadNo) >= t1 ) continue;
+                t1 = nodes[n1].getTT(threadNo);
+                t2 = std::numeric_limits<T1>::max();
+                if ( secondOrder && ijk[d]+2*s >= 0 && ijk[d]+2*s < nn[d] ) {
+                    long long n2 = n1 + s*stride[d];
+                    if ( frozen[n2] && nodes[n2].getTT(threadNo) <= t1 ) {
+                        t2 = nodes[n2].getTT(threadNo);
+                    }
+                }
+            }
+            if ( t1 == std::numeric_limits<T1>::max() ) continue;
+            if ( t2 < std::numeric_limits<T1>::max() ) {
+                a[nd] = 9./(4.*h[d]*h[d]);
+                b[nd] = (4.*t1 - t2)/3.;
+            } else {
+                a[nd] = 1./(h[d]*h[d]);
+                b[nd] = t1;
+            }
+            ++nd;
+        }
+        if ( nd == 0 ) return std::numeric_limits<T1>::max();
+        
+        // sort terms by increasing b
+        for ( size_t m=1; m<nd; ++m ) {
+            for ( size_t l=m; l>0 && b[l]<b[l-1]; --l ) {
+                std::swap(a[l], a[l-1]);
+                std::swap(b[l], b[l-1]);
+            }
+        }
+        
+        // add terms as long as the solution is larger than their b
+        TS s2 = nodes[n].getNodeSlowness() * nodes[n].getNodeSlowness();
+        TS A = 0.0, B = 0.0, C = 0.0;
+        TS t = std::numeric_limits<T1>::max();
+        for ( size_t m=0; m<nd; ++m ) {
+            A += a[m];
+            B += a[m]*b[m];
+            C += a[m]*b[m]*b[m];
+            TS disc = B*B - A*(C-s2);
+            if ( disc < 0.0 ) break;
+            t = (B + std::sqrt(disc))/A;
+            if ( m+1 == nd || t <= b[m+1] ) break;
+        }
+        return t;
+    }
+    
+    template<typename T1, typename T2, typename NODE>
+    void Grid3Drn<T1,T2,NODE>::propagateFMM(std::vector<bool>& frozen,
+                                            const bool secondOrder,
+                                            const size_t threadNo) const {
+        
+        // Fast marching from the frozen nodes.  The narrow band holds
+        // (traveltime, node) pairs; a node whose traveltime decreases is
+        // pushed again, and outdated entries are skipped when popped.
+        std::priority_queue<std::pair<T1,T2>, std::vector<std::pair<T1,T2>>,
+        std::greater<std::pair<T1,T2>>> narrow_band;
+        
+        const size_t nnx = ncx+1;
+        const size_t nnxy = (ncx+1)*(ncy+1);
+        
+        auto update = [&](const size_t i, const size_t j, const size_t k) {
+            const size_t n = (k*(ncy+1)+j)*nnx+i;
+            if ( frozen[n] ) return;
+            T1 t = update_node_fmm(i, j, k, frozen, secondOrder, threadNo);
+            if ( t < nodes[n].getTT(threadNo) ) {
+                nodes[n].setTT(t, threadNo);
+                narrow_band.push( std::make_pair(t, static_cast<T2>(n)) );
+            }
+        };
+        auto updateNeighbours = [&](const size_t i, const size_t j, const size_t k) {
+            if ( i>0 ) update(i-1, j, k);
+            if ( i<ncx ) update(i+1, j, k);
+            if ( j>0 ) update(i, j-1, k);
+            if ( j<ncy ) update(i, j+1, k);
+            if ( k>0 ) update(i, j, k-1);
+            if ( k<ncz ) update(i, j, k+1);
+        };
+        
+        // initial narrow band: neighbours of the frozen nodes
+        for ( size_t k=0, n=0; k<=ncz; ++k ) {
+            for ( size_t j=0; j<=ncy; ++j ) {
+                for ( size_t i=0; i<=ncx; ++i, ++n ) {
+                    if ( frozen[n] ) updateNeighbours(i, j, k);
+                }
+            }
+        }
+        
+        while ( !narrow_band.empty() ) {
+            std::pair<T1,T2> top = narrow_band.top();
+            narrow_band.pop();
+            const size_t n = top.second;
+            if ( frozen[n] || top.first > nodes[n].getTT(threadNo) ) continue;
+            frozen[n] = true;
+            
+            const size_t k = n/nnxy;
+            const size_t j = (n-k*nnxy)/nnx;
+            const size_t i = n - k*nnxy - j*nnx;
+            updateNeighbours(i, j, k);
+        }
     }
 
 #ifdef VTK
@@ -3508,13 +3869,13 @@ namespace ttcr {
 
         vtkSmartPointer<vtkDoubleArray> xCoords = vtkSmartPointer<vtkDoubleArray>::New();
         for (size_t n=0; n<nn[0]; ++n)
-            xCoords->InsertNextValue( xmin + n*dx );
+            xCoords->InsertNextValue( xmin + this->origin.x + n*dx );
         vtkSmartPointer<vtkDoubleArray> yCoords = vtkSmartPointer<vtkDoubleArray>::New();
         for (size_t n=0; n<nn[1]; ++n)
-            yCoords->InsertNextValue( ymin + n*dy );
+            yCoords->InsertNextValue( ymin + this->origin.y + n*dy );
         vtkSmartPointer<vtkDoubleArray> zCoords = vtkSmartPointer<vtkDoubleArray>::New();
         for (size_t n=0; n<nn[2]; ++n)
-            zCoords->InsertNextValue( zmin + n*dz );
+            zCoords->InsertNextValue( zmin + this->origin.z + n*dz );
 
         vtkSmartPointer<vtkRectilinearGrid> rgrid = vtkSmartPointer<vtkRectilinearGrid>::New();
         rgrid->SetDimensions( nn );
@@ -3557,7 +3918,121 @@ namespace ttcr {
     }
 #endif
 
-
+    template<typename T1, typename T2, typename NODE>
+    void Grid3Drn<T1,T2,NODE>::getMisfitGradientLocal(const std::vector<sxyz<T1>>& Rx,
+                                                      const std::vector<T1>& r,
+                                                      std::vector<T1>& grad,
+                                                      const size_t threadNo) const {
+        
+        // Adjoint of the first order upwind (Godunov) update, linearized about
+        // the computed traveltimes.  At node n with upwind neighbours n_d,
+        //   T_n = sum_d a_d/A T_{n_d} + s_n^2/A,  a_d = (T_n-T_{n_d})/h_d^2,
+        // with A = sum_d a_d, so that dT_n/dT_{n_d} = a_d/A and
+        // dT_n/ds_n = s_n/A.  The adjoint variables are propagated from the
+        // receivers toward the source, visiting nodes by decreasing
+        // traveltime.  Nodes set by initFSM have T_n = t0 + s_n*d, d being
+        // the distance to the source.  The same linearization is used for
+        // fields computed with the WENO or second order stencils, in which
+        // case the gradient is approximate.
+        if ( fsmInit[threadNo].frozen.empty() ) {
+            throw std::runtime_error("Error: adjoint-state gradient needs a traveltime field computed with FSM or FMM.");
+        }
+        if ( r.size() != Rx.size() ) {
+            throw std::length_error("Error: residuals and Rx should have the same size.");
+        }
+        this->checkPts(Rx);
+        
+        const size_t nnx = ncx+1;
+        const size_t nnxy = (ncx+1)*(ncy+1);
+        const size_t nPrimary = nnxy*(ncz+1);
+        const T1 h[3] = { dx, dy, dz };
+        const size_t stride[3] = { 1, nnx, nnxy };
+        
+        std::vector<T1> lambda(nPrimary, 0.0);
+        
+        // receivers: traveltimes are interpolated trilinearly
+        for ( size_t nr=0; nr<Rx.size(); ++nr ) {
+            T2 i, j, k;
+            getIJK(Rx[nr], i, j, k);
+            i = i<ncx ? i : ncx-1;
+            j = j<ncy ? j : ncy-1;
+            k = k<ncz ? k : ncz-1;
+            T1 wx = (Rx[nr].x - (xmin+i*dx))/dx;
+            T1 wy = (Rx[nr].y - (ymin+j*dy))/dy;
+            T1 wz = (Rx[nr].z - (zmin+k*dz))/dz;
+            for ( size_t kk=0; kk<2; ++kk ) {
+                for ( size_t jj=0; jj<2; ++jj ) {
+                    for ( size_t ii=0; ii<2; ++ii ) {
+                        T1 w = (ii ? wx : 1.-wx) * (jj ? wy : 1.-wy) * (kk ? wz : 1.-wz);
+                        lambda[((k+kk)*(ncy+1)+j+jj)*nnx+i+ii] += w * r[nr];
+                    }
+                }
+            }
+        }
+        
+        std::vector<T2> order(nPrimary);
+        for ( size_t n=0; n<nPrimary; ++n ) order[n] = static_cast<T2>(n);
+        std::sort(order.begin(), order.end(), [this,threadNo](const T2 a, const T2 b) {
+            return nodes[a].getTT(threadNo) > nodes[b].getTT(threadNo);
+        });
+        
+        grad.assign(nPrimary, 0.0);
+        for ( size_t no=0; no<nPrimary; ++no ) {
+            const size_t n = order[no];
+            const T1 tn = nodes[n].getTT(threadNo);
+            if ( lambda[n] == 0.0 || tn == std::numeric_limits<T1>::max() ) continue;
+            
+            const FSMinit& init = fsmInit[threadNo];
+            if ( init.frozen[n] ) {
+                // source closest in time
+                T1 d = 0.0;
+                T1 dt = std::numeric_limits<T1>::max();
+                for ( size_t ns=0; ns<init.Tx.size(); ++ns ) {
+                    T1 dd = nodes[n].getDistance(init.Tx[ns]);
+                    T1 e = std::abs(init.t0[ns] + nodes[n].getNodeSlowness()*dd - tn);
+                    if ( e < dt ) {
+                        dt = e;
+                        d = dd;
+                    }
+                }
+                grad[n] = lambda[n] * d;
+                continue;
+            }
+            
+            const size_t k = n/nnxy;
+            const size_t j = (n-k*nnxy)/nnx;
+            const size_t i = n - k*nnxy - j*nnx;
+            const size_t ijk[3] = { i, j, k };
+            const size_t nc[3] = { ncx, ncy, ncz };
+            
+            size_t nd[3];
+            T1 a[3];
+            T1 A = 0.0;
+            for ( size_t d=0; d<3; ++d ) {
+                a[d] = 0.0;
+                T1 t = tn;
+                if ( ijk[d] > 0 && nodes[n-stride[d]].getTT(threadNo) < t ) {
+                    nd[d] = n-stride[d];
+                    t = nodes[nd[d]].getTT(threadNo);
+                }
+                if ( ijk[d] < nc[d] && nodes[n+stride[d]].getTT(threadNo) < t ) {
+                    nd[d] = n+stride[d];
+                    t = nodes[nd[d]].getTT(threadNo);
+                }
+                if ( t < tn ) {
+                    a[d] = (tn - t)/(h[d]*h[d]);
+                    A += a[d];
+                }
+            }
+            if ( A == 0.0 ) continue;  // source
+            
+            grad[n] = lambda[n] * nodes[n].getNodeSlowness() / A;
+            for ( size_t d=0; d<3; ++d ) {
+                if ( a[d] > 0.0 ) lambda[nd[d]] += lambda[n] * a[d] / A;
+            }
+        }
+    }
+    
 }
 
 #endif
@@ -9,9 +9,15 @@
 #ifndef Grid3Drndsp_h
 #define Grid3Drndsp_h
 
+#include <algorithm>
+#include <array>
+#include <map>
+
 #include "Grid3Drn.h"
+#include "Interpolator.h"
 #include "Node3Dn.h"
 #include "Node3Dnd.h"
+#include "TempNodesCache.h"
 
 namespace ttcr {
 
@@ -27,7 +33,8 @@ namespace ttcr {
         nSecondary(ns), nTertiary(nd), nPermanent(0),
         dynRadius(drad),
         tempNodes(std::vector<std::vector<Node3Dnd<T1,T2>>>(nt)),
-        tempNeighbors(std::vector<std::vector<std::vector<T2>>>(nt))
+        tempNeighbors(std::vector<std::vector<std::vector<T2>>>(nt)),
+        tempCache(std::vector<TempNodesCache<T1,T2,Node3Dnd<T1,T2>>>(nt))
         {
             buildGridNodes();
             this->template buildGridNeighbors<Node3Dn<T1,T2>>(this->nodes);
@@ -42,6 +49,15 @@ namespace ttcr {
         
         void setSlowness(const std::vector<T1>& s);
         
+        void setTempNodesCache(const size_t nTx) {
+            for ( size_t n=0; n<tempCache.size(); ++n )
+                tempCache[n].setCapacity( nTx );
+        }
+        
+    protected:
+        // the field depends on temporary nodes, which are not cached
+        bool getTTState(std::vector<T1>&, const size_t) const { return false; }
+        
     private:
         T2 nSecondary;                 // number of permanent secondary
         T2 nTertiary;                   // number of temporary secondary
@@ -53,11 +69,17 @@ namespace ttcr {
         // nodes vary from one Tx to the other)
         mutable std::vector<std::vector<Node3Dnd<T1,T2>>> tempNodes;
         mutable std::vector<std::vector<std::vector<T2>>> tempNeighbors;
+        
+        // temporary nodes are reused as long as Tx does not move and slowness
+        // is not set
+        mutable std::vector<TempNodesCache<T1,T2,Node3Dnd<T1,T2>>> tempCache;
 
         void buildGridNodes();
         void linearInterpolation() const;
 
         void addTemporaryNodes(const std::vector<sxyz<T1>>&, const size_t) const;
+        void buildTemporaryNodes(const std::vector<sxyz<T1>>&, const size_t) const;
+        void interpTemporaryNodes(const size_t) const;
 
         void initQueue(const std::vector<sxyz<T1>>& Tx,
                        const std::vector<T1>& t0,
@@ -76,15 +98,15 @@ namespace ttcr {
                        std::vector<bool>& frozen,
                        const size_t threadNo) const;
         
-        void raytrace(const std::vector<sxyz<T1>>& Tx,
-                      const std::vector<T1>& t0,
-                      const std::vector<sxyz<T1>>& Rx,
-                      const size_t threadNo) const;
+        void raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                           const std::vector<T1>& t0,
+                           const std::vector<sxyz<T1>>& Rx,
+                           const size_t threadNo) const;
         
-        void raytrace(const std::vector<sxyz<T1>>& Tx,
-                      const std::vector<T1>& t0,
-                      const std::vector<const std::vector<sxyz<T1>>*>& Rx,
-                      const size_t threadNo) const;
+        void raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                           const std::vector<T1>& t0,
+                           const std::vector<const std::vector<sxyz<T1>>*>& Rx,
+                           const size_t threadNo) const;
     };
 
     template<typename T1, typename T2>
@@ -664,20 +686,62 @@ namespace ttcr {
             }
         }
         this->interpSecondary();
+        this->slownessChanged();
     }
 
     template<typename T1, typename T2>
     void Grid3Drndsp<T1,T2>::addTemporaryNodes(const std::vector<sxyz<T1>>& Tx,
                                                const size_t threadNo) const {
 
-        // clear previously assigned nodes
-        tempNodes[threadNo].clear();
-        for ( size_t nt=0; nt<tempNeighbors[threadNo].size(); ++nt ) {
-            tempNeighbors[threadNo][nt].clear();
+        // clear neighbors of previously assigned nodes
+        for ( size_t n=0; n<tempNodes[threadNo].size(); ++n ) {
+            for ( size_t n2=0; n2<tempNodes[threadNo][n].getOwners().size(); ++n2 ) {
+                tempNeighbors[threadNo][ tempNodes[threadNo][n].getOwners()[n2] ].clear();
+            }
+        }
+
+        if ( tempCache[threadNo].fetch(Tx, tempNodes[threadNo]) ) {
+            // same layout as for a previous call
+            for ( size_t n=0; n<tempNodes[threadNo].size(); ++n ) {
+                tempNodes[threadNo][n].reinit( 0 );
+            }
+            if ( tempCache[threadNo].version != this->slownessVersion ) {
+                interpTemporaryNodes(threadNo);
+            }
+        } else {
+            buildTemporaryNodes(Tx, threadNo);
+            interpTemporaryNodes(threadNo);
+            tempCache[threadNo].set(Tx, this->slownessVersion);
+        }
+
+        for ( T2 n=0; n<tempNodes[threadNo].size(); ++n ) {
+            for ( size_t n2=0; n2<tempNodes[threadNo][n].getOwners().size(); ++n2) {
+                tempNeighbors[threadNo][ tempNodes[threadNo][n].getOwners()[n2] ].push_back(n);
+            }
+        }
+        if ( verbose )
+            std::cout << "  *** thread no " << threadNo << ": " << tempNodes[threadNo].size() << " dynamic nodes were added ***" << std::endl;
+    }
+
+    template<typename T1, typename T2>
+    void Grid3Drndsp<T1,T2>::interpTemporaryNodes(const size_t threadNo) const {
+        for ( size_t n=0; n<tempNodes[threadNo].size(); ++n ) {
+            T1 s = 0.0;
+            for ( size_t i=0; i<4; ++i ) {
+                s += tempCache[threadNo].weights[n][i] *
+                this->nodes[ tempCache[threadNo].parents[n][i] ].getNodeSlowness();
+            }
+            tempNodes[threadNo][n].setNodeSlowness( s );
         }
+        tempCache[threadNo].version = this->slownessVersion;
+    }
+
+    template<typename T1, typename T2>
+    void Grid3Drndsp<T1,T2>::buildTemporaryNodes(const std::vector<sxyz<T1>>& Tx,
+                                                 const size_t threadNo) const {
 
         // find cells surrounding Tx
-        std::set<T2> txCells;
+        std::vector<T2> txCells;
         for (size_t n=0; n<Tx.size(); ++n) {
             long long i, j, k;
             this->getIJK(Tx[n], i, j, k);
@@ -706,16 +770,18 @@ namespace ttcr {
                 for ( p.y=ystart+this->dy/2.; p.y<ystop; p.y+=this->dy ) {
                     for ( p.z=zstart+this->dz/2.; p.z<zstop; p.z+=this->dz ) {
                         if ( Tx[n].getDistance(p) < dynRadius ) {
-                            txCells.insert( this->getCellNo(p) );
+                            txCells.push_back( this->getCellNo(p) );
                         }
                     }
                 }
             }
         }
+        std::sort(txCells.begin(), txCells.end());
+        txCells.erase( std::unique(txCells.begin(), txCells.end()), txCells.end() );
         if ( verbose )
             std::cout << "\n  *** thread no " << threadNo << ": found " << txCells.size() << " cells within radius ***" << std::endl;
 
-        std::set<T2> adjacentCells(txCells.begin(), txCells.end());
+        std::vector<T2> adjacentCells;
 
         T2 nTemp = nTertiary * (nSecondary+1);
 
@@ -730,7 +796,7 @@ namespace ttcr {
         T2 nnx = this->ncx+1;
         T2 nny = this->ncy+1;
 
-        T1 slope, islown;
+        T1 w;
         
         // edge nodes
         T2 nTmpNodes = 0;
@@ -741,44 +807,44 @@ namespace ttcr {
             this->getCellIJK(*cell, ind);
 
             if ( ind.i > 0 )
-                adjacentCells.insert( (ind.k * this->ncy + ind.j) * this->ncx + ind.i-1);
+                adjacentCells.push_back( (ind.k * this->ncy + ind.j) * this->ncx + ind.i-1);
             if ( ind.i < this->ncx-1 )
-                adjacentCells.insert( (ind.k * this->ncy + ind.j) * this->ncx + ind.i+1);
+                adjacentCells.push_back( (ind.k * this->ncy + ind.j) * this->ncx + ind.i+1);
             if ( ind.j > 0 )
-                adjacentCells.insert( (ind.k * this->ncy + ind.j-1) * this->ncx + ind.i);
+                adjacentCells.push_back( (ind.k * this->ncy + ind.j-1) * this->ncx + ind.i);
             if ( ind.j < this->ncy-1 )
-                adjacentCells.insert( (ind.k * this->ncy + ind.j+1) * this->ncx + ind.i);
+                adjacentCells.push_back( (ind.k * this->ncy + ind.j+1) * this->ncx + ind.i);
             if ( ind.k > 0 )
-                adjacentCells.insert( ((ind.k-1) * this->ncy + ind.j) * this->ncx + ind.i);
+                adjacentCells.push_back( ((ind.k-1) * this->ncy + ind.j) * this->ncx + ind.i);
             if ( ind.k < this->ncz-1 )
-                adjacentCells.insert( ((ind.k+1) * this->ncy + ind.j) * this->ncx + ind.i);
+                adjacentCells.push_back( ((ind.k+1) * this->ncy + ind.j) * this->ncx + ind.i);
 
             if ( ind.i > 0 && ind.j > 0 )
-                adjacentCells.insert( (ind.k * this->ncy + ind.j-1) * this->ncx + ind.i-1);
+                adjacentCells.push_back( (ind.k * this->ncy + ind.j-1) * this->ncx + ind.i-1);
             if ( ind.i < this->ncx-1 && ind.j > 0 )
-                adjacentCells.insert( (ind.k * this->ncy + ind.j-1) * this->ncx + ind.i+1);
+                adjacentCells.push_back( (ind.k * this->ncy + ind.j-1) * this->ncx + ind.i+1);
             if ( ind.i > 0 && ind.j < this->ncy-1 )
-                adjacentCells.insert( (ind.k * this->ncy + ind.j+1) * this->ncx + ind.i-1);
+                adjacentCells.push_back( (ind.k * this->ncy + ind.j+1) * this->ncx + ind.i-1);
             if ( ind.i < this->ncx-1 && ind.j < this->ncy-1 )
-                adjacentCells.insert( (ind.k * this->ncy + ind.j+1) * this->ncx + ind.i+1);
+                adjacentCells.push_back( (ind.k * this->ncy + ind.j+1) * this->ncx + ind.i+1);
 
             if ( ind.i > 0 && ind.k > 0 )
-                adjacentCells.insert( ((ind.k-1) * this->ncy + ind.j) * this->ncx + ind.i-1);
+                adjacentCells.push_back( ((ind.k-1) * this->ncy + ind.j) * this->ncx + ind.i-1);
             if ( ind.i < this->ncx-1 && ind.k > 0 )
-                adjacentCells.insert( ((ind.k-1) * this->ncy + ind.j) * this->ncx + ind.i+1);
+                adjacentCells.push_back( ((ind.k-1) * this->ncy + ind.j) * this->ncx + ind.i+1);
             if ( ind.i > 0 && ind.k < this->ncz-1 )
-                adjacentCells.insert( ((ind.k+1) * this->ncy + ind.j) * this->ncx + ind.i-1);
+                adjacentCells.push_back( ((ind.k+1) * this->ncy + ind.j) * this->ncx + ind.i-1);
             if ( ind.i < this->ncx-1 && ind.k < this->ncz-1 )
-                adjacentCells.insert( ((ind.k+1) * this->ncy + ind.j) * this->ncx + ind.i+1);
+                adjacentCells.push_back( ((ind.k+1) * this->ncy + ind.j) * this->ncx + ind.i+1);
 
             if ( ind.j > 0 && ind.k > 0 )
-                adjacentCells.insert( ((ind.k-1) * this->ncy + ind.j-1) * this->ncx + ind.i);
+                adjacentCells.push_back( ((ind.k-1) * this->ncy + ind.j-1) * this->ncx + ind.i);
             if ( ind.j < this->ncy-1 && ind.k > 0 )
-                adjacentCells.insert( ((ind.k-1) * this->ncy + ind.j+1) * this->ncx + ind.i);
+                adjacentCells.push_back( ((ind.k-1) * this->ncy + ind.j+1) * this->ncx + ind.i);
             if ( ind.j > 0 && ind.k < this->ncz-1 )
-                adjacentCells.insert( ((ind.k+1) * this->ncy + ind.j-1) * this->ncx + ind.i);
+                adjacentCells.push_back( ((ind.k+1) * this->ncy + ind.j-1) * this->ncx + ind.i);
             if ( ind.j < this->ncy-1 && ind.k < this->ncz-1 )
-                adjacentCells.insert( ((ind.k+1) * this->ncy + ind.j+1) * this->ncx + ind.i);
+                adjacentCells.push_back( ((ind.k+1) * this->ncy + ind.j+1) * this->ncx + ind.i);
 
             T1 x0 = this->xmin + ind.i*this->dx;
             T1 y0 = this->ymin + ind.j*this->dy;
@@ -799,8 +865,6 @@ namespace ttcr {
                         // not found, insert new pair
                         lineMap[ lineKey ] = std::vector<T2>(nTemp);
 
-                        slope = (this->nodes[lineKey[1]].getNodeSlowness() - this->nodes[lineKey[0]].getNodeSlowness())/this->dx;
-                        
                         size_t nd = 0;
                         for ( size_t n2=0; n2<nSecondary+1; ++n2 ) {
                             for ( size_t n3=0; n3<nTertiary; ++n3 ) {
@@ -808,8 +872,9 @@ namespace ttcr {
                                                     y0 + j*this->dy,
                                                     z0 + k*this->dz,
                                                     nPermanent+nTmpNodes );
-                                islown = this->nodes[lineKey[0]].getNodeSlowness() + slope * tmpNode.getDistance(this->nodes[lineKey[0]]);
-                                tmpNode.setNodeSlowness( islown );
+                                w = tmpNode.getDistance(this->nodes[lineKey[0]])/this->dx;
+                                tempCache[threadNo].parents.push_back( {{lineKey[0], lineKey[1], lineKey[0], lineKey[0]}} );
+                                tempCache[threadNo].weights.push_back( {{static_cast<T1>(1.0-w), static_cast<T1>(w), T1(0), T1(0)}} );
 
                                 lineMap[lineKey][nd++] = nTmpNodes++;
                                 tempNodes[threadNo].push_back( tmpNode );
@@ -840,8 +905,6 @@ namespace ttcr {
                         // not found, insert new pair
                         lineMap[ lineKey ] = std::vector<T2>(nTemp);
                         
-                        slope = (this->nodes[lineKey[1]].getNodeSlowness() - this->nodes[lineKey[0]].getNodeSlowness())/this->dy;
-
                         size_t nd = 0;
                         for ( size_t n2=0; n2<nSecondary+1; ++n2 ) {
                             for ( size_t n3=0; n3<nTertiary; ++n3 ) {
@@ -849,8 +912,9 @@ namespace ttcr {
                                                     y0 + (1+n2*(nTertiary+1)+n3)*dyDyn,
                                                     z0 + k*this->dz,
                                                     nPermanent+nTmpNodes );
-                                islown = this->nodes[lineKey[0]].getNodeSlowness() + slope * tmpNode.getDistance(this->nodes[lineKey[0]]);
-                                tmpNode.setNodeSlowness( islown );
+                                w = tmpNode.getDistance(this->nodes[lineKey[0]])/this->dy;
+                                tempCache[threadNo].parents.push_back( {{lineKey[0], lineKey[1], lineKey[0], lineKey[0]}} );
+                                tempCache[threadNo].weights.push_back( {{static_cast<T1>(1.0-w), static_cast<T1>(w), T1(0), T1(0)}} );
 
                                 lineMap[lineKey][nd++] = nTmpNodes++;
                                 tempNodes[threadNo].push_back( tmpNode );
@@ -881,8 +945,6 @@ namespace ttcr {
                         // not found, insert new pair
                         lineMap[ lineKey ] = std::vector<T2>(nTemp);
                         
-                        slope = (this->nodes[lineKey[1]].getNodeSlowness() - this->nodes[lineKey[0]].getNodeSlowness())/this->dz;
-
                         size_t nd = 0;
                         for ( size_t n2=0; n2<nSecondary+1; ++n2 ) {
                             for ( size_t n3=0; n3<nTertiary; ++n3 ) {
@@ -890,8 +952,9 @@ namespace ttcr {
                                                     y0 + j*this->dy,
                                                     z0 + (1+n2*(nTertiary+1)+n3)*dzDyn,
                                                     nPermanent+nTmpNodes );
-                                islown = this->nodes[lineKey[0]].getNodeSlowness() + slope * tmpNode.getDistance(this->nodes[lineKey[0]]);
-                                tmpNode.setNodeSlowness( islown );
+                                w = tmpNode.getDistance(this->nodes[lineKey[0]])/this->dz;
+                                tempCache[threadNo].parents.push_back( {{lineKey[0], lineKey[1], lineKey[0], lineKey[0]}} );
+                                tempCache[threadNo].weights.push_back( {{static_cast<T1>(1.0-w), static_cast<T1>(w), T1(0), T1(0)}} );
                                 
                                 lineMap[lineKey][nd++] = nTmpNodes++;
                                 tempNodes[threadNo].push_back( tmpNode );
@@ -940,15 +1003,15 @@ namespace ttcr {
                 
                 T1 x[3];
                 T1 y[3];
-                T1 s[4];
+                std::array<T1,4> wf;
                 x[1] = this->nodes[((ind.k+k)*nny + ind.j  ) * nnx + ind.i  ].getX();
                 y[1] = this->nodes[((ind.k+k)*nny + ind.j  ) * nnx + ind.i  ].getY();
                 x[2] = this->nodes[((ind.k+k)*nny + ind.j+1) * nnx + ind.i+1].getX();
                 y[2] = this->nodes[((ind.k+k)*nny + ind.j+1) * nnx + ind.i+1].getY();
-                s[0] = this->nodes[((ind.k+k)*nny + ind.j  ) * nnx + ind.i  ].getNodeSlowness();
-                s[1] = this->nodes[((ind.k+k)*nny + ind.j+1) * nnx + ind.i  ].getNodeSlowness();
-                s[2] = this->nodes[((ind.k+k)*nny + ind.j  ) * nnx + ind.i+1].getNodeSlowness();
-                s[3] = this->nodes[((ind.k+k)*nny + ind.j+1) * nnx + ind.i+1].getNodeSlowness();
+                std::array<T2,4> corners = {{ ((ind.k+k)*nny + ind.j  ) * nnx + ind.i  ,
+                    ((ind.k+k)*nny + ind.j+1) * nnx + ind.i  ,
+                    ((ind.k+k)*nny + ind.j  ) * nnx + ind.i+1,
+                    ((ind.k+k)*nny + ind.j+1) * nnx + ind.i+1 }};
 
                 T1 x0 = this->xmin + ind.i*this->dx;
                 T1 y0 = this->ymin + ind.j*this->dy;
@@ -966,8 +1029,9 @@ namespace ttcr {
                                                 nPermanent+nTmpNodes );
                             x[0] = tmpNode.getX();
                             y[0] = tmpNode.getY();
-                            islown = Interpolator<T1>::bilinear(x, y, s);
-                            tmpNode.setNodeSlowness(islown);
+                            Interpolator<T1>::bilinearWeight(x, y, wf);
+                            tempCache[threadNo].parents.push_back( corners );
+                            tempCache[threadNo].weights.push_back( wf );
 
                             faceMap[faceKey][ifn++] = nTmpNodes++;
                             tempNodes[threadNo].push_back( tmpNode );
@@ -987,8 +1051,9 @@ namespace ttcr {
                                                 nPermanent+nTmpNodes );
                             x[0] = tmpNode.getX();
                             y[0] = tmpNode.getY();
-                            islown = Interpolator<T1>::bilinear(x, y, s);
-                            tmpNode.setNodeSlowness(islown);
+                            Interpolator<T1>::bilinearWeight(x, y, wf);
+                            tempCache[threadNo].parents.push_back( corners );
+                            tempCache[threadNo].weights.push_back( wf );
 
                             faceMap[faceKey][ifn++] = nTmpNodes++;
                             tempNodes[threadNo].push_back( tmpNode );
@@ -1023,15 +1088,15 @@ namespace ttcr {
                 
                 T1 x[3];
                 T1 y[3];
-                T1 s[4];
+                std::array<T1,4> wf;
                 x[1] = this->nodes[((ind.k  )*nny + ind.j+j) * nnx + ind.i  ].getX();
                 y[1] = this->nodes[((ind.k  )*nny + ind.j+j) * nnx + ind.i  ].getZ();
                 x[2] = this->nodes[((ind.k+1)*nny + ind.j+j) * nnx + ind.i+1].getX();
                 y[2] = this->nodes[((ind.k+1)*nny + ind.j+j) * nnx + ind.i+1].getZ();
-                s[0] = this->nodes[((ind.k  )*nny + ind.j+j) * nnx + ind.i  ].getNodeSlowness();
-                s[1] = this->nodes[((ind.k+1)*nny + ind.j+j) * nnx + ind.i  ].getNodeSlowness();
-                s[2] = this->nodes[((ind.k  )*nny + ind.j+j) * nnx + ind.i+1].getNodeSlowness();
-                s[3] = this->nodes[((ind.k+1)*nny + ind.j+j) * nnx + ind.i+1].getNodeSlowness();
+                std::array<T2,4> corners = {{ ((ind.k  )*nny + ind.j+j) * nnx + ind.i  ,
+                    ((ind.k+1)*nny + ind.j+j) * nnx + ind.i  ,
+                    ((ind.k  )*nny + ind.j+j) * nnx + ind.i+1,
+                    ((ind.k+1)*nny + ind.j+j) * nnx + ind.i+1 }};
 
                 T1 x0 = this->xmin + ind.i*this->dx;
                 T1 y0 = this->ymin + ind.j+j*this->dy;
@@ -1049,8 +1114,9 @@ namespace ttcr {
                                                 nPermanent+nTmpNodes );
                             x[0] = tmpNode.getX();
                             y[0] = tmpNode.getZ();
-                            islown = Interpolator<T1>::bilinear(x, y, s);
-                            tmpNode.setNodeSlowness(islown);
+                            Interpolator<T1>::bilinearWeight(x, y, wf);
+                            tempCache[threadNo].parents.push_back( corners );
+                            tempCache[threadNo].weights.push_back( wf );
 
                             faceMap[faceKey][ifn++] = nTmpNodes++;
                             tempNodes[threadNo].push_back( tmpNode );
@@ -1070,8 +1136,9 @@ namespace ttcr {
                                                 nPermanent+nTmpNodes );
                             x[0] = tmpNode.getX();
                             y[0] = tmpNode.getZ();
-                            islown = Interpolator<T1>::bilinear(x, y, s);
-                            tmpNode.setNodeSlowness(islown);
+                            Interpolator<T1>::bilinearWeight(x, y, wf);
+                            tempCache[threadNo].parents.push_back( corners );
+                            tempCache[threadNo].weights.push_back( wf );
 
                             faceMap[faceKey][ifn++] = nTmpNodes++;
                             tempNodes[threadNo].push_back( tmpNode );
@@ -1106,15 +1173,15 @@ namespace ttcr {
                 
                 T1 x[3];
                 T1 y[3];
-                T1 s[4];
+                std::array<T1,4> wf;
                 x[1] = this->nodes[((ind.k  )*nny + ind.j  ) * nnx + ind.i+i].getY();
                 y[1] = this->nodes[((ind.k  )*nny + ind.j  ) * nnx + ind.i+i].getZ();
                 x[2] = this->nodes[((ind.k+1)*nny + ind.j+1) * nnx + ind.i+i].getY();
                 y[2] = this->nodes[((ind.k+1)*nny + ind.j+1) * nnx + ind.i+i].getZ();
-                s[0] = this->nodes[((ind.k  )*nny + ind.j  ) * nnx + ind.i+i].getNodeSlowness();
-                s[1] = this->nodes[((ind.k+1)*nny + ind.j  ) * nnx + ind.i+i].getNodeSlowness();
-                s[2] = this->nodes[((ind.k  )*nny + ind.j+1) * nnx + ind.i+i].getNodeSlowness();
-                s[3] = this->nodes[((ind.k+1)*nny + ind.j+1) * nnx + ind.i+i].getNodeSlowness();
+                std::array<T2,4> corners = {{ ((ind.k  )*nny + ind.j  ) * nnx + ind.i+i,
+                    ((ind.k+1)*nny + ind.j  ) * nnx + ind.i+i,
+                    ((ind.k  )*nny + ind.j+1) * nnx + ind.i+i,
+                    ((ind.k+1)*nny + ind.j+1) * nnx + ind.i+i }};
 
                 T1 x0 = this->xmin + ind.i+i*this->dx;
                 T1 y0 = this->ymin + ind.j*this->dy;
@@ -1132,8 +1199,9 @@ namespace ttcr {
                                                 nPermanent+nTmpNodes );
                             x[0] = tmpNode.getY();
                             y[0] = tmpNode.getZ();
-                            islown = Interpolator<T1>::bilinear(x, y, s);
-                            tmpNode.setNodeSlowness(islown);
+                            Interpolator<T1>::bilinearWeight(x, y, wf);
+                            tempCache[threadNo].parents.push_back( corners );
+                            tempCache[threadNo].weights.push_back( wf );
 
                             faceMap[faceKey][ifn++] = nTmpNodes++;
                             tempNodes[threadNo].push_back( tmpNode );
@@ -1153,8 +1221,9 @@ namespace ttcr {
                                                 nPermanent+nTmpNodes );
                             x[0] = tmpNode.getY();
                             y[0] = tmpNode.getZ();
-                            islown = Interpolator<T1>::bilinear(x, y, s);
-                            tmpNode.setNodeSlowness(islown);
+                            Interpolator<T1>::bilinearWeight(x, y, wf);
+                            tempCache[threadNo].parents.push_back( corners );
+                            tempCache[threadNo].weights.push_back( wf );
 
                             faceMap[faceKey][ifn++] = nTmpNodes++;
                             tempNodes[threadNo].push_back( tmpNode );
@@ -1166,9 +1235,13 @@ namespace ttcr {
             }
         }
 
-        for ( auto cell=txCells.begin(); cell!=txCells.end(); ++cell ) {
-            adjacentCells.erase(*cell);
-        }
+        // keep cells adjacent to, but not within, cells around Tx
+        std::sort(adjacentCells.begin(), adjacentCells.end());
+        adjacentCells.erase( std::unique(adjacentCells.begin(), adjacentCells.end()), adjacentCells.end() );
+        adjacentCells.erase( std::remove_if(adjacentCells.begin(), adjacentCells.end(),
+                                            [&txCells](const T2 c) {
+                                                return std::binary_search(txCells.begin(), txCells.end(), c); }),
+                            adjacentCells.end() );
         for ( auto adj=adjacentCells.begin(); adj!=adjacentCells.end(); ++adj ) {
             this->getCellIJK(*adj, ind);
 
@@ -1289,14 +1362,6 @@ namespace ttcr {
                 }
             }
         }
-
-        for ( T2 n=0; n<tempNodes[threadNo].size(); ++n ) {
-            for ( size_t n2=0; n2<tempNodes[threadNo][n].getOwners().size(); ++n2) {
-                tempNeighbors[threadNo][ tempNodes[threadNo][n].getOwners()[n2] ].push_back(n);
-            }
-        }
-        if ( verbose )
-            std::cout << "  *** thread no " << threadNo << ": " << tempNodes[threadNo].size() << " dynamic nodes were added ***" << std::endl;
     }
     
     
@@ -1401,10 +1466,10 @@ namespace ttcr {
     }
     
     template<typename T1, typename T2>
-    void Grid3Drndsp<T1,T2>::raytrace(const std::vector<sxyz<T1>>& Tx,
-                                      const std::vector<T1>& t0,
-                                      const std::vector<sxyz<T1>>& Rx,
-                                      const size_t threadNo) const {
+    void Grid3Drndsp<T1,T2>::raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                                           const std::vector<T1>& t0,
+                                           const std::vector<sxyz<T1>>& Rx,
+                                           const size_t threadNo) const {
         this->checkPts(Tx);
         this->checkPts(Rx);
         
@@ -1428,10 +1493,10 @@ namespace ttcr {
     }
 
     template<typename T1, typename T2>
-    void Grid3Drndsp<T1,T2>::raytrace(const std::vector<sxyz<T1>>& Tx,
-                                      const std::vector<T1>& t0,
-                                      const std::vector<const std::vector<sxyz<T1>>*>& Rx,
-                                      const size_t threadNo) const {
+    void Grid3Drndsp<T1,T2>::raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                                           const std::vector<T1>& t0,
+                                           const std::vector<const std::vector<sxyz<T1>>*>& Rx,
+                                           const size_t threadNo) const {
         this->checkPts(Tx);
         for ( size_t n=0; n<Rx.size(); ++n )
             this->checkPts(*Rx[n]);
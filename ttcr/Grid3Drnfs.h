@@ -36,59 +36,17 @@ namespace ttcr {
             
         }
         
-        const int get_niter() const { return niter_final; }
+        int get_niter() const { return niter_final; }
         const int get_niterw() const { return niterw_final; }
-
-        void raytrace(const std::vector<sxyz<T1>>& Tx,
-                      const std::vector<T1>& t0,
-                      const std::vector<sxyz<T1>>& Rx,
-                      std::vector<T1>& traveltimes,
-                      const size_t threadNo=0) const {
-            // this is here just to be able to compile cgrid3d.pyx cython code
-            // should be removed when cgrid3d be replace by rgrid
-            Grid3D<T1,T2>::raytrace(Tx, t0, Rx, traveltimes, threadNo);
-        }
-        void raytrace(const std::vector<sxyz<T1>>& Tx,
-                      const std::vector<T1>& t0,
-                      const std::vector<sxyz<T1>>& Rx,
-                      std::vector<T1>& traveltimes,
-                      std::vector<std::vector<sxyz<T1>>>& r_data,
-                      const size_t threadNo=0) const {
-            // this is here just to be able to compile cgrid3d.pyx cython code
-            // should be removed when cgrid3d be replace by rgrid
-            Grid3D<T1,T2>::raytrace(Tx, t0, Rx, traveltimes, r_data, threadNo);
-        }
-        void raytrace(const std::vector<sxyz<T1>>& Tx,
-                      const std::vector<T1>& t0,
-                      const std::vector<sxyz<T1>>& Rx,
-                      std::vector<T1>& traveltimes,
-                      std::vector<std::vector<sxyz<T1>>>& r_data,
-                      std::vector<std::vector<sijv<T1>>>& m_data,
-                      const size_t threadNo=0) const {
-            // this is here just to be able to compile cgrid3d.pyx cython code
-            // should be removed when cgrid3d be replace by rgrid
-            Grid3D<T1,T2>::raytrace(Tx, t0, Rx, traveltimes, r_data, m_data, threadNo);
+        int getNiter(const size_t threadNo) const {
+            return this->warm.getNiter(threadNo);
         }
-        void raytrace(const std::vector<sxyz<T1>>& Tx,
-                      const std::vector<T1>& t0,
-                      const std::vector<sxyz<T1>>& Rx,
-                      std::vector<T1>& traveltimes,
-                      std::vector<std::vector<sxyz<T1>>>& r_data,
-                      std::vector<std::vector<siv<T1>>>& l_data,
-                      const size_t threadNo=0) const {
-            // this is here just to be able to compile cgrid3d.pyx cython code
-            // should be removed when cgrid3d be replace by rgrid
-            Grid3D<T1,T2>::raytrace(Tx, t0, Rx, traveltimes, r_data, l_data, threadNo);
-        }
-        void raytrace(const std::vector<sxyz<T1>>& Tx,
-                      const std::vector<T1>& t0,
-                      const std::vector<sxyz<T1>>& Rx,
-                      std::vector<T1>& traveltimes,
-                      std::vector<std::vector<siv<T1>>>& l_data,
-                      const size_t threadNo=0) const {
-            // this is here just to be able to compile cgrid3d.pyx cython code
-            // should be removed when cgrid3d be replace by rgrid
-            Grid3D<T1,T2>::raytrace(Tx, t0, Rx, traveltimes, l_data, threadNo);
+        
+        void setWarmStart(const bool w, const size_t maxBytes=268435456) { this->warm.setCached(w, maxBytes); }
+        void setTraveltimeSeed(const std::vector<T1>& tt,
+                               const std::vector<T1>& s,
+                               const size_t threadNo=0) const {
+            this->warm.setSeed(tt, s, threadNo);
         }
 
     protected:
@@ -100,19 +58,28 @@ namespace ttcr {
         
         void buildGridNodes();
         
+        void restoreSolve(const std::vector<sxyz<T1>>& Tx,
+                          const std::vector<T1>& t0,
+                          const int n, const int nw,
+                          const size_t threadNo) const {
+            Grid3Drn<T1,T2,Node3Dn<T1,T2>>::restoreSolve(Tx, t0, n, nw, threadNo);
+            niter_final = n-nw;
+            niterw_final = nw;
+        }
+        
     private:
         Grid3Drnfs() {}
         Grid3Drnfs(const Grid3Drnfs<T1,T2>& g) {}
         Grid3Drnfs<T1,T2>& operator=(const Grid3Drnfs<T1,T2>& g) {}
         
-        void raytrace(const std::vector<sxyz<T1>>& Tx,
-                      const std::vector<T1>& t0,
-                      const std::vector<sxyz<T1>>& Rx,
-                      const size_t threadNo=0) const;
-        void raytrace(const std::vector<sxyz<T1>>& Tx,
-                      const std::vector<T1>& t0,
-                      const std::vector<const std::vector<sxyz<T1>>*>& Rx,
-                      const size_t threadNo=0) const;
+        void raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                           const std::vector<T1>& t0,
+                           const std::vector<sxyz<T1>>& Rx,
+                           const size_t threadNo=0) const;
+        void raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                           const std::vector<T1>& t0,
+                           const std::vector<const std::vector<sxyz<T1>>*>& Rx,
+                           const size_t threadNo=0) const;
 
     };
     
@@ -237,10 +204,10 @@ namespace ttcr {
     
     
     template<typename T1, typename T2>
-    void Grid3Drnfs<T1,T2>::raytrace(const std::vector<sxyz<T1>>& Tx,
-                                     const std::vector<T1>& t0,
-                                     const std::vector<sxyz<T1>>& Rx,
-                                     const size_t threadNo) const {
+    void Grid3Drnfs<T1,T2>::raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                                          const std::vector<T1>& t0,
+                                          const std::vector<sxyz<T1>>& Rx,
+                                          const size_t threadNo) const {
         
         this->checkPts(Tx);
         this->checkPts(Rx);
@@ -254,6 +221,11 @@ namespace ttcr {
         int npts = 1;
         if ( weno3 == true ) npts = 2;
         this->initFSM(Tx, t0, frozen, npts, threadNo);
+        // all nodes are active at first, unless starting from the field of
+        // a previous solve
+        std::vector<bool> active( this->nodes.size(), true );
+        bool relax = false;
+        this->initWarmStart(Tx, t0, frozen, active, relax, threadNo);
 //        for ( size_t n=0; n<this->nodes.size(); ++n ) {
 //            if ( frozen[n] ) {
 //                AtomicWriter aw;
@@ -261,10 +233,6 @@ namespace ttcr {
 //            }
 //        }
         
-        std::vector<T1> times( this->nodes.size() );
-        for ( size_t n=0; n<this->nodes.size(); ++n )
-            times[n] = this->nodes[n].getTT( threadNo );
-        
         T1 change = std::numeric_limits<T1>::max();
         if ( weno3 == true ) {
             int niter = 0;
@@ -273,57 +241,38 @@ namespace ttcr {
                 throw std::logic_error("Error: WENO stencil needs dx equal to dz");
             }
             while ( change >= epsilon && niter<nitermax ) {
-                this->sweep(frozen, threadNo);
-                change = 0.0;
-                for ( size_t n=0; n<this->nodes.size(); ++n ) {
-                    T1 dt = std::abs( times[n] - this->nodes[n].getTT(threadNo) );
-                    
-                    change += dt;
-                    times[n] = this->nodes[n].getTT(threadNo);
-                }
+                change = this->sweep(frozen, active, threadNo, relax);
                 niter++;
             }
             change = std::numeric_limits<T1>::max();
             while ( change >= epsilon && niterw<nitermax ) {
-                this->sweep_weno3(frozen, threadNo);
-                change = 0.0;
-                for ( size_t n=0; n<this->nodes.size(); ++n ) {
-                    T1 dt = std::abs( times[n] - this->nodes[n].getTT(threadNo) );
-                    
-                    change += dt;
-                    times[n] = this->nodes[n].getTT(threadNo);
-                }
+                change = this->sweep_weno3(frozen, threadNo);
                 niterw++;
             }
             niter_final = niter;
             niterw_final = niterw;
+            this->warm.setNiter(niter+niterw, threadNo);
             //std::cout << Tx[0] << "    times " << times[0] << '\t' << this->nodes[0].getNodeSlowness() << '\n';
         } else {
             int niter = 0;
             while ( change >= epsilon && niter<nitermax ) {
-                this->sweep(frozen, threadNo);
-                
-                change = 0.0;
-                for ( size_t n=0; n<this->nodes.size(); ++n ) {
-                    T1 dt = std::abs( times[n] - this->nodes[n].getTT(threadNo) );
-                    
-                    change += dt;
-                    times[n] = this->nodes[n].getTT(threadNo);
-                }
+                change = this->sweep(frozen, active, threadNo, relax);
                 niter++;
             }
             niter_final = niter;
+            this->warm.setNiter(niter, threadNo);
         }
+        this->saveWarmStart(Tx, t0, threadNo);
 //        for ( size_t n=0; n<this->nodes.size(); ++n ) {
 //            std::cout << this->nodes[n].getTT(threadNo) << '\n';
 //        }
     }
     
     template<typename T1, typename T2>
-    void Grid3Drnfs<T1,T2>::raytrace(const std::vector<sxyz<T1>>& Tx,
-                                     const std::vector<T1>& t0,
-                                     const std::vector<const std::vector<sxyz<T1>>*>& Rx,
-                                     const size_t threadNo) const {
+    void Grid3Drnfs<T1,T2>::raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                                          const std::vector<T1>& t0,
+                                          const std::vector<const std::vector<sxyz<T1>>*>& Rx,
+                                          const size_t threadNo) const {
         
         this->checkPts(Tx);
         for ( size_t n=0; n<Rx.size(); ++n )
@@ -338,10 +287,11 @@ namespace ttcr {
         int npts = 1;
         if ( weno3 == true ) npts = 2;
         this->initFSM(Tx, t0, frozen, npts, threadNo);
-        
-        std::vector<T1> times( this->nodes.size() );
-        for ( size_t n=0; n<this->nodes.size(); ++n )
-        times[n] = this->nodes[n].getTT( threadNo );
+        // all nodes are active at first, unless starting from the field of
+        // a previous solve
+        std::vector<bool> active( this->nodes.size(), true );
+        bool relax = false;
+        this->initWarmStart(Tx, t0, frozen, active, relax, threadNo);
         
         T1 change = std::numeric_limits<T1>::max();
         if ( weno3 == true ) {
@@ -351,46 +301,27 @@ namespace ttcr {
                 throw std::logic_error("Error: WENO stencil needs dx equal to dz");
             }
             while ( change >= epsilon && niter<nitermax ) {
-                this->sweep(frozen, threadNo);
-                change = 0.0;
-                for ( size_t n=0; n<this->nodes.size(); ++n ) {
-                    T1 dt = std::abs( times[n] - this->nodes[n].getTT(threadNo) );
-                    
-                    change += dt;
-                    times[n] = this->nodes[n].getTT(threadNo);
-                }
+                change = this->sweep(frozen, active, threadNo, relax);
                 niter++;
             }
             change = std::numeric_limits<T1>::max();
             while ( change >= epsilon && niterw<nitermax ) {
-                this->sweep_weno3(frozen, threadNo);
-                change = 0.0;
-                for ( size_t n=0; n<this->nodes.size(); ++n ) {
-                    T1 dt = std::abs( times[n] - this->nodes[n].getTT(threadNo) );
-                    
-                    change += dt;
-                    times[n] = this->nodes[n].getTT(threadNo);
-                }
+                change = this->sweep_weno3(frozen, threadNo);
                 niterw++;
             }
             niter_final = niter;
             niterw_final = niterw;
+            this->warm.setNiter(niter+niterw, threadNo);
         } else {
             int niter = 0;
             while ( change >= epsilon && niter<nitermax ) {
-                this->sweep(frozen, threadNo);
-                
-                change = 0.0;
-                for ( size_t n=0; n<this->nodes.size(); ++n ) {
-                    T1 dt = std::abs( times[n] - this->nodes[n].getTT(threadNo) );
-                    
-                    change += dt;
-                    times[n] = this->nodes[n].getTT(threadNo);
-                }
+                change = this->sweep(frozen, active, threadNo, relax);
                 niter++;
             }
             niter_final = niter;
+            this->warm.setNiter(niter, threadNo);
         }
+        this->saveWarmStart(Tx, t0, threadNo);
         
     }
 }
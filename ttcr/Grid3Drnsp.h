@@ -18,6 +18,7 @@
 #include <queue>
 #include <vector>
 
+#include "EdgeLengths.h"
 #include "Grid3Drn.h"
 #include "Node3Dnsp.h"
 #include "utils.h"
@@ -35,10 +36,12 @@ namespace ttcr {
                    const T2 nnx, const T2 nny, const T2 nnz, const bool ttrp,
                    const bool intVel, const size_t nt=1) :
         Grid3Drn<T1,T2,Node3Dnsp<T1,T2>>(nx, ny, nz, ddx, ddy, ddz, minx, miny, minz, ttrp, intVel, nt),
-        nsnx(nnx), nsny(nny), nsnz(nnz)
+        nsnx(nnx), nsny(nny), nsnz(nnz),
+        edgeTablesMaxBytes(LatticeEdgeLengths<T1,T2>::defaultMaxBytes)
         {
             buildGridNodes();
             this->template buildGridNeighbors<Node3Dnsp<T1,T2>>(this->nodes);
+            buildEdgeLengths();
         }
         
         ~Grid3Drnsp() {
@@ -47,40 +50,69 @@ namespace ttcr {
         
         void setSlowness(const std::vector<T1>& s);
         
-        void raytrace(const std::vector<sxyz<T1>>& Tx,
-                     const std::vector<T1>& t0,
-                     const std::vector<sxyz<T1>>& Rx,
-                     std::vector<T1>& traveltimes,
-                     const size_t threadNo=0) const;
-        
-        void raytrace(const std::vector<sxyz<T1>>& Tx,
-                     const std::vector<T1>& t0,
-                     const std::vector<const std::vector<sxyz<T1>>*>& Rx,
-                     std::vector<std::vector<T1>*>& traveltimes,
-                     const size_t threadNo=0) const;
-        
-        void raytrace(const std::vector<sxyz<T1>>& Tx,
-                     const std::vector<T1>& t0,
-                     const std::vector<sxyz<T1>>& Rx,
-                     std::vector<T1>& traveltimes,
-                     std::vector<std::vector<sxyz<T1>>>& r_data,
-                     const size_t threadNo=0) const;
-        
-        void raytrace(const std::vector<sxyz<T1>>& Tx,
-                     const std::vector<T1>& t0,
-                     const std::vector<const std::vector<sxyz<T1>>*>& Rx,
-                     std::vector<std::vector<T1>*>& traveltimes,
-                     std::vector<std::vector<std::vector<sxyz<T1>>>*>& r_data,
-                     const size_t threadNo=0) const;
-        
-        void raytrace(const std::vector<sxyz<T1>>& Tx,
-                     const std::vector<T1>& t0,
-                     const std::vector<sxyz<T1>>& Rx,
-                     std::vector<T1>& traveltimes,
-                     std::vector<std::vector<sxyz<T1>>>& r_data,
-                     std::vector<std::vector<siv<T1>>>& l_data,
-                     const size_t threadNo=0) const;
+        void getSlownessState(std::vector<T1>& s) const {
+            s.resize( this->nodes.size() );
+            for ( size_t n=0; n<this->nodes.size(); ++n ) {
+                s[n] = this->nodes[n].getNodeSlowness();
+            }
+        }
+        void setSlownessState(const std::vector<T1>& s) {
+            if ( this->nodes.size() != s.size() ) {
+                throw std::length_error("Error: slowness vector of incompatible size.");
+            }
+            for ( size_t n=0; n<this->nodes.size(); ++n ) {
+                this->nodes[n].setNodeSlowness( s[n] );
+            }
+            this->slownessChanged();
+        }
         
+    protected:
+        void raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                          const std::vector<T1>& t0,
+                          const std::vector<sxyz<T1>>& Rx,
+                          std::vector<T1>& traveltimes,
+                          const size_t threadNo=0) const;
+        
+        void raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                          const std::vector<T1>& t0,
+                          const std::vector<const std::vector<sxyz<T1>>*>& Rx,
+                          std::vector<std::vector<T1>*>& traveltimes,
+                          const size_t threadNo=0) const;
+        
+        void raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                          const std::vector<T1>& t0,
+                          const std::vector<sxyz<T1>>& Rx,
+                          std::vector<T1>& traveltimes,
+                          std::vector<std::vector<sxyz<T1>>>& r_data,
+                          const size_t threadNo=0) const;
+        
+        // raypaths are traced back through the parents of the nodes, which
+        // include temporary source nodes
+        void raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                           const std::vector<T1>& t0,
+                           const std::vector<sxyz<T1>>& Rx,
+                           std::vector<T1>& traveltimes,
+                           RayPaths<float,T2>& rays,
+                           const size_t threadNo=0) const {
+            this->appendRaypaths(Tx, t0, Rx, traveltimes, rays, threadNo);
+        }
+        
+        void raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                          const std::vector<T1>& t0,
+                          const std::vector<const std::vector<sxyz<T1>>*>& Rx,
+                          std::vector<std::vector<T1>*>& traveltimes,
+                          std::vector<std::vector<std::vector<sxyz<T1>>>*>& r_data,
+                          const size_t threadNo=0) const;
+        
+        void raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                          const std::vector<T1>& t0,
+                          const std::vector<sxyz<T1>>& Rx,
+                          std::vector<T1>& traveltimes,
+                          std::vector<std::vector<sxyz<T1>>>& r_data,
+                          std::vector<std::vector<siv<T1>>>& l_data,
+                          const size_t threadNo=0) const;
+        
+    public:
         void savePrimary(const char filename[], const size_t nt=0,
                          const bool vtkFormat=0) const;
         
@@ -88,13 +120,50 @@ namespace ttcr {
         const T2 getNsny() const { return nsny; }
         const T2 getNsnz() const { return nsnz; }
         
+        void setEdgeTables(const size_t maxBytes) {
+            edgeTablesMaxBytes = maxBytes;
+            buildEdgeLengths();
+        }
+        bool hasEdgeTables() const { return !edgeLengths.empty(); }
+        
     private:
         T2 nsnx;                 // number of secondary nodes in x
         T2 nsny;                 // number of secondary nodes in y
         T2 nsnz;                 // number of secondary nodes in z
+        size_t edgeTablesMaxBytes;
+        LatticeEdgeLengths<T1,T2> edgeLengths;
+        
+        void buildEdgeLengths() {
+            if ( !edgeLengths.build(this->nodes, this->xmin, this->ymin, this->zmin,
+                                    this->dx, this->dy, this->dz, nsnx, nsny, nsnz,
+                                    edgeTablesMaxBytes) &&
+                edgeTablesMaxBytes > 0 && verbose ) {
+                std::cout << "Tables of edge lengths would exceed " << edgeTablesMaxBytes
+                << " bytes, lengths are computed on the fly.\n";
+            }
+        }
         
         void buildGridNodes();
+        
+        T1 computeDt(const Node3Dnsp<T1,T2>& source,
+                     const Node3Dnsp<T1,T2>& node) const {
+            if ( edgeLengths.contains(source.getGridIndex()) ) {
+                return (node.getNodeSlowness()+source.getNodeSlowness())/2. *
+                edgeLengths(source.getGridIndex(), node.getGridIndex());
+            }
+            return Grid3Drn<T1,T2,Node3Dnsp<T1,T2>>::computeDt(source, node);
+        }
 
+        void raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                           const std::vector<T1>& t0,
+                           const std::vector<sxyz<T1>>& Rx,
+                           const size_t threadNo=0) const;
+        
+        void raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                           const std::vector<T1>& t0,
+                           const std::vector<const std::vector<sxyz<T1>>*>& Rx,
+                           const size_t threadNo=0) const;
+        
         void initQueue(const std::vector<sxyz<T1>>& Tx,
                        const std::vector<T1>& t0,
                        std::priority_queue<Node3Dnsp<T1,T2>*,
@@ -536,18 +605,15 @@ namespace ttcr {
             }
         }
         this->interpSecondary();
-
+        this->slownessChanged();
     }
 
     
     template<typename T1, typename T2>
-    void Grid3Drnsp<T1,T2>::raytrace(const std::vector<sxyz<T1>>& Tx,
-                                     const std::vector<T1>& t0,
-                                     const std::vector<sxyz<T1>>& Rx,
-                                     std::vector<T1>& traveltimes,
-                                     const size_t threadNo) const {
-        
-        // Primary function
+    void Grid3Drnsp<T1,T2>::raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                                          const std::vector<T1>& t0,
+                                          const std::vector<sxyz<T1>>& Rx,
+                                          const size_t threadNo) const {
         
         this->checkPts(Tx);
         this->checkPts(Rx);
@@ -569,6 +635,45 @@ namespace ttcr {
         initQueue(Tx, t0, queue, txNodes, inQueue, frozen, threadNo);
         
         propagate(queue, inQueue, frozen, threadNo);
+    }
+    
+    template<typename T1, typename T2>
+    void Grid3Drnsp<T1,T2>::raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                                          const std::vector<T1>& t0,
+                                          const std::vector<const std::vector<sxyz<T1>>*>& Rx,
+                                          const size_t threadNo) const {
+        
+        this->checkPts(Tx);
+        for ( size_t n=0; n<Rx.size(); ++n )
+            this->checkPts(*Rx[n]);
+        
+        for ( size_t n=0; n<this->nodes.size(); ++n ) {
+            this->nodes[n].reinit( threadNo );
+        }
+        
+        CompareNodePtr<T1> cmp(threadNo);
+        std::priority_queue< Node3Dnsp<T1,T2>*, std::vector<Node3Dnsp<T1,T2>*>,
+        CompareNodePtr<T1>> queue( cmp );
+        
+        std::vector<Node3Dnsp<T1,T2>> txNodes;
+        std::vector<bool> inQueue( this->nodes.size(), false );
+        std::vector<bool> frozen( this->nodes.size(), false );
+        
+        initQueue(Tx, t0, queue, txNodes, inQueue, frozen, threadNo);
+        
+        propagate(queue, inQueue, frozen, threadNo);
+    }
+    
+    template<typename T1, typename T2>
+    void Grid3Drnsp<T1,T2>::raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                                          const std::vector<T1>& t0,
+                                          const std::vector<sxyz<T1>>& Rx,
+                                          std::vector<T1>& traveltimes,
+                                          const size_t threadNo) const {
+        
+        // Primary function
+        
+        this->computeTT(Tx, t0, Rx, threadNo);
         
         if ( traveltimes.size() != Rx.size() ) {
             traveltimes.resize( Rx.size() );
@@ -592,31 +697,13 @@ namespace ttcr {
     }
     
     template<typename T1, typename T2>
-    void Grid3Drnsp<T1,T2>::raytrace(const std::vector<sxyz<T1>>& Tx,
-                                     const std::vector<T1>& t0,
-                                     const std::vector<const std::vector<sxyz<T1>>*>& Rx,
-                                     std::vector<std::vector<T1>*>& traveltimes,
-                                     const size_t threadNo) const {
-        
-        this->checkPts(Tx);
-        for ( size_t n=0; n<Rx.size(); ++n )
-            this->checkPts(*Rx[n]);
+    void Grid3Drnsp<T1,T2>::raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                                          const std::vector<T1>& t0,
+                                          const std::vector<const std::vector<sxyz<T1>>*>& Rx,
+                                          std::vector<std::vector<T1>*>& traveltimes,
+                                          const size_t threadNo) const {
         
-        for ( size_t n=0; n<this->nodes.size(); ++n ) {
-            this->nodes[n].reinit( threadNo );
-        }
-        
-        CompareNodePtr<T1> cmp(threadNo);
-        std::priority_queue< Node3Dnsp<T1,T2>*, std::vector<Node3Dnsp<T1,T2>*>,
-        CompareNodePtr<T1>> queue( cmp );
-        
-        std::vector<Node3Dnsp<T1,T2>> txNodes;
-        std::vector<bool> inQueue( this->nodes.size(), false );
-        std::vector<bool> frozen( this->nodes.size(), false );
-        
-        initQueue(Tx, t0, queue, txNodes, inQueue, frozen, threadNo);
-        
-        propagate(queue, inQueue, frozen, threadNo);
+        this->computeTT(Tx, t0, Rx, threadNo);
         
         if ( traveltimes.size() != Rx.size() ) {
             traveltimes.resize( Rx.size() );
@@ -638,12 +725,12 @@ namespace ttcr {
     }
     
     template<typename T1, typename T2>
-    void Grid3Drnsp<T1,T2>::raytrace(const std::vector<sxyz<T1>>& Tx,
-                                     const std::vector<T1>& t0,
-                                     const std::vector<sxyz<T1>>& Rx,
-                                     std::vector<T1>& traveltimes,
-                                     std::vector<std::vector<sxyz<T1>>>& r_data,
-                                     const size_t threadNo) const {
+    void Grid3Drnsp<T1,T2>::raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                                          const std::vector<T1>& t0,
+                                          const std::vector<sxyz<T1>>& Rx,
+                                          std::vector<T1>& traveltimes,
+                                          std::vector<std::vector<sxyz<T1>>>& r_data,
+                                          const size_t threadNo) const {
         
         // Primary function
         
@@ -738,12 +825,12 @@ namespace ttcr {
     }
     
     template<typename T1, typename T2>
-    void Grid3Drnsp<T1,T2>::raytrace(const std::vector<sxyz<T1>>& Tx,
-                                     const std::vector<T1>& t0,
-                                     const std::vector<const std::vector<sxyz<T1>>*>& Rx,
-                                     std::vector<std::vector<T1>*>& traveltimes,
-                                     std::vector<std::vector<std::vector<sxyz<T1>>>*>& r_data,
-                                     const size_t threadNo) const {
+    void Grid3Drnsp<T1,T2>::raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                                          const std::vector<T1>& t0,
+                                          const std::vector<const std::vector<sxyz<T1>>*>& Rx,
+                                          std::vector<std::vector<T1>*>& traveltimes,
+                                          std::vector<std::vector<std::vector<sxyz<T1>>>*>& r_data,
+                                          const size_t threadNo) const {
         
         this->checkPts(Tx);
         for ( size_t n=0; n<Rx.size(); ++n )
@@ -850,13 +937,13 @@ namespace ttcr {
     }
     
     template<typename T1, typename T2>
-    void Grid3Drnsp<T1,T2>::raytrace(const std::vector<sxyz<T1>>& Tx,
-                                     const std::vector<T1>& t0,
-                                     const std::vector<sxyz<T1>>& Rx,
-                                     std::vector<T1>& traveltimes,
-                                     std::vector<std::vector<sxyz<T1>>>& r_data,
-                                     std::vector<std::vector<siv<T1>>>& l_data,
-                                     const size_t threadNo) const {
+    void Grid3Drnsp<T1,T2>::raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                                          const std::vector<T1>& t0,
+                                          const std::vector<sxyz<T1>>& Rx,
+                                          std::vector<T1>& traveltimes,
+                                          std::vector<std::vector<sxyz<T1>>>& r_data,
+                                          std::vector<std::vector<siv<T1>>>& l_data,
+                                          const size_t threadNo) const {
         
         // Primary function
         
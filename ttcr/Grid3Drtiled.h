@@ -0,0 +1,325 @@
+//
+//  Grid3Drtiled.h
+//  ttcr
+//
+//  Created by agent on 2026-10-18.
+//  Copyright (c) 2026 agent. All rights reserved.
+//
+
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef ttcr_Grid3Drtiled_h
+#define ttcr_Grid3Drtiled_h
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "Bricks.h"
+#include "Cell.h"
+#include "Grid3D.h"
+#include "Grid3Drcfm.h"
+#include "Grid3Drcfs.h"
+#include "Grid3Drcsp.h"
+#include "Grid3Drnfm.h"
+#include "Grid3Drnfs.h"
+#include "Grid3Drnsp.h"
+#include "Node3Dcsp.h"
+#include "structs_ttcr.h"
+
+namespace ttcr {
+
+    // Rectilinear grid with the slowness model stored in a brick file.  For
+    // each source, only the bricks inside a window covering the source and
+    // the receivers plus a margin are read, and the traveltimes are computed
+    // on a rectilinear grid built over that window.  Rays are thus confined
+    // to the window, and the margin should be large enough to hold them.
+    // Bricks are kept in a LRU cache shared by all threads, so that
+    // neighbouring shots reuse the bricks already read.  Matrices M and L,
+    // and traveltimes at the nodes, are not available since the window grids
+    // only live for the duration of each shot.
+    template<typename T1, typename T2>
+    class Grid3Drtiled : public Grid3D<T1,T2> {
+    public:
+        // creates the grid of a window, given the number of cells and the
+        // origin of the window
+        typedef std::function<Grid3D<T1,T2>*(const brickHeader&,
+                                             const T2, const T2, const T2,
+                                             const T1, const T1, const T1)> windowBuilder;
+
+        Grid3Drtiled(const std::string& filename, const windowBuilder& wb,
+                     const T1 m, const size_t cacheSize,
+                     const bool ttrp, const size_t nt=1) :
+        Grid3D<T1,T2>(ttrp, 0, nt), store(filename, cacheSize), builder(wb),
+        margin(m), source_radius(0.0), factored(false) {}
+
+        ~Grid3Drtiled() {}
+
+    protected:
+        void raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                           const std::vector<T1>& t0,
+                           const std::vector<sxyz<T1>>& Rx,
+                           std::vector<T1>& traveltimes,
+                           const size_t threadNo=0) const {
+            std::vector<const std::vector<sxyz<T1>>*> vRx(1, &Rx);
+            std::unique_ptr<Grid3D<T1,T2>> w( buildWindow(Tx, vRx) );
+            w->raytrace(Tx, t0, Rx, traveltimes, 0);
+        }
+
+        void raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                           const std::vector<T1>& t0,
+                           const std::vector<const std::vector<sxyz<T1>>*>& Rx,
+                           std::vector<std::vector<T1>*>& traveltimes,
+                           const size_t threadNo=0) const {
+            std::unique_ptr<Grid3D<T1,T2>> w( buildWindow(Tx, Rx) );
+            w->raytrace(Tx, t0, Rx, traveltimes, 0);
+        }
+
+        void raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                           const std::vector<T1>& t0,
+                           const std::vector<sxyz<T1>>& Rx,
+                           std::vector<T1>& traveltimes,
+                           std::vector<std::vector<sxyz<T1>>>& r_data,
+                           const size_t threadNo=0) const {
+            std::vector<const std::vector<sxyz<T1>>*> vRx(1, &Rx);
+            std::unique_ptr<Grid3D<T1,T2>> w( buildWindow(Tx, vRx) );
+            w->raytrace(Tx, t0, Rx, traveltimes, r_data, 0);
+        }
+
+        void raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                           const std::vector<T1>& t0,
+                           const std::vector<sxyz<T1>>& Rx,
+                           std::vector<T1>& traveltimes,
+                           RayPaths<float,T2>& rays,
+                           const size_t threadNo=0) const {
+            std::vector<const std::vector<sxyz<T1>>*> vRx(1, &Rx);
+            std::unique_ptr<Grid3D<T1,T2>> w( buildWindow(Tx, vRx) );
+            w->raytrace(Tx, t0, Rx, traveltimes, rays, 0);
+        }
+
+        void raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                           const std::vector<T1>& t0,
+                           const std::vector<const std::vector<sxyz<T1>>*>& Rx,
+                           std::vector<std::vector<T1>*>& traveltimes,
+                           std::vector<std::vector<std::vector<sxyz<T1>>>*>& r_data,
+                           const size_t threadNo=0) const {
+            std::unique_ptr<Grid3D<T1,T2>> w( buildWindow(Tx, Rx) );
+            w->raytrace(Tx, t0, Rx, traveltimes, r_data, 0);
+        }
+
+        void raytraceLocal(const std::vector<sxyz<T1>>&, const std::vector<T1>&,
+                           const std::vector<sxyz<T1>>&, std::vector<T1>&,
+                           std::vector<std::vector<sxyz<T1>>>&,
+                           std::vector<std::vector<sijv<T1>>>&,
+                           const size_t=0) const { noMatrix(); }
+        void raytraceLocal(const std::vector<sxyz<T1>>&, const std::vector<T1>&,
+                           const std::vector<sxyz<T1>>&, std::vector<T1>&,
+                           std::vector<std::vector<sijv<T1>>>&,
+                           const size_t=0) const { noMatrix(); }
+        void raytraceLocal(const std::vector<sxyz<T1>>&, const std::vector<T1>&,
+                           const std::vector<sxyz<T1>>&, std::vector<T1>&,
+                           std::vector<std::vector<siv<T1>>>&,
+                           const size_t=0) const { noMatrix(); }
+        void raytraceLocal(const std::vector<sxyz<T1>>&, const std::vector<T1>&,
+                           const std::vector<sxyz<T1>>&, std::vector<T1>&,
+                           std::vector<std::vector<sxyz<T1>>>&,
+                           std::vector<std::vector<siv<T1>>>&,
+                           const size_t=0) const { noMatrix(); }
+        
+    public:
+        void saveTT(const std::string &, const int, const size_t nt=0,
+                    const int format=1) const {
+            throw std::runtime_error("Error: traveltimes at grid nodes cannot be saved for tiled models");
+        }
+
+        void setSourceRadius(const double r) { source_radius = r; }
+        void setFactored(const bool f) { factored = f; }
+
+        size_t getNumberOfNodes() const {
+            const brickHeader& h = store.header();
+            return (h.nCells(0)+1)*(h.nCells(1)+1)*(h.nCells(2)+1);
+        }
+        size_t getNumberOfCells() const {
+            const brickHeader& h = store.header();
+            return h.nCells(0)*h.nCells(1)*h.nCells(2);
+        }
+
+        const T1 getXmin() const { return store.header().min[0]; }
+        const T1 getXmax() const { return getMax(0); }
+        const T1 getYmin() const { return store.header().min[1]; }
+        const T1 getYmax() const { return getMax(1); }
+        const T1 getZmin() const { return store.header().min[2]; }
+        const T1 getZmax() const { return getMax(2); }
+
+        const BrickStore<T1>& getStore() const { return store; }
+
+        // indices of the cells of the window covering Tx and Rx, in the
+        // ranges [imin[0], imax[0]), [imin[1], imax[1]) and [imin[2], imax[2])
+        void getWindow(const std::vector<sxyz<T1>>& Tx,
+                       const std::vector<const std::vector<sxyz<T1>>*>& Rx,
+                       size_t imin[3], size_t imax[3]) const;
+
+    private:
+        BrickStore<T1> store;
+        windowBuilder builder;
+        T1 margin;
+        double source_radius;
+        bool factored;
+
+        void noMatrix() const {
+            throw std::runtime_error("Error: matrices M and L not available for tiled models");
+        }
+
+        T1 getMax(const size_t i) const {
+            const brickHeader& h = store.header();
+            return h.min[i] + h.nCells(i)*h.d[i];
+        }
+
+        Grid3D<T1,T2>* buildWindow(const std::vector<sxyz<T1>>& Tx,
+                                   const std::vector<const std::vector<sxyz<T1>>*>& Rx) const;
+    };
+
+    // Builds the grids of the windows, with SPM, FMM or FSM.  Cells must be
+    // cubic for FMM and FSM.
+    template<typename T1, typename T2>
+    class windowGrid3Dr {
+    public:
+        windowGrid3Dr(const raytracing_method m, const uint32_t nsnx,
+                      const uint32_t nsny, const uint32_t nsnz,
+                      const T1 eps, const int maxit, const bool weno,
+                      const bool ttrp, const bool iv) :
+        method(m), nsn{nsnx, nsny, nsnz}, epsilon(eps), nitermax(maxit),
+        weno3(weno), tt_from_rp(ttrp), interpVel(iv) {
+            if ( method != SHORTEST_PATH && method != FAST_MARCHING &&
+                method != FAST_SWEEPING ) {
+                throw std::invalid_argument("Error: tiled models only available with SPM, FMM and FSM");
+            }
+        }
+
+        Grid3D<T1,T2>* operator()(const brickHeader& h, const T2 ncx,
+                                  const T2 ncy, const T2 ncz,
+                                  const T1 xmin, const T1 ymin, const T1 zmin) const {
+            if ( method != SHORTEST_PATH && (h.d[0] != h.d[1] || h.d[0] != h.d[2]) ) {
+                throw std::runtime_error("Error: cells should be cubic for FSM and FMM");
+            }
+            switch (method) {
+                case SHORTEST_PATH:
+                    if ( h.cells )
+                        return new Grid3Drcsp<T1,T2,Cell<T1,Node3Dcsp<T1,T2>,sxyz<T1>>>(ncx, ncy, ncz,
+                                                                                        h.d[0], h.d[1], h.d[2],
+                                                                                        xmin, ymin, zmin,
+                                                                                        nsn[0], nsn[1], nsn[2],
+                                                                                        tt_from_rp, 1);
+                    return new Grid3Drnsp<T1,T2>(ncx, ncy, ncz, h.d[0], h.d[1], h.d[2],
+                                                 xmin, ymin, zmin, nsn[0], nsn[1], nsn[2],
+                                                 tt_from_rp, interpVel, 1);
+                case FAST_MARCHING:
+                    if ( h.cells )
+                        return new Grid3Drcfm<T1,T2>(ncx, ncy, ncz, h.d[0], xmin, ymin, zmin,
+                                                     weno3, tt_from_rp, interpVel, 1);
+                    return new Grid3Drnfm<T1,T2>(ncx, ncy, ncz, h.d[0], xmin, ymin, zmin,
+                                                 weno3, tt_from_rp, interpVel, 1);
+                case FAST_SWEEPING:
+                    if ( h.cells )
+                        return new Grid3Drcfs<T1,T2>(ncx, ncy, ncz, h.d[0], xmin, ymin, zmin,
+                                                     epsilon, nitermax, weno3,
+                                                     tt_from_rp, interpVel, 1);
+                    return new Grid3Drnfs<T1,T2>(ncx, ncy, ncz, h.d[0], xmin, ymin, zmin,
+                                                 epsilon, nitermax, weno3,
+                                                 tt_from_rp, interpVel, 1);
+                default:
+                    return nullptr;
+            }
+        }
+
+    private:
+        raytracing_method method;
+        uint32_t nsn[3];
+        T1 epsilon;
+        int nitermax;
+        bool weno3;
+        bool tt_from_rp;
+        bool interpVel;
+    };
+
+    template<typename T1, typename T2>
+    void Grid3Drtiled<T1,T2>::getWindow(const std::vector<sxyz<T1>>& Tx,
+                                        const std::vector<const std::vector<sxyz<T1>>*>& Rx,
+                                        size_t imin[3], size_t imax[3]) const {
+        sxyz<T1> pmin = Tx[0];
+        sxyz<T1> pmax = Tx[0];
+        auto expand = [&pmin, &pmax](const sxyz<T1>& p) {
+            pmin.x = std::min(pmin.x, p.x); pmax.x = std::max(pmax.x, p.x);
+            pmin.y = std::min(pmin.y, p.y); pmax.y = std::max(pmax.y, p.y);
+            pmin.z = std::min(pmin.z, p.z); pmax.z = std::max(pmax.z, p.z);
+        };
+        for ( size_t n=1; n<Tx.size(); ++n ) expand(Tx[n]);
+        for ( size_t nr=0; nr<Rx.size(); ++nr ) {
+            for ( size_t n=0; n<Rx[nr]->size(); ++n ) expand((*Rx[nr])[n]);
+        }
+        const T1 lo[3] = { pmin.x-margin, pmin.y-margin, pmin.z-margin };
+        const T1 hi[3] = { pmax.x+margin, pmax.y+margin, pmax.z+margin };
+
+        const brickHeader& h = store.header();
+        for ( size_t i=0; i<3; ++i ) {
+            const double nc = static_cast<double>(h.nCells(i));
+            const double a = std::floor((lo[i]-h.min[i])/h.d[i]);
+            const double b = std::ceil((hi[i]-h.min[i])/h.d[i]);
+            imin[i] = static_cast<size_t>(std::max(0.0, std::min(a, nc-1.0)));
+            imax[i] = static_cast<size_t>(std::max(static_cast<double>(imin[i]+1),
+                                                   std::min(b, nc)));
+        }
+    }
+
+    template<typename T1, typename T2>
+    Grid3D<T1,T2>* Grid3Drtiled<T1,T2>::buildWindow(const std::vector<sxyz<T1>>& Tx,
+                                                    const std::vector<const std::vector<sxyz<T1>>*>& Rx) const {
+        const brickHeader& h = store.header();
+        size_t imin[3], imax[3];
+        getWindow(Tx, Rx, imin, imax);
+
+        // nodes of the window include the last one
+        const size_t last = h.cells ? 0 : 1;
+        std::vector<T1> slowness;
+        store.getBox(imin[0], imax[0]+last, imin[1], imax[1]+last,
+                     imin[2], imax[2]+last, slowness);
+
+        Grid3D<T1,T2>* w = builder(h, imax[0]-imin[0], imax[1]-imin[1], imax[2]-imin[2],
+                                   h.min[0]+imin[0]*h.d[0],
+                                   h.min[1]+imin[1]*h.d[1],
+                                   h.min[2]+imin[2]*h.d[2]);
+        if ( w == nullptr ) {
+            throw std::runtime_error("Error: grid of window cannot be built");
+        }
+        try {
+            w->setSlowness(slowness);
+            if ( source_radius != 0.0 ) w->setSourceRadius(source_radius);
+            if ( factored ) w->setFactored(true);
+        } catch (...) {
+            delete w;
+            throw;
+        }
+        return w;
+    }
+
+}
+
+#endif
@@ -36,6 +36,7 @@
 #include <set>
 #include <sstream>
 #include <stdexcept>
+#include <typeinfo>
 #include <unordered_set>
 #include <vector>
 
@@ -54,6 +55,8 @@
 #include "vtkXMLUnstructuredGridWriter.h"
 #endif
 
+#include "AdjointState.h"
+#include "FactoredEikonal.h"
 #include "Grad.h"
 #include "Grid3D.h"
 #include "utils.h"
@@ -72,7 +75,7 @@ namespace ttcr {
         source_radius(0.0), min_dist(md),
         nodes(std::vector<NODE>(no.size(), NODE(nt))),
         slowness(std::vector<T1>(tet.size())),
-        tetrahedra(tet)
+        tetrahedra(tet), factored(false), factoredSrc(nt), srcTx(nt)
         {}
         
         virtual ~Grid3Duc() {}
@@ -81,6 +84,7 @@ namespace ttcr {
             for ( size_t n=0; n<slowness.size(); ++n ) {
                 slowness[n] = s;
             }
+            this->slownessChanged();
         }
         
         void setSlowness(const T1 *s, const size_t ns) {
@@ -90,6 +94,7 @@ namespace ttcr {
             for ( size_t n=0; n<slowness.size(); ++n ) {
                 slowness[n] = s[n];
             }
+            this->slownessChanged();
         }
         
         void setSlowness(const std::vector<T1>& s) {
@@ -99,6 +104,7 @@ namespace ttcr {
             for ( size_t n=0; n<slowness.size(); ++n ) {
                 slowness[n] = s[n];
             }
+            this->slownessChanged();
         }
         
         void getSlowness(std::vector<T1>& s) const {
@@ -110,13 +116,33 @@ namespace ttcr {
             }
         }
 
-        void setSourceRadius(const double r) { source_radius = r; }
+        void setSourceRadius(const double r) {
+            if ( r != source_radius ) {
+                source_radius = r;
+                this->slownessChanged();
+            }
+        }
+        // solve the factored eikonal equation (single point source)
+        void setFactored(const bool f) {
+            if ( f != factored ) {
+                factored = f;
+                this->slownessChanged();
+            }
+        }
         
+    protected:
+        void getMisfitGradientLocal(const std::vector<sxyz<T1>>& Rx,
+                                    const std::vector<T1>& r,
+                                    std::vector<T1>& grad,
+                                    const size_t threadNo=0) const;
+        
+    public:
         void setTT(const T1 tt, const size_t nn, const size_t nt=0) {
             nodes[nn].setTT(tt, nt);
         }
         
         size_t getNumberOfNodes() const { return nodes.size(); }
+        size_t getNumberOfCells() const { return tetrahedra.size(); }
 
         void getTT(std::vector<T1>& tt, const size_t threadNo=0) const final {
             tt.resize(nPrimary);
@@ -129,37 +155,37 @@ namespace ttcr {
             T1 xmin = nodes[0].getX();
             for ( auto it=nodes.begin(); it!=nodes.end(); ++it )
                 xmin = xmin<it->getX() ? xmin : it->getX();
-            return xmin;
+            return static_cast<T1>(xmin+this->origin.x);
         }
         const T1 getXmax() const {
             T1 xmax = nodes[0].getX();
             for ( auto it=nodes.begin(); it!=nodes.end(); ++it )
                 xmax = xmax>it->getX() ? xmax : it->getX();
-            return xmax;
+            return static_cast<T1>(xmax+this->origin.x);
         }
         const T1 getYmin() const {
             T1 ymin = nodes[0].getY();
             for ( auto it=nodes.begin(); it!=nodes.end(); ++it )
                 ymin = ymin<it->getY() ? ymin : it->getY();
-            return ymin;
+            return static_cast<T1>(ymin+this->origin.y);
         }
         const T1 getYmax() const {
             T1 ymax = nodes[0].getY();
             for ( auto it=nodes.begin(); it!=nodes.end(); ++it )
                 ymax = ymax>it->getY() ? ymax : it->getY();
-            return ymax;
+            return static_cast<T1>(ymax+this->origin.y);
         }
         const T1 getZmin() const {
             T1 zmin = nodes[0].getZ();
             for ( auto it=nodes.begin(); it!=nodes.end(); ++it )
                 zmin = zmin<it->getZ() ? zmin : it->getZ();
-            return zmin;
+            return static_cast<T1>(zmin+this->origin.z);
         }
         const T1 getZmax() const {
             T1 zmax = nodes[0].getZ();
             for ( auto it=nodes.begin(); it!=nodes.end(); ++it )
                 zmax = zmax>it->getZ() ? zmax : it->getZ();
-            return zmax;
+            return static_cast<T1>(zmax+this->origin.z);
         }
         
         void getRaypath(const std::vector<sxyz<T1>>& Tx,
@@ -168,6 +194,25 @@ namespace ttcr {
                         std::vector<sxyz<T1>> &r_data,
                         T1 &tt,
                         const size_t threadNo) const;
+
+        void getRaypath(const std::vector<sxyz<T1>>& Tx,
+                        const std::vector<T1>& t0,
+                        const sxyz<T1> &Rx,
+                        std::vector<siv<T1>> &l_data,
+                        T1 &tt,
+                        const size_t threadNo) const {
+            std::vector<sxyz<T1>> r_data;
+            getRaypath(Tx, t0, Rx, r_data, l_data, tt, threadNo);
+        }
+
+        // l_data holds the length of the raypath segments in each cell
+        void getRaypath(const std::vector<sxyz<T1>>& Tx,
+                        const std::vector<T1>& t0,
+                        const sxyz<T1> &Rx,
+                        std::vector<sxyz<T1>> &r_data,
+                        std::vector<siv<T1>> &l_data,
+                        T1 &tt,
+                        const size_t threadNo) const;
         
         void saveTT(const std::string &, const int, const size_t nt=0,
                     const int format=1) const;
@@ -187,16 +232,86 @@ namespace ttcr {
                 os << nodes[n].getX() << ' ' << nodes[n].getY() << ' ' << nodes[n].getZ() << '\n';
             }
         }
+        void getSecondaryNodes(std::vector<sxyz<T1>>& pts) const {
+            pts.resize( nodes.size()-nPrimary );
+            for ( size_t n=nPrimary; n<nodes.size(); ++n ) {
+                pts[n-nPrimary] = sxyz<T1>(nodes[n]);
+            }
+        }
+
+        void setNodeNumbering(const std::vector<T2>& i2e) {
+            if ( i2e.size() != nPrimary ) {
+                throw std::length_error("Error: node numbering and mesh of incompatible size.");
+            }
+            nodeOrder.resize( i2e.size() );
+            for ( size_t n=0; n<i2e.size(); ++n ) {
+                nodeOrder[ i2e[n] ] = static_cast<T2>(n);
+            }
+        }
+
+        void saveSnapshot(std::ostream&) const;
+        void loadSnapshot(std::istream&);
+
+        // type of grid and parameters it was built with, saved in snapshots
+        // so that these are restored only in grids built alike
+        virtual std::string getSnapshotTag() const { return "Grid3Duc"; }
+        virtual void getSnapshotParameters(std::vector<double>& p) const {
+            p = { static_cast<double>(rp_method),
+                static_cast<double>(this->tt_from_rp),
+                static_cast<double>(min_dist) };
+        }
 
     protected:
+        void getSnapshotHeader(snapshotHeader& h) const {
+            h.tag = getSnapshotTag();
+            getSnapshotParameters(h.parameters);
+            h.inputHash = snapshotInputHash(std::vector<sxyz<T1>>(nodes.begin(), nodes.begin()+nPrimary),
+                                            tetrahedra);
+        }
+
         int rp_method;
         T2 nPrimary;
         T1 source_radius;
         T1 min_dist;
         mutable std::vector<NODE> nodes;
+        std::vector<T2> nodeOrder;  // nodes in the order of the model file
         std::vector<T1> slowness;
         std::vector<tetrahedronElem<T2>> tetrahedra;
         
+        bool factored;
+        // source of the factored equation, for each thread
+        mutable std::vector<FactoredSource<T1>> factoredSrc;
+        // sources of the last raytrace, for each thread
+        mutable std::vector<std::vector<sxyz<T1>>> srcTx;
+        
+        void initSource(const std::vector<sxyz<T1>>& Tx,
+                        const std::vector<T1>& t0,
+                        const size_t threadNo) const {
+            srcTx[threadNo] = Tx;
+            if ( factored && Tx.size() == 1 ) {
+                factoredSrc[threadNo].set(Tx[0], slowness[getCellNo(Tx[0])], t0[0]);
+            } else {
+                factoredSrc[threadNo].active = false;
+            }
+        }
+        
+        bool getTTState(std::vector<T1>& state, const size_t threadNo) const {
+            state.resize( nodes.size() );
+            for ( size_t n=0; n<nodes.size(); ++n ) {
+                state[n] = nodes[n].getTT(threadNo);
+            }
+            return true;
+        }
+        void setTTState(const std::vector<sxyz<T1>>& Tx,
+                        const std::vector<T1>& t0,
+                        const std::vector<T1>& state,
+                        const size_t threadNo) const {
+            for ( size_t n=0; n<nodes.size(); ++n ) {
+                nodes[n].setTT(state[n], threadNo);
+            }
+            initSource(Tx, t0, threadNo);
+        }
+        
         T1 computeDt(const NODE& source, const sxyz<T1>& node,
                      const size_t cellNo) const {
             return slowness[cellNo] * source.getDistance( node );
@@ -211,6 +326,10 @@ namespace ttcr {
                          const std::vector<NODE>& nodes,
                          const size_t threadNo) const;
         
+        T1 getTraveltimeAt(const sxyz<T1>& pt, const size_t threadNo) const {
+            return getTraveltime(pt, this->nodes, threadNo);
+        }
+        
         T1 getTraveltime(const sxyz<T1>& Rx,
                          const std::vector<NODE>& nodes,
                          T2& nodeParentRx,
@@ -229,6 +348,7 @@ namespace ttcr {
                             const int, const size_t);
 
         void localUpdate3D(NODE *vertexC, const size_t threadNo) const;
+        T1 localSolution3D(const NODE *vertexC, const size_t threadNo) const;
         
         T1 localUpdate2D(const NODE *vertexA,
                          const NODE *vertexB,
@@ -762,32 +882,34 @@ namespace ttcr {
     
     
     template<typename T1, typename T2, typename NODE>
-    bool Grid3Duc<T1,T2,NODE>::insideTetrahedron(const sxyz<T1>& v, const T2 nt) const {
+    bool Grid3Duc<T1,T2,NODE>::insideTetrahedron(const sxyz<T1>& p, const T2 nt) const {
+        typedef typename solver_type<T1>::type TS;
+        const sxyz<TS> v = { p.x, p.y, p.z };
         
         
         // from http://steve.hollasch.net/cgindex/geometry/ptintet.html
         
-        sxyz<T1> v1 = { nodes[ tetrahedra[nt].i[0] ].getX(),
+        sxyz<TS> v1 = { nodes[ tetrahedra[nt].i[0] ].getX(),
             nodes[ tetrahedra[nt].i[0] ].getY(),
             nodes[ tetrahedra[nt].i[0] ].getZ() };
         
-        sxyz<T1> v2 = { nodes[ tetrahedra[nt].i[1] ].getX(),
+        sxyz<TS> v2 = { nodes[ tetrahedra[nt].i[1] ].getX(),
             nodes[ tetrahedra[nt].i[1] ].getY(),
             nodes[ tetrahedra[nt].i[1] ].getZ() };
         
-        sxyz<T1> v3 = { nodes[ tetrahedra[nt].i[2] ].getX(),
+        sxyz<TS> v3 = { nodes[ tetrahedra[nt].i[2] ].getX(),
             nodes[ tetrahedra[nt].i[2] ].getY(),
             nodes[ tetrahedra[nt].i[2] ].getZ() };
         
-        sxyz<T1> v4 = { nodes[ tetrahedra[nt].i[3] ].getX(),
+        sxyz<TS> v4 = { nodes[ tetrahedra[nt].i[3] ].getX(),
             nodes[ tetrahedra[nt].i[3] ].getY(),
             nodes[ tetrahedra[nt].i[3] ].getZ() };
         
-        T1 D0 = det4(v1, v2, v3, v4);
-        T1 D1 = det4( v, v2, v3, v4);
-        T1 D2 = det4(v1,  v, v3, v4);
-        T1 D3 = det4(v1, v2,  v, v4);
-        T1 D4 = det4(v1, v2, v3,  v);
+        TS D0 = det4(v1, v2, v3, v4);
+        TS D1 = det4( v, v2, v3, v4);
+        TS D2 = det4(v1,  v, v3, v4);
+        TS D3 = det4(v1, v2,  v, v4);
+        TS D4 = det4(v1, v2, v3,  v);
         
         int t1 = (signum(D0)==signum(D1));
         int t2 = (signum(D0)==signum(D2));
@@ -828,10 +950,11 @@ namespace ttcr {
                 nMax = static_cast<T2>(nodes.size());
             }
             for ( T2 n=0; n<nMax; ++n ) {
-                fout << nodes[n].getX() << '\t'
-                << nodes[n].getY() << '\t'
-                << nodes[n].getZ() << '\t'
-                << nodes[n].getTT(nt) << '\n';
+                const T2 i = n<nodeOrder.size() ? nodeOrder[n] : n;
+                fout << nodes[i].getX()+this->origin.x << '\t'
+                << nodes[i].getY()+this->origin.y << '\t'
+                << nodes[i].getZ()+this->origin.z << '\t'
+                << nodes[i].getTT(nt) << '\n';
             }
             fout.close();
         } else if ( format == 2 ) {
@@ -852,9 +975,9 @@ namespace ttcr {
             double xyz[3];
             T2 nMax = nPrimary;  // only primary are saved
             for (size_t n=0; n<nMax; ++n) {
-                xyz[0] = nodes[n].getX();
-                xyz[1] = nodes[n].getY();
-                xyz[2] = nodes[n].getZ();
+                xyz[0] = nodes[n].getX()+this->origin.x;
+                xyz[1] = nodes[n].getY()+this->origin.y;
+                xyz[2] = nodes[n].getZ()+this->origin.z;
                 newPts->InsertPoint(n, xyz);
                 newScalars->InsertValue(n, nodes[n].getTT(nt) );
             }
@@ -891,7 +1014,10 @@ namespace ttcr {
                 nMax = static_cast<T2>(nodes.size());
             }
             for ( T2 n=0; n<nMax; ++n ) {
-                T1 tmp[] = { nodes[n].getX(), nodes[n].getY(), nodes[n].getZ(), nodes[n].getTT(nt) };
+                const T2 i = n<nodeOrder.size() ? nodeOrder[n] : n;
+                T1 tmp[] = { static_cast<T1>(nodes[i].getX()+this->origin.x),
+                    static_cast<T1>(nodes[i].getY()+this->origin.y),
+                    static_cast<T1>(nodes[i].getZ()+this->origin.z), nodes[i].getTT(nt) };
                 fout.write( (char*)tmp, 4*sizeof(T1) );
             }
             fout.close();
@@ -915,9 +1041,9 @@ namespace ttcr {
         double xyz[3];
         T2 nMax = nPrimary;  // only primary are saved
         for (size_t n=0; n<nMax; ++n) {
-            xyz[0] = nodes[n].getX();
-            xyz[1] = nodes[n].getY();
-            xyz[2] = nodes[n].getZ();
+            xyz[0] = nodes[n].getX()+this->origin.x;
+            xyz[1] = nodes[n].getY()+this->origin.y;
+            xyz[2] = nodes[n].getZ()+this->origin.z;
             newPts->InsertPoint(n, xyz);
         }
         
@@ -1166,11 +1292,22 @@ namespace ttcr {
     template<typename T1, typename T2, typename NODE>
     void Grid3Duc<T1,T2,NODE>::localUpdate3D(NODE *vertexD,
                                              const size_t threadNo) const {
+        T1 t = localSolution3D(vertexD, threadNo);
+        if ( t<vertexD->getTT(threadNo) )
+            vertexD->setTT(t, threadNo);
+    }
+    
+    template<typename T1, typename T2, typename NODE>
+    T1 Grid3Duc<T1,T2,NODE>::localSolution3D(const NODE *vertexD,
+                                             const size_t threadNo) const {
+        typedef typename solver_type<T1>::type TS;
         
         // méthode of Lelievre et al. 2011
+        // (the node is not modified, the smallest solution is returned)
         
         T2 iA, iB, iC, iD;
         NODE *vertexA, *vertexB, *vertexC;
+        TS tD = std::numeric_limits<T1>::max();
         
         for ( size_t no=0; no<vertexD->getOwners().size(); ++no ) {
             
@@ -1200,50 +1337,50 @@ namespace ttcr {
                 continue;
             }
             
-            T1 tABC = std::numeric_limits<T1>::max();
+            TS tABC = std::numeric_limits<T1>::max();
             
             if ( vertexB->getTT(threadNo) != std::numeric_limits<T1>::max() &&
                 vertexC->getTT(threadNo) != std::numeric_limits<T1>::max() ) {
                 
                 // defined in text between eq 13 & eq 14
-                T1 u = vertexB->getTT(threadNo) - vertexA->getTT(threadNo);
-                T1 v = vertexC->getTT(threadNo) - vertexA->getTT(threadNo);
+                TS u = vertexB->getTT(threadNo) - vertexA->getTT(threadNo);
+                TS v = vertexC->getTT(threadNo) - vertexA->getTT(threadNo);
                 
-                sxyz<T1> v_b = { vertexC->getX() - vertexA->getX(),
+                sxyz<TS> v_b = { vertexC->getX() - vertexA->getX(),
                     vertexC->getY() - vertexA->getY(),
                     vertexC->getZ() - vertexA->getZ() };
-                sxyz<T1> v_c = { vertexB->getX() - vertexA->getX(),
+                sxyz<TS> v_c = { vertexB->getX() - vertexA->getX(),
                     vertexB->getY() - vertexA->getY(),
                     vertexB->getZ() - vertexA->getZ() };
                 
-                T1 b = norm( v_b );
-                T1 c = norm( v_c );
-                T1 d2 = dot(v_b, v_c);  // eq 15
+                TS b = norm( v_b );
+                TS c = norm( v_c );
+                TS d2 = dot(v_b, v_c);  // eq 15
                 
-                T1 alpha = acos( d2 / (b*c) );
+                TS alpha = acos( d2 / (b*c) );
                 
-                T1 phi = c*b*sin(alpha);  // eq 23a
+                TS phi = c*b*sin(alpha);  // eq 23a
                 
-                T1 w_tilde = sqrt( slowness[tetNo]*slowness[tetNo]*phi*phi -
+                TS w_tilde = sqrt( slowness[tetNo]*slowness[tetNo]*phi*phi -
                                   u*u*b*b - v*v*c*c + 2.*u*v*d2 );  // eq 23b
                 
                 // project D on plane
                 
-                sxyz<T1> v_n = cross(v_b, v_c);
+                sxyz<TS> v_n = cross(v_b, v_c);
                 
-                T1 d_tmp = -vertexA->getX()*v_n.x - vertexA->getY()*v_n.y - vertexA->getZ()*v_n.z;
+                TS d_tmp = -vertexA->getX()*v_n.x - vertexA->getY()*v_n.y - vertexA->getZ()*v_n.z;
                 
-                T1 k = -(d_tmp + v_n.x*vertexD->getX() + v_n.y*vertexD->getY() + v_n.z*vertexD->getZ())/
+                TS k = -(d_tmp + v_n.x*vertexD->getX() + v_n.y*vertexD->getY() + v_n.z*vertexD->getZ())/
                 norm2(v_n);
                 
-                sxyz<T1> pt;
+                sxyz<TS> pt;
                 pt.x = vertexD->getX() + k*v_n.x;
                 pt.y = vertexD->getY() + k*v_n.y;
                 pt.z = vertexD->getZ() + k*v_n.z;
                 
-                T1 rho0 = vertexD->getDistance( pt );
+                TS rho0 = norm( sxyz<TS>(*vertexD) - pt );
                 
-                sxyz<T1> v_pt = {pt.x-vertexA->getX(), pt.y-vertexA->getY(), pt.z-vertexA->getZ()};
+                sxyz<TS> v_pt = {pt.x-vertexA->getX(), pt.y-vertexA->getY(), pt.z-vertexA->getZ()};
                 
                 // project point on AB
                 
@@ -1253,7 +1390,7 @@ namespace ttcr {
 //                pt.z = vertexA->getZ() + k*v_c.z;
 //                
 //                T1 xi0 = vertexA->getDistance( pt )/c;
-                T1 xi0 = dot(v_pt,v_c)/dot(v_c,v_c);
+                TS xi0 = dot(v_pt,v_c)/dot(v_c,v_c);
                 
                 // project point on AC
                 
@@ -1263,17 +1400,17 @@ namespace ttcr {
 //                pt.z = vertexA->getZ() + k*v_b.z;
 //                
 //                T1 zeta0 = vertexA->getDistance( pt )/b;
-                T1 zeta0 = dot(v_pt,v_b)/dot(v_b,v_b);
+                TS zeta0 = dot(v_pt,v_b)/dot(v_b,v_b);
                 
                 
-                T1 beta = u*b*b - v*d2;    // from eq 19
-                T1 gamma = v*c*c - u*d2;
+                TS beta = u*b*b - v*d2;    // from eq 19
+                TS gamma = v*c*c - u*d2;
                 
-                T1 xi_tilde = -std::abs(beta)*rho0/(phi*w_tilde);      // eq 22a
-                T1 zeta_tilde = -std::abs(gamma)*rho0/(phi*w_tilde);   // eq 22b
+                TS xi_tilde = -std::abs(beta)*rho0/(phi*w_tilde);      // eq 22a
+                TS zeta_tilde = -std::abs(gamma)*rho0/(phi*w_tilde);   // eq 22b
                 
-                T1 xi = xi_tilde + xi0;         // defined in text between eq 13 & eq 14
-                T1 zeta = zeta_tilde + zeta0;
+                TS xi = xi_tilde + xi0;         // defined in text between eq 13 & eq 14
+                TS zeta = zeta_tilde + zeta0;
                 
                 if ( 0.<xi && xi<1. && 0.<zeta && zeta<1. && 0.<(xi+zeta) && (xi+zeta)<1. ) {
                     // eq 25
@@ -1281,7 +1418,17 @@ namespace ttcr {
                 }
             }
             
-            T1 t = vertexA->getTT(threadNo) + slowness[tetNo] * vertexD->getDistance( *vertexA );
+            if ( factoredSrc[threadNo].active &&
+                vertexB->getTT(threadNo) != std::numeric_limits<T1>::max() &&
+                vertexC->getTT(threadNo) != std::numeric_limits<T1>::max() ) {
+                TS t = factoredUpdate(factoredSrc[threadNo], sxyz<T1>(*vertexD), slowness[tetNo],
+                                      sxyz<T1>(*vertexA), vertexA->getTT(threadNo),
+                                      sxyz<T1>(*vertexB), vertexB->getTT(threadNo),
+                                      sxyz<T1>(*vertexC), vertexC->getTT(threadNo));
+                if ( t < tABC ) tABC = t;
+            }
+            
+            TS t = vertexA->getTT(threadNo) + slowness[tetNo] * vertexD->getDistance( *vertexA );
             if ( t < tABC ) tABC = t;
             t = vertexB->getTT(threadNo) + slowness[tetNo] * vertexD->getDistance( *vertexB );
             if ( t < tABC ) tABC = t;
@@ -1295,10 +1442,11 @@ namespace ttcr {
             t = localUpdate2D(vertexB, vertexC, vertexD, tetNo, threadNo);
             if ( t < tABC ) tABC = t;
             
-            if ( tABC<vertexD->getTT(threadNo) )
-                vertexD->setTT(tABC, threadNo);
+            if ( tABC<tD )
+                tD = tABC;
             
         }
+        return tD;
     }
     
     
@@ -1308,42 +1456,43 @@ namespace ttcr {
                                            const NODE *vertexC,
                                            const T2 tetNo,
                                            const size_t threadNo) const {
+        typedef typename solver_type<T1>::type TS;
         
         if ( vertexB->getTT(threadNo)==std::numeric_limits<T1>::max() &&
             vertexA->getTT(threadNo)==std::numeric_limits<T1>::max() ) {
             return std::numeric_limits<T1>::max();
         }
-        T1 t;
+        TS t;
         
-        T1 u = vertexB->getTT(threadNo) - vertexA->getTT(threadNo);
+        TS u = vertexB->getTT(threadNo) - vertexA->getTT(threadNo);
         
-        sxyz<T1> v_b = { vertexC->getX() - vertexA->getX(),
+        sxyz<TS> v_b = { vertexC->getX() - vertexA->getX(),
             vertexC->getY() - vertexA->getY(),
             vertexC->getZ() - vertexA->getZ() };
-        sxyz<T1> v_c = { vertexB->getX() - vertexA->getX(),
+        sxyz<TS> v_c = { vertexB->getX() - vertexA->getX(),
             vertexB->getY() - vertexA->getY(),
             vertexB->getZ() - vertexA->getZ() };
         
-        T1 c = norm( v_c );
+        TS c = norm( v_c );
         
-        T1 w2 = slowness[tetNo]*slowness[tetNo]*c*c - u*u;
+        TS w2 = slowness[tetNo]*slowness[tetNo]*c*c - u*u;
         if ( w2 < 0.0 ) {
             return std::numeric_limits<T1>::max();
         }
         
-        T1 w = sqrt( w2 );
+        TS w = sqrt( w2 );
         
-        T1 k = dot(v_b,v_c)/dot(v_c,v_c);
-        sxyz<T1> pt;
+        TS k = dot(v_b,v_c)/dot(v_c,v_c);
+        sxyz<TS> pt;
         pt.x = vertexA->getX() + k*v_c.x;
         pt.y = vertexA->getY() + k*v_c.y;
         pt.z = vertexA->getZ() + k*v_c.z;
         
-        T1 rho0 = vertexC->getDistance( pt );
+        TS rho0 = norm( sxyz<TS>(*vertexC) - pt );
 //        T1 xi0 = vertexA->getDistance( pt )/c;
-        T1 xi0 = k;
+        TS xi0 = k;
         
-        T1 xi = xi0 - u*rho0/(w*c);
+        TS xi = xi0 - u*rho0/(w*c);
         
         if ( 0.<xi && xi<1. ) {
             t = vertexA->getTT(threadNo) + u*xi0 + w*rho0/c;
@@ -2304,10 +2453,12 @@ namespace ttcr {
                     break;
                 }
                 
-                if ( foundIntersection == false ) {
+                if ( foundIntersection == false &&
+                    findAdjacentCell2(faceNodes, cellNo) != std::numeric_limits<T2>::max() ) {
                     
                     // we must be on an face with gradient pointing slightly outward tetrahedron
-                    // return in other cell but keep gradient
+                    // return in other cell but keep gradient (there is no other cell on
+                    // external faces, we then go outside the mesh, see below)
                     cellNo = findAdjacentCell2(faceNodes, cellNo);
                     
                     std::array<T2,4> itmp = getPrimary(cellNo);
@@ -3156,10 +3307,12 @@ namespace ttcr {
                     break;
                 }
                 
-                if ( foundIntersection == false ) {
+                if ( foundIntersection == false &&
+                    findAdjacentCell2(faceNodes, cellNo) != std::numeric_limits<T2>::max() ) {
                     
                     // we must be on an face with gradient pointing slightly outward tetrahedron
-                    // return in other cell but keep gradient
+                    // return in other cell but keep gradient (there is no other cell on
+                    // external faces, we then go outside the mesh, see below)
                     cellNo = findAdjacentCell2(faceNodes, cellNo);
                     
                     std::array<T2,4> itmp = getPrimary(cellNo);
@@ -3420,6 +3573,65 @@ namespace ttcr {
         delete grad3d;
     }
     
+    template<typename T1, typename T2, typename NODE>
+    void Grid3Duc<T1,T2,NODE>::getRaypath(const std::vector<sxyz<T1>>& Tx,
+                                          const std::vector<T1>& t0,
+                                          const sxyz<T1> &Rx,
+                                          std::vector<sxyz<T1>> &r_data,
+                                          std::vector<siv<T1>> &l_data,
+                                          T1 &tt,
+                                          const size_t threadNo) const {
+
+        const size_t n0 = r_data.size();
+        getRaypath(Tx, t0, Rx, r_data, tt, threadNo);
+
+        // The segments join points on the faces, edges or nodes of the
+        // cells; the cell of a segment is the one containing its midpoint,
+        // looked for among the cells sharing a node with the previous one.
+        siv<T1> cell;
+        cell.i = std::numeric_limits<T2>::max();
+        for ( size_t n=n0+1; n<r_data.size(); ++n ) {
+            cell.v = r_data[n].getDistance( r_data[n-1] );
+            if ( cell.v == 0.0 ) continue;
+            sxyz<T1> mid = static_cast<T1>(0.5) * (r_data[n-1] + r_data[n]);
+
+            T1 wbest = -std::numeric_limits<T1>::max();
+            T2 cbest = 0;
+            if ( cell.i != std::numeric_limits<T2>::max() ) {
+                for ( size_t k=0; k<4; ++k ) {
+                    const std::vector<T2>& owners = nodes[ tetrahedra[cell.i].i[k] ].getOwners();
+                    for ( size_t no=0; no<owners.size(); ++no ) {
+                        sxyz<T1> x[4];
+                        for ( size_t m=0; m<4; ++m ) {
+                            x[m] = nodes[ tetrahedra[owners[no]].i[m] ];
+                        }
+                        T1 w[4];
+                        barycentric(mid, x, w);
+                        T1 wmin = std::min(std::min(w[0], w[1]), std::min(w[2], w[3]));
+                        if ( wmin > wbest ) {
+                            wbest = wmin;
+                            cbest = owners[no];
+                        }
+                    }
+                }
+            }
+            cell.i = wbest > -small ? cbest : getCellNo( mid );
+
+            bool found=false;
+            for ( size_t nc=0; nc<l_data.size(); ++nc ) {
+                if ( l_data[nc].i == cell.i ) {
+                    l_data[nc].v += cell.v;
+                    found = true;
+                    break;
+                }
+            }
+            if ( found == false ) {
+                l_data.push_back( cell );
+            }
+        }
+        sort(l_data.begin(), l_data.end(), CompareSiv_i<T1>());
+    }
+
     template<typename T1, typename T2, typename NODE>
     void Grid3Duc<T1,T2,NODE>::getRaypath(const std::vector<sxyz<T1>>& Tx,
                                           const std::vector<T1>& t0,
@@ -3981,10 +4193,12 @@ namespace ttcr {
                     break;
                 }
                 
-                if ( foundIntersection == false ) {
+                if ( foundIntersection == false &&
+                    findAdjacentCell2(faceNodes, cellNo) != std::numeric_limits<T2>::max() ) {
                     
                     // we must be on an face with gradient pointing slightly outward tetrahedron
-                    // return in other cell but keep gradient
+                    // return in other cell but keep gradient (there is no other cell on
+                    // external faces, we then go outside the mesh, see below)
                     cellNo = findAdjacentCell2(faceNodes, cellNo);
                     
                     std::array<T2,4> itmp = getPrimary(cellNo);
@@ -4988,6 +5202,195 @@ namespace ttcr {
         }
         return found;
     }
+
+    template<typename T1, typename T2, typename NODE>
+    void Grid3Duc<T1,T2,NODE>::saveSnapshot(std::ostream& os) const {
+        snapshotHeader h;
+        getSnapshotHeader(h);
+        writeSnapshotHeader<T1,T2>(os, h);
+        writeSnapshotValue(os, nPrimary);
+        writeSnapshotNodes<T1,T2>(os, nodes);
+        writeSnapshotCSR(os, this->neighbors);
+        writeSnapshotTetrahedra(os, tetrahedra);
+        writeSnapshotArray(os, slowness);
+    }
+
+    template<typename T1, typename T2, typename NODE>
+    void Grid3Duc<T1,T2,NODE>::loadSnapshot(std::istream& is) {
+        snapshotHeader h, expected;
+        readSnapshotHeader<T1,T2>(is, h);
+        getSnapshotHeader(expected);
+        checkSnapshotHeader(h, expected);
+        T2 np;
+        std::vector<NODE> no;
+        std::vector<std::vector<T2>> nb;
+        std::vector<tetrahedronElem<T2>> tet;
+        std::vector<T1> s;
+        readSnapshotValue(is, np);
+        readSnapshotNodes<T1,T2>(is, no, this->nThreads);
+        readSnapshotCSR(is, nb);
+        readSnapshotTetrahedra(is, tet);
+        readSnapshotArray(is, s);
+        if ( np > no.size() || nb.size() != tet.size() || s.size() != tet.size() ) {
+            throw std::runtime_error("Error: corrupted snapshot.");
+        }
+        checkSnapshotIndices(nb, no.size());
+        for ( size_t n=0; n<tet.size(); ++n ) {
+            for ( size_t i=0; i<4; ++i ) {
+                if ( tet[n].i[i] >= no.size() ) {
+                    throw std::runtime_error("Error: corrupted snapshot.");
+                }
+            }
+        }
+        for ( size_t n=0; n<no.size(); ++n ) {
+            for ( size_t i=0; i<no[n].getOwners().size(); ++i ) {
+                if ( no[n].getOwners()[i] >= tet.size() ) {
+                    throw std::runtime_error("Error: corrupted snapshot.");
+                }
+            }
+        }
+        if ( snapshotInputHash(std::vector<sxyz<T1>>(no.begin(), no.begin()+np), tet) != h.inputHash ) {
+            throw std::runtime_error("Error: corrupted snapshot.");
+        }
+        nPrimary = np;
+        nodes.swap(no);
+        this->neighbors.swap(nb);
+        tetrahedra.swap(tet);
+        slowness.swap(s);
+    }
+
+
+    template<typename T1, typename T2, typename NODE>
+    void Grid3Duc<T1,T2,NODE>::getMisfitGradientLocal(const std::vector<sxyz<T1>>& Rx,
+                                                      const std::vector<T1>& r,
+                                                      std::vector<T1>& grad,
+                                                      const size_t threadNo) const {
+        
+        // The traveltime at node D is linearized as T_D = sum_k w_k T_k +
+        // s_c*l, where the ray reaching D crosses the face of tetrahedron c
+        // of D at a point of barycentric coordinates w_k, at distance l (see
+        // AdjointState.h).  Nodes around the source have T_D = t0 + s_c*d,
+        // and receivers not on a node have T_Rx = T_k + s_c*d, as in
+        // getTraveltime.
+        const std::vector<sxyz<T1>>& Tx = srcTx[threadNo];
+        if ( Tx.empty() ) {
+            throw std::runtime_error("Error: adjoint-state gradient needs a traveltime field computed with FSM, FIM or FMM.");
+        }
+        if ( r.size() != Rx.size() ) {
+            throw std::length_error("Error: residuals and Rx should have the same size.");
+        }
+        this->checkPts(Rx);
+        
+        const T2 none = std::numeric_limits<T2>::max();
+        std::vector<T1> lambda(nodes.size(), 0.0);
+        grad.assign(slowness.size(), 0.0);
+        
+        for ( size_t nr=0; nr<Rx.size(); ++nr ) {
+            bool onNode = false;
+            for ( size_t nn=0; nn<nodes.size(); ++nn ) {
+                if ( nodes[nn] == Rx[nr] ) {
+                    lambda[nn] += r[nr];
+                    onNode = true;
+                    break;
+                }
+            }
+            if ( onNode ) continue;
+            
+            T2 cellNo = getCellNo( Rx[nr] );
+            T2 nb = none;
+            T1 tt = std::numeric_limits<T1>::max();
+            for ( size_t k=0; k<this->neighbors[cellNo].size(); ++k ) {
+                T2 neibNo = this->neighbors[cellNo][k];
+                T1 t = nodes[neibNo].getTT(threadNo) + computeDt(nodes[neibNo], Rx[nr], cellNo);
+                if ( t < tt ) {
+                    tt = t;
+                    nb = neibNo;
+                }
+            }
+            lambda[nb] += r[nr];
+            grad[cellNo] += r[nr] * nodes[nb].getDistance( Rx[nr] );
+        }
+        
+        // nodes whose traveltime is set directly from the source
+        std::vector<T2> direct(nodes.size(), none);
+        std::vector<bool> isSource(nodes.size(), false);
+        for ( size_t n=0; n<Tx.size(); ++n ) {
+            bool found = false;
+            for ( size_t nn=0; nn<nodes.size(); ++nn ) {
+                if ( nodes[nn] == Tx[n] ) {
+                    isSource[nn] = true;
+                    found = true;
+                    break;
+                }
+            }
+            if ( !found ) {
+                T2 cellNo = getCellNo( Tx[n] );
+                for ( size_t k=0; k<this->neighbors[cellNo].size(); ++k ) {
+                    direct[this->neighbors[cellNo][k]] = static_cast<T2>(n);
+                }
+            }
+        }
+        
+        std::vector<T2> order(nodes.size());
+        for ( size_t n=0; n<order.size(); ++n ) order[n] = static_cast<T2>(n);
+        std::sort(order.begin(), order.end(), [this,threadNo](const T2 a, const T2 b) {
+            return nodes[a].getTT(threadNo) > nodes[b].getTT(threadNo);
+        });
+        
+        for ( size_t no=0; no<order.size(); ++no ) {
+            const T2 nD = order[no];
+            const T1 tD = nodes[nD].getTT(threadNo);
+            if ( lambda[nD] == 0.0 || isSource[nD] ||
+                tD == std::numeric_limits<T1>::max() ) continue;
+            
+            if ( direct[nD] != none ) {
+                const sxyz<T1>& src = Tx[direct[nD]];
+                grad[getCellNo(src)] += lambda[nD] * nodes[nD].getDistance( src );
+                continue;
+            }
+            
+            // incoming ray, as given by the local solution
+            T1 best = std::numeric_limits<T1>::max();
+            T1 err = std::numeric_limits<T1>::max();
+            T1 wBest[3];
+            T2 iBest[3];
+            T2 tetBest = 0;
+            T1 lBest = 0.0;
+            for ( size_t nt=0; nt<nodes[nD].getOwners().size(); ++nt ) {
+                const T2 tetNo = nodes[nD].getOwners()[nt];
+                T2 ind[3];
+                sxyz<T1> x[3];
+                T1 t[3];
+                for ( size_t i=0, k=0; i<4; ++i ) {
+                    if ( tetrahedra[tetNo].i[i] == nD ) continue;
+                    ind[k] = tetrahedra[tetNo].i[i];
+                    x[k] = sxyz<T1>(nodes[ind[k]]);
+                    t[k] = nodes[ind[k]].getTT(threadNo);
+                    k++;
+                }
+                T1 w[3], l;
+                T1 tt = upwindLinearization(sxyz<T1>(nodes[nD]), tD, slowness[tetNo],
+                                            x, t, w, l);
+                if ( std::abs(tt - tD) < err ) {
+                    best = tt;
+                    err = std::abs(tt - tD);
+                    lBest = l;
+                    tetBest = tetNo;
+                    for ( size_t k=0; k<3; ++k ) {
+                        wBest[k] = w[k];
+                        iBest[k] = ind[k];
+                    }
+                }
+            }
+            if ( best == std::numeric_limits<T1>::max() ) continue;
+            
+            grad[tetBest] += lambda[nD] * lBest;
+            for ( size_t k=0; k<3; ++k ) {
+                lambda[iBest[k]] += lambda[nD] * wBest[k];
+            }
+        }
+    }
+    
 }
 
 #endif
@@ -25,9 +25,13 @@
 #ifndef Grid3Ducdsp_h
 #define Grid3Ducdsp_h
 
+#include <algorithm>
+#include <map>
+
 #include "Grid3Duc.h"
 #include "Node3Dc.h"
 #include "Node3Dcd.h"
+#include "TempNodesCache.h"
 
 namespace ttcr {
     
@@ -43,7 +47,9 @@ namespace ttcr {
         nSecondary(ns), nTertiary(nd), nPermanent(0),
         dyn_radius(drad),
         tempNodes(std::vector<std::vector<Node3Dcd<T1,T2>>>(nt)),
-        tempNeighbors(std::vector<std::vector<std::vector<T2>>>(nt))
+        tempNeighbors(std::vector<std::vector<std::vector<T2>>>(nt)),
+        cacheTempNodes(0),
+        tempCache(std::vector<TempNodesCache<T1,T2,Node3Dcd<T1,T2>>>(nt))
         {
             this->buildGridNodes(no, ns, nt);
             this->template buildGridNeighbors<Node3Dc<T1,T2>>(this->nodes);
@@ -57,32 +63,63 @@ namespace ttcr {
         ~Grid3Ducdsp() {
         }
         
-        void raytrace(const std::vector<sxyz<T1>>&,
-                      const std::vector<T1>&,
-                      const std::vector<sxyz<T1>>&,
-                      std::vector<T1>&,
-                      const size_t=0) const;
-        
-        void raytrace(const std::vector<sxyz<T1>>&,
-                      const std::vector<T1>&,
-                      const std::vector<const std::vector<sxyz<T1>>*>&,
-                      std::vector<std::vector<T1>*>&,
-                      const size_t=0) const;
-        
-        void raytrace(const std::vector<sxyz<T1>>&,
-                      const std::vector<T1>&,
-                      const std::vector<sxyz<T1>>&,
-                      std::vector<T1>&,
-                      std::vector<std::vector<sxyz<T1>>>&,
-                      const size_t=0) const;
-        
-        void raytrace(const std::vector<sxyz<T1>>&,
-                      const std::vector<T1>&,
-                      const std::vector<const std::vector<sxyz<T1>>*>&,
-                      std::vector<std::vector<T1>*>&,
-                      std::vector<std::vector<std::vector<sxyz<T1>>>*>&,
-                      const size_t=0) const;
-    
+        std::string getSnapshotTag() const { return "Grid3Ducdsp"; }
+        void getSnapshotParameters(std::vector<double>& p) const {
+            Grid3Duc<T1,T2,Node3Dc<T1,T2>>::getSnapshotParameters(p);
+            p.push_back( nSecondary );
+            p.push_back( nTertiary );
+            p.push_back( dyn_radius );
+        }
+        
+    protected:
+        void raytraceLocal(const std::vector<sxyz<T1>>&,
+                           const std::vector<T1>&,
+                           const std::vector<sxyz<T1>>&,
+                           std::vector<T1>&,
+                           const size_t=0) const;
+        
+        void raytraceLocal(const std::vector<sxyz<T1>>&,
+                           const std::vector<T1>&,
+                           const std::vector<const std::vector<sxyz<T1>>*>&,
+                           std::vector<std::vector<T1>*>&,
+                           const size_t=0) const;
+        
+        void raytraceLocal(const std::vector<sxyz<T1>>&,
+                           const std::vector<T1>&,
+                           const std::vector<sxyz<T1>>&,
+                           std::vector<T1>&,
+                           std::vector<std::vector<sxyz<T1>>>&,
+                           const size_t=0) const;
+        
+        void raytraceLocal(const std::vector<sxyz<T1>>&,
+                           const std::vector<T1>&,
+                           const std::vector<const std::vector<sxyz<T1>>*>&,
+                           std::vector<std::vector<T1>*>&,
+                           std::vector<std::vector<std::vector<sxyz<T1>>>*>&,
+                           const size_t=0) const;
+        
+    public:
+        void setTempNodesCache(const size_t nTx) {
+            cacheTempNodes = nTx;
+            for ( size_t n=0; n<tempCache.size(); ++n )
+                tempCache[n].setCapacity( nTx );
+        }
+
+        void loadSnapshot(std::istream& is) {
+            Grid3Duc<T1,T2,Node3Dc<T1,T2>>::loadSnapshot(is);
+            nPermanent = static_cast<T2>(this->nodes.size());
+            for ( size_t n=0; n<tempNodes.size(); ++n ) {
+                tempNodes[n].clear();
+                tempNeighbors[n].assign(this->tetrahedra.size(), std::vector<T2>());
+                tempCache[n] = TempNodesCache<T1,T2,Node3Dcd<T1,T2>>();
+                tempCache[n].setCapacity( cacheTempNodes );
+            }
+        }
+        
+    protected:
+        // the field depends on temporary nodes, which are not cached
+        bool getTTState(std::vector<T1>&, const size_t) const { return false; }
+        
     private:
         T2 nSecondary;
         T2 nTertiary;
@@ -95,7 +132,12 @@ namespace ttcr {
         mutable std::vector<std::vector<Node3Dcd<T1,T2>>> tempNodes;
         mutable std::vector<std::vector<std::vector<T2>>> tempNeighbors;
         
+        // temporary nodes are reused as long as Tx does not move
+        size_t cacheTempNodes;        // number of previous Tx whose nodes are kept
+        mutable std::vector<TempNodesCache<T1,T2,Node3Dcd<T1,T2>>> tempCache;
+        
         void addTemporaryNodes(const std::vector<sxyz<T1>>&, const size_t) const;
+        void buildTemporaryNodes(const std::vector<sxyz<T1>>&, const size_t) const;
         
         void initQueue(const std::vector<sxyz<T1>>& Tx,
                        const std::vector<T1>& t0,
@@ -114,15 +156,15 @@ namespace ttcr {
                        std::vector<bool>& frozen,
                        const size_t threadNo) const;
         
-        void raytrace(const std::vector<sxyz<T1>>&,
-                      const std::vector<T1>&,
-                      const std::vector<sxyz<T1>>&,
-                      const size_t=0) const;
+        void raytraceLocal(const std::vector<sxyz<T1>>&,
+                           const std::vector<T1>&,
+                           const std::vector<sxyz<T1>>&,
+                           const size_t=0) const;
         
-        void raytrace(const std::vector<sxyz<T1>>&,
-                      const std::vector<T1>&,
-                      const std::vector<const std::vector<sxyz<T1>>*>&,
-                      const size_t=0) const;
+        void raytraceLocal(const std::vector<sxyz<T1>>&,
+                           const std::vector<T1>&,
+                           const std::vector<const std::vector<sxyz<T1>>*>&,
+                           const size_t=0) const;
 
     };
     
@@ -130,14 +172,38 @@ namespace ttcr {
     void Grid3Ducdsp<T1,T2>::addTemporaryNodes(const std::vector<sxyz<T1>>& Tx,
                                                const size_t threadNo) const {
         
-        // clear previously assigned nodes
-        tempNodes[threadNo].clear();
-        for ( size_t nt=0; nt<this->tetrahedra.size(); ++nt ) {
-            tempNeighbors[threadNo][nt].clear();
+        // clear neighbors of previously assigned nodes
+        for ( size_t n=0; n<tempNodes[threadNo].size(); ++n ) {
+            for ( size_t n2=0; n2<tempNodes[threadNo][n].getOwners().size(); ++n2 ) {
+                tempNeighbors[threadNo][ tempNodes[threadNo][n].getOwners()[n2] ].clear();
+            }
+        }
+        
+        if ( tempCache[threadNo].fetch(Tx, tempNodes[threadNo]) ) {
+            // same layout as for a previous call
+            for ( size_t n=0; n<tempNodes[threadNo].size(); ++n ) {
+                tempNodes[threadNo][n].reinit( 0 );
+            }
+        } else {
+            buildTemporaryNodes(Tx, threadNo);
+            tempCache[threadNo].set(Tx, 0);
         }
         
+        for ( T2 n=0; n<tempNodes[threadNo].size(); ++n ) {
+            for ( size_t n2=0; n2<tempNodes[threadNo][n].getOwners().size(); ++n2) {
+                tempNeighbors[threadNo][ tempNodes[threadNo][n].getOwners()[n2] ].push_back(n);
+            }
+        }
+        if ( verbose )
+            std::cout << "  *** thread no " << threadNo << ": " << tempNodes[threadNo].size() << " dynamic nodes were added ***" << std::endl;
+    }
+        
+    template<typename T1, typename T2>
+    void Grid3Ducdsp<T1,T2>::buildTemporaryNodes(const std::vector<sxyz<T1>>& Tx,
+                                                 const size_t threadNo) const {
+        
         // find cells surrounding Tx
-        std::set<T2> txCells;
+        std::vector<T2> txCells;
         for ( size_t nt=0; nt<this->tetrahedra.size(); ++nt ) {
             // centroid of tet
             sxyz<T1> cent = sxyz<T1>(this->nodes[this->tetrahedra[nt].i[0]] +
@@ -147,14 +213,16 @@ namespace ttcr {
             cent *= 0.25;
             for (size_t n=0; n<Tx.size(); ++n) {
                 if ( cent.getDistance(Tx[n]) <= this->dyn_radius ) {
-                    txCells.insert(static_cast<T2>(nt));
+                    txCells.push_back(static_cast<T2>(nt));
                 }
             }
         }
+        std::sort(txCells.begin(), txCells.end());
+        txCells.erase( std::unique(txCells.begin(), txCells.end()), txCells.end() );
         if ( verbose )
             std::cout << "\n  *** thread no " << threadNo << ": found " << txCells.size() << " cells within radius ***" << std::endl;
         
-        std::set<T2> adjacentCells(txCells.begin(), txCells.end());
+        std::vector<T2> adjacentCells;
 
         T2 iNodes[4][3] = {
             {0,1,2},  // (relative) indices of nodes of 1st triangle
@@ -181,7 +249,7 @@ namespace ttcr {
             for ( size_t i=0; i<4; ++i ) {
                 T2 vertex = this->neighbors[*cell][i];
                 for ( size_t c=0; c<this->nodes[vertex].getOwners().size(); ++c ) {
-                    adjacentCells.insert(this->nodes[vertex].getOwners()[c]);
+                    adjacentCells.push_back(this->nodes[vertex].getOwners()[c]);
                 }
             }
 
@@ -306,9 +374,13 @@ namespace ttcr {
             }
         }
 
-        for ( auto cell=txCells.begin(); cell!=txCells.end(); ++cell ) {
-            adjacentCells.erase(*cell);
-        }
+        // keep cells adjacent to, but not within, cells around Tx
+        std::sort(adjacentCells.begin(), adjacentCells.end());
+        adjacentCells.erase( std::unique(adjacentCells.begin(), adjacentCells.end()), adjacentCells.end() );
+        adjacentCells.erase( std::remove_if(adjacentCells.begin(), adjacentCells.end(),
+                                            [&txCells](const T2 c) {
+                                                return std::binary_search(txCells.begin(), txCells.end(), c); }),
+                            adjacentCells.end() );
         for ( auto adj=adjacentCells.begin(); adj!=adjacentCells.end(); ++adj ) {
             for ( T2 ntri=0; ntri<4; ++ntri ) {
                 for ( size_t nl=ntri; nl<3; ++nl ) {
@@ -341,21 +413,13 @@ namespace ttcr {
                 }
             }
         }
-
-        for ( T2 n=0; n<tempNodes[threadNo].size(); ++n ) {
-            for ( size_t n2=0; n2<tempNodes[threadNo][n].getOwners().size(); ++n2) {
-                tempNeighbors[threadNo][ tempNodes[threadNo][n].getOwners()[n2] ].push_back(n);
-            }
-        }
-        if ( verbose )
-            std::cout << "  *** thread no " << threadNo << ": " << tempNodes[threadNo].size() << " dynamic nodes were added ***" << std::endl;
     }
 
     template<typename T1, typename T2>
-    void Grid3Ducdsp<T1,T2>::raytrace(const std::vector<sxyz<T1>>& Tx,
-                                      const std::vector<T1>& t0,
-                                      const std::vector<sxyz<T1>>& Rx,
-                                      const size_t threadNo) const {
+    void Grid3Ducdsp<T1,T2>::raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                                           const std::vector<T1>& t0,
+                                           const std::vector<sxyz<T1>>& Rx,
+                                           const size_t threadNo) const {
         this->checkPts(Tx);
         this->checkPts(Rx);
         
@@ -379,12 +443,12 @@ namespace ttcr {
     }
 
     template<typename T1, typename T2>
-    void Grid3Ducdsp<T1,T2>::raytrace(const std::vector<sxyz<T1>>& Tx,
-                                      const std::vector<T1>& t0,
-                                      const std::vector<sxyz<T1>>& Rx,
-                                      std::vector<T1>& traveltimes,
-                                      const size_t threadNo) const {
-        raytrace(Tx, t0, Rx, threadNo);
+    void Grid3Ducdsp<T1,T2>::raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                                           const std::vector<T1>& t0,
+                                           const std::vector<sxyz<T1>>& Rx,
+                                           std::vector<T1>& traveltimes,
+                                           const size_t threadNo) const {
+        this->computeTT(Tx, t0, Rx, threadNo);
         
         if ( traveltimes.size() != Rx.size() ) {
             traveltimes.resize( Rx.size() );
@@ -402,10 +466,10 @@ namespace ttcr {
     }
 
     template<typename T1, typename T2>
-    void Grid3Ducdsp<T1,T2>::raytrace(const std::vector<sxyz<T1>>& Tx,
-                                      const std::vector<T1>& t0,
-                                      const std::vector<const std::vector<sxyz<T1>>*>& Rx,
-                                      const size_t threadNo) const {
+    void Grid3Ducdsp<T1,T2>::raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                                           const std::vector<T1>& t0,
+                                           const std::vector<const std::vector<sxyz<T1>>*>& Rx,
+                                           const size_t threadNo) const {
         this->checkPts(Tx);
         for ( size_t n=0; n<Rx.size(); ++n )
             this->checkPts(*Rx[n]);
@@ -430,12 +494,12 @@ namespace ttcr {
     }
 
     template<typename T1, typename T2>
-    void Grid3Ducdsp<T1,T2>::raytrace(const std::vector<sxyz<T1>>& Tx,
-                                      const std::vector<T1>& t0,
-                                      const std::vector<const std::vector<sxyz<T1>>*>& Rx,
-                                      std::vector<std::vector<T1>*>& traveltimes,
-                                      const size_t threadNo) const {
-        raytrace(Tx, t0, Rx, threadNo);
+    void Grid3Ducdsp<T1,T2>::raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                                           const std::vector<T1>& t0,
+                                           const std::vector<const std::vector<sxyz<T1>>*>& Rx,
+                                           std::vector<std::vector<T1>*>& traveltimes,
+                                           const size_t threadNo) const {
+        this->computeTT(Tx, t0, Rx, threadNo);
         
         if ( traveltimes.size() != Rx.size() ) {
             traveltimes.resize( Rx.size() );
@@ -457,14 +521,14 @@ namespace ttcr {
     }
     
     template<typename T1, typename T2>
-    void Grid3Ducdsp<T1,T2>::raytrace(const std::vector<sxyz<T1>>& Tx,
-                                      const std::vector<T1>& t0,
-                                      const std::vector<sxyz<T1>>& Rx,
-                                      std::vector<T1>& traveltimes,
-                                      std::vector<std::vector<sxyz<T1>>>& r_data,
-                                      const size_t threadNo) const {
+    void Grid3Ducdsp<T1,T2>::raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                                           const std::vector<T1>& t0,
+                                           const std::vector<sxyz<T1>>& Rx,
+                                           std::vector<T1>& traveltimes,
+                                           std::vector<std::vector<sxyz<T1>>>& r_data,
+                                           const size_t threadNo) const {
         
-        raytrace(Tx, t0, Rx, threadNo);
+        this->computeTT(Tx, t0, Rx, threadNo);
         
         if ( r_data.size() != Rx.size() ) {
             r_data.resize( Rx.size() );
@@ -483,14 +547,14 @@ namespace ttcr {
     }
     
     template<typename T1, typename T2>
-    void Grid3Ducdsp<T1,T2>::raytrace(const std::vector<sxyz<T1>>& Tx,
-                                      const std::vector<T1>& t0,
-                                      const std::vector<const std::vector<sxyz<T1>>*>& Rx,
-                                      std::vector<std::vector<T1>*>& traveltimes,
-                                      std::vector<std::vector<std::vector<sxyz<T1>>>*>& r_data,
-                                      const size_t threadNo) const {
-        
-        raytrace(Tx, t0, Rx, threadNo);
+    void Grid3Ducdsp<T1,T2>::raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                                           const std::vector<T1>& t0,
+                                           const std::vector<const std::vector<sxyz<T1>>*>& Rx,
+                                           std::vector<std::vector<T1>*>& traveltimes,
+                                           std::vector<std::vector<std::vector<sxyz<T1>>>*>& r_data,
+                                           const size_t threadNo) const {
+        
+        this->computeTT(Tx, t0, Rx, threadNo);
         
         if ( r_data.size() != Rx.size() ) {
             r_data.resize( Rx.size() );
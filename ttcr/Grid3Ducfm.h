@@ -71,31 +71,34 @@ namespace ttcr {
         ~Grid3Ducfm() {
         }
         
-        void raytrace(const std::vector<sxyz<T1>>& Tx,
-                     const std::vector<T1>& t0,
-                     const std::vector<sxyz<T1>>& Rx,
-                     std::vector<T1>& traveltimes,
-                     const size_t threadNo=0) const;
-        
-        void raytrace(const std::vector<sxyz<T1>>&,
-                     const std::vector<T1>&,
-                     const std::vector<const std::vector<sxyz<T1>>*>&,
-                     std::vector<std::vector<T1>*>&,
-                     const size_t=0) const;
-        
-        void raytrace(const std::vector<sxyz<T1>>&,
-                     const std::vector<T1>& ,
-                     const std::vector<sxyz<T1>>&,
-                     std::vector<T1>&,
-                     std::vector<std::vector<sxyz<T1>>>&,
-                     const size_t=0) const;
-        
-        void raytrace(const std::vector<sxyz<T1>>&,
-                     const std::vector<T1>&,
-                     const std::vector<const std::vector<sxyz<T1>>*>&,
-                     std::vector<std::vector<T1>*>&,
-                     std::vector<std::vector<std::vector<sxyz<T1>>>*>&,
-                     const size_t=0) const;
+        std::string getSnapshotTag() const { return "Grid3Ducfm"; }
+        
+    protected:
+        void raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                          const std::vector<T1>& t0,
+                          const std::vector<sxyz<T1>>& Rx,
+                          std::vector<T1>& traveltimes,
+                          const size_t threadNo=0) const;
+        
+        void raytraceLocal(const std::vector<sxyz<T1>>&,
+                          const std::vector<T1>&,
+                          const std::vector<const std::vector<sxyz<T1>>*>&,
+                          std::vector<std::vector<T1>*>&,
+                          const size_t=0) const;
+        
+        void raytraceLocal(const std::vector<sxyz<T1>>&,
+                          const std::vector<T1>& ,
+                          const std::vector<sxyz<T1>>&,
+                          std::vector<T1>&,
+                          std::vector<std::vector<sxyz<T1>>>&,
+                          const size_t=0) const;
+        
+        void raytraceLocal(const std::vector<sxyz<T1>>&,
+                          const std::vector<T1>&,
+                          const std::vector<const std::vector<sxyz<T1>>*>&,
+                          std::vector<std::vector<T1>*>&,
+                          std::vector<std::vector<std::vector<sxyz<T1>>>*>&,
+                          const size_t=0) const;
         
     private:
         
@@ -115,14 +118,18 @@ namespace ttcr {
                        std::vector<bool>&,
                        const size_t) const;
         
+        void raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                           const std::vector<T1>& t0,
+                           const std::vector<sxyz<T1>>& Rx,
+                           const size_t threadNo=0) const;
+        
     };
     
     template<typename T1, typename T2>
-    void Grid3Ducfm<T1,T2>::raytrace(const std::vector<sxyz<T1>>& Tx,
-                                     const std::vector<T1>& t0,
-                                     const std::vector<sxyz<T1>>& Rx,
-                                     std::vector<T1>& traveltimes,
-                                     const size_t threadNo) const {
+    void Grid3Ducfm<T1,T2>::raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                                          const std::vector<T1>& t0,
+                                          const std::vector<sxyz<T1>>& Rx,
+                                          const size_t threadNo) const {
         
         this->checkPts(Tx);
         this->checkPts(Rx);
@@ -141,6 +148,16 @@ namespace ttcr {
         initBand(Tx, t0, narrow_band, inQueue, frozen, threadNo);
         
         propagate(narrow_band, inQueue, frozen, threadNo);
+    }
+    
+    template<typename T1, typename T2>
+    void Grid3Ducfm<T1,T2>::raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                                          const std::vector<T1>& t0,
+                                          const std::vector<sxyz<T1>>& Rx,
+                                          std::vector<T1>& traveltimes,
+                                          const size_t threadNo) const {
+        
+        this->computeTT(Tx, t0, Rx, threadNo);
         
         if ( traveltimes.size() != Rx.size() ) {
             traveltimes.resize( Rx.size() );
@@ -158,11 +175,11 @@ namespace ttcr {
     }
     
     template<typename T1, typename T2>
-    void Grid3Ducfm<T1,T2>::raytrace(const std::vector<sxyz<T1>>& Tx,
-                                     const std::vector<T1>& t0,
-                                     const std::vector<const std::vector<sxyz<T1>>*>& Rx,
-                                     std::vector<std::vector<T1>*>& traveltimes,
-                                     const size_t threadNo) const {
+    void Grid3Ducfm<T1,T2>::raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                                          const std::vector<T1>& t0,
+                                          const std::vector<const std::vector<sxyz<T1>>*>& Rx,
+                                          std::vector<std::vector<T1>*>& traveltimes,
+                                          const size_t threadNo) const {
         
         this->checkPts(Tx);
         for ( size_t n=0; n<Rx.size(); ++n )
@@ -203,12 +220,12 @@ namespace ttcr {
     }
     
     template<typename T1, typename T2>
-    void Grid3Ducfm<T1,T2>::raytrace(const std::vector<sxyz<T1>>& Tx,
-                                     const std::vector<T1>& t0,
-                                     const std::vector<sxyz<T1>>& Rx,
-                                     std::vector<T1>& traveltimes,
-                                     std::vector<std::vector<sxyz<T1>>>& r_data,
-                                     const size_t threadNo) const {
+    void Grid3Ducfm<T1,T2>::raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                                          const std::vector<T1>& t0,
+                                          const std::vector<sxyz<T1>>& Rx,
+                                          std::vector<T1>& traveltimes,
+                                          std::vector<std::vector<sxyz<T1>>>& r_data,
+                                          const size_t threadNo) const {
         
         this->checkPts(Tx);
         this->checkPts(Rx);
@@ -245,12 +262,12 @@ namespace ttcr {
     
     
     template<typename T1, typename T2>
-    void Grid3Ducfm<T1,T2>::raytrace(const std::vector<sxyz<T1>>& Tx,
-                                     const std::vector<T1>& t0,
-                                     const std::vector<const std::vector<sxyz<T1>>*>& Rx,
-                                     std::vector<std::vector<T1>*>& traveltimes,
-                                     std::vector<std::vector<std::vector<sxyz<T1>>>*>& r_data,
-                                     const size_t threadNo) const {
+    void Grid3Ducfm<T1,T2>::raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                                          const std::vector<T1>& t0,
+                                          const std::vector<const std::vector<sxyz<T1>>*>& Rx,
+                                          std::vector<std::vector<T1>*>& traveltimes,
+                                          std::vector<std::vector<std::vector<sxyz<T1>>>*>& r_data,
+                                          const size_t threadNo) const {
         
         this->checkPts(Tx);
         for ( size_t n=0; n<Rx.size(); ++n )
@@ -302,6 +319,8 @@ namespace ttcr {
                                      std::vector<bool>& frozen,
                                      const size_t threadNo) const {
         
+        this->initSource(Tx, t0, threadNo);
+        
         for (size_t n=0; n<Tx.size(); ++n) {
             bool found = false;
             for ( size_t nn=0; nn<this->nodes.size(); ++nn ) {
@@ -53,33 +53,43 @@ namespace ttcr {
         ~Grid3Ducfs() {
         }
         
+        std::string getSnapshotTag() const { return "Grid3Ducfs"; }
+        
         void initOrdering(const std::vector<sxyz<T1>>& refPts, const int order);
         
-        void raytrace(const std::vector<sxyz<T1>>& Tx,
-                     const std::vector<T1>& t0,
-                     const std::vector<sxyz<T1>>& Rx,
-                     std::vector<T1>& traveltimes,
-                     const size_t threadNo=0) const;
-        
-        void raytrace(const std::vector<sxyz<T1>>&,
-                     const std::vector<T1>&,
-                     const std::vector<const std::vector<sxyz<T1>>*>&,
-                     std::vector<std::vector<T1>*>&,
-                     const size_t=0) const;
-        
-        void raytrace(const std::vector<sxyz<T1>>&,
-                     const std::vector<T1>& ,
-                     const std::vector<sxyz<T1>>&,
-                     std::vector<T1>&,
-                     std::vector<std::vector<sxyz<T1>>>&,
-                     const size_t=0) const;
-        
-        void raytrace(const std::vector<sxyz<T1>>&,
-                     const std::vector<T1>&,
-                     const std::vector<const std::vector<sxyz<T1>>*>&,
-                     std::vector<std::vector<T1>*>&,
-                     std::vector<std::vector<std::vector<sxyz<T1>>>*>&,
-                     const size_t=0) const;
+        // orderings point to the nodes of the grid, initOrdering must be
+        // called again once the snapshot is loaded
+        void loadSnapshot(std::istream& is) {
+            Grid3Duc<T1,T2,Node3Dc<T1,T2>>::loadSnapshot(is);
+            S.clear();
+        }
+        
+    protected:
+        void raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                          const std::vector<T1>& t0,
+                          const std::vector<sxyz<T1>>& Rx,
+                          std::vector<T1>& traveltimes,
+                          const size_t threadNo=0) const;
+        
+        void raytraceLocal(const std::vector<sxyz<T1>>&,
+                          const std::vector<T1>&,
+                          const std::vector<const std::vector<sxyz<T1>>*>&,
+                          std::vector<std::vector<T1>*>&,
+                          const size_t=0) const;
+        
+        void raytraceLocal(const std::vector<sxyz<T1>>&,
+                          const std::vector<T1>& ,
+                          const std::vector<sxyz<T1>>&,
+                          std::vector<T1>&,
+                          std::vector<std::vector<sxyz<T1>>>&,
+                          const size_t=0) const;
+        
+        void raytraceLocal(const std::vector<sxyz<T1>>&,
+                          const std::vector<T1>&,
+                          const std::vector<const std::vector<sxyz<T1>>*>&,
+                          std::vector<std::vector<T1>*>&,
+                          std::vector<std::vector<std::vector<sxyz<T1>>>*>&,
+                          const size_t=0) const;
         
     private:
         T1 epsilon;
@@ -87,6 +97,11 @@ namespace ttcr {
         mutable int niter_final;
         std::vector<std::vector<Node3Dc<T1,T2>*>> S;
         
+        T1 updateActive(Node3Dc<T1,T2> *vertexC,
+                        const std::vector<bool>& frozen,
+                        std::vector<bool>& active,
+                        const size_t threadNo) const;
+        
         void initTx(const std::vector<sxyz<T1>>& Tx, const std::vector<T1>& t0,
                     std::vector<bool>& frozen, const size_t threadNo) const;
         
@@ -107,15 +122,15 @@ namespace ttcr {
                        std::vector<bool>&,
                        const size_t) const;
         
-        void raytrace(const std::vector<sxyz<T1>>& Tx,
-                      const std::vector<T1>& t0,
-                      const std::vector<sxyz<T1>>& Rx,
-                      const size_t threadNo=0) const;
+        void raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                           const std::vector<T1>& t0,
+                           const std::vector<sxyz<T1>>& Rx,
+                           const size_t threadNo=0) const;
         
-        void raytrace(const std::vector<sxyz<T1>>&,
-                      const std::vector<T1>&,
-                      const std::vector<const std::vector<sxyz<T1>>*>&,
-                      const size_t=0) const;
+        void raytraceLocal(const std::vector<sxyz<T1>>&,
+                           const std::vector<T1>&,
+                           const std::vector<const std::vector<sxyz<T1>>*>&,
+                           const size_t=0) const;
 
     };
     
@@ -149,10 +164,36 @@ namespace ttcr {
     }
     
     template<typename T1, typename T2>
-    void Grid3Ducfs<T1,T2>::raytrace(const std::vector<sxyz<T1>>& Tx,
-                                     const std::vector<T1>& t0,
-                                     const std::vector<sxyz<T1>>& Rx,
-                                     const size_t threadNo) const {
+    T1 Grid3Ducfs<T1,T2>::updateActive(Node3Dc<T1,T2> *vertexC,
+                                       const std::vector<bool>& frozen,
+                                       std::vector<bool>& active,
+                                       const size_t threadNo) const {
+        // nodes are locked (inactive) until one of the nodes of the cells
+        // they belong to is modified
+        T2 n = vertexC->getGridIndex();
+        if ( frozen[n] || !active[n] )
+            return 0.0;
+        active[n] = false;
+        
+        T1 t = vertexC->getTT(threadNo);
+        this->localUpdate3D(vertexC, threadNo);
+        T1 dt = std::abs( t - vertexC->getTT(threadNo) );
+        if ( dt > 0.0 ) {
+            for ( size_t no=0; no<vertexC->getOwners().size(); ++no ) {
+                T2 cellNo = vertexC->getOwners()[no];
+                for ( size_t k=0; k<this->neighbors[cellNo].size(); ++k )
+                    active[ this->neighbors[cellNo][k] ] = true;
+            }
+            active[n] = false;
+        }
+        return dt;
+    }
+    
+    template<typename T1, typename T2>
+    void Grid3Ducfs<T1,T2>::raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                                          const std::vector<T1>& t0,
+                                          const std::vector<sxyz<T1>>& Rx,
+                                          const size_t threadNo) const {
         
         this->checkPts(Tx);
         this->checkPts(Rx);
@@ -164,9 +205,8 @@ namespace ttcr {
         std::vector<bool> frozen( this->nodes.size(), false );
         initTx(Tx, t0, frozen, threadNo);
         
-        std::vector<T1> times( this->nodes.size() );
-        for ( size_t n=0; n<this->nodes.size(); ++n )
-            times[n] = this->nodes[n].getTT( threadNo );
+        // all nodes are active at first
+        std::vector<bool> active( this->nodes.size(), true );
         
         int niter=0;
         T1 change = std::numeric_limits<T1>::max();
@@ -175,37 +215,21 @@ namespace ttcr {
             for ( size_t i=0; i<S.size(); ++i ) {
                 
                 // ascending
+                change = 0.0;
                 for ( auto vertexC=S[i].begin(); vertexC!=S[i].end(); ++vertexC ) {
-                    if ( !frozen[(*vertexC)->getGridIndex()] )
-                        //                    this->local3Dsolver(*vertexC, threadNo);
-                        this->localUpdate3D(*vertexC, threadNo);
+                    change += updateActive(*vertexC, frozen, active, threadNo);
                 }
                 
-                change = 0.0;
-                for ( size_t n=0; n<this->nodes.size(); ++n ) {
-                    T1 dt = std::abs( times[n] - this->nodes[n].getTT(threadNo) );
-                    
-                    change += dt;
-                    times[n] = this->nodes[n].getTT(threadNo);
-                }
                 if ( change < epsilon ) {
                     break;
                 }
                 
                 // descending
+                change = 0.0;
                 for ( auto vertexC=S[i].rbegin(); vertexC!=S[i].rend(); ++vertexC ) {
-                    if ( !frozen[(*vertexC)->getGridIndex()] )
-                        //                    this->local3Dsolver(*vertexC, threadNo);
-                        this->localUpdate3D(*vertexC, threadNo);
+                    change += updateActive(*vertexC, frozen, active, threadNo);
                 }
                 
-                change = 0.0;
-                for ( size_t n=0; n<this->nodes.size(); ++n ) {
-                    T1 dt = std::abs( times[n] - this->nodes[n].getTT(threadNo) );
-                    
-                    change += dt;
-                    times[n] = this->nodes[n].getTT(threadNo);
-                }
                 if ( change < epsilon ) {
                     break;
                 }
@@ -217,13 +241,13 @@ namespace ttcr {
     }
     
     template<typename T1, typename T2>
-    void Grid3Ducfs<T1,T2>::raytrace(const std::vector<sxyz<T1>>& Tx,
-                                     const std::vector<T1>& t0,
-                                     const std::vector<sxyz<T1>>& Rx,
-                                     std::vector<T1>& traveltimes,
-                                     const size_t threadNo) const {
+    void Grid3Ducfs<T1,T2>::raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                                          const std::vector<T1>& t0,
+                                          const std::vector<sxyz<T1>>& Rx,
+                                          std::vector<T1>& traveltimes,
+                                          const size_t threadNo) const {
         
-        raytrace(Tx, t0, Rx, threadNo);
+        this->computeTT(Tx, t0, Rx, threadNo);
         
         if ( traveltimes.size() != Rx.size() ) {
             traveltimes.resize( Rx.size() );
@@ -241,10 +265,10 @@ namespace ttcr {
     }
     
     template<typename T1, typename T2>
-    void Grid3Ducfs<T1,T2>::raytrace(const std::vector<sxyz<T1>>& Tx,
-                                     const std::vector<T1>& t0,
-                                     const std::vector<const std::vector<sxyz<T1>>*>& Rx,
-                                     const size_t threadNo) const {
+    void Grid3Ducfs<T1,T2>::raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                                          const std::vector<T1>& t0,
+                                          const std::vector<const std::vector<sxyz<T1>>*>& Rx,
+                                          const size_t threadNo) const {
         
         this->checkPts(Tx);
         for ( size_t n=0; n<Rx.size(); ++n )
@@ -257,9 +281,8 @@ namespace ttcr {
         std::vector<bool> frozen( this->nodes.size(), false );
         initTx(Tx, t0, frozen, threadNo);
         
-        std::vector<T1> times( this->nodes.size() );
-        for ( size_t n=0; n<this->nodes.size(); ++n )
-            times[n] = this->nodes[n].getTT( threadNo );
+        // all nodes are active at first
+        std::vector<bool> active( this->nodes.size(), true );
         
         int niter=0;
         T1 change = std::numeric_limits<T1>::max();
@@ -268,37 +291,21 @@ namespace ttcr {
             for ( size_t i=0; i<S.size(); ++i ) {
                 
                 // ascending
+                change = 0.0;
                 for ( auto vertexC=S[i].begin(); vertexC!=S[i].end(); ++vertexC ) {
-                    if ( !frozen[(*vertexC)->getGridIndex()] )
-                        //                    this->local3Dsolver(*vertexC, threadNo);
-                        this->localUpdate3D(*vertexC, threadNo);
+                    change += updateActive(*vertexC, frozen, active, threadNo);
                 }
                 
-                change = 0.0;
-                for ( size_t n=0; n<this->nodes.size(); ++n ) {
-                    T1 dt = std::abs( times[n] - this->nodes[n].getTT(threadNo) );
-                    
-                    change += dt;
-                    times[n] = this->nodes[n].getTT(threadNo);
-                }
                 if ( change < epsilon ) {
                     break;
                 }
                 
                 // descending
+                change = 0.0;
                 for ( auto vertexC=S[i].rbegin(); vertexC!=S[i].rend(); ++vertexC ) {
-                    if ( !frozen[(*vertexC)->getGridIndex()] )
-                        //                    this->local3Dsolver(*vertexC, threadNo);
-                        this->localUpdate3D(*vertexC, threadNo);
+                    change += updateActive(*vertexC, frozen, active, threadNo);
                 }
                 
-                change = 0.0;
-                for ( size_t n=0; n<this->nodes.size(); ++n ) {
-                    T1 dt = std::abs( times[n] - this->nodes[n].getTT(threadNo) );
-                    
-                    change += dt;
-                    times[n] = this->nodes[n].getTT(threadNo);
-                }
                 if ( change < epsilon ) {
                     break;
                 }
@@ -311,13 +318,13 @@ namespace ttcr {
     }
     
     template<typename T1, typename T2>
-    void Grid3Ducfs<T1,T2>::raytrace(const std::vector<sxyz<T1>>& Tx,
-                                     const std::vector<T1>& t0,
-                                     const std::vector<const std::vector<sxyz<T1>>*>& Rx,
-                                     std::vector<std::vector<T1>*>& traveltimes,
-                                     const size_t threadNo) const {
+    void Grid3Ducfs<T1,T2>::raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                                          const std::vector<T1>& t0,
+                                          const std::vector<const std::vector<sxyz<T1>>*>& Rx,
+                                          std::vector<std::vector<T1>*>& traveltimes,
+                                          const size_t threadNo) const {
         
-        raytrace(Tx, t0, Rx, threadNo);
+        this->computeTT(Tx, t0, Rx, threadNo);
         
         if ( traveltimes.size() != Rx.size() ) {
             traveltimes.resize( Rx.size() );
@@ -340,14 +347,14 @@ namespace ttcr {
     
     
     template<typename T1, typename T2>
-    void Grid3Ducfs<T1,T2>::raytrace(const std::vector<sxyz<T1>>& Tx,
-                                     const std::vector<T1>& t0,
-                                     const std::vector<sxyz<T1>>& Rx,
-                                     std::vector<T1>& traveltimes,
-                                     std::vector<std::vector<sxyz<T1>>>& r_data,
-                                     const size_t threadNo) const {
+    void Grid3Ducfs<T1,T2>::raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                                          const std::vector<T1>& t0,
+                                          const std::vector<sxyz<T1>>& Rx,
+                                          std::vector<T1>& traveltimes,
+                                          std::vector<std::vector<sxyz<T1>>>& r_data,
+                                          const size_t threadNo) const {
         
-        raytrace(Tx, t0, Rx, threadNo);
+        this->computeTT(Tx, t0, Rx, threadNo);
         
         if ( traveltimes.size() != Rx.size() ) {
             traveltimes.resize( Rx.size() );
@@ -365,14 +372,14 @@ namespace ttcr {
     }
     
     template<typename T1, typename T2>
-    void Grid3Ducfs<T1,T2>::raytrace(const std::vector<sxyz<T1>>& Tx,
-                                     const std::vector<T1>& t0,
-                                     const std::vector<const std::vector<sxyz<T1>>*>& Rx,
-                                     std::vector<std::vector<T1>*>& traveltimes,
-                                     std::vector<std::vector<std::vector<sxyz<T1>>>*>& r_data,
-                                     const size_t threadNo) const {
+    void Grid3Ducfs<T1,T2>::raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                                          const std::vector<T1>& t0,
+                                          const std::vector<const std::vector<sxyz<T1>>*>& Rx,
+                                          std::vector<std::vector<T1>*>& traveltimes,
+                                          std::vector<std::vector<std::vector<sxyz<T1>>>*>& r_data,
+                                          const size_t threadNo) const {
         
-        raytrace(Tx, t0, Rx, threadNo);
+        this->computeTT(Tx, t0, Rx, threadNo);
         
         if ( traveltimes.size() != Rx.size() ) {
             traveltimes.resize( Rx.size() );
@@ -401,6 +408,8 @@ namespace ttcr {
                                    std::vector<bool>& frozen,
                                    const size_t threadNo) const {
         
+        this->initSource(Tx, t0, threadNo);
+        
         for (size_t n=0; n<Tx.size(); ++n) {
             bool found = false;
             for ( size_t nn=0; nn<this->nodes.size(); ++nn ) {
@@ -33,6 +33,7 @@
 #include <queue>
 #include <vector>
 
+#include "EdgeLengths.h"
 #include "Grid3Duc.h"
 #include "Node3Dcsp.h"
 #include "utils.h"
@@ -46,51 +47,112 @@ namespace ttcr {
                    const std::vector<tetrahedronElem<T2>>& tet,
                    const int ns, const bool rptt, const T1 md,
                    const size_t nt=1) :
-        Grid3Duc<T1,T2,Node3Dcsp<T1,T2>>(no, tet, 1, rptt, md, nt)
+        Grid3Duc<T1,T2,Node3Dcsp<T1,T2>>(no, tet, 1, rptt, md, nt),
+        nSecondary(ns),
+        edgeTablesMaxBytes(CellEdgeLengths<T1,T2>::defaultMaxBytes)
         {
             this->buildGridNodes(no, ns, nt);
             this->template buildGridNeighbors<Node3Dcsp<T1,T2>>(this->nodes);
+            buildEdgeLengths();
         }
         
         ~Grid3Ducsp() {
         }
         
-        void raytrace(const std::vector<sxyz<T1>>&,
-                     const std::vector<T1>&,
-                     const std::vector<sxyz<T1>>&,
-                     std::vector<T1>&,
-                     const size_t=0) const;
-        
-        void raytrace(const std::vector<sxyz<T1>>&,
-                     const std::vector<T1>&,
-                     const std::vector<const std::vector<sxyz<T1>>*>&,
-                     std::vector<std::vector<T1>*>&,
-                     const size_t=0) const;
-        
-        void raytrace(const std::vector<sxyz<T1>>&,
-                     const std::vector<T1>& ,
-                     const std::vector<sxyz<T1>>&,
-                     std::vector<T1>&,
-                     std::vector<std::vector<sxyz<T1>>>&,
-                     const size_t=0) const;
-        
-        void raytrace(const std::vector<sxyz<T1>>&,
-                     const std::vector<T1>&,
-                     const std::vector<const std::vector<sxyz<T1>>*>&,
-                     std::vector<std::vector<T1>*>&,
-                     std::vector<std::vector<std::vector<sxyz<T1>>>*>&,
-                     const size_t=0) const;
-        
-        void raytrace(const std::vector<sxyz<T1>>&,
-                     const std::vector<T1>& ,
-                     const std::vector<sxyz<T1>>&,
-                     std::vector<T1>&,
-                     std::vector<std::vector<sxyz<T1>>>&,
-                     std::vector<std::vector<siv<T1>>>&,
-                     const size_t=0) const;
+        void setEdgeTables(const size_t maxBytes) {
+            edgeTablesMaxBytes = maxBytes;
+            buildEdgeLengths();
+        }
+        bool hasEdgeTables() const { return !edgeLengths.empty(); }
+        
+        std::string getSnapshotTag() const { return "Grid3Ducsp"; }
+        void getSnapshotParameters(std::vector<double>& p) const {
+            Grid3Duc<T1,T2,Node3Dcsp<T1,T2>>::getSnapshotParameters(p);
+            p.push_back( nSecondary );
+        }
+        
+        void loadSnapshot(std::istream& is) {
+            Grid3Duc<T1,T2,Node3Dcsp<T1,T2>>::loadSnapshot(is);
+            buildEdgeLengths();
+        }
+        
+    protected:
+        void raytraceLocal(const std::vector<sxyz<T1>>&,
+                          const std::vector<T1>&,
+                          const std::vector<sxyz<T1>>&,
+                          std::vector<T1>&,
+                          const size_t=0) const;
+        
+        void raytraceLocal(const std::vector<sxyz<T1>>&,
+                          const std::vector<T1>&,
+                          const std::vector<const std::vector<sxyz<T1>>*>&,
+                          std::vector<std::vector<T1>*>&,
+                          const size_t=0) const;
+        
+        void raytraceLocal(const std::vector<sxyz<T1>>&,
+                          const std::vector<T1>& ,
+                          const std::vector<sxyz<T1>>&,
+                          std::vector<T1>&,
+                          std::vector<std::vector<sxyz<T1>>>&,
+                          const size_t=0) const;
+        
+        // raypaths are traced back through the parents of the nodes, which
+        // include temporary source nodes
+        void raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                           const std::vector<T1>& t0,
+                           const std::vector<sxyz<T1>>& Rx,
+                           std::vector<T1>& traveltimes,
+                           RayPaths<float,T2>& rays,
+                           const size_t threadNo=0) const {
+            this->appendRaypaths(Tx, t0, Rx, traveltimes, rays, threadNo);
+        }
+        
+        void raytraceLocal(const std::vector<sxyz<T1>>&,
+                          const std::vector<T1>&,
+                          const std::vector<const std::vector<sxyz<T1>>*>&,
+                          std::vector<std::vector<T1>*>&,
+                          std::vector<std::vector<std::vector<sxyz<T1>>>*>&,
+                          const size_t=0) const;
+        
+        void raytraceLocal(const std::vector<sxyz<T1>>&,
+                          const std::vector<T1>& ,
+                          const std::vector<sxyz<T1>>&,
+                          std::vector<T1>&,
+                          std::vector<std::vector<sxyz<T1>>>&,
+                          std::vector<std::vector<siv<T1>>>&,
+                          const size_t=0) const;
+        
+        // the raypaths are obtained while the shortest path tree is traced
+        // back, l_data is thus only held for the current source
+        void raytraceLTrLocal(const std::vector<sxyz<T1>>& Tx,
+                              const std::vector<T1>& t0,
+                              const std::vector<sxyz<T1>>& Rx,
+                              const std::vector<T1>& r,
+                              std::vector<T1>& traveltimes,
+                              std::vector<T1>& LTr,
+                              const size_t threadNo=0) const;
+
+        void raytraceLxLocal(const std::vector<sxyz<T1>>& Tx,
+                             const std::vector<T1>& t0,
+                             const std::vector<sxyz<T1>>& Rx,
+                             const std::vector<T1>& x,
+                             std::vector<T1>& traveltimes,
+                             std::vector<T1>& Lx,
+                             const size_t threadNo=0) const;
         
         
     private:
+        T2 nSecondary;
+        size_t edgeTablesMaxBytes;
+        CellEdgeLengths<T1,T2> edgeLengths;
+        
+        void buildEdgeLengths() {
+            if ( !edgeLengths.build(this->nodes, this->neighbors, edgeTablesMaxBytes) &&
+                edgeTablesMaxBytes > 0 && verbose ) {
+                std::cout << "Tables of edge lengths would exceed " << edgeTablesMaxBytes
+                << " bytes, lengths are computed on the fly.\n";
+            }
+        }
         
         void initQueue(const std::vector<sxyz<T1>>& Tx,
                        const std::vector<T1>& t0,
@@ -121,11 +183,11 @@ namespace ttcr {
     
     
     template<typename T1, typename T2>
-    void Grid3Ducsp<T1,T2>::raytrace(const std::vector<sxyz<T1>>& Tx,
-                                     const std::vector<T1>& t0,
-                                     const std::vector<sxyz<T1>>& Rx,
-                                     std::vector<T1>& traveltimes,
-                                     const size_t threadNo) const {
+    void Grid3Ducsp<T1,T2>::raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                                          const std::vector<T1>& t0,
+                                          const std::vector<sxyz<T1>>& Rx,
+                                          std::vector<T1>& traveltimes,
+                                          const size_t threadNo) const {
         
         this->checkPts(Tx);
         this->checkPts(Rx);
@@ -162,11 +224,11 @@ namespace ttcr {
     }
     
     template<typename T1, typename T2>
-    void Grid3Ducsp<T1,T2>::raytrace(const std::vector<sxyz<T1>>& Tx,
-                                     const std::vector<T1>& t0,
-                                     const std::vector<const std::vector<sxyz<T1>>*>& Rx,
-                                     std::vector<std::vector<T1>*>& traveltimes,
-                                     const size_t threadNo) const {
+    void Grid3Ducsp<T1,T2>::raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                                          const std::vector<T1>& t0,
+                                          const std::vector<const std::vector<sxyz<T1>>*>& Rx,
+                                          std::vector<std::vector<T1>*>& traveltimes,
+                                          const size_t threadNo) const {
         
         this->checkPts(Tx);
         for ( size_t n=0; n<Rx.size(); ++n )
@@ -208,12 +270,12 @@ namespace ttcr {
     }
     
     template<typename T1, typename T2>
-    void Grid3Ducsp<T1,T2>::raytrace(const std::vector<sxyz<T1>>& Tx,
-                                     const std::vector<T1>& t0,
-                                     const std::vector<sxyz<T1>>& Rx,
-                                     std::vector<T1>& traveltimes,
-                                     std::vector<std::vector<sxyz<T1>>>& r_data,
-                                     const size_t threadNo) const {
+    void Grid3Ducsp<T1,T2>::raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                                          const std::vector<T1>& t0,
+                                          const std::vector<sxyz<T1>>& Rx,
+                                          std::vector<T1>& traveltimes,
+                                          std::vector<std::vector<sxyz<T1>>>& r_data,
+                                          const size_t threadNo) const {
         
         this->checkPts(Tx);
         this->checkPts(Rx);
@@ -311,12 +373,12 @@ namespace ttcr {
     }
     
     template<typename T1, typename T2>
-    void Grid3Ducsp<T1,T2>::raytrace(const std::vector<sxyz<T1>>& Tx,
-                                     const std::vector<T1>& t0,
-                                     const std::vector<const std::vector<sxyz<T1>>*>& Rx,
-                                     std::vector<std::vector<T1>*>& traveltimes,
-                                     std::vector<std::vector<std::vector<sxyz<T1>>>*>& r_data,
-                                     const size_t threadNo) const {
+    void Grid3Ducsp<T1,T2>::raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                                          const std::vector<T1>& t0,
+                                          const std::vector<const std::vector<sxyz<T1>>*>& Rx,
+                                          std::vector<std::vector<T1>*>& traveltimes,
+                                          std::vector<std::vector<std::vector<sxyz<T1>>>*>& r_data,
+                                          const size_t threadNo) const {
         
         this->checkPts(Tx);
         for ( size_t n=0; n<Rx.size(); ++n )
@@ -423,13 +485,13 @@ namespace ttcr {
     }
     
     template<typename T1, typename T2>
-    void Grid3Ducsp<T1,T2>::raytrace(const std::vector<sxyz<T1>>& Tx,
-                                     const std::vector<T1>& t0,
-                                     const std::vector<sxyz<T1>>& Rx,
-                                     std::vector<T1>& traveltimes,
-                                     std::vector<std::vector<sxyz<T1>>>& r_data,
-                                     std::vector<std::vector<siv<T1>>>& l_data,
-                                     const size_t threadNo) const {
+    void Grid3Ducsp<T1,T2>::raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                                          const std::vector<T1>& t0,
+                                          const std::vector<sxyz<T1>>& Rx,
+                                          std::vector<T1>& traveltimes,
+                                          std::vector<std::vector<sxyz<T1>>>& r_data,
+                                          std::vector<std::vector<siv<T1>>>& l_data,
+                                          const size_t threadNo) const {
         
         this->checkPts(Tx);
         this->checkPts(Rx);
@@ -474,7 +536,7 @@ namespace ttcr {
                                            threadNo);
             
             bool flag=false;
-            for ( size_t ns=0; ns<Tx.size(); ++n ) {
+            for ( size_t ns=0; ns<Tx.size(); ++ns ) {
                 if ( Rx[n] == Tx[ns] ) {
                     
                     r_data[n].resize( 1 );
@@ -663,18 +725,22 @@ namespace ttcr {
             inQueue[ src->getGridIndex() ] = false;
             frozen[ src->getGridIndex() ] = true;
             
+            bool tables = edgeLengths.contains(src->getGridIndex());
             for ( size_t no=0; no<src->getOwners().size(); ++no ) {
                 
                 T2 cellNo = src->getOwners()[no];
+                size_t m = this->neighbors[cellNo].size();
+                size_t i = tables ? edgeLengths.localIndex(src->getGridIndex(), no) : 0;
                 
-                for ( size_t k=0; k< this->neighbors[cellNo].size(); ++k ) {
+                for ( size_t k=0; k<m; ++k ) {
                     T2 neibNo = this->neighbors[cellNo][k];
                     if ( neibNo == src->getGridIndex() || frozen[neibNo] ) {
                         continue;
                     }
                     
                     // compute dt
-                    T1 dt = this->computeDt(*src, this->nodes[neibNo], cellNo);
+                    T1 dt = tables ? this->slowness[cellNo] * edgeLengths(cellNo, m, i, k) :
+                    this->computeDt(*src, this->nodes[neibNo], cellNo);
                     
                     if (src->getTT(threadNo)+dt < this->nodes[neibNo].getTT(threadNo)) {
                         this->nodes[neibNo].setTT( src->getTT(threadNo)+dt, threadNo );
@@ -691,6 +757,55 @@ namespace ttcr {
         }
     }
     
+
+    template<typename T1, typename T2>
+    void Grid3Ducsp<T1,T2>::raytraceLTrLocal(const std::vector<sxyz<T1>>& Tx,
+                                             const std::vector<T1>& t0,
+                                             const std::vector<sxyz<T1>>& Rx,
+                                             const std::vector<T1>& r,
+                                             std::vector<T1>& traveltimes,
+                                             std::vector<T1>& LTr,
+                                             const size_t threadNo) const {
+        if ( r.size() != Rx.size() ) {
+            throw std::length_error("Error: r and Rx should have the same size.");
+        }
+        std::vector<std::vector<sxyz<T1>>> r_data;
+        std::vector<std::vector<siv<T1>>> l_data;
+        raytraceLocal(Tx, t0, Rx, traveltimes, r_data, l_data, threadNo);
+
+        if ( LTr.size() != this->getNumberOfCells() ) {
+            LTr.assign( this->getNumberOfCells(), 0.0 );
+        }
+        for ( size_t n=0; n<Rx.size(); ++n ) {
+            for ( size_t nc=0; nc<l_data[n].size(); ++nc ) {
+                LTr[ l_data[n][nc].i ] += l_data[n][nc].v * r[n];
+            }
+        }
+    }
+
+    template<typename T1, typename T2>
+    void Grid3Ducsp<T1,T2>::raytraceLxLocal(const std::vector<sxyz<T1>>& Tx,
+                                            const std::vector<T1>& t0,
+                                            const std::vector<sxyz<T1>>& Rx,
+                                            const std::vector<T1>& x,
+                                            std::vector<T1>& traveltimes,
+                                            std::vector<T1>& Lx,
+                                            const size_t threadNo) const {
+        if ( x.size() != this->getNumberOfCells() ) {
+            throw std::length_error("Error: x should have one value per cell.");
+        }
+        std::vector<std::vector<sxyz<T1>>> r_data;
+        std::vector<std::vector<siv<T1>>> l_data;
+        raytraceLocal(Tx, t0, Rx, traveltimes, r_data, l_data, threadNo);
+
+        Lx.assign( Rx.size(), 0.0 );
+        for ( size_t n=0; n<Rx.size(); ++n ) {
+            for ( size_t nc=0; nc<l_data[n].size(); ++nc ) {
+                Lx[n] += l_data[n][nc].v * x[ l_data[n][nc].i ];
+            }
+        }
+    }
+
 }
 
 #endif
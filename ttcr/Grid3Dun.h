@@ -36,6 +36,7 @@
 #include <set>
 #include <sstream>
 #include <stdexcept>
+#include <typeinfo>
 #include <unordered_set>
 #include <vector>
 
@@ -56,6 +57,8 @@
 #endif
 
 
+#include "AdjointState.h"
+#include "FactoredEikonal.h"
 #include "Grad.h"
 #include "Grid3D.h"
 #include "Interpolator.h"
@@ -77,7 +80,7 @@ namespace ttcr {
         nPrimary(static_cast<T2>(no.size())),
         source_radius(0.0), min_dist(md),
         nodes(std::vector<NODE>(no.size(), NODE(nt))),
-        tetrahedra(tet)
+        tetrahedra(tet), factored(false), factoredSrc(nt), srcTx(nt)
         {}
         
         virtual ~Grid3Dun() {}
@@ -86,6 +89,7 @@ namespace ttcr {
             for ( size_t n=0; n<nodes.size(); ++n ) {
                 nodes[n].setNodeSlowness( s[n] );
             }
+            this->slownessChanged();
         }
         
         void setSlowness(const T1 *s, const size_t ns) {
@@ -95,6 +99,7 @@ namespace ttcr {
             for ( size_t n=0; n<nodes.size(); ++n ) {
                 nodes[n].setNodeSlowness( s[n] );
             }
+            this->slownessChanged();
         }
         
         void setSlowness(const std::vector<T1>& s) {
@@ -104,6 +109,7 @@ namespace ttcr {
             for ( size_t n=0; n<nodes.size(); ++n ) {
                 nodes[n].setNodeSlowness( s[n] );
             }
+            this->slownessChanged();
         }
         void getSlowness(std::vector<T1>& slowness) const {
             if (slowness.size() != nPrimary) {
@@ -113,8 +119,27 @@ namespace ttcr {
                 slowness[n] = nodes[n].getNodeSlowness();
             }
         }
-        void setSourceRadius(const double r) { source_radius = r; }
+        void setSourceRadius(const double r) {
+            if ( r != source_radius ) {
+                source_radius = r;
+                this->slownessChanged();
+            }
+        }
+        // solve the factored eikonal equation (single point source)
+        void setFactored(const bool f) {
+            if ( f != factored ) {
+                factored = f;
+                this->slownessChanged();
+            }
+        }
         
+    protected:
+        void getMisfitGradientLocal(const std::vector<sxyz<T1>>& Rx,
+                                    const std::vector<T1>& r,
+                                    std::vector<T1>& grad,
+                                    const size_t threadNo=0) const;
+        
+    public:
         void setTT(const T1 tt, const size_t nn, const size_t nt=0) {
             nodes[nn].setTT(tt, nt);
         }
@@ -132,37 +157,37 @@ namespace ttcr {
             T1 xmin = nodes[0].getX();
             for ( auto it=nodes.begin(); it!=nodes.end(); ++it )
                 xmin = xmin<it->getX() ? xmin : it->getX();
-            return xmin;
+            return static_cast<T1>(xmin+this->origin.x);
         }
         const T1 getXmax() const {
             T1 xmax = nodes[0].getX();
             for ( auto it=nodes.begin(); it!=nodes.end(); ++it )
                 xmax = xmax>it->getX() ? xmax : it->getX();
-            return xmax;
+            return static_cast<T1>(xmax+this->origin.x);
         }
         const T1 getYmin() const {
             T1 ymin = nodes[0].getY();
             for ( auto it=nodes.begin(); it!=nodes.end(); ++it )
                 ymin = ymin<it->getY() ? ymin : it->getY();
-            return ymin;
+            return static_cast<T1>(ymin+this->origin.y);
         }
         const T1 getYmax() const {
             T1 ymax = nodes[0].getY();
             for ( auto it=nodes.begin(); it!=nodes.end(); ++it )
                 ymax = ymax>it->getY() ? ymax : it->getY();
-            return ymax;
+            return static_cast<T1>(ymax+this->origin.y);
         }
         const T1 getZmin() const {
             T1 zmin = nodes[0].getZ();
             for ( auto it=nodes.begin(); it!=nodes.end(); ++it )
                 zmin = zmin<it->getZ() ? zmin : it->getZ();
-            return zmin;
+            return static_cast<T1>(zmin+this->origin.z);
         }
         const T1 getZmax() const {
             T1 zmax = nodes[0].getZ();
             for ( auto it=nodes.begin(); it!=nodes.end(); ++it )
                 zmax = zmax>it->getZ() ? zmax : it->getZ();
-            return zmax;
+            return static_cast<T1>(zmax+this->origin.z);
         }
         
         void getRaypath(const std::vector<sxyz<T1>>& Tx,
@@ -187,16 +212,91 @@ namespace ttcr {
                 os << nodes[n].getX() << ' ' << nodes[n].getY() << ' ' << nodes[n].getZ() << '\n';
             }
         }
+        void getSecondaryNodes(std::vector<sxyz<T1>>& pts) const {
+            pts.resize( nodes.size()-nPrimary );
+            for ( size_t n=nPrimary; n<nodes.size(); ++n ) {
+                pts[n-nPrimary] = sxyz<T1>(nodes[n]);
+            }
+        }
+
+        void setNodeNumbering(const std::vector<T2>& i2e) {
+            if ( i2e.size() != nPrimary ) {
+                throw std::length_error("Error: node numbering and mesh of incompatible size.");
+            }
+            nodeOrder.resize( i2e.size() );
+            for ( size_t n=0; n<i2e.size(); ++n ) {
+                nodeOrder[ i2e[n] ] = static_cast<T2>(n);
+            }
+        }
+
+        void saveSnapshot(std::ostream&) const;
+        void loadSnapshot(std::istream&);
+
+        // type of grid and parameters it was built with, saved in snapshots
+        // so that these are restored only in grids built alike
+        virtual std::string getSnapshotTag() const { return "Grid3Dun"; }
+        virtual void getSnapshotParameters(std::vector<double>& p) const {
+            p = { static_cast<double>(rp_method),
+                static_cast<double>(this->tt_from_rp),
+                static_cast<double>(min_dist),
+                static_cast<double>(interpVel) };
+        }
 
     protected:
+        void getSnapshotHeader(snapshotHeader& h) const {
+            h.tag = getSnapshotTag();
+            getSnapshotParameters(h.parameters);
+            h.inputHash = snapshotInputHash(std::vector<sxyz<T1>>(nodes.begin(), nodes.begin()+nPrimary),
+                                            tetrahedra);
+        }
+
         int rp_method;
         bool interpVel;
         T2 nPrimary;
         T1 source_radius;
         T1 min_dist;
         mutable std::vector<NODE> nodes;
+        std::vector<T2> nodeOrder;  // nodes in the order of the model file
         std::vector<tetrahedronElem<T2>> tetrahedra;
         
+        bool factored;
+        // source of the factored equation, for each thread
+        mutable std::vector<FactoredSource<T1>> factoredSrc;
+        // sources of the last raytrace, for each thread
+        mutable std::vector<std::vector<sxyz<T1>>> srcTx;
+        
+        void initSource(const std::vector<sxyz<T1>>& Tx,
+                        const std::vector<T1>& t0,
+                        const size_t threadNo) const {
+            srcTx[threadNo] = Tx;
+            if ( factored && Tx.size() == 1 ) {
+                factoredSrc[threadNo].set(Tx[0], computeSlowness(Tx[0]), t0[0]);
+            } else {
+                factoredSrc[threadNo].active = false;
+            }
+        }
+        
+        bool getTTState(std::vector<T1>& state, const size_t threadNo) const {
+            state.resize( nodes.size() );
+            for ( size_t n=0; n<nodes.size(); ++n ) {
+                state[n] = nodes[n].getTT(threadNo);
+            }
+            return true;
+        }
+        void setTTState(const std::vector<sxyz<T1>>& Tx,
+                        const std::vector<T1>& t0,
+                        const std::vector<T1>& state,
+                        const size_t threadNo) const {
+            for ( size_t n=0; n<nodes.size(); ++n ) {
+                nodes[n].setTT(state[n], threadNo);
+            }
+            initSource(Tx, t0, threadNo);
+        }
+        
+        // add g*ds/ds_k to grad, s being the slowness interpolated at pt
+        void addInterpolationGradient(const sxyz<T1>& pt, const T2 cellNo,
+                                      const T1 g, std::vector<T1>& grad) const;
+        
         T1 computeDt(const NODE& source, const NODE& node) const {
             return (node.getNodeSlowness()+source.getNodeSlowness())/2 * source.getDistance( node );
         }
@@ -209,6 +309,10 @@ namespace ttcr {
                          const std::vector<NODE>& nodes,
                          const size_t threadNo) const;
         
+        T1 getTraveltimeAt(const sxyz<T1>& pt, const size_t threadNo) const {
+            return getTraveltime(pt, this->nodes, threadNo);
+        }
+        
         void checkPts(const std::vector<sxyz<T1>>&) const;
         
         bool insideTetrahedron(const sxyz<T1>&, const T2) const;
@@ -221,6 +325,7 @@ namespace ttcr {
                             const int, const size_t);
         
         void localUpdate3D(NODE *vertexC, const size_t threadNo) const;
+        T1 localSolution3D(const NODE *vertexC, const size_t threadNo) const;
         
         T1 localUpdate2D(const NODE *vertexA,
                          const NODE *vertexB,
@@ -778,32 +883,34 @@ namespace ttcr {
     }
     
     template<typename T1, typename T2, typename NODE>
-    bool Grid3Dun<T1,T2,NODE>::insideTetrahedron(const sxyz<T1>& v, const T2 nt) const {
+    bool Grid3Dun<T1,T2,NODE>::insideTetrahedron(const sxyz<T1>& p, const T2 nt) const {
+        typedef typename solver_type<T1>::type TS;
+        const sxyz<TS> v = { p.x, p.y, p.z };
         
         
         // from http://steve.hollasch.net/cgindex/geometry/ptintet.html
         
-        sxyz<T1> v1 = { nodes[ tetrahedra[nt].i[0] ].getX(),
+        sxyz<TS> v1 = { nodes[ tetrahedra[nt].i[0] ].getX(),
             nodes[ tetrahedra[nt].i[0] ].getY(),
             nodes[ tetrahedra[nt].i[0] ].getZ() };
         
-        sxyz<T1> v2 = { nodes[ tetrahedra[nt].i[1] ].getX(),
+        sxyz<TS> v2 = { nodes[ tetrahedra[nt].i[1] ].getX(),
             nodes[ tetrahedra[nt].i[1] ].getY(),
             nodes[ tetrahedra[nt].i[1] ].getZ() };
         
-        sxyz<T1> v3 = { nodes[ tetrahedra[nt].i[2] ].getX(),
+        sxyz<TS> v3 = { nodes[ tetrahedra[nt].i[2] ].getX(),
             nodes[ tetrahedra[nt].i[2] ].getY(),
             nodes[ tetrahedra[nt].i[2] ].getZ() };
         
-        sxyz<T1> v4 = { nodes[ tetrahedra[nt].i[3] ].getX(),
+        sxyz<TS> v4 = { nodes[ tetrahedra[nt].i[3] ].getX(),
             nodes[ tetrahedra[nt].i[3] ].getY(),
             nodes[ tetrahedra[nt].i[3] ].getZ() };
         
-        T1 D0 = det4(v1, v2, v3, v4);
-        T1 D1 = det4( v, v2, v3, v4);
-        T1 D2 = det4(v1,  v, v3, v4);
-        T1 D3 = det4(v1, v2,  v, v4);
-        T1 D4 = det4(v1, v2, v3,  v);
+        TS D0 = det4(v1, v2, v3, v4);
+        TS D1 = det4( v, v2, v3, v4);
+        TS D2 = det4(v1,  v, v3, v4);
+        TS D3 = det4(v1, v2,  v, v4);
+        TS D4 = det4(v1, v2, v3,  v);
         
         int t1 = (signum(D0)==signum(D1));
         int t2 = (signum(D0)==signum(D2));
@@ -844,10 +951,11 @@ namespace ttcr {
                 nMax = static_cast<T2>(nodes.size());
             }
             for ( T2 n=0; n<nMax; ++n ) {
-                fout << nodes[n].getX() << '\t'
-                << nodes[n].getY() << '\t'
-                << nodes[n].getZ() << '\t'
-                << nodes[n].getTT(nt) << '\n';
+                const T2 i = n<nodeOrder.size() ? nodeOrder[n] : n;
+                fout << nodes[i].getX()+this->origin.x << '\t'
+                << nodes[i].getY()+this->origin.y << '\t'
+                << nodes[i].getZ()+this->origin.z << '\t'
+                << nodes[i].getTT(nt) << '\n';
             }
             fout.close();
         } else if ( format == 2 ) {
@@ -867,9 +975,9 @@ namespace ttcr {
             double xyz[3];
             T2 nMax = nPrimary;  // only primary are saved
             for (size_t n=0; n<nMax; ++n) {
-                xyz[0] = nodes[n].getX();
-                xyz[1] = nodes[n].getY();
-                xyz[2] = nodes[n].getZ();
+                xyz[0] = nodes[n].getX()+this->origin.x;
+                xyz[1] = nodes[n].getY()+this->origin.y;
+                xyz[2] = nodes[n].getZ()+this->origin.z;
                 newPts->InsertPoint(n, xyz);
                 newScalars->InsertValue(n, nodes[n].getTT(nt) );
             }
@@ -906,7 +1014,10 @@ namespace ttcr {
                 nMax = static_cast<T2>(nodes.size());
             }
             for ( T2 n=0; n<nMax; ++n ) {
-                T1 tmp[] = { nodes[n].getX(), nodes[n].getY(), nodes[n].getZ(), nodes[n].getTT(nt) };
+                const T2 i = n<nodeOrder.size() ? nodeOrder[n] : n;
+                T1 tmp[] = { static_cast<T1>(nodes[i].getX()+this->origin.x),
+                    static_cast<T1>(nodes[i].getY()+this->origin.y),
+                    static_cast<T1>(nodes[i].getZ()+this->origin.z), nodes[i].getTT(nt) };
                 fout.write( (char*)tmp, 4*sizeof(T1) );
             }
             fout.close();
@@ -929,7 +1040,7 @@ namespace ttcr {
             T1 x, y, z, tt;
             for ( T2 n=0; n<nMax; ++n ) {
                 fin >> x >> y >> z >> tt;
-                nodes[n].setTT(tt, nt);
+                nodes[ n<nodeOrder.size() ? nodeOrder[n] : n ].setTT(tt, nt);
             }
             fin.close();
         } else if ( format == 2 ) {
@@ -959,7 +1070,7 @@ namespace ttcr {
             for ( T2 n=0; n<nMax; ++n ) {
                 T1 tmp[4];
                 fin.read( (char*)tmp, 4*sizeof(T1) );
-                nodes[n].setTT(tmp[3], nt);
+                nodes[ n<nodeOrder.size() ? nodeOrder[n] : n ].setTT(tmp[3], nt);
             }
             fin.close();
         } else {
@@ -987,9 +1098,9 @@ namespace ttcr {
             newScalars->SetName("Slowness");
             
             for (size_t n=0; n<nMax; ++n) {
-                xyz[0] = nodes[n].getX();
-                xyz[1] = nodes[n].getY();
-                xyz[2] = nodes[n].getZ();
+                xyz[0] = nodes[n].getX()+this->origin.x;
+                xyz[1] = nodes[n].getY()+this->origin.y;
+                xyz[2] = nodes[n].getZ()+this->origin.z;
                 newPts->InsertPoint(n, xyz);
                 newScalars->InsertValue(n, nodes[n].getNodeSlowness() );
             }
@@ -997,9 +1108,9 @@ namespace ttcr {
             newScalars->SetName("Velocity");
             
             for (size_t n=0; n<nMax; ++n) {
-                xyz[0] = nodes[n].getX();
-                xyz[1] = nodes[n].getY();
-                xyz[2] = nodes[n].getZ();
+                xyz[0] = nodes[n].getX()+this->origin.x;
+                xyz[1] = nodes[n].getY()+this->origin.y;
+                xyz[2] = nodes[n].getZ()+this->origin.z;
                 newPts->InsertPoint(n, xyz);
                 newScalars->InsertValue(n, static_cast<T1>(1.0)/nodes[n].getNodeSlowness() );
             }
@@ -1046,11 +1157,22 @@ namespace ttcr {
     template<typename T1, typename T2, typename NODE>
     void Grid3Dun<T1,T2,NODE>::localUpdate3D(NODE *vertexD,
                                              const size_t threadNo) const {
+        T1 t = localSolution3D(vertexD, threadNo);
+        if ( t<vertexD->getTT(threadNo) )
+            vertexD->setTT(t, threadNo);
+    }
+    
+    template<typename T1, typename T2, typename NODE>
+    T1 Grid3Dun<T1,T2,NODE>::localSolution3D(const NODE *vertexD,
+                                             const size_t threadNo) const {
+        typedef typename solver_type<T1>::type TS;
         
         // method of Lelievre et al. 2011
+        // (the node is not modified, the smallest solution is returned)
         
         T2 iA, iB, iC, iD;
         NODE *vertexA, *vertexB, *vertexC;
+        TS tD = std::numeric_limits<T1>::max();
         
         for ( size_t no=0; no<vertexD->getOwners().size(); ++no ) {
             
@@ -1084,34 +1206,34 @@ namespace ttcr {
                 continue;
             }
             
-            T1 tABC = std::numeric_limits<T1>::max();
+            TS tABC = std::numeric_limits<T1>::max();
             
             if ( vertexB->getTT(threadNo) != std::numeric_limits<T1>::max() &&
                 vertexC->getTT(threadNo) != std::numeric_limits<T1>::max() ) {
                 
-                T1 u = vertexB->getTT(threadNo) - vertexA->getTT(threadNo);
-                T1 v = vertexC->getTT(threadNo) - vertexA->getTT(threadNo);
+                TS u = vertexB->getTT(threadNo) - vertexA->getTT(threadNo);
+                TS v = vertexC->getTT(threadNo) - vertexA->getTT(threadNo);
                 
-                sxyz<T1> v_b = { vertexC->getX() - vertexA->getX(),
+                sxyz<TS> v_b = { vertexC->getX() - vertexA->getX(),
                     vertexC->getY() - vertexA->getY(),
                     vertexC->getZ() - vertexA->getZ() };
-                sxyz<T1> v_c = { vertexB->getX() - vertexA->getX(),
+                sxyz<TS> v_c = { vertexB->getX() - vertexA->getX(),
                     vertexB->getY() - vertexA->getY(),
                     vertexB->getZ() - vertexA->getZ() };
                 
                 // vector normal to plane
-                sxyz<T1> v_n = cross(v_b, v_c);
+                sxyz<TS> v_n = cross(v_b, v_c);
                 
-                T1 b = norm( v_b );
-                T1 c = norm( v_c );
-                T1 d2 = dot(v_b, v_c);
+                TS b = norm( v_b );
+                TS c = norm( v_c );
+                TS d2 = dot(v_b, v_c);
                 
-                T1 alpha = acos( d2 / (b*c) );
+                TS alpha = acos( d2 / (b*c) );
                 
-                T1 phi = c*b*sin(alpha);
+                TS phi = c*b*sin(alpha);
                 
                 // check for negative value
-                T1 w_tilde = vertexD->getNodeSlowness()*vertexD->getNodeSlowness()*phi*phi -
+                TS w_tilde = vertexD->getNodeSlowness()*vertexD->getNodeSlowness()*phi*phi -
                                   u*u*b*b - v*v*c*c + 2.*u*v*d2;
                 if ( w_tilde > 0.0 ) {
                 
@@ -1120,36 +1242,36 @@ namespace ttcr {
                     // Point (ξ_0 , ζ_0 ) is the normalized projection of node D onto face ABC
                     // project D on plane
                     
-                    T1 d_tmp = -vertexA->getX()*v_n.x - vertexA->getY()*v_n.y - vertexA->getZ()*v_n.z;
+                    TS d_tmp = -vertexA->getX()*v_n.x - vertexA->getY()*v_n.y - vertexA->getZ()*v_n.z;
                     
-                    T1 k = -(d_tmp + v_n.x*vertexD->getX() + v_n.y*vertexD->getY() + v_n.z*vertexD->getZ())/
+                    TS k = -(d_tmp + v_n.x*vertexD->getX() + v_n.y*vertexD->getY() + v_n.z*vertexD->getZ())/
                     norm2(v_n);
                     
-                    sxyz<T1> pt;   // -> Point (ξ_0 , ζ_0 )
+                    sxyz<TS> pt;   // -> Point (ξ_0 , ζ_0 )
                     pt.x = vertexD->getX() + k*v_n.x;
                     pt.y = vertexD->getY() + k*v_n.y;
                     pt.z = vertexD->getZ() + k*v_n.z;
                     
-                    T1 rho0 = vertexD->getDistance( pt );
+                    TS rho0 = norm( sxyz<TS>(*vertexD) - pt );
                     
-                    sxyz<T1> v_pt = {pt.x-vertexA->getX(), pt.y-vertexA->getY(), pt.z-vertexA->getZ()};
+                    sxyz<TS> v_pt = {pt.x-vertexA->getX(), pt.y-vertexA->getY(), pt.z-vertexA->getZ()};
                     
-                    T1 xi0;
-                    T1 zeta0;
+                    TS xi0;
+                    TS zeta0;
                     projNorm(v_b/b, v_c/c, v_pt, xi0, zeta0);
                     if ( xi0 < 0.0 || zeta0 < 0.0 ) {
                         // this should not happen unless we have incorrect triangle
                         continue;
                     }
                     
-                    T1 beta = u*b*b - v*d2;
-                    T1 gamma = v*c*c - u*d2;
+                    TS beta = u*b*b - v*d2;
+                    TS gamma = v*c*c - u*d2;
                     
-                    T1 xi_tilde = -std::abs(beta)*rho0/(phi*w_tilde);
-                    T1 zeta_tilde = -std::abs(gamma)*rho0/(phi*w_tilde);
+                    TS xi_tilde = -std::abs(beta)*rho0/(phi*w_tilde);
+                    TS zeta_tilde = -std::abs(gamma)*rho0/(phi*w_tilde);
                     
-                    T1 xi = xi_tilde + xi0;
-                    T1 zeta = zeta_tilde + zeta0;
+                    TS xi = xi_tilde + xi0;
+                    TS zeta = zeta_tilde + zeta0;
                     
                     if ( 0.<xi && xi<1. && 0.<zeta && zeta<1. && 0.<(xi+zeta) && (xi+zeta)<1. ) {
                         tABC = vertexA->getTT(threadNo) + u*xi0 + v*zeta0 + w_tilde*rho0/phi;
@@ -1157,7 +1279,17 @@ namespace ttcr {
                 }
             }
             
-            T1 t = vertexA->getTT(threadNo) + vertexD->getNodeSlowness() * vertexD->getDistance( *vertexA );
+            if ( factoredSrc[threadNo].active &&
+                vertexB->getTT(threadNo) != std::numeric_limits<T1>::max() &&
+                vertexC->getTT(threadNo) != std::numeric_limits<T1>::max() ) {
+                TS t = factoredUpdate(factoredSrc[threadNo], sxyz<T1>(*vertexD), vertexD->getNodeSlowness(),
+                                      sxyz<T1>(*vertexA), vertexA->getTT(threadNo),
+                                      sxyz<T1>(*vertexB), vertexB->getTT(threadNo),
+                                      sxyz<T1>(*vertexC), vertexC->getTT(threadNo));
+                if ( t < tABC ) tABC = t;
+            }
+            
+            TS t = vertexA->getTT(threadNo) + vertexD->getNodeSlowness() * vertexD->getDistance( *vertexA );
             if ( t < tABC ) tABC = t;
             t = vertexB->getTT(threadNo) + vertexD->getNodeSlowness() * vertexD->getDistance( *vertexB );
             if ( t < tABC ) tABC = t;
@@ -1171,10 +1303,11 @@ namespace ttcr {
             t = localUpdate2D(vertexB, vertexC, vertexD, tetNo, threadNo);
             if ( t < tABC ) tABC = t;
             
-            if ( tABC<vertexD->getTT(threadNo) )
-                vertexD->setTT(tABC, threadNo);
+            if ( tABC<tD )
+                tD = tABC;
             
         }
+        return tD;
     }
     
     
@@ -1184,40 +1317,41 @@ namespace ttcr {
                                            const NODE *vertexC,
                                            const T2 tetNo,
                                            const size_t threadNo) const {
+        typedef typename solver_type<T1>::type TS;
         
         if ( vertexB->getTT(threadNo)==std::numeric_limits<T1>::max() &&
             vertexA->getTT(threadNo)==std::numeric_limits<T1>::max() ) {
             return std::numeric_limits<T1>::max();
         }
-        T1 t;
+        TS t;
         
-        T1 u = vertexB->getTT(threadNo) - vertexA->getTT(threadNo);
+        TS u = vertexB->getTT(threadNo) - vertexA->getTT(threadNo);
         
-        sxyz<T1> v_b = { vertexC->getX() - vertexA->getX(),
+        sxyz<TS> v_b = { vertexC->getX() - vertexA->getX(),
             vertexC->getY() - vertexA->getY(),
             vertexC->getZ() - vertexA->getZ() };
-        sxyz<T1> v_c = { vertexB->getX() - vertexA->getX(),
+        sxyz<TS> v_c = { vertexB->getX() - vertexA->getX(),
             vertexB->getY() - vertexA->getY(),
             vertexB->getZ() - vertexA->getZ() };
         
-        T1 c = norm( v_c );
+        TS c = norm( v_c );
         
-        T1 w2 = vertexC->getNodeSlowness()*vertexC->getNodeSlowness()*c*c - u*u;
+        TS w2 = vertexC->getNodeSlowness()*vertexC->getNodeSlowness()*c*c - u*u;
         if ( w2 < 0.0 ) return std::numeric_limits<T1>::max();
         
-        T1 w = sqrt( w2 );
+        TS w = sqrt( w2 );
         
-        T1 k = dot(v_b,v_c)/dot(v_c,v_c);
-        sxyz<T1> pt;
+        TS k = dot(v_b,v_c)/dot(v_c,v_c);
+        sxyz<TS> pt;
         pt.x = vertexA->getX() + k*v_c.x;
         pt.y = vertexA->getY() + k*v_c.y;
         pt.z = vertexA->getZ() + k*v_c.z;
         
-        T1 rho0 = vertexC->getDistance( pt );
+        TS rho0 = norm( sxyz<TS>(*vertexC) - pt );
 //        T1 xi0 = vertexA->getDistance( pt )/c;
-        T1 xi0 = k;
+        TS xi0 = k;
         
-        T1 xi = xi0 - u*rho0/(w*c);
+        TS xi = xi0 - u*rho0/(w*c);
         
         if ( 0.<xi && xi<1. ) {
             t = vertexA->getTT(threadNo) + u*xi0 + w*rho0/c;
@@ -2180,10 +2314,12 @@ namespace ttcr {
                     break;
                 }
                 
-                if ( foundIntersection == false ) {
+                if ( foundIntersection == false &&
+                    findAdjacentCell2(faceNodes, cellNo) != std::numeric_limits<T2>::max() ) {
                     
                     // we must be on an face with gradient pointing slightly outward tetrahedron
-                    // return in other cell but keep gradient
+                    // return in other cell but keep gradient (there is no other cell on
+                    // external faces, we then go outside the mesh, see below)
                     cellNo = findAdjacentCell2(faceNodes, cellNo);
                     
                     std::array<T2,4> itmp = getPrimary(cellNo);
@@ -3125,10 +3261,12 @@ namespace ttcr {
                     break;
                 }
                 
-                if ( foundIntersection == false ) {
+                if ( foundIntersection == false &&
+                    findAdjacentCell2(faceNodes, cellNo) != std::numeric_limits<T2>::max() ) {
                     
                     // we must be on an face with gradient pointing slightly outward tetrahedron
-                    // return in other cell but keep gradient
+                    // return in other cell but keep gradient (there is no other cell on
+                    // external faces, we then go outside the mesh, see below)
                     cellNo = findAdjacentCell2(faceNodes, cellNo);
                     
                     std::array<T2,4> itmp = getPrimary(cellNo);
@@ -4060,10 +4198,12 @@ namespace ttcr {
                     break;
                 }
                 
-                if ( foundIntersection == false ) {
+                if ( foundIntersection == false &&
+                    findAdjacentCell2(faceNodes, cellNo) != std::numeric_limits<T2>::max() ) {
                     
                     // we must be on an face with gradient pointing slightly outward tetrahedron
-                    // return in other cell but keep gradient
+                    // return in other cell but keep gradient (there is no other cell on
+                    // external faces, we then go outside the mesh, see below)
                     cellNo = findAdjacentCell2(faceNodes, cellNo);
                     
                     std::array<T2,4> itmp = getPrimary(cellNo);
@@ -5154,10 +5294,12 @@ namespace ttcr {
                     break;
                 }
                 
-                if ( foundIntersection == false ) {
+                if ( foundIntersection == false &&
+                    findAdjacentCell2(faceNodes, cellNo) != std::numeric_limits<T2>::max() ) {
                     
                     // we must be on an face with gradient pointing slightly outward tetrahedron
-                    // return in other cell but keep gradient
+                    // return in other cell but keep gradient (there is no other cell on
+                    // external faces, we then go outside the mesh, see below)
                     cellNo = findAdjacentCell2(faceNodes, cellNo);
                     
                     std::array<T2,4> itmp = getPrimary(cellNo);
@@ -8205,6 +8347,252 @@ namespace ttcr {
         }
         return found;
     }
+
+    template<typename T1, typename T2, typename NODE>
+    void Grid3Dun<T1,T2,NODE>::saveSnapshot(std::ostream& os) const {
+        snapshotHeader h;
+        getSnapshotHeader(h);
+        writeSnapshotHeader<T1,T2>(os, h);
+        writeSnapshotValue(os, nPrimary);
+        writeSnapshotNodes<T1,T2>(os, nodes);
+        writeSnapshotCSR(os, this->neighbors);
+        writeSnapshotTetrahedra(os, tetrahedra);
+        // slowness at all nodes, secondary nodes included
+        std::vector<T1> s(nodes.size());
+        for ( size_t n=0; n<nodes.size(); ++n ) {
+            s[n] = nodes[n].getNodeSlowness();
+        }
+        writeSnapshotArray(os, s);
+    }
+
+    template<typename T1, typename T2, typename NODE>
+    void Grid3Dun<T1,T2,NODE>::loadSnapshot(std::istream& is) {
+        snapshotHeader h, expected;
+        readSnapshotHeader<T1,T2>(is, h);
+        getSnapshotHeader(expected);
+        checkSnapshotHeader(h, expected);
+        T2 np;
+        std::vector<NODE> no;
+        std::vector<std::vector<T2>> nb;
+        std::vector<tetrahedronElem<T2>> tet;
+        std::vector<T1> s;
+        readSnapshotValue(is, np);
+        readSnapshotNodes<T1,T2>(is, no, this->nThreads);
+        readSnapshotCSR(is, nb);
+        readSnapshotTetrahedra(is, tet);
+        readSnapshotArray(is, s);
+        if ( np > no.size() || nb.size() != tet.size() || s.size() != no.size() ) {
+            throw std::runtime_error("Error: corrupted snapshot.");
+        }
+        checkSnapshotIndices(nb, no.size());
+        for ( size_t n=0; n<tet.size(); ++n ) {
+            for ( size_t i=0; i<4; ++i ) {
+                if ( tet[n].i[i] >= no.size() ) {
+                    throw std::runtime_error("Error: corrupted snapshot.");
+                }
+            }
+        }
+        for ( size_t n=0; n<no.size(); ++n ) {
+            for ( size_t i=0; i<no[n].getOwners().size(); ++i ) {
+                if ( no[n].getOwners()[i] >= tet.size() ) {
+                    throw std::runtime_error("Error: corrupted snapshot.");
+                }
+            }
+        }
+        if ( snapshotInputHash(std::vector<sxyz<T1>>(no.begin(), no.begin()+np), tet) != h.inputHash ) {
+            throw std::runtime_error("Error: corrupted snapshot.");
+        }
+        for ( size_t n=0; n<no.size(); ++n ) {
+            no[n].setNodeSlowness(s[n]);
+        }
+        nPrimary = np;
+        nodes.swap(no);
+        this->neighbors.swap(nb);
+        tetrahedra.swap(tet);
+    }
+
+    
+    template<typename T1, typename T2, typename NODE>
+    void Grid3Dun<T1,T2,NODE>::addInterpolationGradient(const sxyz<T1>& pt,
+                                                        const T2 cellNo,
+                                                        const T1 g,
+                                                        std::vector<T1>& grad) const {
+        for ( size_t n=0; n<4; ++n ) {
+            if ( nodes[tetrahedra[cellNo].i[n]] == pt ) {
+                grad[tetrahedra[cellNo].i[n]] += g;
+                return;
+            }
+        }
+        sxyz<T1> x[4];
+        for ( size_t n=0; n<4; ++n ) x[n] = sxyz<T1>(nodes[tetrahedra[cellNo].i[n]]);
+        T1 w[4];
+        barycentric(pt, x, w);
+        if ( interpVel ) {
+            // s = 1/sum(w_k/s_k)
+            T1 s = 0.0;
+            for ( size_t n=0; n<4; ++n ) s += w[n]/nodes[tetrahedra[cellNo].i[n]].getNodeSlowness();
+            s = 1./s;
+            for ( size_t n=0; n<4; ++n ) {
+                T1 sn = nodes[tetrahedra[cellNo].i[n]].getNodeSlowness();
+                grad[tetrahedra[cellNo].i[n]] += g * w[n]*s*s/(sn*sn);
+            }
+        } else {
+            for ( size_t n=0; n<4; ++n ) grad[tetrahedra[cellNo].i[n]] += g * w[n];
+        }
+    }
+    
+    template<typename T1, typename T2, typename NODE>
+    void Grid3Dun<T1,T2,NODE>::getMisfitGradientLocal(const std::vector<sxyz<T1>>& Rx,
+                                                      const std::vector<T1>& r,
+                                                      std::vector<T1>& grad,
+                                                      const size_t threadNo) const {
+        
+        // The traveltime at node D is linearized as T_D = sum_k w_k T_k +
+        // s_D*l, where the ray reaching D crosses the face of one of the
+        // tetrahedra of D at a point of barycentric coordinates w_k, at
+        // distance l (see AdjointState.h).  Nodes around the source have
+        // T_D = t0 + (s_D+s_Tx)/2*d, and receivers not on a node have
+        // T_Rx = T_k + (s_k+s_Rx)/2*d, as in getTraveltime.
+        const std::vector<sxyz<T1>>& Tx = srcTx[threadNo];
+        if ( Tx.empty() ) {
+            throw std::runtime_error("Error: adjoint-state gradient needs a traveltime field computed with FSM, FIM or FMM.");
+        }
+        if ( r.size() != Rx.size() ) {
+            throw std::length_error("Error: residuals and Rx should have the same size.");
+        }
+        this->checkPts(Rx);
+        
+        const T2 none = std::numeric_limits<T2>::max();
+        std::vector<T1> lambda(nodes.size(), 0.0);
+        grad.assign(nPrimary, 0.0);
+        
+        for ( size_t nr=0; nr<Rx.size(); ++nr ) {
+            bool onNode = false;
+            for ( size_t nn=0; nn<nodes.size(); ++nn ) {
+                if ( nodes[nn] == Rx[nr] ) {
+                    lambda[nn] += r[nr];
+                    onNode = true;
+                    break;
+                }
+            }
+            if ( onNode ) continue;
+            
+            T1 slo = computeSlowness( Rx[nr] );
+            T2 cellNo = getCellNo( Rx[nr] );
+            T2 nb = none;
+            T1 tt = std::numeric_limits<T1>::max();
+            for ( size_t k=0; k<this->neighbors[cellNo].size(); ++k ) {
+                T2 neibNo = this->neighbors[cellNo][k];
+                T1 t = nodes[neibNo].getTT(threadNo) + computeDt(nodes[neibNo], Rx[nr], slo);
+                if ( t < tt ) {
+                    tt = t;
+                    nb = neibNo;
+                }
+            }
+            T1 d = nodes[nb].getDistance( Rx[nr] );
+            lambda[nb] += r[nr];
+            grad[nb] += 0.5 * r[nr] * d;
+            addInterpolationGradient(Rx[nr], cellNo, 0.5 * r[nr] * d, grad);
+        }
+        
+        // nodes whose traveltime is set directly from the source, and nodes
+        // initialized from a source located on a node (their traveltime may
+        // not be updated afterwards)
+        std::vector<T2> direct(nodes.size(), none);
+        std::vector<T2> nearSource(nodes.size(), none);
+        std::vector<bool> isSource(nodes.size(), false);
+        for ( size_t n=0; n<Tx.size(); ++n ) {
+            bool found = false;
+            for ( size_t nn=0; nn<nodes.size(); ++nn ) {
+                if ( nodes[nn] == Tx[n] ) {
+                    isSource[nn] = true;
+                    found = true;
+                    for ( size_t no=0; no<nodes[nn].getOwners().size(); ++no ) {
+                        T2 cellNo = nodes[nn].getOwners()[no];
+                        for ( size_t k=0; k<this->neighbors[cellNo].size(); ++k ) {
+                            nearSource[this->neighbors[cellNo][k]] = static_cast<T2>(nn);
+                        }
+                    }
+                    break;
+                }
+            }
+            if ( !found ) {
+                T2 cellNo = getCellNo( Tx[n] );
+                for ( size_t k=0; k<this->neighbors[cellNo].size(); ++k ) {
+                    direct[this->neighbors[cellNo][k]] = static_cast<T2>(n);
+                }
+            }
+        }
+        
+        std::vector<T2> order(nodes.size());
+        for ( size_t n=0; n<order.size(); ++n ) order[n] = static_cast<T2>(n);
+        std::sort(order.begin(), order.end(), [this,threadNo](const T2 a, const T2 b) {
+            return nodes[a].getTT(threadNo) > nodes[b].getTT(threadNo);
+        });
+        
+        for ( size_t no=0; no<order.size(); ++no ) {
+            const T2 nD = order[no];
+            const T1 tD = nodes[nD].getTT(threadNo);
+            if ( lambda[nD] == 0.0 || isSource[nD] ||
+                tD == std::numeric_limits<T1>::max() ) continue;
+            
+            if ( direct[nD] != none ) {
+                const sxyz<T1>& src = Tx[direct[nD]];
+                T1 d = nodes[nD].getDistance( src );
+                grad[nD] += 0.5 * lambda[nD] * d;
+                addInterpolationGradient(src, getCellNo(src), 0.5 * lambda[nD] * d, grad);
+                continue;
+            }
+            
+            // incoming ray, as given by the local solution
+            T1 best = std::numeric_limits<T1>::max();
+            T1 err = std::numeric_limits<T1>::max();
+            T1 wBest[3];
+            T2 iBest[3];
+            T1 lBest = 0.0;
+            for ( size_t nt=0; nt<nodes[nD].getOwners().size(); ++nt ) {
+                const T2 tetNo = nodes[nD].getOwners()[nt];
+                T2 ind[3];
+                sxyz<T1> x[3];
+                T1 t[3];
+                for ( size_t i=0, k=0; i<4; ++i ) {
+                    if ( tetrahedra[tetNo].i[i] == nD ) continue;
+                    ind[k] = tetrahedra[tetNo].i[i];
+                    x[k] = sxyz<T1>(nodes[ind[k]]);
+                    t[k] = nodes[ind[k]].getTT(threadNo);
+                    k++;
+                }
+                T1 w[3], l;
+                T1 tt = upwindLinearization(sxyz<T1>(nodes[nD]), tD, nodes[nD].getNodeSlowness(),
+                                            x, t, w, l);
+                if ( std::abs(tt - tD) < err ) {
+                    best = tt;
+                    err = std::abs(tt - tD);
+                    lBest = l;
+                    for ( size_t k=0; k<3; ++k ) {
+                        wBest[k] = w[k];
+                        iBest[k] = ind[k];
+                    }
+                }
+            }
+            if ( nearSource[nD] != none ) {
+                const T2 nS = nearSource[nD];
+                T1 d = nodes[nD].getDistance( nodes[nS] );
+                T1 t = nodes[nS].getTT(threadNo) + computeDt(nodes[nS], nodes[nD]);
+                if ( std::abs(t - tD) <= err ) {
+                    grad[nD] += 0.5 * lambda[nD] * d;
+                    grad[nS] += 0.5 * lambda[nD] * d;
+                    continue;
+                }
+            }
+            if ( best == std::numeric_limits<T1>::max() ) continue;
+            
+            grad[nD] += lambda[nD] * lBest;
+            for ( size_t k=0; k<3; ++k ) {
+                lambda[iBest[k]] += lambda[nD] * wBest[k];
+            }
+        }
+    }
     
 }
 
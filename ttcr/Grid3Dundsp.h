@@ -25,16 +25,17 @@
 #ifndef Grid3Dundsp_h
 #define Grid3Dundsp_h
 
+#include <algorithm>
 #include <array>
 #include <iostream>
 #include <map>
-#include <set>
 #include <vector>
 
 #include "Grid3Dun.h"
 #include "Interpolator.h"
 #include "Node3Dn.h"
 #include "Node3Dnd.h"
+#include "TempNodesCache.h"
 
 namespace ttcr {
     
@@ -50,7 +51,9 @@ namespace ttcr {
         nSecondary(ns), nTertiary(nd), nPermanent(0),
         dyn_radius(drad),
         tempNodes(std::vector<std::vector<Node3Dnd<T1,T2>>>(nt)),
-        tempNeighbors(std::vector<std::vector<std::vector<T2>>>(nt))
+        tempNeighbors(std::vector<std::vector<std::vector<T2>>>(nt)),
+        cacheTempNodes(0),
+        tempCache(std::vector<TempNodesCache<T1,T2,Node3Dnd<T1,T2>>>(nt))
         {
             this->buildGridNodes(no, ns, nt);
             this->template buildGridNeighbors<Node3Dn<T1,T2>>(this->nodes);
@@ -64,6 +67,14 @@ namespace ttcr {
         ~Grid3Dundsp() {
         }
         
+        std::string getSnapshotTag() const { return "Grid3Dundsp"; }
+        void getSnapshotParameters(std::vector<double>& p) const {
+            Grid3Dun<T1,T2,Node3Dn<T1,T2>>::getSnapshotParameters(p);
+            p.push_back( nSecondary );
+            p.push_back( nTertiary );
+            p.push_back( dyn_radius );
+        }
+        
         void setSlowness(const std::vector<T1>& s) {
             if ( this->nPrimary != s.size() ) {
                 throw std::length_error("Error: slowness vectors of incompatible size.");
@@ -77,6 +88,7 @@ namespace ttcr {
                 else
                     interpSlownessSecondary();
             }
+            this->slownessChanged();
         }
 
         void setSlowness(const T1 *s, const size_t ns) {
@@ -92,35 +104,73 @@ namespace ttcr {
                 else
                     interpSlownessSecondary();
             }
+            this->slownessChanged();
         }
 
-        void raytrace(const std::vector<sxyz<T1>>&,
-                      const std::vector<T1>&,
-                      const std::vector<sxyz<T1>>&,
-                      std::vector<T1>&,
-                      const size_t=0) const;
+    protected:
+        void raytraceLocal(const std::vector<sxyz<T1>>&,
+                           const std::vector<T1>&,
+                           const std::vector<sxyz<T1>>&,
+                           std::vector<T1>&,
+                           const size_t=0) const;
         
-        void raytrace(const std::vector<sxyz<T1>>&,
-                      const std::vector<T1>&,
-                      const std::vector<const std::vector<sxyz<T1>>*>&,
-                      std::vector<std::vector<T1>*>&,
-                      const size_t=0) const;
+        void raytraceLocal(const std::vector<sxyz<T1>>&,
+                           const std::vector<T1>&,
+                           const std::vector<const std::vector<sxyz<T1>>*>&,
+                           std::vector<std::vector<T1>*>&,
+                           const size_t=0) const;
         
-        void raytrace(const std::vector<sxyz<T1>>&,
-                      const std::vector<T1>& ,
-                      const std::vector<sxyz<T1>>&,
-                      std::vector<T1>&,
-                      std::vector<std::vector<sxyz<T1>>>&,
-                      const size_t=0) const;
+        void raytraceLocal(const std::vector<sxyz<T1>>&,
+                           const std::vector<T1>& ,
+                           const std::vector<sxyz<T1>>&,
+                           std::vector<T1>&,
+                           std::vector<std::vector<sxyz<T1>>>&,
+                           const size_t=0) const;
+
+        void raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                            const std::vector<T1>& t0,
+                            const std::vector<sxyz<T1>>& Rx,
+                            std::vector<T1>& traveltimes,
+                            RayPaths<float,T2>& rays,
+                            const size_t threadNo=0) const {
+            if ( this->rp_method < 3 ) {
+                Grid3D<T1,T2>::raytraceLocal(Tx, t0, Rx, traveltimes, rays, threadNo);
+            } else {
+                // raypaths traced back with getRaypath_blti
+                this->appendRaypaths(Tx, t0, Rx, traveltimes, rays, threadNo);
+            }
+        }
         
-        void raytrace(const std::vector<sxyz<T1>>&,
-                      const std::vector<T1>&,
-                      const std::vector<const std::vector<sxyz<T1>>*>&,
-                      std::vector<std::vector<T1>*>&,
-                      std::vector<std::vector<std::vector<sxyz<T1>>>*>&,
-                      const size_t=0) const;
+        void raytraceLocal(const std::vector<sxyz<T1>>&,
+                           const std::vector<T1>&,
+                           const std::vector<const std::vector<sxyz<T1>>*>&,
+                           std::vector<std::vector<T1>*>&,
+                           std::vector<std::vector<std::vector<sxyz<T1>>>*>&,
+                           const size_t=0) const;
         
+    public:
+        void setTempNodesCache(const size_t nTx) {
+            cacheTempNodes = nTx;
+            for ( size_t n=0; n<tempCache.size(); ++n )
+                tempCache[n].setCapacity( nTx );
+        }
 
+        void loadSnapshot(std::istream& is) {
+            Grid3Dun<T1,T2,Node3Dn<T1,T2>>::loadSnapshot(is);
+            nPermanent = static_cast<T2>(this->nodes.size());
+            for ( size_t n=0; n<tempNodes.size(); ++n ) {
+                tempNodes[n].clear();
+                tempNeighbors[n].assign(this->tetrahedra.size(), std::vector<T2>());
+                tempCache[n] = TempNodesCache<T1,T2,Node3Dnd<T1,T2>>();
+                tempCache[n].setCapacity( cacheTempNodes );
+            }
+            this->slownessChanged();
+        }
+        
+    protected:
+        // the field depends on temporary nodes, which are not cached
+        bool getTTState(std::vector<T1>&, const size_t) const { return false; }
+        
     private:
         T2 nSecondary;
         T2 nTertiary;
@@ -133,10 +183,17 @@ namespace ttcr {
         mutable std::vector<std::vector<Node3Dnd<T1,T2>>> tempNodes;
         mutable std::vector<std::vector<std::vector<T2>>> tempNeighbors;
         
+        // temporary nodes are reused as long as Tx does not move and slowness
+        // is not set
+        size_t cacheTempNodes;        // number of previous Tx whose nodes are kept
+        mutable std::vector<TempNodesCache<T1,T2,Node3Dnd<T1,T2>>> tempCache;
+        
         void interpSlownessSecondary();
         void interpVelocitySecondary();
 
         void addTemporaryNodes(const std::vector<sxyz<T1>>&, const size_t) const;
+        void buildTemporaryNodes(const std::vector<sxyz<T1>>&, const size_t) const;
+        void interpTemporaryNodes(const size_t) const;
 
         void initQueue(const std::vector<sxyz<T1>>& Tx,
                        const std::vector<T1>& t0,
@@ -155,15 +212,15 @@ namespace ttcr {
                        std::vector<bool>& frozen,
                        const size_t threadNo) const;
         
-        void raytrace(const std::vector<sxyz<T1>>&,
-                      const std::vector<T1>&,
-                      const std::vector<sxyz<T1>>&,
-                      const size_t=0) const;
+        void raytraceLocal(const std::vector<sxyz<T1>>&,
+                           const std::vector<T1>&,
+                           const std::vector<sxyz<T1>>&,
+                           const size_t=0) const;
         
-        void raytrace(const std::vector<sxyz<T1>>&,
-                      const std::vector<T1>&,
-                      const std::vector<const std::vector<sxyz<T1>>*>&,
-                      const size_t=0) const;
+        void raytraceLocal(const std::vector<sxyz<T1>>&,
+                           const std::vector<T1>&,
+                           const std::vector<const std::vector<sxyz<T1>>*>&,
+                           const size_t=0) const;
 
     };
 
@@ -361,14 +418,63 @@ namespace ttcr {
     void Grid3Dundsp<T1,T2>::addTemporaryNodes(const std::vector<sxyz<T1>>& Tx,
                                                const size_t threadNo) const {
 
-        // clear previously assigned nodes
-        tempNodes[threadNo].clear();
-        for ( size_t nt=0; nt<this->tetrahedra.size(); ++nt ) {
-            tempNeighbors[threadNo][nt].clear();
+        // clear neighbors of previously assigned nodes
+        for ( size_t n=0; n<tempNodes[threadNo].size(); ++n ) {
+            for ( size_t n2=0; n2<tempNodes[threadNo][n].getOwners().size(); ++n2 ) {
+                tempNeighbors[threadNo][ tempNodes[threadNo][n].getOwners()[n2] ].clear();
+            }
         }
 
+        if ( tempCache[threadNo].fetch(Tx, tempNodes[threadNo]) ) {
+            // same layout as for a previous call
+            for ( size_t n=0; n<tempNodes[threadNo].size(); ++n ) {
+                tempNodes[threadNo][n].reinit( 0 );
+            }
+            if ( tempCache[threadNo].version != this->slownessVersion ) {
+                interpTemporaryNodes(threadNo);
+            }
+        } else {
+            buildTemporaryNodes(Tx, threadNo);
+            interpTemporaryNodes(threadNo);
+            tempCache[threadNo].set(Tx, this->slownessVersion);
+        }
+
+        for ( T2 n=0; n<tempNodes[threadNo].size(); ++n ) {
+            for ( size_t n2=0; n2<tempNodes[threadNo][n].getOwners().size(); ++n2) {
+                tempNeighbors[threadNo][ tempNodes[threadNo][n].getOwners()[n2] ].push_back(n);
+            }
+        }
+        if ( verbose )
+            std::cout << "  *** thread no " << threadNo << ": " << tempNodes[threadNo].size() << " dynamic nodes were added ***" << std::endl;
+    }
+
+    template<typename T1, typename T2>
+    void Grid3Dundsp<T1,T2>::interpTemporaryNodes(const size_t threadNo) const {
+        for ( size_t n=0; n<tempNodes[threadNo].size(); ++n ) {
+            T1 s = 0.0;
+            if ( this->interpVel ) {
+                for ( size_t i=0; i<4; ++i ) {
+                    s += tempCache[threadNo].weights[n][i] /
+                    this->nodes[ tempCache[threadNo].parents[n][i] ].getNodeSlowness();
+                }
+                s = 1.0/s;
+            } else {
+                for ( size_t i=0; i<4; ++i ) {
+                    s += tempCache[threadNo].weights[n][i] *
+                    this->nodes[ tempCache[threadNo].parents[n][i] ].getNodeSlowness();
+                }
+            }
+            tempNodes[threadNo][n].setNodeSlowness( s );
+        }
+        tempCache[threadNo].version = this->slownessVersion;
+    }
+
+    template<typename T1, typename T2>
+    void Grid3Dundsp<T1,T2>::buildTemporaryNodes(const std::vector<sxyz<T1>>& Tx,
+                                                 const size_t threadNo) const {
+
         // find cells surrounding Tx
-        std::set<T2> txCells;
+        std::vector<T2> txCells;
         for ( size_t nt=0; nt<this->tetrahedra.size(); ++nt ) {
             // centroid of tet
             sxyz<T1> cent = sxyz<T1>(this->nodes[this->tetrahedra[nt].i[0]] +
@@ -378,14 +484,16 @@ namespace ttcr {
             cent *= 0.25;
             for (size_t n=0; n<Tx.size(); ++n) {
                 if ( cent.getDistance(Tx[n]) <= this->dyn_radius ) {
-                    txCells.insert(static_cast<T2>(nt));
+                    txCells.push_back(static_cast<T2>(nt));
                 }
             }
         }
+        std::sort(txCells.begin(), txCells.end());
+        txCells.erase( std::unique(txCells.begin(), txCells.end()), txCells.end() );
         if ( verbose )
             std::cout << "\n  *** thread no " << threadNo << ": found " << txCells.size() << " cells within radius ***" << std::endl;
 
-        std::set<T2> adjacentCells(txCells.begin(), txCells.end());
+        std::vector<T2> adjacentCells;
         
         T2 iNodes[4][3] = {
             {0,1,2},  // (relative) indices of nodes of 1st triangle
@@ -406,7 +514,8 @@ namespace ttcr {
         Node3Dnd<T1,T2> tmpNode;
         size_t nDynTot = (nSecondary+1) * nTertiary;  // total number of dynamic nodes on edges
         
-        T1 slope, islown;
+        T1 w;
+        std::array<T1,3> wf;
 
         for ( auto cell=txCells.begin(); cell!=txCells.end(); cell++ ) {
             
@@ -414,7 +523,7 @@ namespace ttcr {
             for ( size_t i=0; i<4; ++i ) {
                 T2 vertex = this->neighbors[*cell][i];
                 for ( size_t c=0; c<this->nodes[vertex].getOwners().size(); ++c ) {
-                    adjacentCells.insert(this->nodes[vertex].getOwners()[c]);
+                    adjacentCells.push_back(this->nodes[vertex].getOwners()[c]);
                 }
             }
             
@@ -442,12 +551,7 @@ namespace ttcr {
                     
                     sxyz<T1> d = (this->nodes[lineKey[1]]-this->nodes[lineKey[0]])/static_cast<T1>(nDynTot+nSecondary+1);
                     
-                    if ( this->interpVel )
-                        slope = (1.0/this->nodes[lineKey[1]].getNodeSlowness() - 1.0/this->nodes[lineKey[0]].getNodeSlowness())/
-                            this->nodes[lineKey[1]].getDistance(this->nodes[lineKey[0]]);
-                    else
-                        slope = (this->nodes[lineKey[1]].getNodeSlowness() - this->nodes[lineKey[0]].getNodeSlowness())/
-                            this->nodes[lineKey[1]].getDistance(this->nodes[lineKey[0]]);
+                    T1 len = this->nodes[lineKey[1]].getDistance(this->nodes[lineKey[0]]);
                     
                     size_t nd = 0;
                     for ( size_t n2=0; n2<nSecondary+1; ++n2 ) {
@@ -456,11 +560,9 @@ namespace ttcr {
                                                 this->nodes[lineKey[0]].getY()+(1+n2*(nTertiary+1)+n3)*d.y,
                                                 this->nodes[lineKey[0]].getZ()+(1+n2*(nTertiary+1)+n3)*d.z,
                                                 nPermanent+nTmpNodes );
-                            if ( this->interpVel )
-                                islown = 1.0/(1.0/this->nodes[lineKey[0]].getNodeSlowness() + slope * tmpNode.getDistance(this->nodes[lineKey[0]]));
-                            else
-                                islown = this->nodes[lineKey[0]].getNodeSlowness() + slope * tmpNode.getDistance(this->nodes[lineKey[0]]);
-                            tmpNode.setNodeSlowness( islown );
+                            w = tmpNode.getDistance(this->nodes[lineKey[0]])/len;
+                            tempCache[threadNo].parents.push_back( {{lineKey[0], lineKey[1], lineKey[0], lineKey[0]}} );
+                            tempCache[threadNo].weights.push_back( {{static_cast<T1>(1.0-w), static_cast<T1>(w), T1(0), T1(0)}} );
                             
                             lineMap[lineKey][nd++] = nTmpNodes++;
                             tempNodes[threadNo].push_back( tmpNode );
@@ -523,11 +625,9 @@ namespace ttcr {
                                                 pt1.y+(1+n4)*d.y,
                                                 pt1.z+(1+n4)*d.z,
                                                 nPermanent+nTmpNodes );
-                            if ( this->interpVel )
-                                islown = Interpolator<T1>::bilinearTriangleVel(tmpNode, inodes);
-                            else
-                                islown = Interpolator<T1>::bilinearTriangle(tmpNode, inodes);
-                            tmpNode.setNodeSlowness(islown);
+                            Interpolator<T1>::bilinearTriangleWeight(tmpNode, inodes[0], inodes[1], inodes[2], wf);
+                            tempCache[threadNo].parents.push_back( {{faceKey[0], faceKey[1], faceKey[2], faceKey[0]}} );
+                            tempCache[threadNo].weights.push_back( {{wf[0], wf[1], wf[2], T1(0)}} );
 
                             faceMap[faceKey][ifn++] = nTmpNodes++;
                             tempNodes[threadNo].push_back( tmpNode );
@@ -551,11 +651,9 @@ namespace ttcr {
                                                 nPermanent+nTmpNodes );
                             n5++;
                             
-                            if ( this->interpVel )
-                                islown = Interpolator<T1>::bilinearTriangleVel(tmpNode, inodes);
-                            else
-                                islown = Interpolator<T1>::bilinearTriangle(tmpNode, inodes);
-                            tmpNode.setNodeSlowness(islown);
+                            Interpolator<T1>::bilinearTriangleWeight(tmpNode, inodes[0], inodes[1], inodes[2], wf);
+                            tempCache[threadNo].parents.push_back( {{faceKey[0], faceKey[1], faceKey[2], faceKey[0]}} );
+                            tempCache[threadNo].weights.push_back( {{wf[0], wf[1], wf[2], T1(0)}} );
 
                             faceMap[faceKey][ifn++] = nTmpNodes++;
                             tempNodes[threadNo].push_back( tmpNode );
@@ -568,9 +666,13 @@ namespace ttcr {
             }
         }
         
-        for ( auto cell=txCells.begin(); cell!=txCells.end(); ++cell ) {
-            adjacentCells.erase(*cell);
-        }
+        // keep cells adjacent to, but not within, cells around Tx
+        std::sort(adjacentCells.begin(), adjacentCells.end());
+        adjacentCells.erase( std::unique(adjacentCells.begin(), adjacentCells.end()), adjacentCells.end() );
+        adjacentCells.erase( std::remove_if(adjacentCells.begin(), adjacentCells.end(),
+                                            [&txCells](const T2 c) {
+                                                return std::binary_search(txCells.begin(), txCells.end(), c); }),
+                            adjacentCells.end() );
         for ( auto adj=adjacentCells.begin(); adj!=adjacentCells.end(); ++adj ) {
             for ( T2 ntri=0; ntri<4; ++ntri ) {
                 for ( size_t nl=ntri; nl<3; ++nl ) {
@@ -618,14 +720,6 @@ namespace ttcr {
 //            std::cout << '\n';
 //        }
 //        std::cout << "noTot = " << noTot << '\n';
-        
-        for ( T2 n=0; n<tempNodes[threadNo].size(); ++n ) {
-            for ( size_t n2=0; n2<tempNodes[threadNo][n].getOwners().size(); ++n2) {
-                tempNeighbors[threadNo][ tempNodes[threadNo][n].getOwners()[n2] ].push_back(n);
-            }
-        }
-        if ( verbose )
-            std::cout << "  *** thread no " << threadNo << ": " << tempNodes[threadNo].size() << " dynamic nodes were added ***" << std::endl;
     }
     
     
@@ -765,10 +859,10 @@ namespace ttcr {
     
 
     template<typename T1, typename T2>
-    void Grid3Dundsp<T1,T2>::raytrace(const std::vector<sxyz<T1>>& Tx,
-                                      const std::vector<T1>& t0,
-                                      const std::vector<sxyz<T1>>& Rx,
-                                      const size_t threadNo) const {
+    void Grid3Dundsp<T1,T2>::raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                                           const std::vector<T1>& t0,
+                                           const std::vector<sxyz<T1>>& Rx,
+                                           const size_t threadNo) const {
         this->checkPts(Tx);
         this->checkPts(Rx);
         
@@ -792,12 +886,12 @@ namespace ttcr {
     }
 
     template<typename T1, typename T2>
-    void Grid3Dundsp<T1,T2>::raytrace(const std::vector<sxyz<T1>>& Tx,
-                                      const std::vector<T1>& t0,
-                                      const std::vector<sxyz<T1>>& Rx,
-                                      std::vector<T1>& traveltimes,
-                                      const size_t threadNo) const {
-        raytrace(Tx, t0, Rx, threadNo);
+    void Grid3Dundsp<T1,T2>::raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                                           const std::vector<T1>& t0,
+                                           const std::vector<sxyz<T1>>& Rx,
+                                           std::vector<T1>& traveltimes,
+                                           const size_t threadNo) const {
+        this->computeTT(Tx, t0, Rx, threadNo);
         
         if ( traveltimes.size() != Rx.size() ) {
             traveltimes.resize( Rx.size() );
@@ -821,10 +915,10 @@ namespace ttcr {
     }
 
     template<typename T1, typename T2>
-    void Grid3Dundsp<T1,T2>::raytrace(const std::vector<sxyz<T1>>& Tx,
-                                      const std::vector<T1>& t0,
-                                      const std::vector<const std::vector<sxyz<T1>>*>& Rx,
-                                      const size_t threadNo) const {
+    void Grid3Dundsp<T1,T2>::raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                                           const std::vector<T1>& t0,
+                                           const std::vector<const std::vector<sxyz<T1>>*>& Rx,
+                                           const size_t threadNo) const {
         this->checkPts(Tx);
         for ( size_t n=0; n<Rx.size(); ++n )
             this->checkPts(*Rx[n]);
@@ -849,12 +943,12 @@ namespace ttcr {
     }
 
     template<typename T1, typename T2>
-    void Grid3Dundsp<T1,T2>::raytrace(const std::vector<sxyz<T1>>& Tx,
-                                      const std::vector<T1>& t0,
-                                      const std::vector<const std::vector<sxyz<T1>>*>& Rx,
-                                      std::vector<std::vector<T1>*>& traveltimes,
-                                      const size_t threadNo) const {
-        raytrace(Tx, t0, Rx, threadNo);
+    void Grid3Dundsp<T1,T2>::raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                                           const std::vector<T1>& t0,
+                                           const std::vector<const std::vector<sxyz<T1>>*>& Rx,
+                                           std::vector<std::vector<T1>*>& traveltimes,
+                                           const size_t threadNo) const {
+        this->computeTT(Tx, t0, Rx, threadNo);
         
         if ( traveltimes.size() != Rx.size() ) {
             traveltimes.resize( Rx.size() );
@@ -881,13 +975,13 @@ namespace ttcr {
     }
 
     template<typename T1, typename T2>
-    void Grid3Dundsp<T1,T2>::raytrace(const std::vector<sxyz<T1>>& Tx,
-                                      const std::vector<T1>& t0,
-                                      const std::vector<sxyz<T1>>& Rx,
-                                      std::vector<T1>& traveltimes,
-                                      std::vector<std::vector<sxyz<T1>>>& r_data,
-                                      const size_t threadNo) const {
-        raytrace(Tx, t0, Rx, threadNo);
+    void Grid3Dundsp<T1,T2>::raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                                           const std::vector<T1>& t0,
+                                           const std::vector<sxyz<T1>>& Rx,
+                                           std::vector<T1>& traveltimes,
+                                           std::vector<std::vector<sxyz<T1>>>& r_data,
+                                           const size_t threadNo) const {
+        this->computeTT(Tx, t0, Rx, threadNo);
         
         if ( r_data.size() != Rx.size() ) {
             r_data.resize( Rx.size() );
@@ -911,14 +1005,14 @@ namespace ttcr {
     }
 
     template<typename T1, typename T2>
-    void Grid3Dundsp<T1,T2>::raytrace(const std::vector<sxyz<T1>>& Tx,
-                                      const std::vector<T1>& t0,
-                                      const std::vector<const std::vector<sxyz<T1>>*>& Rx,
-                                      std::vector<std::vector<T1>*>& traveltimes,
-                                      std::vector<std::vector<std::vector<sxyz<T1>>>*>& r_data,
-                                      const size_t threadNo) const {
-        
-        raytrace(Tx, t0, Rx, threadNo);
+    void Grid3Dundsp<T1,T2>::raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                                           const std::vector<T1>& t0,
+                                           const std::vector<const std::vector<sxyz<T1>>*>& Rx,
+                                           std::vector<std::vector<T1>*>& traveltimes,
+                                           std::vector<std::vector<std::vector<sxyz<T1>>>*>& r_data,
+                                           const size_t threadNo) const {
+        
+        this->computeTT(Tx, t0, Rx, threadNo);
         
         if ( r_data.size() != Rx.size() ) {
             r_data.resize( Rx.size() );
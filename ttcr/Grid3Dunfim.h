@@ -0,0 +1,485 @@
+//
+//  Grid3Dunfim.h
+//  ttcr
+//
+//  Created by agent on 2026-10-18.
+//  Copyright (c) 2026 agent. All rights reserved.
+//
+
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef ttcr_Grid3Dunfim_h
+#define ttcr_Grid3Dunfim_h
+
+#include <atomic>
+#include <cmath>
+#include <fstream>
+#include <vector>
+
+#include "Grid3Dun.h"
+#include "Node3Dn.h"
+#include "Workers.h"
+
+namespace ttcr {
+
+    // Fast Iterative Method (Jeong & Whitaker, 2008): the nodes of an active
+    // list are updated concurrently with the local solver of Lelievre et al.
+    // (2011), converged nodes are removed from the list and their neighbours
+    // activated.
+
+    template<typename T1, typename T2>
+    class Grid3Dunfim : public Grid3Dun<T1,T2,Node3Dn<T1,T2>> {
+    public:
+        Grid3Dunfim(const std::vector<sxyz<T1>>& no,
+                    const std::vector<tetrahedronElem<T2>>& tet,
+                    const T1 eps, const int rp, const bool iv,
+                    const bool rptt, const T1 md, const size_t nt=1,
+                    const size_t nw=1) :
+        Grid3Dun<T1,T2,Node3Dn<T1,T2>>(no, tet, rp, iv, rptt, md, nt),
+        epsilon(eps), nWorkers(nw>0 ? nw : 1), niter_final(0), nShots(0)
+        {
+            this->buildGridNodes(no, nt);
+            this->template buildGridNeighbors<Node3Dn<T1,T2>>(this->nodes);
+        }
+        
+        ~Grid3Dunfim() {
+        }
+        
+        std::string getSnapshotTag() const { return "Grid3Dunfim"; }
+        
+        int get_niter() const { return niter_final; }
+        
+    protected:
+        void raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                           const std::vector<T1>& t0,
+                           const std::vector<sxyz<T1>>& Rx,
+                           std::vector<T1>& traveltimes,
+                           const size_t threadNo=0) const;
+        
+        void raytraceLocal(const std::vector<sxyz<T1>>&,
+                           const std::vector<T1>&,
+                           const std::vector<const std::vector<sxyz<T1>>*>&,
+                           std::vector<std::vector<T1>*>&,
+                           const size_t=0) const;
+        
+        void raytraceLocal(const std::vector<sxyz<T1>>&,
+                           const std::vector<T1>& ,
+                           const std::vector<sxyz<T1>>&,
+                           std::vector<T1>&,
+                           std::vector<std::vector<sxyz<T1>>>&,
+                           const size_t=0) const;
+        
+        void raytraceLocal(const std::vector<sxyz<T1>>&,
+                           const std::vector<T1>&,
+                           const std::vector<const std::vector<sxyz<T1>>*>&,
+                           std::vector<std::vector<T1>*>&,
+                           std::vector<std::vector<std::vector<sxyz<T1>>>*>&,
+                           const size_t=0) const;
+
+    private:
+        T1 epsilon;
+        size_t nWorkers;                     // threads updating the active list
+        mutable int niter_final;
+        mutable std::atomic<size_t> nShots;  // shots being computed concurrently
+        
+        void restoreSolve(const std::vector<sxyz<T1>>&, const std::vector<T1>&,
+                          const int n, const int, const size_t) const {
+            niter_final = n;
+        }
+        
+        void initTx(const std::vector<sxyz<T1>>& Tx, const std::vector<T1>& t0,
+                    std::vector<bool>& frozen, const size_t threadNo) const;
+        
+        void propagate(const std::vector<bool>& frozen,
+                       const size_t threadNo) const;
+        
+        void localSolutions(const std::vector<T2>& list,
+                            std::vector<T1>& tt,
+                            Workers& workers,
+                            const size_t threadNo) const;
+        
+        void raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                           const std::vector<T1>& t0,
+                           const std::vector<sxyz<T1>>& Rx,
+                           const size_t threadNo=0) const;
+        
+        void raytraceLocal(const std::vector<sxyz<T1>>&,
+                           const std::vector<T1>&,
+                           const std::vector<const std::vector<sxyz<T1>>*>&,
+                           const size_t=0) const;
+
+    };
+
+    template<typename T1, typename T2>
+    void Grid3Dunfim<T1,T2>::raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                                           const std::vector<T1>& t0,
+                                           const std::vector<sxyz<T1>>& Rx,
+                                           const size_t threadNo) const {
+        
+        this->checkPts(Tx);
+        this->checkPts(Rx);
+        
+        for ( size_t n=0; n<this->nodes.size(); ++n ) {
+            this->nodes[n].reinit( threadNo );
+        }
+        
+        std::vector<bool> frozen( this->nodes.size(), false );
+        initTx(Tx, t0, frozen, threadNo);
+        
+        propagate(frozen, threadNo);
+    }
+
+    template<typename T1, typename T2>
+    void Grid3Dunfim<T1,T2>::raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                                           const std::vector<T1>& t0,
+                                           const std::vector<const std::vector<sxyz<T1>>*>& Rx,
+                                           const size_t threadNo) const {
+        
+        this->checkPts(Tx);
+        for ( size_t n=0; n<Rx.size(); ++n )
+            this->checkPts(*Rx[n]);
+        
+        for ( size_t n=0; n<this->nodes.size(); ++n ) {
+            this->nodes[n].reinit( threadNo );
+        }
+        
+        std::vector<bool> frozen( this->nodes.size(), false );
+        initTx(Tx, t0, frozen, threadNo);
+        
+        propagate(frozen, threadNo);
+    }
+
+    template<typename T1, typename T2>
+    void Grid3Dunfim<T1,T2>::raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                                           const std::vector<T1>& t0,
+                                           const std::vector<sxyz<T1>>& Rx,
+                                           std::vector<T1>& traveltimes,
+                                           const size_t threadNo) const {
+        
+        this->computeTT(Tx, t0, Rx, threadNo);
+        
+        if ( traveltimes.size() != Rx.size() ) {
+            traveltimes.resize( Rx.size() );
+        }
+        
+        if ( this->tt_from_rp ) {
+            for (size_t n=0; n<Rx.size(); ++n) {
+                traveltimes[n] = this->getTraveltimeFromRaypath(Tx, t0, Rx[n], threadNo);
+            }
+        } else {
+            for (size_t n=0; n<Rx.size(); ++n) {
+                traveltimes[n] = this->getTraveltime(Rx[n], this->nodes, threadNo);
+            }
+        }
+    }
+
+    template<typename T1, typename T2>
+    void Grid3Dunfim<T1,T2>::raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                                           const std::vector<T1>& t0,
+                                           const std::vector<const std::vector<sxyz<T1>>*>& Rx,
+                                           std::vector<std::vector<T1>*>& traveltimes,
+                                           const size_t threadNo) const {
+        
+        this->computeTT(Tx, t0, Rx, threadNo);
+        
+        if ( traveltimes.size() != Rx.size() ) {
+            traveltimes.resize( Rx.size() );
+        }
+        
+        if ( this->tt_from_rp ) {
+            for (size_t nr=0; nr<Rx.size(); ++nr) {
+                traveltimes[nr]->resize( Rx[nr]->size() );
+                for (size_t n=0; n<Rx[nr]->size(); ++n)
+                    (*traveltimes[nr])[n] = this->getTraveltimeFromRaypath(Tx, t0, (*Rx[nr])[n], threadNo);
+            }
+        } else {
+            for (size_t nr=0; nr<Rx.size(); ++nr) {
+                traveltimes[nr]->resize( Rx[nr]->size() );
+                for (size_t n=0; n<Rx[nr]->size(); ++n)
+                    (*traveltimes[nr])[n] = this->getTraveltime((*Rx[nr])[n], this->nodes, threadNo);
+            }
+        }
+    }
+
+    template<typename T1, typename T2>
+    void Grid3Dunfim<T1,T2>::raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                                           const std::vector<T1>& t0,
+                                           const std::vector<sxyz<T1>>& Rx,
+                                           std::vector<T1>& traveltimes,
+                                           std::vector<std::vector<sxyz<T1>>>& r_data,
+                                           const size_t threadNo) const {
+        
+        this->computeTT(Tx, t0, Rx, threadNo);
+        
+        if ( traveltimes.size() != Rx.size() ) {
+            traveltimes.resize( Rx.size() );
+        }
+        if ( r_data.size() != Rx.size() ) {
+            r_data.resize( Rx.size() );
+        }
+        for ( size_t ni=0; ni<r_data.size(); ++ni ) {
+            r_data[ni].resize( 0 );
+        }
+        
+        for (size_t n=0; n<Rx.size(); ++n) {
+            this->getRaypath(Tx, t0, Rx[n], r_data[n], traveltimes[n], threadNo);
+        }
+    }
+
+    template<typename T1, typename T2>
+    void Grid3Dunfim<T1,T2>::raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                                           const std::vector<T1>& t0,
+                                           const std::vector<const std::vector<sxyz<T1>>*>& Rx,
+                                           std::vector<std::vector<T1>*>& traveltimes,
+                                           std::vector<std::vector<std::vector<sxyz<T1>>>*>& r_data,
+                                           const size_t threadNo) const {
+        
+        this->computeTT(Tx, t0, Rx, threadNo);
+        
+        if ( traveltimes.size() != Rx.size() ) {
+            traveltimes.resize( Rx.size() );
+        }
+        if ( r_data.size() != Rx.size() ) {
+            r_data.resize( Rx.size() );
+        }
+        
+        for (size_t nr=0; nr<Rx.size(); ++nr) {
+            traveltimes[nr]->resize( Rx[nr]->size() );
+            r_data[nr]->resize( Rx[nr]->size() );
+            for ( size_t ni=0; ni<r_data[nr]->size(); ++ni ) {
+                (*r_data[nr])[ni].resize( 0 );
+            }
+            
+            for (size_t n=0; n<Rx[nr]->size(); ++n) {
+                this->getRaypath(Tx, t0, (*Rx[nr])[n], (*r_data[nr])[n],
+                                 (*traveltimes[nr])[n], threadNo);
+            }
+        }
+    }
+
+    template<typename T1, typename T2>
+    void Grid3Dunfim<T1,T2>::localSolutions(const std::vector<T2>& list,
+                                            std::vector<T1>& tt,
+                                            Workers& workers,
+                                            const size_t threadNo) const {
+        
+        // traveltimes are only read here, the solutions are stored in tt
+        tt.resize( list.size() );
+        
+        // avoid handing out short lists
+        const size_t min_per_worker = 256;
+        size_t n_blk = std::min(workers.size(), list.size()/min_per_worker);
+        
+        if ( n_blk <= 1 ) {
+            for ( size_t n=0; n<list.size(); ++n ) {
+                tt[n] = this->localSolution3D(&(this->nodes[list[n]]), threadNo);
+            }
+            return;
+        }
+        
+        size_t blk_size = (list.size() + n_blk - 1) / n_blk;
+        workers.run(n_blk, [this,&list,&tt,blk_size,threadNo](const size_t i) {
+            size_t blk_end = std::min((i+1)*blk_size, list.size());
+            for ( size_t n=i*blk_size; n<blk_end; ++n ) {
+                tt[n] = this->localSolution3D(&(this->nodes[list[n]]), threadNo);
+            }
+        });
+    }
+
+    template<typename T1, typename T2>
+    void Grid3Dunfim<T1,T2>::propagate(const std::vector<bool>& frozen,
+                                       const size_t threadNo) const {
+        
+        // workers are shared among the shots computed concurrently
+        size_t ns = ++nShots;
+        size_t nw = std::max(nWorkers/ns, static_cast<size_t>(1));
+        // started once, used at each iteration
+        Workers workers(nw);
+        
+        std::vector<bool> active( this->nodes.size(), false );
+        std::vector<T2> activeList;
+        
+        // neighbours of nodes with known traveltimes form the initial list
+        for ( size_t n=0; n<this->nodes.size(); ++n ) {
+            if ( this->nodes[n].getTT(threadNo) == std::numeric_limits<T1>::max() )
+                continue;
+            for ( size_t no=0; no<this->nodes[n].getOwners().size(); ++no ) {
+                T2 cellNo = this->nodes[n].getOwners()[no];
+                for ( size_t k=0; k< this->neighbors[cellNo].size(); ++k ) {
+                    T2 neibNo = this->neighbors[cellNo][k];
+                    if ( frozen[neibNo] || active[neibNo] ) continue;
+                    active[neibNo] = true;
+                    activeList.push_back( neibNo );
+                }
+            }
+        }
+        
+        std::vector<T1> tt;
+        std::vector<T2> candidates;
+        int niter = 0;
+        while ( !activeList.empty() ) {
+            
+            localSolutions(activeList, tt, workers, threadNo);
+            
+            size_t nActive = 0;
+            candidates.clear();
+            for ( size_t n=0; n<activeList.size(); ++n ) {
+                T2 nodeNo = activeList[n];
+                T1 t = this->nodes[nodeNo].getTT(threadNo);
+                if ( tt[n] < t ) {
+                    this->nodes[nodeNo].setTT(tt[n], threadNo);
+                }
+                if ( t - tt[n] > epsilon ) {
+                    // still changing, keep in list
+                    activeList[nActive++] = nodeNo;
+                    continue;
+                }
+                
+                // node has converged, its neighbours may have to be updated
+                active[nodeNo] = false;
+                for ( size_t no=0; no<this->nodes[nodeNo].getOwners().size(); ++no ) {
+                    T2 cellNo = this->nodes[nodeNo].getOwners()[no];
+                    for ( size_t k=0; k< this->neighbors[cellNo].size(); ++k ) {
+                        T2 neibNo = this->neighbors[cellNo][k];
+                        if ( frozen[neibNo] || active[neibNo] ) continue;
+                        active[neibNo] = true;
+                        candidates.push_back( neibNo );
+                    }
+                }
+            }
+            activeList.resize( nActive );
+            
+            localSolutions(candidates, tt, workers, threadNo);
+            
+            for ( size_t n=0; n<candidates.size(); ++n ) {
+                T2 nodeNo = candidates[n];
+                if ( tt[n] < this->nodes[nodeNo].getTT(threadNo) ) {
+                    this->nodes[nodeNo].setTT(tt[n], threadNo);
+                    activeList.push_back( nodeNo );
+                } else {
+                    active[nodeNo] = false;
+                }
+            }
+            niter++;
+        }
+        niter_final = niter;
+        --nShots;
+    }
+
+    template<typename T1, typename T2>
+    void Grid3Dunfim<T1,T2>::initTx(const std::vector<sxyz<T1>>& Tx,
+                                    const std::vector<T1>& t0,
+                                    std::vector<bool>& frozen,
+                                    const size_t threadNo) const {
+        
+        this->initSource(Tx, t0, threadNo);
+        
+        for (size_t n=0; n<Tx.size(); ++n) {
+            bool found = false;
+            for ( size_t nn=0; nn<this->nodes.size(); ++nn ) {
+                if ( this->nodes[nn] == Tx[n] ) {
+                    found = true;
+                    this->nodes[nn].setTT( t0[n], threadNo );
+                    frozen[nn] = true;
+                    
+                    if ( Grid3Dun<T1,T2,Node3Dn<T1,T2>>::source_radius == 0.0 ) {
+                        // populate around Tx
+                        for ( size_t no=0; no<this->nodes[nn].getOwners().size(); ++no ) {
+                            
+                            T2 cellNo = this->nodes[nn].getOwners()[no];
+                            for ( size_t k=0; k< this->neighbors[cellNo].size(); ++k ) {
+                                T2 neibNo = this->neighbors[cellNo][k];
+                                if ( neibNo == nn ) continue;
+                                T1 dt = this->computeDt(this->nodes[nn], this->nodes[neibNo]);
+                                
+                                if ( t0[n]+dt < this->nodes[neibNo].getTT(threadNo) ) {
+                                    this->nodes[neibNo].setTT( t0[n]+dt, threadNo );
+                                }
+                            }
+                        }
+                    } else {
+                        // find nodes within source radius
+                        size_t nodes_added = 0;
+                        for ( size_t no=0; no<this->nodes.size(); ++no ) {
+                            
+                            if ( no == nn ) continue;
+                            
+                            T1 d = this->nodes[nn].getDistance( this->nodes[no] );
+                            if ( d <= Grid3Dun<T1,T2,Node3Dn<T1,T2>>::source_radius ) {
+                                
+                                T1 dt = this->computeDt(this->nodes[nn], this->nodes[no] );
+                                
+                                if ( t0[n]+dt < this->nodes[no].getTT(threadNo) ) {
+                                    if ( this->nodes[no].getTT(threadNo) == std::numeric_limits<T1>::max() ) nodes_added++;
+                                    this->nodes[no].setTT( t0[n]+dt, threadNo );
+                                }
+                            }
+                        }
+                        if ( nodes_added == 0 ) {
+                            std::cerr << "Error: no nodes found within source radius, aborting" << std::endl;
+                            abort();
+                        } else {
+                            std::cout << "(found " << nodes_added << " nodes around Tx point)\n";
+                        }
+                    }
+                    
+                    break;
+                }
+            }
+            if ( found==false ) {
+                
+                T1 sTx = this->computeSlowness( Tx[n] );
+                
+                T2 cellNo = this->getCellNo(Tx[n]);
+                if ( Grid3Dun<T1,T2,Node3Dn<T1,T2>>::source_radius == 0.0 ) {
+                    for ( size_t k=0; k< this->neighbors[cellNo].size(); ++k ) {
+                        T2 neibNo = this->neighbors[cellNo][k];
+                        // compute dt
+                        T1 dt = this->computeDt(this->nodes[neibNo], Tx[n], sTx);
+                        
+                        this->nodes[neibNo].setTT( t0[n]+dt, threadNo );
+                        frozen[neibNo] = true;
+                    }
+                } else if ( Tx.size()==1 ) { // look into source radius only for point sources
+                    // find nodes within source radius
+                    size_t nodes_added = 0;
+                    for ( size_t no=0; no<this->nodes.size(); ++no ) {
+                        
+                        T1 d = this->nodes[no].getDistance( Tx[n] );
+                        if ( d <= Grid3Dun<T1,T2,Node3Dn<T1,T2>>::source_radius ) {
+                            
+                            T1 dt = this->computeDt(this->nodes[no], Tx[n], sTx);
+                            
+                            if ( t0[n]+dt < this->nodes[no].getTT(threadNo) ) {
+                                if ( this->nodes[no].getTT(threadNo) == std::numeric_limits<T1>::max() ) nodes_added++;
+                                this->nodes[no].setTT( t0[n]+dt, threadNo );
+                            }
+                        }
+                    }
+                    if ( nodes_added == 0 ) {
+                        std::cerr << "Error: no nodes found within source radius, aborting" << std::endl;
+                        abort();
+                    } else {
+                        std::cout << "(found " << nodes_added << " nodes around Tx point)\n";
+                    }
+                }
+            }
+        }
+    }
+}
+
+#endif
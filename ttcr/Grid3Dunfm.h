@@ -51,31 +51,34 @@ namespace ttcr {
         ~Grid3Dunfm() {
         }
         
-        void raytrace(const std::vector<sxyz<T1>>& Tx,
-                     const std::vector<T1>& t0,
-                     const std::vector<sxyz<T1>>& Rx,
-                     std::vector<T1>& traveltimes,
-                     const size_t threadNo=0) const;
-        
-        void raytrace(const std::vector<sxyz<T1>>&,
-                     const std::vector<T1>&,
-                     const std::vector<const std::vector<sxyz<T1>>*>&,
-                     std::vector<std::vector<T1>*>&,
-                     const size_t=0) const;
-        
-        void raytrace(const std::vector<sxyz<T1>>&,
-                     const std::vector<T1>& ,
-                     const std::vector<sxyz<T1>>&,
-                     std::vector<T1>&,
-                     std::vector<std::vector<sxyz<T1>>>&,
-                     const size_t=0) const;
-        
-        void raytrace(const std::vector<sxyz<T1>>&,
-                     const std::vector<T1>&,
-                     const std::vector<const std::vector<sxyz<T1>>*>&,
-                     std::vector<std::vector<T1>*>&,
-                     std::vector<std::vector<std::vector<sxyz<T1>>>*>&,
-                     const size_t=0) const;
+        std::string getSnapshotTag() const { return "Grid3Dunfm"; }
+        
+    protected:
+        void raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                          const std::vector<T1>& t0,
+                          const std::vector<sxyz<T1>>& Rx,
+                          std::vector<T1>& traveltimes,
+                          const size_t threadNo=0) const;
+        
+        void raytraceLocal(const std::vector<sxyz<T1>>&,
+                          const std::vector<T1>&,
+                          const std::vector<const std::vector<sxyz<T1>>*>&,
+                          std::vector<std::vector<T1>*>&,
+                          const size_t=0) const;
+        
+        void raytraceLocal(const std::vector<sxyz<T1>>&,
+                          const std::vector<T1>& ,
+                          const std::vector<sxyz<T1>>&,
+                          std::vector<T1>&,
+                          std::vector<std::vector<sxyz<T1>>>&,
+                          const size_t=0) const;
+        
+        void raytraceLocal(const std::vector<sxyz<T1>>&,
+                          const std::vector<T1>&,
+                          const std::vector<const std::vector<sxyz<T1>>*>&,
+                          std::vector<std::vector<T1>*>&,
+                          std::vector<std::vector<std::vector<sxyz<T1>>>*>&,
+                          const size_t=0) const;
         
     private:
         
@@ -98,11 +101,11 @@ namespace ttcr {
     };
     
     template<typename T1, typename T2>
-    void Grid3Dunfm<T1,T2>::raytrace(const std::vector<sxyz<T1>>& Tx,
-                                     const std::vector<T1>& t0,
-                                     const std::vector<sxyz<T1>>& Rx,
-                                     std::vector<T1>& traveltimes,
-                                     const size_t threadNo) const {
+    void Grid3Dunfm<T1,T2>::raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                                          const std::vector<T1>& t0,
+                                          const std::vector<sxyz<T1>>& Rx,
+                                          std::vector<T1>& traveltimes,
+                                          const size_t threadNo) const {
         
         this->checkPts(Tx);
         this->checkPts(Rx);
@@ -138,11 +141,11 @@ namespace ttcr {
     }
     
     template<typename T1, typename T2>
-    void Grid3Dunfm<T1,T2>::raytrace(const std::vector<sxyz<T1>>& Tx,
-                                     const std::vector<T1>& t0,
-                                     const std::vector<const std::vector<sxyz<T1>>*>& Rx,
-                                     std::vector<std::vector<T1>*>& traveltimes,
-                                     const size_t threadNo) const {
+    void Grid3Dunfm<T1,T2>::raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                                          const std::vector<T1>& t0,
+                                          const std::vector<const std::vector<sxyz<T1>>*>& Rx,
+                                          std::vector<std::vector<T1>*>& traveltimes,
+                                          const size_t threadNo) const {
         
         this->checkPts(Tx);
         for ( size_t n=0; n<Rx.size(); ++n )
@@ -183,12 +186,12 @@ namespace ttcr {
     }
     
     template<typename T1, typename T2>
-    void Grid3Dunfm<T1,T2>::raytrace(const std::vector<sxyz<T1>>& Tx,
-                                     const std::vector<T1>& t0,
-                                     const std::vector<sxyz<T1>>& Rx,
-                                     std::vector<T1>& traveltimes,
-                                     std::vector<std::vector<sxyz<T1>>>& r_data,
-                                     const size_t threadNo) const {
+    void Grid3Dunfm<T1,T2>::raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                                          const std::vector<T1>& t0,
+                                          const std::vector<sxyz<T1>>& Rx,
+                                          std::vector<T1>& traveltimes,
+                                          std::vector<std::vector<sxyz<T1>>>& r_data,
+                                          const size_t threadNo) const {
         
         this->checkPts(Tx);
         this->checkPts(Rx);
@@ -224,12 +227,12 @@ namespace ttcr {
     }
     
     template<typename T1, typename T2>
-    void Grid3Dunfm<T1,T2>::raytrace(const std::vector<sxyz<T1>>& Tx,
-                                     const std::vector<T1>& t0,
-                                     const std::vector<const std::vector<sxyz<T1>>*>& Rx,
-                                     std::vector<std::vector<T1>*>& traveltimes,
-                                     std::vector<std::vector<std::vector<sxyz<T1>>>*>& r_data,
-                                     const size_t threadNo) const {
+    void Grid3Dunfm<T1,T2>::raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                                          const std::vector<T1>& t0,
+                                          const std::vector<const std::vector<sxyz<T1>>*>& Rx,
+                                          std::vector<std::vector<T1>*>& traveltimes,
+                                          std::vector<std::vector<std::vector<sxyz<T1>>>*>& r_data,
+                                          const size_t threadNo) const {
         
         this->checkPts(Tx);
         for ( size_t n=0; n<Rx.size(); ++n )
@@ -281,6 +284,8 @@ namespace ttcr {
                                      std::vector<bool>& frozen,
                                      const size_t threadNo) const {
         
+        this->initSource(Tx, t0, threadNo);
+        
         for (size_t n=0; n<Tx.size(); ++n) {
             bool found = false;
             for ( size_t nn=0; nn<this->nodes.size(); ++nn ) {
@@ -353,7 +358,7 @@ namespace ttcr {
             }
             if ( found==false ) {
                 
-                T2 sTx = this->computeSlowness( Tx[n] );
+                T1 sTx = this->computeSlowness( Tx[n] );
                 
                 T2 cellNo = this->getCellNo(Tx[n]);
                 if ( Grid3Dun<T1,T2,Node3Dn<T1,T2>>::source_radius == 0.0 ) {
@@ -33,6 +33,7 @@
 #include "Grid3Dun.h"
 #include "Node3Dn.h"
 #include "Metric.h"
+#include "WarmStart.h"
 
 namespace ttcr {
     
@@ -44,7 +45,7 @@ namespace ttcr {
                    const T1 eps, const int maxit, const int rp, const bool iv,
                    const bool rptt, const T1 md, const size_t nt=1) :
         Grid3Dun<T1,T2,Node3Dn<T1,T2>>(no, tet, rp, iv, rptt, md, nt),
-        epsilon(eps), nitermax(maxit), S(), niter_final(0)
+        epsilon(eps), nitermax(maxit), S(), niter_final(0), warm(nt)
         {
             this->buildGridNodes(no, nt);
             this->template buildGridNeighbors<Node3Dn<T1,T2>>(this->nodes);
@@ -56,7 +57,7 @@ namespace ttcr {
                    const int rp, const bool iv, const bool rptt, const T1 md,
                    const size_t nt=1) :
         Grid3Dun<T1,T2,Node3Dn<T1,T2>>(no, tet, rp, iv, rptt, md, nt),
-        epsilon(eps), nitermax(maxit), S(), niter_final(0)
+        epsilon(eps), nitermax(maxit), S(), niter_final(0), warm(nt)
         {
             this->buildGridNodes(no, nt);
             this->buildGridNeighbors(this->nodes);
@@ -66,52 +67,100 @@ namespace ttcr {
         ~Grid3Dunfs() {
         }
         
+        std::string getSnapshotTag() const { return "Grid3Dunfs"; }
+        
         void initOrdering(const std::vector<sxyz<T1>>& refPts, const int order);
         
-        const int get_niter() const { return niter_final; }
+        // orderings point to the nodes of the grid, initOrdering must be
+        // called again once the snapshot is loaded
+        void loadSnapshot(std::istream& is) {
+            Grid3Dun<T1,T2,Node3Dn<T1,T2>>::loadSnapshot(is);
+            S.clear();
+        }
         
-        void raytrace(const std::vector<sxyz<T1>>& Tx,
-                     const std::vector<T1>& t0,
-                     const std::vector<sxyz<T1>>& Rx,
-                     std::vector<T1>& traveltimes,
-                     const size_t threadNo=0) const;
-        
-        void raytrace(const std::vector<sxyz<T1>>&,
-                     const std::vector<T1>&,
-                     const std::vector<const std::vector<sxyz<T1>>*>&,
-                     std::vector<std::vector<T1>*>&,
-                     const size_t=0) const;
-        
-        void raytrace(const std::vector<sxyz<T1>>&,
-                     const std::vector<T1>& ,
-                     const std::vector<sxyz<T1>>&,
-                     std::vector<T1>&,
-                     std::vector<std::vector<sxyz<T1>>>&,
-                     const size_t=0) const;
-        
-        void raytrace(const std::vector<sxyz<T1>>&,
-                     const std::vector<T1>&,
-                     const std::vector<const std::vector<sxyz<T1>>*>&,
-                     std::vector<std::vector<T1>*>&,
-                     std::vector<std::vector<std::vector<sxyz<T1>>>*>&,
-                     const size_t=0) const;
+        int get_niter() const { return niter_final; }
+        int getNiter(const size_t threadNo) const { return warm.getNiter(threadNo); }
         
+        void setWarmStart(const bool w, const size_t maxBytes=268435456) { warm.setCached(w, maxBytes); }
+        void setTraveltimeSeed(const std::vector<T1>& tt,
+                               const std::vector<T1>& s,
+                               const size_t threadNo=0) const {
+            warm.setSeed(tt, s, threadNo);
+        }
+        
+        using Grid3D<T1,T2>::raytrace;
+        
+        // v0: mean velocity at the sources
         void raytrace(const std::vector<sxyz<T1>>& Tx,
-                     const std::vector<T1>& t0,
-                     const std::vector<sxyz<T1>>& Rx,
-                     std::vector<T1>& traveltimes,
-                     std::vector<std::vector<sxyz<T1>>>& r_data,
-                     T1& v0,
-                     const size_t threadNo=0) const;
+                      const std::vector<T1>& t0,
+                      const std::vector<sxyz<T1>>& Rx,
+                      std::vector<T1>& traveltimes,
+                      std::vector<std::vector<sxyz<T1>>>& r_data,
+                      T1& v0,
+                      const size_t threadNo=0) const {
+            std::vector<sxyz<T1>> lTx, lRx;
+            raytraceLocal(this->toLocal(Tx, lTx), t0, this->toLocal(Rx, lRx),
+                          traveltimes, r_data, v0, threadNo);
+            this->toGlobal(r_data);
+        }
         
         void raytrace(const std::vector<sxyz<T1>>& Tx,
-                     const std::vector<T1>& t0,
-                     const std::vector<sxyz<T1>>& Rx,
-                     std::vector<T1>& traveltimes,
-                     std::vector<std::vector<sxyz<T1>>>& r_data,
-                     T1& v0,
-                     std::vector<std::vector<sijv<T1>>>& m_data,
-                     const size_t threadNo=0) const;
+                      const std::vector<T1>& t0,
+                      const std::vector<sxyz<T1>>& Rx,
+                      std::vector<T1>& traveltimes,
+                      std::vector<std::vector<sxyz<T1>>>& r_data,
+                      T1& v0,
+                      std::vector<std::vector<sijv<T1>>>& m_data,
+                      const size_t threadNo=0) const {
+            std::vector<sxyz<T1>> lTx, lRx;
+            raytraceLocal(this->toLocal(Tx, lTx), t0, this->toLocal(Rx, lRx),
+                          traveltimes, r_data, v0, m_data, threadNo);
+            this->toGlobal(r_data);
+        }
+        
+    protected:
+        void raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                          const std::vector<T1>& t0,
+                          const std::vector<sxyz<T1>>& Rx,
+                          std::vector<T1>& traveltimes,
+                          const size_t threadNo=0) const;
+        
+        void raytraceLocal(const std::vector<sxyz<T1>>&,
+                          const std::vector<T1>&,
+                          const std::vector<const std::vector<sxyz<T1>>*>&,
+                          std::vector<std::vector<T1>*>&,
+                          const size_t=0) const;
+        
+        void raytraceLocal(const std::vector<sxyz<T1>>&,
+                          const std::vector<T1>& ,
+                          const std::vector<sxyz<T1>>&,
+                          std::vector<T1>&,
+                          std::vector<std::vector<sxyz<T1>>>&,
+                          const size_t=0) const;
+        
+        void raytraceLocal(const std::vector<sxyz<T1>>&,
+                          const std::vector<T1>&,
+                          const std::vector<const std::vector<sxyz<T1>>*>&,
+                          std::vector<std::vector<T1>*>&,
+                          std::vector<std::vector<std::vector<sxyz<T1>>>*>&,
+                          const size_t=0) const;
+        
+        void raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                          const std::vector<T1>& t0,
+                          const std::vector<sxyz<T1>>& Rx,
+                          std::vector<T1>& traveltimes,
+                          std::vector<std::vector<sxyz<T1>>>& r_data,
+                          T1& v0,
+                          const size_t threadNo=0) const;
+        
+        void raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                          const std::vector<T1>& t0,
+                          const std::vector<sxyz<T1>>& Rx,
+                          std::vector<T1>& traveltimes,
+                          std::vector<std::vector<sxyz<T1>>>& r_data,
+                          T1& v0,
+                          std::vector<std::vector<sijv<T1>>>& m_data,
+                          const size_t threadNo=0) const;
 
     private:
         T1 epsilon;
@@ -119,6 +168,34 @@ namespace ttcr {
         std::vector<std::vector<Node3Dn<T1,T2>*>> S;
         mutable int niter_final;
         
+        // initial fields and number of sweeps, for each thread
+        mutable WarmStart<T1> warm;
+        
+        bool initWarmStart(const std::vector<sxyz<T1>>& Tx,
+                           const std::vector<T1>& t0,
+                           const std::vector<bool>& frozen,
+                           std::vector<bool>& active,
+                           bool& relax,
+                           const size_t threadNo) const;
+        // the seed supplied for the thread was meant for a solve, and is
+        // dropped; the traveltimes are kept for a warm start from Tx
+        void restoreSolve(const std::vector<sxyz<T1>>& Tx,
+                          const std::vector<T1>& t0,
+                          const int n, const int,
+                          const size_t threadNo) const {
+            niter_final = n;
+            warm.setNiter(n, threadNo);
+            warm.dropSeed(threadNo);
+            if ( warm.isCached() ) warm.put(Tx, t0, warm.makeField(this->nodes, threadNo));
+        }
+        void relaxedUpdate3D(Node3Dn<T1,T2> *vertexC, const size_t threadNo) const;
+        
+        T1 updateActive(Node3Dn<T1,T2> *vertexC,
+                        const std::vector<bool>& frozen,
+                        std::vector<bool>& active,
+                        const bool relax,
+                        const size_t threadNo) const;
+        
         void initTx(const std::vector<sxyz<T1>>& Tx, const std::vector<T1>& t0,
                     std::vector<bool>& frozen, const size_t threadNo) const;
         
@@ -139,15 +216,15 @@ namespace ttcr {
                        std::vector<bool>&,
                        const size_t) const;
         
-        void raytrace(const std::vector<sxyz<T1>>& Tx,
-                      const std::vector<T1>& t0,
-                      const std::vector<sxyz<T1>>& Rx,
-                      const size_t threadNo=0) const;
+        void raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                           const std::vector<T1>& t0,
+                           const std::vector<sxyz<T1>>& Rx,
+                           const size_t threadNo=0) const;
         
-        void raytrace(const std::vector<sxyz<T1>>&,
-                      const std::vector<T1>&,
-                      const std::vector<const std::vector<sxyz<T1>>*>&,
-                      const size_t=0) const;
+        void raytraceLocal(const std::vector<sxyz<T1>>&,
+                           const std::vector<T1>&,
+                           const std::vector<const std::vector<sxyz<T1>>*>&,
+                           const size_t=0) const;
 
     };
     
@@ -181,10 +258,85 @@ namespace ttcr {
     }
     
     template<typename T1, typename T2>
-    void Grid3Dunfs<T1,T2>::raytrace(const std::vector<sxyz<T1>>& Tx,
-                                     const std::vector<T1>& t0,
-                                     const std::vector<sxyz<T1>>& Rx,
-                                     const size_t threadNo) const {
+    bool Grid3Dunfs<T1,T2>::initWarmStart(const std::vector<sxyz<T1>>& Tx,
+                                          const std::vector<T1>& t0,
+                                          const std::vector<bool>& frozen,
+                                          std::vector<bool>& active,
+                                          bool& relax,
+                                          const size_t threadNo) const {
+        
+        // Start from the field of a previous solve, if any.  Returns true if
+        // nodes were initialized, in which case only the nodes flagged by
+        // WarmStart::seedNodes and the nodes of the cells they belong to are
+        // active, and relax is set if relaxed updates are needed.
+        typename WarmStart<T1>::field f = warm.get(Tx, t0, threadNo);
+        if ( !f ) return false;
+        
+        std::vector<bool> changed;
+        relax = warm.seedNodes(*f, this->nodes, frozen, changed, threadNo);
+        active.assign( this->nodes.size(), false );
+        for ( size_t n=0; n<this->nodes.size(); ++n ) {
+            if ( !changed[n] ) continue;
+            active[n] = true;
+            for ( size_t no=0; no<this->nodes[n].getOwners().size(); ++no ) {
+                T2 cellNo = this->nodes[n].getOwners()[no];
+                for ( size_t k=0; k<this->neighbors[cellNo].size(); ++k )
+                    active[ this->neighbors[cellNo][k] ] = true;
+            }
+        }
+        return true;
+    }
+    
+    template<typename T1, typename T2>
+    void Grid3Dunfs<T1,T2>::relaxedUpdate3D(Node3Dn<T1,T2> *vertexC,
+                                            const size_t threadNo) const {
+        // the current value comes from a previous solve and is not necessarily
+        // an upper bound: keep the local solution even if it is larger, unless
+        // the difference is within round-off
+        T1 t = vertexC->getTT(threadNo);
+        vertexC->setTT(std::numeric_limits<T1>::max(), threadNo);
+        this->localUpdate3D(vertexC, threadNo);
+        T1 tn = vertexC->getTT(threadNo);
+        if ( tn == std::numeric_limits<T1>::max() ||
+            (tn >= t && tn-t <= 100*std::numeric_limits<T1>::epsilon()*t) )
+            vertexC->setTT(t, threadNo);
+    }
+    
+    template<typename T1, typename T2>
+    T1 Grid3Dunfs<T1,T2>::updateActive(Node3Dn<T1,T2> *vertexC,
+                                       const std::vector<bool>& frozen,
+                                       std::vector<bool>& active,
+                                       const bool relax,
+                                       const size_t threadNo) const {
+        // nodes are locked (inactive) until one of the nodes of the cells
+        // they belong to is modified
+        T2 n = vertexC->getGridIndex();
+        if ( frozen[n] || !active[n] )
+            return 0.0;
+        active[n] = false;
+        
+        T1 t = vertexC->getTT(threadNo);
+        if ( relax )
+            relaxedUpdate3D(vertexC, threadNo);
+        else
+            this->localUpdate3D(vertexC, threadNo);
+        T1 dt = std::abs( t - vertexC->getTT(threadNo) );
+        if ( dt > 0.0 ) {
+            for ( size_t no=0; no<vertexC->getOwners().size(); ++no ) {
+                T2 cellNo = vertexC->getOwners()[no];
+                for ( size_t k=0; k<this->neighbors[cellNo].size(); ++k )
+                    active[ this->neighbors[cellNo][k] ] = true;
+            }
+            active[n] = false;
+        }
+        return dt;
+    }
+    
+    template<typename T1, typename T2>
+    void Grid3Dunfs<T1,T2>::raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                                          const std::vector<T1>& t0,
+                                          const std::vector<sxyz<T1>>& Rx,
+                                          const size_t threadNo) const {
         
         this->checkPts(Tx);
         this->checkPts(Rx);
@@ -195,10 +347,11 @@ namespace ttcr {
         
         std::vector<bool> frozen( this->nodes.size(), false );
         initTx(Tx, t0, frozen, threadNo);
-        
-        std::vector<T1> times( this->nodes.size() );
-        for ( size_t n=0; n<this->nodes.size(); ++n )
-            times[n] = this->nodes[n].getTT( threadNo );
+        // all nodes are active at first, unless starting from the field of
+        // a previous solve
+        std::vector<bool> active( this->nodes.size(), true );
+        bool relax = false;
+        initWarmStart(Tx, t0, frozen, active, relax, threadNo);
         
         int niter = 0;
         T1 change = std::numeric_limits<T1>::max();
@@ -207,37 +360,21 @@ namespace ttcr {
             for ( size_t i=0; i<S.size(); ++i ) {
                 
                 // ascending
+                change = 0.0;
                 for ( auto vertexC=S[i].begin(); vertexC!=S[i].end(); ++vertexC ) {
-                    if ( !frozen[(*vertexC)->getGridIndex()] )
-                        //                    this->local3Dsolver(*vertexC, threadNo);
-                        this->localUpdate3D(*vertexC, threadNo);
+                    change += updateActive(*vertexC, frozen, active, relax, threadNo);
                 }
                 
-                change = 0.0;
-                for ( size_t n=0; n<this->nodes.size(); ++n ) {
-                    T1 dt = std::abs( times[n] - this->nodes[n].getTT(threadNo) );
-                    
-                    change += dt;
-                    times[n] = this->nodes[n].getTT(threadNo);
-                }
                 if ( change < epsilon ) {
                     break;
                 }
                 
                 // descending
+                change = 0.0;
                 for ( auto vertexC=S[i].rbegin(); vertexC!=S[i].rend(); ++vertexC ) {
-                    if ( !frozen[(*vertexC)->getGridIndex()] )
-                        //                    this->local3Dsolver(*vertexC, threadNo);
-                        this->localUpdate3D(*vertexC, threadNo);
+                    change += updateActive(*vertexC, frozen, active, relax, threadNo);
                 }
                 
-                change = 0.0;
-                for ( size_t n=0; n<this->nodes.size(); ++n ) {
-                    T1 dt = std::abs( times[n] - this->nodes[n].getTT(threadNo) );
-                    
-                    change += dt;
-                    times[n] = this->nodes[n].getTT(threadNo);
-                }
                 if ( change < epsilon ) {
                     break;
                 }
@@ -245,16 +382,18 @@ namespace ttcr {
             niter++;
         }
         niter_final = niter;
+        warm.setNiter(niter, threadNo);
+        if ( warm.isCached() ) warm.put(Tx, t0, warm.makeField(this->nodes, threadNo));
     }
     
     template<typename T1, typename T2>
-    void Grid3Dunfs<T1,T2>::raytrace(const std::vector<sxyz<T1>>& Tx,
-                                     const std::vector<T1>& t0,
-                                     const std::vector<sxyz<T1>>& Rx,
-                                     std::vector<T1>& traveltimes,
-                                     const size_t threadNo) const {
+    void Grid3Dunfs<T1,T2>::raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                                          const std::vector<T1>& t0,
+                                          const std::vector<sxyz<T1>>& Rx,
+                                          std::vector<T1>& traveltimes,
+                                          const size_t threadNo) const {
         
-        raytrace(Tx, t0, Rx, threadNo);
+        this->computeTT(Tx, t0, Rx, threadNo);
         
         if ( traveltimes.size() != Rx.size() ) {
             traveltimes.resize( Rx.size() );
@@ -272,10 +411,10 @@ namespace ttcr {
     }
     
     template<typename T1, typename T2>
-    void Grid3Dunfs<T1,T2>::raytrace(const std::vector<sxyz<T1>>& Tx,
-                                     const std::vector<T1>& t0,
-                                     const std::vector<const std::vector<sxyz<T1>>*>& Rx,
-                                     const size_t threadNo) const {
+    void Grid3Dunfs<T1,T2>::raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                                          const std::vector<T1>& t0,
+                                          const std::vector<const std::vector<sxyz<T1>>*>& Rx,
+                                          const size_t threadNo) const {
         
         this->checkPts(Tx);
         for ( size_t n=0; n<Rx.size(); ++n )
@@ -287,10 +426,11 @@ namespace ttcr {
         
         std::vector<bool> frozen( this->nodes.size(), false );
         initTx(Tx, t0, frozen, threadNo);
-        
-        std::vector<T1> times( this->nodes.size() );
-        for ( size_t n=0; n<this->nodes.size(); ++n )
-            times[n] = this->nodes[n].getTT( threadNo );
+        // all nodes are active at first, unless starting from the field of
+        // a previous solve
+        std::vector<bool> active( this->nodes.size(), true );
+        bool relax = false;
+        initWarmStart(Tx, t0, frozen, active, relax, threadNo);
         
         int niter = 0;
         T1 change = std::numeric_limits<T1>::max();
@@ -299,37 +439,21 @@ namespace ttcr {
             for ( size_t i=0; i<S.size(); ++i ) {
                 
                 // ascending
+                change = 0.0;
                 for ( auto vertexC=S[i].begin(); vertexC!=S[i].end(); ++vertexC ) {
-                    if ( !frozen[(*vertexC)->getGridIndex()] )
-                        //                    this->local3Dsolver(*vertexC, threadNo);
-                        this->localUpdate3D(*vertexC, threadNo);
+                    change += updateActive(*vertexC, frozen, active, relax, threadNo);
                 }
                 
-                change = 0.0;
-                for ( size_t n=0; n<this->nodes.size(); ++n ) {
-                    T1 dt = std::abs( times[n] - this->nodes[n].getTT(threadNo) );
-                    
-                    change += dt;
-                    times[n] = this->nodes[n].getTT(threadNo);
-                }
                 if ( change < epsilon ) {
                     break;
                 }
                 
                 // descending
+                change = 0.0;
                 for ( auto vertexC=S[i].rbegin(); vertexC!=S[i].rend(); ++vertexC ) {
-                    if ( !frozen[(*vertexC)->getGridIndex()] )
-                        //                    this->local3Dsolver(*vertexC, threadNo);
-                        this->localUpdate3D(*vertexC, threadNo);
+                    change += updateActive(*vertexC, frozen, active, relax, threadNo);
                 }
                 
-                change = 0.0;
-                for ( size_t n=0; n<this->nodes.size(); ++n ) {
-                    T1 dt = std::abs( times[n] - this->nodes[n].getTT(threadNo) );
-                    
-                    change += dt;
-                    times[n] = this->nodes[n].getTT(threadNo);
-                }
                 if ( change < epsilon ) {
                     break;
                 }
@@ -338,16 +462,18 @@ namespace ttcr {
             niter++;
         }
         niter_final = niter;
+        warm.setNiter(niter, threadNo);
+        if ( warm.isCached() ) warm.put(Tx, t0, warm.makeField(this->nodes, threadNo));
     }
 
     template<typename T1, typename T2>
-    void Grid3Dunfs<T1,T2>::raytrace(const std::vector<sxyz<T1>>& Tx,
-                                     const std::vector<T1>& t0,
-                                     const std::vector<const std::vector<sxyz<T1>>*>& Rx,
-                                     std::vector<std::vector<T1>*>& traveltimes,
-                                     const size_t threadNo) const {
+    void Grid3Dunfs<T1,T2>::raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                                          const std::vector<T1>& t0,
+                                          const std::vector<const std::vector<sxyz<T1>>*>& Rx,
+                                          std::vector<std::vector<T1>*>& traveltimes,
+                                          const size_t threadNo) const {
         
-        raytrace(Tx, t0, Rx, threadNo);
+        this->computeTT(Tx, t0, Rx, threadNo);
         
         if ( traveltimes.size() != Rx.size() ) {
             traveltimes.resize( Rx.size() );
@@ -369,14 +495,14 @@ namespace ttcr {
     }
 
     template<typename T1, typename T2>
-    void Grid3Dunfs<T1,T2>::raytrace(const std::vector<sxyz<T1>>& Tx,
-                                     const std::vector<T1>& t0,
-                                     const std::vector<sxyz<T1>>& Rx,
-                                     std::vector<T1>& traveltimes,
-                                     std::vector<std::vector<sxyz<T1>>>& r_data,
-                                     const size_t threadNo) const {
+    void Grid3Dunfs<T1,T2>::raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                                          const std::vector<T1>& t0,
+                                          const std::vector<sxyz<T1>>& Rx,
+                                          std::vector<T1>& traveltimes,
+                                          std::vector<std::vector<sxyz<T1>>>& r_data,
+                                          const size_t threadNo) const {
         
-        raytrace(Tx, t0, Rx, threadNo);
+        this->computeTT(Tx, t0, Rx, threadNo);
         
         if ( traveltimes.size() != Rx.size() ) {
             traveltimes.resize( Rx.size() );
@@ -394,14 +520,14 @@ namespace ttcr {
     }
     
     template<typename T1, typename T2>
-    void Grid3Dunfs<T1,T2>::raytrace(const std::vector<sxyz<T1>>& Tx,
-                                     const std::vector<T1>& t0,
-                                     const std::vector<const std::vector<sxyz<T1>>*>& Rx,
-                                     std::vector<std::vector<T1>*>& traveltimes,
-                                     std::vector<std::vector<std::vector<sxyz<T1>>>*>& r_data,
-                                     const size_t threadNo) const {
+    void Grid3Dunfs<T1,T2>::raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                                          const std::vector<T1>& t0,
+                                          const std::vector<const std::vector<sxyz<T1>>*>& Rx,
+                                          std::vector<std::vector<T1>*>& traveltimes,
+                                          std::vector<std::vector<std::vector<sxyz<T1>>>*>& r_data,
+                                          const size_t threadNo) const {
         
-        raytrace(Tx, t0, Rx, threadNo);
+        this->computeTT(Tx, t0, Rx, threadNo);
         
         if ( traveltimes.size() != Rx.size() ) {
             traveltimes.resize( Rx.size() );
@@ -425,15 +551,15 @@ namespace ttcr {
     }
     
     template<typename T1, typename T2>
-    void Grid3Dunfs<T1,T2>::raytrace(const std::vector<sxyz<T1>>& Tx,
-                                     const std::vector<T1>& t0,
-                                     const std::vector<sxyz<T1>>& Rx,
-                                     std::vector<T1>& traveltimes,
-                                     std::vector<std::vector<sxyz<T1>>>& r_data,
-                                     T1& v0,
-                                     const size_t threadNo) const {
+    void Grid3Dunfs<T1,T2>::raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                                          const std::vector<T1>& t0,
+                                          const std::vector<sxyz<T1>>& Rx,
+                                          std::vector<T1>& traveltimes,
+                                          std::vector<std::vector<sxyz<T1>>>& r_data,
+                                          T1& v0,
+                                          const size_t threadNo) const {
         
-        raytrace(Tx, t0, Rx, threadNo);
+        this->computeTT(Tx, t0, Rx, threadNo);
         
         if ( traveltimes.size() != Rx.size() ) {
             traveltimes.resize( Rx.size() );
@@ -457,16 +583,16 @@ namespace ttcr {
     }
     
     template<typename T1, typename T2>
-    void Grid3Dunfs<T1,T2>::raytrace(const std::vector<sxyz<T1>>& Tx,
-                                     const std::vector<T1>& t0,
-                                     const std::vector<sxyz<T1>>& Rx,
-                                     std::vector<T1>& traveltimes,
-                                     std::vector<std::vector<sxyz<T1>>>& r_data,
-                                     T1& v0,
-                                     std::vector<std::vector<sijv<T1>>>& m_data,
-                                     const size_t threadNo) const {
+    void Grid3Dunfs<T1,T2>::raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                                          const std::vector<T1>& t0,
+                                          const std::vector<sxyz<T1>>& Rx,
+                                          std::vector<T1>& traveltimes,
+                                          std::vector<std::vector<sxyz<T1>>>& r_data,
+                                          T1& v0,
+                                          std::vector<std::vector<sijv<T1>>>& m_data,
+                                          const size_t threadNo) const {
         
-        raytrace(Tx, t0, Rx, traveltimes, threadNo);
+        raytraceLocal(Tx, t0, Rx, traveltimes, threadNo);
         
         if ( r_data.size() != Rx.size() ) {
             r_data.resize( Rx.size() );
@@ -499,6 +625,8 @@ namespace ttcr {
                                    std::vector<bool>& frozen,
                                    const size_t threadNo) const {
         
+        this->initSource(Tx, t0, threadNo);
+        
         for (size_t n=0; n<Tx.size(); ++n) {
             bool found = false;
             for ( size_t nn=0; nn<this->nodes.size(); ++nn ) {
@@ -554,7 +682,7 @@ namespace ttcr {
             }
             if ( found==false ) {
                 
-                T2 sTx = this->computeSlowness( Tx[n] );
+                T1 sTx = this->computeSlowness( Tx[n] );
                 
                 T2 cellNo = this->getCellNo(Tx[n]);
                 if ( Grid3Dun<T1,T2,Node3Dn<T1,T2>>::source_radius == 0.0 ) {
@@ -34,6 +34,7 @@
 #include <stdexcept>
 #include <vector>
 
+#include "EdgeLengths.h"
 #include "Grid3Dun.h"
 #include "Interpolator.h"
 #include "Node3Dnsp.h"
@@ -49,15 +50,34 @@ namespace ttcr {
                    const int ns, const bool iv, const bool rptt, const T1 md,
                    const size_t nt=1) :
         Grid3Dun<T1,T2,Node3Dnsp<T1,T2>>(no, tet, 1, iv, rptt, md, nt),
-        nSecondary(ns)
+        nSecondary(ns),
+        edgeTablesMaxBytes(CellEdgeLengths<T1,T2>::defaultMaxBytes)
         {
             this->buildGridNodes(no, ns, nt);
             this->template buildGridNeighbors<Node3Dnsp<T1,T2>>(this->nodes);
+            buildEdgeLengths();
         }
         
         ~Grid3Dunsp() {
         }
         
+        void setEdgeTables(const size_t maxBytes) {
+            edgeTablesMaxBytes = maxBytes;
+            buildEdgeLengths();
+        }
+        bool hasEdgeTables() const { return !edgeLengths.empty(); }
+        
+        std::string getSnapshotTag() const { return "Grid3Dunsp"; }
+        void getSnapshotParameters(std::vector<double>& p) const {
+            Grid3Dun<T1,T2,Node3Dnsp<T1,T2>>::getSnapshotParameters(p);
+            p.push_back( nSecondary );
+        }
+        
+        void loadSnapshot(std::istream& is) {
+            Grid3Dun<T1,T2,Node3Dnsp<T1,T2>>::loadSnapshot(is);
+            buildEdgeLengths();
+        }
+        
         void setSlowness(const std::vector<T1>& s) {
             if ( this->nPrimary != s.size() ) {
                 throw std::length_error("Error: slowness vectors of incompatible size.");
@@ -71,6 +91,7 @@ namespace ttcr {
                 else
                     interpSlownessSecondary();
             }
+            this->slownessChanged();
         }
         
         
@@ -87,51 +108,100 @@ namespace ttcr {
                 else
                     interpSlownessSecondary();
             }
+            this->slownessChanged();
         }
         
+        void getSlownessState(std::vector<T1>& s) const {
+            s.resize( this->nodes.size() );
+            for ( size_t n=0; n<this->nodes.size(); ++n ) {
+                s[n] = this->nodes[n].getNodeSlowness();
+            }
+        }
+        void setSlownessState(const std::vector<T1>& s) {
+            if ( this->nodes.size() != s.size() ) {
+                throw std::length_error("Error: slowness vectors of incompatible size.");
+            }
+            for ( size_t n=0; n<this->nodes.size(); ++n ) {
+                this->nodes[n].setNodeSlowness( s[n] );
+            }
+            this->slownessChanged();
+        }
         
         
-        void raytrace(const std::vector<sxyz<T1>>&,
-                     const std::vector<T1>&,
-                     const std::vector<sxyz<T1>>&,
-                     std::vector<T1>&,
-                     const size_t=0) const;
-        
-        void raytrace(const std::vector<sxyz<T1>>&,
-                     const std::vector<T1>&,
-                     const std::vector<const std::vector<sxyz<T1>>*>&,
-                     std::vector<std::vector<T1>*>&,
-                     const size_t=0) const;
         
-        void raytrace(const std::vector<sxyz<T1>>&,
-                     const std::vector<T1>& ,
-                     const std::vector<sxyz<T1>>&,
-                     std::vector<T1>&,
-                     std::vector<std::vector<sxyz<T1>>>&,
-                     const size_t=0) const;
+    protected:
+        void raytraceLocal(const std::vector<sxyz<T1>>&,
+                          const std::vector<T1>&,
+                          const std::vector<sxyz<T1>>&,
+                          std::vector<T1>&,
+                          const size_t=0) const;
+        
+        void raytraceLocal(const std::vector<sxyz<T1>>&,
+                          const std::vector<T1>&,
+                          const std::vector<const std::vector<sxyz<T1>>*>&,
+                          std::vector<std::vector<T1>*>&,
+                          const size_t=0) const;
+        
+        void raytraceLocal(const std::vector<sxyz<T1>>&,
+                          const std::vector<T1>& ,
+                          const std::vector<sxyz<T1>>&,
+                          std::vector<T1>&,
+                          std::vector<std::vector<sxyz<T1>>>&,
+                          const size_t=0) const;
+        
+        // raypaths are traced back through the parents of the nodes, which
+        // include temporary source nodes
+        void raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                           const std::vector<T1>& t0,
+                           const std::vector<sxyz<T1>>& Rx,
+                           std::vector<T1>& traveltimes,
+                           RayPaths<float,T2>& rays,
+                           const size_t threadNo=0) const {
+            this->appendRaypaths(Tx, t0, Rx, traveltimes, rays, threadNo);
+        }
         
-        void raytrace(const std::vector<sxyz<T1>>&,
-                     const std::vector<T1>&,
-                     const std::vector<const std::vector<sxyz<T1>>*>&,
-                     std::vector<std::vector<T1>*>&,
-                     std::vector<std::vector<std::vector<sxyz<T1>>>*>&,
-                     const size_t=0) const;
+        void raytraceLocal(const std::vector<sxyz<T1>>&,
+                          const std::vector<T1>&,
+                          const std::vector<const std::vector<sxyz<T1>>*>&,
+                          std::vector<std::vector<T1>*>&,
+                          std::vector<std::vector<std::vector<sxyz<T1>>>*>&,
+                          const size_t=0) const;
         
-        void raytrace(const std::vector<sxyz<T1>>&,
-                     const std::vector<T1>& ,
-                     const std::vector<sxyz<T1>>&,
-                     std::vector<T1>&,
-                     std::vector<std::vector<sxyz<T1>>>&,
-                     std::vector<std::vector<siv<T1>>>&,
-                     const size_t=0) const;
+        void raytraceLocal(const std::vector<sxyz<T1>>&,
+                          const std::vector<T1>& ,
+                          const std::vector<sxyz<T1>>&,
+                          std::vector<T1>&,
+                          std::vector<std::vector<sxyz<T1>>>&,
+                          std::vector<std::vector<siv<T1>>>&,
+                          const size_t=0) const;
         
         
     private:
         T2 nSecondary;
+        size_t edgeTablesMaxBytes;
+        CellEdgeLengths<T1,T2> edgeLengths;
+        
+        void buildEdgeLengths() {
+            if ( !edgeLengths.build(this->nodes, this->neighbors, edgeTablesMaxBytes) &&
+                edgeTablesMaxBytes > 0 && verbose ) {
+                std::cout << "Tables of edge lengths would exceed " << edgeTablesMaxBytes
+                << " bytes, lengths are computed on the fly.\n";
+            }
+        }
         
         void interpSlownessSecondary();
         void interpVelocitySecondary();
         
+        void raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                           const std::vector<T1>& t0,
+                           const std::vector<sxyz<T1>>& Rx,
+                           const size_t threadNo=0) const;
+        
+        void raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                           const std::vector<T1>& t0,
+                           const std::vector<const std::vector<sxyz<T1>>*>& Rx,
+                           const size_t threadNo=0) const;
+        
         void initQueue(const std::vector<sxyz<T1>>& Tx,
                        const std::vector<T1>& t0,
                        std::priority_queue<Node3Dnsp<T1,T2>*,
@@ -359,11 +429,10 @@ namespace ttcr {
     
     
     template<typename T1, typename T2>
-    void Grid3Dunsp<T1,T2>::raytrace(const std::vector<sxyz<T1>>& Tx,
-                                     const std::vector<T1>& t0,
-                                     const std::vector<sxyz<T1>>& Rx,
-                                     std::vector<T1>& traveltimes,
-                                     const size_t threadNo) const {
+    void Grid3Dunsp<T1,T2>::raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                                          const std::vector<T1>& t0,
+                                          const std::vector<sxyz<T1>>& Rx,
+                                          const size_t threadNo) const {
         
         this->checkPts(Tx);
         this->checkPts(Rx);
@@ -383,28 +452,13 @@ namespace ttcr {
         initQueue(Tx, t0, queue, txNodes, inQueue, frozen, threadNo);
         
         propagate(queue, inQueue, frozen, threadNo);
-        
-        if ( traveltimes.size() != Rx.size() ) {
-            traveltimes.resize( Rx.size() );
-        }
-        
-        if ( this->tt_from_rp ) {
-            for (size_t n=0; n<Rx.size(); ++n) {
-                traveltimes[n] = this->getTraveltimeFromRaypath(Tx, t0, Rx[n], threadNo);
-            }
-        } else {
-            for (size_t n=0; n<Rx.size(); ++n) {
-                traveltimes[n] = this->getTraveltime(Rx[n], this->nodes, threadNo);
-            }
-        }
     }
     
     template<typename T1, typename T2>
-    void Grid3Dunsp<T1,T2>::raytrace(const std::vector<sxyz<T1>>& Tx,
-                                     const std::vector<T1>& t0,
-                                     const std::vector<const std::vector<sxyz<T1>>*>& Rx,
-                                     std::vector<std::vector<T1>*>& traveltimes,
-                                     const size_t threadNo) const {
+    void Grid3Dunsp<T1,T2>::raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                                          const std::vector<T1>& t0,
+                                          const std::vector<const std::vector<sxyz<T1>>*>& Rx,
+                                          const size_t threadNo) const {
         
         this->checkPts(Tx);
         for ( size_t n=0; n<Rx.size(); ++n )
@@ -425,6 +479,40 @@ namespace ttcr {
         initQueue(Tx, t0, queue, txNodes, inQueue, frozen, threadNo);
         
         propagate(queue, inQueue, frozen, threadNo);
+    }
+    
+    template<typename T1, typename T2>
+    void Grid3Dunsp<T1,T2>::raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                                          const std::vector<T1>& t0,
+                                          const std::vector<sxyz<T1>>& Rx,
+                                          std::vector<T1>& traveltimes,
+                                          const size_t threadNo) const {
+        
+        this->computeTT(Tx, t0, Rx, threadNo);
+        
+        if ( traveltimes.size() != Rx.size() ) {
+            traveltimes.resize( Rx.size() );
+        }
+        
+        if ( this->tt_from_rp ) {
+            for (size_t n=0; n<Rx.size(); ++n) {
+                traveltimes[n] = this->getTraveltimeFromRaypath(Tx, t0, Rx[n], threadNo);
+            }
+        } else {
+            for (size_t n=0; n<Rx.size(); ++n) {
+                traveltimes[n] = this->getTraveltime(Rx[n], this->nodes, threadNo);
+            }
+        }
+    }
+    
+    template<typename T1, typename T2>
+    void Grid3Dunsp<T1,T2>::raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                                          const std::vector<T1>& t0,
+                                          const std::vector<const std::vector<sxyz<T1>>*>& Rx,
+                                          std::vector<std::vector<T1>*>& traveltimes,
+                                          const size_t threadNo) const {
+        
+        this->computeTT(Tx, t0, Rx, threadNo);
         
         if ( traveltimes.size() != Rx.size() ) {
             traveltimes.resize( Rx.size() );
@@ -447,12 +535,12 @@ namespace ttcr {
     
     
     template<typename T1, typename T2>
-    void Grid3Dunsp<T1,T2>::raytrace(const std::vector<sxyz<T1>>& Tx,
-                                     const std::vector<T1>& t0,
-                                     const std::vector<sxyz<T1>>& Rx,
-                                     std::vector<T1>& traveltimes,
-                                     std::vector<std::vector<sxyz<T1>>>& r_data,
-                                     const size_t threadNo) const {
+    void Grid3Dunsp<T1,T2>::raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                                          const std::vector<T1>& t0,
+                                          const std::vector<sxyz<T1>>& Rx,
+                                          std::vector<T1>& traveltimes,
+                                          std::vector<std::vector<sxyz<T1>>>& r_data,
+                                          const size_t threadNo) const {
         
         this->checkPts(Tx);
         this->checkPts(Rx);
@@ -550,12 +638,12 @@ namespace ttcr {
     }
     
     template<typename T1, typename T2>
-    void Grid3Dunsp<T1,T2>::raytrace(const std::vector<sxyz<T1>>& Tx,
-                                     const std::vector<T1>& t0,
-                                     const std::vector<const std::vector<sxyz<T1>>*>& Rx,
-                                     std::vector<std::vector<T1>*>& traveltimes,
-                                     std::vector<std::vector<std::vector<sxyz<T1>>>*>& r_data,
-                                     const size_t threadNo) const {
+    void Grid3Dunsp<T1,T2>::raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                                          const std::vector<T1>& t0,
+                                          const std::vector<const std::vector<sxyz<T1>>*>& Rx,
+                                          std::vector<std::vector<T1>*>& traveltimes,
+                                          std::vector<std::vector<std::vector<sxyz<T1>>>*>& r_data,
+                                          const size_t threadNo) const {
         
         this->checkPts(Tx);
         for ( size_t n=0; n<Rx.size(); ++n )
@@ -662,13 +750,13 @@ namespace ttcr {
     }
     
     template<typename T1, typename T2>
-    void Grid3Dunsp<T1,T2>::raytrace(const std::vector<sxyz<T1>>& Tx,
-                                     const std::vector<T1>& t0,
-                                     const std::vector<sxyz<T1>>& Rx,
-                                     std::vector<T1>& traveltimes,
-                                     std::vector<std::vector<sxyz<T1>>>& r_data,
-                                     std::vector<std::vector<siv<T1>>>& l_data,
-                                     const size_t threadNo) const {
+    void Grid3Dunsp<T1,T2>::raytraceLocal(const std::vector<sxyz<T1>>& Tx,
+                                          const std::vector<T1>& t0,
+                                          const std::vector<sxyz<T1>>& Rx,
+                                          std::vector<T1>& traveltimes,
+                                          std::vector<std::vector<sxyz<T1>>>& r_data,
+                                          std::vector<std::vector<siv<T1>>>& l_data,
+                                          const size_t threadNo) const {
         
         this->checkPts(Tx);
         this->checkPts(Rx);
@@ -919,18 +1007,23 @@ namespace ttcr {
             inQueue[ src->getGridIndex() ] = false;
             frozen[ src->getGridIndex() ] = true;
             
+            bool tables = edgeLengths.contains(src->getGridIndex());
             for ( size_t no=0; no<src->getOwners().size(); ++no ) {
                 
                 T2 cellNo = src->getOwners()[no];
+                size_t m = this->neighbors[cellNo].size();
+                size_t i = tables ? edgeLengths.localIndex(src->getGridIndex(), no) : 0;
                 
-                for ( size_t k=0; k< this->neighbors[cellNo].size(); ++k ) {
+                for ( size_t k=0; k<m; ++k ) {
                     T2 neibNo = this->neighbors[cellNo][k];
                     if ( neibNo == src->getGridIndex() || frozen[neibNo] ) {
                         continue;
                     }
                     
                     // compute dt
-                    T1 dt = this->computeDt(*src, this->nodes[neibNo]);
+                    T1 dt = tables ?
+                    (this->nodes[neibNo].getNodeSlowness()+src->getNodeSlowness())/2 * edgeLengths(cellNo, m, i, k) :
+                    this->computeDt(*src, this->nodes[neibNo]);
                     
                     if (src->getTT(threadNo)+dt < this->nodes[neibNo].getTT(threadNo)) {
                         this->nodes[neibNo].setTT( src->getTT(threadNo)+dt, threadNo );
@@ -60,6 +60,17 @@ namespace ttcr {
             /((x[2]-x[1])*(y[2]-y[1]));
         }
         
+        inline static void bilinearWeight(const T x[], const T y[], std::array<T,4>& w) {
+            
+            // weights of s[0] to s[3] in bilinear
+            
+            T den = (x[2]-x[1])*(y[2]-y[1]);
+            w[0] = (x[2]-x[0])*(y[2]-y[0])/den;
+            w[1] = (x[2]-x[0])*(y[0]-y[1])/den;
+            w[2] = (x[0]-x[1])*(y[2]-y[0])/den;
+            w[3] = (x[0]-x[1])*(y[0]-y[1])/den;
+        }
+        
         inline static T trilinear(const T x[], const T y[], const T z[], const T s[]) {
             
             // evaluate s @ (x[0], y[0], z[0])
@@ -0,0 +1,308 @@
+//
+//  MultiPhase.h
+//  ttcr
+//
+//  Created by agent on 2026-10-18.
+//  Copyright (c) 2026 agent. All rights reserved.
+//
+
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+
+ Traveltimes of multi-leg phases (reflections, conversions at interfaces, ...)
+
+ A phase is described by the sequence of interfaces it visits between the
+ source and the receivers, an interface being a set of points; an empty
+ sequence is the direct wave.  Each leg is computed by raytracing from the
+ points of the previous interface, with their traveltimes as t0.
+
+ Phases are merged in a prefix tree, so that a leg shared by several phases
+ (e.g. source -> reflector 1) is computed once per source, and all legs
+ leaving the same interface are obtained from a single traveltime field.
+ The (source, leg) tasks form a DAG that is processed by a pool of threads,
+ a leg being started as soon as the traveltimes at its starting interface
+ are known.  The traveltimes at an interface are freed once the leg using
+ them is done.
+
+ When there are fewer receivers than sources, the last leg of the phases
+ can be obtained by reciprocity, from tables of traveltimes between the
+ receivers and the points of the interface, computed once and reused for
+ all sources: t_rcv = min_p ( t_p + t(rcv,p) ).
+
+ */
+
+#ifndef ttcr_MultiPhase_h
+#define ttcr_MultiPhase_h
+
+#include <algorithm>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <limits>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace ttcr {
+
+    template<typename T1, typename S, typename GRID>
+    class MultiPhase {
+    public:
+        MultiPhase(const GRID& g,
+                   const std::vector<std::vector<S>>& itf,
+                   const std::vector<std::vector<size_t>>& ph) :
+        grid(g), interfaces(itf), phases(ph), tables(-1),
+        tree(1, leg(std::numeric_limits<size_t>::max())) {
+
+            for ( size_t np=0; np<phases.size(); ++np ) {
+                size_t n = 0;
+                for ( size_t i=0; i<phases[np].size(); ++i ) {
+                    if ( phases[np][i] >= interfaces.size() ) {
+                        throw std::out_of_range("Error: phase " + std::to_string(np) +
+                                                " refers to an undefined interface.");
+                    }
+                    size_t c = 0;
+                    for ( ; c<tree[n].children.size(); ++c ) {
+                        if ( tree[ tree[n].children[c] ].itf == phases[np][i] ) break;
+                    }
+                    if ( c == tree[n].children.size() ) {
+                        tree[n].children.push_back( tree.size() );
+                        tree.push_back( leg(phases[np][i]) );
+                    }
+                    n = tree[n].children[c];
+                }
+                tree[n].phases.push_back( np );
+            }
+        }
+
+        // -1: automatic, 0: never, 1: always use reciprocal tables
+        void setReciprocalTables(const int t) { tables = t; }
+
+        size_t getNlegs() const { return tree.size()-1; }
+
+        // traveltimes are returned in tt[phase][source][receiver]
+        void raytrace(const std::vector<std::vector<S>>& Tx,
+                      const std::vector<std::vector<T1>>& t0,
+                      const std::vector<S>& Rx,
+                      std::vector<std::vector<std::vector<T1>>>& tt,
+                      size_t nThreads=0) const;
+
+    private:
+        struct leg {
+            size_t itf;                   // interface reached by the leg
+            std::vector<size_t> children; // legs leaving this interface
+            std::vector<size_t> phases;   // phases ending at the receivers after this leg
+            leg(const size_t i) : itf(i) {}
+        };
+
+        struct task {
+            std::function<void(const size_t)> run;
+            std::vector<size_t> next;
+            size_t nDeps;
+            task() : nDeps(0) {}
+        };
+
+        const GRID& grid;
+        const std::vector<std::vector<S>>& interfaces;
+        const std::vector<std::vector<size_t>>& phases;
+        int tables;
+        std::vector<leg> tree;
+
+        static void schedule(std::vector<task>& tasks, const size_t nThreads);
+    };
+
+    template<typename T1, typename S, typename GRID>
+    void MultiPhase<T1,S,GRID>::raytrace(const std::vector<std::vector<S>>& Tx,
+                                         const std::vector<std::vector<T1>>& t0,
+                                         const std::vector<S>& Rx,
+                                         std::vector<std::vector<std::vector<T1>>>& tt,
+                                         size_t nThreads) const {
+
+        if ( Tx.size() != t0.size() ) {
+            throw std::length_error("Error: Tx and t0 should have the same size.");
+        }
+        if ( nThreads == 0 || nThreads > grid.getNthreads() ) {
+            nThreads = grid.getNthreads();
+        }
+        const size_t nTx = Tx.size();
+        const size_t nLegs = tree.size();
+
+        // interfaces for which the last leg is computed by reciprocity
+        bool useTables = tables==1 || (tables==-1 && Rx.size() < nTx);
+        std::vector<size_t> tableNo(interfaces.size(), std::numeric_limits<size_t>::max());
+        std::vector<size_t> tableItf;
+        if ( useTables ) {
+            for ( size_t n=1; n<nLegs; ++n ) {
+                if ( !tree[n].phases.empty() &&
+                    tableNo[ tree[n].itf ] == std::numeric_limits<size_t>::max() ) {
+                    tableNo[ tree[n].itf ] = tableItf.size();
+                    tableItf.push_back( tree[n].itf );
+                }
+            }
+        }
+        std::vector<std::vector<T1>> tab(tableItf.size());
+        for ( size_t nt=0; nt<tableItf.size(); ++nt ) {
+            tab[nt].resize( Rx.size()*interfaces[ tableItf[nt] ].size() );
+        }
+
+        tt.resize( phases.size() );
+        for ( size_t np=0; np<phases.size(); ++np ) {
+            tt[np].resize( nTx );
+        }
+
+        // traveltimes at the interface reached by leg n for source ns
+        std::vector<std::vector<T1>> itf_tt( nTx*nLegs );
+
+        const size_t nTableTasks = tableItf.size()*Rx.size();
+        std::vector<task> tasks( nTableTasks + nTx*nLegs );
+
+        for ( size_t nt=0; nt<tableItf.size(); ++nt ) {
+            for ( size_t nr=0; nr<Rx.size(); ++nr ) {
+                task& tk = tasks[nt*Rx.size()+nr];
+                tk.run = [this,&Rx,&tab,&tableItf,nt,nr](const size_t threadNo) {
+                    const std::vector<S>& pts = interfaces[ tableItf[nt] ];
+                    std::vector<S> src(1, Rx[nr]);
+                    std::vector<T1> t(1, 0.0);
+                    std::vector<T1> tmp;
+                    grid.raytrace(src, t, pts, tmp, threadNo);
+                    std::copy(tmp.begin(), tmp.end(), tab[nt].begin()+nr*pts.size());
+                };
+            }
+        }
+
+        for ( size_t ns=0; ns<nTx; ++ns ) {
+            for ( size_t n=0; n<nLegs; ++n ) {
+                const size_t no = nTableTasks + ns*nLegs + n;
+                const bool tabulated = n>0 && useTables && !tree[n].phases.empty();
+                for ( size_t c=0; c<tree[n].children.size(); ++c ) {
+                    tasks[no].next.push_back( nTableTasks + ns*nLegs + tree[n].children[c] );
+                    tasks[ nTableTasks + ns*nLegs + tree[n].children[c] ].nDeps++;
+                }
+                if ( tabulated ) {
+                    const size_t nt = tableNo[ tree[n].itf ];
+                    for ( size_t nr=0; nr<Rx.size(); ++nr ) {
+                        tasks[nt*Rx.size()+nr].next.push_back( no );
+                        tasks[no].nDeps++;
+                    }
+                }
+
+                tasks[no].run = [this,&Tx,&t0,&Rx,&tt,&itf_tt,&tab,&tableNo,
+                                 ns,n,nLegs,tabulated](const size_t threadNo) {
+                    const leg& l = tree[n];
+                    const std::vector<S>& src = n==0 ? Tx[ns] : interfaces[l.itf];
+                    const std::vector<T1>& t = n==0 ? t0[ns] : itf_tt[ns*nLegs+n];
+
+                    std::vector<const std::vector<S>*> Rx_all;
+                    std::vector<std::vector<T1>*> tt_all;
+                    for ( size_t c=0; c<l.children.size(); ++c ) {
+                        Rx_all.push_back( &(interfaces[ tree[l.children[c]].itf ]) );
+                        tt_all.push_back( &(itf_tt[ns*nLegs+l.children[c]]) );
+                    }
+                    std::vector<T1> tr;
+                    if ( !l.phases.empty() && !tabulated ) {
+                        Rx_all.push_back( &Rx );
+                        tt_all.push_back( &tr );
+                    }
+                    if ( !Rx_all.empty() ) {
+                        grid.raytrace(src, t, Rx_all, tt_all, threadNo);
+                    }
+                    if ( tabulated ) {
+                        const std::vector<T1>& tb = tab[ tableNo[l.itf] ];
+                        tr.resize( Rx.size() );
+                        for ( size_t nr=0; nr<Rx.size(); ++nr ) {
+                            const T1* row = &(tb[nr*src.size()]);
+                            T1 tmin = std::numeric_limits<T1>::max();
+                            for ( size_t i=0; i<src.size(); ++i ) {
+                                tmin = t[i]+row[i] < tmin ? t[i]+row[i] : tmin;
+                            }
+                            tr[nr] = tmin;
+                        }
+                    }
+                    for ( size_t np=0; np<l.phases.size(); ++np ) {
+                        tt[ l.phases[np] ][ns] = tr;
+                    }
+                    if ( n > 0 ) {
+                        // not needed anymore
+                        std::vector<T1>().swap( itf_tt[ns*nLegs+n] );
+                    }
+                };
+            }
+        }
+
+        schedule(tasks, nThreads);
+    }
+
+    template<typename T1, typename S, typename GRID>
+    void MultiPhase<T1,S,GRID>::schedule(std::vector<task>& tasks,
+                                         const size_t nThreads) {
+
+        std::vector<size_t> ready;
+        for ( size_t n=0; n<tasks.size(); ++n ) {
+            if ( tasks[n].nDeps == 0 ) ready.push_back( n );
+        }
+        std::mutex mtx;
+        std::condition_variable cv;
+        size_t nDone = 0;
+        std::exception_ptr error;
+
+        auto worker = [&tasks,&ready,&mtx,&cv,&nDone,&error](const size_t threadNo) {
+            std::unique_lock<std::mutex> lock(mtx);
+            for ( ;; ) {
+                cv.wait(lock, [&]{ return !ready.empty() || nDone == tasks.size() || error; });
+                if ( nDone == tasks.size() || error ) break;
+
+                // last ready task first, to complete the phases of a source
+                // before starting the next one
+                size_t no = ready.back();
+                ready.pop_back();
+                lock.unlock();
+                try {
+                    tasks[no].run(threadNo);
+                } catch (...) {
+                    lock.lock();
+                    if ( !error ) error = std::current_exception();
+                    cv.notify_all();
+                    break;
+                }
+                lock.lock();
+                nDone++;
+                for ( size_t i=0; i<tasks[no].next.size(); ++i ) {
+                    if ( --(tasks[ tasks[no].next[i] ].nDeps) == 0 ) {
+                        ready.push_back( tasks[no].next[i] );
+                    }
+                }
+                cv.notify_all();
+            }
+        };
+
+        std::vector<std::thread> threads;
+        for ( size_t i=1; i<nThreads; ++i ) {
+            threads.push_back( std::thread(worker, i) );
+        }
+        worker(0);
+        for ( size_t i=0; i<threads.size(); ++i ) {
+            threads[i].join();
+        }
+        if ( error ) std::rethrow_exception(error);
+    }
+
+}
+
+#endif
@@ -157,6 +157,7 @@ namespace ttcr {
             primary = p;
         }
         const bool isPrimary() const { return primary; }
+        int getPrimary() const { return primary; }
         
     protected:
         size_t nThreads;
@@ -211,6 +211,7 @@ namespace ttcr {
         
         void setPrimary(const bool p) { primary = p; }
         const bool isPrimary() const { return primary; }
+        int getPrimary() const { return primary; }
         
     private:
         size_t nThreads;
@@ -0,0 +1,355 @@
+//
+//  RayPaths.h
+//  ttcr
+//
+//  Created by agent on 2026-10-18.
+//  Copyright (c) 2026 agent. All rights reserved.
+//
+
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+
+ Flat storage of raypaths
+
+ The points of all rays are packed in a single array of coordinates
+ (x, y, z for each point, y = 0 for 2D rays), and ray n spans points
+ offsets[n] to offsets[n+1]-1.  Rays can be gathered in groups (e.g. one
+ group per source), group g spanning rays groups[g] to groups[g+1]-1.
+ Optionally, the cell crossed by each segment is stored at the index of
+ the point ending the segment.
+
+ Raypaths are written without VTK, in VTK XML PolyData files (raw appended
+ data) or in a binary file with the layout
+
+   char[8]  "ttcrrays"
+   uint32   version (1), size of coordinates (4 or 8), 1 if cells are
+            stored, size of cell indices
+   uint64   number of groups, of rays and of points
+   uint64   groups[nGroups+1], offsets[nRays+1]
+   coord    coordinates[3*nPoints]
+   cell     cells[nPoints] (if stored)
+
+ in the byte order of the host.  Data are streamed from the flat arrays,
+ or from nested vectors of points, without intermediate objects.
+
+ */
+
+#ifndef ttcr_RayPaths_h
+#define ttcr_RayPaths_h
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "ttcr_t.h"
+
+namespace ttcr {
+
+    template<typename T=float, typename T2=uint32_t>
+    class RayPaths {
+    public:
+        RayPaths() : groups(1, 0), offsets(1, 0) {}
+
+        void clear() {
+            groups.assign(1, 0);
+            offsets.assign(1, 0);
+            coordinates.clear();
+            cells.clear();
+        }
+
+        void reserve(const size_t nRays, const size_t nPoints) {
+            offsets.reserve( nRays+1 );
+            coordinates.reserve( 3*nPoints );
+        }
+
+        // rays appended since the end of the last group form a new group
+        void endGroup() { groups.push_back( size() ); }
+
+        template<typename S>
+        void append(const std::vector<S>& ray) {
+            for ( size_t n=0; n<ray.size(); ++n ) {
+                push(ray[n]);
+            }
+            offsets.push_back( offsets.back()+ray.size() );
+            if ( !cells.empty() ) {
+                cells.resize( offsets.back(), std::numeric_limits<T2>::max() );
+            }
+        }
+
+        // cells[k] is the cell of the segment ending at point k of the ray
+        template<typename S>
+        void append(const std::vector<S>& ray, const std::vector<T2>& c) {
+            if ( c.size() != ray.size() ) {
+                throw std::length_error("Error: ray and cells should have the same size.");
+            }
+            cells.resize( offsets.back(), std::numeric_limits<T2>::max() );
+            append(ray);
+            cells.resize( offsets.back(), std::numeric_limits<T2>::max() );
+            std::copy(c.begin(), c.end(), cells.end()-c.size());
+        }
+
+        template<typename S>
+        void append(const std::vector<std::vector<S>>& rays) {
+            size_t npts = 0;
+            for ( size_t n=0; n<rays.size(); ++n ) npts += rays[n].size();
+            reserve( size()+rays.size(), getNumberOfPoints()+npts );
+            for ( size_t n=0; n<rays.size(); ++n ) {
+                append(rays[n]);
+            }
+        }
+
+        size_t size() const { return offsets.size()-1; }
+        size_t getNumberOfGroups() const { return groups.size()-1 + (groups.back()!=size()); }
+        size_t getNumberOfPoints() const { return offsets.back(); }
+        size_t getNumberOfPoints(const size_t n) const { return offsets[n+1]-offsets[n]; }
+        const T* getPoint(const size_t n, const size_t i) const {
+            return &(coordinates[3*(offsets[n]+i)]);
+        }
+
+        const std::vector<uint64_t>& getOffsets() const { return offsets; }
+        const std::vector<T>& getCoordinates() const { return coordinates; }
+        const std::vector<T2>& getCells() const { return cells; }
+        std::vector<uint64_t> getGroups() const {
+            std::vector<uint64_t> g(groups);
+            if ( g.back() != size() ) g.push_back( size() );
+            return g;
+        }
+
+        // adds (dx, dy, dz) to the points of rays n0 and following, the sum
+        // being computed in double
+        void translate(const size_t n0, const double dx, const double dy,
+                       const double dz) {
+            for ( size_t i=3*offsets[n0]; i<coordinates.size(); i+=3 ) {
+                coordinates[i] = static_cast<T>(coordinates[i]+dx);
+                coordinates[i+1] = static_cast<T>(coordinates[i+1]+dy);
+                coordinates[i+2] = static_cast<T>(coordinates[i+2]+dz);
+            }
+        }
+
+        void saveVTP(const std::string& fname) const;
+        void saveBinary(const std::string& fname) const;
+        void loadBinary(const std::string& fname);
+
+    private:
+        std::vector<uint64_t> groups;
+        std::vector<uint64_t> offsets;
+        std::vector<T> coordinates;
+        std::vector<T2> cells;
+
+        template<typename U>
+        void push(const sxyz<U>& p) {
+            coordinates.push_back( static_cast<T>(p.x) );
+            coordinates.push_back( static_cast<T>(p.y) );
+            coordinates.push_back( static_cast<T>(p.z) );
+        }
+        template<typename U>
+        void push(const sxz<U>& p) {
+            coordinates.push_back( static_cast<T>(p.x) );
+            coordinates.push_back( 0 );
+            coordinates.push_back( static_cast<T>(p.z) );
+        }
+    };
+
+    inline bool isLittleEndian() {
+        const uint16_t one = 1;
+        char c;
+        std::memcpy(&c, &one, 1);
+        return c == 1;
+    }
+
+    template<typename U>
+    inline void vtpPoint(const sxyz<U>& p, float* c) {
+        c[0] = static_cast<float>(p.x);
+        c[1] = static_cast<float>(p.y);
+        c[2] = static_cast<float>(p.z);
+    }
+    template<typename U>
+    inline void vtpPoint(const sxz<U>& p, float* c) {
+        c[0] = static_cast<float>(p.x);
+        c[1] = 0.0f;
+        c[2] = static_cast<float>(p.z);
+    }
+
+/**
+ * Write polylines in a VTK XML PolyData file, with raw appended data
+ *
+ * @param fname name of file
+ * @param nRays number of polylines
+ * @param nPoints total number of points
+ * @param nPts function returning the number of points of a polyline
+ * @param point function writing the coordinates of point i of polyline n
+ *        as 3 floats
+ */
+    template<typename NPTS, typename POINT>
+    void writeVTPPolylines(const std::string& fname,
+                           const size_t nRays, const size_t nPoints,
+                           NPTS nPts, POINT point) {
+
+        std::ofstream fout(fname, std::ios::out | std::ios::binary);
+        if ( !fout ) {
+            throw std::runtime_error("Error: cannot open file " + fname + " for writing.");
+        }
+        const uint64_t szPts = 3*sizeof(float)*nPoints;
+        const uint64_t szConn = sizeof(int64_t)*nPoints;
+        const uint64_t szOff = sizeof(int64_t)*nRays;
+
+        fout << "<?xml version=\"1.0\"?>\n"
+        << "<VTKFile type=\"PolyData\" version=\"1.0\" byte_order=\""
+        << (isLittleEndian() ? "LittleEndian" : "BigEndian")
+        << "\" header_type=\"UInt64\">\n"
+        << "  <PolyData>\n"
+        << "    <Piece NumberOfPoints=\"" << nPoints << "\" NumberOfVerts=\"0\" NumberOfLines=\""
+        << nRays << "\" NumberOfStrips=\"0\" NumberOfPolys=\"0\">\n"
+        << "      <Points>\n"
+        << "        <DataArray type=\"Float32\" NumberOfComponents=\"3\" format=\"appended\" offset=\"0\"/>\n"
+        << "      </Points>\n"
+        << "      <Lines>\n"
+        << "        <DataArray type=\"Int64\" Name=\"connectivity\" format=\"appended\" offset=\""
+        << sizeof(uint64_t)+szPts << "\"/>\n"
+        << "        <DataArray type=\"Int64\" Name=\"offsets\" format=\"appended\" offset=\""
+        << 2*sizeof(uint64_t)+szPts+szConn << "\"/>\n"
+        << "      </Lines>\n"
+        << "    </Piece>\n"
+        << "  </PolyData>\n"
+        << "  <AppendedData encoding=\"raw\">\n   _";
+
+        // data are written by blocks of fixed size
+        const size_t blk = 4096;
+        std::vector<float> buf(3*blk);
+        std::vector<int64_t> ibuf(blk);
+
+        fout.write(reinterpret_cast<const char*>(&szPts), sizeof(uint64_t));
+        size_t k = 0;
+        for ( size_t n=0; n<nRays; ++n ) {
+            for ( size_t i=0; i<nPts(n); ++i ) {
+                point(n, i, &(buf[3*k]));
+                if ( ++k == blk ) {
+                    fout.write(reinterpret_cast<const char*>(buf.data()), 3*sizeof(float)*k);
+                    k = 0;
+                }
+            }
+        }
+        fout.write(reinterpret_cast<const char*>(buf.data()), 3*sizeof(float)*k);
+
+        fout.write(reinterpret_cast<const char*>(&szConn), sizeof(uint64_t));
+        for ( size_t n=0; n<nPoints; n+=blk ) {
+            size_t m = nPoints-n < blk ? nPoints-n : blk;
+            for ( size_t i=0; i<m; ++i ) ibuf[i] = static_cast<int64_t>(n+i);
+            fout.write(reinterpret_cast<const char*>(ibuf.data()), sizeof(int64_t)*m);
+        }
+
+        fout.write(reinterpret_cast<const char*>(&szOff), sizeof(uint64_t));
+        int64_t off = 0;
+        for ( size_t n=0; n<nRays; n+=blk ) {
+            size_t m = nRays-n < blk ? nRays-n : blk;
+            for ( size_t i=0; i<m; ++i ) {
+                off += nPts(n+i);
+                ibuf[i] = off;
+            }
+            fout.write(reinterpret_cast<const char*>(ibuf.data()), sizeof(int64_t)*m);
+        }
+
+        fout << "\n  </AppendedData>\n</VTKFile>\n";
+        fout.close();
+    }
+
+    template<typename S>
+    void writeVTPPolylines(const std::string& fname,
+                           const std::vector<std::vector<S>>& r_data) {
+        size_t nPoints = 0;
+        for ( size_t n=0; n<r_data.size(); ++n ) nPoints += r_data[n].size();
+        writeVTPPolylines(fname, r_data.size(), nPoints,
+                          [&r_data](const size_t n) { return r_data[n].size(); },
+                          [&r_data](const size_t n, const size_t i, float* c) {
+                              vtpPoint(r_data[n][i], c);
+                          });
+    }
+
+    template<typename T, typename T2>
+    void RayPaths<T,T2>::saveVTP(const std::string& fname) const {
+        writeVTPPolylines(fname, size(), getNumberOfPoints(),
+                          [this](const size_t n) { return getNumberOfPoints(n); },
+                          [this](const size_t n, const size_t i, float* c) {
+                              const T* p = getPoint(n, i);
+                              c[0] = static_cast<float>(p[0]);
+                              c[1] = static_cast<float>(p[1]);
+                              c[2] = static_cast<float>(p[2]);
+                          });
+    }
+
+    template<typename T, typename T2>
+    void RayPaths<T,T2>::saveBinary(const std::string& fname) const {
+        std::ofstream fout(fname, std::ios::out | std::ios::binary);
+        if ( !fout ) {
+            throw std::runtime_error("Error: cannot open file " + fname + " for writing.");
+        }
+        std::vector<uint64_t> g = getGroups();
+        const uint32_t head[4] = { 1, sizeof(T), cells.empty() ? 0u : 1u, sizeof(T2) };
+        const uint64_t sizes[3] = { g.size()-1, size(), getNumberOfPoints() };
+        fout.write("ttcrrays", 8);
+        fout.write(reinterpret_cast<const char*>(head), sizeof(head));
+        fout.write(reinterpret_cast<const char*>(sizes), sizeof(sizes));
+        fout.write(reinterpret_cast<const char*>(g.data()), sizeof(uint64_t)*g.size());
+        fout.write(reinterpret_cast<const char*>(offsets.data()), sizeof(uint64_t)*offsets.size());
+        fout.write(reinterpret_cast<const char*>(coordinates.data()), sizeof(T)*coordinates.size());
+        if ( !cells.empty() ) {
+            fout.write(reinterpret_cast<const char*>(cells.data()), sizeof(T2)*cells.size());
+        }
+        fout.close();
+    }
+
+    template<typename T, typename T2>
+    void RayPaths<T,T2>::loadBinary(const std::string& fname) {
+        std::ifstream fin(fname, std::ios::in | std::ios::binary);
+        if ( !fin ) {
+            throw std::runtime_error("Error: cannot open file " + fname);
+        }
+        char magic[8];
+        uint32_t head[4];
+        uint64_t sizes[3];
+        fin.read(magic, 8);
+        fin.read(reinterpret_cast<char*>(head), sizeof(head));
+        fin.read(reinterpret_cast<char*>(sizes), sizeof(sizes));
+        if ( !fin || std::strncmp(magic, "ttcrrays", 8) != 0 || head[0] != 1 ) {
+            throw std::runtime_error("Error: " + fname + " is not a raypath file.");
+        }
+        if ( head[1] != sizeof(T) || head[3] != sizeof(T2) ) {
+            throw std::runtime_error("Error: raypaths in " + fname + " stored with another precision.");
+        }
+        groups.resize( sizes[0]+1 );
+        offsets.resize( sizes[1]+1 );
+        coordinates.resize( 3*sizes[2] );
+        cells.resize( head[2] ? sizes[2] : 0 );
+        fin.read(reinterpret_cast<char*>(groups.data()), sizeof(uint64_t)*groups.size());
+        fin.read(reinterpret_cast<char*>(offsets.data()), sizeof(uint64_t)*offsets.size());
+        fin.read(reinterpret_cast<char*>(coordinates.data()), sizeof(T)*coordinates.size());
+        fin.read(reinterpret_cast<char*>(cells.data()), sizeof(T2)*cells.size());
+        if ( !fin ) {
+            throw std::runtime_error("Error: " + fname + " is truncated.");
+        }
+        fin.close();
+    }
+
+}
+
+#endif
@@ -0,0 +1,356 @@
+//
+//  Renumbering.h
+//  ttcr
+//
+//  Created by agent on 2026-10-18.
+//  Copyright (c) 2026 agent. All rights reserved.
+//
+
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+
+ Renumbering of the nodes and cells of unstructured meshes, to improve the
+ memory locality of the accesses to neighbour nodes during raytracing.
+
+ Nodes are sorted along a Morton (Z-order) curve, or with the reverse
+ Cuthill-McKee algorithm applied to the graph of the mesh edges.  Cells are
+ then sorted according to their smallest node index.  The maps between
+ internal (mesh) and external (user) indices are kept to convert slowness
+ and traveltimes.
+
+ */
+
+#ifndef ttcr_Renumbering_h
+#define ttcr_Renumbering_h
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <queue>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+#include "ttcr_t.h"
+
+namespace ttcr {
+
+    enum renumbering_method : int { NO_RENUMBERING=0, MORTON=1, RCM=2 };
+
+    template<typename T2>
+    class Renumbering {
+    public:
+        Renumbering() : node_i2e(), node_e2i(), cell_i2e(), cell_e2i() {}
+
+        // compute the new numbering of the nodes and elements (tetrahedra
+        // or triangles)
+        template<typename S, typename ELEM>
+        void build(const std::vector<S>& nodes,
+                   const std::vector<ELEM>& elements,
+                   const int method) {
+            switch ( method ) {
+                case NO_RENUMBERING:
+                    identity(node_i2e, nodes.size());
+                    break;
+                case MORTON:
+                    mortonOrder(nodes);
+                    break;
+                case RCM:
+                    rcmOrder(nodes.size(), elements);
+                    break;
+                default:
+                    throw std::invalid_argument("Error: renumbering method undefined.");
+            }
+            invert(node_i2e, node_e2i);
+            sortCells(elements);
+            invert(cell_i2e, cell_e2i);
+        }
+
+        // renumber nodes and elements in place
+        template<typename S, typename ELEM>
+        void apply(std::vector<S>& nodes,
+                   std::vector<ELEM>& elements) const {
+            if ( nodes.size() != node_i2e.size() || elements.size() != cell_i2e.size() ) {
+                throw std::length_error("Error: mesh and renumbering of incompatible size.");
+            }
+            std::vector<S> tmp(nodes);
+            for ( size_t n=0; n<nodes.size(); ++n ) {
+                nodes[n] = tmp[ node_i2e[n] ];
+            }
+            std::vector<ELEM> etmp(elements);
+            for ( size_t n=0; n<elements.size(); ++n ) {
+                elements[n] = etmp[ cell_i2e[n] ];
+                for ( size_t k=0; k<nVertices<ELEM>(); ++k ) {
+                    elements[n].i[k] = node_e2i[ elements[n].i[k] ];
+                }
+            }
+        }
+
+        // values at nodes, from external to internal numbering
+        template<typename T>
+        void toInternalNodes(const std::vector<T>& ext, std::vector<T>& in) const {
+            toInternal(node_i2e, ext, in);
+        }
+
+        // values at cells, from external to internal numbering
+        template<typename T>
+        void toInternalCells(const std::vector<T>& ext, std::vector<T>& in) const {
+            toInternal(cell_i2e, ext, in);
+        }
+
+        // values at nodes, from internal to external numbering
+        template<typename T>
+        void toExternalNodes(const std::vector<T>& in, std::vector<T>& ext) const {
+            toExternal(node_i2e, in, ext);
+        }
+
+        // values at cells, from internal to external numbering
+        template<typename T>
+        void toExternalCells(const std::vector<T>& in, std::vector<T>& ext) const {
+            toExternal(cell_i2e, in, ext);
+        }
+
+        const std::vector<T2>& getNodeMap() const { return node_i2e; }
+        const std::vector<T2>& getCellMap() const { return cell_i2e; }
+
+    private:
+        std::vector<T2> node_i2e;   // internal to external node index
+        std::vector<T2> node_e2i;
+        std::vector<T2> cell_i2e;   // internal to external cell index
+        std::vector<T2> cell_e2i;
+
+        template<typename ELEM>
+        static constexpr size_t nVertices() {
+            return std::extent<decltype(ELEM::i)>::value;
+        }
+
+        template<typename T>
+        static void toInternal(const std::vector<T2>& i2e,
+                               const std::vector<T>& ext, std::vector<T>& in) {
+            if ( ext.size() != i2e.size() ) {
+                throw std::length_error("Error: vector and renumbering of incompatible size.");
+            }
+            in.resize( ext.size() );
+            for ( size_t n=0; n<in.size(); ++n ) {
+                in[n] = ext[ i2e[n] ];
+            }
+        }
+
+        template<typename T>
+        static void toExternal(const std::vector<T2>& i2e,
+                               const std::vector<T>& in, std::vector<T>& ext) {
+            if ( in.size() != i2e.size() ) {
+                throw std::length_error("Error: vector and renumbering of incompatible size.");
+            }
+            ext.resize( in.size() );
+            for ( size_t n=0; n<ext.size(); ++n ) {
+                ext[ i2e[n] ] = in[n];
+            }
+        }
+
+        static void identity(std::vector<T2>& m, const size_t n) {
+            m.resize( n );
+            for ( size_t i=0; i<n; ++i ) m[i] = static_cast<T2>(i);
+        }
+
+        static void invert(const std::vector<T2>& m, std::vector<T2>& inv) {
+            inv.resize( m.size() );
+            for ( size_t i=0; i<m.size(); ++i ) inv[ m[i] ] = static_cast<T2>(i);
+        }
+
+        // spread the lower 21 bits of v, leaving two zeros between bits
+        static uint64_t spread3(uint64_t v) {
+            v &= 0x1fffff;
+            v = (v | v << 32) & 0x1f00000000ffff;
+            v = (v | v << 16) & 0x1f0000ff0000ff;
+            v = (v | v << 8) & 0x100f00f00f00f00f;
+            v = (v | v << 4) & 0x10c30c30c30c30c3;
+            v = (v | v << 2) & 0x1249249249249249;
+            return v;
+        }
+
+        // spread the lower 32 bits of v, leaving one zero between bits
+        static uint64_t spread2(uint64_t v) {
+            v &= 0xffffffff;
+            v = (v | v << 16) & 0x0000ffff0000ffff;
+            v = (v | v << 8) & 0x00ff00ff00ff00ff;
+            v = (v | v << 4) & 0x0f0f0f0f0f0f0f0f;
+            v = (v | v << 2) & 0x3333333333333333;
+            v = (v | v << 1) & 0x5555555555555555;
+            return v;
+        }
+
+        template<typename T1>
+        static uint64_t mortonKey(const sxyz<T1>& p, const sxyz<T1>& pmin,
+                                  const T1 scale) {
+            return spread3( static_cast<uint64_t>((p.x-pmin.x)*scale) ) |
+            spread3( static_cast<uint64_t>((p.y-pmin.y)*scale) ) << 1 |
+            spread3( static_cast<uint64_t>((p.z-pmin.z)*scale) ) << 2;
+        }
+
+        template<typename T1>
+        static uint64_t mortonKey(const sxz<T1>& p, const sxz<T1>& pmin,
+                                  const T1 scale) {
+            return spread2( static_cast<uint64_t>((p.x-pmin.x)*scale) ) |
+            spread2( static_cast<uint64_t>((p.z-pmin.z)*scale) ) << 1;
+        }
+
+        template<typename T1>
+        static void bounds(const std::vector<sxyz<T1>>& nodes,
+                           sxyz<T1>& pmin, T1& size) {
+            pmin = nodes[0];
+            sxyz<T1> pmax = nodes[0];
+            for ( size_t n=1; n<nodes.size(); ++n ) {
+                pmin.x = std::min(pmin.x, nodes[n].x);
+                pmin.y = std::min(pmin.y, nodes[n].y);
+                pmin.z = std::min(pmin.z, nodes[n].z);
+                pmax.x = std::max(pmax.x, nodes[n].x);
+                pmax.y = std::max(pmax.y, nodes[n].y);
+                pmax.z = std::max(pmax.z, nodes[n].z);
+            }
+            size = std::max(std::max(pmax.x-pmin.x, pmax.y-pmin.y), pmax.z-pmin.z);
+        }
+
+        template<typename T1>
+        static void bounds(const std::vector<sxz<T1>>& nodes,
+                           sxz<T1>& pmin, T1& size) {
+            pmin = nodes[0];
+            sxz<T1> pmax = nodes[0];
+            for ( size_t n=1; n<nodes.size(); ++n ) {
+                pmin.x = std::min(pmin.x, nodes[n].x);
+                pmin.z = std::min(pmin.z, nodes[n].z);
+                pmax.x = std::max(pmax.x, nodes[n].x);
+                pmax.z = std::max(pmax.z, nodes[n].z);
+            }
+            size = std::max(pmax.x-pmin.x, pmax.z-pmin.z);
+        }
+
+        template<typename S>
+        void mortonOrder(const std::vector<S>& nodes) {
+            identity(node_i2e, nodes.size());
+            if ( nodes.empty() ) return;
+            S pmin;
+            decltype(pmin.x) size;
+            bounds(nodes, pmin, size);
+            // 21 bits per coordinate (3D) or 32 (2D)
+            const uint64_t nbits = std::is_same<S, sxz<decltype(pmin.x)>>::value ? 32 : 21;
+            const decltype(pmin.x) scale = size > 0 ? ((uint64_t(1)<<nbits)-1)/size : 0;
+            std::vector<uint64_t> key(nodes.size());
+            for ( size_t n=0; n<nodes.size(); ++n ) {
+                key[n] = mortonKey(nodes[n], pmin, scale);
+            }
+            std::stable_sort(node_i2e.begin(), node_i2e.end(),
+                             [&key](const T2 a, const T2 b) { return key[a] < key[b]; });
+        }
+
+        template<typename ELEM>
+        void rcmOrder(const size_t nNodes, const std::vector<ELEM>& elements) {
+
+            // graph of the mesh edges
+            std::vector<std::vector<T2>> adj(nNodes);
+            for ( size_t n=0; n<elements.size(); ++n ) {
+                for ( size_t k=0; k<nVertices<ELEM>(); ++k ) {
+                    for ( size_t l=0; l<nVertices<ELEM>(); ++l ) {
+                        if ( k != l ) adj[ elements[n].i[k] ].push_back( elements[n].i[l] );
+                    }
+                }
+            }
+            std::vector<size_t> degree(nNodes);
+            for ( size_t n=0; n<nNodes; ++n ) {
+                std::sort(adj[n].begin(), adj[n].end());
+                adj[n].erase(std::unique(adj[n].begin(), adj[n].end()), adj[n].end());
+                degree[n] = adj[n].size();
+            }
+            for ( size_t n=0; n<nNodes; ++n ) {
+                std::sort(adj[n].begin(), adj[n].end(),
+                          [&degree](const T2 a, const T2 b) {
+                    return degree[a] < degree[b] || (degree[a] == degree[b] && a < b);
+                });
+            }
+
+            node_i2e.clear();
+            node_i2e.reserve( nNodes );
+            std::vector<bool> visited(nNodes, false);
+            std::vector<size_t> level(nNodes);
+
+            // breadth-first search from root, returns the last node reached
+            auto bfs = [&](const T2 root, std::vector<T2>& order) {
+                size_t start = order.size();
+                order.push_back( root );
+                visited[root] = true;
+                level[root] = 0;
+                for ( size_t n=start; n<order.size(); ++n ) {
+                    for ( T2 nb : adj[ order[n] ] ) {
+                        if ( !visited[nb] ) {
+                            visited[nb] = true;
+                            level[nb] = level[ order[n] ] + 1;
+                            order.push_back( nb );
+                        }
+                    }
+                }
+                return order.back();
+            };
+
+            for ( ;; ) {
+                // root of the next component: node of smallest degree
+                T2 root = std::numeric_limits<T2>::max();
+                for ( size_t n=0; n<nNodes; ++n ) {
+                    if ( !visited[n] && (root == std::numeric_limits<T2>::max() ||
+                                         degree[n] < degree[root]) ) {
+                        root = static_cast<T2>(n);
+                    }
+                }
+                if ( root == std::numeric_limits<T2>::max() ) break;
+
+                // pseudo-peripheral node, obtained by repeating the search
+                // from the farthest node while the eccentricity grows
+                std::vector<T2> order;
+                size_t ecc = 0;
+                for ( size_t it=0; it<8; ++it ) {
+                    order.clear();
+                    T2 last = bfs(root, order);
+                    for ( T2 n : order ) visited[n] = false;
+                    if ( it > 0 && level[last] <= ecc ) break;
+                    ecc = level[last];
+                    root = last;
+                }
+                order.clear();
+                bfs(root, order);
+                node_i2e.insert(node_i2e.end(), order.begin(), order.end());
+            }
+            std::reverse(node_i2e.begin(), node_i2e.end());
+        }
+
+        template<typename ELEM>
+        void sortCells(const std::vector<ELEM>& elements) {
+            std::vector<T2> key(elements.size());
+            for ( size_t n=0; n<elements.size(); ++n ) {
+                key[n] = node_e2i[ elements[n].i[0] ];
+                for ( size_t k=1; k<nVertices<ELEM>(); ++k ) {
+                    key[n] = std::min(key[n], node_e2i[ elements[n].i[k] ]);
+                }
+            }
+            identity(cell_i2e, elements.size());
+            std::stable_sort(cell_i2e.begin(), cell_i2e.end(),
+                             [&key](const T2 a, const T2 b) { return key[a] < key[b]; });
+        }
+    };
+
+}
+
+#endif
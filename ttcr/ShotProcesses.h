@@ -0,0 +1,249 @@
+//
+//  ShotProcesses.h
+//  ttcr
+//
+//  Created by agent on 2026-10-18.
+//  Copyright (c) 2026 agent. All rights reserved.
+//
+
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+
+ Shots distributed over worker processes
+
+ The grid is built once by the calling process, which then forks the
+ workers.  The geometry and slowness are shared with the workers through
+ copy-on-write pages and are never rebuilt nor copied, while each worker
+ only allocates the traveltime state of the nodes it updates.  A grid
+ used this way needs a single thread.
+
+ The shot queue and the traveltimes at the receivers sit in a POSIX shared
+ memory segment: workers take the next shot from an atomic counter and
+ write their results directly at the offset of the shot.  The calling
+ process takes part in the work and collects the results once all workers
+ are done.  The first error raised in a worker is reported to the caller.
+
+ On systems without fork (Windows), the shots are computed in the calling
+ process.
+
+ */
+
+#ifndef ttcr_ShotProcesses_h
+#define ttcr_ShotProcesses_h
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <exception>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+namespace ttcr {
+
+    template<typename T1>
+    class ShotProcesses {
+    public:
+        ShotProcesses(const size_t np) : nProc(np==0 ? 1 : np) {}
+
+        size_t getNprocesses() const { return nProc; }
+
+        // compute(n, tt) computes the nRx[n] traveltimes of shot n, which
+        // are returned in tt[n]
+        template<typename COMPUTE>
+        void run(const std::vector<size_t>& nRx, COMPUTE compute,
+                 std::vector<std::vector<T1>>& tt) const;
+
+    private:
+        size_t nProc;
+
+        struct header {
+            std::atomic<size_t> next;     // next shot to compute
+            std::atomic<int> failed;
+            char msg[512];
+            header() : next(0), failed(0) { msg[0] = '\0'; }
+        };
+
+        static void setError(header* h, const char* msg) {
+            int expected = 0;
+            if ( h->failed.compare_exchange_strong(expected, 1) ) {
+                std::strncpy(h->msg, msg, sizeof(h->msg)-1);
+                h->msg[sizeof(h->msg)-1] = '\0';
+            }
+        }
+    };
+
+    template<typename T1>
+    template<typename COMPUTE>
+    void ShotProcesses<T1>::run(const std::vector<size_t>& nRx, COMPUTE compute,
+                                std::vector<std::vector<T1>>& tt) const {
+
+        const size_t nTx = nRx.size();
+        tt.resize( nTx );
+        const size_t np = nProc < nTx ? nProc : nTx;
+
+#ifndef _WIN32
+        if ( np > 1 ) {
+            std::vector<size_t> offset(nTx+1, 0);
+            for ( size_t n=0; n<nTx; ++n ) {
+                offset[n+1] = offset[n] + nRx[n];
+            }
+            const size_t hsize = (sizeof(header)+sizeof(T1)-1)/sizeof(T1)*sizeof(T1);
+            const size_t bytes = hsize + offset[nTx]*sizeof(T1);
+
+            static std::atomic<unsigned> counter(0);
+            const std::string name = "/ttcr_" + std::to_string(getpid()) + "_" +
+            std::to_string(counter++);
+            int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+            if ( fd < 0 ) {
+                throw std::runtime_error("Error: cannot create shared memory segment " +
+                                         name + ": " + std::strerror(errno));
+            }
+            if ( ftruncate(fd, bytes) != 0 ) {
+                const int err = errno;
+                close(fd);
+                shm_unlink(name.c_str());
+                throw std::runtime_error("Error: cannot size shared memory segment " +
+                                         name + ": " + std::strerror(err));
+            }
+            void* p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            const int err = errno;
+            // the mapping outlives the name, and is inherited by the workers
+            close(fd);
+            shm_unlink(name.c_str());
+            if ( p == MAP_FAILED ) {
+                throw std::runtime_error("Error: cannot map shared memory segment " +
+                                         name + ": " + std::strerror(err));
+            }
+
+            header* h = new (p) header();
+            T1* data = reinterpret_cast<T1*>(static_cast<char*>(p) + hsize);
+
+            auto work = [&]() {
+                std::vector<T1> buffer;
+                for ( ;; ) {
+                    const size_t n = h->next.fetch_add(1);
+                    if ( n >= nTx || h->failed.load() ) break;
+                    compute(n, buffer);
+                    if ( buffer.size() != nRx[n] ) {
+                        throw std::length_error("Error: wrong number of traveltimes for shot " +
+                                                std::to_string(n));
+                    }
+                    std::copy(buffer.begin(), buffer.end(), data+offset[n]);
+                }
+            };
+
+            std::vector<pid_t> pids;
+            for ( size_t i=1; i<np; ++i ) {
+                const pid_t pid = fork();
+                if ( pid == 0 ) {
+                    int status = 0;
+                    try {
+                        work();
+                    } catch (std::exception& e) {
+                        setError(h, e.what());
+                        status = 1;
+                    } catch (...) {
+                        setError(h, "Error: unknown exception in worker process");
+                        status = 1;
+                    }
+                    // leave without running the handlers of the parent
+                    _exit(status);
+                } else if ( pid < 0 ) {
+                    // the processes already started share the work
+                    break;
+                }
+                pids.push_back( pid );
+            }
+
+            try {
+                work();
+            } catch (std::exception& e) {
+                setError(h, e.what());
+            } catch (...) {
+                setError(h, "Error: unknown exception");
+            }
+
+            for ( size_t i=0; i<pids.size(); ++i ) {
+                int status = 0;
+                pid_t r;
+                while ( (r = waitpid(pids[i], &status, 0)) < 0 && errno == EINTR ) {}
+                if ( r < 0 || !WIFEXITED(status) ) {
+                    setError(h, "Error: worker process terminated abnormally");
+                }
+            }
+
+            const bool failed = h->failed.load() != 0;
+            const std::string msg(h->msg);
+            if ( !failed ) {
+                for ( size_t n=0; n<nTx; ++n ) {
+                    tt[n].assign(data+offset[n], data+offset[n+1]);
+                }
+            }
+            h->~header();
+            munmap(p, bytes);
+            if ( failed ) throw std::runtime_error(msg);
+            return;
+        }
+#endif
+
+        for ( size_t n=0; n<nTx; ++n ) {
+            compute(n, tt[n]);
+            if ( tt[n].size() != nRx[n] ) {
+                throw std::length_error("Error: wrong number of traveltimes for shot " +
+                                        std::to_string(n));
+            }
+        }
+    }
+
+
+    // traveltimes of the shots (Tx[n], t0[n]) at Rx[n], computed by nProc
+    // processes with thread 0 of grid g
+    template<typename GRID, typename T1, typename S>
+    void raytraceProcesses(const GRID& g,
+                           const std::vector<std::vector<S>>& Tx,
+                           const std::vector<std::vector<T1>>& t0,
+                           const std::vector<std::vector<S>>& Rx,
+                           std::vector<std::vector<T1>>& tt,
+                           const size_t nProc) {
+        if ( t0.size() != Tx.size() || Rx.size() != Tx.size() ) {
+            throw std::length_error("Error: Tx, t0 and Rx should have the same size.");
+        }
+        std::vector<size_t> nRx( Rx.size() );
+        for ( size_t n=0; n<Rx.size(); ++n ) {
+            nRx[n] = Rx[n].size();
+        }
+        ShotProcesses<T1> sp(nProc);
+        sp.run(nRx, [&g,&Tx,&t0,&Rx](const size_t n, std::vector<T1>& t) {
+            g.raytrace(Tx[n], t0[n], Rx[n], t, 0);
+        }, tt);
+    }
+
+}
+
+#endif
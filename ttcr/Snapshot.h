@@ -0,0 +1,305 @@
+//
+//  Snapshot.h
+//  ttcr
+//
+//  Created by agent on 2026-10-18.
+//  Copyright (c) 2026 agent. All rights reserved.
+//
+
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef ttcr_Snapshot_h
+#define ttcr_Snapshot_h
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+#include "ttcr_t.h"
+
+namespace ttcr {
+
+    // Binary snapshots of fully built grids (nodes, cell neighbors and
+    // slowness), used to restore a grid without rebuilding it.  A snapshot
+    // starts with a header holding a magic string, the format version, the
+    // sizes of T1 and T2, a tag naming the type of grid, the parameters the
+    // grid was built with and a hash of the input mesh (primary nodes and
+    // tetrahedra); arrays are then stored as their number of elements
+    // (uint64) followed by the raw values, in the byte order of the machine.
+    // Snapshots are validated when read, and std::runtime_error is thrown
+    // if they are truncated or inconsistent.
+
+    const char snapshotMagic[8] = { 't', 't', 'c', 'r', 's', 'n', 'a', 'p' };
+    const uint32_t snapshotVersion = 2;
+
+    struct snapshotHeader {
+        std::string tag;
+        std::vector<double> parameters;
+        uint64_t inputHash;
+    };
+
+    // read-only stream buffer over a block of memory (e.g. a mapped file or
+    // a python bytes object), to restore a snapshot without copying it
+    class SnapshotBuffer : public std::streambuf {
+    public:
+        SnapshotBuffer(const char* buffer, const size_t size) {
+            char* p = const_cast<char*>(buffer);
+            setg(p, p, p+size);
+        }
+    };
+
+    template<typename T>
+    void writeSnapshotValue(std::ostream& os, const T& v) {
+        os.write(reinterpret_cast<const char*>(&v), sizeof(T));
+    }
+
+    template<typename T>
+    void readSnapshotValue(std::istream& is, T& v) {
+        if ( !is.read(reinterpret_cast<char*>(&v), sizeof(T)) ) {
+            throw std::runtime_error("Error: truncated snapshot.");
+        }
+    }
+
+    template<typename T>
+    void writeSnapshotArray(std::ostream& os, const std::vector<T>& v) {
+        writeSnapshotValue(os, static_cast<uint64_t>(v.size()));
+        os.write(reinterpret_cast<const char*>(v.data()), v.size()*sizeof(T));
+    }
+
+    // arrays are read by blocks, so that a corrupted length cannot make
+    // memory be allocated beyond the length of the stream
+    template<typename T>
+    void readSnapshotArray(std::istream& is, std::vector<T>& v) {
+        uint64_t n;
+        readSnapshotValue(is, n);
+        if ( n > std::numeric_limits<size_t>::max()/sizeof(T) ) {
+            throw std::runtime_error("Error: corrupted snapshot.");
+        }
+        const size_t block = (size_t(1)<<20)/sizeof(T) + 1;
+        v.clear();
+        while ( v.size() < n ) {
+            size_t m = v.size();
+            v.resize( m + std::min(static_cast<size_t>(n)-m, block) );
+            if ( !is.read(reinterpret_cast<char*>(v.data()+m), (v.size()-m)*sizeof(T)) ) {
+                throw std::runtime_error("Error: truncated snapshot.");
+            }
+        }
+    }
+
+    // lists of lists (neighbors, owners) are stored in compressed sparse
+    // row format
+    template<typename T>
+    void writeSnapshotCSR(std::ostream& os, const std::vector<std::vector<T>>& v) {
+        std::vector<uint64_t> indptr(v.size()+1, 0);
+        for ( size_t n=0; n<v.size(); ++n ) {
+            indptr[n+1] = indptr[n] + v[n].size();
+        }
+        std::vector<T> indices;
+        indices.reserve(indptr.back());
+        for ( size_t n=0; n<v.size(); ++n ) {
+            indices.insert(indices.end(), v[n].begin(), v[n].end());
+        }
+        writeSnapshotArray(os, indptr);
+        writeSnapshotArray(os, indices);
+    }
+
+    template<typename T>
+    void readSnapshotCSR(std::istream& is, std::vector<std::vector<T>>& v) {
+        std::vector<uint64_t> indptr;
+        std::vector<T> indices;
+        readSnapshotArray(is, indptr);
+        readSnapshotArray(is, indices);
+        if ( indptr.empty() || indptr[0] != 0 || indptr.back() != indices.size() ) {
+            throw std::runtime_error("Error: corrupted snapshot.");
+        }
+        for ( size_t n=1; n<indptr.size(); ++n ) {
+            if ( indptr[n] < indptr[n-1] ) {
+                throw std::runtime_error("Error: corrupted snapshot.");
+            }
+        }
+        v.resize(indptr.size()-1);
+        for ( size_t n=0; n<v.size(); ++n ) {
+            v[n].assign(indices.begin()+indptr[n], indices.begin()+indptr[n+1]);
+        }
+    }
+
+    template<typename T1, typename T2>
+    void writeSnapshotHeader(std::ostream& os, const snapshotHeader& h) {
+        os.write(snapshotMagic, sizeof(snapshotMagic));
+        writeSnapshotValue(os, snapshotVersion);
+        writeSnapshotValue(os, static_cast<uint32_t>(sizeof(T1)));
+        writeSnapshotValue(os, static_cast<uint32_t>(sizeof(T2)));
+        std::vector<char> t(h.tag.begin(), h.tag.end());
+        writeSnapshotArray(os, t);
+        writeSnapshotArray(os, h.parameters);
+        writeSnapshotValue(os, h.inputHash);
+    }
+
+    template<typename T1, typename T2>
+    void readSnapshotHeader(std::istream& is, snapshotHeader& h) {
+        char magic[sizeof(snapshotMagic)];
+        if ( !is.read(magic, sizeof(magic)) ||
+            std::memcmp(magic, snapshotMagic, sizeof(magic)) != 0 ) {
+            throw std::runtime_error("Error: not a ttcr snapshot.");
+        }
+        uint32_t version, s1, s2;
+        readSnapshotValue(is, version);
+        if ( version != snapshotVersion ) {
+            throw std::runtime_error("Error: unsupported snapshot version.");
+        }
+        readSnapshotValue(is, s1);
+        readSnapshotValue(is, s2);
+        if ( s1 != sizeof(T1) || s2 != sizeof(T2) ) {
+            throw std::runtime_error("Error: snapshot was saved for another type of grid.");
+        }
+        std::vector<char> t;
+        readSnapshotArray(is, t);
+        h.tag.assign(t.begin(), t.end());
+        readSnapshotArray(is, h.parameters);
+        readSnapshotValue(is, h.inputHash);
+    }
+
+    // header read from a snapshot, compared to the one of the grid restored
+    inline void checkSnapshotHeader(const snapshotHeader& h,
+                                    const snapshotHeader& expected) {
+        if ( h.tag != expected.tag ) {
+            throw std::runtime_error("Error: snapshot was saved for another type of grid.");
+        }
+        if ( h.parameters != expected.parameters ) {
+            throw std::runtime_error("Error: snapshot was saved for a grid built with other parameters.");
+        }
+    }
+
+    // FNV-1a hash of the coordinates of the primary nodes and of the
+    // tetrahedra, to check that a snapshot was saved for a given mesh
+    template<typename T1, typename T2>
+    uint64_t snapshotInputHash(const std::vector<sxyz<T1>>& nodes,
+                               const std::vector<tetrahedronElem<T2>>& tet) {
+        uint64_t h = 14695981039346656037ULL;
+        auto add = [&h](const void* v, const size_t size) {
+            const unsigned char* c = static_cast<const unsigned char*>(v);
+            for ( size_t i=0; i<size; ++i ) {
+                h ^= c[i];
+                h *= 1099511628211ULL;
+            }
+        };
+        for ( size_t n=0; n<nodes.size(); ++n ) {
+            add(&nodes[n].x, sizeof(T1));
+            add(&nodes[n].y, sizeof(T1));
+            add(&nodes[n].z, sizeof(T1));
+        }
+        for ( size_t n=0; n<tet.size(); ++n ) {
+            add(tet[n].i, 4*sizeof(T2));
+            add(&tet[n].physical_entity, sizeof(T2));
+        }
+        return h;
+    }
+
+    // all indices held in v must be lower than n
+    template<typename T>
+    void checkSnapshotIndices(const std::vector<std::vector<T>>& v, const size_t n) {
+        for ( size_t i=0; i<v.size(); ++i ) {
+            for ( size_t j=0; j<v[i].size(); ++j ) {
+                if ( v[i][j] >= n ) {
+                    throw std::runtime_error("Error: corrupted snapshot.");
+                }
+            }
+        }
+    }
+
+    // coordinates, indices, primary flags and owners of the nodes of a grid
+    template<typename T1, typename T2, typename NODE>
+    void writeSnapshotNodes(std::ostream& os, const std::vector<NODE>& nodes) {
+        std::vector<T1> xyz(3*nodes.size());
+        std::vector<T2> index(nodes.size());
+        std::vector<int32_t> primary(nodes.size());
+        std::vector<std::vector<T2>> owners(nodes.size());
+        for ( size_t n=0; n<nodes.size(); ++n ) {
+            xyz[3*n] = nodes[n].getX();
+            xyz[3*n+1] = nodes[n].getY();
+            xyz[3*n+2] = nodes[n].getZ();
+            index[n] = nodes[n].getGridIndex();
+            primary[n] = nodes[n].getPrimary();
+            owners[n] = nodes[n].getOwners();
+        }
+        writeSnapshotArray(os, xyz);
+        writeSnapshotArray(os, index);
+        writeSnapshotArray(os, primary);
+        writeSnapshotCSR(os, owners);
+    }
+
+    template<typename T1, typename T2, typename NODE>
+    void readSnapshotNodes(std::istream& is, std::vector<NODE>& nodes,
+                           const size_t nt) {
+        std::vector<T1> xyz;
+        std::vector<T2> index;
+        std::vector<int32_t> primary;
+        std::vector<std::vector<T2>> owners;
+        readSnapshotArray(is, xyz);
+        readSnapshotArray(is, index);
+        readSnapshotArray(is, primary);
+        readSnapshotCSR(is, owners);
+        if ( xyz.size() != 3*index.size() || primary.size() != index.size() ||
+            owners.size() != index.size() ) {
+            throw std::runtime_error("Error: corrupted snapshot.");
+        }
+        nodes.assign(index.size(), NODE(nt));
+        for ( size_t n=0; n<nodes.size(); ++n ) {
+            nodes[n].setXYZindex(xyz[3*n], xyz[3*n+1], xyz[3*n+2], index[n]);
+            nodes[n].setPrimary(primary[n]);
+            for ( size_t no=0; no<owners[n].size(); ++no ) {
+                nodes[n].pushOwner(owners[n][no]);
+            }
+        }
+    }
+
+    template<typename T2>
+    void writeSnapshotTetrahedra(std::ostream& os,
+                                 const std::vector<tetrahedronElem<T2>>& tet) {
+        std::vector<T2> t(5*tet.size());
+        for ( size_t n=0; n<tet.size(); ++n ) {
+            for ( size_t i=0; i<4; ++i ) {
+                t[5*n+i] = tet[n].i[i];
+            }
+            t[5*n+4] = tet[n].physical_entity;
+        }
+        writeSnapshotArray(os, t);
+    }
+
+    template<typename T2>
+    void readSnapshotTetrahedra(std::istream& is,
+                                std::vector<tetrahedronElem<T2>>& tet) {
+        std::vector<T2> t;
+        readSnapshotArray(is, t);
+        if ( t.size() % 5 != 0 ) {
+            throw std::runtime_error("Error: corrupted snapshot.");
+        }
+        tet.resize(t.size()/5);
+        for ( size_t n=0; n<tet.size(); ++n ) {
+            tet[n] = tetrahedronElem<T2>(t[5*n], t[5*n+1], t[5*n+2], t[5*n+3], t[5*n+4]);
+        }
+    }
+
+}
+
+#endif
@@ -0,0 +1,196 @@
+//
+//  StraightRays.h
+//  ttcr
+//
+//  Created by agent on 2026-10-18.
+//  Copyright (c) 2026 agent. All rights reserved.
+//
+
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * Reference paper
+ *
+ * @inproceedings{amanatides87,
+ *  author = {John Amanatides and Andrew Woo},
+ *  title = {A Fast Voxel Traversal Algorithm for Ray Tracing},
+ *  booktitle = {Eurographics '87},
+ *  year = {1987},
+ *  pages = {3-10}
+ * }
+ *
+ */
+
+#ifndef ttcr_StraightRays_h
+#define ttcr_StraightRays_h
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "ttcr_t.h"
+
+namespace ttcr {
+
+    // Index of the cell of a rectilinear grid axis (node coordinates gr)
+    // containing x.  A point on a grid line is assigned to the cell the ray
+    // enters when going in the direction of sign s.
+    template<typename T1>
+    long getStraightRayCell(const std::vector<T1>& gr, const T1 x, const int s) {
+        long i = static_cast<long>(std::upper_bound(gr.begin(), gr.end(), x) - gr.begin()) - 1;
+        if ( s < 0 && i > 0 && x == gr[i] ) {
+            --i;
+        }
+        return std::max(0L, std::min(i, static_cast<long>(gr.size())-2));
+    }
+
+    // Walks the cells crossed by the segment going from a to b, calling
+    // f(cellNo, length) for each of them (voxel traversal of Amanatides &
+    // Woo, with cell sizes varying along each axis).  Cells are numbered
+    // column-wise, i.e. (i*ncy + j)*ncz + k.
+    template<typename T1, typename F>
+    void traverseStraightRay(const sxyz<T1>& a, const sxyz<T1>& b,
+                             const std::vector<T1>& grx,
+                             const std::vector<T1>& gry,
+                             const std::vector<T1>& grz,
+                             F f) {
+        T1 d = std::sqrt( (b.x-a.x)*(b.x-a.x) + (b.y-a.y)*(b.y-a.y) + (b.z-a.z)*(b.z-a.z) );
+        if ( d == 0.0 ) return;
+
+        const std::vector<T1>* gr[3] = { &grx, &gry, &grz };
+        const T1 p[3] = { a.x, a.y, a.z };
+        const T1 dir[3] = { (b.x-a.x)/d, (b.y-a.y)/d, (b.z-a.z)/d };
+        const T1 eps = 1.e-10 * d;  // segments shorter than this are dropped
+
+        long i[3];
+        long nc[3];
+        int step[3];
+        T1 tMax[3];
+        for ( size_t k=0; k<3; ++k ) {
+            nc[k] = static_cast<long>(gr[k]->size()) - 1;
+            step[k] = (dir[k] > 0.0) - (dir[k] < 0.0);
+            i[k] = getStraightRayCell(*gr[k], p[k], step[k]);
+            if ( step[k] > 0 ) {
+                tMax[k] = ((*gr[k])[i[k]+1] - p[k]) / dir[k];
+            } else if ( step[k] < 0 ) {
+                tMax[k] = ((*gr[k])[i[k]] - p[k]) / dir[k];
+            } else {
+                tMax[k] = std::numeric_limits<T1>::max();
+            }
+        }
+
+        T1 t = 0.0;
+        while ( t < d ) {
+            size_t k = tMax[0] < tMax[1] ? 0 : 1;
+            if ( tMax[2] < tMax[k] ) k = 2;
+            T1 tNext = std::min(tMax[k], d);
+            if ( tNext-t > eps ) {
+                f( (i[0]*nc[1] + i[1])*nc[2] + i[2], tNext-t );
+            }
+            t = tNext;
+            i[k] += step[k];
+            if ( i[k] < 0 || i[k] >= nc[k] ) {
+                break;
+            }
+            tMax[k] = ((*gr[k])[step[k] > 0 ? i[k]+1 : i[k]] - p[k]) / dir[k];
+        }
+    }
+
+    // Data kernel matrix L of straight rays between pairs Tx[n]-Rx[n], in
+    // compressed sparse row format.  Pairs are processed in parallel; rows
+    // are first counted to size the arrays, then filled in place.
+    template<typename T1, typename T2>
+    void getStraightRayKernel(const std::vector<sxyz<T1>>& Tx,
+                              const std::vector<sxyz<T1>>& Rx,
+                              const std::vector<T1>& grx,
+                              const std::vector<T1>& gry,
+                              const std::vector<T1>& grz,
+                              std::vector<T2>& indptr,
+                              std::vector<T2>& indices,
+                              std::vector<T1>& data,
+                              const size_t nThreads=1) {
+        if ( Tx.size() != Rx.size() ) {
+            throw std::length_error("Error: Tx and Rx should have the same size.");
+        }
+        if ( grx.size() < 2 || gry.size() < 2 || grz.size() < 2 ) {
+            throw std::length_error("Error: grid should have at least one cell along each axis.");
+        }
+        auto checkPts = [&grx, &gry, &grz](const std::vector<sxyz<T1>>& pts) {
+            for ( size_t n=0; n<pts.size(); ++n ) {
+                if ( pts[n].x < grx.front() || pts[n].x > grx.back() ||
+                    pts[n].y < gry.front() || pts[n].y > gry.back() ||
+                    pts[n].z < grz.front() || pts[n].z > grz.back() ) {
+                    std::ostringstream msg;
+                    msg << "Error: Point (" << pts[n].x << ", " << pts[n].y << ", " << pts[n].z << ") outside grid.";
+                    throw std::runtime_error(msg.str());
+                }
+            }
+        };
+        checkPts(Tx);
+        checkPts(Rx);
+
+        size_t n_blk = std::max(static_cast<size_t>(1), std::min(nThreads, Tx.size()));
+        size_t blk_size = (Tx.size() + n_blk - 1) / n_blk;
+        auto run = [&](const std::function<void(size_t)>& work) {
+            if ( n_blk == 1 ) {
+                for ( size_t n=0; n<Tx.size(); ++n ) work(n);
+                return;
+            }
+            std::vector<std::thread> threads(n_blk);
+            for ( size_t i=0; i<n_blk; ++i ) {
+                size_t blk_start = i*blk_size;
+                size_t blk_end = std::min(blk_start+blk_size, Tx.size());
+                threads[i] = std::thread( [&work,blk_start,blk_end]{
+                    for ( size_t n=blk_start; n<blk_end; ++n ) work(n);
+                });
+            }
+            std::for_each(threads.begin(),threads.end(), std::mem_fn(&std::thread::join));
+        };
+
+        // first pass: number of cells crossed by each ray
+        indptr.assign(Tx.size()+1, 0);
+        run( [&](size_t n) {
+            T2 count = 0;
+            traverseStraightRay(Tx[n], Rx[n], grx, gry, grz,
+                                [&count](const long, const T1) { ++count; });
+            indptr[n+1] = count;
+        });
+        for ( size_t n=0; n<Tx.size(); ++n ) {
+            indptr[n+1] += indptr[n];
+        }
+
+        // second pass: fill
+        indices.resize(indptr.back());
+        data.resize(indptr.back());
+        run( [&](size_t n) {
+            size_t k = indptr[n];
+            traverseStraightRay(Tx[n], Rx[n], grx, gry, grz,
+                                [&](const long cellNo, const T1 l) {
+                                    indices[k] = static_cast<T2>(cellNo);
+                                    data[k++] = l;
+                                });
+        });
+    }
+
+}
+
+#endif
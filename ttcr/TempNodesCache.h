@@ -0,0 +1,129 @@
+//
+//  TempNodesCache.h
+//  ttcr
+//
+//  Created by agent on 2026-10-18.
+//  Copyright (c) 2026 agent. All rights reserved.
+//
+
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef ttcr_TempNodesCache_h
+#define ttcr_TempNodesCache_h
+
+#include <array>
+#include <utility>
+#include <vector>
+
+#include "ttcr_t.h"
+
+namespace ttcr {
+
+    // Bookkeeping of the temporary nodes added around the sources by the
+    // dynamic shortest path method.  The layout of the temporary nodes only
+    // depends on the position of the sources, so it can be reused as long as
+    // the sources do not move, and only the slowness at the temporary nodes
+    // has to be updated when the model changes.  This is done with the indices
+    // and weights of the permanent nodes used to interpolate the slowness
+    // (unused for grids where slowness is defined in cells).
+    //
+    // Besides the nodes in use, the nodes of at most `capacity' previous
+    // sources are kept, the least recently used being dropped first.  Each
+    // holds about as many nodes as the tertiary nodes of a source, hence the
+    // cache is off by default.
+
+    template<typename T1, typename T2, typename NODE>
+    class TempNodesCache {
+    public:
+        TempNodesCache() : version(0), valid(false), capacity(0) {}
+
+        std::vector<std::array<T2,4>> parents;
+        std::vector<std::array<T1,4>> weights;
+        size_t version;   // version of the slowness model at the time of interpolation
+
+        // number of previous sources whose nodes are kept
+        void setCapacity(const size_t c) {
+            capacity = c;
+            if ( stored.size() > capacity ) stored.resize( capacity );
+        }
+
+        // Look for temporary nodes built for Tx.  nodes holds the temporary
+        // nodes currently in use, which are kept for later calls if capacity
+        // allows.  Returns false if nodes must be built.
+        bool fetch(const std::vector<sxyz<T1>>& Tx,
+                   std::vector<NODE>& nodes) {
+            if ( valid && Tx == txCurrent ) {
+                return true;
+            }
+            if ( capacity > 0 && valid ) {
+                // most recently used first
+                stored.insert( stored.begin(), Entry() );
+                std::swap(stored.front().Tx, txCurrent);
+                std::swap(stored.front().nodes, nodes);
+                std::swap(stored.front().parents, parents);
+                std::swap(stored.front().weights, weights);
+                stored.front().version = version;
+            }
+            valid = false;
+            for ( size_t n=0; n<stored.size(); ++n ) {
+                if ( stored[n].Tx == Tx ) {
+                    std::swap(stored[n].Tx, txCurrent);
+                    std::swap(stored[n].nodes, nodes);
+                    std::swap(stored[n].parents, parents);
+                    std::swap(stored[n].weights, weights);
+                    version = stored[n].version;
+                    stored.erase( stored.begin()+n );
+                    valid = true;
+                    return true;
+                }
+            }
+            if ( stored.size() > capacity ) stored.resize( capacity );
+            nodes.clear();
+            parents.clear();
+            weights.clear();
+            return false;
+        }
+
+        // to be called once temporary nodes are built for Tx
+        void set(const std::vector<sxyz<T1>>& Tx, const size_t v) {
+            txCurrent = Tx;
+            version = v;
+            valid = true;
+        }
+
+        void clear() {
+            stored.clear();
+        }
+
+    private:
+        struct Entry {
+            std::vector<sxyz<T1>> Tx;
+            std::vector<NODE> nodes;
+            std::vector<std::array<T2,4>> parents;
+            std::vector<std::array<T1,4>> weights;
+            size_t version;
+        };
+
+        std::vector<sxyz<T1>> txCurrent;
+        bool valid;
+        size_t capacity;
+        std::vector<Entry> stored;    // most recently used first
+    };
+
+}
+
+#endif
@@ -0,0 +1,241 @@
+//
+//  WarmStart.h
+//  ttcr
+//
+//  Created by agent on 2026-10-18.
+//  Copyright (c) 2026 agent. All rights reserved.
+//
+
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+
+ Initial traveltimes of the fast sweeping method
+
+ In iterative inversion the model changes little from one iteration to the
+ next, and the traveltimes computed for a source at the previous iteration
+ are close to the new ones.  Sweeping from these traveltimes instead of
+ infinity needs fewer iterations, provided they are upper bounds of the new
+ ones: the usual updates, which only decrease values, then apply.  If the
+ slowness used for the previous solve is known, the previous traveltimes
+ are multiplied by the largest ratio of the new to the old slowness when
+ it exceeds one, which makes them upper bounds.  Moreover, if this ratio
+ does not exceed one, only the nodes whose slowness changed and their
+ neighbours have to be updated at first, the others being consistent with
+ their neighbours as long as these do not change.  Without the previous
+ slowness, the traveltimes are not known to be upper bounds, and relaxed
+ updates (values may increase) are needed.
+
+ The initial field of a solve is either supplied for a thread (it is used
+ by the next solve on that thread), or taken from the fields kept for each
+ source when caching is enabled.  Kept fields hold at most a given number
+ of bytes, the least recently used being dropped.
+
+ */
+
+#ifndef ttcr_WarmStart_h
+#define ttcr_WarmStart_h
+
+#include <limits>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+#include "ttcr_t.h"
+
+namespace ttcr {
+
+    template<typename T1>
+    struct traveltimeField {
+        std::vector<T1> tt;  // traveltimes at the nodes
+        std::vector<T1> s;   // slowness at the nodes used to compute tt, empty if unknown
+    };
+
+    template<typename T1>
+    class WarmStart {
+    public:
+        typedef std::shared_ptr<const traveltimeField<T1>> field;
+
+        WarmStart(const size_t nt=1) : cached(false), capacity(0), nBytes(0),
+        seeds(nt), niter(nt, 0) {}
+
+        // keep the final field of each source, to start the next solve for
+        // the same source (Tx and t0), within maxBytes
+        void setCached(const bool c, const size_t maxBytes=268435456) {
+            std::lock_guard<std::mutex> lock(mtx);
+            cached = c;
+            capacity = maxBytes;
+            if ( !cached ) {
+                lru.clear();
+                fields.clear();
+                nBytes = 0;
+            } else {
+                shrink();
+            }
+        }
+        bool isCached() const {
+            std::lock_guard<std::mutex> lock(mtx);
+            return cached;
+        }
+
+        void clear() {
+            std::lock_guard<std::mutex> lock(mtx);
+            lru.clear();
+            fields.clear();
+            nBytes = 0;
+            for ( size_t n=0; n<seeds.size(); ++n ) seeds[n].reset();
+        }
+
+        void setSeed(const std::vector<T1>& tt, const std::vector<T1>& s,
+                     const size_t threadNo) {
+            if ( !s.empty() && s.size() != tt.size() ) {
+                throw std::length_error("Error: traveltimes and slowness of seed should have the same size.");
+            }
+            std::shared_ptr<traveltimeField<T1>> f = std::make_shared<traveltimeField<T1>>();
+            f->tt = tt;
+            f->s = s;
+            seeds.at(threadNo) = f;
+        }
+        void dropSeed(const size_t threadNo) { seeds.at(threadNo).reset(); }
+
+        // field used to start the solve for Tx on thread threadNo: the seed
+        // supplied for the thread (used once), or the field kept for Tx,
+        // null if none
+        field get(const std::vector<sxyz<T1>>& Tx, const std::vector<T1>& t0,
+                  const size_t threadNo) {
+            field f;
+            f.swap( seeds[threadNo] );
+            std::lock_guard<std::mutex> lock(mtx);
+            if ( f || !cached ) return f;
+            typename std::map<std::vector<T1>, typename entryList::iterator>::iterator it = fields.find(key(Tx, t0));
+            if ( it != fields.end() ) {
+                lru.splice(lru.begin(), lru, it->second);
+                f = it->second->second;
+            }
+            return f;
+        }
+
+        void put(const std::vector<sxyz<T1>>& Tx, const std::vector<T1>& t0,
+                 const field& f) {
+            std::lock_guard<std::mutex> lock(mtx);
+            if ( !cached ) return;
+            const std::vector<T1> k = key(Tx, t0);
+            typename std::map<std::vector<T1>, typename entryList::iterator>::iterator it = fields.find(k);
+            if ( it != fields.end() ) {
+                nBytes -= bytes(*(it->second->second));
+                lru.erase( it->second );
+                fields.erase( it );
+            }
+            lru.push_front( std::make_pair(k, f) );
+            fields[k] = lru.begin();
+            nBytes += bytes(*f);
+            shrink();
+        }
+
+        size_t size() const {
+            std::lock_guard<std::mutex> lock(mtx);
+            return fields.size();
+        }
+
+        // number of sweeps of the last solve on thread threadNo
+        int getNiter(const size_t threadNo) const { return niter.at(threadNo); }
+        void setNiter(const int n, const size_t threadNo) { niter[threadNo] = n; }
+
+        // Sets the traveltimes of the nodes that are not frozen to those of
+        // f, made upper bounds of the new ones if the slowness used to
+        // compute f is known, and flags the nodes to update first.  Returns
+        // true if the traveltimes are not known to be upper bounds, in
+        // which case relaxed updates are needed.
+        template<typename NODE>
+        bool seedNodes(const traveltimeField<T1>& f, std::vector<NODE>& nodes,
+                       const std::vector<bool>& frozen, std::vector<bool>& changed,
+                       const size_t threadNo) const {
+            if ( f.tt.size() != nodes.size() ) {
+                throw std::length_error("Error: initial traveltimes of incompatible size.");
+            }
+            T1 ratio = 1.0;
+            for ( size_t n=0; n<f.s.size(); ++n ) {
+                if ( f.s[n] > 0.0 && nodes[n].getNodeSlowness() > ratio*f.s[n] )
+                    ratio = nodes[n].getNodeSlowness()/f.s[n];
+            }
+            // with scaled traveltimes, all nodes may decrease
+            changed.assign( nodes.size(), f.s.empty() || ratio > 1.0 );
+            for ( size_t n=0; n<nodes.size(); ++n ) {
+                if ( !frozen[n] && f.tt[n] < std::numeric_limits<T1>::max() )
+                    nodes[n].setTT( ratio*f.tt[n], threadNo );
+                if ( !f.s.empty() && nodes[n].getNodeSlowness() != f.s[n] )
+                    changed[n] = true;
+            }
+            return f.s.empty();
+        }
+
+        template<typename NODE>
+        field makeField(const std::vector<NODE>& nodes, const size_t threadNo) const {
+            std::shared_ptr<traveltimeField<T1>> f = std::make_shared<traveltimeField<T1>>();
+            f->tt.resize( nodes.size() );
+            f->s.resize( nodes.size() );
+            for ( size_t n=0; n<nodes.size(); ++n ) {
+                f->tt[n] = nodes[n].getTT(threadNo);
+                f->s[n] = nodes[n].getNodeSlowness();
+            }
+            return f;
+        }
+
+    private:
+        typedef std::list<std::pair<std::vector<T1>, field>> entryList;
+
+        bool cached;
+        size_t capacity;                          // max number of bytes of kept fields
+        size_t nBytes;
+        mutable std::mutex mtx;
+        entryList lru;                            // kept fields, most recently used first
+        std::map<std::vector<T1>, typename entryList::iterator> fields;
+        std::vector<field> seeds;                 // supplied seed of each thread
+        std::vector<int> niter;
+
+        static size_t bytes(const traveltimeField<T1>& f) {
+            return (f.tt.size()+f.s.size())*sizeof(T1);
+        }
+
+        void shrink() {
+            while ( nBytes > capacity && !lru.empty() ) {
+                nBytes -= bytes(*(lru.back().second));
+                fields.erase( lru.back().first );
+                lru.pop_back();
+            }
+        }
+
+        static std::vector<T1> key(const std::vector<sxyz<T1>>& Tx,
+                                   const std::vector<T1>& t0) {
+            std::vector<T1> k;
+            k.reserve( 4*Tx.size() );
+            for ( size_t n=0; n<Tx.size(); ++n ) {
+                k.push_back( Tx[n].x );
+                k.push_back( Tx[n].y );
+                k.push_back( Tx[n].z );
+                k.push_back( n<t0.size() ? t0[n] : 0.0 );
+            }
+            return k;
+        }
+    };
+
+}
+
+#endif
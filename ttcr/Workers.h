@@ -0,0 +1,162 @@
+//
+//  Workers.h
+//  ttcr
+//
+//  Created by agent on 2026-10-18.
+//  Copyright (c) 2026 agent. All rights reserved.
+//
+
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+
+ Group of threads reused by successive parallel loops
+
+ Solvers iterating many times over short loops (e.g. the active list of
+ the fast iterative method) cannot afford to start threads at each
+ iteration.  The threads of a group wait between loops, and the calling
+ thread takes part in each loop run with run().  A loop started with
+ start() is left to the threads of the group, the calling thread being free
+ to do other work (e.g. consume results) until it calls wait().
+
+ */
+
+#ifndef ttcr_Workers_h
+#define ttcr_Workers_h
+
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace ttcr {
+
+    class Workers {
+    public:
+        // group of nt threads, including the calling thread
+        Workers(const size_t nt) : threads(), task(), nTasks(0), next(0),
+        running(0), generation(0), stop(false), error() {
+            for ( size_t i=1; i<nt; ++i ) {
+                threads.push_back( std::thread(&Workers::work, this) );
+            }
+        }
+
+        ~Workers() {
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                stop = true;
+            }
+            cv.notify_all();
+            for ( size_t i=0; i<threads.size(); ++i ) {
+                threads[i].join();
+            }
+        }
+
+        size_t size() const { return threads.size()+1; }
+
+        // f(i) for all i < n, returns when all are done
+        void run(const size_t n, const std::function<void(size_t)>& f) {
+            if ( threads.empty() || n <= 1 ) {
+                for ( size_t i=0; i<n; ++i ) f(i);
+                return;
+            }
+            std::unique_lock<std::mutex> lock(mtx);
+            launch(n, f);
+            doTasks(lock);
+            finish(lock);
+        }
+
+        // f(i) for all i < n on the threads of the group only, which must
+        // hold at least one thread besides the calling thread; wait()
+        // returns when all are done
+        void start(const size_t n, const std::function<void(size_t)>& f) {
+            if ( threads.empty() ) {
+                throw std::logic_error("Error: no thread to start a loop on.");
+            }
+            std::unique_lock<std::mutex> lock(mtx);
+            launch(n, f);
+        }
+        void wait() {
+            std::unique_lock<std::mutex> lock(mtx);
+            finish(lock);
+        }
+
+    private:
+        std::vector<std::thread> threads;
+        std::mutex mtx;
+        std::condition_variable cv;    // a loop is started
+        std::condition_variable done;  // a thread is done with the loop
+        std::function<void(size_t)> task;
+        size_t nTasks;
+        size_t next;
+        size_t running;                // threads not done with the loop
+        size_t generation;             // number of loops started
+        bool stop;
+        std::exception_ptr error;
+
+        Workers(const Workers&);
+        Workers& operator=(const Workers&);
+
+        // called with lock held
+        void launch(const size_t n, const std::function<void(size_t)>& f) {
+            task = f;
+            nTasks = n;
+            next = 0;
+            running = threads.size();
+            error = nullptr;
+            generation++;
+            cv.notify_all();
+        }
+        void finish(std::unique_lock<std::mutex>& lock) {
+            done.wait(lock, [this]{ return running == 0; });
+            task = nullptr;
+            if ( error ) std::rethrow_exception(error);
+        }
+        void doTasks(std::unique_lock<std::mutex>& lock) {
+            while ( next < nTasks && !error ) {
+                const size_t i = next++;
+                lock.unlock();
+                try {
+                    task(i);
+                } catch (...) {
+                    lock.lock();
+                    if ( !error ) error = std::current_exception();
+                    continue;
+                }
+                lock.lock();
+            }
+        }
+
+        void work() {
+            std::unique_lock<std::mutex> lock(mtx);
+            size_t seen = 0;  // loops may start before the thread gets here
+            for ( ;; ) {
+                cv.wait(lock, [this,seen]{ return stop || generation != seen; });
+                if ( stop ) return;
+                seen = generation;
+                doTasks(lock);
+                if ( --running == 0 ) done.notify_one();
+            }
+        }
+    };
+
+}
+
+#endif
@@ -25,6 +25,7 @@
 #ifndef ttcr_grids_h
 #define ttcr_grids_h
 
+#include <algorithm>
 #include <exception>
 #include <chrono>
 #include <set>
@@ -42,8 +43,10 @@
 #endif
 
 #include "Cell.h"
+#include "Grid2Drcfm.h"
 #include "Grid2Drcfs.h"
 #include "Grid2Drcsp.h"
+#include "Grid2Drnfm.h"
 #include "Grid2Drnfs.h"
 #include "Grid2Drnsp.h"
 #include "Grid2Ducfm.h"
@@ -54,15 +57,20 @@
 #include "Grid2Dunsp.h"
 #include "Grid3Drcsp.h"
 #include "Grid3Drcdsp.h"
+#include "Grid3Drcfm.h"
 #include "Grid3Drcfs.h"
 #include "Grid3Drnsp.h"
 #include "Grid3Drndsp.h"
+#include "Grid3Drnfm.h"
 #include "Grid3Drnfs.h"
+#include "Grid3Drtiled.h"
 #include "Grid3Ducfm.h"
+#include "Grid3Ducfim.h"
 #include "Grid3Ducfs.h"
 #include "Grid3Ducsp.h"
 #include "Grid3Ducdsp.h"
 #include "Grid3Dunfm.h"
+#include "Grid3Dunfim.h"
 #include "Grid3Dunfs.h"
 #include "Grid3Dunsp.h"
 #include "Grid3Dundsp.h"
@@ -77,11 +85,131 @@
 
 #include "Rcv.h"
 #include "Rcv2D.h"
+#include "Renumbering.h"
 
 #include "utils.h"
 
 namespace ttcr {
 
+/**
+ * check if grid should be restored from snapshot file, i.e. if the file
+ * exists and was saved for the same mesh
+ *
+ * @tparam T type of real numbers
+ * @param par input parameters structure holding name of snapshot file
+ * @param nodes nodes of the mesh
+ * @param tetrahedra cells of the mesh
+ */
+    template<typename T>
+    bool snapshotMatches(const input_parameters &par,
+                         const std::vector<sxyz<T>> &nodes,
+                         const std::vector<tetrahedronElem<uint32_t>> &tetrahedra) {
+        if ( par.snapshotfile.empty() ) return false;
+        std::ifstream fin(par.snapshotfile, std::ios::in | std::ios::binary);
+        if ( !fin ) return false;
+        snapshotHeader h;
+        try {
+            readSnapshotHeader<T,uint32_t>(fin, h);
+        } catch (std::exception& e) {
+            std::cerr << e.what() << " Building grid again." << std::endl;
+            return false;
+        }
+        if ( h.inputHash != snapshotInputHash(nodes, tetrahedra) ) {
+            if ( verbose ) {
+                std::cout << "Snapshot file " << par.snapshotfile
+                << " was saved for another mesh, building grid again.\n";
+            }
+            return false;
+        }
+        return true;
+    }
+
+/**
+ * restore grid from snapshot file
+ *
+ * @tparam T type of real numbers
+ * @param par input parameters structure holding name of snapshot file
+ * @param g grid to restore, built from empty lists of nodes and cells
+ * @return false if the snapshot does not match the grid, which must then
+ *         be built again
+ */
+    template<typename T>
+    bool loadGridSnapshot(const input_parameters &par, Grid3D<T,uint32_t> *g) {
+        if ( verbose ) {
+            std::cout << "Reading snapshot file " << par.snapshotfile << " ... ";
+            std::cout.flush();
+        }
+        std::ifstream fin(par.snapshotfile, std::ios::in | std::ios::binary);
+        try {
+            g->loadSnapshot(fin);
+        } catch (std::exception& e) {
+            std::cerr << e.what() << " Building grid again." << std::endl;
+            return false;
+        }
+        if ( verbose ) {
+            std::cout << "done.\nTotal number of nodes: " << g->getNumberOfNodes() << "\n";
+            std::cout.flush();
+        }
+        return true;
+    }
+
+/**
+ * save snapshot of grid, to be restored in later runs
+ *
+ * @tparam T type of real numbers
+ * @param par input parameters structure holding name of snapshot file
+ * @param g grid to save
+ */
+    template<typename T>
+    void saveGridSnapshot(const input_parameters &par, const Grid3D<T,uint32_t> *g) {
+        if ( verbose ) {
+            std::cout << "Saving snapshot in " << par.snapshotfile << " ... ";
+            std::cout.flush();
+        }
+        std::ofstream fout(par.snapshotfile, std::ios::out | std::ios::binary);
+        g->saveSnapshot(fout);
+        if ( !fout ) {
+            std::cerr << "Error: cannot write snapshot file " << par.snapshotfile << std::endl;
+        }
+        if ( verbose ) std::cout << "done.\n";
+    }
+
+/**
+ * renumber nodes and cells of mesh to improve memory locality
+ *
+ * @tparam T type of real numbers
+ * @param par input parameters structure holding renumbering method
+ * @param nodes mesh nodes
+ * @param elements mesh cells (tetrahedra or triangles)
+ * @param slowness slowness of cells or at nodes
+ * @param constCells true if slowness is defined for cells, false if at nodes
+ * @param renum maps between internal and external indices
+ */
+    template<typename T, typename S, typename ELEM>
+    void renumberMesh(const input_parameters &par,
+                      std::vector<S> &nodes,
+                      std::vector<ELEM> &elements,
+                      std::vector<T> &slowness,
+                      const bool constCells,
+                      Renumbering<uint32_t> &renum) {
+        renum.build(nodes, elements, par.renumbering);
+        if ( par.renumbering == NO_RENUMBERING ) return;
+        if ( verbose ) {
+            std::cout << "Renumbering mesh ("
+            << (par.renumbering == MORTON ? "Morton" : "reverse Cuthill-McKee")
+            << ") ... ";
+            std::cout.flush();
+        }
+        std::vector<T> tmp;
+        if ( constCells )
+            renum.toInternalCells(slowness, tmp);
+        else
+            renum.toInternalNodes(slowness, tmp);
+        slowness.swap( tmp );
+        renum.apply(nodes, elements);
+        if ( verbose ) std::cout << "done.\n";
+    }
+
 /**
  * build 3D rectilinear grid from parameters
  *
@@ -221,9 +349,19 @@ namespace ttcr {
                 std::cout << "\n  Grid has slowness defined at nodes";
             if ( par.method == FAST_SWEEPING && par.weno3 == true)
                 std::cout << "\n  Fast Sweeping Method: will use 3rd order WENO stencil";
+            if ( par.method == FAST_MARCHING && par.weno3 == true)
+                std::cout << "\n  Fast Marching Method: will use 2nd order stencil";
             std::cout << std::endl;
         }
         
+        // in single precision, the grid is built with its origin at 0, and
+        // coordinates are shifted by Grid3D (see setOrigin)
+        sxyz<double> origin;
+        if ( par.singlePrecision ) {
+            origin = sxyz<double>(min[0], min[1], min[2]);
+            min[0] = min[1] = min[2] = 0.0;
+        }
+        
         std::chrono::high_resolution_clock::time_point begin, end;
         switch (par.method) {
             case SHORTEST_PATH:
@@ -257,9 +395,29 @@ namespace ttcr {
             }
             case FAST_MARCHING:
             {
-                std::cerr << "Error: fast marching method not yet implemented for 3D rectilinear grids\n";
-                std::cerr.flush();
-                return nullptr;
+                if ( verbose ) {
+                    std::cout << "Creating grid ... ";
+                    std::cout.flush();
+                }
+                if ( par.time ) { begin = std::chrono::high_resolution_clock::now(); }
+                if ( constCells ) {
+                    g = new Grid3Drcfm<T, uint32_t>(ncells[0], ncells[1], ncells[2],
+                                                    d[0], min[0], min[1],  min[2],
+                                                    par.weno3, par.tt_from_rp,
+                                                    par.interpVel, nt);
+                }
+                else
+                    g = new Grid3Drnfm<T, uint32_t>(ncells[0], ncells[1], ncells[2],
+                                                    d[0], min[0], min[1],  min[2],
+                                                    par.weno3, par.tt_from_rp,
+                                                    par.interpVel, nt);
+                
+                if ( par.time ) { end = std::chrono::high_resolution_clock::now(); }
+                if ( verbose ) {
+                    std::cout << "done.\n";
+                    std::cout.flush();
+                }
+                
                 break;
             }
             case FAST_SWEEPING:
@@ -337,6 +495,10 @@ namespace ttcr {
         }
         std::cout.flush();
         
+        if ( par.singlePrecision ) {
+            g->setOrigin(origin);
+        }
+        
         try {
             g->setSlowness(slowness);
         } catch (std::exception& e) {
@@ -362,8 +524,68 @@ namespace ttcr {
 
         return g;
     }
-    
-    
+
+
+/**
+ * build 3D rectilinear grid with slowness model stored in a brick file,
+ * traveltimes being computed over windows around each shot
+ *
+ * @tparam T type of real numbers
+ * @param par input parameters structure holding name of brick file
+ * @param nt number of threads
+ */
+    template<typename T>
+    Grid3D<T,uint32_t> *buildTiled3D(const input_parameters &par,
+                                     const size_t nt) {
+
+        if ( par.method == DYNAMIC_SHORTEST_PATH ) {
+            std::cerr << "Error: dynamic shortest path not implemented for tiled models"
+            << std::endl;
+            return nullptr;
+        }
+        if ( par.saveM ) {
+            std::cerr << "Error: matrix M not available for tiled models" << std::endl;
+            return nullptr;
+        }
+        if ( par.saveGridTT > 0 ) {
+            std::cerr << "Error: traveltimes at grid nodes cannot be saved for tiled models"
+            << std::endl;
+            return nullptr;
+        }
+
+        Grid3Drtiled<T,uint32_t> *g = nullptr;
+        try {
+            windowGrid3Dr<T,uint32_t> builder(par.method, par.nn[0], par.nn[1], par.nn[2],
+                                              par.epsilon, par.nitermax, par.weno3,
+                                              par.tt_from_rp, par.interpVel);
+            g = new Grid3Drtiled<T,uint32_t>(par.modelfile, builder, par.tile_margin,
+                                             par.brick_cache, par.tt_from_rp, nt);
+        } catch (std::exception& e) {
+            std::cerr << e.what() << std::endl;
+            return nullptr;
+        }
+
+        if ( verbose ) {
+            const brickHeader& h = g->getStore().header();
+            std::cout << "Reading model file " << par.modelfile
+            << "\n  Tiled rectilinear grid in file has"
+            << "\n    " << g->getNumberOfNodes() << " nodes"
+            << "\n    " << g->getNumberOfCells() << " cells"
+            << "\n    (bricks of " << h.bs << " x " << h.bs << " x " << h.bs
+            << (h.cells ? " cells" : " nodes") << ", " << g->getStore().getCacheSize()
+            << " held in memory)"
+            << "\n  Dim\tmin\tmax\tinc."
+            << "\n   X\t" << g->getXmin() << '\t' << g->getXmax() << '\t' << h.d[0]
+            << "\n   Y\t" << g->getYmin() << '\t' << g->getYmax() << '\t' << h.d[1]
+            << "\n   Z\t" << g->getZmin() << '\t' << g->getZmax() << '\t' << h.d[2]
+            << "\n  Margin around shots: " << par.tile_margin
+            << std::endl;
+        }
+
+        return g;
+    }
+
+
 #ifdef VTK
 /**
  * build 3D rectilinear grid from VTK file
@@ -414,6 +636,8 @@ namespace ttcr {
             << std::endl;
             if ( par.method == FAST_SWEEPING && par.weno3 == true)
                 std::cout << "\n  Fast Sweeping Method: will use 3rd order WENO stencil\n";
+            if ( par.method == FAST_MARCHING && par.weno3 == true)
+                std::cout << "\n  Fast Marching Method: will use 2nd order stencil\n";
         }
         vtkPointData *pd = dataSet->GetPointData();
         vtkCellData *cd = dataSet->GetCellData();
@@ -516,9 +740,26 @@ namespace ttcr {
                         break;
                         
                     case FAST_MARCHING:
-                        std::cerr << "Error: fast marching method not yet implemented for 3D rectilinear grids\n";
-                        std::cerr.flush();
-                        return nullptr;
+                        if ( verbose ) { std::cout << "Building grid (Grid3Drnfm) ... "; std::cout.flush(); }
+                        if ( par.time ) { begin = std::chrono::high_resolution_clock::now(); }
+                        g = new Grid3Drnfm<T, uint32_t>(ncells[0], ncells[1], ncells[2],
+                                                        d[0], xrange[0], yrange[0], zrange[0],
+                                                        par.weno3, par.tt_from_rp,
+                                                        par.interpVel, nt);
+                        if ( par.time ) { end = std::chrono::high_resolution_clock::now(); }
+                        if ( verbose ) {
+                            std::cout << "done.\nTotal number of nodes: " << g->getNumberOfNodes()
+                            << "\nAssigning slowness at grid nodes ... ";
+                            std::cout.flush();
+                        }
+                        try {
+                            g->setSlowness(slowness);
+                        } catch (std::exception& e) {
+                            cerr << e.what() << endl;
+                            delete g;
+                            return nullptr;
+                        }
+                        if ( verbose ) std::cout << "done.\n";
                         break;
 
                     case DYNAMIC_SHORTEST_PATH:
@@ -699,9 +940,26 @@ namespace ttcr {
                         break;
                         
                     case FAST_MARCHING:
-                        std::cerr << "Error: fast marching method not yet implemented for 3D rectilinear grids\n";
-                        std::cerr.flush();
-                        return nullptr;
+                        if ( verbose ) { std::cout << "Building grid (Grid3Drcfm) ... "; std::cout.flush(); }
+                        if ( par.time ) { begin = std::chrono::high_resolution_clock::now(); }
+                        g = new Grid3Drcfm<T, uint32_t>(ncells[0], ncells[1], ncells[2],
+                                                        d[0], xrange[0], yrange[0], zrange[0],
+                                                        par.weno3, par.tt_from_rp,
+                                                        par.interpVel, nt);
+                        if ( par.time ) { end = std::chrono::high_resolution_clock::now(); }
+                        if ( verbose ) {
+                            std::cout << "done.\nTotal number of nodes: " << g->getNumberOfNodes()
+                            << "\nAssigning slowness at grid nodes ... ";
+                            std::cout.flush();
+                        }
+                        try {
+                            g->setSlowness(slowness);
+                        } catch (std::exception& e) {
+                            cerr << e.what() << endl;
+                            delete g;
+                            return nullptr;
+                        }
+                        if ( verbose ) std::cout << "done.\n";
                         break;
 
                     case DYNAMIC_SHORTEST_PATH:
@@ -795,6 +1053,14 @@ namespace ttcr {
             std::cout << std::endl;
         }
         
+        // when a snapshot of the same mesh is available, the grid is created
+        // from empty lists of nodes and cells, and restored from the snapshot
+        bool fromSnapshot = snapshotMatches(par, nodes, tetrahedra);
+        std::vector<sxyz<T>> noNodes;
+        std::vector<tetrahedronElem<uint32_t>> noTetrahedra;
+        const std::vector<sxyz<T>>& gNodes = fromSnapshot ? noNodes : nodes;
+        const std::vector<tetrahedronElem<uint32_t>>& gTetrahedra = fromSnapshot ? noTetrahedra : tetrahedra;
+
         std::chrono::high_resolution_clock::time_point begin, end;
         Grid3D<T, uint32_t> *g = nullptr;
         switch (par.method) {
@@ -806,15 +1072,15 @@ namespace ttcr {
                 }
                 if ( par.time ) { begin = std::chrono::high_resolution_clock::now(); }
                 if ( constCells )
-                    g = new Grid3Ducsp<T, uint32_t>(nodes,
-                                                    tetrahedra,
+                    g = new Grid3Ducsp<T, uint32_t>(gNodes,
+                                                    gTetrahedra,
                                                     par.nn[0],
                                                     par.tt_from_rp,
                                                     par.min_distance_rp,
                                                     nt);
                 else
-                    g = new Grid3Dunsp<T, uint32_t>(nodes,
-                                                    tetrahedra,
+                    g = new Grid3Dunsp<T, uint32_t>(gNodes,
+                                                    gTetrahedra,
                                                     par.nn[0],
                                                     par.interpVel,
                                                     par.tt_from_rp,
@@ -837,14 +1103,14 @@ namespace ttcr {
                 }
                 if ( par.time ) { begin = std::chrono::high_resolution_clock::now(); }
                 if ( constCells )
-                    g = new Grid3Ducfm<T, uint32_t>(nodes,
-                                                    tetrahedra,
+                    g = new Grid3Ducfm<T, uint32_t>(gNodes,
+                                                    gTetrahedra,
                                                     par.raypath_method,
                                                     par.tt_from_rp,
                                                     par.min_distance_rp,
                                                     nt);
                 else
-                    g = new Grid3Dunfm<T, uint32_t>(nodes, tetrahedra,
+                    g = new Grid3Dunfm<T, uint32_t>(gNodes, gTetrahedra,
                                                     par.raypath_method,
                                                     par.interpVel,
                                                     par.tt_from_rp,
@@ -866,8 +1132,8 @@ namespace ttcr {
                 }
                 if ( par.time ) { begin = std::chrono::high_resolution_clock::now(); }
                 if ( constCells )
-                    g = new Grid3Ducfs<T, uint32_t>(nodes,
-                                                    tetrahedra,
+                    g = new Grid3Ducfs<T, uint32_t>(gNodes,
+                                                    gTetrahedra,
                                                     par.epsilon,
                                                     par.nitermax,
                                                     par.raypath_method,
@@ -875,8 +1141,8 @@ namespace ttcr {
                                                     par.min_distance_rp,
                                                     nt);
                 else
-                    g = new Grid3Dunfs<T, uint32_t>(nodes,
-                                                    tetrahedra,
+                    g = new Grid3Dunfs<T, uint32_t>(gNodes,
+                                                    gTetrahedra,
                                                     par.epsilon,
                                                     par.nitermax,
                                                     par.raypath_method,
@@ -884,6 +1150,15 @@ namespace ttcr {
                                                     par.tt_from_rp,
                                                     par.min_distance_rp,
                                                     nt);
+                if ( fromSnapshot && !loadGridSnapshot(par, g) ) {
+                    // built again, without reading the snapshot, and saved
+                    delete g;
+                    input_parameters p(par);
+                    p.snapshotfile.clear();
+                    g = buildUnstructured3DfromVtu<T>(p, nt);
+                    if ( g != nullptr ) saveGridSnapshot(par, g);
+                    return g;
+                }
                 T xmin = g->getXmin();
                 T xmax = g->getXmax();
                 T ymin = g->getYmin();
@@ -914,6 +1189,44 @@ namespace ttcr {
                 
                 break;
             }
+            case FAST_ITERATIVE:
+            {
+                if ( verbose ) {
+                    std::cout << "Creating grid ... ";
+                    std::cout.flush();
+                }
+                if ( par.time ) { begin = std::chrono::high_resolution_clock::now(); }
+                if ( constCells )
+                    g = new Grid3Ducfim<T, uint32_t>(gNodes,
+                                                     gTetrahedra,
+                                                     par.epsilon,
+                                                     par.raypath_method,
+                                                     par.tt_from_rp,
+                                                     par.min_distance_rp,
+                                                     nt, nt);
+                else
+                    g = new Grid3Dunfim<T, uint32_t>(gNodes,
+                                                     gTetrahedra,
+                                                     par.epsilon,
+                                                     par.raypath_method,
+                                                     par.interpVel,
+                                                     par.tt_from_rp,
+                                                     par.min_distance_rp,
+                                                     nt, nt);
+                if ( par.time ) { end = std::chrono::high_resolution_clock::now(); }
+                if ( verbose ) {
+                    std::cout << "done.\n";
+                    std::cout.flush();
+                }
+                if ( par.source_radius>0.0 ) {
+                    if ( verbose ) {
+                        std::cout << "Setting source radius to " << par.source_radius << '\n';
+                    }
+                    g->setSourceRadius( par.source_radius );
+                }
+
+                break;
+            }
             case DYNAMIC_SHORTEST_PATH:
             {
                 if ( verbose ) {
@@ -922,8 +1235,8 @@ namespace ttcr {
                 }
                 if ( par.time ) { begin = std::chrono::high_resolution_clock::now(); }
                 if ( constCells )
-                    g = new Grid3Ducdsp<T, uint32_t>(nodes,
-                                                     tetrahedra,
+                    g = new Grid3Ducdsp<T, uint32_t>(gNodes,
+                                                     gTetrahedra,
                                                      par.nn[0],
                                                      par.nTertiary,
                                                      par.source_radius,
@@ -933,8 +1246,8 @@ namespace ttcr {
                                                      par.radius_tertiary_nodes,
                                                      nt);
                 else
-                    g = new Grid3Dundsp<T, uint32_t>(nodes,
-                                                     tetrahedra,
+                    g = new Grid3Dundsp<T, uint32_t>(gNodes,
+                                                     gTetrahedra,
                                                      par.nn[0],
                                                      par.nTertiary,
                                                      par.source_radius,
@@ -956,6 +1269,18 @@ namespace ttcr {
             default:
                 break;
         }
+        if ( fromSnapshot && par.method != FAST_SWEEPING ) {
+            if ( !loadGridSnapshot(par, g) ) {
+                // built again, without reading the snapshot, and saved
+                delete g;
+                input_parameters p(par);
+                p.snapshotfile.clear();
+                g = buildUnstructured3DfromVtu<T>(p, nt);
+                if ( g != nullptr ) saveGridSnapshot(par, g);
+                return g;
+            }
+            if ( par.time ) { end = std::chrono::high_resolution_clock::now(); }
+        }
         if ( par.time ) {
             std::cout.precision(12);
             std::cout << "Time to build grid: " << std::chrono::duration<double>(end-begin).count() << '\n';
@@ -983,6 +1308,9 @@ namespace ttcr {
             end = std::chrono::high_resolution_clock::now();
             std::cout << "Time to interpolate slowness values: " << std::chrono::duration<double>(end-begin).count() << '\n';
         }
+        if ( !fromSnapshot && !par.snapshotfile.empty() ) {
+            saveGridSnapshot(par, g);
+        }
         
         return g;
     }
@@ -995,11 +1323,13 @@ namespace ttcr {
  * @param par input parameters structure holding name of gmsh file
  * @param nt number of threads
  * @param nsrc number of sources (used if reflectors are built)
+ * @param renum if not null, holds maps between internal and external indices
  */
     template<typename T>
     Grid3D<T, uint32_t> *buildUnstructured3D(const input_parameters &par,
                                              std::vector<Rcv<T>> &reflectors,
-                                             const size_t nt, const size_t nsrc)
+                                             const size_t nt, const size_t nsrc,
+                                             Renumbering<uint32_t> *renum=nullptr)
     {
         
         MSHReader reader( par.modelfile.c_str() );
@@ -1018,7 +1348,27 @@ namespace ttcr {
         std::vector<tetrahedronElem<uint32_t>> tetrahedra(reader.getNumberOfTetra());
         std::vector<T> slowness(reader.getNumberOfTetra());
         
-        reader.readNodes3D(nodes);
+        // in single precision, nodes are read in double and the grid is built
+        // with coordinates relative to the lowest corner of the mesh, which
+        // are shifted by Grid3D (see setOrigin)
+        sxyz<double> origin;
+        if ( par.singlePrecision && !nodes.empty() ) {
+            std::vector<sxyz<double>> dnodes(nodes.size());
+            reader.readNodes3D(dnodes);
+            origin = dnodes[0];
+            for ( size_t n=1; n<dnodes.size(); ++n ) {
+                origin.x = std::min(origin.x, dnodes[n].x);
+                origin.y = std::min(origin.y, dnodes[n].y);
+                origin.z = std::min(origin.z, dnodes[n].z);
+            }
+            for ( size_t n=0; n<dnodes.size(); ++n ) {
+                nodes[n] = sxyz<T>(static_cast<T>(dnodes[n].x-origin.x),
+                                   static_cast<T>(dnodes[n].y-origin.y),
+                                   static_cast<T>(dnodes[n].z-origin.z));
+            }
+        } else {
+            reader.readNodes3D(nodes);
+        }
         reader.readTetrahedronElements(tetrahedra);
         if ( verbose ) std::cout << "done.\n";
         std::map<std::string, double> slownesses;
@@ -1096,6 +1446,18 @@ namespace ttcr {
             std::cout << std::endl;
         }
         
+        Renumbering<uint32_t> localRenum;
+        Renumbering<uint32_t> &rn = renum == nullptr ? localRenum : *renum;
+        renumberMesh(par, nodes, tetrahedra, slowness, constCells, rn);
+
+        // when a snapshot of the same mesh is available, the grid is created
+        // from empty lists of nodes and cells, and restored from the snapshot
+        bool fromSnapshot = snapshotMatches(par, nodes, tetrahedra);
+        std::vector<sxyz<T>> noNodes;
+        std::vector<tetrahedronElem<uint32_t>> noTetrahedra;
+        const std::vector<sxyz<T>>& gNodes = fromSnapshot ? noNodes : nodes;
+        const std::vector<tetrahedronElem<uint32_t>>& gTetrahedra = fromSnapshot ? noTetrahedra : tetrahedra;
+
         std::chrono::high_resolution_clock::time_point begin, end;
         Grid3D<T, uint32_t> *g = nullptr;
         switch (par.method) {
@@ -1107,15 +1469,15 @@ namespace ttcr {
                 }
                 if ( par.time ) { begin = std::chrono::high_resolution_clock::now(); }
                 if ( constCells )
-                    g = new Grid3Ducsp<T, uint32_t>(nodes,
-                                                    tetrahedra,
+                    g = new Grid3Ducsp<T, uint32_t>(gNodes,
+                                                    gTetrahedra,
                                                     par.nn[0],
                                                     par.tt_from_rp,
                                                     par.min_distance_rp,
                                                     nt);
                 else
-                    g = new Grid3Dunsp<T, uint32_t>(nodes,
-                                                    tetrahedra,
+                    g = new Grid3Dunsp<T, uint32_t>(gNodes,
+                                                    gTetrahedra,
                                                     par.nn[0],
                                                     par.interpVel,
                                                     par.tt_from_rp,
@@ -1138,15 +1500,15 @@ namespace ttcr {
                 }
                 if ( par.time ) { begin = std::chrono::high_resolution_clock::now(); }
                 if ( constCells )
-                    g = new Grid3Ducfm<T, uint32_t>(nodes,
-                                                    tetrahedra,
+                    g = new Grid3Ducfm<T, uint32_t>(gNodes,
+                                                    gTetrahedra,
                                                     par.raypath_method,
                                                     par.tt_from_rp,
                                                     par.min_distance_rp,
                                                     nt);
                 else
-                    g = new Grid3Dunfm<T, uint32_t>(nodes,
-                                                    tetrahedra,
+                    g = new Grid3Dunfm<T, uint32_t>(gNodes,
+                                                    gTetrahedra,
                                                     par.raypath_method,
                                                     par.interpVel,
                                                     par.tt_from_rp,
@@ -1174,8 +1536,8 @@ namespace ttcr {
                 }
                 if ( par.time ) { begin = std::chrono::high_resolution_clock::now(); }
                 if ( constCells )
-                    g = new Grid3Ducfs<T, uint32_t>(nodes,
-                                                    tetrahedra,
+                    g = new Grid3Ducfs<T, uint32_t>(gNodes,
+                                                    gTetrahedra,
                                                     par.epsilon,
                                                     par.nitermax,
                                                     par.raypath_method,
@@ -1183,8 +1545,8 @@ namespace ttcr {
                                                     par.min_distance_rp,
                                                     nt);
                 else
-                    g = new Grid3Dunfs<T, uint32_t>(nodes,
-                                                    tetrahedra,
+                    g = new Grid3Dunfs<T, uint32_t>(gNodes,
+                                                    gTetrahedra,
                                                     par.epsilon,
                                                     par.nitermax,
                                                     par.raypath_method,
@@ -1193,6 +1555,15 @@ namespace ttcr {
                                                     par.min_distance_rp,
                                                     nt);
                 
+                if ( fromSnapshot && !loadGridSnapshot(par, g) ) {
+                    // built again, without reading the snapshot, and saved
+                    delete g;
+                    input_parameters p(par);
+                    p.snapshotfile.clear();
+                    g = buildUnstructured3D<T>(p, reflectors, nt, nsrc, renum);
+                    if ( g != nullptr ) saveGridSnapshot(par, g);
+                    return g;
+                }
                 T xmin = g->getXmin();
                 T xmax = g->getXmax();
                 T ymin = g->getYmin();
@@ -1223,6 +1594,44 @@ namespace ttcr {
                 
                 break;
             }
+            case FAST_ITERATIVE:
+            {
+                if ( verbose ) {
+                    std::cout << "Creating grid ... ";
+                    std::cout.flush();
+                }
+                if ( par.time ) { begin = std::chrono::high_resolution_clock::now(); }
+                if ( constCells )
+                    g = new Grid3Ducfim<T, uint32_t>(gNodes,
+                                                     gTetrahedra,
+                                                     par.epsilon,
+                                                     par.raypath_method,
+                                                     par.tt_from_rp,
+                                                     par.min_distance_rp,
+                                                     nt, nt);
+                else
+                    g = new Grid3Dunfim<T, uint32_t>(gNodes,
+                                                     gTetrahedra,
+                                                     par.epsilon,
+                                                     par.raypath_method,
+                                                     par.interpVel,
+                                                     par.tt_from_rp,
+                                                     par.min_distance_rp,
+                                                     nt, nt);
+                if ( par.time ) { end = std::chrono::high_resolution_clock::now(); }
+                if ( verbose ) {
+                    std::cout << "done.\n";
+                    std::cout.flush();
+                }
+                if ( par.source_radius>0.0 ) {
+                    if ( verbose ) {
+                        std::cout << "Setting source radius to " << par.source_radius << '\n';
+                    }
+                    g->setSourceRadius( par.source_radius );
+                }
+                
+                break;
+            }
             case DYNAMIC_SHORTEST_PATH:
             {
                 if ( verbose ) {
@@ -1231,8 +1640,8 @@ namespace ttcr {
                 }
                 if ( par.time ) { begin = std::chrono::high_resolution_clock::now(); }
                 if ( constCells )
-                    g = new Grid3Ducdsp<T, uint32_t>(nodes,
-                                                     tetrahedra,
+                    g = new Grid3Ducdsp<T, uint32_t>(gNodes,
+                                                     gTetrahedra,
                                                      par.nn[0],
                                                      par.nTertiary,
                                                      par.source_radius,
@@ -1242,8 +1651,8 @@ namespace ttcr {
                                                      par.radius_tertiary_nodes,
                                                      nt);
                 else
-                    g = new Grid3Dundsp<T, uint32_t>(nodes,
-                                                     tetrahedra,
+                    g = new Grid3Dundsp<T, uint32_t>(gNodes,
+                                                     gTetrahedra,
                                                      par.nn[0],
                                                      par.nTertiary,
                                                      par.source_radius,
@@ -1266,6 +1675,18 @@ namespace ttcr {
             default:
                 break;
         }
+        if ( fromSnapshot && par.method != FAST_SWEEPING ) {
+            if ( !loadGridSnapshot(par, g) ) {
+                // built again, without reading the snapshot, and saved
+                delete g;
+                input_parameters p(par);
+                p.snapshotfile.clear();
+                g = buildUnstructured3D<T>(p, reflectors, nt, nsrc, renum);
+                if ( g != nullptr ) saveGridSnapshot(par, g);
+                return g;
+            }
+            if ( par.time ) { end = std::chrono::high_resolution_clock::now(); }
+        }
         if ( par.time ) {
             std::cout.precision(12);
             std::cout << "Time to build grid: " << std::chrono::duration<double>(end-begin).count() << '\n';
@@ -1294,9 +1715,31 @@ namespace ttcr {
             end = std::chrono::high_resolution_clock::now();
             std::cout << "Time to interpolate slowness values: " << std::chrono::duration<double>(end-begin).count() << '\n';
         }
+        if ( !fromSnapshot && !par.snapshotfile.empty() ) {
+            saveGridSnapshot(par, g);
+        }
+        if ( par.renumbering != NO_RENUMBERING ) {
+            g->setNodeNumbering(rn.getNodeMap());
+        }
         
         if ( par.processReflectors ) {
-            buildReflectors(reader, nodes, nsrc, par.nn[0], reflectors);
+            const size_t nr = reflectors.size();
+            buildReflectors(reader, nodes, nsrc, par.nn[0], reflectors, nt,
+                            rn.getNodeMap());
+            if ( par.singlePrecision ) {
+                for ( size_t n=nr; n<reflectors.size(); ++n ) {
+                    std::vector<sxyz<T>>& pts = reflectors[n].get_coord();
+                    for ( size_t i=0; i<pts.size(); ++i ) {
+                        pts[i].x = static_cast<T>(pts[i].x+origin.x);
+                        pts[i].y = static_cast<T>(pts[i].y+origin.y);
+                        pts[i].z = static_cast<T>(pts[i].z+origin.z);
+                    }
+                }
+            }
+        }
+        
+        if ( par.singlePrecision ) {
+            g->setOrigin(origin);
         }
         
         if ( par.saveModelVTK ) {
@@ -1462,6 +1905,8 @@ namespace ttcr {
                 std::cout << "\n  Fast Sweeping Method: will use rotated template";
             if ( par.method == FAST_SWEEPING && par.weno3 == true)
                 std::cout << "\n  Fast Sweeping Method: will use 3rd order WENO stencil";
+            if ( par.method == FAST_MARCHING && par.weno3 == true)
+                std::cout << "\n  Fast Marching Method: will use 2nd order stencil";
             std::cout << std::endl;
         }
         
@@ -1496,9 +1941,25 @@ namespace ttcr {
             }
             case FAST_MARCHING:
             {
-                std::cerr << "Error: fast marching method not yet implemented for 2D rectilinear grids\n";
-                std::cerr.flush();
-                return nullptr;
+                if ( verbose ) {
+                    std::cout << "Creating grid ... ";
+                    std::cout.flush();
+                }
+                if ( par.time ) { begin = std::chrono::high_resolution_clock::now(); }
+                if ( constCells ) {
+                    g = new Grid2Drcfm<T, uint32_t, sxz<T>>(ncells[0], ncells[2], d[0], d[2],
+                                                    min[0], min[2], par.weno3, nt);
+                }
+                else
+                    g = new Grid2Drnfm<T, uint32_t, sxz<T>>(ncells[0], ncells[2], d[0], d[2],
+                                                    min[0], min[2], par.weno3, nt);
+                
+                if ( par.time ) { end = std::chrono::high_resolution_clock::now(); }
+                if ( verbose ) {
+                    std::cout << "done.\n";
+                    std::cout.flush();
+                }
+                
                 break;
             }
             case FAST_SWEEPING:
@@ -1610,6 +2071,9 @@ namespace ttcr {
             if ( par.method == FAST_SWEEPING && par.weno3 == true)
                 std::cout << "\n  Fast Sweeping Method: will use 3rd order WENO stencil"
                 << std::endl;
+            if ( par.method == FAST_MARCHING && par.weno3 == true)
+                std::cout << "\n  Fast Marching Method: will use 2nd order stencil"
+                << std::endl;
             
             
         }
@@ -1723,9 +2187,29 @@ namespace ttcr {
                     }
                     case FAST_MARCHING:
                     {
-                        std::cerr << "Error: fast marching method not yet implemented for 2D rectilinear grids\n";
-                        std::cerr.flush();
-                        return nullptr;
+                        if ( verbose ) { std::cout << "Building grid (Grid2Drnfm) ... "; std::cout.flush(); }
+                        if ( par.time ) { begin = std::chrono::high_resolution_clock::now(); }
+                        g = new Grid2Drnfm<T,uint32_t, sxz<T>>(ncells[0], ncells[2], d[0], d[2],
+                                                       xrange[0], zrange[0], par.weno3, nt);
+                        if ( par.time ) { end = std::chrono::high_resolution_clock::now(); }
+                        if ( verbose ) {
+                            std::cout << "done.\nTotal number of nodes: " << g->getNumberOfNodes()
+                            << "\nAssigning slowness at grid nodes ... ";
+                            std::cout.flush();
+                        }
+                        try {
+                            g->setSlowness(slowness);
+                        } catch (std::exception& e) {
+                            cerr << e.what() << endl;
+                            delete g;
+                            return nullptr;
+                        }
+                        if ( verbose ) std::cout << "done.\n";
+                        if ( par.time ) {
+                            std::cout.precision(12);
+                            std::cout << "Time to build grid: " << std::chrono::duration<double>(end-begin).count() << '\n';
+                        }
+                        break;
                     }
                         
                     default:
@@ -1902,9 +2386,29 @@ namespace ttcr {
                     }
                     case FAST_MARCHING:
                     {
-                        std::cerr << "Error: fast marching method not yet implemented for 2D rectilinear grids\n";
-                        std::cerr.flush();
-                        return nullptr;
+                        if ( verbose ) { std::cout << "Building grid (Grid2Drcfm) ... "; std::cout.flush(); }
+                        if ( par.time ) { begin = std::chrono::high_resolution_clock::now(); }
+                        g = new Grid2Drcfm<T,uint32_t, sxz<T>>(ncells[0], ncells[2], d[0], d[2],
+                                                       xrange[0], zrange[0], par.weno3, nt);
+                        if ( par.time ) { end = std::chrono::high_resolution_clock::now(); }
+                        if ( verbose ) {
+                            std::cout << "done.\nTotal number of nodes: " << g->getNumberOfNodes()
+                            << "\nAssigning slowness at grid nodes ... ";
+                            std::cout.flush();
+                        }
+                        try {
+                            g->setSlowness(slowness);
+                        } catch (std::exception& e) {
+                            cerr << e.what() << endl;
+                            delete g;
+                            return nullptr;
+                        }
+                        if ( verbose ) std::cout << "done.\n";
+                        if ( par.time ) {
+                            std::cout.precision(12);
+                            std::cout << "Time to build grid: " << std::chrono::duration<double>(end-begin).count() << '\n';
+                        }
+                        break;
                     }
                         
                     default:
@@ -2191,6 +2695,9 @@ namespace ttcr {
             std::cout << std::endl;
         }
         
+        Renumbering<uint32_t> renum;
+        renumberMesh(par, nodes, triangles, slowness, constCells, renum);
+
         std::chrono::high_resolution_clock::time_point begin, end;
         Grid2D<T,uint32_t,sxz<T>> *g=nullptr;
         switch (par.method) {
@@ -2286,6 +2793,9 @@ namespace ttcr {
             delete g;
             return nullptr;
         }
+        if ( par.renumbering != NO_RENUMBERING ) {
+            g->setNodeNumbering(renum.getNodeMap());
+        }
         
         if ( par.processReflectors ) {
             std::vector<std::string> reflector_names = reader.getPhysicalNames(1);
@@ -25,23 +25,29 @@
 #ifndef ttcr_structs_ttcr_h
 #define ttcr_structs_ttcr_h
 
+#include <cstdint>
 #include <map>
 #include <string>
+#include <vector>
 
 namespace ttcr {
     
-    enum raytracing_method { SHORTEST_PATH, FAST_MARCHING, FAST_SWEEPING, DYNAMIC_SHORTEST_PATH };
+    enum raytracing_method { SHORTEST_PATH, FAST_MARCHING, FAST_SWEEPING, DYNAMIC_SHORTEST_PATH,
+        FAST_ITERATIVE };
     enum gradient_method : int { LS_FO=0, LS_SO=1, AB=2 };
     
     struct input_parameters {
         uint32_t nn[3];
         int nt;
+        int nProc;                    // number of processes sharing the shots
         int order;                    // order of l metric
         int nitermax;
         int nTertiary;
         int raypath_method;
         int saveGridTT;
         int min_per_thread;
+        int renumbering;              // 0: none, 1: Morton, 2: RCM (meshes)
+        int brick_cache;              // number of bricks held in memory
         bool inverseDistance;
         bool singlePrecision;
         bool saveRaypaths;
@@ -53,29 +59,34 @@ namespace ttcr {
         bool interpVel;
         bool rotated_template;
         bool weno3;
+        bool factored;                // solve the factored eikonal equation
         bool dump_secondary;
         bool tt_from_rp;
         double epsilon;
         double source_radius;
         double min_distance_rp;
         double radius_tertiary_nodes;
+        double tile_margin;           // margin around shots, tiled models
         raytracing_method method;
         std::string basename;
         std::string modelfile;
         std::string velfile;
         std::string slofile;
         std::string rcvfile;
+        std::string snapshotfile;
         std::vector<std::string> srcfiles;
         
-        input_parameters() : nn(), nt(0), order(2), nitermax(20),
+        input_parameters() : nn(), nt(0), nProc(1), order(2), nitermax(20),
         nTertiary(3), raypath_method(LS_SO), saveGridTT(0), min_per_thread(5),
-        inverseDistance(false), singlePrecision(false), saveRaypaths(false),
-        saveModelVTK(false), saveM(false), time(false), processReflectors(false),
+        renumbering(0), brick_cache(64), inverseDistance(false), singlePrecision(false),
+        saveRaypaths(false), saveModelVTK(false), saveM(false), time(false),
+        processReflectors(false),
         projectTxRx(false), interpVel(false), rotated_template(false),
-        weno3(false), dump_secondary(false), tt_from_rp(false),
+        weno3(false), factored(false), dump_secondary(false), tt_from_rp(false),
         epsilon(1.e-15), source_radius(0.0), min_distance_rp(1.e-5),
-        radius_tertiary_nodes(0.0), method(SHORTEST_PATH), basename(),
-        modelfile(), velfile(), slofile(), rcvfile(), srcfiles() {}
+        radius_tertiary_nodes(0.0), tile_margin(0.0), method(SHORTEST_PATH), basename(),
+        modelfile(), velfile(), slofile(), rcvfile(), snapshotfile(),
+        srcfiles() {}
         
     };
     
@@ -32,6 +32,7 @@
 
 #include <boost/asio/ip/host_name.hpp>
 
+#include "Batch.h"
 #include "Grid2D.h"
 #include "Rcv2D.h"
 #include "Src2D.h"
@@ -66,8 +67,6 @@ int body(const input_parameters &par) {
 		num_threads = par.nt < nTx ? par.nt : nTx;
 	}
 	
-    size_t blk_size = nTx/num_threads;
-    if ( blk_size == 0 ) blk_size++;
 	
 	string::size_type idx;
     
@@ -157,7 +156,7 @@ int body(const input_parameters &par) {
     }
 	if ( verbose && num_threads>1 ) {
 		cout << "Calculations will be done using " << num_threads
-        << " threads with " << blk_size << " shots per thread.\n";
+        << " threads, shots being dispatched dynamically.\n";
 	}
     
 	vector<const vector<sxz<T>>*> all_rcv;
@@ -182,254 +181,78 @@ int body(const input_parameters &par) {
     
     if ( verbose ) { cout << "Computing traveltimes ... "; cout.flush(); }
 	if ( par.time ) { begin = chrono::high_resolution_clock::now(); }
-	if ( par.saveRaypaths && par.rcvfile != "" ) {
-		if ( num_threads == 1 ) {
-			for ( size_t n=0; n<src.size(); ++n ) {
-                
-                vector<vector<T>*> all_tt;
+	Batch<> batch(num_threads);
+	try {
+		if ( par.saveRaypaths && par.rcvfile != "" ) {
+			batch.run(nTx, [&par,&g,&src,&rcv,&r_data,&reflectors,&all_rcv,
+							&rfl_r_data,&rfl2_r_data](const size_t n, const size_t threadNo) {
+
+				vector<vector<T>*> all_tt;
 				all_tt.push_back( &(rcv.get_tt(n)) );
-                vector<vector<vector<sxz<T>>>*> all_r_data;
-                all_r_data.push_back( &(r_data[n]) );
-                
+				vector<vector<vector<sxz<T>>>*> all_r_data;
+				all_r_data.push_back( &(r_data[n]) );
 				for ( size_t nr=0; nr<reflectors.size(); ++nr ) {
 					all_tt.push_back( &(reflectors[nr].get_tt(n)) );
-                    all_r_data.push_back( &(rfl_r_data[nr][n]) );
+					all_r_data.push_back( &(rfl_r_data[nr][n]) );
 				}
-                try {
-                    g->raytrace(src[n].get_coord(), src[n].get_t0(), all_rcv,
-                                all_tt, all_r_data);
-                } catch (std::exception& e) {
-                    std::cerr << e.what() << std::endl;
-                    abort();
-                }
+				g->raytrace(src[n].get_coord(), src[n].get_t0(), all_rcv,
+							all_tt, all_r_data, threadNo);
 
-                if ( par.saveGridTT>0 ) {
-                    
-                    string srcname = par.srcfiles[n];
-                    size_t pos = srcname.rfind("/");
-                    srcname.erase(0, pos+1);
-                    pos = srcname.rfind(".");
-                    size_t len = srcname.length()-pos;
-                    srcname.erase(pos, len);
-                    
-                    string filename = par.basename+"_"+srcname+"_all_tt";
-                    g->saveTT(filename, 0, 0, par.saveGridTT);
-//                    filename = par.basename+"_"+srcname+"_tt_grad";
-//                    g->saveTTgrad(filename, 0, true);
-//                    filename = par.basename+"_"+srcname+"_tt_grad";
-//                    g->saveTTgrad2(filename, 0, true);
-                }
-                
-				for ( size_t nr=0; nr<reflectors.size(); ++nr ) {
-                    try {
-                        g->raytrace(reflectors[nr].get_coord(),
-                                    reflectors[nr].get_tt(n), rcv.get_coord(),
-                                    rcv.get_tt(n,nr+1), rfl2_r_data[nr][n]);
-                    } catch (std::exception& e) {
-                        std::cerr << e.what() << std::endl;
-                        abort();
-                    }
-				}
-			}
-		} else {
-			// threaded jobs
-			
-			vector<thread> threads(num_threads-1);
-			size_t blk_start = 0;
-			for ( size_t i=0; i<num_threads-1; ++i ) {
-                
-				size_t blk_end = blk_start + blk_size;
-				
-				threads[i]=thread( [&g,&src,&rcv,&r_data,&reflectors,&all_rcv,
-                                    &rfl_r_data,&rfl2_r_data,
-                                    blk_start,blk_end,i]{
-                    
-					for ( size_t n=blk_start; n<blk_end; ++n ) {
-                        
-                        vector<vector<T>*> all_tt;
-						all_tt.push_back( &(rcv.get_tt(n)) );
-                        vector<vector<vector<sxz<T>>>*> all_r_data;
-                        all_r_data.push_back( &(r_data[n]) );
-						for ( size_t nr=0; nr<reflectors.size(); ++nr ) {
-							all_tt.push_back( &(reflectors[nr].get_tt(n)) );
-                            all_r_data.push_back( &(rfl_r_data[nr][n]) );
-						}
-                        try {
-                            g->raytrace(src[n].get_coord(), src[n].get_t0(), all_rcv,
-                                        all_tt, all_r_data, i+1);
-                        } catch (std::exception& e) {
-                            std::cerr << e.what() << std::endl;
-                            abort();
-                        }
+				if ( par.saveGridTT>0 ) {
 
-						for ( size_t nr=0; nr<reflectors.size(); ++nr ) {
-                            try {
-                                g->raytrace(reflectors[nr].get_coord(),
-                                            reflectors[nr].get_tt(n), rcv.get_coord(),
-                                            rcv.get_tt(n,nr+1), rfl2_r_data[nr][n], i+1);
-                            } catch (std::exception& e) {
-                                std::cerr << e.what() << std::endl;
-                                abort();
-                            }
-						}
-					}
-				});
-				
-				blk_start = blk_end;
-			}
-			for ( size_t n=blk_start; n<nTx; ++n ) {
-                
-				vector<vector<T>*> all_tt;
-                all_tt.push_back( &(rcv.get_tt(n)) );
-                vector<vector<vector<sxz<T>>>*> all_r_data;
-                all_r_data.push_back( &(r_data[n]) );
-                for ( size_t nr=0; nr<reflectors.size(); ++nr ) {
-                    all_tt.push_back( &(reflectors[nr].get_tt(n)) );
-                    all_r_data.push_back( &(rfl_r_data[nr][n]) );
-                }
-                try {
-                    g->raytrace(src[n].get_coord(), src[n].get_t0(), all_rcv,
-                                all_tt, all_r_data, 0);
-                } catch (std::exception& e) {
-                    std::cerr << e.what() << std::endl;
-                    abort();
-                }
+					string srcname = par.srcfiles[n];
+					size_t pos = srcname.rfind("/");
+					srcname.erase(0, pos+1);
+					pos = srcname.rfind(".");
+					size_t len = srcname.length()-pos;
+					srcname.erase(pos, len);
 
-                for ( size_t nr=0; nr<reflectors.size(); ++nr ) {
-                    try {
-                        g->raytrace(reflectors[nr].get_coord(),
-                                    reflectors[nr].get_tt(n), rcv.get_coord(),
-                                    rcv.get_tt(n,nr+1), rfl2_r_data[nr][n], 0);
-                    } catch (std::exception& e) {
-                        std::cerr << e.what() << std::endl;
-                        abort();
-                    }
-                }
-			}
-			
-			for_each(threads.begin(),threads.end(), mem_fn(&thread::join));
-		}
-	} else {
-		if ( num_threads == 1 ) {
-			for ( size_t n=0; n<src.size(); ++n ) {
-				
-				vector<vector<T>*> all_tt;
-                if ( par.rcvfile != "" )
-                    all_tt.push_back( &(rcv.get_tt(n)) );
-				for ( size_t nr=0; nr<reflectors.size(); ++nr ) {
-					all_tt.push_back( &(reflectors[nr].get_tt(n)) );
+					string filename = par.basename+"_"+srcname+"_all_tt";
+					g->saveTT(filename, 0, threadNo, par.saveGridTT);
 				}
-                try {
-                    g->raytrace(src[n].get_coord(), src[n].get_t0(), all_rcv,
-                                all_tt);
-                } catch (std::exception& e) {
-                    std::cerr << e.what() << std::endl;
-                    abort();
-                }
 
-                if ( par.saveGridTT>0 ) {
-                    
-                    string srcname = par.srcfiles[n];
-                    size_t pos = srcname.rfind("/");
-                    srcname.erase(0, pos+1);
-                    pos = srcname.rfind(".");
-                    size_t len = srcname.length()-pos;
-                    srcname.erase(pos, len);
-                    
-                    string filename = par.basename+"_"+srcname+"_all_tt";
-                    g->saveTT(filename, 0, 0, par.saveGridTT);
-//                    filename = par.basename+"_"+srcname+"_tt_grad";
-//                    g->saveTTgrad(filename, 0, true);
-//                    filename = par.basename+"_"+srcname+"_tt_grad";
-//                    g->saveTTgrad2(filename, 0, true);
-                }
-                
 				for ( size_t nr=0; nr<reflectors.size(); ++nr ) {
-                    try {
-                        g->raytrace(reflectors[nr].get_coord(),
-                                    reflectors[nr].get_tt(n), rcv.get_coord(),
-                                    rcv.get_tt(n,nr+1));
-                    } catch (std::exception& e) {
-                        std::cerr << e.what() << std::endl;
-                        abort();
-                    }
+					g->raytrace(reflectors[nr].get_coord(),
+								reflectors[nr].get_tt(n), rcv.get_coord(),
+								rcv.get_tt(n,nr+1), rfl2_r_data[nr][n], threadNo);
 				}
-			}
+			});
 		} else {
-			// threaded jobs
-			
-			vector<thread> threads(num_threads-1);
-			size_t blk_start = 0;
-			for ( size_t i=0; i<num_threads-1; ++i ) {
-				
-				size_t blk_end = blk_start + blk_size;
-                
-				threads[i]=thread( [&par,&g,&src,&rcv,&all_rcv,&reflectors,blk_start,
-                                    blk_end,i]{
-                    
-					for ( size_t n=blk_start; n<blk_end; ++n ) {
-						
-						vector<vector<T>*> all_tt;
-						if ( par.rcvfile != "" )
-                            all_tt.push_back( &(rcv.get_tt(n)) );
-						for ( size_t nr=0; nr<reflectors.size(); ++nr ) {
-							all_tt.push_back( &(reflectors[nr].get_tt(n)) );
-						}
-                        try {
-                            g->raytrace(src[n].get_coord(), src[n].get_t0(), all_rcv,
-                                        all_tt, i+1);
-                        } catch (std::exception& e) {
-                            std::cerr << e.what() << std::endl;
-                            abort();
-                        }
+			batch.run(nTx, [&par,&g,&src,&rcv,&all_rcv,
+							&reflectors](const size_t n, const size_t threadNo) {
 
-						for ( size_t nr=0; nr<reflectors.size(); ++nr ) {
-                            try {
-                                g->raytrace(reflectors[nr].get_coord(),
-                                            reflectors[nr].get_tt(n), rcv.get_coord(),
-                                            rcv.get_tt(n,nr+1), i+1);
-                            } catch (std::exception& e) {
-                                std::cerr << e.what() << std::endl;
-                                abort();
-                            }
-						}
-						
-					}
-				});
-				
-				blk_start = blk_end;
-			}
-			for ( size_t n=blk_start; n<nTx; ++n ) {
-                
 				vector<vector<T>*> all_tt;
 				if ( par.rcvfile != "" )
-                    all_tt.push_back( &(rcv.get_tt(n)) );
+					all_tt.push_back( &(rcv.get_tt(n)) );
 				for ( size_t nr=0; nr<reflectors.size(); ++nr ) {
 					all_tt.push_back( &(reflectors[nr].get_tt(n)) );
 				}
-                try {
-                    g->raytrace(src[n].get_coord(), src[n].get_t0(), all_rcv,
-                                all_tt, 0);
-                } catch (std::exception& e) {
-                    std::cerr << e.what() << std::endl;
-                    abort();
-                }
+				g->raytrace(src[n].get_coord(), src[n].get_t0(), all_rcv,
+							all_tt, threadNo);
+
+				if ( par.saveGridTT>0 ) {
+
+					string srcname = par.srcfiles[n];
+					size_t pos = srcname.rfind("/");
+					srcname.erase(0, pos+1);
+					pos = srcname.rfind(".");
+					size_t len = srcname.length()-pos;
+					srcname.erase(pos, len);
+
+					string filename = par.basename+"_"+srcname+"_all_tt";
+					g->saveTT(filename, 0, threadNo, par.saveGridTT);
+				}
 
 				for ( size_t nr=0; nr<reflectors.size(); ++nr ) {
-                    try {
-                        g->raytrace(reflectors[nr].get_coord(),
-                                    reflectors[nr].get_tt(n), rcv.get_coord(),
-                                    rcv.get_tt(n,nr+1), 0);
-                    } catch (std::exception& e) {
-                        std::cerr << e.what() << std::endl;
-                        abort();
-                    }
+					g->raytrace(reflectors[nr].get_coord(),
+								reflectors[nr].get_tt(n), rcv.get_coord(),
+								rcv.get_tt(n,nr+1), threadNo);
 				}
-                
-			}
-			
-			for_each(threads.begin(),threads.end(), mem_fn(&thread::join));
+			});
 		}
+	} catch (std::exception& e) {
+		std::cerr << e.what() << std::endl;
+		abort();
 	}
 	if ( par.time ) { end = chrono::high_resolution_clock::now(); }
     if ( verbose ) {
@@ -487,16 +310,6 @@ int body(const input_parameters &par) {
 				saveRayPaths(filename, r_tmp);
 				if ( verbose ) cout << "done.\n";
 			}
-			
-			if ( reflectors.size() > 0 ) {
-				filename = par.basename+"_rp.bin";
-				ofstream fout;
-//				fout.open(filename, ios::out | ios::binary);
-//				fout << r_data.size();
-//				fout.close();
-				
-				// TODO complete this...
-			}
 		}
 	} else {
         for ( size_t ns=0; ns<src.size(); ++ns ) {
@@ -549,68 +362,38 @@ int body(const input_parameters &par) {
 			if ( verbose ) cout << '\n';
         }
         
-		if ( par.saveRaypaths && reflectors.size() > 0 ) {
-			string filename = par.basename+"_rp.bin";
-			ofstream fout;
-			fout.open(filename, ios::out | ios::binary);
-            if ( !fout ) {
-                std::cerr << "Cannot open file " << filename << " for writing.\n";
-                exit(1);
-            }
-            
-            if ( verbose ) cout << "Saving global raypath data in " << filename << " ... ";
-			size_t size = r_data.size();
-			fout.write((char*)&size,sizeof(size_t));
-			for ( size_t n=0; n<r_data.size(); ++n ) {
-				size = r_data[n].size();
-				fout.write((char*)&size,sizeof(size_t));
-				for ( size_t nr=0; nr<r_data[n].size(); ++nr ) {
-					size = r_data[n][nr].size();
-					fout.write((char*)&size,sizeof(size_t));
-					fout.write((char*)r_data[n][nr].data(),
-							   sizeof(sxz<T>) * size);
-				}
-			}
-			
-			size = rfl_r_data.size();
-			fout.write((char*)&size,sizeof(size_t));
-			for ( size_t r=0; r<rfl_r_data.size(); ++r ) {
-				size = rfl_r_data[r].size();
-				fout.write((char*)&size,sizeof(size_t));
-				for ( size_t n=0; n<rfl_r_data[r].size(); ++n ) {
-					size = rfl_r_data[r][n].size();
-					fout.write((char*)&size,sizeof(size_t));
-					for ( size_t nr=0; nr<rfl_r_data[r][n].size(); ++nr ) {
-						size = rfl_r_data[r][n][nr].size();
-						fout.write((char*)&size,sizeof(size_t));
-						fout.write((char*)rfl_r_data[r][n][nr].data(),
-								   sizeof(sxz<T>) * size);
-					}
-				}
-			}
-			
-			size = rfl2_r_data.size();
-			fout.write((char*)&size,sizeof(size_t));
-			for ( size_t r=0; r<rfl2_r_data.size(); ++r ) {
-				size = rfl2_r_data[r].size();
-				fout.write((char*)&size,sizeof(size_t));
-				for ( size_t n=0; n<rfl2_r_data[r].size(); ++n ) {
-					size = rfl2_r_data[r][n].size();
-					fout.write((char*)&size,sizeof(size_t));
-					for ( size_t nr=0; nr<rfl2_r_data[r][n].size(); ++nr ) {
-						size = rfl2_r_data[r][n][nr].size();
-						fout.write((char*)&size,sizeof(size_t));
-						fout.write((char*)rfl2_r_data[r][n][nr].data(),
-								   sizeof(sxz<T>) * size);
-					}
-				}
-			}
-			
-			fout.close();
-            if ( verbose ) cout << "done.\n";
-		}
 	}
     
+    if ( par.saveRaypaths && reflectors.size() > 0 ) {
+        // direct rays, then rays to and from each reflector, one group per source
+        string filename = par.basename+"_rp.bin";
+        if ( verbose ) cout << "Saving global raypath data in " << filename << " ... ";
+        RayPaths<float,uint32_t> rays;
+        for ( size_t n=0; n<r_data.size(); ++n ) {
+            rays.append(r_data[n]);
+            rays.endGroup();
+        }
+        for ( size_t nr=0; nr<rfl_r_data.size(); ++nr ) {
+            for ( size_t n=0; n<rfl_r_data[nr].size(); ++n ) {
+                rays.append(rfl_r_data[nr][n]);
+                rays.endGroup();
+            }
+        }
+        for ( size_t nr=0; nr<rfl2_r_data.size(); ++nr ) {
+            for ( size_t n=0; n<rfl2_r_data[nr].size(); ++n ) {
+                rays.append(rfl2_r_data[nr][n]);
+                rays.endGroup();
+            }
+        }
+        try {
+            rays.saveBinary(filename);
+        } catch (std::exception& e) {
+            std::cerr << e.what() << std::endl;
+            exit(1);
+        }
+        if ( verbose ) cout << "done.\n";
+    }
+    
     if ( verbose ) cout << "Normal termination of program.\n";
 	return 0;
 }
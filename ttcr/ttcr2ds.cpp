@@ -28,6 +28,7 @@
 
 #include <boost/asio/ip/host_name.hpp>
 
+#include "Batch.h"
 #include "Grid2Duc.h"
 #include "Rcv.h"
 #include "Src.h"
@@ -62,9 +63,6 @@ int body(const input_parameters &par) {
 		num_threads = par.nt < nTx ? par.nt : nTx;
 	}
 	
-    size_t blk_size = nTx/num_threads;
-    if ( blk_size == 0 ) blk_size++;
-    
 	string::size_type idx;
     
     idx = par.modelfile.rfind('.');
@@ -108,7 +106,7 @@ int body(const input_parameters &par) {
     }
 	if ( verbose && num_threads>1 ) {
 		cout << "Calculations will be done using " << num_threads
-        << " threads with " << blk_size << " shots per thread.\n";
+        << " threads, shots being dispatched dynamically.\n";
 	}
 
 	chrono::high_resolution_clock::time_point begin, end;
@@ -125,148 +123,28 @@ int body(const input_parameters &par) {
 	
 	if ( verbose ) { cout << "Computing traveltimes ... "; cout.flush(); }
 	if ( par.time ) { begin = chrono::high_resolution_clock::now(); }
-    if ( par.saveM ) {
-        if ( num_threads == 1 ) {
-            for ( size_t n=0; n<src.size(); ++n ) {
-                try {
-                    g->raytrace(src[n].get_coord(), src[n].get_t0(), rcv.get_coord(),
-                                rcv.get_tt(n), r_data[n], v0[n], m_data[n]);
-                } catch (std::exception& e) {
-                    std::cerr << e.what() << std::endl;
-                    abort();
-                }
-            }
-        } else {
-            // threaded jobs
-            
-            vector<thread> threads(num_threads-1);
-            size_t blk_start = 0;
-            for ( size_t i=0; i<num_threads-1; ++i ) {
-                
-                size_t blk_end = blk_start + blk_size;
-                
-                threads[i]=thread( [&g,&src,&rcv,&r_data,&v0,&m_data,blk_start,blk_end,i]{
-                    
-                    for ( size_t n=blk_start; n<blk_end; ++n ) {
-                        try {
-                            g->raytrace(src[n].get_coord(), src[n].get_t0(), rcv.get_coord(),
-                                        rcv.get_tt(n), r_data[n], v0[n], m_data[n], i+1);
-                        } catch (std::exception& e) {
-                            std::cerr << e.what() << std::endl;
-                            abort();
-                        }
-                    }
-                });
-                
-                blk_start = blk_end;
-            }
-            for ( size_t n=blk_start; n<nTx; ++n ) {
-                try {
-                    g->raytrace(src[n].get_coord(), src[n].get_t0(), rcv.get_coord(),
-                                rcv.get_tt(n), r_data[n], v0[n], m_data[n], 0);
-                } catch (std::exception& e) {
-                    std::cerr << e.what() << std::endl;
-                    abort();
-                }
-            }
-            
-            for_each(threads.begin(),threads.end(), mem_fn(&thread::join));
-        }
-    } else if ( par.saveRaypaths ) {
-		if ( num_threads == 1 ) {
-			for ( size_t n=0; n<src.size(); ++n ) {
-                try {
-                    g->raytrace(src[n].get_coord(), src[n].get_t0(), rcv.get_coord(),
-                                rcv.get_tt(n), r_data[n]);
-                } catch (std::exception& e) {
-                    std::cerr << e.what() << std::endl;
-                    abort();
-                }
-			}
-		} else {
-			// threaded jobs
-			
-			vector<thread> threads(num_threads-1);
-			size_t blk_start = 0;
-			for ( size_t i=0; i<num_threads-1; ++i ) {
-                
-				size_t blk_end = blk_start + blk_size;
-				
-				threads[i]=thread( [&g,&src,&rcv,&r_data,blk_start,blk_end,i]{
-                    
-					for ( size_t n=blk_start; n<blk_end; ++n ) {
-                        try {
-                            g->raytrace(src[n].get_coord(), src[n].get_t0(), rcv.get_coord(),
-                                        rcv.get_tt(n), r_data[n], i+1);
-                        } catch (std::exception& e) {
-                            std::cerr << e.what() << std::endl;
-                            abort();
-                        }
-					}
-				});
-				
-				blk_start = blk_end;
-			}
-			for ( size_t n=blk_start; n<nTx; ++n ) {
-                try {
-                    g->raytrace(src[n].get_coord(), src[n].get_t0(), rcv.get_coord(),
-                                rcv.get_tt(n), r_data[n], 0);
-                } catch (std::exception& e) {
-                    std::cerr << e.what() << std::endl;
-                    abort();
-                }
-			}
-			
-			for_each(threads.begin(),threads.end(), mem_fn(&thread::join));
-		}
-	} else {
-		if ( num_threads == 1 ) {
-			for ( size_t n=0; n<src.size(); ++n ) {
-                try {
-                    g->raytrace(src[n].get_coord(), src[n].get_t0(), rcv.get_coord(),
-                                rcv.get_tt(n));
-                } catch (std::exception& e) {
-                    std::cerr << e.what() << std::endl;
-                    abort();
-                }
-			}
-		} else {
-			// threaded jobs
-			
-			vector<thread> threads(num_threads-1);
-			size_t blk_start = 0;
-			for ( size_t i=0; i<num_threads-1; ++i ) {
-				
-				size_t blk_end = blk_start + blk_size;
-                
-				threads[i]=thread( [&g,&src,&rcv,blk_start,blk_end,i]{
-                    
-					for ( size_t n=blk_start; n<blk_end; ++n ) {
-                        try {
-                            g->raytrace(src[n].get_coord(), src[n].get_t0(), rcv.get_coord(),
-                                        rcv.get_tt(n), i+1);
-                        } catch (std::exception& e) {
-                            std::cerr << e.what() << std::endl;
-                            abort();
-                        }
-					}
-				});
-				
-				blk_start = blk_end;
-			}
-			for ( size_t n=blk_start; n<nTx; ++n ) {
-                try {
-                    g->raytrace(src[n].get_coord(), src[n].get_t0(), rcv.get_coord(),
-                                rcv.get_tt(n), 0);
-                } catch (std::exception& e) {
-                    std::cerr << e.what() << std::endl;
-                    abort();
-                }
-			}
-			
-			for_each(threads.begin(),threads.end(), mem_fn(&thread::join));
-		}
-	}
+    survey<T,sxyz<T>> sv;
+    for ( size_t n=0; n<src.size(); ++n ) {
+        sv.Tx.push_back( &(src[n].get_coord()) );
+        sv.t0.push_back( &(src[n].get_t0()) );
+    }
+    sv.Rx.push_back( &(rcv.get_coord()) );
+    int outputs = BATCH_TT;
+    if ( par.saveM ) outputs |= BATCH_M;
+    else if ( par.saveRaypaths ) outputs |= BATCH_RAYS;
+    try {
+        raytraceBatch(*g, sv, outputs,
+                      [&rcv,&r_data,&v0,&m_data](const size_t n,
+                                                 shotData<T,sxyz<T>,siv2<T>>& d) {
+                          rcv.get_tt(n) = d.tt;
+                          r_data[n].swap( d.r_data );
+                          v0[n] = d.v0;
+                          m_data[n].swap( d.m_data );
+                      }, num_threads);
+    } catch (std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        abort();
+    }
 	if ( par.time ) { end = chrono::high_resolution_clock::now(); }
     if ( verbose ) cout << "done.\n";
 	if ( par.time ) {
@@ -32,8 +32,11 @@
 
 #include <boost/asio/ip/host_name.hpp>
 
+#include "Batch.h"
 #include "Grid3D.h"
+#include "MultiPhase.h"
 #include "Rcv.h"
+#include "ShotProcesses.h"
 #include "Src.h"
 #include "structs_ttcr.h"
 #include "ttcr_io.h"
@@ -72,9 +75,13 @@ int body(const input_parameters &par) {
 	} else {
 		num_threads = par.nt < nTx ? par.nt : nTx;
 	}
+
+    // when only traveltimes are needed, shots can be shared by processes
+    // working on a single-threaded grid
+    bool const useProcesses = par.nProc > 1 && nTx > 1 && par.rcvfile != "" &&
+    !par.saveM && !par.saveRaypaths && par.saveGridTT == 0;
+    if ( useProcesses ) num_threads = 1;
 	
-    size_t blk_size = nTx/num_threads;
-    if ( blk_size == 0 ) blk_size++;
     
     
     // ? Find the generic file name of the input model?
@@ -91,10 +98,13 @@ int body(const input_parameters &par) {
     Grid3D<T,uint32_t> *g=nullptr;
 
     vector<Rcv<T>> reflectors;
+    Renumbering<uint32_t> renum;
     
     // Load the grid file into the GRID3D object g for different formats
     if (extension == ".grd") {
         g = buildRectilinear3D<T>(par, num_threads);
+    } else if (extension == ".brk") {
+        g = buildTiled3D<T>(par, num_threads);
     } else if (extension == ".vtr") {
 #ifdef VTK
         g = buildRectilinear3DfromVtr<T>(par, num_threads);
@@ -110,7 +120,7 @@ int body(const input_parameters &par) {
 		return 1;
 #endif
     } else if (extension == ".msh") {
-        g = buildUnstructured3D<T>(par, reflectors, num_threads, src.size());
+        g = buildUnstructured3D<T>(par, reflectors, num_threads, src.size(), &renum);
     } else {
         cerr << par.modelfile << " Unknown extenstion: " << extension << endl;
         return 1;
@@ -132,12 +142,13 @@ int body(const input_parameters &par) {
     }
     
     if ( par.source_radius != 0.0 ) g->setSourceRadius( par.source_radius );
+    if ( par.factored ) g->setFactored( true );
     
     // Load the receiver file into the Rcv object rcv
 	Rcv<T> rcv( par.rcvfile );
     if ( par.rcvfile != "" ) {
         if ( verbose ) cout << "Reading receiver file " << par.rcvfile << " ... ";
-        rcv.init( src.size() );
+        rcv.init( src.size(), reflectors.size() );
         if ( verbose ) cout << "done.\n";
     }
 
@@ -174,7 +185,11 @@ int body(const input_parameters &par) {
     }
 	if ( verbose && num_threads>1 ) {
 		cout << "Calculations will be done using " << num_threads
-		<< " threads with " << blk_size << " shots per threads.\n";
+		<< " threads, shots being dispatched dynamically.\n";
+	}
+	if ( verbose && useProcesses ) {
+		cout << "Calculations will be done using " << par.nProc
+		<< " processes, shots being dispatched dynamically.\n";
 	}
     if ( verbose && par.tt_from_rp ) {
         cout << "Calculation of traveltimes will be done at backward step\n"
@@ -207,293 +222,173 @@ int body(const input_parameters &par) {
     // Computes the travel time
     if ( verbose ) { cout << "Computing traveltimes ... "; cout.flush(); }
 	if ( par.time ) { begin = chrono::high_resolution_clock::now(); }
+    Batch<> batch(num_threads);
     if ( par.saveM ) {
-        if ( num_threads == 1 ) {
-            for ( size_t n=0; n<src.size(); ++n ) {
-                try {
-                    g->raytrace(src[n].get_coord(), src[n].get_t0(), rcv.get_coord(),
-                                rcv.get_tt(n), r_data[n], m_data[n]);
-                } catch (std::exception& e) {
-                    std::cerr << e.what() << std::endl;
-                    abort();
-                }
-            }
-        } else {
-            // threaded jobs
-            
-            vector<thread> threads(num_threads-1);
-            size_t blk_start = 0;
-            for ( size_t i=0; i<num_threads-1; ++i ) {
-                
-                size_t blk_end = blk_start + blk_size;
-                
-                threads[i]=thread( [&g,&src,&rcv,&r_data,&m_data,blk_start,blk_end,i]{
-                    
-                    for ( size_t n=blk_start; n<blk_end; ++n ) {
-                        try {
-                            g->raytrace(src[n].get_coord(), src[n].get_t0(), rcv.get_coord(),
-                                        rcv.get_tt(n), r_data[n], m_data[n], i+1);
-                        } catch (std::exception& e) {
-                            std::cerr << e.what() << std::endl;
-                            abort();
-                        }
-                    }
-                });
-                
-                blk_start = blk_end;
-            }
-            for ( size_t n=blk_start; n<nTx; ++n ) {
-                try {
-                    g->raytrace(src[n].get_coord(), src[n].get_t0(), rcv.get_coord(),
-                                rcv.get_tt(n), r_data[n], m_data[n], 0);
-                } catch (std::exception& e) {
-                    std::cerr << e.what() << std::endl;
-                    abort();
-                }
-            }
-            
-            for_each(threads.begin(),threads.end(), mem_fn(&thread::join));
+        survey<T,sxyz<T>> sv;
+        for ( size_t n=0; n<src.size(); ++n ) {
+            sv.Tx.push_back( &(src[n].get_coord()) );
+            sv.t0.push_back( &(src[n].get_t0()) );
+        }
+        sv.Rx.push_back( &(rcv.get_coord()) );
+        try {
+            raytraceBatch(*g, sv, BATCH_RAYS | BATCH_M,
+                          [&rcv,&r_data,&m_data](const size_t n,
+                                                 shotData<T,sxyz<T>,siv<T>>& d) {
+                              rcv.get_tt(n) = d.tt;
+                              r_data[n].swap( d.r_data );
+                              m_data[n].swap( d.m_data );
+                          }, num_threads);
+        } catch (std::exception& e) {
+            std::cerr << e.what() << std::endl;
+            abort();
+        }
+        if ( par.renumbering != NO_RENUMBERING && !renum.getNodeMap().empty() ) {
+            // columns of M in the numbering of the model file
+            for ( size_t n=0; n<m_data.size(); ++n )
+                for ( size_t n1=0; n1<m_data[n].size(); ++n1 )
+                    for ( size_t n2=0; n2<m_data[n][n1].size(); ++n2 )
+                        m_data[n][n1][n2].j = renum.getNodeMap()[ m_data[n][n1][n2].j ];
         }
     } else if ( par.saveRaypaths && par.rcvfile != "" ) {
-		if ( num_threads == 1 ) {
-			for ( size_t n=0; n<src.size(); ++n ) {
-				
-                vector<vector<T>*> all_tt;
+        try {
+			batch.run(nTx, [&par,&g,&src,&rcv,&r_data,&reflectors,&all_rcv,
+							&rfl_r_data,&rfl2_r_data](const size_t n, const size_t threadNo) {
+
+				vector<vector<T>*> all_tt;
 				all_tt.push_back( &(rcv.get_tt(n)) );
-                vector<vector<vector<sxyz<T>>>*> all_r_data;
-                all_r_data.push_back( &(r_data[n]) );
-				
+				vector<vector<vector<sxyz<T>>>*> all_r_data;
+				all_r_data.push_back( &(r_data[n]) );
 				for ( size_t nr=0; nr<reflectors.size(); ++nr ) {
 					all_tt.push_back( &(reflectors[nr].get_tt(n)) );
-                    all_r_data.push_back( &(rfl_r_data[nr][n]) );
+					all_r_data.push_back( &(rfl_r_data[nr][n]) );
+				}
+				g->raytrace(src[n].get_coord(), src[n].get_t0(), all_rcv,
+							all_tt, all_r_data, threadNo);
+
+				if ( par.saveGridTT>0 ) {
+
+					string srcname = par.srcfiles[n];
+					size_t pos = srcname.rfind("/");
+					srcname.erase(0, pos+1);
+					pos = srcname.rfind(".");
+					size_t len = srcname.length()-pos;
+					srcname.erase(pos, len);
+
+					string filename = par.basename+"_"+srcname+"_all_tt";
+					g->saveTT(filename, 0, threadNo, par.saveGridTT);
 				}
-                try {
-                    g->raytrace(src[n].get_coord(), src[n].get_t0(), all_rcv,
-                                all_tt, all_r_data);
-                } catch (std::exception& e) {
-                    std::cerr << e.what() << std::endl;
-                    abort();
-                }
 
-                if ( par.saveGridTT>0 ) {
-                    
-                    string srcname = par.srcfiles[n];
-                    size_t pos = srcname.rfind("/");
-                    srcname.erase(0, pos+1);
-                    pos = srcname.rfind(".");
-                    size_t len = srcname.length()-pos;
-                    srcname.erase(pos, len);
-                    
-                    string filename = par.basename+"_"+srcname+"_all_tt";
-                    g->saveTT(filename, 0, 0, par.saveGridTT);
-                }
-				
 				for ( size_t nr=0; nr<reflectors.size(); ++nr ) {
-                    try {
-                        g->raytrace(reflectors[nr].get_coord(),
-                                    reflectors[nr].get_tt(n), rcv.get_coord(),
-                                    rcv.get_tt(n,nr+1), rfl2_r_data[nr][n]);
-                    } catch (std::exception& e) {
-                        std::cerr << e.what() << std::endl;
-                        abort();
-                    }
+					g->raytrace(reflectors[nr].get_coord(),
+								reflectors[nr].get_tt(n), rcv.get_coord(),
+								rcv.get_tt(n,nr+1), rfl2_r_data[nr][n], threadNo);
 				}
-			}
-		} else {
-			// threaded jobs
-			
-			std::vector<std::thread> threads(num_threads-1);
-			size_t blk_start = 0;
-			for ( size_t i=0; i<num_threads-1; ++i ) {
-				
-				size_t blk_end = blk_start + blk_size;
-				
-				threads[i]=thread( [&g,&src,&rcv,&r_data,&reflectors,&all_rcv,
-									&rfl_r_data,&rfl2_r_data,
-									blk_start,blk_end,i]{
-                    
-					for ( size_t n=blk_start; n<blk_end; ++n ) {
-						
-						vector<vector<T>*> all_tt;
-						all_tt.push_back( &(rcv.get_tt(n)) );
-                        vector<vector<vector<sxyz<T>>>*> all_r_data;
-                        all_r_data.push_back( &(r_data[n]) );
-						for ( size_t nr=0; nr<reflectors.size(); ++nr ) {
-							all_tt.push_back( &(reflectors[nr].get_tt(n)) );
-                            all_r_data.push_back( &(rfl_r_data[nr][n]) );
-						}
-                        try {
-                            g->raytrace(src[n].get_coord(), src[n].get_t0(), all_rcv,
-                                        all_tt, all_r_data, i+1);
-                        } catch (std::exception& e) {
-                            std::cerr << e.what() << std::endl;
-                            abort();
-                        }
+			});
+        } catch (std::exception& e) {
+            std::cerr << e.what() << std::endl;
+            abort();
+        }
+    } else if ( useProcesses ) {
+        // direct wave and reflections, traveltimes at rcv packed by phase
+        size_t const nRcv = rcv.get_coord().size();
+        vector<size_t> nRx(src.size(), nRcv*(1+reflectors.size()));
+        vector<vector<T>> tt;
+        try {
+            ShotProcesses<T> sp(par.nProc);
+            sp.run(nRx, [&g,&src,&rcv,&all_rcv,&reflectors](const size_t n, vector<T>& t) {
 
-						for ( size_t nr=0; nr<reflectors.size(); ++nr ) {
-                            try {
-                                g->raytrace(reflectors[nr].get_coord(),
-                                            reflectors[nr].get_tt(n), rcv.get_coord(),
-                                            rcv.get_tt(n,nr+1), rfl2_r_data[nr][n], i+1);
-                            } catch (std::exception& e) {
-                                std::cerr << e.what() << std::endl;
-                                abort();
-                            }
-						}
-					}
-				});
-				
-				blk_start = blk_end;
-			}
-			for ( size_t n=blk_start; n<nTx; ++n ) {
-                
-				vector<vector<T>*> all_tt;
-                all_tt.push_back( &(rcv.get_tt(n)) );
-                vector<vector<vector<sxyz<T>>>*> all_r_data;
-                all_r_data.push_back( &(r_data[n]) );
+                vector<vector<T>> tt_rcv(1+reflectors.size());
+                vector<vector<T>> tt_rfl(reflectors.size());
+                vector<vector<T>*> all_tt;
+                all_tt.push_back( &(tt_rcv[0]) );
                 for ( size_t nr=0; nr<reflectors.size(); ++nr ) {
-                    all_tt.push_back( &(reflectors[nr].get_tt(n)) );
-                    all_r_data.push_back( &(rfl_r_data[nr][n]) );
-                }
-                try {
-                    g->raytrace(src[n].get_coord(), src[n].get_t0(), all_rcv,
-                                all_tt, all_r_data, 0);
-                } catch (std::exception& e) {
-                    std::cerr << e.what() << std::endl;
-                    abort();
+                    all_tt.push_back( &(tt_rfl[nr]) );
                 }
-
+                g->raytrace(src[n].get_coord(), src[n].get_t0(), all_rcv,
+                            all_tt, 0);
                 for ( size_t nr=0; nr<reflectors.size(); ++nr ) {
-                    try {
-                        g->raytrace(reflectors[nr].get_coord(),
-                                    reflectors[nr].get_tt(n), rcv.get_coord(),
-                                    rcv.get_tt(n,nr+1), rfl2_r_data[nr][n], 0);
-                    } catch (std::exception& e) {
-                        std::cerr << e.what() << std::endl;
-                        abort();
-                    }
+                    g->raytrace(reflectors[nr].get_coord(), tt_rfl[nr],
+                                rcv.get_coord(), tt_rcv[nr+1], 0);
                 }
-			}
-			
-			std::for_each(threads.begin(),threads.end(),
-						  std::mem_fn(&std::thread::join));
-		}
+                t.clear();
+                for ( size_t np=0; np<tt_rcv.size(); ++np ) {
+                    t.insert(t.end(), tt_rcv[np].begin(), tt_rcv[np].end());
+                }
+            }, tt);
+        } catch (std::exception& e) {
+            std::cerr << e.what() << std::endl;
+            abort();
+        }
+        for ( size_t n=0; n<src.size(); ++n ) {
+            for ( size_t np=0; np<=reflectors.size(); ++np ) {
+                rcv.get_tt(n, np).assign(tt[n].begin()+np*nRcv,
+                                         tt[n].begin()+(np+1)*nRcv);
+            }
+        }
+    } else if ( reflectors.size() > 0 && par.rcvfile != "" && par.saveGridTT == 0 ) {
+        // direct wave and reflections, legs scheduled over all threads
+        vector<vector<sxyz<T>>> interfaces;
+        vector<vector<size_t>> phases(1);
+        for ( size_t nr=0; nr<reflectors.size(); ++nr ) {
+            interfaces.push_back( reflectors[nr].get_coord() );
+            phases.push_back( vector<size_t>(1, nr) );
+        }
+        vector<vector<sxyz<T>>> Tx( src.size() );
+        vector<vector<T>> t0( src.size() );
+        for ( size_t n=0; n<src.size(); ++n ) {
+            Tx[n] = src[n].get_coord();
+            t0[n] = src[n].get_t0();
+        }
+        vector<vector<vector<T>>> tt;
+        try {
+            MultiPhase<T,sxyz<T>,Grid3D<T,uint32_t>> mp(*g, interfaces, phases);
+            mp.raytrace(Tx, t0, rcv.get_coord(), tt, num_threads);
+        } catch (std::exception& e) {
+            std::cerr << e.what() << std::endl;
+            abort();
+        }
+        for ( size_t np=0; np<phases.size(); ++np ) {
+            for ( size_t n=0; n<src.size(); ++n ) {
+                rcv.get_tt(n, np) = tt[np][n];
+            }
+        }
 	} else {
-		if ( num_threads == 1 ) {
-			for ( size_t n=0; n<src.size(); ++n ) {
-				
+        try {
+			batch.run(nTx, [&par,&g,&src,&rcv,&all_rcv,
+							&reflectors](const size_t n, const size_t threadNo) {
+
 				vector<vector<T>*> all_tt;
-                if ( par.rcvfile != "" )
-                    all_tt.push_back( &(rcv.get_tt(n)) );
+				if ( par.rcvfile != "" )
+					all_tt.push_back( &(rcv.get_tt(n)) );
 				for ( size_t nr=0; nr<reflectors.size(); ++nr ) {
 					all_tt.push_back( &(reflectors[nr].get_tt(n)) );
 				}
-                try {
-                    g->raytrace(src[n].get_coord(), src[n].get_t0(), all_rcv,
-                                all_tt);
-                } catch (std::exception& e) {
-                    std::cerr << e.what() << std::endl;
-                    abort();
-                }
+				g->raytrace(src[n].get_coord(), src[n].get_t0(), all_rcv,
+							all_tt, threadNo);
 
-                if ( par.saveGridTT>0 ) {
-                    
-                    string srcname = par.srcfiles[n];
-                    size_t pos = srcname.rfind("/");
-                    srcname.erase(0, pos+1);
-                    pos = srcname.rfind(".");
-                    size_t len = srcname.length()-pos;
-                    srcname.erase(pos, len);
-                    
-                    string filename = par.basename+"_"+srcname+"_all_tt";
-                    g->saveTT(filename, 0, 0, par.saveGridTT);
-                }
+				if ( par.saveGridTT>0 ) {
 
-				for ( size_t nr=0; nr<reflectors.size(); ++nr ) {
-                    try {
-                        g->raytrace(reflectors[nr].get_coord(),
-                                    reflectors[nr].get_tt(n), rcv.get_coord(),
-                                    rcv.get_tt(n,nr+1));
-                    } catch (std::exception& e) {
-                        std::cerr << e.what() << std::endl;
-                        abort();
-                    }
-				}
-			}
-		} else {
-			// threaded jobs
-			
-			vector<thread> threads(num_threads-1);
-			size_t blk_start = 0;
-			for ( size_t i=0; i<num_threads-1; ++i ) {
-				
-				size_t blk_end = blk_start + blk_size;
-				
-				threads[i]=thread( [&par,&g,&src,&rcv,&all_rcv,&reflectors,
-									blk_start,blk_end,i]{
-					
-					for ( size_t n=blk_start; n<blk_end; ++n ) {
-						
-						vector<vector<T>*> all_tt;
-						if ( par.rcvfile != "" )
-                            all_tt.push_back( &(rcv.get_tt(n)) );
-						for ( size_t nr=0; nr<reflectors.size(); ++nr ) {
-							all_tt.push_back( &(reflectors[nr].get_tt(n)) );
-						}
-                        try {
-                            g->raytrace(src[n].get_coord(), src[n].get_t0(), all_rcv,
-                                        all_tt, i+1);
-                        } catch (std::exception& e) {
-                            std::cerr << e.what() << std::endl;
-                            abort();
-                        }
+					string srcname = par.srcfiles[n];
+					size_t pos = srcname.rfind("/");
+					srcname.erase(0, pos+1);
+					pos = srcname.rfind(".");
+					size_t len = srcname.length()-pos;
+					srcname.erase(pos, len);
 
-						for ( size_t nr=0; nr<reflectors.size(); ++nr ) {
-                            try {
-                                g->raytrace(reflectors[nr].get_coord(),
-                                            reflectors[nr].get_tt(n), rcv.get_coord(),
-                                            rcv.get_tt(n,nr+1), i+1);
-                            } catch (std::exception& e) {
-                                std::cerr << e.what() << std::endl;
-                                abort();
-                            }
-						}
-					}
-				});
-				
-				blk_start = blk_end;
-			}
-			for ( size_t n=blk_start; n<nTx; ++n ) {
-				
-				vector<vector<T>*> all_tt;
-				if ( par.rcvfile != "" )
-                    all_tt.push_back( &(rcv.get_tt(n)) );
-				for ( size_t nr=0; nr<reflectors.size(); ++nr ) {
-					all_tt.push_back( &(reflectors[nr].get_tt(n)) );
+					string filename = par.basename+"_"+srcname+"_all_tt";
+					g->saveTT(filename, 0, threadNo, par.saveGridTT);
 				}
-                try {
-                    g->raytrace(src[n].get_coord(), src[n].get_t0(), all_rcv,
-                                all_tt, 0);
-                } catch (std::exception& e) {
-                    std::cerr << e.what() << std::endl;
-                    abort();
-                }
 
 				for ( size_t nr=0; nr<reflectors.size(); ++nr ) {
-                    try {
-                        g->raytrace(reflectors[nr].get_coord(),
-                                    reflectors[nr].get_tt(n), rcv.get_coord(),
-                                    rcv.get_tt(n,nr+1), 0);
-                    } catch (std::exception& e) {
-                        std::cerr << e.what() << std::endl;
-                        abort();
-                    }
+					g->raytrace(reflectors[nr].get_coord(),
+								reflectors[nr].get_tt(n), rcv.get_coord(),
+								rcv.get_tt(n,nr+1), threadNo);
 				}
-			}
-			
-			std::for_each(threads.begin(),threads.end(),
-						  std::mem_fn(&std::thread::join));
-		}
+			});
+        } catch (std::exception& e) {
+            std::cerr << e.what() << std::endl;
+            abort();
+        }
 	}
 	if ( par.time ) { end = chrono::high_resolution_clock::now(); }
     if ( verbose ) {
@@ -551,16 +446,6 @@ int body(const input_parameters &par) {
 				saveRayPaths(filename, r_tmp);
 				if ( verbose ) cout << "done.\n";
 			}
-			
-			if ( reflectors.size() > 0 ) {
-				filename = par.basename+"_rp.bin";
-				ofstream fout;
-//				fout.open(filename, ios::out | ios::binary);
-//				fout << r_data.size();
-//				fout.close();
-				
-				// TODO complete this...
-			}
 		}
         
         if ( par.saveM ) {
@@ -636,66 +521,36 @@ int body(const input_parameters &par) {
             if ( verbose ) cout << '\n';
         }
 		
-		if ( par.saveRaypaths && reflectors.size() > 0 ) {
-			string filename = par.basename+"_rp.bin";
-			ofstream fout;
-			fout.open(filename, ios::out | ios::binary);
-            if ( !fout ) {
-                std::cerr << "Cannot open file " << filename << " for writing.\n";
-                exit(1);
+    }
+    
+    if ( par.saveRaypaths && reflectors.size() > 0 ) {
+        // direct rays, then rays to and from each reflector, one group per source
+        string filename = par.basename+"_rp.bin";
+        if ( verbose ) cout << "Saving global raypath data in " << filename << " ... ";
+        RayPaths<float,uint32_t> rays;
+        for ( size_t n=0; n<r_data.size(); ++n ) {
+            rays.append(r_data[n]);
+            rays.endGroup();
+        }
+        for ( size_t nr=0; nr<rfl_r_data.size(); ++nr ) {
+            for ( size_t n=0; n<rfl_r_data[nr].size(); ++n ) {
+                rays.append(rfl_r_data[nr][n]);
+                rays.endGroup();
             }
-            
-            if ( verbose ) cout << "Saving global raypath data in " << filename << " ... ";
-			size_t size = r_data.size();
-			fout.write((char*)&size,sizeof(size_t));
-			for ( size_t n=0; n<r_data.size(); ++n ) {
-				size = r_data[n].size();
-				fout.write((char*)&size,sizeof(size_t));
-				for ( size_t nr=0; nr<r_data[n].size(); ++nr ) {
-					size = r_data[n][nr].size();
-					fout.write((char*)&size,sizeof(size_t));
-					fout.write((char*)r_data[n][nr].data(),
-							   sizeof(sxyz<T>) * size);
-				}
-			}
-			
-			size = rfl_r_data.size();
-			fout.write((char*)&size,sizeof(size_t));
-			for ( size_t r=0; r<rfl_r_data.size(); ++r ) {
-				size = rfl_r_data[r].size();
-				fout.write((char*)&size,sizeof(size_t));
-				for ( size_t n=0; n<rfl_r_data[r].size(); ++n ) {
-					size = rfl_r_data[r][n].size();
-					fout.write((char*)&size,sizeof(size_t));
-					for ( size_t nr=0; nr<rfl_r_data[r][n].size(); ++nr ) {
-						size = rfl_r_data[r][n][nr].size();
-						fout.write((char*)&size,sizeof(size_t));
-						fout.write((char*)rfl_r_data[r][n][nr].data(),
-								   sizeof(sxyz<T>) * size);
-					}
-				}
-			}
-			
-			size = rfl2_r_data.size();
-			fout.write((char*)&size,sizeof(size_t));
-			for ( size_t r=0; r<rfl2_r_data.size(); ++r ) {
-				size = rfl2_r_data[r].size();
-				fout.write((char*)&size,sizeof(size_t));
-				for ( size_t n=0; n<rfl2_r_data[r].size(); ++n ) {
-					size = rfl2_r_data[r][n].size();
-					fout.write((char*)&size,sizeof(size_t));
-					for ( size_t nr=0; nr<rfl2_r_data[r][n].size(); ++nr ) {
-						size = rfl2_r_data[r][n][nr].size();
-						fout.write((char*)&size,sizeof(size_t));
-						fout.write((char*)rfl2_r_data[r][n][nr].data(),
-								   sizeof(sxyz<T>) * size);
-					}
-				}
-			}
-			
-			fout.close();
-            if ( verbose ) cout << "done.\n";
-		}
+        }
+        for ( size_t nr=0; nr<rfl2_r_data.size(); ++nr ) {
+            for ( size_t n=0; n<rfl2_r_data[nr].size(); ++n ) {
+                rays.append(rfl2_r_data[nr][n]);
+                rays.endGroup();
+            }
+        }
+        try {
+            rays.saveBinary(filename);
+        } catch (std::exception& e) {
+            std::cerr << e.what() << std::endl;
+            exit(1);
+        }
+        if ( verbose ) cout << "done.\n";
     }
     
     if ( verbose ) cout << "Normal termination of program.\n";
@@ -48,6 +48,8 @@ namespace ttcr {
         << "  -v  Verbose mode\n"
         << "  -t  Measure time to build grid and perform raytracing\n"
         << "  -s  Dump secondary nodes to ascii file\n"
+        << "  -S  Specify snapshot file: tetrahedral mesh is restored from it if\n"
+        << "      the file exists, otherwise the mesh is built and saved in it\n"
         << std::endl;
         exit (exit_code);
     }
@@ -58,7 +60,7 @@ namespace ttcr {
         string param_file;
         
         int next_option;
-        const char* const short_options = "hk†p:vts";
+        const char* const short_options = "hk†p:vtsS:";
         bool no_option = true;
 
         do {
@@ -99,6 +101,11 @@ namespace ttcr {
                     ip.dump_secondary = true;
                     break;
                     
+                case  'S' :
+                    no_option = false;
+                    ip.snapshotfile = optarg;
+                    break;
+                    
                 case  '?' : // The user specified an invalid option.
                     // Print usage information to standard error, and exit with exit
                     //code one (indicating abnormal termination).
@@ -184,6 +191,10 @@ namespace ttcr {
                 sin.str( value ); sin.seekg(0, std::ios_base::beg); sin.clear();
                 sin >> ip.nt;
             }
+            else if (par.find("number of processes") < 200) {
+                sin.str( value ); sin.seekg(0, std::ios_base::beg); sin.clear();
+                sin >> ip.nProc;
+            }
             else if (par.find("min nb Tx per thread") < 200) {
                 sin.str( value ); sin.seekg(0, std::ios_base::beg); sin.clear();
                 sin >> ip.min_per_thread;
@@ -212,6 +223,14 @@ namespace ttcr {
                 sin.str( value ); sin.seekg(0, std::ios_base::beg); sin.clear();
                 sin >> ip.nitermax;
             }
+            else if (par.find("renumbering") < 200) {
+                sin.str( value ); sin.seekg(0, std::ios_base::beg); sin.clear();
+                sin >> ip.renumbering;
+            }
+            else if (par.find("factored eikonal") < 200) {
+                sin.str( value ); sin.seekg(0, std::ios_base::beg); sin.clear();
+                sin >> ip.factored;
+            }
             else if (par.find("saveGridTT") < 200) {
                 sin.str( value ); sin.seekg(0, std::ios_base::beg); sin.clear();
                 sin >> ip.saveGridTT;
@@ -259,10 +278,24 @@ namespace ttcr {
                 sin >> test;
                 if ( test == 1 ) ip.method = DYNAMIC_SHORTEST_PATH;
             }
+            else if (par.find("fast iterative") < 200) {
+                sin.str( value ); sin.seekg(0, std::ios_base::beg); sin.clear();
+                int test;
+                sin >> test;
+                if ( test == 1 ) ip.method = FAST_ITERATIVE;
+            }
             else if (par.find("source radius") < 200) {
                 sin.str( value ); sin.seekg(0, std::ios_base::beg); sin.clear();
                 sin >> ip.source_radius;
             }
+            else if (par.find("tile margin") < 200) {
+                sin.str( value ); sin.seekg(0, std::ios_base::beg); sin.clear();
+                sin >> ip.tile_margin;
+            }
+            else if (par.find("brick cache size") < 200) {
+                sin.str( value ); sin.seekg(0, std::ios_base::beg); sin.clear();
+                sin >> ip.brick_cache;
+            }
             else if (par.find("src radius tertiary") < 200 ||
                      par.find("radius dynamic nodes") < 200) {
                 sin.str( value ); sin.seekg(0, std::ios_base::beg); sin.clear();
@@ -274,7 +307,8 @@ namespace ttcr {
                 sin >> test;
                 ip.rotated_template = (test == 1);
             }
-            else if (par.find("fsm high order") < 200) {
+            else if (par.find("fsm high order") < 200 ||
+                     par.find("fmm high order") < 200) {
                 sin.str( value ); sin.seekg(0, std::ios_base::beg); sin.clear();
                 int test;
                 sin >> test;
@@ -39,6 +39,16 @@ namespace ttcr {
     const double pi = 4.0*atan(1.0);
     const double theta_cut = 65. * pi / 180.;  // for raytracing -> unstructured meshes
 
+    // Type of the variables in local eikonal solvers and geometric
+    // predicates.  Grids instantiated with float store traveltimes,
+    // slowness and coordinates in single precision, but local computations
+    // are done in double precision (mixed precision).
+    template<typename T>
+    struct solver_type { typedef T type; };
+
+    template<>
+    struct solver_type<float> { typedef double type; };
+
     const size_t iLength[4][3]={{0,1,2},{1,3,4},{2,3,5},{0,4,5}};
     const size_t iNodes[4][3] = {
         {0,1,2},  // (relative) indices of nodes of 1st triangle
@@ -25,8 +25,12 @@
 #ifndef ttcr_utils_h
 #define ttcr_utils_h
 
+#include <algorithm>
+#include <array>
+#include <cstdint>
 #include <iostream>
-#include <set>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
 #ifdef VTK
@@ -40,6 +44,7 @@
 
 #include "MSHReader.h"
 #include "Rcv.h"
+#include "RayPaths.h"
 
 namespace ttcr {
 
@@ -489,19 +494,30 @@ namespace ttcr {
 /**
  * Build reflectors from interfaces between two lithologies
  *
+ * Points are the vertices of the triangles of the reflectors, followed by
+ * the points on their edges and faces.  Edge and face points are computed
+ * from the sorted node indices of the edge or face, as the secondary nodes
+ * of the tetrahedral meshes, so that they coincide with these nodes.
+ * Points shared by adjacent triangles are identified by node or edge
+ * index, and coordinates are computed in parallel.
+ *
  * @tparam T underlying type of sxyz & Rcv objects
  * @param[in] reader reader used to extract indicides of nodes makign the reflectors
  * @param[in] nodes grid nodes
  * @param[in] nsrc number of sources to model
  * @param[in] nsecondary number of secondary nodes
  * @param[out] reflectors vector of Rcv objects making the reflectors
+ * @param[in] nt number of threads
+ * @param[in] i2e if not empty, map from grid to file numbering of nodes
  */
     template<typename T>
     void buildReflectors(const MSHReader &reader,
                          const std::vector<sxyz<T>> &nodes,
                          const size_t nsrc,
                          const int nsecondary,
-                         std::vector<Rcv<T>> &reflectors) {
+                         std::vector<Rcv<T>> &reflectors,
+                         const size_t nt=1,
+                         const std::vector<uint32_t> &i2e=std::vector<uint32_t>()) {
         
         std::vector<std::string> reflector_names = reader.getPhysicalNames(2);
         std::vector<int> indices = reader.getPhysicalIndices(2);
@@ -514,101 +530,113 @@ namespace ttcr {
         std::vector<triangleElem<uint32_t>> triangles;
         reader.readTriangleElements(triangles);
         
-        sxyz<T> pt1, pt2, pt3, pt4, pt5, pt6, d1, d2;
-        int ncut = nsecondary - 1;
+        if ( !i2e.empty() ) {
+            std::vector<uint32_t> e2i( i2e.size() );
+            for ( size_t n=0; n<i2e.size(); ++n ) e2i[ i2e[n] ] = static_cast<uint32_t>(n);
+            for ( size_t n=0; n<triangles.size(); ++n ) {
+                for ( size_t k=0; k<3; ++k ) triangles[n].i[k] = e2i[ triangles[n].i[k] ];
+            }
+        }
+        
+        // triangles of each reflector, in a single pass
+        std::unordered_map<int, size_t> reflectorNo;
+        for ( size_t ni=0; ni<indices.size(); ++ni ) reflectorNo[ indices[ni] ] = ni;
+        std::vector<std::vector<size_t>> reflector_tri( indices.size() );
+        for ( size_t n=0; n<triangles.size(); ++n ) {
+            auto it = reflectorNo.find( triangles[n].physical_entity );
+            if ( it != reflectorNo.end() ) reflector_tri[ it->second ].push_back( n );
+        }
+        
+        const size_t nsec = nsecondary > 0 ? nsecondary : 0;
+        size_t nFaceNodes = 0;
+        for ( size_t n=1; n<nsec; ++n ) nFaceNodes += n;
         
         for ( size_t ni=0; ni<indices.size(); ++ni ) {
             
             reflectors.push_back( reflector_names[ni] );
+            const std::vector<size_t> &tri = reflector_tri[ni];
             
-            std::set<sxyz<T>> refl_pts;  // use set to avoid duplicate points
-            typename std::set<sxyz<T>>::iterator it;
-            
-            for ( size_t nt=0; nt<triangles.size(); ++nt ) {
-                if ( indices[ni] == triangles[nt].physical_entity ) {
-                    pt1 = nodes[ triangles[nt].i[0] ];
-                    pt2 = nodes[ triangles[nt].i[1] ];
-                    pt3 = nodes[ triangles[nt].i[2] ];
-                    
-                    // edge nodes
-                    // 1st edge
-                    d1.x = (pt2.x-pt1.x)/(nsecondary+1);
-                    d1.y = (pt2.y-pt1.y)/(nsecondary+1);
-                    d1.z = (pt2.z-pt1.z)/(nsecondary+1);
-                    
-                    refl_pts.insert( pt1 );
-                    for ( size_t n2=0; n2<nsecondary; ++n2 ) {
-                        pt4.x = pt1.x+(1+n2)*d1.x;
-                        pt4.y = pt1.y+(1+n2)*d1.y;
-                        pt4.z = pt1.z+(1+n2)*d1.z;
-                        refl_pts.insert( pt4 );
-                    }
-                    refl_pts.insert( pt2 );
-                    
-                    // 2nd edge
-                    d1.x = (pt3.x-pt2.x)/(nsecondary+1);
-                    d1.y = (pt3.y-pt2.y)/(nsecondary+1);
-                    d1.z = (pt3.z-pt2.z)/(nsecondary+1);
-                    
-                    for ( size_t n2=0; n2<nsecondary; ++n2 ) {
-                        pt4.x = pt2.x+(1+n2)*d1.x;
-                        pt4.y = pt2.y+(1+n2)*d1.y;
-                        pt4.z = pt2.z+(1+n2)*d1.z;
-                        refl_pts.insert( pt4 );
+            // vertices and edges, in order of first occurence
+            std::unordered_map<uint32_t, size_t> vertexNo;
+            std::unordered_map<uint64_t, size_t> edgeNo;
+            std::vector<uint32_t> vertices;
+            std::vector<std::array<uint32_t,2>> edges;
+            for ( size_t n=0; n<tri.size(); ++n ) {
+                const triangleElem<uint32_t> &t = triangles[ tri[n] ];
+                for ( size_t k=0; k<3; ++k ) {
+                    if ( vertexNo.insert( {t.i[k], vertices.size()} ).second ) {
+                        vertices.push_back( t.i[k] );
                     }
-                    refl_pts.insert( pt3 );
-                    
-                    // 3rd edge
-                    d1.x = (pt1.x-pt3.x)/(nsecondary+1);
-                    d1.y = (pt1.y-pt3.y)/(nsecondary+1);
-                    d1.z = (pt1.z-pt3.z)/(nsecondary+1);
-                    
-                    for ( size_t n2=0; n2<nsecondary; ++n2 ) {
-                        pt4.x = pt3.x+(1+n2)*d1.x;
-                        pt4.y = pt3.y+(1+n2)*d1.y;
-                        pt4.z = pt3.z+(1+n2)*d1.z;
-                        refl_pts.insert( pt4 );
+                    std::array<uint32_t,2> edgeKey = {t.i[k], t.i[(k+1)%3]};
+                    std::sort(edgeKey.begin(), edgeKey.end());
+                    uint64_t key = (static_cast<uint64_t>(edgeKey[0]) << 32) | edgeKey[1];
+                    if ( nsec > 0 && edgeNo.insert( {key, edges.size()} ).second ) {
+                        edges.push_back( edgeKey );
                     }
-                    
-                    // face nodes
-                    d2.x = (pt1.x-pt2.x)/(nsecondary+1);
-                    d2.y = (pt1.y-pt2.y)/(nsecondary+1);
-                    d2.z = (pt1.z-pt2.z)/(nsecondary+1);
-                    
-                    for ( size_t n=0; n<ncut; ++n ) {
-                        
-                        pt4.x = pt3.x+(1+n)*d1.x;
-                        pt4.y = pt3.y+(1+n)*d1.y;
-                        pt4.z = pt3.z+(1+n)*d1.z;
-                        
-                        pt5.x = pt2.x+(1+n)*d2.x;
-                        pt5.y = pt2.y+(1+n)*d2.y;
-                        pt5.z = pt2.z+(1+n)*d2.z;
-                        
-                        size_t nseg = ncut+1-n;
+                }
+            }
+            
+            const size_t nItems = vertices.size() + edges.size() + (nFaceNodes>0 ? tri.size() : 0);
+            std::vector<sxyz<T>> &pts = reflectors.back().get_coord();
+            pts.resize( vertices.size() + edges.size()*nsec + tri.size()*nFaceNodes );
+            
+            auto sample = [&](const size_t start, const size_t end) {
+                for ( size_t item=start; item<end; ++item ) {
+                    if ( item < vertices.size() ) {
+                        pts[item] = nodes[ vertices[item] ];
+                    } else if ( item < vertices.size()+edges.size() ) {
+                        const size_t ne = item-vertices.size();
+                        const sxyz<T> &p0 = nodes[ edges[ne][0] ];
+                        sxyz<T> d = (nodes[ edges[ne][1] ]-p0)/static_cast<T>(nsec+1);
+                        size_t ip = vertices.size() + ne*nsec;
+                        for ( size_t n2=0; n2<nsec; ++n2 ) {
+                            pts[ip++] = { p0.x+(1+n2)*d.x, p0.y+(1+n2)*d.y, p0.z+(1+n2)*d.z };
+                        }
+                    } else {
+                        const size_t nf = item-vertices.size()-edges.size();
+                        const triangleElem<uint32_t> &t = triangles[ tri[nf] ];
+                        std::array<uint32_t,3> faceKey = {t.i[0], t.i[1], t.i[2]};
+                        std::sort(faceKey.begin(), faceKey.end());
                         
-                        sxyz<T> d = { (pt5.x-pt4.x)/nseg,
-                            (pt5.y-pt4.y)/nseg,
-                            (pt5.z-pt4.z)/nseg };
+                        sxyz<T> d1 = (nodes[faceKey[1]]-nodes[faceKey[0]])/static_cast<T>(nsec+1);
+                        sxyz<T> d2 = (nodes[faceKey[1]]-nodes[faceKey[2]])/static_cast<T>(nsec+1);
                         
-                        for ( size_t n2=0; n2<nseg-1; ++n2 ) {
-                            pt6.x = pt1.x+(1+n2)*d.x;
-                            pt6.y = pt1.y+(1+n2)*d.y;
-                            pt6.z = pt1.z+(1+n2)*d.z;
-                            refl_pts.insert( pt6 );
+                        size_t ip = vertices.size() + edges.size()*nsec + nf*nFaceNodes;
+                        const size_t ncut = nsec-1;
+                        for ( size_t n=0; n<ncut; ++n ) {
+                            
+                            sxyz<T> pt1 = nodes[faceKey[0]]+static_cast<T>(1+n)*d1;
+                            sxyz<T> pt2 = nodes[faceKey[2]]+static_cast<T>(1+n)*d2;
+                            
+                            size_t nseg = ncut+1-n;
+                            
+                            sxyz<T> d = (pt2-pt1)/static_cast<T>(nseg);
+                            
+                            for ( size_t n2=0; n2<nseg-1; ++n2 ) {
+                                pts[ip++] = { pt1.x+(1+n2)*d.x, pt1.y+(1+n2)*d.y, pt1.z+(1+n2)*d.z };
+                            }
                         }
                     }
                 }
-            }
-            for (it=refl_pts.begin(); it!=refl_pts.end(); ++it) {
-                reflectors.back().add_coord( *it );
+            };
+            
+            size_t nThreads = nt < nItems ? nt : 1;
+            if ( nThreads <= 1 ) {
+                sample(0, nItems);
+            } else {
+                size_t blk_size = nItems/nThreads + (nItems%nThreads ? 1 : 0);
+                std::vector<std::thread> threads;
+                for ( size_t n=0; n<nItems; n+=blk_size ) {
+                    threads.push_back( std::thread(sample, n, std::min(n+blk_size, nItems)) );
+                }
+                for ( size_t n=0; n<threads.size(); ++n ) threads[n].join();
             }
             reflectors.back().init_tt( nsrc );
         }
     }
 
 /**
- * Save 3D raypaths in a vtk file
+ * Save 3D raypaths in a vtk file (VTK is not needed)
  *
  * @tparam T underlying type of sxyz objects
  * @param fname name of file for saving paths
@@ -617,45 +645,11 @@ namespace ttcr {
     template<typename T>
     void saveRayPaths(const std::string &fname,
                       const std::vector<std::vector<sxyz<T>>> &r_data) {
-        
-#ifdef VTK
-        vtkSmartPointer<vtkPolyData> polydata = vtkSmartPointer<vtkPolyData>::New();
-        vtkSmartPointer<vtkCellArray> cellarray = vtkSmartPointer<vtkCellArray>::New();
-        vtkSmartPointer<vtkPoints> pts = vtkSmartPointer<vtkPoints>::New();
-        
-        size_t npts=0;
-        for ( size_t n=0; n<r_data.size(); ++n ) {
-            npts += r_data[n].size();
-        }
-        pts->SetNumberOfPoints(npts);
-        for ( size_t n=0, npts=0; n<r_data.size(); ++n ) {
-            for ( size_t np=0; np<r_data[n].size(); ++np, ++npts ) {
-                pts->InsertPoint(npts, r_data[n][np].x, r_data[n][np].y, r_data[n][np].z);
-            }
-        }
-        polydata->SetPoints(pts);
-        
-        for ( size_t n=0, npts=0; n<r_data.size(); ++n ) {
-            vtkSmartPointer<vtkPolyLine> line = vtkSmartPointer<vtkPolyLine>::New();
-            line->GetPointIds()->SetNumberOfIds( r_data[n].size() );
-            for ( size_t np=0; np<r_data[n].size(); ++np, ++npts ) {
-                line->GetPointIds()->SetId(np, npts);
-            }
-            cellarray->InsertNextCell(line);
-        }
-        polydata->SetLines(cellarray);
-        
-        vtkSmartPointer<vtkXMLPolyDataWriter> writer = vtkSmartPointer<vtkXMLPolyDataWriter>::New();
-        writer->SetFileName( fname.c_str() );
-        writer->SetInputData( polydata );
-        writer->SetDataModeToBinary();
-        writer->Update();
-#endif
-        
+        writeVTPPolylines(fname, r_data);
     }
     
 /**
- * Save 2D raypaths in a vtk file
+ * Save 2D raypaths in a vtk file (VTK is not needed)
  *
  * @tparam T underlying type of sxz objects
  * @param fname name of file for saving paths
@@ -664,41 +658,7 @@ namespace ttcr {
     template<typename T>
     void saveRayPaths(const std::string &fname,
                       const std::vector<std::vector<sxz<T>>> &r_data) {
-        
-#ifdef VTK
-        vtkSmartPointer<vtkPolyData> polydata = vtkSmartPointer<vtkPolyData>::New();
-        vtkSmartPointer<vtkCellArray> cellarray = vtkSmartPointer<vtkCellArray>::New();
-        vtkSmartPointer<vtkPoints> pts = vtkSmartPointer<vtkPoints>::New();
-        
-        size_t npts=0;
-        for ( size_t n=0; n<r_data.size(); ++n ) {
-            npts += r_data[n].size();
-        }
-        pts->SetNumberOfPoints(npts);
-        for ( size_t n=0, npts=0; n<r_data.size(); ++n ) {
-            for ( size_t np=0; np<r_data[n].size(); ++np, ++npts ) {
-                pts->InsertPoint(npts, r_data[n][np].x, 0.0, r_data[n][np].z);
-            }
-        }
-        polydata->SetPoints(pts);
-        
-        for ( size_t n=0, npts=0; n<r_data.size(); ++n ) {
-            vtkSmartPointer<vtkPolyLine> line = vtkSmartPointer<vtkPolyLine>::New();
-            line->GetPointIds()->SetNumberOfIds( r_data[n].size() );
-            for ( size_t np=0; np<r_data[n].size(); ++np, ++npts ) {
-                line->GetPointIds()->SetId(np, npts);
-            }
-            cellarray->InsertNextCell(line);
-        }
-        polydata->SetLines(cellarray);
-        
-        vtkSmartPointer<vtkXMLPolyDataWriter> writer = vtkSmartPointer<vtkXMLPolyDataWriter>::New();
-        writer->SetFileName( fname.c_str() );
-        writer->SetInputData( polydata );
-        writer->SetDataModeToBinary();
-        writer->Update();
-#endif
-        
+        writeVTPPolylines(fname, r_data);
     }
 
 /**
@@ -0,0 +1,101 @@
+%GRID2DRCFM class to perform raytracing in 2D with the fast marching method
+%
+%  Usage:
+%
+%  Create and destroy instance of class
+%
+%    g = grid2drcfm(par, nthreads)
+%    clear g
+%
+%   Input for instantiation
+%    par: struct variable for grid definition with the following fields
+%          xmin: origin in X
+%          zmin: origin in Z
+%          dx: cell size in X
+%          dz: cell size in Z
+%          nx: number of cells in X
+%          nz: number of cells in Z
+%          second_order: use second order FMM (optional, default = 0)
+%    nthreads: number of threads (optional, default = 1)
+%
+%  Raytracing
+%    [tt] = g.raytrace(s, Tx, Rx, t0)
+%    [tt, rays] = g.raytrace(s, Tx, Rx, t0)
+%
+%   Input
+%    g: grid instance
+%    s: slowness vector ( nSlowness by 1 ), or [] to use the slowness
+%       of the previous call
+%    Tx: source coordinates, nTx by 2
+%          1st column contains X coordinates,
+%          2nd contains Z coordinates
+%    Rx: receiver coordinates, nRx by 2
+%          1st column contains X coordinates,
+%          2nd contains Z coordinates
+%    t0: source epoch, nTx by 1
+%          t0 is optional (0 if not given)
+%
+%    *** IMPORTANT: Tx or Rx should _not_ lie on (or close to) an external
+%                   face of the grid when rays are needed ***
+%    *** nTx must be equal to nRx, i.e. each row define one Tx-Rx pair ***
+%    *** nSlowness must equal g.nx*g.nz ***
+%
+%
+%   Output
+%    tt:   vector of traveltimes, nRx by 1
+%    rays: cell object containing the matrices of coordinates of the ray
+%          paths, nRx by 1.  Each matrix is nPts by 2
+%
+% -----------
+%
+% agent
+% 2026-10-18
+
+
+classdef grid2drcfm < handle
+    properties (SetAccess = private, Hidden = true)
+        objectHandle; % Handle to the underlying C++ class instance
+    end
+    methods
+        % Constructor - Create a new C++ class instance
+        function this = grid2drcfm(varargin)
+            this.objectHandle = grid2drcfm_mex('new', varargin{:});
+        end
+        
+        % Destructor - Destroy the C++ class instance
+        function delete(this)
+            grid2drcfm_mex('delete', this.objectHandle);
+        end
+        
+        % setSlowness
+        function varargout = setSlowness(this, varargin)
+            [varargout{1:nargout}] = grid2drcfm_mex('setSlowness', this.objectHandle, varargin{:});
+        end
+        
+        % raytrace
+        function varargout = raytrace(this, varargin)
+            [varargout{1:nargout}] = grid2drcfm_mex('raytrace', this.objectHandle, varargin{:});
+        end
+        
+        % for saving in mat-files
+        function s = saveobj(obj)
+            s.xmin = grid2drcfm_mex('get_xmin', obj.objectHandle);
+            s.zmin = grid2drcfm_mex('get_zmin', obj.objectHandle);
+            s.dx = grid2drcfm_mex('get_dx', obj.objectHandle);
+            s.dz = grid2drcfm_mex('get_dz', obj.objectHandle);
+            s.nx = grid2drcfm_mex('get_nx', obj.objectHandle);
+            s.nz = grid2drcfm_mex('get_nz', obj.objectHandle);
+            s.nthreads = grid2drcfm_mex('get_nthreads', obj.objectHandle);
+        end
+    end
+    methods(Static)
+        % for loading from mat-files
+        function obj = loadobj(s)
+            if isstruct(s)
+                obj = grid2drcfm(s, s.nthreads);
+            else
+                error('Wrong input arguments')
+            end
+        end
+    end
+end
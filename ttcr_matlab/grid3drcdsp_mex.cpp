@@ -0,0 +1,183 @@
+//
+//  grid3drcdsp_mex.cpp
+//  ttcr
+//
+//  Created by agent on 2026-10-18.
+//  Copyright (c) 2026 agent. All rights reserved.
+//
+
+#include <exception>
+
+#include "mex.h"
+#include "class_handle.hpp"
+#include "mex_raytrace.hpp"
+
+#include "Cell.h"
+#include "Grid3Drcdsp.h"
+
+using namespace std;
+using namespace ttcr;
+
+typedef Grid3Drcdsp<double,uint32_t,Cell<double,Node3Dc<double,uint32_t>,sxyz<double>>> grid;
+
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+{
+    // Get the command string
+    char cmd[64];
+    if (nrhs < 1 || mxGetString(prhs[0], cmd, sizeof(cmd)))
+        mexErrMsgTxt("First input should be a command string less than 64 characters long.");
+    
+    //  ---------------------------------------------------------------------------
+    // New
+    if (!strcmp("new", cmd)) {
+        // Check parameters
+        if (nlhs != 1) {
+            mexErrMsgTxt("New: One output expected.");
+        }
+        if (nrhs > 3) {
+            mexErrMsgTxt("New: max 2 input arguments needed.");
+        }
+        // Return a handle to a new C++ instance
+        
+        double        *xmin, *ymin, *zmin;
+        double        *dx, *dy, *dz, *nx_d, *ny_d, *nz_d;
+        double        *ns_d, *nt_d, *rad;
+        uint32_t      nx, ny, nz, ns, nt;
+        size_t        nthreads;
+        
+        // ------------------------------------------------------
+        //	 grid structure
+        // ------------------------------------------------------
+        if(!mxIsStruct(prhs[1]))
+            mexErrMsgTxt("First argument must be a structure.");
+        
+        xmin  = static_cast<double*>( mxGetPr( mxGetField(prhs[1], 0, "xmin") ) );
+        ymin  = static_cast<double*>( mxGetPr( mxGetField(prhs[1], 0, "ymin") ) );
+        zmin  = static_cast<double*>( mxGetPr( mxGetField(prhs[1], 0, "zmin") ) );
+        dx    = static_cast<double*>( mxGetPr( mxGetField(prhs[1], 0, "dx") ) );
+        dy    = static_cast<double*>( mxGetPr( mxGetField(prhs[1], 0, "dy") ) );
+        dz    = static_cast<double*>( mxGetPr( mxGetField(prhs[1], 0, "dz") ) );
+        nx_d  = static_cast<double*>( mxGetPr( mxGetField(prhs[1], 0, "nx") ) );
+        ny_d  = static_cast<double*>( mxGetPr( mxGetField(prhs[1], 0, "ny") ) );
+        nz_d  = static_cast<double*>( mxGetPr( mxGetField(prhs[1], 0, "nz") ) );
+        ns_d  = static_cast<double*>( mxGetPr( mxGetField(prhs[1], 0, "n_secondary") ) );
+        nt_d  = static_cast<double*>( mxGetPr( mxGetField(prhs[1], 0, "n_tertiary") ) );
+        rad   = static_cast<double*>( mxGetPr( mxGetField(prhs[1], 0, "radius_tertiary") ) );
+        
+        // ------------------------------------------------------
+        // number of threads
+        // ------------------------------------------------------
+        nthreads = 1;
+        if ( nrhs>2 ) {
+            size_t mrows = mxGetM(prhs[2]);
+            size_t ncols = mxGetN(prhs[2]);
+            if( !mxIsDouble(prhs[2]) || mxIsComplex(prhs[2]) ||
+               !(mrows==1 && ncols==1) ) {
+                mexErrMsgIdAndTxt( "MATLAB:timestwo:inputNotRealScalarDouble",
+                                  "Input must be a noncomplex scalar double.");
+            }
+            
+            double *dtmp = mxGetPr( prhs[2] );
+            nthreads = round( *dtmp );
+        }
+        
+        nx = uint32_t(round(*nx_d));
+        ny = uint32_t(round(*ny_d));
+        nz = uint32_t(round(*nz_d));
+        ns = uint32_t(round(*ns_d));
+        nt = uint32_t(round(*nt_d));
+        
+        grid *g = new grid(nx, ny, nz, *dx, *dy, *dz,
+                           *xmin, *ymin, *zmin,
+                           ns, false, nt, *rad, nthreads);
+        plhs[0] = convertPtr2Mat<mex_grid<grid>>(new mex_grid<grid>(g));
+        return;
+    }
+    
+    // Check there is a second input, which should be the class instance handle
+    if (nrhs < 2)
+        mexErrMsgTxt("Second input should be a class instance handle.");
+    
+    // ---------------------------------------------------------------------------
+    // Delete
+    //
+    if (!strcmp("delete", cmd)) {
+        // Destroy the C++ object
+        destroyObject<mex_grid<grid>>(prhs[1]);
+        // Warn if other commands were ignored
+        if (nlhs != 0 || nrhs != 2)
+            mexWarnMsgTxt("Delete: Unexpected arguments ignored.");
+        return;
+    }
+    
+    // Get the class instance pointer from the second input
+    mex_grid<grid> *instance = convertMat2Ptr<mex_grid<grid>>(prhs[1]);
+    grid *grid_instance = instance->grid.get();
+    
+    // Call the various class methods
+    // ---------------------------------------------------------------------------
+    // setSlowness
+    //
+    if (!strcmp("setSlowness", cmd)) {
+        // Check parameters
+        if (nlhs < 0 || nrhs != 3)
+            mexErrMsgTxt("setSlowness: Unexpected arguments.");
+        // Call the method
+        mexSetSlowness(*instance, prhs[2]);
+        
+        return;
+    }
+    
+    //  ---------------------------------------------------------------------------
+    // raytrace
+    if (!strcmp("raytrace", cmd)) {
+        mexRaytrace<sxyz<double>,siv<double>,Grid3D<double,uint32_t>>(*instance, nlhs, plhs, nrhs, prhs);
+        return;
+    }
+    
+    //  ---------------------------------------------------------------------------
+    // accessors
+    if (!strcmp("get_nthreads", cmd)) {
+        mexScalar(cmd, grid_instance->getNthreads(), nlhs, plhs, nrhs);
+        return;
+    }
+    if (!strcmp("get_xmin", cmd)) {
+        mexScalar(cmd, grid_instance->getXmin(), nlhs, plhs, nrhs);
+        return;
+    }
+    if (!strcmp("get_ymin", cmd)) {
+        mexScalar(cmd, grid_instance->getYmin(), nlhs, plhs, nrhs);
+        return;
+    }
+    if (!strcmp("get_zmin", cmd)) {
+        mexScalar(cmd, grid_instance->getZmin(), nlhs, plhs, nrhs);
+        return;
+    }
+    if (!strcmp("get_dx", cmd)) {
+        mexScalar(cmd, grid_instance->getDx(), nlhs, plhs, nrhs);
+        return;
+    }
+    if (!strcmp("get_dy", cmd)) {
+        mexScalar(cmd, grid_instance->getDy(), nlhs, plhs, nrhs);
+        return;
+    }
+    if (!strcmp("get_dz", cmd)) {
+        mexScalar(cmd, grid_instance->getDz(), nlhs, plhs, nrhs);
+        return;
+    }
+    if (!strcmp("get_nx", cmd)) {
+        mexScalar(cmd, grid_instance->getNcx(), nlhs, plhs, nrhs);
+        return;
+    }
+    if (!strcmp("get_ny", cmd)) {
+        mexScalar(cmd, grid_instance->getNcy(), nlhs, plhs, nrhs);
+        return;
+    }
+    if (!strcmp("get_nz", cmd)) {
+        mexScalar(cmd, grid_instance->getNcz(), nlhs, plhs, nrhs);
+        return;
+    }
+    
+    // Got here, so command not recognized
+    mexErrMsgTxt("Command not recognized.");
+}
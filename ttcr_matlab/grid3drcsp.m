@@ -30,7 +30,8 @@
 %
 %   Input
 %    g: grid instance
-%    s: slowness vector ( nSlowness by 1 )
+%    s: slowness vector ( nSlowness by 1 ), or [] to use the slowness
+%       of the previous call
 %    Tx: source coordinates, nTx by 3
 %          1st column contains X coordinates, 2nd contains Y coordinates,
 %          3rd contains Z coordinates
@@ -0,0 +1,510 @@
+//
+//  mex_raytrace.hpp
+//  ttcr
+//
+//  Created by agent on 2026-10-18.
+//  Copyright (c) 2026 agent. All rights reserved.
+//
+
+/*
+
+ Code shared by the mex files
+
+ The grid instance is kept with a group of threads (Workers.h) that lives as
+ long as the MATLAB object, so that successive calls to raytrace do not
+ create threads.  The sources are raytraced by these threads, each source
+ in a buffer taken from a small pool, while the calling thread, the only
+ one allowed to use the MATLAB API, writes the results of the completed
+ sources in the output arrays and returns the buffers to the pool.
+
+ */
+
+#ifndef __MEX_RAYTRACE_HPP__
+#define __MEX_RAYTRACE_HPP__
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "mex.h"
+
+#include "Batch.h"
+#include "Workers.h"
+#include "ttcr_t.h"
+
+namespace ttcr {
+
+    // object held by class_handle
+    template<typename G>
+    struct mex_grid {
+        std::unique_ptr<G> grid;
+        size_t nSlowness;   // size of the last slowness vector assigned
+        Workers workers;    // one thread per thread of the grid, plus the caller
+
+        mex_grid(G *g) : grid(g), nSlowness(0), workers(g->getNthreads()+1) {}
+    };
+
+    // point n of a MATLAB matrix with N rows, one point per row
+    inline void mxToPoint(const double *a, const size_t n, const size_t N, sxyz<double>& p) {
+        p.x = a[n];
+        p.y = a[n+N];
+        p.z = a[n+2*N];
+    }
+    inline void mxToPoint(const double *a, const size_t n, const size_t N, sxz<double>& p) {
+        p.x = a[n];
+        p.z = a[n+N];
+    }
+    inline void pointToMx(const sxyz<double>& p, const size_t n, const size_t N, double *a) {
+        a[n] = p.x;
+        a[n+N] = p.y;
+        a[n+2*N] = p.z;
+    }
+    inline void pointToMx(const sxz<double>& p, const size_t n, const size_t N, double *a) {
+        a[n] = p.x;
+        a[n+N] = p.z;
+    }
+    inline size_t mxNdim(const sxyz<double>&) { return 3; }
+    inline size_t mxNdim(const sxz<double>&) { return 2; }
+
+    struct mxPointHash {
+        size_t operator()(const sxyz<double>& p) const {
+            size_t h = std::hash<double>()(p.x);
+            h ^= std::hash<double>()(p.y) + 0x9e3779b9 + (h<<6) + (h>>2);
+            return h ^ (std::hash<double>()(p.z) + 0x9e3779b9 + (h<<6) + (h>>2));
+        }
+        size_t operator()(const sxz<double>& p) const {
+            size_t h = std::hash<double>()(p.x);
+            return h ^ (std::hash<double>()(p.z) + 0x9e3779b9 + (h<<6) + (h>>2));
+        }
+    };
+    struct mxPointEqual {
+        bool operator()(const sxyz<double>& a, const sxyz<double>& b) const {
+            return a.x==b.x && a.y==b.y && a.z==b.z;
+        }
+        bool operator()(const sxz<double>& a, const sxz<double>& b) const {
+            return a.x==b.x && a.z==b.z;
+        }
+    };
+
+    // size of a real double column vector, raises a MATLAB error otherwise
+    inline size_t mxVectorSize(const mxArray *a, const char *name) {
+        if ( !mxIsDouble(a) || mxIsComplex(a) ) {
+            mexErrMsgTxt((std::string(name)+" must be double precision.").c_str());
+        }
+        if ( mxGetNumberOfDimensions(a) != 2 || mxGetDimensions(a)[1] != 1 ) {
+            mexErrMsgTxt((std::string(name)+" must be a vector (n by 1).").c_str());
+        }
+        return static_cast<size_t>( mxGetDimensions(a)[0] );
+    }
+
+    // number of rows of a real double matrix with ncols columns
+    inline size_t mxMatrixRows(const mxArray *a, const size_t ncols, const char *name) {
+        if ( !mxIsDouble(a) || mxIsComplex(a) ) {
+            mexErrMsgTxt((std::string(name)+" must be double precision.").c_str());
+        }
+        if ( mxGetNumberOfDimensions(a) != 2 || mxGetDimensions(a)[1] != ncols ) {
+            mexErrMsgTxt((std::string(name)+": matrix n by "+std::to_string(ncols)+".").c_str());
+        }
+        return static_cast<size_t>( mxGetDimensions(a)[0] );
+    }
+
+    template<typename G>
+    void mexSetSlowness(mex_grid<G>& h, const mxArray *s) {
+        size_t nSlowness = mxVectorSize(s, "Slowness");
+        const double *slowness = mxGetPr(s);
+        std::vector<double> slown(slowness, slowness+nSlowness);
+        try {
+            h.grid->setSlowness(slown);
+        } catch (std::exception& e) {
+            mexErrMsgTxt("Slowness values must be defined for each grid node.");
+        }
+        h.nSlowness = nSlowness;
+    }
+
+    // Tx-Rx pairs of the raytrace command grouped by source, the t0 of the
+    // first pair of a source being kept
+    template<typename S>
+    struct mxShots {
+        std::vector<std::vector<S>> Tx;
+        std::vector<std::vector<double>> t0;
+        std::vector<std::vector<S>> Rx;
+        std::vector<std::vector<size_t>> iTx;   // pairs of each source
+        size_t nPairs;
+    };
+
+    // reads the arguments of raytrace(s, Tx, Rx, t0); if s is empty, the
+    // slowness model already assigned to the grid is used
+    template<typename S, typename G>
+    void mxReadShots(mex_grid<G>& h, int nrhs, const mxArray *prhs[],
+                     mxShots<S>& shots) {
+        if ( nrhs != 5 && nrhs != 6 ) {
+            mexErrMsgTxt("raytrace: Unexpected arguments.");
+        }
+        if ( !mxIsEmpty(prhs[2]) ) {
+            mexSetSlowness(h, prhs[2]);
+        } else if ( h.nSlowness == 0 ) {
+            mexErrMsgTxt("raytrace: slowness model not defined.");
+        }
+
+        const size_t ndim = mxNdim(S());
+        const size_t nTx = mxMatrixRows(prhs[3], ndim, "Tx");
+        const size_t nRx = mxMatrixRows(prhs[4], ndim, "Rx");
+        if ( nTx != nRx ) {
+            mexErrMsgTxt("nTx should be equal to nRx.");
+        }
+        const double *Tx = mxGetPr(prhs[3]);
+        const double *Rx = mxGetPr(prhs[4]);
+        const double *tTx = nullptr;
+        if ( nrhs == 6 ) {
+            if ( mxVectorSize(prhs[5], "t0") != nTx ) {
+                mexErrMsgTxt("t0: matrix nTx by 1.");
+            }
+            tTx = mxGetPr(prhs[5]);
+        }
+
+        std::unordered_map<S, size_t, mxPointHash, mxPointEqual> txNo;
+        txNo.reserve(nTx);
+        for ( size_t ntx=0; ntx<nTx; ++ntx ) {
+            S tx, rx;
+            mxToPoint(Tx, ntx, nTx, tx);
+            mxToPoint(Rx, ntx, nRx, rx);
+            auto it = txNo.emplace(tx, shots.Tx.size());
+            if ( it.second ) {
+                shots.Tx.push_back( std::vector<S>(1, tx) );
+                shots.t0.push_back( std::vector<double>(1, tTx==nullptr ? 0.0 : tTx[ntx]) );
+                shots.iTx.push_back( std::vector<size_t>() );
+                shots.Rx.push_back( std::vector<S>() );
+            }
+            shots.iTx[ it.first->second ].push_back( ntx );
+            shots.Rx[ it.first->second ].push_back( rx );
+        }
+        shots.nPairs = nRx;
+    }
+
+    // sorts the elements of a row of a sparse matrix by column, merging
+    // elements of the same column (a ray can cross a cell in more than one
+    // segment); col(e) is the column of element e, which must be < nCols
+    template<typename E, typename COL>
+    void mxSortRow(std::vector<E>& row, COL col, const size_t nCols) {
+        std::sort(row.begin(), row.end(),
+                  [&col](const E& x, const E& y) { return col(x) < col(y); });
+        size_t k = 0;
+        for ( size_t n=1; n<row.size(); ++n ) {
+            if ( col(row[n]) == col(row[k]) ) {
+                row[k].v += row[n].v;
+            } else {
+                row[++k] = row[n];
+            }
+        }
+        if ( !row.empty() ) row.resize(k+1);
+        if ( !row.empty() && col(row.back()) >= nCols ) {
+            throw std::out_of_range("column of sparse matrix out of range.");
+        }
+    }
+
+    // ray of a Tx-Rx pair, created in the calling thread
+    template<typename S>
+    mxArray* mxCreateRay(const std::vector<S>& ray) {
+        mxArray *a = mxCreateDoubleMatrix(ray.size(), mxNdim(S()), mxREAL);
+        double *r = mxGetPr(a);
+        for ( size_t np=0; np<ray.size(); ++np ) {
+            pointToMx(ray[np], np, ray.size(), r);
+        }
+        return a;
+    }
+
+    /*
+     Raytraces the sources of shots on the threads of h.workers, where
+     compute(n, buffer, threadNo) fills the buffer of source n.  consume(n,
+     buffer) is called in the calling thread as the sources complete, and
+     each thread holds at most two buffers waiting to be consumed.  Raises a
+     MATLAB error, once all threads are done, if compute or consume threw.
+     */
+    template<typename BUF, typename G, typename COMPUTE, typename CONSUME>
+    void mexRunShots(mex_grid<G>& h, const size_t nShots,
+                     COMPUTE compute, CONSUME consume) {
+
+        const size_t nt = h.workers.size()-1;
+        std::vector<BUF> buffers(2*nt);
+        std::vector<size_t> freeBuffers;
+        for ( size_t i=buffers.size(); i>0; --i ) freeBuffers.push_back( i-1 );
+        std::deque<std::pair<size_t,size_t>> ready;   // source, buffer
+
+        std::mutex mtx;
+        std::condition_variable cv;
+        size_t next = 0;          // next source to raytrace
+        size_t running = nt;      // threads still raytracing
+        bool failed = false;
+        std::string what;
+
+        auto fail = [&failed, &what](const char *msg) {
+            if ( !failed ) what = msg;
+            failed = true;
+        };
+
+        // one task per thread of the grid, the task number being the
+        // thread number used to select the data of the grid
+        h.workers.start(nt, [&](const size_t threadNo) {
+            std::unique_lock<std::mutex> lock(mtx);
+            for ( ;; ) {
+                cv.wait(lock, [&]{ return next == nShots || failed || !freeBuffers.empty(); });
+                if ( next == nShots || failed ) break;
+                const size_t n = next++;
+                const size_t b = freeBuffers.back();
+                freeBuffers.pop_back();
+                lock.unlock();
+                try {
+                    compute(n, buffers[b], threadNo);
+                } catch (std::exception& e) {
+                    lock.lock();
+                    fail(e.what());
+                    break;
+                } catch (...) {
+                    lock.lock();
+                    fail("unknown error");
+                    break;
+                }
+                lock.lock();
+                ready.push_back( std::make_pair(n, b) );
+                cv.notify_all();
+            }
+            running--;
+            cv.notify_all();
+        });
+
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            for ( ;; ) {
+                cv.wait(lock, [&]{ return !ready.empty() || running == 0; });
+                if ( ready.empty() ) break;
+                const std::pair<size_t,size_t> r = ready.front();
+                ready.pop_front();
+                if ( !failed ) {
+                    lock.unlock();
+                    try {
+                        consume(r.first, buffers[r.second]);
+                        lock.lock();
+                    } catch (std::exception& e) {
+                        lock.lock();
+                        fail(e.what());
+                    }
+                }
+                freeBuffers.push_back( r.second );
+                cv.notify_all();
+            }
+        }
+        h.workers.wait();
+
+        if ( failed ) {
+            mexErrMsgTxt((std::string("Problem while raytracing: ")+what).c_str());
+        }
+    }
+
+    /*
+     raytrace command:  [tt, rays, L] = raytrace(s, Tx, Rx, t0)
+
+     BASE is the base class of the grid (Grid2D or Grid3D), through which
+     the per-source methods are called, S the type of points and LT the type
+     of the elements of L.
+     */
+    template<typename S, typename LT, typename BASE, typename G>
+    void mexRaytrace(mex_grid<G>& h, int nlhs, mxArray *plhs[],
+                     int nrhs, const mxArray *prhs[]) {
+
+        if ( nlhs > 3 ) {
+            mexErrMsgTxt("raytrace has a maximum of three output argument.");
+        }
+        mxShots<S> shots;
+        mxReadShots(h, nrhs, prhs, shots);
+        const size_t nRx = shots.nPairs;
+        const size_t nSlowness = h.nSlowness;
+        const BASE& g = *(h.grid);
+
+        plhs[0] = mxCreateDoubleMatrix(nRx, 1, mxREAL);
+        double *t_arr = mxGetPr(plhs[0]);
+        if ( nlhs >= 2 ) {
+            plhs[1] = mxCreateCellMatrix(nRx, 1);
+        }
+
+        // the rows of L are appended in the order the sources complete, and
+        // are put in compressed sparse columns once all are known
+        std::vector<size_t> rowStart( nlhs == 3 ? nRx+1 : 0, 0 );
+        std::vector<size_t> rowEnd( nlhs == 3 ? nRx : 0, 0 );
+        std::vector<mwIndex> Lcol;
+        std::vector<double> Lv;
+        std::vector<mwIndex> count( nlhs == 3 ? nSlowness+1 : 0, 0 );
+
+        int outputs = BATCH_TT;
+        if ( nlhs >= 2 ) outputs |= BATCH_RAYS;
+        if ( nlhs == 3 ) outputs |= BATCH_L;
+
+        mexRunShots<shotData<double,S,LT>>(h, shots.Tx.size(),
+            [&](const size_t n, shotData<double,S,LT>& d, const size_t threadNo) {
+                raytraceShot(g, shots.Tx[n], shots.t0[n], shots.Rx[n], outputs, d, threadNo);
+                for ( size_t ni=0; ni<d.l_data.size(); ++ni ) {
+                    mxSortRow(d.l_data[ni], [](const LT& e) { return e.i; }, nSlowness);
+                }
+            },
+            [&](const size_t n, shotData<double,S,LT>& d) {
+                for ( size_t ni=0; ni<shots.iTx[n].size(); ++ni ) {
+                    const size_t i = shots.iTx[n][ni];
+                    t_arr[i] = d.tt[ni];
+                    if ( nlhs >= 2 ) {
+                        mxSetCell( plhs[1], i, mxCreateRay(d.r_data[ni]) );
+                    }
+                    if ( nlhs == 3 ) {
+                        const std::vector<LT>& row = d.l_data[ni];
+                        rowStart[i] = Lcol.size();
+                        for ( size_t k=0; k<row.size(); ++k ) {
+                            Lcol.push_back( row[k].i );
+                            Lv.push_back( row[k].v );
+                            count[ row[k].i+1 ]++;
+                        }
+                        rowEnd[i] = Lcol.size();
+                    }
+                }
+            });
+
+        if ( nlhs == 3 ) {
+            // compressed sparse columns, built by counting the elements of
+            // each column
+            plhs[2] = mxCreateSparse(nRx, nSlowness, Lcol.size(), mxREAL);
+            double *Lval = mxGetPr( plhs[2] );
+            mwIndex *irL = mxGetIr( plhs[2] );
+            mwIndex *jcL = mxGetJc( plhs[2] );
+            for ( size_t j=0; j<nSlowness; ++j ) {
+                count[j+1] += count[j];
+            }
+            std::memcpy(jcL, count.data(), (nSlowness+1)*sizeof(mwIndex));
+            for ( size_t i=0; i<nRx; ++i ) {   // rows in increasing order
+                for ( size_t k=rowStart[i]; k<rowEnd[i]; ++k ) {
+                    mwIndex kk = count[ Lcol[k] ]++;
+                    irL[kk] = i;
+                    Lval[kk] = Lv[k];
+                }
+            }
+        }
+    }
+
+    /*
+     raytrace command of the unstructured meshes:
+        [tt, rays, v0, M] = raytrace(s, Tx, Rx, t0)
+
+     v0 is the velocity at the source of each pair, and M holds one matrix
+     per source of partial derivatives with respect to slowness and to the
+     static corrections of the receivers of the source.  The per-source
+     methods are those of G, and S is the type of points.
+     */
+    template<typename S, typename G>
+    void mexRaytraceM(mex_grid<G>& h, int nlhs, mxArray *plhs[],
+                      int nrhs, const mxArray *prhs[]) {
+
+        if ( nlhs > 4 ) {
+            mexErrMsgTxt("raytrace has a maximum of four output argument.");
+        }
+        mxShots<S> shots;
+        mxReadShots(h, nrhs, prhs, shots);
+        const size_t nRx = shots.nPairs;
+        const size_t nSlowness = h.nSlowness;
+        const G& g = *(h.grid);
+
+        plhs[0] = mxCreateDoubleMatrix(nRx, 1, mxREAL);
+        double *t_arr = mxGetPr(plhs[0]);
+        if ( nlhs >= 2 ) {
+            plhs[1] = mxCreateCellMatrix(nRx, 1);
+        }
+        double *v0 = nullptr;
+        if ( nlhs >= 3 ) {
+            plhs[2] = mxCreateDoubleMatrix(nRx, 1, mxREAL);
+            v0 = mxGetPr(plhs[2]);
+        }
+        if ( nlhs >= 4 ) {
+            plhs[3] = mxCreateCellMatrix(shots.Tx.size(), 1);
+        }
+
+        mexRunShots<shotData<double,S,siv<double>>>(h, shots.Tx.size(),
+            [&](const size_t n, shotData<double,S,siv<double>>& d, const size_t threadNo) {
+                if ( nlhs == 4 ) {
+                    g.raytrace(shots.Tx[n], shots.t0[n], shots.Rx[n], d.tt,
+                               d.r_data, d.v0, d.m_data, threadNo);
+                    for ( size_t ni=0; ni<d.m_data.size(); ++ni ) {
+                        mxSortRow(d.m_data[ni], [](const sijv<double>& e) { return e.j; },
+                                  nSlowness);
+                    }
+                } else if ( nlhs == 3 ) {
+                    g.raytrace(shots.Tx[n], shots.t0[n], shots.Rx[n], d.tt,
+                               d.r_data, d.v0, threadNo);
+                } else if ( nlhs == 2 ) {
+                    g.raytrace(shots.Tx[n], shots.t0[n], shots.Rx[n], d.tt,
+                               d.r_data, threadNo);
+                } else {
+                    g.raytrace(shots.Tx[n], shots.t0[n], shots.Rx[n], d.tt, threadNo);
+                }
+            },
+            [&](const size_t n, shotData<double,S,siv<double>>& d) {
+                const size_t nRcv = shots.iTx[n].size();
+                for ( size_t ni=0; ni<nRcv; ++ni ) {
+                    const size_t i = shots.iTx[n][ni];
+                    t_arr[i] = d.tt[ni];
+                    if ( nlhs >= 2 ) {
+                        mxSetCell( plhs[1], i, mxCreateRay(d.r_data[ni]) );
+                    }
+                    if ( nlhs >= 3 ) v0[i] = d.v0;
+                }
+                if ( nlhs == 4 ) {
+                    // one column per slowness value, then one per receiver
+                    std::vector<mwIndex> jc( nSlowness+nRcv+1, 0 );
+                    for ( size_t ni=0; ni<nRcv; ++ni ) {
+                        for ( size_t k=0; k<d.m_data[ni].size(); ++k ) {
+                            jc[ d.m_data[ni][k].j+1 ]++;
+                        }
+                        jc[ nSlowness+ni+1 ]++;
+                    }
+                    for ( size_t j=0; j<nSlowness+nRcv; ++j ) {
+                        jc[j+1] += jc[j];
+                    }
+                    mxArray *M = mxCreateSparse(nRcv, nSlowness+nRcv, jc.back(), mxREAL);
+                    double *Mval = mxGetPr( M );
+                    mwIndex *irM = mxGetIr( M );
+                    std::memcpy(mxGetJc( M ), jc.data(), jc.size()*sizeof(mwIndex));
+                    for ( size_t ni=0; ni<nRcv; ++ni ) {   // rows in increasing order
+                        for ( size_t k=0; k<d.m_data[ni].size(); ++k ) {
+                            mwIndex kk = jc[ d.m_data[ni][k].j ]++;
+                            irM[kk] = ni;
+                            Mval[kk] = d.m_data[ni][k].v;
+                        }
+                        // derivative of t with respect to static correction
+                        mwIndex kk = jc[ nSlowness+ni ]++;
+                        irM[kk] = ni;
+                        Mval[kk] = 1.0;
+                    }
+                    mxSetCell( plhs[3], n, M );
+                }
+            });
+    }
+
+    // returns a scalar for the get_* commands
+    inline void mexScalar(const char *cmd, const double value,
+                          int nlhs, mxArray *plhs[], int nrhs) {
+        if ( nrhs > 2 ) {
+            mexErrMsgTxt((std::string(cmd)+": No arguments needed.").c_str());
+        }
+        if ( nlhs > 1 ) {
+            mexErrMsgTxt((std::string(cmd)+": has a maximum of one output argument.").c_str());
+        }
+        plhs[0] = mxCreateDoubleMatrix(1, 1, mxREAL);
+        *mxGetPr(plhs[0]) = value;
+    }
+}
+
+#endif // __MEX_RAYTRACE_HPP__
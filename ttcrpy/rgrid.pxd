@@ -1,7 +1,7 @@
 
 from libcpp.string cimport string
 from libcpp.vector cimport vector
-from libc.stdint cimport uint32_t, int64_t
+from libc.stdint cimport uint32_t, int64_t, uint64_t
 from libc.math cimport sqrt
 from libcpp cimport bool
 
@@ -24,13 +24,64 @@ cdef extern from "typedefs.h" namespace "ttcr":
         pass
 
 
+cdef extern from "StraightRays.h" namespace "ttcr" nogil:
+    void getStraightRayKernel[T1,T2](vector[sxyz[T1]]& Tx,
+                                     vector[sxyz[T1]]& Rx,
+                                     vector[T1]& grx,
+                                     vector[T1]& gry,
+                                     vector[T1]& grz,
+                                     vector[T2]& indptr,
+                                     vector[T2]& indices,
+                                     vector[T1]& data,
+                                     size_t nThreads) except +
+
+cdef extern from "FieldCache.h" namespace "ttcr" nogil:
+    cdef cppclass FieldCache[T1]:
+        size_t size()
+        size_t getNumberSpilled()
+        size_t getBytes()
+        size_t getHits()
+        size_t getSpillHits()
+        size_t getMisses()
+
 cdef extern from "Grid3D.h" namespace "ttcr" nogil:
     cdef cppclass Grid3D[T1,T2]:
         size_t getNthreads()
         void setSlowness(vector[T1]&) except +
         void getSlowness(vector[T1]&) except +
         T1 computeSlowness(sxyz[T1]&) except +
+        void setTempNodesCache(size_t) except +
+        void setEdgeTables(size_t) except +
+        bool hasEdgeTables()
+        void setFactored(bool) except +
+        void setWarmStart(bool, size_t) except +
+        void setTraveltimeSeed(vector[T1]& tt, vector[T1]& s,
+                               size_t threadNo) except +
+        int getNiter(size_t threadNo) except +
+        void setTraveltimeCache(size_t maxBytes, string& spillFile,
+                                size_t spillBytes) except +
+        const FieldCache[T1]* getTraveltimeCache()
         void getTT(vector[T1]& tt, size_t threadNo) except +
+        void getTraveltimes(vector[sxyz[T1]]& pts, T1* traveltimes,
+                            size_t threadNo) except +
+        void getMisfitGradient(vector[vector[sxyz[T1]]]& Tx,
+                               vector[vector[T1]]& t0,
+                               vector[vector[sxyz[T1]]]& Rx,
+                               vector[vector[T1]]& tobs,
+                               vector[vector[T1]]& traveltimes,
+                               vector[T1]& grad) except +
+        void raytraceLTr(vector[vector[sxyz[T1]]]& Tx,
+                         vector[vector[T1]]& t0,
+                         vector[vector[sxyz[T1]]]& Rx,
+                         vector[vector[T1]]& r,
+                         vector[vector[T1]]& traveltimes,
+                         vector[T1]& LTr) except +
+        void raytraceLx(vector[vector[sxyz[T1]]]& Tx,
+                        vector[vector[T1]]& t0,
+                        vector[vector[sxyz[T1]]]& Rx,
+                        vector[T1]& x,
+                        vector[vector[T1]]& traveltimes,
+                        vector[vector[T1]]& Lx) except +
         void raytrace(vector[sxyz[T1]]& Tx,
                       vector[T1]& t0,
                       vector[sxyz[T1]]& Rx,
@@ -107,13 +158,22 @@ cdef extern from "Grid3Drn.h" namespace "ttcr" nogil:
 
 cdef extern from "Grid3Drc.h" namespace "ttcr" nogil:
     cdef cppclass Grid3Drc[T1,T2,N](Grid3D[T1,T2]):
-        pass
+        void getStraightRayKernel(vector[sxyz[T1]]& Tx,
+                                  vector[sxyz[T1]]& Rx,
+                                  vector[T2]& indptr,
+                                  vector[T2]& indices,
+                                  vector[T1]& data) except +
 
 cdef extern from "Grid3Drnfs.h" namespace "ttcr" nogil:
     cdef cppclass Grid3Drnfs[T1,T2](Grid3Drn[T1,T2,Node3Dn[T1,T2]]):
         Grid3Drnfs(T2, T2, T2, T1, T1, T1, T1, T1, int, bool, bool, bool,
                    size_t) except +
 
+cdef extern from "Grid3Drnfm.h" namespace "ttcr" nogil:
+    cdef cppclass Grid3Drnfm[T1,T2](Grid3Drn[T1,T2,Node3Dn[T1,T2]]):
+        Grid3Drnfm(T2, T2, T2, T1, T1, T1, T1, bool, bool, bool,
+                   size_t) except +
+
 cdef extern from "Grid3Drnsp.h" namespace "ttcr" nogil:
     cdef cppclass Grid3Drnsp[T1,T2](Grid3Drn[T1,T2,Node3Dnsp[T1,T2]]):
         Grid3Drnsp(T2, T2, T2, T1, T1, T1, T1, T1, T1, T2, T2, T2, bool, bool,
@@ -129,6 +189,11 @@ cdef extern from "Grid3Drcfs.h" namespace "ttcr" nogil:
         Grid3Drcfs(T2, T2, T2, T1, T1, T1, T1, T1, int, bool, bool, bool,
                    size_t) except +
 
+cdef extern from "Grid3Drcfm.h" namespace "ttcr" nogil:
+    cdef cppclass Grid3Drcfm[T1,T2](Grid3Drn[T1,T2,Node3Dn[T1,T2]]):
+        Grid3Drcfm(T2, T2, T2, T1, T1, T1, T1, bool, bool, bool,
+                   size_t) except +
+
 cdef extern from "Grid3Drcsp.h" namespace "ttcr" nogil:
     cdef cppclass Grid3Drcsp[T1,T2,CELL](Grid3Drc[T1,T2,Node3Dcsp[T1,T2]]):
         Grid3Drcsp(T2, T2, T2, T1, T1, T1, T1, T1, T1, T2, T2, T2, bool,
@@ -139,6 +204,84 @@ cdef extern from "Grid3Drcdsp.h" namespace "ttcr" nogil:
         Grid3Drcdsp(T2, T2, T2, T1, T1, T1, T1, T1, T1, T2, bool, T2, T1,
                     size_t) except +
 
+cdef extern from "Bricks.h" namespace "ttcr" nogil:
+    cdef cppclass brickHeader:
+        brickHeader()
+        uint32_t nv[3]
+        uint32_t bs
+        uint32_t cells
+        double d[3]
+        double min[3]
+    cdef cppclass BrickWriter:
+        BrickWriter(string&, brickHeader&) except +
+        void addPlane(vector[double]&) except +
+        void close() except +
+    cdef cppclass BrickStore[T1]:
+        size_t getCacheSize()
+        size_t getHits()
+        size_t getMisses()
+
+cdef extern from "Grid3Drtiled.h" namespace "ttcr" nogil:
+    cdef enum raytracing_method:
+        SHORTEST_PATH, FAST_MARCHING, FAST_SWEEPING
+    cdef cppclass windowGrid3Dr[T1,T2]:
+        windowGrid3Dr(raytracing_method, uint32_t, uint32_t, uint32_t, T1, int,
+                      bool, bool, bool) except +
+    cdef cppclass Grid3Drtiled[T1,T2](Grid3D[T1,T2]):
+        Grid3Drtiled(string&, windowGrid3Dr[T1,T2]&, T1, size_t, bool,
+                     size_t) except +
+        BrickStore[T1]& getStore()
+        T1 getXmin()
+        T1 getXmax()
+        T1 getYmin()
+        T1 getYmax()
+        T1 getZmin()
+        T1 getZmax()
+
+
+cdef extern from "RayPaths.h" namespace "ttcr" nogil:
+    cdef cppclass RayPaths[T,T2]:
+        RayPaths() except +
+        void append(vector[sxyz[double]]&) except +
+        size_t size() const
+        size_t getNumberOfPoints() const
+        const vector[uint64_t]& getOffsets() const
+        const vector[T]& getCoordinates() const
+        void saveVTP(string&) except +
+        void saveBinary(string&) except +
+        void loadBinary(string&) except +
+
+
+cdef extern from "ShotProcesses.h" namespace "ttcr" nogil:
+    void raytraceProcesses(Grid3D[double,uint32_t]&,
+                           vector[vector[sxyz[double]]]&,
+                           vector[vector[double]]&,
+                           vector[vector[sxyz[double]]]&,
+                           vector[vector[double]]&, size_t) except +
+
+
+cdef extern from "Ensemble.h" namespace "ttcr" nogil:
+    cdef cppclass Ensemble[T1,T2]:
+        Ensemble(Grid3D[T1,T2]&) except +
+        void addModel(vector[T1]&) except +
+        size_t size()
+        void raytrace(vector[vector[sxyz[T1]]]& Tx,
+                      vector[vector[T1]]& t0,
+                      vector[sxyz[T1]]& Rx,
+                      T1* tt, size_t nThreads) except +
+
+
+cdef extern from "MultiPhase.h" namespace "ttcr" nogil:
+    cdef cppclass MultiPhase[T1,S,G]:
+        MultiPhase(G&, vector[vector[S]]&, vector[vector[size_t]]&) except +
+        void setReciprocalTables(int)
+        size_t getNlegs()
+        void raytrace(vector[vector[S]]& Tx,
+                      vector[vector[T1]]& t0,
+                      vector[S]& Rx,
+                      vector[vector[vector[T1]]]& tt,
+                      size_t nThreads) except +
+
 
 cdef extern from "Grid2D.h" namespace "ttcr" nogil:
     cdef cppclass Grid2D[T1,T2,S]:
@@ -152,7 +295,11 @@ cdef extern from "Grid2D.h" namespace "ttcr" nogil:
         void setDelta(vector[T1]&) except +
         void setEpsilon(vector[T1]&) except +
         void setGamma(vector[T1]&) except +
+        void setEdgeTables(size_t) except +
+        bool hasEdgeTables()
         void getTT(vector[T1]& tt, size_t threadNo) except +
+        void getTraveltimes(vector[S]& pts, T1* traveltimes,
+                            size_t threadNo) except +
         void raytrace(vector[S]& Tx,
                       vector[T1]& t0,
                       vector[S]& Rx,
@@ -214,6 +361,10 @@ cdef extern from "Grid2Drcfs.h" namespace "ttcr" nogil:
     cdef cppclass Grid2Drcfs[T1,T2,S](Grid2Drn[T1,T2,S,Node2Dn[T1,T2]]):
         Grid2Drcfs(T2, T2, T1, T1, T1, T1, T1, int, bool, bool, size_t) except +
 
+cdef extern from "Grid2Drcfm.h" namespace "ttcr" nogil:
+    cdef cppclass Grid2Drcfm[T1,T2,S](Grid2Drn[T1,T2,S,Node2Dn[T1,T2]]):
+        Grid2Drcfm(T2, T2, T1, T1, T1, T1, bool, size_t) except +
+
 cdef extern from "Grid2Drnsp.h" namespace "ttcr" nogil:
     cdef cppclass Grid2Drnsp[T1,T2,S](Grid2Drn[T1,T2,S,node2d]):
         Grid2Drnsp(T2, T2, T1, T1, T1, T1, T2, T2, size_t) except +
@@ -221,3 +372,7 @@ cdef extern from "Grid2Drnsp.h" namespace "ttcr" nogil:
 cdef extern from "Grid2Drnfs.h" namespace "ttcr" nogil:
     cdef cppclass Grid2Drnfs[T1,T2,S](Grid2Drn[T1,T2,S,Node2Dn[T1,T2]]):
         Grid2Drnfs(T2, T2, T1, T1, T1, T1, T1, int, bool, bool, size_t) except +
+
+cdef extern from "Grid2Drnfm.h" namespace "ttcr" nogil:
+    cdef cppclass Grid2Drnfm[T1,T2,S](Grid2Drn[T1,T2,S,Node2Dn[T1,T2]]):
+        Grid2Drnfm(T2, T2, T1, T1, T1, T1, bool, size_t) except +
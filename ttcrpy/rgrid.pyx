@@ -2,10 +2,11 @@
 """
 Raytracing on rectilinear grids
 
-This module contains two classes to perform traveltime computation and
+This module contains three classes to perform traveltime computation and
 raytracing on rectilinear grids:
     - `Grid2d` for 2D media
     - `Grid3d` for 3D media
+    - `TiledGrid3d` for 3D media with slowness stored in a brick file
 
 Two general algorithms are implemented
     - the Shortest-Path Method
@@ -28,9 +29,12 @@ import scipy.sparse as sp
 import vtk
 from vtk.util import numpy_support
 
-from ttcrpy.rgrid cimport Grid3D, Grid3Drcfs, Grid3Drcsp, Grid3Drcdsp, \
-    Grid3Drnfs, Grid3Drnsp, Grid3Drndsp, Grid2D, Grid2Drc, Grid2Drn, \
-    Grid2Drcsp, Grid2Drcfs, Grid2Drnsp, Grid2Drnfs
+from ttcrpy.rgrid cimport Grid3D, Grid3Drcfs, Grid3Drcfm, Grid3Drcsp, \
+    Grid3Drcdsp, Grid3Drnfs, Grid3Drnfm, Grid3Drnsp, Grid3Drndsp, Grid2D, \
+    Grid2Drc, Grid2Drn, Grid2Drcsp, Grid2Drcfs, Grid2Drcfm, Grid2Drnsp, \
+    Grid2Drnfs, Grid2Drnfm, getStraightRayKernel, MultiPhase, RayPaths, \
+    raytraceProcesses, Ensemble, FieldCache, brickHeader, BrickWriter, \
+    Grid3Drtiled, windowGrid3Dr, SHORTEST_PATH, FAST_MARCHING, FAST_SWEEPING
 
 cdef extern from "verbose.h" namespace "ttcr" nogil:
     void setVerbose(int)
@@ -46,6 +50,106 @@ def set_verbose(v):
     """
     setVerbose(v)
 
+cdef _csr_from_vectors(vector[int64_t]& indptr, vector[int64_t]& indices,
+                       vector[double]& data, shape):
+    if data.size() == 0:
+        return sp.csr_matrix(shape)
+    return sp.csr_matrix((np.asarray(<double[:data.size()]>data.data()).copy(),
+                          np.asarray(<int64_t[:indices.size()]>indices.data()).copy(),
+                          np.asarray(<int64_t[:indptr.size()]>indptr.data()).copy()),
+                         shape=shape)
+
+
+cdef _rays_to_arrays(RayPaths[float, uint32_t]& rp):
+    cdef size_t i, npts
+    cdef const float* c
+    cdef float[::1] cv
+    offsets = np.empty((rp.size()+1,), dtype=np.int64)
+    for i in range(rp.size()+1):
+        offsets[i] = rp.getOffsets()[i]
+    npts = rp.getNumberOfPoints()
+    if npts == 0:
+        return offsets, np.empty((0, 3), dtype=np.float32)
+    c = rp.getCoordinates().data()
+    coords = np.empty((3*npts,), dtype=np.float32)
+    cv = coords
+    for i in range(3*npts):
+        cv[i] = c[i]
+    return offsets, coords.reshape((npts, 3))
+
+cdef _flat_rays(vector[vector[vector[sxyz[double]]]]& r_data, iRx, size_t nrcv):
+    # raypaths packed in the order of rcv: ray i has points
+    # coords[offsets[i]:offsets[i+1], :]
+    cdef RayPaths[float, uint32_t] rp
+    cdef size_t i, n, nt
+    ind = np.empty((nrcv, 2), dtype=np.int64)
+    for n in range(len(iRx)):
+        for nt in range(len(iRx[n])):
+            ind[iRx[n][nt], 0] = n
+            ind[iRx[n][nt], 1] = nt
+    for i in range(nrcv):
+        n = ind[i, 0]
+        nt = ind[i, 1]
+        rp.append(r_data[n][nt])
+    return _rays_to_arrays(rp)
+
+def save_rays(filename, offsets, coords):
+    """
+    save_rays(filename, offsets, coords)
+
+    Save raypaths packed in two arrays, as returned by raytrace with
+    return_rays='flat'
+
+    Parameters
+    ----------
+    filename : str
+        name of file; raypaths are saved in VTK XML PolyData format if the
+        extension is .vtp, and in the binary format of ttcr otherwise
+    offsets : np.ndarray
+        points of ray i are coords[offsets[i]:offsets[i+1], :]
+    coords : np.ndarray, shape (npts, 3)
+        coordinates of points
+    """
+    cdef RayPaths[float, uint32_t] rp
+    cdef vector[sxyz[double]] ray
+    cdef size_t i, n
+    offsets = np.asarray(offsets, dtype=np.int64)
+    coords = np.asarray(coords, dtype=np.double)
+    if coords.ndim != 2 or coords.shape[1] != 3 or offsets[-1] != coords.shape[0]:
+        raise ValueError('coords should be npts x 3, npts being offsets[-1]')
+    for n in range(offsets.size-1):
+        ray.clear()
+        for i in range(offsets[n], offsets[n+1]):
+            ray.push_back(sxyz[double](coords[i, 0], coords[i, 1], coords[i, 2]))
+        rp.append(ray)
+    if filename.endswith('.vtp'):
+        rp.saveVTP(filename.encode('utf-8'))
+    else:
+        rp.saveBinary(filename.encode('utf-8'))
+
+def load_rays(filename):
+    """
+    load_rays(filename) -> offsets, coords
+
+    Load raypaths saved in the binary format of ttcr (see save_rays)
+
+    Parameters
+    ----------
+    filename : str
+        name of file
+
+    Returns
+    -------
+    offsets : np.ndarray
+        points of ray i are coords[offsets[i]:offsets[i+1], :]
+    coords : np.ndarray, shape (npts, 3)
+        coordinates of points
+    """
+    cdef RayPaths[float, uint32_t] rp
+    rp.loadBinary(filename.encode('utf-8'))
+    return _rays_to_arrays(rp)
+
+
 cdef class Grid3d:
     """
     class to perform raytracing with 3D rectilinear grids
@@ -75,7 +179,8 @@ cdef class Grid3d:
 
     Grid3d(x, y, z, n_threads=1, cell_slowness=1, method='FSM', tt_from_rp=1,
            interp_vel=0, eps=1.e-15, maxit=20, weno=1, nsnx=5, nsny=5, nsnz=5,
-           n_secondary=2, n_tertiary=2, radius_tertiary=1.0) -> Grid3d
+           n_secondary=2, n_tertiary=2, radius_tertiary=1.0,
+           factored=0) -> Grid3d
 
         Parameters
         ----------
@@ -91,7 +196,8 @@ cdef class Grid3d:
             slowness defined for cells (True) or nodes (False) (default is 1)
         method : string
             raytracing method (default is FSM)
-                - 'FSM' : fast marching method
+                - 'FSM' : fast sweeping method
+                - 'FMM' : fast marching method
                 - 'SPM' : shortest path method
                 - 'DSPM' : dynamic shortest path
         tt_from_rp : bool
@@ -104,8 +210,8 @@ cdef class Grid3d:
         maxit : int
             max number of sweeping iterations (FSM) (default is 20)
         weno : bool
-            use 3rd order weighted essentially non-oscillatory operator (FSM)
-            (default is True)
+            use 3rd order weighted essentially non-oscillatory operator (FSM),
+            or 2nd order upwind stencil (FMM) (default is True)
         nsnx : int
             number of secondary nodes in x (SPM) (default is 5)
         nsny : int
@@ -118,7 +224,12 @@ cdef class Grid3d:
             number of tertiary nodes (DSPM) (default is 2)
         radius_tertiary : double
             radius of sphere around source that includes tertiary nodes (DSPM)
-            (default is 1)
+            (default is 1).  See set_tertiary_nodes_cache to reuse them when
+            raytracing again from the same source positions.
+        factored : bool
+            solve the factored eikonal equation, which removes the error due
+            to the curvature of the wavefront near the source (FSM & FMM,
+            single source) (default is False)
     """
     cdef vector[double] _x
     cdef vector[double] _y
@@ -140,6 +251,7 @@ cdef class Grid3d:
     cdef uint32_t n_secondary
     cdef uint32_t n_tertiary
     cdef double radius_tertiary
+    cdef bool factored
     cdef Grid3D[double, uint32_t]* grid
 
     def __cinit__(self, np.ndarray[np.double_t, ndim=1] x,
@@ -151,7 +263,7 @@ cdef class Grid3d:
                   double eps=1.e-15, int maxit=20, bool weno=1,
                   uint32_t nsnx=5, uint32_t nsny=5, uint32_t nsnz=5,
                   uint32_t n_secondary=2, uint32_t n_tertiary=2,
-                  double radius_tertiary=1.0):
+                  double radius_tertiary=1.0, bool factored=0):
 
         cdef uint32_t nx = x.size-1
         cdef uint32_t ny = y.size-1
@@ -175,10 +287,11 @@ cdef class Grid3d:
         self.n_secondary = n_secondary
         self.n_tertiary = n_tertiary
         self.radius_tertiary = radius_tertiary
+        self.factored = factored
 
-        if method == 'FSM':
+        if method == 'FSM' or method == 'FMM':
             if np.abs(self._dx - self._dy)>0.000001 or np.abs(self._dx - self._dz)>0.000001:
-                raise ValueError('FSM: Grid cells must be cubic')
+                raise ValueError('{0:s}: Grid cells must be cubic'.format(method))
 
         for val in x:
             self._x.push_back(val)
@@ -198,6 +311,12 @@ cdef class Grid3d:
                                                             eps, maxit, weno,
                                                             tt_from_rp, interp_vel,
                                                             n_threads)
+            elif method == 'FMM':
+                self.method = b'm'
+                self.grid = new Grid3Drcfm[double,uint32_t](nx, ny, nz, self._dx,
+                                                            xmin, ymin, zmin,
+                                                            weno, tt_from_rp,
+                                                            interp_vel, n_threads)
             elif method == 'SPM':
                 self.method = b's'
                 self.grid = new Grid3Drcsp[double,uint32_t,Cell[double,Node3Dcsp[double,uint32_t],sxyz[double]]](nx, ny, nz,
@@ -224,6 +343,12 @@ cdef class Grid3d:
                                                             eps, maxit, weno,
                                                             tt_from_rp, interp_vel,
                                                             n_threads)
+            elif method == 'FMM':
+                self.method = b'm'
+                self.grid = new Grid3Drnfm[double,uint32_t](nx, ny, nz, self._dx,
+                                                            xmin, ymin, zmin,
+                                                            weno, tt_from_rp,
+                                                            interp_vel, n_threads)
             elif method == 'SPM':
                 self.method = b's'
                 self.grid = new Grid3Drnsp[double,uint32_t](nx, ny, nz,
@@ -243,12 +368,17 @@ cdef class Grid3d:
             else:
                 raise ValueError('Method {0:s} undefined'.format(method))
 
+        if factored:
+            self.grid.setFactored(True)
+
     def __dealloc__(self):
         del self.grid
 
     def __reduce__(self):
         if self.method == b'f':
             method = 'FSM'
+        elif self.method == b'm':
+            method = 'FMM'
         elif self.method == b's':
             method = 'SPM'
         elif self.method == b'd':
@@ -258,7 +388,7 @@ cdef class Grid3d:
                               self.tt_from_rp, self.interp_vel, self.eps,
                               self.maxit, self.weno, self.nsnx, self.nsny,
                               self.nsnz, self.n_secondary, self.n_tertiary,
-                              self.radius_tertiary)
+                              self.radius_tertiary, self.factored)
         return (_rebuild3d, (self.x, self.y, self.z, constructor_params))
 
     @property
@@ -369,6 +499,202 @@ cdef class Grid3d:
         shape = (self._x.size(), self._y.size(), self._z.size())
         return tt.reshape(shape)
 
+    def set_warm_start(self, warm_start, size_t max_bytes=268435456):
+        """
+        set_warm_start(warm_start, max_bytes=268435456)
+
+        Keep the traveltimes computed for each source, and start the next
+        computation for the same source from them rather than from infinity
+        (FSM), which saves sweeps when the model changes little, e.g.
+        between iterations of an inversion.  Traveltimes are scaled by the
+        largest increase of slowness, so that they remain upper bounds of
+        the new ones.  If slowness did not increase, only the nodes where it
+        changed and their neighbours are updated at first.  Traveltimes and
+        slowness of all nodes are kept for each source, up to max_bytes
+        (least recently used sources are dropped first), and are discarded
+        when warm_start is False.
+
+        Parameters
+        ----------
+        warm_start : bool
+        max_bytes : int
+            maximum size of the kept fields, in bytes
+        """
+        self.grid.setWarmStart(warm_start, max_bytes)
+
+    def set_traveltime_seed(self, tt, thread_no=0):
+        """
+        set_traveltime_seed(tt, thread_no=0)
+
+        Start the next computation in thread thread_no from traveltimes tt
+        rather than from infinity (FSM).  All nodes are updated.
+
+        Parameters
+        ----------
+        tt : np ndarray, shape (nx, ny, nz)
+            traveltimes at primary grid nodes, as returned by
+            get_grid_traveltimes
+        thread_no : int
+            thread of the next computation (default is 0)
+        """
+        if thread_no >= self._n_threads:
+            raise ValueError('Thread number is larger than number of threads')
+        if tt.size != self._x.size()*self._y.size()*self._z.size():
+            raise ValueError('tt has wrong size')
+        cdef vector[double] vtt
+        cdef vector[double] vs
+        cdef double[::1] tt_view = np.ascontiguousarray(tt, dtype=np.double).ravel()
+        cdef size_t n
+        for n in range(tt_view.shape[0]):
+            vtt.push_back(tt_view[n])
+        self.grid.setTraveltimeSeed(vtt, vs, thread_no)
+
+    def get_niter(self, thread_no=0):
+        """
+        get_niter(thread_no=0)
+
+        Number of sweeping iterations of the last computation in thread
+        thread_no (FSM)
+
+        Parameters
+        ----------
+        thread_no : int
+            thread used to computed traveltimes (default is 0)
+
+        Returns
+        -------
+        niter : int
+        """
+        if thread_no >= self._n_threads:
+            raise ValueError('Thread number is larger than number of threads')
+        return self.grid.getNiter(thread_no)
+
+    def set_tertiary_nodes_cache(self, n_sources):
+        """
+        set_tertiary_nodes_cache(n_sources)
+
+        Keep the tertiary nodes built around the last n_sources sources of
+        each thread (DSPM), so that they are reused when raytracing again
+        from the same positions, e.g. at each iteration of an inversion.
+        Each source holds about as many nodes as its sphere of tertiary
+        nodes; the least recently used are dropped first.
+
+        Parameters
+        ----------
+        n_sources : int
+            number of sources whose nodes are kept, 0 (the default) to
+            keep only those of the last source
+        """
+        self.grid.setTempNodesCache(n_sources)
+
+    def set_edge_tables(self, size_t max_bytes):
+        """
+        set_edge_tables(max_bytes)
+
+        Set memory budget of the tables of lengths of the edges joining the
+        nodes of the cells, used by the SPM.  Lengths are computed on the
+        fly if tables would take more than the budget.
+
+        Parameters
+        ----------
+        max_bytes : int
+            memory budget (256 MB when grid is built), 0 disables tables
+        """
+        self.grid.setEdgeTables(max_bytes)
+
+    def has_edge_tables(self):
+        """
+        Returns
+        -------
+        bool:
+            True if tables of edge lengths are used (see set_edge_tables)
+        """
+        return self.grid.hasEdgeTables()
+
+    def set_traveltime_cache(self, max_bytes, spill_file=None, spill_bytes=0):
+        """
+        set_traveltime_cache(max_bytes, spill_file=None, spill_bytes=0)
+
+        Keep the traveltimes computed at the nodes for each source, so that
+        raytrace only has to interpolate them at the receivers when called
+        again for the same source (coordinates and t0) and slowness.  The
+        cache is emptied when slowness is set.
+
+        Parameters
+        ----------
+        max_bytes : int
+            size of the cache in memory, the least recently used traveltimes
+            being discarded first.  0 disables the cache.
+        spill_file : str
+            memory-mapped file where traveltimes discarded from memory are
+            moved (default is None, discarded traveltimes are lost).  The
+            file is removed when the cache is disabled.
+        spill_bytes : int
+            size of spill_file
+        """
+        cdef string fname
+        if spill_file is not None:
+            fname = spill_file.encode('utf-8')
+        self.grid.setTraveltimeCache(max_bytes, fname, spill_bytes)
+
+    def get_traveltime_cache_stats(self):
+        """
+        get_traveltime_cache_stats()
+
+        Usage of the traveltime cache
+
+        Returns
+        -------
+        stats : dict
+            'size': number of traveltime fields in memory,
+            'spilled': number of fields in spill file,
+            'bytes': memory used by fields,
+            'hits', 'spill_hits', 'misses': number of calls to raytrace that
+            found the fields in memory, in the spill file, or not at all.
+            None if the cache is disabled.
+        """
+        cdef const FieldCache[double]* c = self.grid.getTraveltimeCache()
+        if c == NULL:
+            return None
+        return {'size': c.size(), 'spilled': c.getNumberSpilled(),
+                'bytes': c.getBytes(), 'hits': c.getHits(),
+                'spill_hits': c.getSpillHits(), 'misses': c.getMisses()}
+
+    def get_tt_at(self, pts, thread_no=0):
+        """
+        get_tt_at(pts, thread_no=0)
+
+        Obtain traveltimes at arbitrary points, from the traveltimes computed
+        by the last call to raytrace performed with thread "thread_no"
+
+        Parameters
+        ----------
+        pts : np ndarray, shape (npts, 3)
+            coordinates of points
+        thread_no : int
+            thread used to computed traveltimes (default is 0)
+
+        Returns
+        -------
+        tt: np ndarray, shape (npts,)
+            traveltimes
+        """
+        if thread_no >= self._n_threads:
+            raise ValueError('Thread number is larger than number of threads')
+        pts = np.atleast_2d(np.asarray(pts, dtype=np.double))
+        if pts.ndim != 2 or pts.shape[1] != 3:
+            raise ValueError('pts should be npts x 3')
+        cdef vector[sxyz[double]] vpts
+        cdef size_t n
+        vpts.reserve(pts.shape[0])
+        for n in range(pts.shape[0]):
+            vpts.push_back(sxyz[double](pts[n, 0], pts[n, 1], pts[n, 2]))
+        tt = np.empty((pts.shape[0],))
+        cdef double[::1] tt_view = tt
+        if vpts.size() > 0:
+            self.grid.getTraveltimes(vpts, &tt_view[0], thread_no)
+        return tt
+
     def ind(self, i, j, k):
         """
         ind(i, j, k)
@@ -749,11 +1075,13 @@ cdef class Grid3d:
 
     def raytrace(self, source, rcv, slowness=None, thread_no=None,
                  aggregate_src=False, compute_L=False, compute_M=False,
-                 return_rays=False):
+                 return_rays=False, tt_obs=None, residuals=None, model=None,
+                 n_procs=1):
         """
         raytrace(source, rcv, slowness=None, thread_no=None,
                  aggregate_src=False, compute_L=False, compute_M=False,
-                 return_rays=False) -> tt, rays, M, L
+                 return_rays=False, tt_obs=None, residuals=None,
+                 model=None, n_procs=1) -> tt, rays, M, L
 
         Perform raytracing
 
@@ -778,8 +1106,27 @@ cdef class Grid3d:
         compute_M : bool (False by default)
             Compute matrices of partial derivative of travel time w/r to velocity
             Note : compute_M and compute_L are mutually exclusive
-        return_rays : bool (False by default)
-            Return raypaths
+        return_rays : bool or 'flat' (False by default)
+            Return raypaths; with 'flat', raypaths are packed in two arrays
+        tt_obs : np.ndarray (None by default)
+            observed travel times, one value per row of rcv.  If given, the
+            gradient of the misfit 0.5*sum((tt-tt_obs)**2) with respect to
+            slowness is computed with the adjoint-state method and returned
+            along with tt, without building rays or L (FSM and FMM only)
+        residuals : np.ndarray (None by default)
+            (weighted) residuals, one value per row of rcv.  If given, L^T r
+            is accumulated while the raypaths are traced and returned along
+            with tt, without building L (slowness defined for cells only)
+        model : np.ndarray (None by default)
+            vector of cell values x, with the shape of the slowness.  If
+            given, L x is computed while the raypaths are traced and returned
+            along with tt, without building L (slowness defined for cells
+            only)
+        n_procs : int (1 by default)
+            Number of processes sharing the sources, when only travel times
+            are computed.  The grid is shared by the processes without being
+            copied, and each process uses thread 0 of the grid (POSIX
+            systems only, sources are processed sequentially otherwise)
 
         Returns
         -------
@@ -787,6 +1134,8 @@ cdef class Grid3d:
             travel times for the appropriate source-rcv  (see Notes below)
         rays : :obj:`list` of :obj:`np.ndarray`
             Coordinates of segments forming raypaths (if return_rays is True)
+            If return_rays is 'flat', tuple (offsets, coords) where the points
+            of ray i are coords[offsets[i]:offsets[i+1], :]
         M : :obj:`list` of :obj:`csr_matrix`
             matrices of partial derivative of travel time w/r to velocity.
             the number of matrices is equal to the number of sources
@@ -795,6 +1144,13 @@ cdef class Grid3d:
             if input argument source has 5 columns, L is a list of matrices and
             the number of matrices is equal to the number of sources
             otherwise, L is a single csr_matrix
+        grad : np.ndarray
+            gradient of the misfit w/r to slowness, flattened in 'C' order
+            (if tt_obs is given)
+        LTr : np.ndarray
+            L^T r, flattened in 'C' order (if residuals is given)
+        Lx : np.ndarray
+            L x, one value per row of rcv (if model is given)
 
         Notes
         -----
@@ -834,6 +1190,33 @@ cdef class Grid3d:
         if compute_L and not self.cell_slowness:
             raise NotImplementedError('compute_L defined only for grids with slowness defined for cells')
 
+        if tt_obs is not None:
+            if compute_L or compute_M or return_rays:
+                raise ValueError('tt_obs cannot be used with compute_L, compute_M or return_rays')
+            if self.method != b'f' and self.method != b'm':
+                raise NotImplementedError('misfit gradient available only with FSM and FMM')
+            tt_obs = np.asarray(tt_obs).flatten()
+            if tt_obs.size != rcv.shape[0]:
+                raise ValueError('tt_obs and rcv should have the same number of rows')
+
+        if residuals is not None or model is not None:
+            if compute_L or compute_M or return_rays or tt_obs is not None:
+                raise ValueError('residuals and model cannot be used with compute_L, compute_M, return_rays or tt_obs')
+            if residuals is not None and model is not None:
+                raise ValueError('residuals and model are mutually exclusive')
+            if not self.cell_slowness:
+                raise NotImplementedError('residuals and model defined only for grids with slowness defined for cells')
+            if residuals is not None:
+                residuals = np.asarray(residuals, dtype=np.double).flatten()
+                if residuals.size != rcv.shape[0]:
+                    raise ValueError('residuals and rcv should have the same number of rows')
+            else:
+                model = np.asarray(model, dtype=np.double)
+                if model.size != self.nparams:
+                    raise ValueError('model has wrong size')
+                # parameters are stored in 'F' order
+                model = model.reshape(self.shape).flatten('F')
+
         evID = None
         if source.shape[1] == 5:
             src = source[:,2:5]
@@ -875,6 +1258,10 @@ cdef class Grid3d:
         cdef vector[vector[vector[sxyz[double]]]] r_data
         cdef vector[vector[vector[siv[double]]]] l_data
         cdef vector[vector[vector[sijv[double]]]] m_data
+        cdef vector[vector[double]] vtobs
+        cdef vector[double] grad
+        cdef vector[double] vx
+        cdef vector[vector[double]] vLx
         cdef size_t thread_nb
 
         cdef int i, j, k, n, nn, MM, NN
@@ -957,7 +1344,51 @@ cdef class Grid3d:
         #     print('  size of tt = ',vtt[n].size())
 
         tt = np.zeros((rcv.shape[0],))
-        if nTx < self._n_threads or self._n_threads == 1:
+        if tt_obs is not None:
+            vtobs.resize(nTx)
+            for n in range(nTx):
+                for nt in iRx[n]:
+                    vtobs[n].push_back(tt_obs[nt])
+            self.grid.getMisfitGradient(vTx, vt0, vRx, vtobs, vtt, grad)
+            for n in range(nTx):
+                for nt in range(vtt[n].size()):
+                    tt[iRx[n][nt]] = vtt[n][nt]
+            g = np.empty((grad.size(),))
+            for n in range(grad.size()):
+                g[n] = grad[n]
+            # parameters are stored in 'F' order
+            return tt, g.reshape(self.shape, order='F').flatten()
+
+        if residuals is not None:
+            vtobs.resize(nTx)
+            for n in range(nTx):
+                for nt in iRx[n]:
+                    vtobs[n].push_back(residuals[nt])
+            self.grid.raytraceLTr(vTx, vt0, vRx, vtobs, vtt, grad)
+            for n in range(nTx):
+                for nt in range(vtt[n].size()):
+                    tt[iRx[n][nt]] = vtt[n][nt]
+            g = np.empty((grad.size(),))
+            for n in range(grad.size()):
+                g[n] = grad[n]
+            return tt, g.reshape(self.shape, order='F').flatten()
+
+        if model is not None:
+            for n in range(model.size):
+                vx.push_back(model[n])
+            self.grid.raytraceLx(vTx, vt0, vRx, vx, vtt, vLx)
+            Lx = np.empty((rcv.shape[0],))
+            for n in range(nTx):
+                for nt in range(vtt[n].size()):
+                    tt[iRx[n][nt]] = vtt[n][nt]
+                    Lx[iRx[n][nt]] = vLx[n][nt]
+            return tt, Lx
+
+        if n_procs > 1 and nTx > 1 and thread_no is None and \
+                compute_L==False and compute_M==False and return_rays==False:
+            raytraceProcesses(self.grid[0], vTx, vt0, vRx, vtt, n_procs)
+
+        elif nTx < self._n_threads or self._n_threads == 1:
             if compute_L==False and compute_M==False and return_rays==False:
                 for n in range(nTx):
                     self.grid.raytrace(vTx[n], vt0[n], vRx[n], vtt[n], 0)
@@ -989,6 +1420,9 @@ cdef class Grid3d:
                 self.grid.raytrace(vTx[0], vt0[0], vRx[0], vtt[0], r_data[0], thread_nb)
                 for nt in range(vtt[0].size()):
                     tt[nt] = vtt[0][nt]
+                if return_rays == 'flat':
+                    return tt, _flat_rays(r_data, [np.arange(vRx[0].size())],
+                                          vRx[0].size())
                 rays = []
                 for n2 in range(vRx.size()):
                     r = np.empty((r_data[0][n2].size(), 3))
@@ -1023,7 +1457,9 @@ cdef class Grid3d:
             for nt in range(vtt[n].size()):
                 tt[iRx[n][nt]] = vtt[n][nt]
 
-        if return_rays:
+        if return_rays == 'flat':
+            rays = _flat_rays(r_data, iRx, rcv.shape[0])
+        elif return_rays:
             rays = [ [0.0] for n in range(rcv.shape[0])]
             for n in range(nTx):
                 r = [ [0.0] for i in range(vRx[n].size())]
@@ -1111,6 +1547,188 @@ cdef class Grid3d:
         else:
             return tt, rays
 
+    def raytrace_phases(self, source, rcv, interfaces, phases, slowness=None,
+                        reciprocal=None):
+        """
+        raytrace_phases(source, rcv, interfaces, phases, slowness=None,
+                        reciprocal=None) -> tt
+
+        Compute traveltimes of multi-leg phases (e.g. reflections)
+
+        Parameters
+        ----------
+        source : 2D np.ndarray with 3 or 4 columns
+            one row per source, columns are x, y and z coordinates, with
+            origin time in the 1st column if 4 columns are given
+        rcv : 2D np.ndarray with 3 columns
+            coordinates of receivers, common to all sources
+        interfaces : :obj:`list` of 2D np.ndarray with 3 columns
+            coordinates of points discretizing each interface
+        phases : :obj:`list` of sequences of int
+            indices of the interfaces visited by each phase, between source
+            and receivers; an empty sequence corresponds to the direct wave
+        slowness : np ndarray, (None by default)
+            if None, slowness must have been assigned previously
+        reciprocal : bool (None by default)
+            compute the last leg of the phases from receiver-interface
+            tables; if None, tables are used if there are fewer receivers
+            than sources
+
+        Returns
+        -------
+        tt : np.ndarray of size nphases x nsrc x nrcv
+            travel times
+
+        Notes
+        -----
+        Legs shared by several phases are computed once per source, and all
+        (source, leg) pairs are distributed over the threads of the grid.
+        """
+        if source.ndim != 2 or rcv.ndim != 2:
+            raise ValueError('source and rcv should be 2D arrays')
+        if source.shape[1] == 3:
+            src = source
+            t0 = np.zeros((source.shape[0],))
+        elif source.shape[1] == 4:
+            src = source[:,1:4]
+            t0 = source[:,0]
+        else:
+            raise ValueError('source should be either nsrc x 3 or 4')
+        if rcv.shape[1] != 3:
+            raise ValueError('rcv should be nrcv x 3')
+        if self.is_outside(src):
+            raise ValueError('Source point outside grid')
+        if self.is_outside(rcv):
+            raise ValueError('Receiver outside grid')
+        if slowness is not None:
+            self.set_slowness(slowness)
+
+        cdef vector[vector[sxyz[double]]] vTx
+        cdef vector[vector[double]] vt0
+        cdef vector[sxyz[double]] vRx
+        cdef vector[vector[sxyz[double]]] vitf
+        cdef vector[vector[size_t]] vph
+        cdef vector[vector[vector[double]]] vtt
+        cdef MultiPhase[double, sxyz[double], Grid3D[double, uint32_t]]* mp
+
+        vTx.resize(src.shape[0])
+        vt0.resize(src.shape[0])
+        for n in range(src.shape[0]):
+            vTx[n].push_back(sxyz[double](src[n,0], src[n,1], src[n,2]))
+            vt0[n].push_back(t0[n])
+        for r in rcv:
+            vRx.push_back(sxyz[double](r[0], r[1], r[2]))
+        vitf.resize(len(interfaces))
+        for n in range(len(interfaces)):
+            pts = np.asarray(interfaces[n], dtype=np.double)
+            if pts.ndim != 2 or pts.shape[1] != 3:
+                raise ValueError('interfaces should be npts x 3')
+            if self.is_outside(pts):
+                raise ValueError('Interface point outside grid')
+            for p in pts:
+                vitf[n].push_back(sxyz[double](p[0], p[1], p[2]))
+        vph.resize(len(phases))
+        for n in range(len(phases)):
+            for i in phases[n]:
+                vph[n].push_back(i)
+
+        mp = new MultiPhase[double, sxyz[double], Grid3D[double, uint32_t]](self.grid[0], vitf, vph)
+        if reciprocal is not None:
+            mp.setReciprocalTables(1 if reciprocal else 0)
+        try:
+            mp.raytrace(vTx, vt0, vRx, vtt, self._n_threads)
+        finally:
+            del mp
+
+        tt = np.empty((vtt.size(), vTx.size(), vRx.size()))
+        for n in range(vtt.size()):
+            for ns in range(vtt[n].size()):
+                for nr in range(vtt[n][ns].size()):
+                    tt[n, ns, nr] = vtt[n][ns][nr]
+        return tt
+
+    def raytrace_ensemble(self, source, rcv, slowness):
+        """
+        raytrace_ensemble(source, rcv, slowness) -> tt
+
+        Compute traveltimes through an ensemble of slowness models
+
+        Parameters
+        ----------
+        source : 2D np.ndarray with 3 or 4 columns
+            one row per source, columns are x, y and z coordinates, with
+            origin time in the 1st column if 4 columns are given
+        rcv : 2D np.ndarray with 3 columns
+            coordinates of receivers, common to all sources
+        slowness : np.ndarray
+            one model per row, each row shaped as for set_slowness
+
+        Returns
+        -------
+        tt : np.ndarray of size nmodels x nsrc x nrcv
+            travel times
+
+        Notes
+        -----
+        The models share the geometry of the grid, and the slowness at
+        secondary nodes is interpolated once per model.  The sources of each
+        model are distributed over the threads of the grid, and the travel
+        times are written directly in the returned array.  The slowness
+        assigned to the grid is left unchanged.
+        """
+        if source.ndim != 2 or rcv.ndim != 2:
+            raise ValueError('source and rcv should be 2D arrays')
+        if source.shape[1] == 3:
+            src = source
+            t0 = np.zeros((source.shape[0],))
+        elif source.shape[1] == 4:
+            src = source[:,1:4]
+            t0 = source[:,0]
+        else:
+            raise ValueError('source should be either nsrc x 3 or 4')
+        if rcv.shape[1] != 3:
+            raise ValueError('rcv should be nrcv x 3')
+        if self.is_outside(src):
+            raise ValueError('Source point outside grid')
+        if self.is_outside(rcv):
+            raise ValueError('Receiver outside grid')
+        slowness = np.asarray(slowness, dtype=np.double)
+        if slowness.ndim < 2 or np.prod(slowness.shape[1:]) != self.nparams:
+            raise ValueError('slowness should be nmodels x nparams')
+
+        cdef vector[vector[sxyz[double]]] vTx
+        cdef vector[vector[double]] vt0
+        cdef vector[sxyz[double]] vRx
+        cdef vector[double] slown
+        cdef Ensemble[double, uint32_t]* ens
+        cdef double[:, :, ::1] tt_view
+
+        vTx.resize(src.shape[0])
+        vt0.resize(src.shape[0])
+        for n in range(src.shape[0]):
+            vTx[n].push_back(sxyz[double](src[n,0], src[n,1], src[n,2]))
+            vt0[n].push_back(t0[n])
+        for r in rcv:
+            vRx.push_back(sxyz[double](r[0], r[1], r[2]))
+
+        tt = np.empty((slowness.shape[0], vTx.size(), vRx.size()))
+        if tt.size == 0:
+            return tt
+        tt_view = tt
+        ens = new Ensemble[double, uint32_t](self.grid[0])
+        try:
+            for k in range(slowness.shape[0]):
+                # parameters are stored in 'F' order
+                tmp = slowness[k].reshape(self.shape).flatten('F')
+                slown.clear()
+                for i in range(tmp.size):
+                    slown.push_back(tmp[i])
+                ens.addModel(slown)
+            ens.raytrace(vTx, vt0, vRx, &tt_view[0, 0, 0], self._n_threads)
+        finally:
+            del ens
+        return tt
+
     def to_vtk(self, fields, filename):
         """
         to_vtk(fields, filename)
@@ -1227,11 +1845,13 @@ cdef class Grid3d:
     @staticmethod
     def builder(filename, n_threads=1, method='FSM', tt_from_rp=1, interp_vel=0,
                 eps=1.e-15, maxit=20, weno=1, nsnx=5, nsny=5, nsnz=5,
-                n_secondary=2, n_tertiary=2, radius_tertiary=1.0):
+                n_secondary=2, n_tertiary=2, radius_tertiary=1.0,
+                factored=0):
         """
         builder(filename, n_threads=1, method='FSM', tt_from_rp=1, interp_vel=0,
                 eps=1.e-15, maxit=20, weno=1, nsnx=5, nsny=5, nsnz=5,
-                n_secondary=2, n_tertiary=2, radius_tertiary=1.0)
+                n_secondary=2, n_tertiary=2, radius_tertiary=1.0,
+                factored=0)
 
         Build instance of Grid3d from VTK file
 
@@ -1282,7 +1902,7 @@ cdef class Grid3d:
 
         g = Grid3d(x, y, z, n_threads, cell_slowness, method, tt_from_rp,
                    interp_vel, eps, maxit, weno, nsnx, nsny, nsnz,
-                   n_secondary, n_tertiary, radius_tertiary)
+                   n_secondary, n_tertiary, radius_tertiary, factored)
         g.set_slowness(slowness)
         return g
 
@@ -1292,9 +1912,9 @@ cdef class Grid3d:
                                   np.ndarray[np.double_t, ndim=1] grx,
                                   np.ndarray[np.double_t, ndim=1] gry,
                                   np.ndarray[np.double_t, ndim=1] grz,
-                                  centers=False):
+                                  centers=False, size_t n_threads=1):
         """
-        data_kernel_straight_rays(Tx, Rx, grx, gry, grz, centers) -> L, (xc, yc, zc)
+        data_kernel_straight_rays(Tx, Rx, grx, gry, grz, centers, n_threads) -> L, (xc, yc, zc)
 
         Raytracing with straight rays in 3D
 
@@ -1318,6 +1938,9 @@ cdef class Grid3d:
             grid node coordinates along z
         centers : bool
             return coordinates of center of cells (False by default)
+        n_threads : int
+            number of threads used to process the source-receiver pairs
+            (1 by default)
 
         Returns
         -------
@@ -1329,399 +1952,290 @@ cdef class Grid3d:
         Note
         ----
         Tx and Rx should contain the same number of rows, each row corresponding
-        to a source-receiver pair
+        to a source-receiver pair.  A RuntimeError is raised if a point is outside
+        the grid
 
         """
 
+        cdef vector[sxyz[double]] vTx
+        cdef vector[sxyz[double]] vRx
+        cdef vector[double] vgrx
+        cdef vector[double] vgry
+        cdef vector[double] vgrz
+        cdef vector[int64_t] indptr
+        cdef vector[int64_t] indices
+        cdef vector[double] data
         cdef size_t nTx = Tx.shape[0]
-        cdef size_t n_grx = grx.shape[0]
-        cdef size_t n_gry = gry.shape[0]
-        cdef size_t n_grz = grz.shape[0]
-
-        cdef double small = 1.e-10
-
-        data_p = []
-        indices_p = []
-        indptr_p = []
-
-        cdef size_t k = 0
-        cdef size_t ix = 0
-        cdef size_t iy = 0
-        cdef size_t iz = 0
-
-        cdef double x, y, z, x1, y1, z1, x2, y2, z2, dtmp, d, l, m, n
-        cdef double m_y, b_y, m_z, b_z, dlx, dly, dlz, dl, xe, ye, ze
-        cdef int sy, sz
-        cdef bool up_y, up_z
-        cdef Py_ssize_t nt
-
-        for nt in range(nTx):
-            indptr_p.append(k)
-
-            x1 = Tx[nt, 0]
-            y1 = Tx[nt, 1]
-            z1 = Tx[nt, 2]
-            x2 = Rx[nt, 0]
-            y2 = Rx[nt, 1]
-            z2 = Rx[nt, 2]
-
-            if x1 > x2:  # on veut x croissant
-                dtmp = x1
-                x1 = x2
-                x2 = dtmp
-                dtmp = y1
-                y1 = y2
-                y2 = dtmp
-                dtmp = z1
-                z1 = z2
-                z2 = dtmp
-
-            d = sqrt( (x2-x1)*(x2-x1) + (y2-y1)*(y2-y1) + (z2-z1)*(z2-z1) )
-            # cosinus directeurs
-            l = (x2-x1)/d
-            m = (y2-y1)/d
-            n = (z2-z1)/d
-
-            sy = (m > 0) - (m < 0)  # sign of m
-            sz = (n > 0) - (n < 0)
-
-            x = x1
-            y = y1
-            z = z1
-
-            for ix in range(n_grx-1):
-                if x < grx[ix+1] and x >= grx[ix]:
-                    break
-            for iy in range(n_gry-1):
-                if y < gry[iy+1] and y >= gry[iy]:
-                    break
-            for iz in range(n_grz-1):
-                if z < grz[iz+1] and z >= grz[iz]:
-                    break
-
-            if abs(l) < small:
-                if abs(m) < small:
-                    # X & Y constants
-                    if z1 > z2:
-                        dtmp = z1
-                        z1 = z2
-                        z2 = dtmp
-                        z = z1
-                        for iz in range(n_grz-1):
-                            if z < grz[iz+1] and z >= grz[iz]:
-                                break
-                    while z < z2:
-                        iCell = (ix*(n_gry-1)+iy)*(n_grz-1) + iz
-
-                        dlz = ( grz[iz+1] if grz[iz+1] < z2 else z2 ) - z
-
-                        indices_p.append(iCell)
-                        data_p.append(dlz)
-                        k += 1
-
-                        iz += 1
-                        z = grz[iz]
-
-                elif abs(n) < small:
-                    # X & Z constants
-                    if y1 > y2:
-                        dtmp = y1
-                        y1 = y2
-                        y2 = dtmp
-                        y = y1
-                        for iy in range(n_gry-1):
-                            if y < gry[iy+1] and y >= gry[iy]:
-                                break
-                    while y < y2:
-                        iCell = (ix*(n_gry-1)+iy)*(n_grz-1) + iz
-
-                        dly = ( gry[iy+1] if gry[iy+1] < y2 else y2 ) - y
-
-                        indices_p.append(iCell)
-                        data_p.append(dly)
-                        k += 1
-
-                        iy += 1
-                        y = gry[iy]
-
-                else:
-                    # seul X constant
-                    if y1 > y2:
-                        dtmp = y1
-                        y1 = y2
-                        y2 = dtmp
-                        dtmp = z1
-                        z1 = z2
-                        z2 = dtmp
-                        y = y1
-                        for iy in range(n_gry-1):
-                            if y < gry[iy+1] and y >= gry[iy]:
-                                break
-                        z = z1
-                        for iz in range(n_grz-1):
-                            if z < grz[iz+1] and z >= grz[iz]:
-                                break
-
-                    m_z = (z2-z1) / (y2-y1)
-                    b_z = z2 - m_z*y2
-                    up_z = m_z > 0
-
-                    while y < y2:
-
-                        zi = m_z*gry[iy+1] + b_z
-                        if up_z:
-                            while z < zi and z < z2:
-                                iCell = (ix*(n_gry-1)+iy)*(n_grz-1) + iz
-
-                                ze = grz[iz+1] if grz[iz+1]<zi else zi
-                                ze = ze if ze < z2 else z2
-                                ye = (ze-b_z) / m_z
-                                dly = ye - y
-                                dlz = ze - z
-                                dl = sqrt( dly*dly + dlz*dlz )
-
-                                indices_p.append(iCell)
-                                data_p.append(dl)
-                                k += 1
-
-                                y = ye
-                                z = ze
+        cdef size_t n
 
-                                if abs(z-grz[iz+1]) < small:
-                                    iz += 1
+        if Rx.shape[0] != nTx:
+            raise ValueError('Tx and Rx should contain the same number of rows')
 
-                        else: # down
-                            while z > zi and z > z2:
-                                iCell = (ix*(n_gry-1)+iy)*(n_grz-1) + iz
+        vTx.reserve(nTx)
+        vRx.reserve(nTx)
+        for n in range(nTx):
+            vTx.push_back(sxyz[double](Tx[n, 0], Tx[n, 1], Tx[n, 2]))
+            vRx.push_back(sxyz[double](Rx[n, 0], Rx[n, 1], Rx[n, 2]))
+        for n in range(grx.size):
+            vgrx.push_back(grx[n])
+        for n in range(gry.size):
+            vgry.push_back(gry[n])
+        for n in range(grz.size):
+            vgrz.push_back(grz[n])
 
-                                ze = grz[iz] if grz[iz] > zi else zi
-                                ze = ze if ze > z2 else z2
-                                ye = (ze-b_z)/m_z
-                                dly = ye - y
-                                dlz = ze - z
-                                dl = sqrt( dly*dly + dlz*dlz )
+        getStraightRayKernel(vTx, vRx, vgrx, vgry, vgrz, indptr, indices,
+                             data, n_threads)
 
-                                indices_p.append(iCell)
-                                data_p.append(dl)
-                                k += 1
+        L = _csr_from_vectors(indptr, indices, data,
+                              (nTx, (grx.size-1)*(gry.size-1)*(grz.size-1)))
 
-                                y = ye
-                                z = ze
-                                if abs(z-grz[iz]) < small:
-                                    iz -= 1
+        if centers:
+            xc = (grx[1:]+grx[:-1])/2
+            yc = (gry[1:]+gry[:-1])/2
+            zc = (grz[1:]+grz[:-1])/2
+            return L, (xc, yc, zc)
+        else:
+            return L
 
-                        iy += 1
-                        y = gry[iy]
-            else:
-                if abs(m) < small and abs(n) < small:
-                    # Y & Z constants
-                    while x < x2:
-                        iCell = (ix*(n_gry-1)+iy)*(n_grz-1) + iz
 
-                        dlx = ( grx[ix+1] if grx[ix+1] < x2 else x2 ) - x
+def write_brick_file(filename, np.ndarray[np.double_t, ndim=1] x,
+                     np.ndarray[np.double_t, ndim=1] y,
+                     np.ndarray[np.double_t, ndim=1] z, slowness,
+                     bool cell_slowness=1, uint32_t brick_size=16):
+    """
+    write_brick_file(filename, x, y, z, slowness, cell_slowness=1,
+                     brick_size=16)
 
-                        indices_p.append(iCell)
-                        data_p.append(dlx)
-                        k += 1
+    Write slowness model of a 3D rectilinear grid in a brick file, to be
+    used with `TiledGrid3d`
 
-                        ix += 1
-                        x = grx[ix]
+    Parameters
+    ----------
+    filename : str
+        name of brick file
+    x : np.ndarray
+        node coordinates along x
+    y : np.ndarray
+        node coordinates along y
+    z : np.ndarray
+        node coordinates along z
+    slowness : np.ndarray, shape (nx, ny, nz)
+        slowness at grid nodes or cells (depending on cell_slowness)
+        slowness may also have been flattened (with default 'C' order)
+    cell_slowness : bool
+        slowness defined for cells (True) or nodes (False) (default is 1)
+    brick_size : int
+        number of values along each edge of a brick (default is 16)
+    """
+    cdef brickHeader h
+    cdef BrickWriter* w
+    cdef vector[double] plane
+    cdef size_t k
+
+    if cell_slowness:
+        dim = (x.size-1, y.size-1, z.size-1)
+    else:
+        dim = (x.size, y.size, z.size)
+    slowness = np.asarray(slowness, dtype=np.double)
+    if slowness.size != dim[0]*dim[1]*dim[2]:
+        raise ValueError('slowness has wrong size')
+    slowness = slowness.reshape(dim)
+
+    h.nv[0] = dim[0]
+    h.nv[1] = dim[1]
+    h.nv[2] = dim[2]
+    h.bs = brick_size
+    h.cells = cell_slowness
+    h.d[0] = x[1] - x[0]
+    h.d[1] = y[1] - y[0]
+    h.d[2] = z[1] - z[0]
+    h.min[0] = x[0]
+    h.min[1] = y[0]
+    h.min[2] = z[0]
+
+    w = new BrickWriter(filename.encode('utf-8'), h)
+    try:
+        for k in range(dim[2]):
+            # planes of constant z, x varying fastest
+            plane = slowness[:, :, k].flatten('F')
+            w.addPlane(plane)
+        w.close()
+    finally:
+        del w
+
+
+cdef class TiledGrid3d:
+    """
+    class to perform raytracing with 3D rectilinear grids whose slowness
+    model is stored in a brick file (see `write_brick_file`).  For each
+    source, only the bricks covering the source and its receivers plus a
+    margin are read, and traveltimes are computed on a grid built over that
+    window.  Rays are thus confined to the window.
 
-                elif abs(m) < small:
-                    # seul Y constant
-                    m_z = (z2-z1) / (x2-x1)
-                    b_z = z2 - m_z*x2
-                    up_z = m_z>0
+    Attributes
+    ----------
+    n_threads: int
+        number of threads for raytracing
 
-                    while x < x2:
+    Constructor:
 
-                        zi = m_z*grx[ix+1] + b_z
+    TiledGrid3d(filename, margin=0.0, brick_cache=64, n_threads=1,
+                method='FSM', tt_from_rp=0, interp_vel=0, eps=1.e-15,
+                maxit=20, weno=1, nsnx=5, nsny=5, nsnz=5,
+                factored=0) -> TiledGrid3d
 
-                        if up_z:
-                            while z < zi and z < z2:
-                                iCell = (ix*(n_gry-1)+iy)*(n_grz-1) + iz
+        Parameters
+        ----------
+        filename : str
+            name of brick file
+        margin : double
+            margin added around the sources and receivers of each source
+            (default is 0)
+        brick_cache : int
+            number of bricks held in memory (default is 64)
+        method : string
+            raytracing method (default is FSM)
+                - 'FSM' : fast sweeping method
+                - 'FMM' : fast marching method
+                - 'SPM' : shortest path method
+        Other parameters are defined as in `Grid3d`
+    """
+    cdef size_t _n_threads
+    cdef Grid3Drtiled[double, uint32_t]* grid
 
-                                ze = grz[iz+1] if grz[iz+1] < zi else zi
-                                ze = ze if ze < z2 else z2
-                                xe = (ze-b_z) / m_z
-                                dlx = xe - x
-                                dlz = ze - z
-                                dl = sqrt( dlx*dlx + dlz*dlz )
+    def __cinit__(self, str filename, double margin=0.0,
+                  size_t brick_cache=64, size_t n_threads=1,
+                  str method='FSM', bool tt_from_rp=0, bool interp_vel=0,
+                  double eps=1.e-15, int maxit=20, bool weno=1,
+                  uint32_t nsnx=5, uint32_t nsny=5, uint32_t nsnz=5,
+                  bool factored=0):
+        cdef raytracing_method m
+        cdef windowGrid3Dr[double, uint32_t]* builder
+        if method == 'FSM':
+            m = FAST_SWEEPING
+        elif method == 'FMM':
+            m = FAST_MARCHING
+        elif method == 'SPM':
+            m = SHORTEST_PATH
+        else:
+            raise ValueError('Method {0:s} undefined'.format(method))
+        self._n_threads = n_threads
 
-                                indices_p.append(iCell)
-                                data_p.append(dl)
-                                k += 1
+        builder = new windowGrid3Dr[double, uint32_t](m, nsnx, nsny, nsnz,
+                                                     eps, maxit, weno,
+                                                     tt_from_rp, interp_vel)
+        try:
+            self.grid = new Grid3Drtiled[double, uint32_t](filename.encode('utf-8'),
+                                                           builder[0], margin,
+                                                           brick_cache,
+                                                           tt_from_rp,
+                                                           n_threads)
+        finally:
+            del builder
 
-                                x = xe
-                                z = ze
-                                if abs(z-grz[iz+1]) < small:
-                                    iz += 1
-                        else: # down
-                            while z > zi and z > z2:
-                                iCell = (ix*(n_gry-1)+iy)*(n_grz-1) + iz
-
-                                ze = grz[iz] if grz[iz] > zi else zi
-                                ze = ze if ze > z2 else z2
-                                xe = (ze-b_z) / m_z
-                                dlx = xe - x
-                                dlz = ze - z
-                                dl = sqrt( dlx*dlx + dlz*dlz )
-
-                                indices_p.append(iCell)
-                                data_p.append(dl)
-                                k += 1
+        if factored:
+            self.grid.setFactored(True)
 
-                                x = xe
-                                z = ze
-                                if abs(z-grz[iz]) < small:
-                                    iz -= 1
+    def __dealloc__(self):
+        del self.grid
 
-                        ix += 1
-                        x = grx[ix]
-                elif abs(n) < small:
-                    # seul Z constant
-                    m_y = (y2-y1) / (x2-x1)
-                    b_y = y2 - m_y*x2
-                    up_y = m_y > 0
+    @property
+    def n_threads(self):
+        """int: number of threads for raytracing"""
+        return self._n_threads
 
-                    while x < x2:
+    def get_brick_cache_stats(self):
+        """
+        get_brick_cache_stats()
 
-                        yi = m_y*grx[ix+1] + b_y
+        Usage of the cache of bricks
 
-                        if up_y:
-                            while y < yi and y < y2:
-                                iCell = (ix*(n_gry-1)+iy)*(n_grz-1) + iz
+        Returns
+        -------
+        stats : dict
+            'size': max number of bricks held in memory,
+            'hits', 'misses': number of bricks found in the cache, or read
+            from the file
+        """
+        return {'size': self.grid.getStore().getCacheSize(),
+                'hits': self.grid.getStore().getHits(),
+                'misses': self.grid.getStore().getMisses()}
 
-                                ye = gry[iy+1] if gry[iy+1] < yi else yi
-                                ye = ye if ye < y2 else y2
-                                xe = (ye-b_y) / m_y
-                                dlx = xe - x
-                                dly = ye - y
-                                dl = sqrt( dlx*dlx + dly*dly )
+    def raytrace(self, source, rcv):
+        """
+        raytrace(source, rcv) -> tt
 
-                                indices_p.append(iCell)
-                                data_p.append(dl)
-                                k += 1
+        Compute traveltimes
 
-                                x = xe
-                                y = ye
-                                if abs(y-gry[iy+1]) < small:
-                                    iy += 1
-                        else:  # down
-                            while y > yi and y > y2:
-                                iCell = (ix*(n_gry-1)+iy)*(n_grz-1) + iz
-
-                                ye = gry[iy] if gry[iy] > yi else yi
-                                ye = ye if ye > y2 else y2
-                                xe = (ye-b_y)/m_y
-                                dlx = xe - x
-                                dly = ye - y
-                                dl = sqrt( dlx*dlx + dly*dly )
-
-                                indices_p.append(iCell)
-                                data_p.append(dl)
-                                k += 1
+        Parameters
+        ----------
+        source : 2D np.ndarray with 3 or 4 columns
+            see notes of `Grid3d.raytrace`
+        rcv : 2D np.ndarray with 3 columns
+            Columns correspond to x, y and z coordinates
 
-                                x = xe
-                                y = ye
-                                if abs(y-gry[iy]) < small:
-                                    iy -= 1
+        Returns
+        -------
+        tt : np.ndarray
+            travel times for the appropriate source-rcv
 
-                        ix += 1
-                        x = grx[ix]
-                else:
-                    while x < x2:
-
-                        m_y = (y2-y1) / (x2-x1)
-                        b_y = y2 - m_y*x2
-                        up_y = m_y > 0
-
-                        m_z = (z2-z1) / (x2-x1)
-                        b_z = z2 - m_z*x2
-                        up_z = m_z > 0
-
-                        yi = m_y*grx[ix+1] + b_y
-                        zi = m_z*grx[ix+1] + b_z
-
-                        while (sy*(yi-y)) > 0 and (sy*(y2-y)) > 0 and \
-							  (sz*(zi-z)) > 0 and (sz*(z2-z)) > 0:
-
-                            if up_y:
-                                ye = gry[iy+1] if gry[iy+1] < yi else yi
-                                ye = ye if ye<y2 else y2
-                            else:
-                                ye = gry[iy] if gry[iy] > yi else yi
-                                ye = ye if ye>y2 else y2
-                            if up_z:
-                                ze = grz[iz+1] if grz[iz+1] < zi else zi
-                                ze = ze if ze < z2 else z2
-                            else:
-                                ze = grz[iz] if grz[iz] > zi else zi
-                                ze = ze if ze > z2 else z2
-
-                            if (ze-b_z)/m_z < (ye-b_y)/m_y:  # we cross z before y
-                                iCell = (ix*(n_gry-1)+iy)*(n_grz-1) + iz
-
-                                xe = (ze-b_z) / m_z
-                                ye = m_y*xe + b_y
-                                dlx = xe - x
-                                dly = ye - y
-                                dlz = ze - z
-                                dl = sqrt( dlx*dlx + dly*dly + dlz*dlz )
-
-                                indices_p.append(iCell)
-                                data_p.append(dl)
-                                k += 1
+        Notes
+        -----
+        source and rcv can contain the same number of rows, each row
+        corresponding to a source-receiver pair, or all rows in source may
+        be identical.  A RuntimeError is raised if a point is outside the
+        model.
+        """
+        if source.ndim != 2 or rcv.ndim != 2:
+            raise ValueError('source and rcv should be 2D arrays')
 
-                                x = xe
-                                y = ye
-                                z = ze
-                                if up_z:
-                                    if abs(z-grz[iz+1]) < small:
-                                        iz += 1
-                                else:
-                                    if abs(z-grz[iz]) < small:
-                                        iz -= 1
-
-                            else:  # we cross y before z
-                                iCell = (ix*(n_gry-1)+iy)*(n_grz-1) + iz
-
-                                xe = (ye-b_y)/m_y
-                                ze = m_z*xe + b_z
-                                dlx = xe - x
-                                dly = ye - y
-                                dlz = ze - z
-
-                                dl = sqrt( dlx*dlx + dly*dly + dlz*dlz )
-
-                                indices_p.append(iCell)
-                                data_p.append(dl)
-                                k += 1
+        if source.shape[1] == 3:
+            src = source
+            Tx = np.unique(source, axis=0)
+            t0 = np.zeros((Tx.shape[0],))
+        elif source.shape[1] == 4:
+            src = source[:,1:4]
+            tmp = np.unique(source, axis=0)
+            Tx = tmp[:,1:4]
+            t0 = tmp[:,0]
+        else:
+            raise ValueError('source should be either nsrc x 3 or 4')
+        if rcv.shape[1] != 3:
+            raise ValueError('rcv should be ndata x 3')
+        nTx = Tx.shape[0]
+        if nTx > 1 and src.shape != rcv.shape:
+            raise ValueError('src and rcv should be of equal size')
 
-                                x = xe
-                                y = ye
-                                z = ze
-                                if up_y:
-                                    if abs(y-gry[iy+1]) < small:
-                                        iy += 1
-                                else:
-                                    if abs(y-gry[iy]) < small:
-                                        iy -= 1
+        cdef vector[vector[sxyz[double]]] vTx
+        cdef vector[vector[sxyz[double]]] vRx
+        cdef vector[vector[double]] vt0
+        cdef vector[vector[double]] vtt
+        cdef size_t n, nt
 
-                        ix += 1
-                        x = grx[ix]
+        vTx.resize(nTx)
+        vRx.resize(nTx)
+        vt0.resize(nTx)
+        vtt.resize(nTx)
+        iRx = []
+        for n in range(nTx):
+            if nTx == 1:
+                ind = np.arange(rcv.shape[0])
+            else:
+                ind = np.nonzero(np.sum(Tx[n,:] == src, axis=1) == 3)[0]
+            iRx.append(ind)
+            vTx[n].push_back(sxyz[double](Tx[n,0], Tx[n,1], Tx[n,2]))
+            vt0[n].push_back(t0[n])
+            for r in rcv[ind,:]:
+                vRx[n].push_back(sxyz[double](r[0], r[1], r[2]))
+            vtt[n].resize(vRx[n].size())
 
-        indptr_p.append(k)
-        L = sp.csr_matrix((data_p, indices_p, indptr_p),
-                          shape=(nTx, (n_grx-1)*(n_gry-1)*(n_grz-1)))
+        self.grid.raytrace(vTx, vt0, vRx, vtt)
 
-        if centers:
-            xc = (grx[1:]+grx[:-1])/2
-            yc = (gry[1:]+gry[:-1])/2
-            zc = (grz[1:]+grz[:-1])/2
-            return L, (xc, yc, zc)
-        else:
-            return L
+        tt = np.zeros((rcv.shape[0],))
+        for n in range(nTx):
+            for nt in range(vtt[n].size()):
+                tt[iRx[n][nt]] = vtt[n][nt]
+        return tt
 
 
 cdef class Grid2d:
@@ -1763,15 +2277,16 @@ cdef class Grid2d:
         slowness defined for cells (True) or nodes (False) (default is 1)
     method : string
         raytracing method (default is SPM)
-            - 'FSM' : fast marching method
+            - 'FSM' : fast sweeping method
+            - 'FMM' : fast marching method
             - 'SPM' : shortest path method
     eps : double
         convergence criterion (FSM) (default is 1e-15)
     maxit : int
         max number of sweeping iterations (FSM) (default is 20)
     weno : bool
-        use 3rd order weighted essentially non-oscillatory operator (FSM)
-        (default is True)
+        use 3rd order weighted essentially non-oscillatory operator (FSM),
+        or 2nd order upwind stencil (FMM) (default is True)
     rotated_template : bool
         use rotated templates (FSM)
     nsnx : int
@@ -1859,6 +2374,11 @@ cdef class Grid2d:
                 self.grid = new Grid2Drcfs[double,uint32_t,sxz[double]](nx, nz,
                                 self._dx, self._dz, xmin, zmin, eps,
                                 maxit, weno, rotated_template, n_threads)
+            elif method == 'FMM':
+                self.method = b'm'
+                self.grid = new Grid2Drcfm[double,uint32_t,sxz[double]](nx, nz,
+                                self._dx, self._dz, xmin, zmin, weno,
+                                n_threads)
             else:
                 raise ValueError('Method {0:s} undefined'.format(method))
         else:
@@ -1872,6 +2392,11 @@ cdef class Grid2d:
                 self.grid = new Grid2Drnfs[double,uint32_t,sxz[double]](nx, nz,
                                 self._dx, self._dz, xmin, zmin, eps,
                                 maxit, weno, rotated_template, n_threads)
+            elif method == 'FMM':
+                self.method = b'm'
+                self.grid = new Grid2Drnfm[double,uint32_t,sxz[double]](nx, nz,
+                                self._dx, self._dz, xmin, zmin, weno,
+                                n_threads)
 
     def __dealloc__(self):
         del self.grid
@@ -1879,6 +2404,8 @@ cdef class Grid2d:
     def __reduce__(self):
         if self.method == b'f':
             method = 'FSM'
+        elif self.method == b'm':
+            method = 'FMM'
         elif self.method == b's':
             method = 'SPM'
         elif self.method == b'd':
@@ -1993,6 +2520,41 @@ cdef class Grid2d:
         shape = (self._x.size(), self._z.size())
         return tt.reshape(shape)
 
+    def get_tt_at(self, pts, thread_no=0):
+        """
+        get_tt_at(pts, thread_no=0)
+
+        Obtain traveltimes at arbitrary points, from the traveltimes computed
+        by the last call to raytrace performed with thread "thread_no"
+
+        Parameters
+        ----------
+        pts : np ndarray, shape (npts, 2)
+            coordinates (x, z) of points
+        thread_no : int
+            thread used to computed traveltimes (default is 0)
+
+        Returns
+        -------
+        tt: np ndarray, shape (npts,)
+            traveltimes
+        """
+        if thread_no >= self._n_threads:
+            raise ValueError('Thread number is larger than number of threads')
+        pts = np.atleast_2d(np.asarray(pts, dtype=np.double))
+        if pts.ndim != 2 or pts.shape[1] != 2:
+            raise ValueError('pts should be npts x 2')
+        cdef vector[sxz[double]] vpts
+        cdef size_t n
+        vpts.reserve(pts.shape[0])
+        for n in range(pts.shape[0]):
+            vpts.push_back(sxz[double](pts[n, 0], pts[n, 1]))
+        tt = np.empty((pts.shape[0],))
+        cdef double[::1] tt_view = tt
+        if vpts.size() > 0:
+            self.grid.getTraveltimes(vpts, &tt_view[0], thread_no)
+        return tt
+
     def is_outside(self, np.ndarray[np.double_t, ndim=2] pts):
         """
         is_outside(pts)
@@ -2350,6 +2912,31 @@ cdef class Grid2d:
             raise ValueError('v must be 1D or 3D ndarray')
         self.grid.setGamma(data)
 
+    def set_edge_tables(self, size_t max_bytes):
+        """
+        set_edge_tables(max_bytes)
+
+        Set memory budget of the tables of traveltimes along the edges of
+        the cells, used by the SPM with anisotropic cells.  Tables are
+        updated when cell parameters change, and traveltimes are computed
+        on the fly if tables would take more than the budget.
+
+        Parameters
+        ----------
+        max_bytes : int
+            memory budget (256 MB when grid is built), 0 disables tables
+        """
+        self.grid.setEdgeTables(max_bytes)
+
+    def has_edge_tables(self):
+        """
+        Returns
+        -------
+        bool:
+            True if tables of edge traveltimes are used (see set_edge_tables)
+        """
+        return self.grid.hasEdgeTables()
+
     def compute_K(self, order=1):
         """
         Compute smoothing matrices
@@ -2895,9 +3482,10 @@ cdef class Grid2d:
     def data_kernel_straight_rays(np.ndarray[np.double_t, ndim=2] Tx,
                                   np.ndarray[np.double_t, ndim=2] Rx,
                                   np.ndarray[np.double_t, ndim=1] grx,
-                                  np.ndarray[np.double_t, ndim=1] grz):
+                                  np.ndarray[np.double_t, ndim=1] grz,
+                                  size_t n_threads=1):
         """
-        data_kernel_straight_rays(Tx, Rx, grx, grz) -> L
+        data_kernel_straight_rays(Tx, Rx, grx, grz, n_threads) -> L
 
         Raytracing with straight rays in 2D
 
@@ -2915,6 +3503,9 @@ cdef class Grid2d:
                 grid node coordinates along x
         grz : np.ndarray
                 grid node coordinates along z
+        n_threads : int
+            number of threads used to process the source-receiver pairs
+            (1 by default)
 
         Returns
         -------
@@ -2924,164 +3515,51 @@ cdef class Grid2d:
         Note
         ----
         Tx and Rx should contain the same number of rows, each row corresponding
-        to a source-receiver pair
+        to a source-receiver pair.  A RuntimeError is raised if a point is outside
+        the grid
         """
 
+        cdef vector[sxyz[double]] vTx
+        cdef vector[sxyz[double]] vRx
+        cdef vector[double] vgrx
+        cdef vector[double] vgry
+        cdef vector[double] vgrz
+        cdef vector[int64_t] indptr
+        cdef vector[int64_t] indices
+        cdef vector[double] data
         cdef size_t nTx = Tx.shape[0]
-        cdef size_t n_grx = grx.shape[0]
-        cdef size_t n_grz = grz.shape[0]
-
-        cdef double small = 1.e-10
-
-        data_p = []
-        indices_p = []
-        indptr_p = []
-
-        cdef size_t k = 0
-        cdef size_t ix = 0
-        cdef size_t iz = 0
+        cdef size_t n
 
-        cdef double x, z, xs, xr, zs, zr, dtmp, dlx, dlz, m, b, ze, xe
-        cdef int64_t iCell
-        cdef bool up
-        cdef Py_ssize_t n
+        if Rx.shape[0] != nTx:
+            raise ValueError('Tx and Rx should contain the same number of rows')
 
+        # 2D grid handled as a 3D grid with one cell along y
+        vTx.reserve(nTx)
+        vRx.reserve(nTx)
         for n in range(nTx):
-            indptr_p.append(k)
-
-            xs = Tx[n, 0]
-            zs = Tx[n, 1]
-            xr = Rx[n, 0]
-            zr = Rx[n, 1]
-
-            if xs > xr:  # on va de s à r, on veut x croissant
-                dtmp = xs
-                xs = xr
-                xr = dtmp
-                dtmp = zs
-                zs = zr
-                zr = dtmp
-
-            # point de départ
-            x = xs
-            z = zs
-
-            if abs(zs-zr)<small: # rai horizontal
-
-                for ix in range(n_grx-1):
-                    if x < grx[ix+1]:
-                        break
-                for iz in range(n_grz-1):
-                    if z < grz[iz+1]:
-                        break
-
-                while x < xr:
-                    iCell = ix*(n_grz-1) + iz
-
-                    dlx = ( grx[ix+1] if grx[ix+1]<xr else xr ) - x
-
-                    indices_p.append(iCell)
-                    data_p.append(dlx)
-                    k += 1
-
-                    ix += 1
-                    x = grx[ix]
-
-            elif abs(xs-xr) < small:   # rai vertical
-                if zs > zr:
-                    dtmp = zs
-                    zs = zr
-                    zr = dtmp
-                z = zs
-
-                for ix in range(n_grx-1):
-                    if x < grx[ix+1]:
-                        break
-                for iz in range(n_grz-1):
-                    if z < grz[iz+1]:
-                        break
-
-                while z < zr:
-                    iCell = ix*(n_grz-1) + iz
-
-                    dlz = ( grz[iz+1] if grz[iz+1]<zr else zr ) - z
-
-                    indices_p.append(iCell)
-                    data_p.append(dlz)
-                    k += 1
-
-                    iz += 1
-                    z = grz[iz]
-            else:   # rai oblique
-                m = (zr-zs)/(xr-xs)
-                b = zr - m*xr
-                up = m>0
-
-                for ix in range(n_grx-1):
-                    if x < grx[ix+1]:
-                        break
-                for iz in range(n_grz-1):
-                    if z < grz[iz+1]:
-                        break
-
-                while x < xr:
-
-                    zi = m*grx[ix+1] + b
-
-                    if up:
-                        while z < zi and z < zr:
-                            iCell = ix*(n_grz-1) + iz
-
-                            ze = grz[iz+1] if grz[iz+1]<zi else zi
-                            ze = ze if ze<zr else zr
-                            xe = (ze-b)/m
-                            dlx = xe - x
-                            dlz = ze - z
-                            dl = sqrt( dlx*dlx + dlz*dlz )
-
-                            indices_p.append(iCell)
-                            data_p.append(dl)
-                            k += 1
-
-                            x = xe
-                            z = ze
-                            if abs(z-grz[iz+1])<small:
-                                iz += 1
-                    else:
-                        while z > zi and z > zr:
-                            iCell = ix*(n_grz-1) + iz
-
-                            ze = grz[iz] if grz[iz]>zi else zi
-                            ze = ze if ze>zr else zr
-                            xe = (ze-b)/m
-                            dlx = xe - x
-                            dlz = ze - z
-                            dl = sqrt( dlx*dlx + dlz*dlz )
-
-                            indices_p.append(iCell)
-                            data_p.append(dl)
-                            k += 1
-
-                            x = xe
-                            z = ze
-                            if abs(z-grz[iz])<small:
-                                iz -= 1
+            vTx.push_back(sxyz[double](Tx[n, 0], 0.0, Tx[n, 1]))
+            vRx.push_back(sxyz[double](Rx[n, 0], 0.0, Rx[n, 1]))
+        for n in range(grx.size):
+            vgrx.push_back(grx[n])
+        vgry.push_back(-1.0)
+        vgry.push_back(1.0)
+        for n in range(grz.size):
+            vgrz.push_back(grz[n])
 
-                    ix += 1
-                    x = grx[ix]
+        getStraightRayKernel(vTx, vRx, vgrx, vgry, vgrz, indptr, indices,
+                             data, n_threads)
 
-        indptr_p.append(k)
-        L = sp.csr_matrix((data_p, indices_p, indptr_p), shape=(nTx, (n_grx-1)*(n_grz-1)))
-        return L
+        return _csr_from_vectors(indptr, indices, data,
+                                 (nTx, (grx.size-1)*(grz.size-1)))
 
 
 def _rebuild3d(x, y, z, constructor_params):
     (n_threads, cell_slowness, method, tt_from_rp, interp_vel, eps, maxit,
      weno, nsnx, nsny, nsnz, n_secondary,
-     n_tertiary, radius_tertiary) = constructor_params
+     n_tertiary, radius_tertiary, factored) = constructor_params
     g = Grid3d(x, y, z, n_threads, cell_slowness, method, tt_from_rp,
                interp_vel, eps, maxit, weno, nsnx, nsny, nsnz, n_secondary,
-               n_tertiary, radius_tertiary)
+               n_tertiary, radius_tertiary, factored)
     return g
 
 def _rebuild2d(x, z, constructor_params):
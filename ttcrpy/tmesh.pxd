@@ -1,7 +1,7 @@
 
 from libcpp.string cimport string
 from libcpp.vector cimport vector
-from libc.stdint cimport uint32_t, int64_t
+from libc.stdint cimport uint32_t, int64_t, uint64_t
 from libc.math cimport sqrt
 from libcpp cimport bool
 
@@ -21,13 +21,54 @@ cdef extern from "ttcr_t.h" namespace "ttcr" nogil:
         T i[4]
         T physical_entity
 
+cdef extern from "Renumbering.h" namespace "ttcr" nogil:
+    cdef cppclass Renumbering[T2]:
+        Renumbering() except +
+        void build(vector[sxyz[double]]&, vector[tetrahedronElem[T2]]&, int) except +
+        void build(vector[sxz[double]]&, vector[triangleElem[T2]]&, int) except +
+        void apply(vector[sxyz[double]]&, vector[tetrahedronElem[T2]]&) except +
+        void apply(vector[sxz[double]]&, vector[triangleElem[T2]]&) except +
+        vector[T2]& getNodeMap()
+        vector[T2]& getCellMap()
+
+
+cdef extern from "FieldCache.h" namespace "ttcr" nogil:
+    cdef cppclass FieldCache[T1]:
+        size_t size()
+        size_t getNumberSpilled()
+        size_t getBytes()
+        size_t getHits()
+        size_t getSpillHits()
+        size_t getMisses()
 
 cdef extern from "Grid3D.h" namespace "ttcr" nogil:
     cdef cppclass Grid3D[T1,T2]:
         size_t getNthreads()
         void setSlowness(vector[T1]&) except +
         T1 computeSlowness(sxyz[T1]&) except +
+        void setTempNodesCache(size_t) except +
+        void setEdgeTables(size_t) except +
+        bool hasEdgeTables()
+        void setFactored(bool) except +
+        void setWarmStart(bool, size_t) except +
+        void setTraveltimeSeed(vector[T1]& tt, vector[T1]& s,
+                               size_t threadNo) except +
+        int getNiter(size_t threadNo) except +
+        void setTraveltimeCache(size_t maxBytes, string& spillFile,
+                                size_t spillBytes) except +
+        const FieldCache[T1]* getTraveltimeCache()
+        void getSecondaryNodes(vector[sxyz[T1]]&) except +
+        void getSnapshot(string&) except +
+        void setSnapshot(const char*, size_t) except +
         void getTT(vector[T1]& tt, size_t threadNo) except +
+        void getTraveltimes(vector[sxyz[T1]]& pts, T1* traveltimes,
+                            size_t threadNo) except +
+        void getMisfitGradient(vector[vector[sxyz[T1]]]& Tx,
+                               vector[vector[T1]]& t0,
+                               vector[vector[sxyz[T1]]]& Rx,
+                               vector[vector[T1]]& tobs,
+                               vector[vector[T1]]& traveltimes,
+                               vector[T1]& grad) except +
         void raytrace(vector[sxyz[T1]]& Tx,
                       vector[T1]& t0,
                       vector[sxyz[T1]]& Rx,
@@ -110,6 +151,11 @@ cdef extern from "Grid3Ducfs.h" namespace "ttcr" nogil:
         Grid3Ducfs(vector[sxyz[T1]], vector[tetrahedronElem[T2]], T1, int, bool,
                    bool, T1, size_t) except +
 
+cdef extern from "Grid3Ducfim.h" namespace "ttcr" nogil:
+    cdef cppclass Grid3Ducfim[T1, T2](Grid3Duc[T1,T2,Node3Dc[T1,T2]]):
+        Grid3Ducfim(vector[sxyz[T1]], vector[tetrahedronElem[T2]], T1, bool,
+                    bool, T1, size_t, size_t) except +
+
 cdef extern from "Grid3Ducsp.h" namespace "ttcr" nogil:
     cdef cppclass Grid3Ducsp[T1, T2](Grid3Duc[T1,T2,Node3Dcsp[T1,T2]]):
         Grid3Ducsp(vector[sxyz[T1]], vector[tetrahedronElem[T2]],
@@ -125,6 +171,11 @@ cdef extern from "Grid3Dunfs.h" namespace "ttcr" nogil:
         Grid3Dunfs(vector[sxyz[T1]], vector[tetrahedronElem[T2]], T1, int, int,
                    bool, bool, T1, size_t) except +
 
+cdef extern from "Grid3Dunfim.h" namespace "ttcr" nogil:
+    cdef cppclass Grid3Dunfim[T1, T2](Grid3Dun[T1,T2,Node3Dn[T1,T2]]):
+        Grid3Dunfim(vector[sxyz[T1]], vector[tetrahedronElem[T2]], T1, int,
+                    bool, bool, T1, size_t, size_t) except +
+
 cdef extern from "Grid3Dunsp.h" namespace "ttcr" nogil:
     cdef cppclass Grid3Dunsp[T1, T2](Grid3Dun[T1,T2,Node3Dnsp[T1,T2]]):
         Grid3Dunsp(vector[sxyz[T1]], vector[tetrahedronElem[T2]], int, bool,
@@ -136,12 +187,63 @@ cdef extern from "Grid3Dundsp.h" namespace "ttcr" nogil:
                     bool, int, bool, T1, T1, size_t) except +
 
 
+cdef extern from "RayPaths.h" namespace "ttcr" nogil:
+    cdef cppclass RayPaths[T,T2]:
+        RayPaths() except +
+        void append(vector[sxyz[double]]&) except +
+        size_t size() const
+        size_t getNumberOfPoints() const
+        const vector[uint64_t]& getOffsets() const
+        const vector[T]& getCoordinates() const
+
+
+cdef extern from "MSHReader.h" namespace "ttcr" nogil:
+    cdef cppclass MSHReader:
+        MSHReader(const char*) except +
+        bool isValid()
+        const vector[string]& getPhysicalNames(size_t) except +
+        void readNodes3D[T](vector[sxyz[T]]&) except +
+
+cdef extern from "Rcv.h" namespace "ttcr" nogil:
+    cdef cppclass Rcv[T]:
+        vector[sxyz[T]]& get_coord()
+
+cdef extern from "utils.h" namespace "ttcr" nogil:
+    void buildReflectors[T](MSHReader&, vector[sxyz[T]]&, size_t, int,
+                            vector[Rcv[T]]&, size_t) except +
+
+
+cdef extern from "Ensemble.h" namespace "ttcr" nogil:
+    cdef cppclass Ensemble[T1,T2]:
+        Ensemble(Grid3D[T1,T2]&) except +
+        void addModel(vector[T1]&) except +
+        size_t size()
+        void raytrace(vector[vector[sxyz[T1]]]& Tx,
+                      vector[vector[T1]]& t0,
+                      vector[sxyz[T1]]& Rx,
+                      T1* tt, size_t nThreads) except +
+
+
+cdef extern from "MultiPhase.h" namespace "ttcr" nogil:
+    cdef cppclass MultiPhase[T1,S,G]:
+        MultiPhase(G&, vector[vector[S]]&, vector[vector[size_t]]&) except +
+        void setReciprocalTables(int)
+        size_t getNlegs()
+        void raytrace(vector[vector[S]]& Tx,
+                      vector[vector[T1]]& t0,
+                      vector[S]& Rx,
+                      vector[vector[vector[T1]]]& tt,
+                      size_t nThreads) except +
+
+
 cdef extern from "Grid2D.h" namespace "ttcr" nogil:
     cdef cppclass Grid2D[T1,T2,S]:
         size_t getNthreads()
         void setSlowness(vector[T1]&) except +
         void getSlowness(vector[T1]&) except +
         void getTT(vector[T1]& tt, size_t threadNo) except +
+        void getTraveltimes(vector[S]& pts, T1* traveltimes,
+                            size_t threadNo) except +
         void raytrace(vector[S]& Tx,
                       vector[T1]& t0,
                       vector[S]& Rx,
@@ -151,7 +253,7 @@ cdef extern from "Grid2D.h" namespace "ttcr" nogil:
                       vector[T1]& t0,
                       vector[S]& Rx,
                       vector[T1]& traveltimes,
-                      vector[vector[sxz[T1]]]& r_data,
+                      vector[vector[S]]& r_data,
                       size_t threadNo) except +
         void raytrace(vector[S]& Tx,
                       vector[T1]& t0,
@@ -210,3 +312,27 @@ cdef extern from "Grid2Dunsp.h" namespace "ttcr" nogil:
 cdef extern from "Grid2Dunfs.h" namespace "ttcr" nogil:
     cdef cppclass Grid2Dunfs[T1,T2,NODE,S](Grid2Dun[T1,T2,NODE,S]):
         Grid2Dunfs(vector[S]&, vector[triangleElem[T2]]&, T1, int, size_t, bool) except +
+
+
+cdef extern from "ShotProcesses.h" namespace "ttcr" nogil:
+    void raytraceProcesses(Grid3D[double,uint32_t]&,
+                           vector[vector[sxyz[double]]]&,
+                           vector[vector[double]]&,
+                           vector[vector[sxyz[double]]]&,
+                           vector[vector[double]]&, size_t) except +
+
+
+cdef extern from "Batch.h" namespace "ttcr" nogil:
+    void raytraceBatch(Grid2D[double,uint32_t,sxyz[double]]&,
+                       vector[vector[sxyz[double]]]& Tx,
+                       vector[vector[double]]& t0,
+                       vector[vector[sxyz[double]]]& Rx,
+                       vector[vector[double]]& tt,
+                       size_t nThreads) except +
+    void raytraceBatch(Grid2D[double,uint32_t,sxyz[double]]&,
+                       vector[vector[sxyz[double]]]& Tx,
+                       vector[vector[double]]& t0,
+                       vector[vector[sxyz[double]]]& Rx,
+                       vector[vector[double]]& tt,
+                       vector[vector[vector[sxyz[double]]]]* r_data,
+                       size_t nThreads) except +
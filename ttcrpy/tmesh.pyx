@@ -2,10 +2,11 @@
 """
 Raytracing on unstructured triangular and tetrahedral meshes
 
-This module contains two classes to perform traveltime computation and
+This module contains three classes to perform traveltime computation and
 raytracing on unstructured meshes:
     - `Mesh2d` for 2D media
     - `Mesh3d` for 3D media
+    - `Mesh2ds` for undulated surfaces (triangular meshes in 3D space)
 
     Two general algorithms are implemented
         - the Shortest-Path Method
@@ -28,9 +29,11 @@ import scipy.sparse as sp
 import vtk
 from vtk.util import numpy_support
 
-from ttcrpy.tmesh cimport Grid3D, Grid3Ducfs, Grid3Ducsp, Grid3Ducdsp, \
-    Grid3Dunfs, Grid3Dunsp, Grid3Dundsp, Grid2D, Grid2Duc, Grid2Dun, \
-    Grid2Ducsp, Grid2Ducfs, Grid2Dunsp, Grid2Dunfs
+from ttcrpy.tmesh cimport Grid3D, Grid3Ducfs, Grid3Ducfim, Grid3Ducsp, \
+    Grid3Ducdsp, Grid3Dunfs, Grid3Dunfim, Grid3Dunsp, Grid3Dundsp, Grid2D, \
+    Grid2Duc, Grid2Dun, Grid2Ducsp, Grid2Ducfs, Grid2Dunsp, Grid2Dunfs, \
+    Renumbering, MultiPhase, RayPaths, raytraceBatch, raytraceProcesses, \
+    Ensemble, FieldCache, MSHReader, Rcv, buildReflectors
 
 cdef extern from "verbose.h" namespace "ttcr" nogil:
     void setVerbose(int)
@@ -45,6 +48,94 @@ def set_verbose(v):
     """
     setVerbose(v)
 
+def _renumbering_method(reorder):
+    if reorder is None:
+        return 0
+    elif reorder == 'morton':
+        return 1
+    elif reorder == 'rcm':
+        return 2
+    raise ValueError('Renumbering method {0:s} undefined'.format(reorder))
+
+
+cdef _flat_rays(vector[vector[vector[sxyz[double]]]]& r_data, iRx, size_t nrcv):
+    # raypaths packed in the order of rcv: ray i has points
+    # coords[offsets[i]:offsets[i+1], :]
+    cdef RayPaths[float, uint32_t] rp
+    cdef size_t i, n, nt, npts
+    cdef const float* c
+    cdef float[::1] cv
+    ind = np.empty((nrcv, 2), dtype=np.int64)
+    for n in range(len(iRx)):
+        for nt in range(len(iRx[n])):
+            ind[iRx[n][nt], 0] = n
+            ind[iRx[n][nt], 1] = nt
+    for i in range(nrcv):
+        n = ind[i, 0]
+        nt = ind[i, 1]
+        rp.append(r_data[n][nt])
+    offsets = np.empty((rp.size()+1,), dtype=np.int64)
+    for i in range(rp.size()+1):
+        offsets[i] = rp.getOffsets()[i]
+    npts = rp.getNumberOfPoints()
+    if npts == 0:
+        return offsets, np.empty((0, 3), dtype=np.float32)
+    c = rp.getCoordinates().data()
+    coords = np.empty((3*npts,), dtype=np.float32)
+    cv = coords
+    for i in range(3*npts):
+        cv[i] = c[i]
+    return offsets, coords.reshape((npts, 3))
+
+def reflector_points(filename, n_secondary=2, n_threads=1):
+    """
+    reflector_points(filename, n_secondary=2, n_threads=1)
+
+    Points sampling the reflectors of a mesh, i.e. the physical surfaces
+    of a gmsh file, as used to compute traveltimes of reflected waves
+
+    Parameters
+    ----------
+    filename : str
+        name of mesh file (gmsh format 2.2)
+    n_secondary : int
+        number of secondary nodes per edge, as for Mesh3d (default is 2)
+    n_threads : int
+        number of threads used to compute the points (default is 1)
+
+    Returns
+    -------
+    points : dict
+        coordinates of the points, with shape (npts, 3), for each reflector
+        name; vertices of the triangles come first, followed by points on
+        the edges and on the faces
+    """
+    cdef MSHReader* reader
+    cdef vector[sxyz[double]] nodes
+    cdef vector[Rcv[double]] reflectors
+    cdef vector[string] names
+    cdef size_t n, i
+    fname = filename.encode('utf-8')
+    reader = new MSHReader(fname)
+    try:
+        if not reader.isValid():
+            raise IOError('File {0:s} is not a valid gmsh 2.2 file'.format(filename))
+        names = reader.getPhysicalNames(2)
+        reader.readNodes3D[double](nodes)
+        buildReflectors[double](reader[0], nodes, 1, n_secondary, reflectors,
+                                n_threads)
+    finally:
+        del reader
+    points = {}
+    for n in range(reflectors.size()):
+        pts = np.empty((reflectors[n].get_coord().size(), 3))
+        for i in range(pts.shape[0]):
+            pts[i, 0] = reflectors[n].get_coord()[i].x
+            pts[i, 1] = reflectors[n].get_coord()[i].y
+            pts[i, 2] = reflectors[n].get_coord()[i].z
+        points[names[n].decode('utf-8')] = pts
+    return points
+
 
 cdef class Mesh3d:
     """class to perform raytracing with tetrahedral meshes
@@ -53,7 +144,7 @@ cdef class Mesh3d:
 
     Mesh3d(nodes, tetra, n_threads, cell_slowness, method, gradient_method,
            tt_from_rp, interp_vel, eps, maxit, min_dist, n_secondary,
-           n_tertiary, radius_tertiary)
+           n_tertiary, radius_tertiary, snapshot, factored, reorder)
 
         Parameters
         ----------
@@ -70,6 +161,8 @@ cdef class Mesh3d:
                 - 'FSM' : fast marching method
                 - 'SPM' : shortest path method
                 - 'DSPM' : dynamic shortest path
+                - 'FIM' : fast iterative method, a single source uses
+                          n_threads threads
         gradient_method : int
             method to compute traveltime gradient (default is 1)
                 - 0 : least-squares first-order
@@ -81,7 +174,7 @@ cdef class Mesh3d:
             interpolate velocity instead of slowness at nodes (for
             cell_slowness == False or FSM) (defauls is False)
         eps : double
-            convergence criterion (FSM) (default is 1e-15)
+            convergence criterion (FSM & FIM) (default is 1e-15)
         maxit : int
             max number of sweeping iterations (FSM) (default is 20)
         min_dist : double
@@ -92,7 +185,26 @@ cdef class Mesh3d:
             number of tertiary nodes (DSPM) (default is 2)
         radius_tertiary : double
             radius of sphere around source that includes tertiary nodes (DSPM)
-            (default is 1)
+            (default is 1).  See set_tertiary_nodes_cache to reuse them when
+            raytracing again from the same source positions.
+        snapshot : bytes-like object
+            binary snapshot of the mesh, as returned by save_snapshot.  The
+            mesh is restored from the snapshot instead of being built; nodes
+            and tetra must be those used to create the saved mesh, and
+            method and parameters must be the same.  Any object supporting
+            the buffer protocol can be used, e.g. a mmap of a snapshot file
+            (default is None)
+        factored : bool
+            solve the factored eikonal equation, which removes the error due
+            to the curvature of the wavefront near the source (FSM & FIM,
+            single source) (default is False)
+        reorder : str
+            renumber nodes and cells to improve memory locality during
+            raytracing (default is None)
+                - 'morton' : nodes sorted along a Morton (Z-order) curve
+                - 'rcm' : reverse Cuthill-McKee ordering of the mesh graph
+            Slowness, traveltimes and gradients are always given in the
+            numbering of the input nodes and tetra.
 
     """
     cdef bool cell_slowness
@@ -107,6 +219,11 @@ cdef class Mesh3d:
     cdef uint32_t n_secondary
     cdef uint32_t n_tertiary
     cdef double radius_tertiary
+    cdef bool factored
+    cdef int renumbering
+    cdef object reorder
+    cdef object node_map
+    cdef object cell_map
     cdef vector[sxyz[double]] no
     cdef vector[tetrahedronElem[uint32_t]] tet
     cdef Grid3D[double, uint32_t]* grid
@@ -118,7 +235,7 @@ cdef class Mesh3d:
                   bool tt_from_rp=1, bool interp_vel=0,
                   double eps=1.e-15, int maxit=20, double min_dist=1.e-5,
                   uint32_t n_secondary=2, uint32_t n_tertiary=2,
-                  double radius_tertiary=1.0):
+                  double radius_tertiary=1.0, snapshot=None, bool factored=0, reorder=None):
 
         self.cell_slowness = cell_slowness
         self._n_threads = n_threads
@@ -131,8 +248,26 @@ cdef class Mesh3d:
         self.n_secondary = n_secondary
         self.n_tertiary = n_tertiary
         self.radius_tertiary = radius_tertiary
+        self.factored = factored
+        self.reorder = reorder
+        self.renumbering = _renumbering_method(reorder)
 
         cdef double source_radius = 0.0
+        cdef Renumbering[uint32_t] renum
+
+        # when restored from a snapshot, the grid is created without nodes
+        # nor cells, and these are read from the snapshot
+        cdef vector[sxyz[double]] no_nodes
+        cdef vector[tetrahedronElem[uint32_t]] no_tet
+        cdef vector[sxyz[double]]* no = &self.no
+        cdef vector[tetrahedronElem[uint32_t]]* tet = &self.tet
+        cdef const unsigned char[::1] buf
+        if snapshot is not None:
+            buf = snapshot
+            if buf.shape[0] == 0:
+                raise ValueError('Empty snapshot')
+            no = &no_nodes
+            tet = &no_tet
 
         cdef int n
         for n in range(nodes.shape[0]):
@@ -144,24 +279,29 @@ cdef class Mesh3d:
                                                          tetra[n, 1],
                                                          tetra[n, 2],
                                                          tetra[n, 3]))
+        if self.renumbering != 0:
+            renum.build(self.no, self.tet, self.renumbering)
+            renum.apply(self.no, self.tet)
+            self.node_map = np.array(renum.getNodeMap(), dtype=np.int64)
+            self.cell_map = np.array(renum.getCellMap(), dtype=np.int64)
 
         if cell_slowness:
             if method == 'FSM':
                 self.method = b'f'
-                self.grid = new Grid3Ducfs[double,uint32_t](self.no, self.tet,
+                self.grid = new Grid3Ducfs[double,uint32_t](no[0], tet[0],
                                                             eps, maxit,
                                                             gradient_method,
                                                             tt_from_rp,
                                                             min_dist, n_threads)
             elif method == 'SPM':
                 self.method = b's'
-                self.grid = new Grid3Ducsp[double,uint32_t](self.no, self.tet,
+                self.grid = new Grid3Ducsp[double,uint32_t](no[0], tet[0],
                                                             n_secondary,
                                                             tt_from_rp,
                                                             min_dist, n_threads)
             elif method == 'DSPM':
                 self.method = b'd'
-                self.grid = new Grid3Ducdsp[double,uint32_t](self.no, self.tet,
+                self.grid = new Grid3Ducdsp[double,uint32_t](no[0], tet[0],
                                                              n_secondary,
                                                              n_tertiary,
                                                              source_radius,
@@ -170,13 +310,20 @@ cdef class Mesh3d:
                                                              min_dist,
                                                              radius_tertiary,
                                                              n_threads)
-
+            elif method == 'FIM':
+                self.method = b'i'
+                self.grid = new Grid3Ducfim[double,uint32_t](no[0], tet[0],
+                                                             eps,
+                                                             gradient_method,
+                                                             tt_from_rp,
+                                                             min_dist, n_threads,
+                                                             n_threads)
             else:
                 raise ValueError('Method {0:s} undefined'.format(method))
         else:
             if method == 'FSM':
                 self.method = b'f'
-                self.grid = new Grid3Dunfs[double,uint32_t](self.no, self.tet,
+                self.grid = new Grid3Dunfs[double,uint32_t](no[0], tet[0],
                                                             eps, maxit,
                                                             gradient_method,
                                                             interp_vel,
@@ -184,14 +331,14 @@ cdef class Mesh3d:
                                                             min_dist, n_threads)
             elif method == 'SPM':
                 self.method = b's'
-                self.grid = new Grid3Dunsp[double,uint32_t](self.no, self.tet,
+                self.grid = new Grid3Dunsp[double,uint32_t](no[0], tet[0],
                                                             n_secondary,
                                                             interp_vel,
                                                             tt_from_rp,
                                                             min_dist, n_threads)
             elif method == 'DSPM':
                 self.method = b'd'
-                self.grid = new Grid3Dundsp[double,uint32_t](self.no, self.tet,
+                self.grid = new Grid3Dundsp[double,uint32_t](no[0], tet[0],
                                                              n_secondary,
                                                              n_tertiary,
                                                              source_radius,
@@ -201,9 +348,23 @@ cdef class Mesh3d:
                                                              min_dist,
                                                              radius_tertiary,
                                                              n_threads)
+            elif method == 'FIM':
+                self.method = b'i'
+                self.grid = new Grid3Dunfim[double,uint32_t](no[0], tet[0],
+                                                             eps,
+                                                             gradient_method,
+                                                             interp_vel,
+                                                             tt_from_rp,
+                                                             min_dist, n_threads,
+                                                             n_threads)
             else:
                 raise ValueError('Method {0:s} undefined'.format(method))
 
+        if snapshot is not None:
+            self.grid.setSnapshot(<const char*>&buf[0], buf.shape[0])
+        if factored:
+            self.grid.setFactored(True)
+
     def __dealloc__(self):
         del self.grid
 
@@ -214,6 +375,8 @@ cdef class Mesh3d:
             method = 'SPM'
         elif self.method == b'd':
             method = 'DSPM'
+        elif self.method == b'i':
+            method = 'FIM'
 
         nodes = np.ndarray((self.no.size(), 3))
         tetra = np.ndarray((self.tet.size(), 4), dtype=int)
@@ -226,13 +389,56 @@ cdef class Mesh3d:
         for n in range(tetra.shape[0]):
             for nn in range(4):
                 tetra[n, nn] = self.tet[n].i[nn]
+        if self.renumbering != 0:
+            nodes = self._to_external(nodes, False)
+            tetra = self._to_external(self.node_map[tetra], True)
 
         constructor_params = (nodes, tetra, method, self.cell_slowness,
                               self._n_threads, self.tt_from_rp, self.interp_vel,
                               self.eps, self.maxit, self.gradient_method,
                               self.min_dist, self.n_secondary, self.n_tertiary,
-                              self.radius_tertiary)
-        return (_rebuild3d, constructor_params)
+                              self.radius_tertiary, self.factored,
+                              self.reorder)
+        return (_rebuild3d, (constructor_params, self.save_snapshot()))
+
+    def save_snapshot(self, filename=None):
+        """
+        save_snapshot(filename=None)
+
+        Binary snapshot of the built mesh (nodes, secondary nodes, neighbors
+        and slowness), which allows restoring the mesh without building it
+        again (see constructor)
+
+        Parameters
+        ----------
+        filename : str
+            name of file where the snapshot is written (default is None)
+
+        Returns
+        -------
+        snapshot : bytes
+            snapshot of the mesh, if filename is None
+        """
+        cdef string buf
+        self.grid.getSnapshot(buf)
+        if filename is None:
+            return buf
+        with open(filename, 'wb') as f:
+            f.write(buf)
+
+    def _to_internal(self, data, cells):
+        # values at nodes or cells, from input to mesh numbering
+        if self.renumbering == 0:
+            return data
+        return data[self.cell_map if cells else self.node_map]
+
+    def _to_external(self, data, cells):
+        # values at nodes or cells, from mesh to input numbering
+        if self.renumbering == 0:
+            return data
+        out = np.empty_like(data)
+        out[self.cell_map if cells else self.node_map] = data
+        return out
 
     @property
     def n_threads(self):
@@ -265,6 +471,23 @@ cdef class Mesh3d:
         """
         return self.tet.size()
 
+    def get_secondary_nodes(self):
+        """
+        Returns
+        -------
+        np ndarray, shape (nsecondary, 3)
+            coordinates of secondary nodes of the grid (SPM and DSPM)
+        """
+        cdef vector[sxyz[double]] pts
+        cdef size_t n
+        self.grid.getSecondaryNodes(pts)
+        out = np.empty((pts.size(), 3))
+        for n in range(pts.size()):
+            out[n, 0] = pts[n].x
+            out[n, 1] = pts[n].y
+            out[n, 2] = pts[n].z
+        return out
+
     def get_grid_traveltimes(self, thread_no=0):
         """
         get_grid_traveltimes(thread_no=0)
@@ -289,6 +512,201 @@ cdef class Mesh3d:
         tt = np.empty((tmp.size(),))
         for n in range(tmp.size()):
             tt[n] = tmp[n]
+        return self._to_external(tt, False)
+
+    def set_warm_start(self, warm_start, size_t max_bytes=268435456):
+        """
+        set_warm_start(warm_start, max_bytes=268435456)
+
+        Keep the traveltimes computed for each source, and start the next
+        computation for the same source from them rather than from infinity
+        (FSM).  Traveltimes are scaled by the largest increase of slowness,
+        so that they remain upper bounds of the new ones.  If slowness did
+        not increase, only the nodes where it changed and the nodes of the
+        cells they belong to are updated at first.  Traveltimes and slowness
+        of all nodes are kept for each source, up to max_bytes (least
+        recently used sources are dropped first), and are discarded when
+        warm_start is False.
+
+        Parameters
+        ----------
+        warm_start : bool
+        max_bytes : int
+            maximum size of the kept fields, in bytes
+        """
+        self.grid.setWarmStart(warm_start, max_bytes)
+
+    def set_traveltime_seed(self, tt, thread_no=0):
+        """
+        set_traveltime_seed(tt, thread_no=0)
+
+        Start the next computation in thread thread_no from traveltimes tt
+        rather than from infinity (FSM).  All nodes are updated.
+
+        Parameters
+        ----------
+        tt : np ndarray, shape (nnodes,)
+            traveltimes at primary nodes, as returned by get_grid_traveltimes
+        thread_no : int
+            thread of the next computation (default is 0)
+        """
+        if thread_no >= self._n_threads:
+            raise ValueError('Thread number is larger than number of threads')
+        if tt.size != self.no.size():
+            raise ValueError('tt has wrong size')
+        cdef vector[double] vtt
+        cdef vector[double] vs
+        cdef double[::1] tt_view = np.ascontiguousarray(self._to_internal(tt.ravel(), False),
+                                                        dtype=np.double)
+        cdef size_t n
+        for n in range(tt_view.shape[0]):
+            vtt.push_back(tt_view[n])
+        self.grid.setTraveltimeSeed(vtt, vs, thread_no)
+
+    def get_niter(self, thread_no=0):
+        """
+        get_niter(thread_no=0)
+
+        Number of sweeping iterations of the last computation in thread
+        thread_no (FSM)
+
+        Parameters
+        ----------
+        thread_no : int
+            thread used to computed traveltimes (default is 0)
+
+        Returns
+        -------
+        niter : int
+        """
+        if thread_no >= self._n_threads:
+            raise ValueError('Thread number is larger than number of threads')
+        return self.grid.getNiter(thread_no)
+
+    def set_tertiary_nodes_cache(self, n_sources):
+        """
+        set_tertiary_nodes_cache(n_sources)
+
+        Keep the tertiary nodes built around the last n_sources sources of
+        each thread (DSPM), so that they are reused when raytracing again
+        from the same positions, e.g. at each iteration of an inversion.
+        Each source holds about as many nodes as its sphere of tertiary
+        nodes; the least recently used are dropped first.
+
+        Parameters
+        ----------
+        n_sources : int
+            number of sources whose nodes are kept, 0 (the default) to
+            keep only those of the last source
+        """
+        self.grid.setTempNodesCache(n_sources)
+
+    def set_edge_tables(self, size_t max_bytes):
+        """
+        set_edge_tables(max_bytes)
+
+        Set memory budget of the tables of lengths of the edges joining the
+        nodes of the cells, used by the SPM.  Lengths are computed on the
+        fly if tables would take more than the budget.
+
+        Parameters
+        ----------
+        max_bytes : int
+            memory budget (256 MB when grid is built), 0 disables tables
+        """
+        self.grid.setEdgeTables(max_bytes)
+
+    def has_edge_tables(self):
+        """
+        Returns
+        -------
+        bool:
+            True if tables of edge lengths are used (see set_edge_tables)
+        """
+        return self.grid.hasEdgeTables()
+
+    def set_traveltime_cache(self, max_bytes, spill_file=None, spill_bytes=0):
+        """
+        set_traveltime_cache(max_bytes, spill_file=None, spill_bytes=0)
+
+        Keep the traveltimes computed at the nodes for each source, so that
+        raytrace only has to interpolate them at the receivers when called
+        again for the same source (coordinates and t0) and slowness.  The
+        cache is emptied when slowness is set.
+
+        Parameters
+        ----------
+        max_bytes : int
+            size of the cache in memory, the least recently used traveltimes
+            being discarded first.  0 disables the cache.
+        spill_file : str
+            memory-mapped file where traveltimes discarded from memory are
+            moved (default is None, discarded traveltimes are lost).  The
+            file is removed when the cache is disabled.
+        spill_bytes : int
+            size of spill_file
+        """
+        cdef string fname
+        if spill_file is not None:
+            fname = spill_file.encode('utf-8')
+        self.grid.setTraveltimeCache(max_bytes, fname, spill_bytes)
+
+    def get_traveltime_cache_stats(self):
+        """
+        get_traveltime_cache_stats()
+
+        Usage of the traveltime cache
+
+        Returns
+        -------
+        stats : dict
+            'size': number of traveltime fields in memory,
+            'spilled': number of fields in spill file,
+            'bytes': memory used by fields,
+            'hits', 'spill_hits', 'misses': number of calls to raytrace that
+            found the fields in memory, in the spill file, or not at all.
+            None if the cache is disabled.
+        """
+        cdef const FieldCache[double]* c = self.grid.getTraveltimeCache()
+        if c == NULL:
+            return None
+        return {'size': c.size(), 'spilled': c.getNumberSpilled(),
+                'bytes': c.getBytes(), 'hits': c.getHits(),
+                'spill_hits': c.getSpillHits(), 'misses': c.getMisses()}
+
+    def get_tt_at(self, pts, thread_no=0):
+        """
+        get_tt_at(pts, thread_no=0)
+
+        Obtain traveltimes at arbitrary points, from the traveltimes computed
+        by the last call to raytrace performed with thread "thread_no"
+
+        Parameters
+        ----------
+        pts : np ndarray, shape (npts, 3)
+            coordinates of points
+        thread_no : int
+            thread used to computed traveltimes (default is 0)
+
+        Returns
+        -------
+        tt: np ndarray, shape (npts,)
+            traveltimes
+        """
+        if thread_no >= self._n_threads:
+            raise ValueError('Thread number is larger than number of threads')
+        pts = np.atleast_2d(np.asarray(pts, dtype=np.double))
+        if pts.ndim != 2 or pts.shape[1] != 3:
+            raise ValueError('pts should be npts x 3')
+        cdef vector[sxyz[double]] vpts
+        cdef size_t n
+        vpts.reserve(pts.shape[0])
+        for n in range(pts.shape[0]):
+            vpts.push_back(sxyz[double](pts[n, 0], pts[n, 1], pts[n, 2]))
+        tt = np.empty((pts.shape[0],))
+        cdef double[::1] tt_view = tt
+        if vpts.size() > 0:
+            self.grid.getTraveltimes(vpts, &tt_view[0], thread_no)
         return tt
 
     def set_slowness(self, slowness):
@@ -306,6 +724,7 @@ cdef class Mesh3d:
 
         if not slowness.flags['C_CONTIGUOUS']:
             slowness = np.ascontiguousarray(slowness)
+        slowness = self._to_internal(slowness.flatten(), self.cell_slowness)
 
         cdef vector[double] slown
         cdef int i
@@ -328,6 +747,7 @@ cdef class Mesh3d:
 
         if not velocity.flags['C_CONTIGUOUS']:
             velocity = np.ascontiguousarray(velocity)
+        velocity = self._to_internal(velocity.flatten(), self.cell_slowness)
 
         cdef vector[double] slown
         cdef int i
@@ -336,10 +756,12 @@ cdef class Mesh3d:
         self.grid.setSlowness(slown)
 
     def raytrace(self, source, rcv, slowness=None, thread_no=None,
-                 aggregate_src=False, return_rays=False):
+                 aggregate_src=False, return_rays=False, tt_obs=None,
+                 n_procs=1):
         """
         raytrace(source, rcv, slowness=None, thread_no=None,
-              aggregate_src=False, return_rays=False) -> tt, rays
+              aggregate_src=False, return_rays=False, tt_obs=None,
+              n_procs=1) -> tt, rays
 
         Perform raytracing
 
@@ -358,8 +780,18 @@ cdef class Mesh3d:
             sources and value of n_threads in constructor
         aggregate_src : bool (False by default)
             if True, all source coordinates belong to a single event
-        return_rays : bool (False by default)
-            Return raypaths
+        return_rays : bool or 'flat' (False by default)
+            Return raypaths; with 'flat', raypaths are packed in two arrays
+        tt_obs : np.ndarray (None by default)
+            observed travel times, one value per row of rcv.  If given, the
+            gradient of the misfit 0.5*sum((tt-tt_obs)**2) with respect to
+            slowness is computed with the adjoint-state method and returned
+            along with tt, without computing rays (FSM and FIM only)
+        n_procs : int (1 by default)
+            Number of processes sharing the sources, when rays are not
+            returned.  The mesh is shared by the processes without being
+            copied, and each process uses thread 0 of the mesh (POSIX
+            systems only, sources are processed sequentially otherwise)
 
         Returns
         -------
@@ -367,6 +799,10 @@ cdef class Mesh3d:
             travel times for the appropriate source-rcv  (see Notes below)
         rays : :obj:`list` of :obj:`np.ndarray`
             Coordinates of segments forming raypaths (if return_rays is True)
+            If return_rays is 'flat', tuple (offsets, coords) where the points
+            of ray i are coords[offsets[i]:offsets[i+1], :]
+        grad : np.ndarray
+            gradient of the misfit w/r to slowness (if tt_obs is given)
 
         Notes
         -----
@@ -397,6 +833,15 @@ cdef class Mesh3d:
         if self.method == b'd' and aggregate_src:
             raise ValueError('Cannot aggregate source with DSPM raytracing')
 
+        if tt_obs is not None:
+            if return_rays:
+                raise ValueError('tt_obs cannot be used with return_rays')
+            if self.method != b'f' and self.method != b'i':
+                raise NotImplementedError('misfit gradient available only with FSM and FIM')
+            tt_obs = np.asarray(tt_obs).flatten()
+            if tt_obs.size != rcv.shape[0]:
+                raise ValueError('tt_obs and rcv should have the same number of rows')
+
         evID = None
         if source.shape[1] == 5:
             src = source[:,2:5]
@@ -430,6 +875,8 @@ cdef class Mesh3d:
         cdef vector[vector[double]] vtt
 
         cdef vector[vector[vector[sxyz[double]]]] r_data
+        cdef vector[vector[double]] vtobs
+        cdef vector[double] grad
         cdef size_t thread_nb
 
         cdef int i, n, n2, nt
@@ -495,7 +942,24 @@ cdef class Mesh3d:
                 vtt[n].resize(vRx[n].size())
 
         tt = np.zeros((rcv.shape[0],))
-        if nTx < self._n_threads or self._n_threads == 1:
+        if tt_obs is not None:
+            vtobs.resize(nTx)
+            for n in range(nTx):
+                for nt in iRx[n]:
+                    vtobs[n].push_back(tt_obs[nt])
+            self.grid.getMisfitGradient(vTx, vt0, vRx, vtobs, vtt, grad)
+            for n in range(nTx):
+                for nt in range(vtt[n].size()):
+                    tt[iRx[n][nt]] = vtt[n][nt]
+            g = np.empty((grad.size(),))
+            for n in range(grad.size()):
+                g[n] = grad[n]
+            return tt, self._to_external(g, self.cell_slowness)
+
+        if n_procs > 1 and nTx > 1 and thread_no is None and return_rays==False:
+            raytraceProcesses(self.grid[0], vTx, vt0, vRx, vtt, n_procs)
+
+        elif nTx < self._n_threads or self._n_threads == 1:
             if return_rays==False:
                 for n in range(nTx):
                     self.grid.raytrace(vTx[n], vt0[n], vRx[n], vtt[n], 0)
@@ -512,6 +976,9 @@ cdef class Mesh3d:
                 self.grid.raytrace(vTx[0], vt0[0], vRx[0], vtt[0], r_data[0], thread_nb)
                 for nt in range(vtt[0].size()):
                     tt[nt] = vtt[0][nt]
+                if return_rays == 'flat':
+                    return tt, _flat_rays(r_data, [np.arange(vRx[0].size())],
+                                          vRx[0].size())
                 rays = []
                 for n2 in range(vRx.size()):
                     r = np.empty((r_data[0][n2].size(), 3))
@@ -538,7 +1005,9 @@ cdef class Mesh3d:
             for nt in range(vtt[n].size()):
                 tt[iRx[n][nt]] = vtt[n][nt]
 
-        if return_rays:
+        if return_rays == 'flat':
+            rays = _flat_rays(r_data, iRx, rcv.shape[0])
+        elif return_rays:
             rays = [ [0.0] for n in range(rcv.shape[0])]
             for n in range(nTx):
                 r = [ [0.0] for i in range(vRx[n].size())]
@@ -556,6 +1025,178 @@ cdef class Mesh3d:
         else:
             return tt, rays
 
+    def raytrace_phases(self, source, rcv, interfaces, phases, slowness=None,
+                        reciprocal=None):
+        """
+        raytrace_phases(source, rcv, interfaces, phases, slowness=None,
+                        reciprocal=None) -> tt
+
+        Compute traveltimes of multi-leg phases (e.g. reflections)
+
+        Parameters
+        ----------
+        source : 2D np.ndarray with 3 or 4 columns
+            one row per source, columns are x, y and z coordinates, with
+            origin time in the 1st column if 4 columns are given
+        rcv : 2D np.ndarray with 3 columns
+            coordinates of receivers, common to all sources
+        interfaces : :obj:`list` of 2D np.ndarray with 3 columns
+            coordinates of points discretizing each interface
+        phases : :obj:`list` of sequences of int
+            indices of the interfaces visited by each phase, between source
+            and receivers; an empty sequence corresponds to the direct wave
+        slowness : np ndarray, (None by default)
+            if None, slowness must have been assigned previously
+        reciprocal : bool (None by default)
+            compute the last leg of the phases from receiver-interface
+            tables; if None, tables are used if there are fewer receivers
+            than sources
+
+        Returns
+        -------
+        tt : np.ndarray of size nphases x nsrc x nrcv
+            travel times
+
+        Notes
+        -----
+        Legs shared by several phases are computed once per source, and all
+        (source, leg) pairs are distributed over the threads of the grid.
+        """
+        if source.ndim != 2 or rcv.ndim != 2:
+            raise ValueError('source and rcv should be 2D arrays')
+        if source.shape[1] == 3:
+            src = source
+            t0 = np.zeros((source.shape[0],))
+        elif source.shape[1] == 4:
+            src = source[:,1:4]
+            t0 = source[:,0]
+        else:
+            raise ValueError('source should be either nsrc x 3 or 4')
+        if rcv.shape[1] != 3:
+            raise ValueError('rcv should be nrcv x 3')
+
+        if slowness is not None:
+            self.set_slowness(slowness)
+
+        cdef vector[vector[sxyz[double]]] vTx
+        cdef vector[vector[double]] vt0
+        cdef vector[sxyz[double]] vRx
+        cdef vector[vector[sxyz[double]]] vitf
+        cdef vector[vector[size_t]] vph
+        cdef vector[vector[vector[double]]] vtt
+        cdef MultiPhase[double, sxyz[double], Grid3D[double, uint32_t]]* mp
+
+        vTx.resize(src.shape[0])
+        vt0.resize(src.shape[0])
+        for n in range(src.shape[0]):
+            vTx[n].push_back(sxyz[double](src[n,0], src[n,1], src[n,2]))
+            vt0[n].push_back(t0[n])
+        for r in rcv:
+            vRx.push_back(sxyz[double](r[0], r[1], r[2]))
+        vitf.resize(len(interfaces))
+        for n in range(len(interfaces)):
+            pts = np.asarray(interfaces[n], dtype=np.double)
+            if pts.ndim != 2 or pts.shape[1] != 3:
+                raise ValueError('interfaces should be npts x 3')
+            for p in pts:
+                vitf[n].push_back(sxyz[double](p[0], p[1], p[2]))
+        vph.resize(len(phases))
+        for n in range(len(phases)):
+            for i in phases[n]:
+                vph[n].push_back(i)
+
+        mp = new MultiPhase[double, sxyz[double], Grid3D[double, uint32_t]](self.grid[0], vitf, vph)
+        if reciprocal is not None:
+            mp.setReciprocalTables(1 if reciprocal else 0)
+        try:
+            mp.raytrace(vTx, vt0, vRx, vtt, self._n_threads)
+        finally:
+            del mp
+
+        tt = np.empty((vtt.size(), vTx.size(), vRx.size()))
+        for n in range(vtt.size()):
+            for ns in range(vtt[n].size()):
+                for nr in range(vtt[n][ns].size()):
+                    tt[n, ns, nr] = vtt[n][ns][nr]
+        return tt
+
+    def raytrace_ensemble(self, source, rcv, slowness):
+        """
+        raytrace_ensemble(source, rcv, slowness) -> tt
+
+        Compute traveltimes through an ensemble of slowness models
+
+        Parameters
+        ----------
+        source : 2D np.ndarray with 3 or 4 columns
+            one row per source, columns are x, y and z coordinates, with
+            origin time in the 1st column if 4 columns are given
+        rcv : 2D np.ndarray with 3 columns
+            coordinates of receivers, common to all sources
+        slowness : np.ndarray
+            one model per row, with nparams values per row
+
+        Returns
+        -------
+        tt : np.ndarray of size nmodels x nsrc x nrcv
+            travel times
+
+        Notes
+        -----
+        The models share the geometry of the mesh, and the slowness at
+        secondary nodes is interpolated once per model.  The sources of each
+        model are distributed over the threads of the mesh, and the travel
+        times are written directly in the returned array.  The slowness
+        assigned to the mesh is left unchanged.
+        """
+        if source.ndim != 2 or rcv.ndim != 2:
+            raise ValueError('source and rcv should be 2D arrays')
+        if source.shape[1] == 3:
+            src = source
+            t0 = np.zeros((source.shape[0],))
+        elif source.shape[1] == 4:
+            src = source[:,1:4]
+            t0 = source[:,0]
+        else:
+            raise ValueError('source should be either nsrc x 3 or 4')
+        if rcv.shape[1] != 3:
+            raise ValueError('rcv should be nrcv x 3')
+        slowness = np.asarray(slowness, dtype=np.double)
+        if slowness.ndim != 2 or slowness.shape[1] != self.nparams:
+            raise ValueError('slowness should be nmodels x nparams')
+
+        cdef vector[vector[sxyz[double]]] vTx
+        cdef vector[vector[double]] vt0
+        cdef vector[sxyz[double]] vRx
+        cdef vector[double] slown
+        cdef Ensemble[double, uint32_t]* ens
+        cdef double[:, :, ::1] tt_view
+
+        vTx.resize(src.shape[0])
+        vt0.resize(src.shape[0])
+        for n in range(src.shape[0]):
+            vTx[n].push_back(sxyz[double](src[n,0], src[n,1], src[n,2]))
+            vt0[n].push_back(t0[n])
+        for r in rcv:
+            vRx.push_back(sxyz[double](r[0], r[1], r[2]))
+
+        tt = np.empty((slowness.shape[0], vTx.size(), vRx.size()))
+        if tt.size == 0:
+            return tt
+        tt_view = tt
+        ens = new Ensemble[double, uint32_t](self.grid[0])
+        try:
+            for k in range(slowness.shape[0]):
+                tmp = self._to_internal(slowness[k], self.cell_slowness)
+                slown.clear()
+                for i in range(tmp.size):
+                    slown.push_back(tmp[i])
+                ens.addModel(slown)
+            ens.raytrace(vTx, vt0, vRx, &tt_view[0, 0, 0], self._n_threads)
+        finally:
+            del ens
+        return tt
+
     def to_vtk(self, fields, filename):
         """
         to_vtk(fields, filename)
@@ -603,10 +1244,12 @@ cdef class Mesh3d:
                 scalar.SetNumberOfComponents(1)
                 scalar.SetNumberOfTuples(data.size)
                 if data.size == self.get_number_of_nodes():
+                    data = self._to_internal(data.flatten(), False)
                     for n in range(data.size):
                         scalar.SetTuple1(n, data[n])
                     ugrid.GetPointData().AddArray(scalar)
                 elif data.size == self.get_number_of_cells():
+                    data = self._to_internal(data.flatten(), True)
                     for n in range(data.size):
                         scalar.SetTuple1(n, data[n])
                     ugrid.GetCellData().AddArray(scalar)
@@ -726,7 +1369,7 @@ cdef class Mesh2d:
     Constructor:
 
     Mesh2d(nodes, tiangles, n_threads, cell_slowness, method, eps, maxit,
-          process_obtuse, n_secondary)
+          process_obtuse, n_secondary, reorder)
 
         Parameters
         ----------
@@ -752,6 +1395,13 @@ cdef class Mesh2d:
             with obtuse angle
         n_secondary : int
             number of secondary nodes (SPM) (default is 5)
+        reorder : str
+            renumber nodes and cells to improve memory locality during
+            raytracing (default is None)
+                - 'morton' : nodes sorted along a Morton (Z-order) curve
+                - 'rcm' : reverse Cuthill-McKee ordering of the mesh graph
+            Slowness, traveltimes and gradients are always given in the
+            numbering of the input nodes and triangles.
 
     """
     cdef bool cell_slowness
@@ -761,6 +1411,10 @@ cdef class Mesh2d:
     cdef int maxit
     cdef char method
     cdef uint32_t n_secondary
+    cdef int renumbering
+    cdef object reorder
+    cdef object node_map
+    cdef object cell_map
     cdef vector[sxz[double]] no
     cdef vector[triangleElem[uint32_t]] tri
     cdef Grid2D[double, uint32_t,sxz[double]]* grid
@@ -769,7 +1423,8 @@ cdef class Mesh2d:
                   np.ndarray[np.int64_t, ndim=2] triangles,
                   size_t n_threads=1, bool cell_slowness=1,
                   str method='FSM', double eps=1.e-15, int maxit=20,
-                  bool process_obtuse=1, uint32_t n_secondary=5):
+                  bool process_obtuse=1, uint32_t n_secondary=5,
+                  reorder=None):
 
         self.cell_slowness = cell_slowness
         self._n_threads = n_threads
@@ -777,7 +1432,10 @@ cdef class Mesh2d:
         self.maxit = maxit
         self.process_obtuse = process_obtuse
         self.n_secondary = n_secondary
+        self.reorder = reorder
+        self.renumbering = _renumbering_method(reorder)
 
+        cdef Renumbering[uint32_t] renum
         cdef int n
         for n in range(nodes.shape[0]):
             self.no.push_back(sxz[double](nodes[n, 0],
@@ -786,6 +1444,11 @@ cdef class Mesh2d:
             self.tri.push_back(triangleElem[uint32_t](triangles[n, 0],
                                                       triangles[n, 1],
                                                       triangles[n, 2]))
+        if self.renumbering != 0:
+            renum.build(self.no, self.tri, self.renumbering)
+            renum.apply(self.no, self.tri)
+            self.node_map = np.array(renum.getNodeMap(), dtype=np.int64)
+            self.cell_map = np.array(renum.getCellMap(), dtype=np.int64)
 
         if cell_slowness:
             if method == 'FSM':
@@ -841,13 +1504,30 @@ cdef class Mesh2d:
         for n in range(triangles.shape[0]):
             for nn in range(3):
                 triangles[n, nn] = self.tri[n].i[nn]
+        if self.renumbering != 0:
+            nodes = self._to_external(nodes, False)
+            triangles = self._to_external(self.node_map[triangles], True)
 
         constructor_params = (nodes, triangles,
                               method, self.cell_slowness,
                               self._n_threads,
                               self.eps, self.maxit, self.process_obtuse,
-                              self.n_secondary)
-        return (_rebuild2d, constructor_params)
+                              self.n_secondary, self.reorder)
+        return (_rebuild2d, (constructor_params,))
+
+    def _to_internal(self, data, cells):
+        # values at nodes or cells, from input to mesh numbering
+        if self.renumbering == 0:
+            return data
+        return data[self.cell_map if cells else self.node_map]
+
+    def _to_external(self, data, cells):
+        # values at nodes or cells, from mesh to input numbering
+        if self.renumbering == 0:
+            return data
+        out = np.empty_like(data)
+        out[self.cell_map if cells else self.node_map] = data
+        return out
 
     @property
     def n_threads(self):
@@ -904,6 +1584,41 @@ cdef class Mesh2d:
         tt = np.empty((tmp.size(),))
         for n in range(tmp.size()):
             tt[n] = tmp[n]
+        return self._to_external(tt, False)
+
+    def get_tt_at(self, pts, thread_no=0):
+        """
+        get_tt_at(pts, thread_no=0)
+
+        Obtain traveltimes at arbitrary points, from the traveltimes computed
+        by the last call to raytrace performed with thread "thread_no"
+
+        Parameters
+        ----------
+        pts : np ndarray, shape (npts, 2)
+            coordinates (x, z) of points
+        thread_no : int
+            thread used to computed traveltimes (default is 0)
+
+        Returns
+        -------
+        tt: np ndarray, shape (npts,)
+            traveltimes
+        """
+        if thread_no >= self._n_threads:
+            raise ValueError('Thread number is larger than number of threads')
+        pts = np.atleast_2d(np.asarray(pts, dtype=np.double))
+        if pts.ndim != 2 or pts.shape[1] != 2:
+            raise ValueError('pts should be npts x 2')
+        cdef vector[sxz[double]] vpts
+        cdef size_t n
+        vpts.reserve(pts.shape[0])
+        for n in range(pts.shape[0]):
+            vpts.push_back(sxz[double](pts[n, 0], pts[n, 1]))
+        tt = np.empty((pts.shape[0],))
+        cdef double[::1] tt_view = tt
+        if vpts.size() > 0:
+            self.grid.getTraveltimes(vpts, &tt_view[0], thread_no)
         return tt
 
     def set_slowness(self, slowness):
@@ -921,6 +1636,7 @@ cdef class Mesh2d:
 
         if not slowness.flags['C_CONTIGUOUS']:
             slowness = np.ascontiguousarray(slowness)
+        slowness = self._to_internal(slowness.flatten(), self.cell_slowness)
 
         cdef vector[double] slown
         cdef int i
@@ -943,6 +1659,7 @@ cdef class Mesh2d:
 
         if not velocity.flags['C_CONTIGUOUS']:
             velocity = np.ascontiguousarray(velocity)
+        velocity = self._to_internal(velocity.flatten(), self.cell_slowness)
 
         cdef vector[double] slown
         cdef int i
@@ -1177,10 +1894,12 @@ cdef class Mesh2d:
                 scalar.SetNumberOfComponents(1)
                 scalar.SetNumberOfTuples(data.size)
                 if data.size == self.get_number_of_nodes():
+                    data = self._to_internal(data.flatten(), False)
                     for n in range(data.size):
                         scalar.SetTuple1(n, data[n])
                     ugrid.GetPointData().AddArray(scalar)
                 elif data.size == self.get_number_of_cells():
+                    data = self._to_internal(data.flatten(), True)
                     for n in range(data.size):
                         scalar.SetTuple1(n, data[n])
                     ugrid.GetCellData().AddArray(scalar)
@@ -1289,20 +2008,373 @@ cdef class Mesh2d:
         return m
 
 
-def _rebuild3d(constructor_params):
+cdef class Mesh2ds:
+    """class to perform raytracing on undulated surfaces
+
+    The surface is described by triangles whose nodes have 3D coordinates,
+    and waves travel along the surface.  Traveltimes are computed with the
+    shortest path method.
+
+    Constructor:
+
+    Mesh2ds(nodes, triangles, n_threads, cell_slowness, n_secondary)
+
+        Parameters
+        ----------
+        nodes : np.ndarray, shape (nnodes, 3)
+            node coordinates
+        triangles : np.ndarray of int, shape (ntriangles, 3)
+            indices of nodes forming the triangles
+        n_threads : int
+            number of threads for raytracing (default is 1)
+        cell_slowness : bool
+            slowness defined for cells (True) or nodes (False) (default is 1)
+        n_secondary : int
+            number of secondary nodes (default is 5)
+
+    """
+    cdef bool cell_slowness
+    cdef size_t _n_threads
+    cdef uint32_t n_secondary
+    cdef vector[sxyz[double]] no
+    cdef vector[triangleElem[uint32_t]] tri
+    cdef Grid2D[double, uint32_t, sxyz[double]]* grid
+
+    def __cinit__(self, np.ndarray[np.double_t, ndim=2] nodes,
+                  np.ndarray[np.int64_t, ndim=2] triangles,
+                  size_t n_threads=1, bool cell_slowness=1,
+                  uint32_t n_secondary=5):
+
+        self.cell_slowness = cell_slowness
+        self._n_threads = n_threads
+        self.n_secondary = n_secondary
+
+        cdef int n
+        for n in range(nodes.shape[0]):
+            self.no.push_back(sxyz[double](nodes[n, 0],
+                                           nodes[n, 1],
+                                           nodes[n, 2]))
+        for n in range(triangles.shape[0]):
+            self.tri.push_back(triangleElem[uint32_t](triangles[n, 0],
+                                                      triangles[n, 1],
+                                                      triangles[n, 2]))
+
+        if cell_slowness:
+            self.grid = new Grid2Ducsp[double,uint32_t,Node3Dcsp[double,uint32_t],sxyz[double]](self.no,
+                                                                                                self.tri,
+                                                                                                n_secondary,
+                                                                                                n_threads)
+        else:
+            self.grid = new Grid2Dunsp[double,uint32_t,Node3Dnsp[double,uint32_t],sxyz[double]](self.no,
+                                                                                                self.tri,
+                                                                                                n_secondary,
+                                                                                                n_threads)
+
+    def __dealloc__(self):
+        del self.grid
+
+    def __reduce__(self):
+        nodes = np.ndarray((self.no.size(), 3))
+        triangles = np.ndarray((self.tri.size(), 3), dtype=np.int64)
+        cdef int n
+        cdef int nn
+        for n in range(nodes.shape[0]):
+            nodes[n, 0] = self.no[n].x
+            nodes[n, 1] = self.no[n].y
+            nodes[n, 2] = self.no[n].z
+        for n in range(triangles.shape[0]):
+            for nn in range(3):
+                triangles[n, nn] = self.tri[n].i[nn]
+
+        constructor_params = (nodes, triangles, self._n_threads,
+                              self.cell_slowness, self.n_secondary)
+        return (_rebuild2ds, (constructor_params,))
+
+    @property
+    def n_threads(self):
+        """int: number of threads for raytracing"""
+        return self._n_threads
+
+    @property
+    def nparams(self):
+        """int: total number of parameters for mesh"""
+        if self.cell_slowness:
+            return self.tri.size()
+        else:
+            return self.no.size()
+
+    def get_number_of_nodes(self):
+        """
+        Returns
+        -------
+        int:
+            number of nodes in grid
+        """
+        return self.no.size()
+
+    def get_number_of_cells(self):
+        """
+        Returns
+        -------
+        int:
+            number of cells in grid
+        """
+        return self.tri.size()
+
+    def get_grid_traveltimes(self, thread_no=0):
+        """
+        get_grid_traveltimes(thread_no=0)
+
+        Obtain traveltimes computed at primary grid nodes
+
+        Parameters
+        ----------
+        thread_no : int
+            thread used to computed traveltimes (default is 0)
+
+        Returns
+        -------
+        tt: np ndarray, shape (nnodes,)
+            traveltimes
+        """
+        if thread_no >= self._n_threads:
+            raise ValueError('Thread number is larger than number of threads')
+        cdef vector[double] tmp
+        cdef int n
+        self.grid.getTT(tmp, thread_no)
+        tt = np.empty((tmp.size(),))
+        for n in range(tmp.size()):
+            tt[n] = tmp[n]
+        return tt
+
+    def set_slowness(self, slowness):
+        """
+        set_slowness(slowness)
+
+        Assign slowness to grid
+
+        Parameters
+        ----------
+        slowness : np ndarray, shape (nparams, )
+        """
+        if slowness.size != self.nparams:
+            raise ValueError('Slowness vector has wrong size')
+
+        if not slowness.flags['C_CONTIGUOUS']:
+            slowness = np.ascontiguousarray(slowness)
+        slowness = slowness.flatten()
+
+        cdef vector[double] slown
+        cdef int i
+        for i in range(slowness.size):
+            slown.push_back(slowness[i])
+        self.grid.setSlowness(slown)
+
+    def set_velocity(self, velocity):
+        """
+        set_velocity(velocity)
+
+        Assign velocity to grid
+
+        Parameters
+        ----------
+        velocity : np ndarray, shape (nparams, )
+        """
+        if velocity.size != self.nparams:
+            raise ValueError('velocity vector has wrong size')
+
+        if not velocity.flags['C_CONTIGUOUS']:
+            velocity = np.ascontiguousarray(velocity)
+        velocity = velocity.flatten()
+
+        cdef vector[double] slown
+        cdef int i
+        for i in range(velocity.size):
+            slown.push_back(1./velocity[i])
+        self.grid.setSlowness(slown)
+
+    def raytrace(self, source, rcv, slowness=None, thread_no=None,
+                 aggregate_src=False, return_rays=False):
+        """
+        raytrace(source, rcv, slowness=None, thread_no=None,
+              aggregate_src=False, return_rays=False) -> tt, rays
+
+        Perform raytracing
+
+        Parameters
+        ----------
+        source : 2D np.ndarray with 3 or 4 columns
+            see notes below
+        rcv : 2D np.ndarray with 3 columns
+            Columns correspond to x, y and z coordinates
+        slowness : np ndarray, (None by default)
+            slowness at grid nodes or cells (depending on cell_slowness)
+            if None, slowness must have been assigned previously
+        thread_no : int (None by default)
+            Perform calculations in thread number "thread_no"
+            if None, the sources are distributed over the threads
+        aggregate_src : bool (False by default)
+            if True, all source coordinates belong to a single event
+        return_rays : bool (False by default)
+            Return raypaths
+
+        Returns
+        -------
+        tt : np.ndarray
+            travel times for the appropriate source-rcv  (see Notes below)
+        rays : :obj:`list` of :obj:`np.ndarray`
+            Coordinates of segments forming raypaths (if return_rays is True)
+
+        Notes
+        -----
+        If source has 3 columns:
+            - Columns correspond to x, y and z coordinates
+            - Origin time (t0) is 0 for all points
+        If source has 4 columns:
+            - 1st column corresponds to origin times
+            - 2nd, 3rd & 4th columns correspond to x, y and z coordinates
+
+        Sources and receivers should lie on the surface.
+
+        source and rcv can contain the same number of rows, each row
+        corresponding to a source-receiver pair, or the number of rows may
+        differ if aggregate_src is True or if all rows in source are identical.
+        """
+
+        # check input data consistency
+
+        if source.ndim != 2 or rcv.ndim != 2:
+            raise ValueError('source and rcv should be 2D arrays')
+
+        if source.shape[1] == 3:
+            src = source
+            Tx = np.unique(source, axis=0)
+            t0 = np.zeros((Tx.shape[0], 1))
+            nTx = Tx.shape[0]
+        elif source.shape[1] == 4:
+            src = source[:,1:4]
+            tmp = np.unique(source, axis=0)
+            nTx = tmp.shape[0]
+            Tx = tmp[:,1:4]
+            t0 = tmp[:,0]
+        else:
+            raise ValueError('source should be either nsrc x 3 or 4')
+
+        if src.shape[1] != 3 or rcv.shape[1] != 3:
+            raise ValueError('src and rcv should be ndata x 3')
+
+        if thread_no is not None and thread_no >= self._n_threads:
+            raise ValueError('Thread number is larger than number of threads')
+
+        if slowness is not None:
+            self.set_slowness(slowness)
+
+        cdef vector[vector[sxyz[double]]] vTx
+        cdef vector[vector[sxyz[double]]] vRx
+        cdef vector[vector[double]] vt0
+        cdef vector[vector[double]] vtt
+
+        cdef vector[vector[vector[sxyz[double]]]] r_data
+        cdef size_t thread_nb
+
+        cdef int n, n2, nt
+
+        vTx.resize(nTx)
+        vRx.resize(nTx)
+        vt0.resize(nTx)
+        vtt.resize(nTx)
+        if return_rays:
+            r_data.resize(nTx)
+
+        iRx = []
+        if nTx == 1:
+            vTx[0].push_back(sxyz[double](src[0,0], src[0,1], src[0,2]))
+            for r in rcv:
+                vRx[0].push_back(sxyz[double](r[0], r[1], r[2]))
+            vt0[0].push_back(t0[0])
+            vtt[0].resize(rcv.shape[0])
+            iRx.append(np.arange(rcv.shape[0]))
+        elif aggregate_src:
+            for t in Tx:
+                vTx[0].push_back(sxyz[double](t[0], t[1], t[2]))
+            for t in t0:
+                vt0[0].push_back(t)
+            for r in rcv:
+                vRx[0].push_back(sxyz[double](r[0], r[1], r[2]))
+            vtt[0].resize(rcv.shape[0])
+            nTx = 1
+            vTx.resize(1)
+            vRx.resize(1)
+            vt0.resize(1)
+            vtt.resize(1)
+            if return_rays:
+                r_data.resize(1)
+            iRx.append(np.arange(rcv.shape[0]))
+        else:
+            if src.shape != rcv.shape:
+                raise ValueError('src and rcv should be of equal size')
+
+            for n in range(nTx):
+                ind = np.sum(Tx[n,:] == src, axis=1) == 3
+                iRx.append(np.nonzero(ind)[0])
+                vTx[n].push_back(sxyz[double](Tx[n,0], Tx[n,1], Tx[n,2]))
+                vt0[n].push_back(t0[n])
+                for r in rcv[ind,:]:
+                    vRx[n].push_back(sxyz[double](r[0], r[1], r[2]))
+                vtt[n].resize(vRx[n].size())
+
+        if thread_no is not None:
+            thread_nb = thread_no
+            for n in range(nTx):
+                if return_rays:
+                    self.grid.raytrace(vTx[n], vt0[n], vRx[n], vtt[n], r_data[n], thread_nb)
+                else:
+                    self.grid.raytrace(vTx[n], vt0[n], vRx[n], vtt[n], thread_nb)
+        elif return_rays:
+            raytraceBatch(self.grid[0], vTx, vt0, vRx, vtt, &r_data, self._n_threads)
+        else:
+            raytraceBatch(self.grid[0], vTx, vt0, vRx, vtt, self._n_threads)
+
+        tt = np.zeros((rcv.shape[0],))
+        for n in range(nTx):
+            for nt in range(vtt[n].size()):
+                tt[iRx[n][nt]] = vtt[n][nt]
+
+        if return_rays:
+            rays = [ [0.0] for n in range(rcv.shape[0])]
+            for n in range(nTx):
+                for n2 in range(vRx[n].size()):
+                    r = np.empty((r_data[n][n2].size(), 3))
+                    for nn in range(r_data[n][n2].size()):
+                        r[nn, 0] = r_data[n][n2][nn].x
+                        r[nn, 1] = r_data[n][n2][nn].y
+                        r[nn, 2] = r_data[n][n2][nn].z
+                    rays[iRx[n][n2]] = r
+            return tt, rays
+        else:
+            return tt
+
+
+def _rebuild3d(constructor_params, snapshot=None):
     (nodes, tetra, method, cell_slowness, n_threads, tt_from_rp, interp_vel, eps,
      maxit, gradient_method, min_dist, n_secondary, n_tertiary,
-     radius_tertiary) = constructor_params
+     radius_tertiary, factored, reorder) = constructor_params
 
     g = Mesh3d(nodes, tetra, n_threads, cell_slowness, method, gradient_method,
                tt_from_rp, interp_vel, eps, maxit, min_dist, n_secondary,
-               n_tertiary, radius_tertiary)
+               n_tertiary, radius_tertiary, snapshot, factored, reorder)
     return g
 
 def _rebuild2d(constructor_params):
     (nodes, triangles, method, cell_slowness, n_threads, eps, maxit,
-     process_obtuse, n_secondary) = constructor_params
+     process_obtuse, n_secondary, reorder) = constructor_params
 
     g = Mesh2d(nodes, triangles, n_threads, cell_slowness, method, eps, maxit,
-        process_obtuse, n_secondary)
+        process_obtuse, n_secondary, reorder)
+    return g
+
+def _rebuild2ds(constructor_params):
+    (nodes, triangles, n_threads, cell_slowness, n_secondary) = constructor_params
+
+    g = Mesh2ds(nodes, triangles, n_threads, cell_slowness, n_secondary)
     return g